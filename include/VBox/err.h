@@ -584,6 +584,9 @@
 /** Internal processing error in the PGM physial page mapping code dealing
  * with MMIO2 pages. */
 #define VERR_PGM_PHYS_PAGE_MAP_MMIO2_IPE        (-1684)
+/** A page missing after a post-copy teleportation could not be obtained
+ * from the source. */
+#define VERR_PGM_POST_COPY_PAGE_NOT_RECEIVED    (-1685)
 /** @} */
 
 
@@ -1597,6 +1600,8 @@
 #define VERR_VD_DMG_XML_PARSE_ERROR                 (-3284)
 /** Unable to locate a usable DMG file within the XAR archive. */
 #define VERR_VD_DMG_NOT_FOUND_INSIDE_XAR            (-3285)
+/** Dedup: Invalid image or block store header. */
+#define VERR_VD_DEDUP_INVALID_HEADER                (-3286)
 /** @} */
 
 
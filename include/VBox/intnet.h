@@ -135,8 +135,10 @@ typedef struct INTNETBUF
     STAMCOUNTER     cStatLost;
     /** Number of bad frames (both rings). */
     STAMCOUNTER     cStatBadFrames;
+    /** Number of receive wakeups skipped because nobody was waiting. */
+    STAMCOUNTER     cStatRecvWakeupsSkipped;
     /** Reserved for future use. */
-    STAMCOUNTER     aStatReserved[2];
+    STAMCOUNTER     aStatReserved[1];
     /** Reserved for future send profiling. */
     STAMPROFILE     StatSend1;
     /** Reserved for future send profiling. */
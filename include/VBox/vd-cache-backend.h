@@ -29,6 +29,14 @@
 #include <VBox/vd.h>
 #include <VBox/vd-ifs-internal.h>
 
+/** @name VBox HDD cache backend write flags
+ * @{
+ */
+/** The data comes from the guest. Without this flag the write fills the
+ * cache with data read from the image. */
+#define VD_CACHE_WRITE_GUEST RT_BIT_32(0)
+/** @}*/
+
 /**
  * Cache format backend interface used by VBox HDD Container implementation.
  */
@@ -152,9 +160,13 @@ typedef struct VDCACHEBACKEND
      *                          that could be written in a full block write,
      *                          when prefixed/postfixed by the appropriate
      *                          amount of (previously read) padding data.
+     * @param   fWrite          Write flags, VD_CACHE_WRITE_XXX. For guest writes
+     *                          VERR_VD_BLOCK_FREE means the cache didn't take the
+     *                          data and it must be written to the image. Any
+     *                          clean copy of the range in the cache is invalidated.
      */
     DECLR3CALLBACKMEMBER(int, pfnWrite, (void *pBackendData, uint64_t uOffset, size_t cbWrite,
-                                         PVDIOCTX pIoCtx, size_t *pcbWriteProcess));
+                                         PVDIOCTX pIoCtx, size_t *pcbWriteProcess, uint32_t fWrite));
 
     /**
      * Flush data to disk.
@@ -311,6 +323,39 @@ typedef struct VDCACHEBACKEND
      *  VD_CAP_FILE and NULL otherwise. */
     DECLR3CALLBACKMEMBER(int, pfnComposeName, (PVDINTERFACE pConfig, char **pszName));
 
+    /**
+     * Returns the next range of dirty data to write back to the image.
+     * Optional, only for backends supporting write-back caching.
+     *
+     * @returns VBox status code.
+     * @retval  VERR_NOT_FOUND if there is nothing to write back. Without fAll
+     *          this is also returned if the cache thresholds aren't reached yet.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   fAll            Flag whether all dirty data should be written back
+     *                          regardless of the thresholds.
+     * @param   pvBuf           Where to store the data.
+     * @param   cbBuf           Size of the buffer.
+     * @param   puOffset        Where to store the offset of the range in the disk.
+     * @param   pcbDestage      Where to store the size of the range.
+     * @param   puCookie        Where to store the cookie to pass to pfnDestageComplete.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnDestageGet, (void *pBackendData, bool fAll, void *pvBuf, size_t cbBuf,
+                                              uint64_t *puOffset, size_t *pcbDestage, uint64_t *puCookie));
+
+    /**
+     * Completes writing back ranges returned by pfnDestageGet. Called after the
+     * data was written to the image and the image was flushed.
+     *
+     * @returns VBox status code.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   pauCookies      Array of cookies returned by pfnDestageGet.
+     * @param   cCookies        Number of cookies in the array.
+     * @param   rcDestage       Status code of the write back, the ranges stay
+     *                          dirty on failure.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnDestageComplete, (void *pBackendData, const uint64_t *pauCookies,
+                                                   unsigned cCookies, int rcDestage));
+
 } VDCACHEBACKEND;
 /** Pointer to VD cache backend. */
 typedef VDCACHEBACKEND *PVDCACHEBACKEND;
@@ -217,10 +217,18 @@ typedef struct VDINTERFACEIOINT
      * @param   uOffset        The offset to start reading from.
      * @param   pIoCtx         I/O context passed in the read/write callback.
      * @param   cbRead         How many bytes to read.
+     * @param   pfnCompleted   Completion callback.
+     * @param   pvCompleteUser Opaque user data passed in the completion callback.
+     *
+     * @notes The completion callback is invoked once after all data was
+     *        transfered, also if the request had to be split. It is not invoked
+     *        if the request completed already when this returns VINF_SUCCESS.
      */
     DECLR3CALLBACKMEMBER(int, pfnReadUser, (void *pvUser, PVDIOSTORAGE pStorage,
                                             uint64_t uOffset, PVDIOCTX pIoCtx,
-                                            size_t cbRead));
+                                            size_t cbRead,
+                                            PFNVDXFERCOMPLETED pfnComplete,
+                                            void *pvCompleteUser));
 
     /**
      * Initiate a write request for user data.
@@ -233,6 +241,8 @@ typedef struct VDINTERFACEIOINT
      * @param   cbWrite        How many bytes to write.
      * @param   pfnCompleted   Completion callback.
      * @param   pvCompleteUser Opaque user data passed in the completion callback.
+     *
+     * @notes See pfnReadUser().
      */
     DECLR3CALLBACKMEMBER(int, pfnWriteUser, (void *pvUser, PVDIOSTORAGE pStorage,
                                              uint64_t uOffset, PVDIOCTX pIoCtx,
@@ -509,7 +519,17 @@ DECLINLINE(int) vdIfIoIntFileReadUser(PVDINTERFACEIOINT pIfIoInt, PVDIOSTORAGE p
                                       uint64_t uOffset, PVDIOCTX pIoCtx, size_t cbRead)
 {
     return pIfIoInt->pfnReadUser(pIfIoInt->Core.pvUser, pStorage,
-                                 uOffset, pIoCtx, cbRead);
+                                 uOffset, pIoCtx, cbRead, NULL, NULL);
+}
+
+DECLINLINE(int) vdIfIoIntFileReadUserEx(PVDINTERFACEIOINT pIfIoInt, PVDIOSTORAGE pStorage,
+                                        uint64_t uOffset, PVDIOCTX pIoCtx, size_t cbRead,
+                                        PFNVDXFERCOMPLETED pfnComplete,
+                                        void *pvCompleteUser)
+{
+    return pIfIoInt->pfnReadUser(pIfIoInt->Core.pvUser, pStorage,
+                                 uOffset, pIoCtx, cbRead, pfnComplete,
+                                 pvCompleteUser);
 }
 
 DECLINLINE(int) vdIfIoIntFileWriteUser(PVDINTERFACEIOINT pIfIoInt, PVDIOSTORAGE pStorage,
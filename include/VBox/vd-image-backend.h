@@ -37,6 +37,11 @@
  * flag. The backend may still decide in some circumstances that it wants
  * to ignore this flag (which may cause extra dynamic image expansion). */
 #define VD_WRITE_NO_ALLOC   RT_BIT(1)
+/** The write is issued outside of the disk lock and may run concurrently
+ * with other reads and writes. The backend must not modify any metadata
+ * and has to return VERR_VD_BLOCK_FREE if the block is not allocated.
+ * Only used for backends which report VD_CAP_CONCURRENT_IO. */
+#define VD_WRITE_CONCURRENT RT_BIT(2)
 /** @}*/
 
 /** @name VBox HDD backend discard flags
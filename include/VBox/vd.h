@@ -307,6 +307,13 @@ DECLINLINE(uint32_t) VDOpenFlagsToFileOpenFlags(unsigned uOpenFlags, bool fCreat
 #define VD_CAP_VFS                  RT_BIT(9)
 /** The backend supports the discard operation. */
 #define VD_CAP_DISCARD              RT_BIT(10)
+/** The backend allows reads and writes to already allocated blocks to be
+ * issued concurrently from different threads without the generic disk lock.
+ * Such requests must not touch any metadata and VERR_VD_BLOCK_FREE must be
+ * returned for unallocated blocks when VD_WRITE_CONCURRENT is given.
+ * Metadata reads fail with VERR_VD_NOT_ENOUGH_METADATA for these requests,
+ * which is passed up to continue with the disk lock held. */
+#define VD_CAP_CONCURRENT_IO        RT_BIT(11)
 /** @}*/
 
 /** @name VBox HDD container type.
@@ -1267,6 +1274,36 @@ VBOXDDU_DECL(void) VDDumpImages(PVBOXHDD pDisk);
  */
 VBOXDDU_DECL(int) VDDiscardRanges(PVBOXHDD pDisk, PCRTRANGE paRanges, unsigned cRanges);
 
+/** Maximum size of a range processed by one VDCompactOnline() call. */
+#define VD_COMPACT_ONLINE_RANGE_MAX _4M
+
+/**
+ * Compacts the given range of the last image while the disk is in use.
+ *
+ * Blocks of the last image in the range which contain only zeros are freed
+ * and the image file shrinks accordingly. Partially used blocks are left
+ * alone, and only backends which can free blocks (pfnDiscard, currently VDI)
+ * are supported. The last image must have been opened with
+ * VD_OPEN_FLAGS_DISCARD. In contrast to VDCompact() this works
+ * on opened images with guest I/O going on. The range is processed with the
+ * disk locked, so it should be kept small to not stall guest I/O for too long.
+ * The caller is expected to walk over the disk in small steps and throttle
+ * the calls.
+ *
+ * @return  VBox status code.
+ * @return  VERR_TRY_AGAIN if there is I/O in flight, retry later.
+ * @return  VERR_VD_IMAGE_READ_ONLY if the last image is not writable.
+ * @return  VERR_NOT_SUPPORTED if the image backend can't free blocks or the
+ *          image was not opened with VD_OPEN_FLAGS_DISCARD.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   uOffset         Start offset of the range, sector aligned.
+ * @param   cbRange         Size of the range, at most VD_COMPACT_ONLINE_RANGE_MAX.
+ * @param   pcbReclaimed    Where to store the number of bytes the image file
+ *                          shrunk, optional.
+ */
+VBOXDDU_DECL(int) VDCompactOnline(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRange,
+                                  uint64_t *pcbReclaimed);
+
 
 /**
  * Start an asynchronous read request.
@@ -1288,6 +1325,9 @@ VBOXDDU_DECL(int) VDAsyncRead(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRead,
 /**
  * Start an asynchronous write request.
  *
+ * The data in the S/G buffer is never modified, so it may refer to memory
+ * shared with the guest. The buffer must stay valid until the request completes.
+ *
  * @return  VBox status code.
  * @param   pDisk           Pointer to the HDD container.
  * @param   uOffset         The offset of the virtual disk to write to.
@@ -164,9 +164,26 @@ typedef struct PDMINETWORKDOWN
      */
     DECLR3CALLBACKMEMBER(void, pfnXmitPending,(PPDMINETWORKDOWN pInterface));
 
+    /**
+     * Brackets a batch of frames passed up by pfnReceive and pfnReceiveGso.
+     *
+     * Leaf drivers that drain several frames in one go call this with
+     * fBegin=true before passing up the first frame and with fBegin=false after
+     * the last one, as well as before blocking in pfnWaitReceiveAvail.  This
+     * allows the device to make the frames visible to the guest right away
+     * while raising only a single receive interrupt for the whole batch.
+     *
+     * Optional, NULL if the device raises one interrupt per frame anyway.
+     *
+     * @param   pInterface      Pointer to this interface.
+     * @param   fBegin          true when a batch starts, false when it ends.
+     * @thread  Non-EMT.
+     */
+    DECLR3CALLBACKMEMBER(void, pfnNotifyReceiveBatch,(PPDMINETWORKDOWN pInterface, bool fBegin));
+
 } PDMINETWORKDOWN;
 /** PDMINETWORKDOWN interface ID. */
-#define PDMINETWORKDOWN_IID                     "52b8cdbb-a087-493b-baa7-81ec3b803e06"
+#define PDMINETWORKDOWN_IID                     "c93e0ef9-92ba-4ffb-9943-d8dc5c24960f"
 
 
 /**
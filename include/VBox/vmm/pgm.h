@@ -235,6 +235,23 @@ typedef DECLCALLBACK(int) FNPGMENUMDIRTYFTPAGES(PVM pVM, RTGCPHYS GCPhys, uint8_
 /** Pointer to PGMR3PhysEnumDirtyFTPages callback. */
 typedef FNPGMENUMDIRTYFTPAGES *PFNPGMENUMDIRTYFTPAGES;
 
+/**
+ * PGMR3PhysPostCopyStart callback for pulling a missing page from the
+ * teleportation source.
+ *
+ * The callback must not return successfully before the page has been passed
+ * to PGMR3PhysPostCopyPutPage.
+ *
+ * @returns VBox status code.  Failure is fatal to the VM.
+ * @param   pUVM            The user mode VM handle.
+ * @param   GCPhys          The guest physical address of the page.
+ * @param   pvUser          User argument.
+ * @thread  EMT, possibly several at once.
+ */
+typedef DECLCALLBACK(int) FNPGMPHYSPOSTCOPYREQUEST(PUVM pUVM, RTGCPHYS GCPhys, void *pvUser);
+/** Pointer to a PGMR3PhysPostCopyStart callback. */
+typedef FNPGMPHYSPOSTCOPYREQUEST *PFNPGMPHYSPOSTCOPYREQUEST;
+
 /**
  * Paging mode.
  */
@@ -474,6 +491,13 @@ VMMR3DECL(int)      PGMR3PhysGetRange(PVM pVM, uint32_t iRange, PRTGCPHYS pGCPhy
                                       const char **ppszDesc, bool *pfIsMmio);
 VMMR3DECL(int)      PGMR3QueryMemoryStats(PUVM pUVM, uint64_t *pcbTotalMem, uint64_t *pcbPrivateMem, uint64_t *pcbSharedMem, uint64_t *pcbZeroMem);
 VMMR3DECL(int)      PGMR3QueryGlobalMemoryStats(PUVM pUVM, uint64_t *pcbAllocMem, uint64_t *pcbFreeMem, uint64_t *pcbBallonedMem, uint64_t *pcbSharedMem);
+VMMR3DECL(int)      PGMR3QueryLiveSaveStats(PUVM pUVM, uint64_t *pcbDirtyMem, uint64_t *pcbDirtiedPerSec);
+VMMR3DECL(int)      PGMR3PhysPostCopyArm(PUVM pUVM);
+VMMR3DECL(int)      PGMR3PhysPostCopyReadPage(PUVM pUVM, PRTGCPHYS pGCPhys, void *pvPage);
+VMMR3DECL(uint32_t) PGMR3PhysPostCopyGetPending(PUVM pUVM);
+VMMR3DECL(int)      PGMR3PhysPostCopyStart(PUVM pUVM, PFNPGMPHYSPOSTCOPYREQUEST pfnRequest, void *pvUser);
+VMMR3DECL(int)      PGMR3PhysPostCopyPutPage(PUVM pUVM, RTGCPHYS GCPhys, void const *pvPage);
+VMMR3DECL(int)      PGMR3PhysPostCopyAbort(PUVM pUVM);
 
 VMMR3DECL(int)      PGMR3PhysMMIORegister(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS cb,
                                           R3PTRTYPE(PFNPGMR3PHYSHANDLER) pfnHandlerR3, RTR3PTR pvUserR3,
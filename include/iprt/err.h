@@ -1029,6 +1029,9 @@ RT_C_DECLS_END
 #define VERR_PATH_IS_NOT_RELATIVE           (-144)
 /** Zero length path. */
 #define VERR_PATH_ZERO_LENGTH               (-145)
+/** The async I/O context can't process requests on buffered files
+ *  asynchronously. */
+#define VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED (-146)
 /** @} */
 
 
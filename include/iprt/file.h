@@ -1159,10 +1159,22 @@ typedef struct RTFILEAIOLIMITS
     /** The alignment data buffers need to have.
      * 0 means no alignment restrictions. */
     uint32_t cbBufferAlignment;
+    /** Combination of RTFILEAIOLIMITS_F_*. */
+    uint32_t fFlags;
 } RTFILEAIOLIMITS;
 /** A pointer to a AIO limits structure. */
 typedef RTFILEAIOLIMITS *PRTFILEAIOLIMITS;
 
+/** @name RTFILEAIOLIMITS::fFlags
+ * @{ */
+/** Requests on files opened without RTFILE_O_NO_CACHE are processed
+ * asynchronously too and don't block in RTFileAioCtxSubmit().
+ * This is only a hint, a context can still lack this capability. Pass
+ * RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC to RTFileAioCtxCreate() to get one
+ * which is guaranteed to have it. */
+#define RTFILEAIOLIMITS_F_BUFFERED_ASYNC    RT_BIT_32(0)
+/** @} */
+
 /**
  * Returns the global limits for the AIO API.
  *
@@ -1287,6 +1299,9 @@ RTDECL(int) RTFileAioReqGetRC(RTFILEAIOREQ hReq, size_t *pcbTransferred);
  *       above.
  *
  * @returns IPRT status code.
+ * @retval  VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED if
+ *          RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC is given and the context
+ *          can't provide it.
  * @param   phAioCtx        Where to store the async I/O context handle.
  * @param   cAioReqsMax     How many async I/O requests the context should be capable
  *                          to handle. Pass RTFILEAIO_UNLIMITED_REQS if the
@@ -1305,8 +1320,14 @@ RTDECL(int) RTFileAioCtxCreate(PRTFILEAIOCTX phAioCtx, uint32_t cAioReqsMax,
  * even when there is none waiting currently, instead of returning
  * VERR_FILE_AIO_NO_REQUEST. */
 #define RTFILEAIOCTX_FLAGS_WAIT_WITHOUT_PENDING_REQUESTS RT_BIT_32(0)
+/** The context must process requests on files opened without
+ * RTFILE_O_NO_CACHE asynchronously. RTFileAioCtxCreate() fails with
+ * VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED instead of quietly creating a
+ * context which blocks on such requests. */
+#define RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC                RT_BIT_32(1)
 /** mask of valid flags. */
-#define RTFILEAIOCTX_FLAGS_VALID_MASK (RTFILEAIOCTX_FLAGS_WAIT_WITHOUT_PENDING_REQUESTS)
+#define RTFILEAIOCTX_FLAGS_VALID_MASK (  RTFILEAIOCTX_FLAGS_WAIT_WITHOUT_PENDING_REQUESTS \
+                                       | RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC)
 
 /**
  * Destroys an async I/O context.
@@ -1406,6 +1427,27 @@ RTDECL(int) RTFileAioCtxSubmit(RTFILEAIOCTX hAioCtx, PRTFILEAIOREQ pahReqs, size
 RTDECL(int) RTFileAioCtxWait(RTFILEAIOCTX hAioCtx, size_t cMinReqs, RTMSINTERVAL cMillies,
                              PRTFILEAIOREQ pahReqs, size_t cReqs, uint32_t *pcReqs);
 
+/**
+ * Registers a set of data buffers with an async I/O context.
+ *
+ * Requests whose data buffer lies completely within one of the registered
+ * buffers can be processed without mapping the buffer pages for every
+ * request. The set replaces any previously registered one.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_NOT_SUPPORTED if the host API has no support for this.
+ * @retval  VERR_FILE_AIO_BUSY if there are requests active on the context.
+ * @retval  VERR_OUT_OF_RANGE if the host can't handle that many buffers.
+ *
+ * @param   hAioCtx         The async I/O context handle.
+ * @param   paSegs          Array of buffers to register, the memory must stay
+ *                          valid until the context is destroyed or another
+ *                          set is registered.
+ * @param   cSegs           Number of buffers in the array, 0 to unregister
+ *                          all buffers.
+ */
+RTDECL(int) RTFileAioCtxRegisterBuffers(RTFILEAIOCTX hAioCtx, PCRTSGSEG paSegs, size_t cSegs);
+
 /**
  * Forces any RTFileAioCtxWait() call on another thread to return immediately.
  *
@@ -535,6 +535,7 @@
 # define RTFileAioCtxCreate                             RT_MANGLER(RTFileAioCtxCreate)
 # define RTFileAioCtxDestroy                            RT_MANGLER(RTFileAioCtxDestroy)
 # define RTFileAioCtxGetMaxReqCount                     RT_MANGLER(RTFileAioCtxGetMaxReqCount)
+# define RTFileAioCtxRegisterBuffers                    RT_MANGLER(RTFileAioCtxRegisterBuffers)
 # define RTFileAioCtxSubmit                             RT_MANGLER(RTFileAioCtxSubmit)
 # define RTFileAioCtxWait                               RT_MANGLER(RTFileAioCtxWait)
 # define RTFileAioCtxWakeup                             RT_MANGLER(RTFileAioCtxWakeup)
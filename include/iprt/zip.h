@@ -87,6 +87,8 @@ typedef enum RTZIPTYPE
     RTZIPTYPE_LZO,
     /* Zlib compression the data without zlib header. */
     RTZIPTYPE_ZLIB_NO_HEADER,
+    /** LZ4 block format compression (natively implemented in IPRT). */
+    RTZIPTYPE_LZ4,
     /** End of valid the valid compression types.  */
     RTZIPTYPE_END
 } RTZIPTYPE;
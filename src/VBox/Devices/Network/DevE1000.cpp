@@ -44,6 +44,8 @@
 
 #include "DevEEPROM.h"
 #include "DevE1000Phy.h"
+#include "DevE1000Itr.h"
+#include "DevE1000Rx.h"
 
 
 /* Options *******************************************************************/
@@ -64,9 +66,11 @@
  * E1K_ITR_ENABLED reduces the number of interrupts generated by E1000 if a
  * guest driver requested it by writing non-zero value to the Interrupt
  * Throttling Register (see section 13.4.18 in "8254x Family of Gigabit
- * Ethernet Controllers Software Developer’s Manual").
+ * Ethernet Controllers Software Developer’s Manual"). Interrupts coming too
+ * early are postponed via the late interrupt timer. Can be switched off at
+ * runtime with the "ItrEnabled" and "ItrRxEnabled" config keys.
  */
-//#define E1K_ITR_ENABLED
+#define E1K_ITR_ENABLED
 /** @def E1K_TX_DELAY
  * E1K_TX_DELAY aims to improve guest-host transfer rate for TCP streams by
  * preventing packets to be sent immediately. It allows to send several
@@ -100,9 +104,13 @@
  */
 //#define E1K_INT_STATS
 /** @def E1K_WITH_MSI
- * E1K_WITH_MSI enables rudimentary MSI support. Not implemented.
+ * E1K_WITH_MSI enables single vector MSI support. The capability is only
+ * exposed to the guest if the "MSI" config key is set and the chipset
+ * supports it.
  */
-//#define E1K_WITH_MSI
+#ifdef VBOX_WITH_MSI_DEVICES
+# define E1K_WITH_MSI
+#endif
 /** @def E1K_WITH_TX_CS
  * E1K_WITH_TX_CS protects e1kXmitPending with a critical section.
  */
@@ -231,14 +239,7 @@ static const struct E1kChips
 } g_Chips[] =
 {
     /* Vendor Device SSVendor SubSys  Name */
-    { 0x8086,
-      /* Temporary code, as MSI-aware driver dislike 0x100E. How to do that right? */
-#ifdef E1K_WITH_MSI
-      0x105E,
-#else
-      0x100E,
-#endif
-                      0x8086, 0x001E, "82540EM" }, /* Intel 82540EM-A in Intel PRO/1000 MT Desktop */
+    { 0x8086, 0x100E, 0x8086, 0x001E, "82540EM" }, /* Intel 82540EM-A in Intel PRO/1000 MT Desktop */
     { 0x8086, 0x1004, 0x8086, 0x1004, "82543GC" }, /* Intel 82543GC   in Intel PRO/1000 T  Server */
     { 0x8086, 0x100F, 0x15AD, 0x0750, "82545EM" }  /* Intel 82545EM-A in VMWare Network Adapter */
 };
@@ -1083,8 +1084,12 @@ struct E1kState_st
     bool        fRCEnabled;
     /** EMT: Compute Ethernet CRC for RX packets. */
     bool        fEthernetCRC;
-
-    bool        Alignment2[3];
+    /** EMT: Honor the interrupt rate the guest programmed into ITR. */
+    bool        fItrEnabled;
+    /** EMT: Throttle RX interrupts (RXT0) too, not only the other causes. */
+    bool        fItrRxEnabled;
+    /** EMT: MSI capability exposed and registered with the PCI bus. */
+    bool        fMsiEnabled;
     /** Link up delay (in milliseconds). */
     uint32_t    cMsLinkUpDelay;
 
@@ -1207,6 +1212,7 @@ struct E1kState_st
     STAMCOUNTER                         StatLateInts;
     STAMCOUNTER                         StatIntsRaised;
     STAMCOUNTER                         StatIntsPrevented;
+    STAMCOUNTER                         StatIntsThrottled;
     STAMPROFILEADV                      StatReceive;
     STAMPROFILEADV                      StatReceiveCRC;
     STAMPROFILEADV                      StatReceiveFilter;
@@ -1906,15 +1912,26 @@ static int e1kRaiseInterrupt(PE1KSTATE pThis, int rcBusy, uint32_t u32IntCause =
         {
 #ifdef E1K_ITR_ENABLED
             uint64_t tstamp = TMTimerGet(pThis->CTX_SUFF(pIntTimer));
-            /* interrupts/sec = 1 / (256 * 10E-9 * ITR) */
+            uint64_t u64Due = 0;
             E1kLog2(("%s e1kRaiseInterrupt: tstamp - pThis->u64AckedAt = %d, ITR * 256 = %d\n",
                         pThis->szPrf, (uint32_t)(tstamp - pThis->u64AckedAt), ITR * 256));
             //if (!!ITR && pThis->fIntMaskUsed && tstamp - pThis->u64AckedAt < ITR * 256)
-            if (!!ITR && tstamp - pThis->u64AckedAt < ITR * 256 && !(ICR & ICR_RXT0))
+            if (e1kItrApplies(pThis->fItrEnabled, pThis->fItrRxEnabled, !!(ICR & ICR_RXT0)))
+                u64Due = e1kItrCalcDue(ITR, pThis->u64AckedAt, tstamp);
+            if (u64Due)
             {
                 E1K_INC_ISTAT_CNT(pThis->uStatIntEarly);
                 E1kLog2(("%s e1kRaiseInterrupt: Too early to raise again: %d ns < %d ns.\n",
                         pThis->szPrf, (uint32_t)(tstamp - pThis->u64AckedAt), ITR * 256));
+                /*
+                 * Deliver it when the interval is over, all causes accumulated
+                 * in ICR until then are signalled with a single interrupt.
+                 */
+                if (!TMTimerIsActive(pThis->CTX_SUFF(pIntTimer)))
+                {
+                    STAM_COUNTER_INC(&pThis->StatIntsThrottled);
+                    TMTimerSet(pThis->CTX_SUFF(pIntTimer), u64Due);
+                }
             }
             else
 #endif
@@ -2146,18 +2163,27 @@ DECLINLINE(void) e1kRxDPut(PE1KSTATE pThis, E1KRXDESC* pDesc)
 /**
  * Store a fragment of received packet at the specifed address.
  *
+ * The fragment consists of the part of the frame followed by the part of the
+ * tail (FCS) that go into this buffer.
+ *
  * @param   pThis          The device state structure.
  * @param   pDesc           The next available RX descriptor.
  * @param   pvBuf           The fragment.
  * @param   cb              The size of the fragment.
+ * @param   pvTail          The tail part of the fragment.
+ * @param   cbTail          The size of the tail part, usually 0.
  */
-static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc, const void *pvBuf, size_t cb)
+static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc, const void *pvBuf, size_t cb,
+                                             const void *pvTail, size_t cbTail)
 {
     STAM_PROFILE_ADV_START(&pThis->StatReceiveStore, a);
-    E1kLog2(("%s e1kStoreRxFragment: store fragment of %04X at %016LX, EOP=%d\n",
-             pThis->szPrf, cb, pDesc->u64BufAddr, pDesc->status.fEOP));
-    PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pDesc->u64BufAddr, pvBuf, cb);
-    pDesc->u16Length = (uint16_t)cb;                        Assert(pDesc->u16Length == cb);
+    E1kLog2(("%s e1kStoreRxFragment: store fragment of %04X+%u at %016LX, EOP=%d\n",
+             pThis->szPrf, cb, cbTail, pDesc->u64BufAddr, pDesc->status.fEOP));
+    if (cb)
+        PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pDesc->u64BufAddr, pvBuf, cb);
+    if (cbTail)
+        PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pDesc->u64BufAddr + cb, pvTail, cbTail);
+    pDesc->u16Length = (uint16_t)(cb + cbTail);             Assert(pDesc->u16Length == cb + cbTail);
     STAM_PROFILE_ADV_STOP(&pThis->StatReceiveStore, a);
 }
 
@@ -2173,13 +2199,19 @@ static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc,
  * @param   pDesc           The next available RX descriptor.
  * @param   pvBuf           The fragment.
  * @param   cb              The size of the fragment.
+ * @param   pvTail          The tail part of the fragment (FCS).
+ * @param   cbTail          The size of the tail part, usually 0.
  */
-static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc, const void *pvBuf, size_t cb)
+static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc, const void *pvBuf, size_t cb,
+                                             const void *pvTail, size_t cbTail)
 {
     STAM_PROFILE_ADV_START(&pThis->StatReceiveStore, a);
-    E1kLog2(("%s e1kStoreRxFragment: store fragment of %04X at %016LX, EOP=%d\n", pThis->szPrf, cb, pDesc->u64BufAddr, pDesc->status.fEOP));
-    PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pDesc->u64BufAddr, pvBuf, cb);
-    pDesc->u16Length = (uint16_t)cb;                        Assert(pDesc->u16Length == cb);
+    E1kLog2(("%s e1kStoreRxFragment: store fragment of %04X+%u at %016LX, EOP=%d\n", pThis->szPrf, cb, cbTail, pDesc->u64BufAddr, pDesc->status.fEOP));
+    if (cb)
+        PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pDesc->u64BufAddr, pvBuf, cb);
+    if (cbTail)
+        PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pDesc->u64BufAddr + cb, pvTail, cbTail);
+    pDesc->u16Length = (uint16_t)(cb + cbTail);             Assert(pDesc->u16Length == cb + cbTail);
     /* Write back the descriptor */
     PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), e1kDescAddr(RDBAH, RDBAL, RDH), pDesc, sizeof(E1KRXDESC));
     e1kPrintRDesc(pThis, pDesc);
@@ -2291,7 +2323,10 @@ static int e1kRxChecksumOffload(PE1KSTATE pThis, const uint8_t *pFrame, size_t c
  * Pad and store received packet.
  *
  * @remarks Make sure that the packet appears to upper layer as one coming
- *          from real Ethernet: pad it and insert FCS.
+ *          from real Ethernet: pad it and insert FCS.  Unless the frame has to
+ *          be modified (VLAN tag stripping, padding) it is stored straight
+ *          from @a pvBuf, which usually points into the intnet ring, with the
+ *          FCS appended separately.
  *
  * @returns VBox status code.
  * @param   pThis          The device state structure.
@@ -2301,9 +2336,13 @@ static int e1kRxChecksumOffload(PE1KSTATE pThis, const uint8_t *pFrame, size_t c
  */
 static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KRXDST status)
 {
-#if defined(IN_RING3) /** @todo Remove this extra copying, it's gonna make us run out of kernel / hypervisor stack! */
-    uint8_t   rxPacket[E1K_MAX_RX_PKT_SIZE];
-    uint8_t  *ptr = rxPacket;
+#if defined(IN_RING3)
+    uint8_t         rxPacket[E1K_MAX_RX_PKT_SIZE];
+    const uint8_t  *ptr = rxPacket;
+    /* The FCS, stored after the frame data. */
+    uint32_t        u32Fcs = 0;
+    const uint8_t  *pbTail = (const uint8_t *)&u32Fcs;
+    size_t          cbTail = 0;
 
     int rc = e1kCsRxEnter(pThis, VERR_SEM_BUSY);
     if (RT_UNLIKELY(rc != VINF_SUCCESS))
@@ -2316,27 +2355,29 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     Assert(cb > 16);
     size_t cbMax = ((RCTL & RCTL_LPE) ? E1K_MAX_RX_PKT_SIZE - 4 : 1518) - (status.fVP ? 0 : 4);
     E1kLog3(("%s Max RX packet size is %u\n", pThis->szPrf, cbMax));
-    if (status.fVP)
+    if (status.fVP && (CTRL & CTRL_VME) && cb > 16)
     {
         /* VLAN packet -- strip VLAN tag in VLAN mode */
-        if ((CTRL & CTRL_VME) && cb > 16)
-        {
-            uint16_t *u16Ptr = (uint16_t*)pvBuf;
-            memcpy(rxPacket, pvBuf, 12); /* Copy src and dst addresses */
-            status.u16Special = RT_BE2H_U16(u16Ptr[7]); /* Extract VLAN tag */
-            memcpy(rxPacket + 12, (uint8_t*)pvBuf + 16, cb - 16); /* Copy the rest of the packet */
-            cb -= 4;
-            E1kLog3(("%s Stripped tag for VLAN %u (cb=%u)\n",
-                     pThis->szPrf, status.u16Special, cb));
-        }
-        else
-            status.fVP = false; /* Set VP only if we stripped the tag */
+        uint16_t *u16Ptr = (uint16_t*)pvBuf;
+        memcpy(rxPacket, pvBuf, 12); /* Copy src and dst addresses */
+        status.u16Special = RT_BE2H_U16(u16Ptr[7]); /* Extract VLAN tag */
+        memcpy(rxPacket + 12, (uint8_t*)pvBuf + 16, cb - 16); /* Copy the rest of the packet */
+        cb -= 4;
+        E1kLog3(("%s Stripped tag for VLAN %u (cb=%u)\n",
+                 pThis->szPrf, status.u16Special, cb));
     }
     else
-        memcpy(rxPacket, pvBuf, cb);
+    {
+        status.fVP = false; /* Set VP only if we stripped the tag */
+        if (cb < 60)
+            memcpy(rxPacket, pvBuf, cb);
+        else
+            ptr = (const uint8_t *)pvBuf; /* Store it as is, no need to copy. */
+    }
     /* Pad short packets */
     if (cb < 60)
     {
+        Assert(ptr == rxPacket);
         memset(rxPacket + cb, 0, 60 - cb);
         cb = 60;
     }
@@ -2349,14 +2390,15 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
          * of calculating it (see EthernetCRC CFGM parameter).
          */
         if (pThis->fEthernetCRC)
-            *(uint32_t*)(rxPacket + cb) = RTCrc32(rxPacket, cb);
-        cb += sizeof(uint32_t);
+            u32Fcs = RTCrc32(ptr, cb);
+        cbTail = sizeof(uint32_t);
         STAM_PROFILE_ADV_STOP(&pThis->StatReceiveCRC, a);
-        E1kLog3(("%s Added FCS (cb=%u)\n", pThis->szPrf, cb));
+        E1kLog3(("%s Added FCS (cb=%u)\n", pThis->szPrf, cb + cbTail));
     }
-    /* Compute checksum of complete packet */
-    uint16_t checksum = e1kCSum16(rxPacket + GET_BITS(RXCSUM, PCSS), cb);
-    e1kRxChecksumOffload(pThis, rxPacket, cb, &status);
+    /* Compute checksum of complete packet (excluding FCS) */
+    uint16_t checksum = cb > GET_BITS(RXCSUM, PCSS)
+                      ? e1kCSum16(ptr + GET_BITS(RXCSUM, PCSS), cb - GET_BITS(RXCSUM, PCSS)) : 0;
+    e1kRxChecksumOffload(pThis, ptr, cb, &status);
 
     /* Update stats */
     E1K_INC_CNT32(GPRC);
@@ -2365,17 +2407,18 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     else if (e1kIsMulticast(pvBuf))
         E1K_INC_CNT32(MPRC);
     /* Update octet receive counter */
-    E1K_ADD_CNT64(GORCL, GORCH, cb);
-    STAM_REL_COUNTER_ADD(&pThis->StatReceiveBytes, cb);
-    if (cb == 64)
+    size_t const cbTotal = cb + cbTail;
+    E1K_ADD_CNT64(GORCL, GORCH, cbTotal);
+    STAM_REL_COUNTER_ADD(&pThis->StatReceiveBytes, cbTotal);
+    if (cbTotal == 64)
         E1K_INC_CNT32(PRC64);
-    else if (cb < 128)
+    else if (cbTotal < 128)
         E1K_INC_CNT32(PRC127);
-    else if (cb < 256)
+    else if (cbTotal < 256)
         E1K_INC_CNT32(PRC255);
-    else if (cb < 512)
+    else if (cbTotal < 512)
         E1K_INC_CNT32(PRC511);
-    else if (cb < 1024)
+    else if (cbTotal < 1024)
         E1K_INC_CNT32(PRC1023);
     else
         E1K_INC_CNT32(PRC1522);
@@ -2383,7 +2426,7 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     E1K_INC_ISTAT_CNT(pThis->uStatRxFrm);
 
 #ifdef E1K_WITH_RXD_CACHE
-    while (cb > 0)
+    while (cb + cbTail > 0)
     {
         E1KRXDESC *pDesc = e1kRxDGet(pThis);
 
@@ -2391,7 +2434,7 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
         {
             E1kLog(("%s Out of receive buffers, dropping the packet "
                     "(cb=%u, in_cache=%u, RDH=%x RDT=%x)\n",
-                    pThis->szPrf, cb, e1kRxDInCache(pThis), RDH, RDT));
+                    pThis->szPrf, cb + cbTail, e1kRxDInCache(pThis), RDH, RDT));
             break;
         }
 #else /* !E1K_WITH_RXD_CACHE */
@@ -2423,27 +2466,32 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
              * e1kRegWriteRDT() never modifies RDH. It never touches already
              * fetched RxD cache entries either.
              */
-            if (cb > pThis->u16RxBSize)
+            size_t cbFrag;
+            size_t cbFragTail;
+            if (!e1kRxCalcFragment(cb, cbTail, pThis->u16RxBSize, &cbFrag, &cbFragTail))
             {
                 pDesc->status.fEOP = false;
                 e1kCsRxLeave(pThis);
-                e1kStoreRxFragment(pThis, pDesc, ptr, pThis->u16RxBSize);
+                e1kStoreRxFragment(pThis, pDesc, ptr, cbFrag, pbTail, cbFragTail);
                 rc = e1kCsRxEnter(pThis, VERR_SEM_BUSY);
                 if (RT_UNLIKELY(rc != VINF_SUCCESS))
                     return rc;
-                ptr += pThis->u16RxBSize;
-                cb -= pThis->u16RxBSize;
+                ptr    += cbFrag;
+                cb     -= cbFrag;
+                pbTail += cbFragTail;
+                cbTail -= cbFragTail;
             }
             else
             {
                 pDesc->status.fEOP = true;
                 e1kCsRxLeave(pThis);
-                e1kStoreRxFragment(pThis, pDesc, ptr, cb);
+                e1kStoreRxFragment(pThis, pDesc, ptr, cbFrag, pbTail, cbFragTail);
 #ifdef E1K_WITH_RXD_CACHE
                 rc = e1kCsRxEnter(pThis, VERR_SEM_BUSY);
                 if (RT_UNLIKELY(rc != VINF_SUCCESS))
                     return rc;
                 cb = 0;
+                cbTail = 0;
 #else /* !E1K_WITH_RXD_CACHE */
                 pThis->led.Actual.s.fReading = 0;
                 return VINF_SUCCESS;
@@ -2471,8 +2519,8 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
 #endif /* !E1K_WITH_RXD_CACHE */
     }
 
-    if (cb > 0)
-        E1kLog(("%s Out of receive buffers, dropping %u bytes", pThis->szPrf, cb));
+    if (cb + cbTail > 0)
+        E1kLog(("%s Out of receive buffers, dropping %u bytes", pThis->szPrf, cb + cbTail));
 
     pThis->led.Actual.s.fReading = 0;
 
@@ -7378,12 +7426,8 @@ static DECLCALLBACK(void) e1kConfigurePciDev(PPCIDEVICE pPciDev, E1KCHIP eChip)
     /* PCI-X Configuration Registers *****************************************/
     /* Capability ID: PCI-X Configuration Registers */
     PCIDevSetByte( pPciDev, 0xE4,          VBOX_PCI_CAP_ID_PCIX);
-#ifdef E1K_WITH_MSI
-    PCIDevSetByte( pPciDev, 0xE4 + 1,                      0x80);
-#else
-    /* Next Item Pointer: None (Message Signalled Interrupts are disabled) */
+    /* Next Item Pointer: None, e1kR3Construct links in MSI if enabled */
     PCIDevSetByte( pPciDev, 0xE4 + 1,                      0x00);
-#endif
     /* PCI-X Command: Enable Relaxed Ordering */
     PCIDevSetWord( pPciDev, 0xE4 + 2,        VBOX_PCI_X_CMD_ERO);
     /* PCI-X Status: 32-bit, 66MHz*/
@@ -7450,7 +7494,8 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
      */
     if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "AdapterType\0"
                                     "LineSpeed\0" "GCEnabled\0" "R0Enabled\0"
-                                    "EthernetCRC\0" "GSOEnabled\0" "LinkUpDelay\0"))
+                                    "EthernetCRC\0" "GSOEnabled\0" "LinkUpDelay\0"
+                                    "ItrEnabled\0" "ItrRxEnabled\0" "MSI\0"))
         return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
                                 N_("Invalid configuration for E1000 device"));
 
@@ -7495,6 +7540,21 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
         return PDMDEV_SET_ERROR(pDevIns, rc,
                                 N_("Configuration error: Failed to get the value of 'GSOEnabled'"));
 
+    rc = CFGMR3QueryBoolDef(pCfg, "ItrEnabled", &pThis->fItrEnabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'ItrEnabled'"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "ItrRxEnabled", &pThis->fItrRxEnabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'ItrRxEnabled'"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "MSI", &pThis->fMsiEnabled, false);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'MSI'"));
+
     rc = CFGMR3QueryU32Def(pCfg, "LinkUpDelay", (uint32_t*)&pThis->cMsLinkUpDelay, 5000); /* ms */
     if (RT_FAILURE(rc))
         return PDMDEV_SET_ERROR(pDevIns, rc,
@@ -7505,10 +7565,12 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     else if (pThis->cMsLinkUpDelay == 0)
         LogRel(("%s WARNING! Link up delay is disabled!\n", pThis->szPrf));
 
-    E1kLog(("%s Chip=%s LinkUpDelay=%ums EthernetCRC=%s GSO=%s R0=%s GC=%s\n", pThis->szPrf,
+    E1kLog(("%s Chip=%s LinkUpDelay=%ums EthernetCRC=%s GSO=%s ITR=%s RX ITR=%s R0=%s GC=%s\n", pThis->szPrf,
             g_Chips[pThis->eChip].pcszName, pThis->cMsLinkUpDelay,
             pThis->fEthernetCRC ? "on" : "off",
             pThis->fGSOEnabled ? "enabled" : "disabled",
+            pThis->fItrEnabled ? "enabled" : "disabled",
+            pThis->fItrRxEnabled ? "enabled" : "disabled",
             pThis->fR0Enabled ? "enabled" : "disabled",
             pThis->fRCEnabled ? "enabled" : "disabled"));
 
@@ -7550,14 +7612,25 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
         return rc;
 
 #ifdef E1K_WITH_MSI
-    PDMMSIREG MsiReg;
-    RT_ZERO(MsiReg);
-    MsiReg.cMsiVectors    = 1;
-    MsiReg.iMsiCapOffset  = 0x80;
-    MsiReg.iMsiNextOffset = 0x0;
-    MsiReg.fMsi64bit      = false;
-    rc = PDMDevHlpPCIRegisterMsi(pDevIns, &MsiReg);
-    AssertRCReturn(rc, rc);
+    if (pThis->fMsiEnabled)
+    {
+        PDMMSIREG MsiReg;
+        RT_ZERO(MsiReg);
+        MsiReg.cMsiVectors    = 1;
+        MsiReg.iMsiCapOffset  = 0x80;
+        MsiReg.iMsiNextOffset = 0x0;
+        MsiReg.fMsi64bit      = false;
+        rc = PDMDevHlpPCIRegisterMsi(pDevIns, &MsiReg);
+        if (RT_SUCCESS(rc))
+            /* Next Item Pointer of PCI-X: MSI */
+            PCIDevSetByte(&pThis->pciDevice, 0xE4 + 1, 0x80);
+        else
+        {
+            /* That's OK, we can work without MSI (e.g. on the PIIX3 chipset) */
+            LogRel(("%s MSI is not available (%Rrc), using INTA#\n", pThis->szPrf, rc));
+            pThis->fMsiEnabled = false;
+        }
+    }
 #endif
 
 
@@ -7723,6 +7796,7 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatLateInts,           STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of late interrupts",          "/Devices/E1k%d/LateInt/Occured", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatIntsRaised,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of raised interrupts",        "/Devices/E1k%d/Interrupts/Raised", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatIntsPrevented,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of prevented interrupts",     "/Devices/E1k%d/Interrupts/Prevented", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatIntsThrottled,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of interrupts postponed by ITR", "/Devices/E1k%d/Interrupts/Throttled", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceive,            STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive",                  "/Devices/E1k%d/Receive/Total", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveCRC,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive checksumming",     "/Devices/E1k%d/Receive/CRC", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveFilter,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive filtering",        "/Devices/E1k%d/Receive/Filter", iInstance);
@@ -0,0 +1,67 @@
+/* $Id: DevE1000Itr.h $ */
+/** @file
+ * DevE1000 - Intel 82540EM Ethernet Controller Emulation, interrupt throttling.
+ *
+ * Kept apart from the device so the testcase can check it directly.
+ */
+
+/*
+ * Copyright (C) 2007-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___DevE1000Itr_h
+#define ___DevE1000Itr_h
+
+#include <iprt/types.h>
+
+
+/**
+ * Checks whether interrupt throttling applies to an interrupt.
+ *
+ * @returns true if the interrupt is subject to ITR, false if it is raised
+ *          right away.
+ * @param   fItrEnabled         Whether ITR is honored at all ("ItrEnabled").
+ * @param   fItrRxEnabled       Whether receive interrupts are throttled too
+ *                              ("ItrRxEnabled").
+ * @param   fRxCause            Whether the receive timer cause (RXT0) is
+ *                              pending.
+ */
+DECLINLINE(bool) e1kItrApplies(bool fItrEnabled, bool fItrRxEnabled, bool fRxCause)
+{
+    return fItrEnabled && (fItrRxEnabled || !fRxCause);
+}
+
+
+/**
+ * Calculates when the next interrupt may be raised according to the interval
+ * the guest programmed into ITR.
+ *
+ * All times are in nanoseconds of the virtual clock, which is what the late
+ * interrupt timer runs on.
+ *
+ * @returns The time the interrupt is due at, 0 if it may be raised now.
+ * @param   uItr                The ITR register, the minimum interval between
+ *                              interrupts in 256 ns units, 0 for no limit.
+ * @param   u64AckedAt          When the guest acknowledged the last interrupt
+ *                              by reading ICR.
+ * @param   u64Now              The current time.
+ */
+DECLINLINE(uint64_t) e1kItrCalcDue(uint32_t uItr, uint64_t u64AckedAt, uint64_t u64Now)
+{
+    /* interrupts/sec = 1 / (256 * 10E-9 * ITR) */
+    uint64_t const cNsInterval = (uint64_t)uItr * 256;
+    if (   !cNsInterval
+        || u64Now - u64AckedAt >= cNsInterval)
+        return 0;
+    return u64AckedAt + cNsInterval;
+}
+
+#endif
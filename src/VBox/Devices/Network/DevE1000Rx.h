@@ -0,0 +1,57 @@
+/* $Id: DevE1000Rx.h $ */
+/** @file
+ * DevE1000 - Intel 82540EM Ethernet Controller Emulation, receive buffer fill.
+ *
+ * Kept apart from the device so the testcase can check it directly.
+ */
+
+/*
+ * Copyright (C) 2007-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___DevE1000Rx_h
+#define ___DevE1000Rx_h
+
+#include <iprt/types.h>
+#include <iprt/cdefs.h>
+
+
+/**
+ * Works out how much of a received frame and of its tail (FCS) goes into the
+ * next receive buffer.
+ *
+ * The frame is stored first, the tail right after it, so the tail may be
+ * split between two buffers just like it would be if it were part of the
+ * frame.
+ *
+ * @returns true if this is the last buffer of the frame (EOP), false if not.
+ * @param   cb                  The number of frame bytes left to store.
+ * @param   cbTail              The number of tail bytes left to store.
+ * @param   cbBuf               The receive buffer size.
+ * @param   pcbFrag             Where to return the number of frame bytes going
+ *                              into this buffer.
+ * @param   pcbFragTail         Where to return the number of tail bytes going
+ *                              into this buffer.
+ */
+DECLINLINE(bool) e1kRxCalcFragment(size_t cb, size_t cbTail, size_t cbBuf, size_t *pcbFrag, size_t *pcbFragTail)
+{
+    if (cb + cbTail > cbBuf)
+    {
+        *pcbFrag     = RT_MIN(cb, cbBuf);
+        *pcbFragTail = cbBuf - *pcbFrag;
+        return false;
+    }
+    *pcbFrag     = cb;
+    *pcbFragTail = cbTail;
+    return true;
+}
+
+#endif
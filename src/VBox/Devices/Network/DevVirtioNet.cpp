@@ -35,6 +35,7 @@
 #endif /* IN_RING3 */
 #include "VBoxDD.h"
 #include "../VirtIO/Virtio.h"
+#include "DevVirtioNetMQ.h"
 
 
 /*******************************************************************************
@@ -89,6 +90,7 @@
 #define VNET_F_CTRL_VQ    0x00020000  /**< Control channel available */
 #define VNET_F_CTRL_RX    0x00040000  /**< Control channel RX mode support */
 #define VNET_F_CTRL_VLAN  0x00080000  /**< Control channel VLAN filtering */
+#define VNET_F_MQ         0x00400000  /**< Device supports multiple RX/TX queue pairs */
 /** @} */
 
 #define VNET_S_LINK_UP    1
@@ -105,8 +107,42 @@ struct __attribute__ ((__packed__)) VNetPCIConfig /** @todo r=bird: Use #pragma
 {
     RTMAC    mac;
     uint16_t uStatus;
+    uint16_t uMaxVirtqueuePairs;
 };
 AssertCompileMemberOffset(struct VNetPCIConfig, uStatus, 6);
+AssertCompileMemberOffset(struct VNetPCIConfig, uMaxVirtqueuePairs, 8);
+
+/**
+ * RX/TX queue pair state.
+ *
+ * Each pair has its own locks, so the receive path and the transmit paths of
+ * different pairs do not serialize on the device critical section.
+ */
+typedef struct VNetQueuePair
+{
+    /** Protects the RX queue. */
+    PDMCRITSECT             csRx;
+    /** Protects the TX queue, held by the thread transmitting from it. */
+    PDMCRITSECT             csTx;
+
+    STAMCOUNTER             StatReceivePackets;
+    STAMCOUNTER             StatTransmitPackets;
+
+    R3PTRTYPE(PVQUEUE)      pRxQueue;
+    R3PTRTYPE(PVQUEUE)      pTxQueue;
+    /** TX worker thread, only used in multi-queue configurations. */
+    R3PTRTYPE(PPDMTHREAD)   pTxThread;
+    /** Wakes up the TX worker thread. */
+    R3PTRTYPE(RTSEMEVENT)   hTxEvent;
+    /** Set when the TX worker has to look at the TX queue. */
+    bool volatile           fTxPending;
+    /** Set when frames were put on the RX queue during a receive batch and the
+     * guest has not been notified yet.  Protected by csRx. */
+    bool                    fRxNotifyPending;
+    bool                    afAlignment[6];
+} VNETQUEUEPAIR;
+/** Pointer to a RX/TX queue pair. */
+typedef VNETQUEUEPAIR *PVNETQUEUEPAIR;
 
 /**
  * Device state structure. Holds the current state of device.
@@ -156,9 +192,6 @@ typedef struct VNetState_st
     uint64_t                u64NanoTS;
 #endif /* VNET_TX_DELAY */
 
-    /** Indicates transmission in progress -- only one thread is allowed. */
-    uint32_t                uIsTransmitting;
-
     /** PCI config area holding MAC address as well as TBD. */
     struct VNetPCIConfig    config;
     /** MAC address obtained from the configuration. */
@@ -180,6 +213,9 @@ typedef struct VNetState_st
     bool                    fPromiscuous;
     /** AllMulti mode -- RX filter accepts all multicast packets. */
     bool                    fAllMulti;
+    /** Set while the driver below is passing up a batch of frames, see
+     * PDMINETWORKDOWN::pfnNotifyReceiveBatch.  RX thread only. */
+    bool                    fRxBatch;
     /** The number of actually used slots in aMacTable. */
     uint32_t                nMacFilterEntries;
     /** Array of MAC addresses accepted by RX filter. */
@@ -187,9 +223,6 @@ typedef struct VNetState_st
     /** Bit array of VLAN filter, one bit per VLAN ID. */
     uint8_t                 aVlanFilter[VNET_MAX_VID / sizeof(uint8_t)];
 
-    R3PTRTYPE(PVQUEUE)      pRxQueue;
-    R3PTRTYPE(PVQUEUE)      pTxQueue;
-    R3PTRTYPE(PVQUEUE)      pCtlQueue;
     /* Receive-blocking-related fields ***************************************/
 
     /** EMT: Gets signalled when more RX descriptors become available. */
@@ -203,6 +236,8 @@ typedef struct VNetState_st
     STAMCOUNTER             StatTransmitPackets;
     STAMCOUNTER             StatTransmitGSO;
     STAMCOUNTER             StatTransmitCSum;
+    STAMCOUNTER             StatReceiveSteerFallback;
+    STAMCOUNTER             StatReceiveCoalesced;
 #if defined(VBOX_WITH_STATISTICS)
     STAMPROFILE             StatReceive;
     STAMPROFILE             StatReceiveStore;
@@ -212,6 +247,15 @@ typedef struct VNetState_st
     STAMCOUNTER             StatRxOverflowWakeup;
 #endif /* VBOX_WITH_STATISTICS */
     /** @}  */
+
+    /** Number of configured RX/TX queue pairs. */
+    uint32_t                cMaxQueuePairs;
+    /** Number of queue pairs enabled by the guest (VNET_CTRL_CMD_MQ_VQ_PAIRS_SET). */
+    uint32_t volatile       cActiveQueuePairs;
+    /** RSS indirection table mapping flow hashes to queue pairs. */
+    uint8_t                 au8RssTable[VNET_RSS_TABLE_SIZE];
+    /** The RX/TX queue pairs. */
+    VNETQUEUEPAIR           aQueuePairs[VNET_MAX_QUEUE_PAIRS];
 } VNETSTATE;
 /** Pointer to a virtual I/O network device state. */
 typedef VNETSTATE *PVNETSTATE;
@@ -249,6 +293,8 @@ typedef VNETHDRMRX *PVNETHDRMRX;
 AssertCompileSize(VNETHDRMRX, 12);
 
 AssertCompileMemberOffset(VNETSTATE, VPCI, 0);
+AssertCompileMemberAlignment(VNETSTATE, aQueuePairs, 8);
+AssertCompile(VNET_MAX_QUEUE_PAIRS * 2 + 1 <= VIRTIO_MAX_NQUEUES);
 
 #define VNET_OK                    0
 #define VNET_ERROR                 1
@@ -265,6 +311,9 @@ typedef uint8_t VNETCTLACK;
 #define VNET_CTRL_CMD_VLAN_ADD         0
 #define VNET_CTRL_CMD_VLAN_DEL         1
 
+#define VNET_CTRL_CLS_MQ               4
+#define VNET_CTRL_CMD_MQ_VQ_PAIRS_SET  0
+
 
 struct VNetCtlHdr
 {
@@ -291,18 +340,73 @@ DECLINLINE(void) vnetCsLeave(PVNETSTATE pThis)
     vpciCsLeave(&pThis->VPCI);
 }
 
-DECLINLINE(int) vnetCsRxEnter(PVNETSTATE pThis, int rcBusy)
+DECLINLINE(int) vnetCsRxEnter(PVNETQUEUEPAIR pPair, int rcBusy)
+{
+    return PDMCritSectEnter(&pPair->csRx, rcBusy);
+}
+
+DECLINLINE(void) vnetCsRxLeave(PVNETQUEUEPAIR pPair)
+{
+    PDMCritSectLeave(&pPair->csRx);
+}
+
+/**
+ * Enters the RX and TX locks of all queue pairs.
+ *
+ * @returns VBox status code, nothing is held on failure.
+ * @param   pThis      The device state structure.
+ * @param   rcBusy     Status code to return when a lock is busy (not in R3).
+ */
+static int vnetCsQueuesEnter(PVNETSTATE pThis, int rcBusy)
 {
-    // STAM_PROFILE_START(&pThis->CTXSUFF(StatCsRx), a);
-    // int rc = PDMCritSectEnter(&pThis->csRx, rcBusy);
-    // STAM_PROFILE_STOP(&pThis->CTXSUFF(StatCsRx), a);
-    // return rc;
+    for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        int rc = PDMCritSectEnter(&pThis->aQueuePairs[i].csRx, rcBusy);
+        if (rc == VINF_SUCCESS)
+        {
+            rc = PDMCritSectEnter(&pThis->aQueuePairs[i].csTx, rcBusy);
+            if (rc == VINF_SUCCESS)
+                continue;
+            PDMCritSectLeave(&pThis->aQueuePairs[i].csRx);
+        }
+        while (i-- > 0)
+        {
+            PDMCritSectLeave(&pThis->aQueuePairs[i].csTx);
+            PDMCritSectLeave(&pThis->aQueuePairs[i].csRx);
+        }
+        return rc;
+    }
     return VINF_SUCCESS;
 }
 
-DECLINLINE(void) vnetCsRxLeave(PVNETSTATE pThis)
+static void vnetCsQueuesLeave(PVNETSTATE pThis)
+{
+    for (unsigned i = pThis->cMaxQueuePairs; i-- > 0;)
+    {
+        PDMCritSectLeave(&pThis->aQueuePairs[i].csTx);
+        PDMCritSectLeave(&pThis->aQueuePairs[i].csRx);
+    }
+}
+
+/** Returns true if the guest uses more than one RX/TX queue pair. */
+DECLINLINE(bool) vnetIsMultiQueue(PVNETSTATE pThis)
 {
-    // PDMCritSectLeave(&pThis->csRx);
+    return !!(pThis->VPCI.uGuestFeatures & VNET_F_MQ);
+}
+
+/** Returns the index of the control queue. */
+DECLINLINE(unsigned) vnetCtlQueueIndex(PVNETSTATE pThis)
+{
+    return vnetMqCtlQueueIndex(vnetIsMultiQueue(pThis), pThis->cMaxQueuePairs);
+}
+
+/**
+ * Fills the RSS indirection table for the given number of active queue pairs.
+ */
+static void vnetSetActiveQueuePairs(PVNETSTATE pThis, uint32_t cPairs)
+{
+    vnetRssFillTable(&pThis->au8RssTable[0], cPairs);
+    ASMAtomicWriteU32(&pThis->cActiveQueuePairs, cPairs);
 }
 
 /**
@@ -354,7 +458,8 @@ DECLINLINE(void) vnetPrintFeatures(PVNETSTATE pThis, uint32_t fFeatures, const c
         { VNET_F_STATUS,     "virtio_net_config.status available" },
         { VNET_F_CTRL_VQ,    "control channel available" },
         { VNET_F_CTRL_RX,    "control channel RX mode support" },
-        { VNET_F_CTRL_VLAN,  "control channel VLAN filtering" }
+        { VNET_F_CTRL_VLAN,  "control channel VLAN filtering" },
+        { VNET_F_MQ,         "multiple RX/TX queue pairs" }
     };
 
     Log3(("%s %s:\n", INSTANCE(pThis), pcszText));
@@ -375,8 +480,11 @@ static DECLCALLBACK(uint32_t) vnetIoCb_GetHostFeatures(void *pvState)
      * - RX mode setting
      * - MAC filter table
      * - VLAN filter
+     * - Multiple queue pairs (if configured)
      */
-    return VNET_F_MAC
+    PVNETSTATE pThis = (PVNETSTATE)pvState;
+    return (pThis->cMaxQueuePairs > 1 ? VNET_F_MQ : 0)
+        | VNET_F_MAC
         | VNET_F_STATUS
         | VNET_F_CTRL_VQ
         | VNET_F_CTRL_RX
@@ -447,14 +555,15 @@ static DECLCALLBACK(int) vnetIoCb_Reset(void *pvState)
     PVNETSTATE pThis = (PVNETSTATE)pvState;
     Log(("%s Reset triggered\n", INSTANCE(pThis)));
 
-    int rc = vnetCsRxEnter(pThis, VERR_SEM_BUSY);
+    int rc = vnetCsQueuesEnter(pThis, VINF_IOM_R3_IOPORT_WRITE);
     if (RT_UNLIKELY(rc != VINF_SUCCESS))
     {
-        LogRel(("vnetIoCb_Reset failed to enter RX critical section!\n"));
+        Log(("%s vnetIoCb_Reset: queue locks are busy (%Rrc)\n", INSTANCE(pThis), rc));
         return rc;
     }
     vpciReset(&pThis->VPCI);
-    vnetCsRxLeave(pThis);
+    vnetSetActiveQueuePairs(pThis, 1);
+    vnetCsQueuesLeave(pThis);
 
     // TODO: Implement reset
     if (pThis->fCableConnected)
@@ -472,7 +581,6 @@ static DECLCALLBACK(int) vnetIoCb_Reset(void *pvState)
     pThis->nMacFilterEntries = 0;
     memset(pThis->aMacFilter,  0, VNET_MAC_FILTER_LEN * sizeof(RTMAC));
     memset(pThis->aVlanFilter, 0, sizeof(pThis->aVlanFilter));
-    pThis->uIsTransmitting   = 0;
 #ifndef IN_RING3
     return VINF_IOM_R3_IOPORT_WRITE;
 #else
@@ -619,32 +727,87 @@ PDMBOTHCBDECL(int) vnetIOPortOut(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT port
  *          It disables notification if it can receive.
  *
  * @returns VERR_NET_NO_BUFFER_SPACE if it cannot.
- * @param   pInterface      Pointer to the interface structure containing the called function pointer.
+ * @param   pThis           The device state structure.
+ * @param   pPair           The queue pair to check the RX queue of.
  * @thread  RX
  */
-static int vnetCanReceive(PVNETSTATE pThis)
+static int vnetCanReceive(PVNETSTATE pThis, PVNETQUEUEPAIR pPair)
 {
-    int rc = vnetCsRxEnter(pThis, VERR_SEM_BUSY);
+    int rc = vnetCsRxEnter(pPair, VERR_SEM_BUSY);
     AssertRCReturn(rc, rc);
 
-    LogFlow(("%s vnetCanReceive\n", INSTANCE(pThis)));
+    LogFlow(("%s vnetCanReceive: %s\n", INSTANCE(pThis), pPair->pRxQueue->pcszName));
     if (!(pThis->VPCI.uStatus & VPCI_STATUS_DRV_OK))
         rc = VERR_NET_NO_BUFFER_SPACE;
-    else if (!vqueueIsReady(&pThis->VPCI, pThis->pRxQueue))
+    else if (!vqueueIsReady(&pThis->VPCI, pPair->pRxQueue))
         rc = VERR_NET_NO_BUFFER_SPACE;
-    else if (vqueueIsEmpty(&pThis->VPCI, pThis->pRxQueue))
+    else if (vqueueIsEmpty(&pThis->VPCI, pPair->pRxQueue))
     {
-        vringSetNotification(&pThis->VPCI, &pThis->pRxQueue->VRing, true);
+        vringSetNotification(&pThis->VPCI, &pPair->pRxQueue->VRing, true);
         rc = VERR_NET_NO_BUFFER_SPACE;
     }
     else
     {
-        vringSetNotification(&pThis->VPCI, &pThis->pRxQueue->VRing, false);
+        vringSetNotification(&pThis->VPCI, &pPair->pRxQueue->VRing, false);
         rc = VINF_SUCCESS;
     }
 
     LogFlow(("%s vnetCanReceive -> %Rrc\n", INSTANCE(pThis), rc));
-    vnetCsRxLeave(pThis);
+    vnetCsRxLeave(pPair);
+    return rc;
+}
+
+/**
+ * Check if any of the active RX queues can take a packet.
+ *
+ * @returns VERR_NET_NO_BUFFER_SPACE if none can.
+ * @param   pThis           The device state structure.
+ * @thread  RX
+ */
+static int vnetCanReceiveAny(PVNETSTATE pThis)
+{
+    int rc = VERR_NET_NO_BUFFER_SPACE;
+    uint32_t cPairs = ASMAtomicReadU32(&pThis->cActiveQueuePairs);
+    for (unsigned i = 0; i < cPairs && rc == VERR_NET_NO_BUFFER_SPACE; i++)
+        rc = vnetCanReceive(pThis, &pThis->aQueuePairs[i]);
+    return rc;
+}
+
+/**
+ * Selects the queue pair to receive a frame on.
+ *
+ * The frame goes to the pair the RSS indirection table maps its flow to. If
+ * that RX queue has no buffers it goes to the first active one that has, as
+ * dropping the frame here would just make the sender retransmit it.
+ *
+ * @returns VBox status code, VERR_NET_NO_BUFFER_SPACE if no RX queue has space.
+ * @param   pThis           The device state structure.
+ * @param   pvBuf           The ethernet frame.
+ * @param   cb              The size of the frame.
+ * @param   ppPair          Where to return the selected queue pair.
+ * @thread  RX
+ */
+static int vnetSelectRxQueuePair(PVNETSTATE pThis, const void *pvBuf, size_t cb, PVNETQUEUEPAIR *ppPair)
+{
+    uint32_t cPairs = ASMAtomicReadU32(&pThis->cActiveQueuePairs);
+    PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[vnetRssSelectPair(&pThis->au8RssTable[0], cPairs, pvBuf, cb)];
+
+    int rc = vnetCanReceive(pThis, pPair);
+    if (rc == VERR_NET_NO_BUFFER_SPACE && cPairs > 1)
+    {
+        for (unsigned i = 0; i < cPairs; i++)
+        {
+            if (   &pThis->aQueuePairs[i] != pPair
+                && RT_SUCCESS(vnetCanReceive(pThis, &pThis->aQueuePairs[i])))
+            {
+                STAM_REL_COUNTER_INC(&pThis->StatReceiveSteerFallback);
+                pPair = &pThis->aQueuePairs[i];
+                rc = VINF_SUCCESS;
+                break;
+            }
+        }
+    }
+    *ppPair = pPair;
     return rc;
 }
 
@@ -655,7 +818,7 @@ static DECLCALLBACK(int) vnetNetworkDown_WaitReceiveAvail(PPDMINETWORKDOWN pInte
 {
     PVNETSTATE pThis = RT_FROM_MEMBER(pInterface, VNETSTATE, INetworkDown);
     LogFlow(("%s vnetNetworkDown_WaitReceiveAvail(cMillies=%u)\n", INSTANCE(pThis), cMillies));
-    int rc = vnetCanReceive(pThis);
+    int rc = vnetCanReceiveAny(pThis);
 
     if (RT_SUCCESS(rc))
         return VINF_SUCCESS;
@@ -670,7 +833,7 @@ static DECLCALLBACK(int) vnetNetworkDown_WaitReceiveAvail(PPDMINETWORKDOWN pInte
     while (RT_LIKELY(   (enmVMState = PDMDevHlpVMState(pThis->VPCI.CTX_SUFF(pDevIns))) == VMSTATE_RUNNING
                      ||  enmVMState == VMSTATE_RUNNING_LS))
     {
-        int rc2 = vnetCanReceive(pThis);
+        int rc2 = vnetCanReceiveAny(pThis);
         if (RT_SUCCESS(rc2))
         {
             rc = VINF_SUCCESS;
@@ -777,11 +940,12 @@ static bool vnetAddressFilter(PVNETSTATE pThis, const void *pvBuf, size_t cb)
  *
  * @returns VBox status code.
  * @param   pThis          The device state structure.
+ * @param   pPair           The queue pair to store the packet in.
  * @param   pvBuf           The available data.
  * @param   cb              Number of bytes available in the buffer.
  * @thread  RX
  */
-static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
+static int vnetHandleRxPacket(PVNETSTATE pThis, PVNETQUEUEPAIR pPair, const void *pvBuf, size_t cb,
                               PCPDMNETWORKGSO pGso)
 {
     VNETHDRMRX   Hdr;
@@ -836,7 +1000,7 @@ static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
         VQUEUEELEM elem;
         unsigned int nSeg = 0, uElemSize = 0, cbReserved = 0;
 
-        if (!vqueueGet(&pThis->VPCI, pThis->pRxQueue, &elem))
+        if (!vqueueGet(&pThis->VPCI, pPair->pRxQueue, &elem))
         {
             /*
              * @todo: It is possible to run out of RX buffers if only a few
@@ -880,7 +1044,7 @@ static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
             uElemSize += uSize;
         }
         STAM_PROFILE_START(&pThis->StatReceiveStore, a);
-        vqueuePut(&pThis->VPCI, pThis->pRxQueue, &elem, uElemSize, cbReserved);
+        vqueuePut(&pThis->VPCI, pPair->pRxQueue, &elem, uElemSize, cbReserved);
         STAM_PROFILE_STOP(&pThis->StatReceiveStore, a);
         if (!vnetMergeableRxBuffers(pThis))
             break;
@@ -898,7 +1062,15 @@ static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
             return rc;
         }
     }
-    vqueueSync(&pThis->VPCI, pThis->pRxQueue);
+    /* Within a receive batch the guest is notified once when the batch ends. */
+    vqueueSync(&pThis->VPCI, pPair->pRxQueue, !pThis->fRxBatch);
+    if (pThis->fRxBatch)
+    {
+        if (pPair->fRxNotifyPending)
+            STAM_REL_COUNTER_INC(&pThis->StatReceiveCoalesced);
+        pPair->fRxNotifyPending = true;
+    }
+    STAM_REL_COUNTER_INC(&pPair->StatReceivePackets);
     if (uOffset < cb)
     {
         Log(("%s vnetHandleRxPacket: Packet did not fit into RX queue (packet size=%u)!\n",
@@ -948,7 +1120,8 @@ static DECLCALLBACK(int) vnetNetworkDown_ReceiveGso(PPDMINETWORKDOWN pInterface,
 
     Log2(("%s vnetNetworkDown_ReceiveGso: pvBuf=%p cb=%u pGso=%p\n",
           INSTANCE(pThis), pvBuf, cb, pGso));
-    int rc = vnetCanReceive(pThis);
+    PVNETQUEUEPAIR pPair;
+    int rc = vnetSelectRxQueuePair(pThis, pvBuf, cb, &pPair);
     if (RT_FAILURE(rc))
         return rc;
 
@@ -963,12 +1136,12 @@ static DECLCALLBACK(int) vnetNetworkDown_ReceiveGso(PPDMINETWORKDOWN pInterface,
     vpciSetReadLed(&pThis->VPCI, true);
     if (vnetAddressFilter(pThis, pvBuf, cb))
     {
-        rc = vnetCsRxEnter(pThis, VERR_SEM_BUSY);
+        rc = vnetCsRxEnter(pPair, VERR_SEM_BUSY);
         if (RT_SUCCESS(rc))
         {
-            rc = vnetHandleRxPacket(pThis, pvBuf, cb, pGso);
+            rc = vnetHandleRxPacket(pThis, pPair, pvBuf, cb, pGso);
             STAM_REL_COUNTER_ADD(&pThis->StatReceiveBytes, cb);
-            vnetCsRxLeave(pThis);
+            vnetCsRxLeave(pPair);
         }
     }
     vpciSetReadLed(&pThis->VPCI, false);
@@ -984,6 +1157,37 @@ static DECLCALLBACK(int) vnetNetworkDown_Receive(PPDMINETWORKDOWN pInterface, co
     return vnetNetworkDown_ReceiveGso(pInterface, pvBuf, cb, NULL);
 }
 
+/**
+ * @interface_method_impl{PDMINETWORKDOWN,pfnNotifyReceiveBatch}
+ *
+ * Frames received during a batch are made visible to the guest right away,
+ * but each RX queue they went to only raises its interrupt once the batch
+ * ends.
+ */
+static DECLCALLBACK(void) vnetNetworkDown_NotifyReceiveBatch(PPDMINETWORKDOWN pInterface, bool fBegin)
+{
+    PVNETSTATE pThis = RT_FROM_MEMBER(pInterface, VNETSTATE, INetworkDown);
+
+    pThis->fRxBatch = fBegin;
+    if (fBegin)
+        return;
+
+    for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+        if (pPair->fRxNotifyPending)
+        {
+            int rc = vnetCsRxEnter(pPair, VERR_SEM_BUSY);
+            if (RT_SUCCESS(rc))
+            {
+                pPair->fRxNotifyPending = false;
+                vqueueNotify(&pThis->VPCI, pPair->pRxQueue);
+                vnetCsRxLeave(pPair);
+            }
+        }
+    }
+}
+
 /**
  * Gets the current Media Access Control (MAC) address.
  *
@@ -1138,21 +1342,36 @@ DECLINLINE(void) vnetCompleteChecksum(uint8_t *pBuf, unsigned cbSize, uint16_t u
     *(uint16_t*)(pBuf + uStart + uOffset) = vnetCSum16(pBuf + uStart, cbSize - uStart);
 }
 
-static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fOnWorkerThread)
+/**
+ * Transmits the packets queued in the TX queue of a queue pair.
+ *
+ * @returns VINF_SUCCESS if the queue has been drained, VERR_TRY_AGAIN if
+ *          another thread is transmitting or the driver is out of buffers,
+ *          VERR_INVALID_PARAMETER if the guest queued a malformed chain.
+ * @param   pThis           The device state structure.
+ * @param   pPair           The queue pair to transmit from.
+ * @param   fOnWorkerThread Whether we're on a worker thread or an EMT.
+ */
+static int vnetTransmitPendingPackets(PVNETSTATE pThis, PVNETQUEUEPAIR pPair, bool fOnWorkerThread)
 {
+    PVQUEUE pQueue = pPair->pTxQueue;
+
     /*
-     * Only one thread is allowed to transmit at a time, others should skip
-     * transmission as the packets will be picked up by the transmitting
-     * thread.
+     * Only one thread is allowed to transmit from a queue at a time, others
+     * should skip transmission as the packets will be picked up by the
+     * transmitting thread. The driver may call us back on the same thread
+     * from pfnSendBuf, that has to be skipped as well.
      */
-    if (!ASMAtomicCmpXchgU32(&pThis->uIsTransmitting, 1, 0))
-        return;
+    if (   PDMCritSectIsOwner(&pPair->csTx)
+        || PDMCritSectTryEnter(&pPair->csTx) != VINF_SUCCESS)
+        return VERR_TRY_AGAIN;
 
     if ((pThis->VPCI.uStatus & VPCI_STATUS_DRV_OK) == 0)
     {
         Log(("%s Ignoring transmit requests from non-existent driver (status=0x%x).\n",
              INSTANCE(pThis), pThis->VPCI.uStatus));
-        return;
+        PDMCritSectLeave(&pPair->csTx);
+        return VINF_SUCCESS;
     }
 
     PPDMINETWORKUP pDrv = pThis->pDrv;
@@ -1162,8 +1381,8 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
         Assert(rc == VINF_SUCCESS || rc == VERR_TRY_AGAIN);
         if (rc == VERR_TRY_AGAIN)
         {
-            ASMAtomicWriteU32(&pThis->uIsTransmitting, 0);
-            return;
+            PDMCritSectLeave(&pPair->csTx);
+            return rc;
         }
     }
 
@@ -1173,11 +1392,12 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
     else
         uHdrLen = sizeof(VNETHDR);
 
-    Log3(("%s vnetTransmitPendingPackets: About to transmit %d pending packets\n", INSTANCE(pThis),
-          vringReadAvailIndex(&pThis->VPCI, &pThis->pTxQueue->VRing) - pThis->pTxQueue->uNextAvailIndex));
+    Log3(("%s vnetTransmitPendingPackets: About to transmit %d pending packets on %s\n", INSTANCE(pThis),
+          vringReadAvailIndex(&pThis->VPCI, &pQueue->VRing) - pQueue->uNextAvailIndex, pQueue->pcszName));
 
     vpciSetWriteLed(&pThis->VPCI, true);
 
+    int rcRet = VINF_SUCCESS;
     VQUEUEELEM elem;
     /*
      * Do not remove descriptors from available ring yet, try to allocate the
@@ -1190,6 +1410,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
         {
             Log(("%s vnetQueueTransmit: The first segment is not the header! (%u < 2 || %u != %u).\n",
                  INSTANCE(pThis), elem.nOut, elem.aSegsOut[0].cb, uHdrLen));
+            rcRet = VERR_INVALID_PARAMETER;
             break; /* For now we simply ignore the header, but it must be there anyway! */
         }
         else
@@ -1211,6 +1432,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
                                   &Hdr, sizeof(Hdr));
 
                 STAM_REL_COUNTER_INC(&pThis->StatTransmitPackets);
+                STAM_REL_COUNTER_INC(&pPair->StatTransmitPackets);
 
                 STAM_PROFILE_START(&pThis->StatTransmitSend, a);
 
@@ -1284,6 +1506,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
                     STAM_PROFILE_STOP(&pThis->StatTransmitSend, a);
                     STAM_PROFILE_ADV_STOP(&pThis->StatTransmit, a);
                     /* Stop trying to fetch TX descriptors until we get more bandwidth. */
+                    rcRet = VERR_TRY_AGAIN;
                     break;
                 }
 
@@ -1294,14 +1517,26 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
         /* Remove this descriptor chain from the available ring */
         vqueueSkip(&pThis->VPCI, pQueue);
         vqueuePut(&pThis->VPCI, pQueue, &elem, sizeof(VNETHDR) + uOffset);
-        vqueueSync(&pThis->VPCI, pQueue);
+        vqueueSync(&pThis->VPCI, pQueue, true /*fNotify*/);
         STAM_PROFILE_ADV_STOP(&pThis->StatTransmit, a);
     }
     vpciSetWriteLed(&pThis->VPCI, false);
 
     if (pDrv)
         pDrv->pfnEndXmit(pDrv);
-    ASMAtomicWriteU32(&pThis->uIsTransmitting, 0);
+    PDMCritSectLeave(&pPair->csTx);
+    return rcRet;
+}
+
+/**
+ * Hands the TX queue of a queue pair over to its worker thread.
+ *
+ * @param   pPair           The queue pair.
+ */
+static void vnetKickTxThread(PVNETQUEUEPAIR pPair)
+{
+    if (!ASMAtomicXchgBool(&pPair->fTxPending, true))
+        RTSemEventSignal(pPair->hTxEvent);
 }
 
 /**
@@ -1310,7 +1545,77 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
 static DECLCALLBACK(void) vnetNetworkDown_XmitPending(PPDMINETWORKDOWN pInterface)
 {
     PVNETSTATE pThis = RT_FROM_MEMBER(pInterface, VNETSTATE, INetworkDown);
-    vnetTransmitPendingPackets(pThis, pThis->pTxQueue, false /*fOnWorkerThread*/);
+    if (pThis->cMaxQueuePairs > 1)
+    {
+        for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+            vnetKickTxThread(&pThis->aQueuePairs[i]);
+    }
+    else
+        vnetTransmitPendingPackets(pThis, &pThis->aQueuePairs[0], false /*fOnWorkerThread*/);
+}
+
+/**
+ * @callback_method_impl{FNPDMTHREADDEV, TX worker of a queue pair.}
+ *
+ * In multi-queue configurations every queue pair has a TX worker, so the
+ * guest can transmit on several queues in parallel and the EMT only has to
+ * kick the worker when notified.
+ */
+static DECLCALLBACK(int) vnetTxThread(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PVNETSTATE     pThis = PDMINS_2_DATA(pDevIns, PVNETSTATE);
+    PVNETQUEUEPAIR pPair = (PVNETQUEUEPAIR)pThread->pvUser;
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        if (!ASMAtomicXchgBool(&pPair->fTxPending, false))
+        {
+            int rc = RTSemEventWait(pPair->hTxEvent, RT_INDEFINITE_WAIT);
+            if (RT_FAILURE(rc) && rc != VERR_INTERRUPTED)
+                return rc;
+            continue;
+        }
+
+        if (!vqueueIsReady(&pThis->VPCI, pPair->pTxQueue))
+            continue;
+
+        int rc = vnetTransmitPendingPackets(pThis, pPair, true /*fOnWorkerThread*/);
+
+        /*
+         * Re-enable notifications and look at the queue once more, the guest
+         * may have added descriptors after we saw it empty without kicking us.
+         * If the driver is busy it will call pfnXmitPending when it is done.
+         */
+        vringSetNotification(&pThis->VPCI, &pPair->pTxQueue->VRing, true);
+        if (   rc == VINF_SUCCESS
+            && !vqueueIsEmpty(&pThis->VPCI, pPair->pTxQueue))
+        {
+            vringSetNotification(&pThis->VPCI, &pPair->pTxQueue->VRing, false);
+            ASMAtomicWriteBool(&pPair->fTxPending, true);
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDEV}
+ */
+static DECLCALLBACK(int) vnetTxThreadWakeUp(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PVNETQUEUEPAIR pPair = (PVNETQUEUEPAIR)pThread->pvUser;
+    NOREF(pDevIns);
+    return RTSemEventSignal(pPair->hTxEvent);
+}
+
+/**
+ * Returns the queue pair a RX or TX queue belongs to.
+ */
+DECLINLINE(PVNETQUEUEPAIR) vnetQueuePair(PVNETSTATE pThis, PVQUEUE pQueue)
+{
+    return &pThis->aQueuePairs[(pQueue - &pThis->VPCI.Queues[0]) / 2];
 }
 
 #ifdef VNET_TX_DELAY
@@ -1319,17 +1624,25 @@ static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
 {
     PVNETSTATE pThis = (PVNETSTATE)pvState;
 
+    if (pThis->cMaxQueuePairs > 1)
+    {
+        /* Stop further kicks until the worker has drained the queue. */
+        vringSetNotification(&pThis->VPCI, &pQueue->VRing, false);
+        vnetKickTxThread(vnetQueuePair(pThis, pQueue));
+        return;
+    }
+
     if (TMTimerIsActive(pThis->CTX_SUFF(pTxTimer)))
     {
         int rc = TMTimerStop(pThis->CTX_SUFF(pTxTimer));
         Log3(("%s vnetQueueTransmit: Got kicked with notification disabled, "
               "re-enable notification and flush TX queue\n", INSTANCE(pThis)));
-        vnetTransmitPendingPackets(pThis, pQueue, false /*fOnWorkerThread*/);
+        vnetTransmitPendingPackets(pThis, vnetQueuePair(pThis, pQueue), false /*fOnWorkerThread*/);
         if (RT_FAILURE(vnetCsEnter(pThis, VERR_SEM_BUSY)))
             LogRel(("vnetQueueTransmit: Failed to enter critical section!/n"));
         else
         {
-            vringSetNotification(&pThis->VPCI, &pThis->pTxQueue->VRing, true);
+            vringSetNotification(&pThis->VPCI, &pQueue->VRing, true);
             vnetCsLeave(pThis);
         }
     }
@@ -1339,7 +1652,7 @@ static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
             LogRel(("vnetQueueTransmit: Failed to enter critical section!/n"));
         else
         {
-            vringSetNotification(&pThis->VPCI, &pThis->pTxQueue->VRing, false);
+            vringSetNotification(&pThis->VPCI, &pQueue->VRing, false);
             TMTimerSetMicro(pThis->CTX_SUFF(pTxTimer), VNET_TX_DELAY);
             pThis->u64NanoTS = RTTimeNanoTS();
             vnetCsLeave(pThis);
@@ -1365,13 +1678,13 @@ static DECLCALLBACK(void) vnetTxTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, void
             u32MicroDiff, pThis->u32AvgDiff, pThis->u32MinDiff, pThis->u32MaxDiff));
 
 //    Log3(("%s vnetTxTimer: Expired\n", INSTANCE(pThis)));
-    vnetTransmitPendingPackets(pThis, pThis->pTxQueue, false /*fOnWorkerThread*/);
+    vnetTransmitPendingPackets(pThis, &pThis->aQueuePairs[0], false /*fOnWorkerThread*/);
     if (RT_FAILURE(vnetCsEnter(pThis, VERR_SEM_BUSY)))
     {
         LogRel(("vnetTxTimer: Failed to enter critical section!/n"));
         return;
     }
-    vringSetNotification(&pThis->VPCI, &pThis->pTxQueue->VRing, true);
+    vringSetNotification(&pThis->VPCI, &pThis->aQueuePairs[0].pTxQueue->VRing, true);
     vnetCsLeave(pThis);
 }
 
@@ -1381,7 +1694,13 @@ static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
 {
     PVNETSTATE pThis = (PVNETSTATE)pvState;
 
-    vnetTransmitPendingPackets(pThis, pQueue, false /*fOnWorkerThread*/);
+    if (pThis->cMaxQueuePairs > 1)
+    {
+        vringSetNotification(&pThis->VPCI, &pQueue->VRing, false);
+        vnetKickTxThread(vnetQueuePair(pThis, pQueue));
+    }
+    else
+        vnetTransmitPendingPackets(pThis, vnetQueuePair(pThis, pQueue), false /*fOnWorkerThread*/);
 }
 
 #endif /* !VNET_TX_DELAY */
@@ -1539,6 +1858,45 @@ static uint8_t vnetControlVlan(PVNETSTATE pThis, PVNETCTLHDR pCtlHdr, PVQUEUEELE
     return u8Ack;
 }
 
+static uint8_t vnetControlMq(PVNETSTATE pThis, PVNETCTLHDR pCtlHdr, PVQUEUEELEM pElem)
+{
+    uint16_t cPairs;
+
+    if (   pCtlHdr->u8Command != VNET_CTRL_CMD_MQ_VQ_PAIRS_SET
+        || !vnetIsMultiQueue(pThis))
+    {
+        Log(("%s vnetControlMq: Unsupported command or VNET_F_MQ not negotiated "
+             "(u8Command=%u)\n", INSTANCE(pThis), pCtlHdr->u8Command));
+        return VNET_ERROR;
+    }
+
+    if (pElem->nOut != 2 || pElem->aSegsOut[1].cb != sizeof(cPairs))
+    {
+        Log(("%s vnetControlMq: Segment layout is wrong "
+             "(u8Command=%u nOut=%u cb=%u)\n", INSTANCE(pThis),
+             pCtlHdr->u8Command, pElem->nOut, pElem->aSegsOut[1].cb));
+        return VNET_ERROR;
+    }
+
+    PDMDevHlpPhysRead(pThis->VPCI.CTX_SUFF(pDevIns),
+                      pElem->aSegsOut[1].addr,
+                      &cPairs, sizeof(cPairs));
+
+    if (!vnetMqIsValidPairCount(vnetIsMultiQueue(pThis), cPairs, pThis->cMaxQueuePairs))
+    {
+        Log(("%s vnetControlMq: Number of queue pairs is out of range "
+             "(cPairs=%u)\n", INSTANCE(pThis), cPairs));
+        return VNET_ERROR;
+    }
+
+    Log(("%s vnetControlMq: Using %u queue pairs\n", INSTANCE(pThis), cPairs));
+    vnetSetActiveQueuePairs(pThis, cPairs);
+    /* The new RX queues may already have buffers. */
+    vnetWakeupReceive(pThis->VPCI.CTX_SUFF(pDevIns));
+
+    return VNET_OK;
+}
+
 
 static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
 {
@@ -1581,6 +1939,9 @@ static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
                 case VNET_CTRL_CLS_VLAN:
                     u8Ack = vnetControlVlan(pThis, &CtlHdr, &elem);
                     break;
+                case VNET_CTRL_CLS_MQ:
+                    u8Ack = vnetControlMq(pThis, &CtlHdr, &elem);
+                    break;
                 default:
                     u8Ack = VNET_ERROR;
             }
@@ -1591,10 +1952,32 @@ static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
                                   &u8Ack, sizeof(u8Ack));
         }
         vqueuePut(&pThis->VPCI, pQueue, &elem, sizeof(u8Ack));
-        vqueueSync(&pThis->VPCI, pQueue);
+        vqueueSync(&pThis->VPCI, pQueue, true /*fNotify*/);
     }
 }
 
+/**
+ * Dispatches queue notifications.
+ *
+ * The role of a queue depends on its index and on whether the guest has
+ * negotiated VNET_F_MQ: RX queues have even indexes, TX queues odd ones and
+ * the control queue either follows the first or the last queue pair.
+ */
+static DECLCALLBACK(void) vnetQueueNotify(void *pvState, PVQUEUE pQueue)
+{
+    PVNETSTATE pThis  = (PVNETSTATE)pvState;
+    unsigned   iQueue = pQueue - &pThis->VPCI.Queues[0];
+
+    if (iQueue == vnetCtlQueueIndex(pThis))
+        vnetQueueControl(pvState, pQueue);
+    else if (iQueue >= pThis->cMaxQueuePairs * 2)
+        Log(("%s vnetQueueNotify: Queue %u is not in use\n", INSTANCE(pThis), iQueue));
+    else if (iQueue & 1)
+        vnetQueueTransmit(pvState, pQueue);
+    else
+        vnetQueueReceive(pvState, pQueue);
+}
+
 
 /* -=-=-=-=- Saved state -=-=-=-=- */
 
@@ -1628,10 +2011,13 @@ static DECLCALLBACK(int) vnetSavePrep(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
 {
     PVNETSTATE pThis = PDMINS_2_DATA(pDevIns, PVNETSTATE);
 
-    int rc = vnetCsRxEnter(pThis, VERR_SEM_BUSY);
-    if (RT_UNLIKELY(rc != VINF_SUCCESS))
-        return rc;
-    vnetCsRxLeave(pThis);
+    for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        int rc = vnetCsRxEnter(&pThis->aQueuePairs[i], VERR_SEM_BUSY);
+        if (RT_UNLIKELY(rc != VINF_SUCCESS))
+            return rc;
+        vnetCsRxLeave(&pThis->aQueuePairs[i]);
+    }
     return VINF_SUCCESS;
 }
 
@@ -1663,6 +2049,8 @@ static DECLCALLBACK(int) vnetSaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
     AssertRCReturn(rc, rc);
     rc = SSMR3PutMem( pSSM, pThis->aVlanFilter, sizeof(pThis->aVlanFilter));
     AssertRCReturn(rc, rc);
+    rc = SSMR3PutU32( pSSM, pThis->cActiveQueuePairs);
+    AssertRCReturn(rc, rc);
     Log(("%s State has been saved\n", INSTANCE(pThis)));
     return VINF_SUCCESS;
 }
@@ -1676,10 +2064,13 @@ static DECLCALLBACK(int) vnetLoadPrep(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
 {
     PVNETSTATE pThis = PDMINS_2_DATA(pDevIns, PVNETSTATE);
 
-    int rc = vnetCsRxEnter(pThis, VERR_SEM_BUSY);
-    if (RT_UNLIKELY(rc != VINF_SUCCESS))
-        return rc;
-    vnetCsRxLeave(pThis);
+    for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        int rc = vnetCsRxEnter(&pThis->aQueuePairs[i], VERR_SEM_BUSY);
+        if (RT_UNLIKELY(rc != VINF_SUCCESS))
+            return rc;
+        vnetCsRxLeave(&pThis->aQueuePairs[i]);
+    }
     return VINF_SUCCESS;
 }
 
@@ -1729,6 +2120,16 @@ static DECLCALLBACK(int) vnetLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint3
             rc = SSMR3GetMem(pSSM, pThis->aVlanFilter,
                              sizeof(pThis->aVlanFilter));
             AssertRCReturn(rc, rc);
+            uint32_t cPairs = 1;
+            if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_MQ)
+            {
+                rc = SSMR3GetU32(pSSM, &cPairs);
+                AssertRCReturn(rc, rc);
+                if (cPairs < 1 || cPairs > pThis->cMaxQueuePairs)
+                    return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("Invalid number of active queue pairs: config=%u saved=%u"),
+                                            pThis->cMaxQueuePairs, cPairs);
+            }
+            vnetSetActiveQueuePairs(pThis, cPairs);
         }
         else
         {
@@ -1946,8 +2347,27 @@ static DECLCALLBACK(int) vnetDestruct(PPDMDEVINS pDevIns)
         pThis->hEventMoreRxDescAvail = NIL_RTSEMEVENT;
     }
 
-    // if (PDMCritSectIsInitialized(&pThis->csRx))
-    //     PDMR3CritSectDelete(&pThis->csRx);
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aQueuePairs); i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+        /* The TX workers use the event semaphores, so they have to go first. */
+        if (pPair->pTxThread)
+        {
+            int rcThread;
+            int rc = PDMR3ThreadDestroy(pPair->pTxThread, &rcThread);
+            AssertRC(rc);
+            pPair->pTxThread = NULL;
+        }
+        if (pPair->hTxEvent != NIL_RTSEMEVENT)
+        {
+            RTSemEventDestroy(pPair->hTxEvent);
+            pPair->hTxEvent = NIL_RTSEMEVENT;
+        }
+        if (PDMCritSectIsInitialized(&pPair->csTx))
+            PDMR3CritSectDelete(&pPair->csTx);
+        if (PDMCritSectIsInitialized(&pPair->csRx))
+            PDMR3CritSectDelete(&pPair->csRx);
+    }
 
     return vpciDestruct(&pThis->VPCI);
 }
@@ -1964,26 +2384,56 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
 
     /* Initialize the instance data suffiencently for the destructor not to blow up. */
     pThis->hEventMoreRxDescAvail = NIL_RTSEMEVENT;
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aQueuePairs); i++)
+        pThis->aQueuePairs[i].hTxEvent = NIL_RTSEMEVENT;
 
     /* Do our own locking. */
     rc = PDMDevHlpSetDeviceCritSect(pDevIns, PDMDevHlpCritSectGetNop(pDevIns));
     AssertRCReturn(rc, rc);
 
+    /* Number of RX/TX queue pairs, more than one enables VNET_F_MQ. */
+    rc = CFGMR3QueryU32Def(pCfg, "QueuePairs", &pThis->cMaxQueuePairs, 1);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'QueuePairs'"));
+    if (pThis->cMaxQueuePairs < 1 || pThis->cMaxQueuePairs > VNET_MAX_QUEUE_PAIRS)
+        return PDMDevHlpVMSetError(pDevIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("Configuration error: 'QueuePairs' must be between 1 and %u"),
+                                   VNET_MAX_QUEUE_PAIRS);
+
     /* Initialize PCI part. */
     pThis->VPCI.IBase.pfnQueryInterface    = vnetQueryInterface;
     rc = vpciConstruct(pDevIns, &pThis->VPCI, iInstance,
                        VNET_NAME_FMT, VNET_PCI_SUBSYSTEM_ID,
-                       VNET_PCI_CLASS, VNET_N_QUEUES);
-    pThis->pRxQueue  = vpciAddQueue(&pThis->VPCI, 256, vnetQueueReceive,  "RX ");
-    pThis->pTxQueue  = vpciAddQueue(&pThis->VPCI, 256, vnetQueueTransmit, "TX ");
-    pThis->pCtlQueue = vpciAddQueue(&pThis->VPCI, 16,  vnetQueueControl,  "CTL");
+                       VNET_PCI_CLASS, pThis->cMaxQueuePairs * 2 + 1);
+    if (pThis->cMaxQueuePairs == 1)
+    {
+        pThis->aQueuePairs[0].pRxQueue = vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, "RX ");
+        pThis->aQueuePairs[0].pTxQueue = vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, "TX ");
+        vpciAddQueue(&pThis->VPCI, 16, vnetQueueNotify, "CTL");
+    }
+    else
+    {
+        static const char * const s_apszQueueNames[VNET_MAX_QUEUE_PAIRS * 2] =
+        {
+            "RX0", "TX0", "RX1", "TX1", "RX2", "TX2", "RX3", "TX3",
+            "RX4", "TX4", "RX5", "TX5", "RX6", "TX6", "RX7", "TX7"
+        };
+        for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+        {
+            pThis->aQueuePairs[i].pRxQueue = vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, s_apszQueueNames[i * 2]);
+            pThis->aQueuePairs[i].pTxQueue = vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, s_apszQueueNames[i * 2 + 1]);
+        }
+        /* Queue #2 is the control queue unless the guest negotiates VNET_F_MQ, hence the size. */
+        vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, "CTL");
+    }
 
     Log(("%s Constructing new instance\n", INSTANCE(pThis)));
 
     /*
      * Validate configuration.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "LineSpeed\0" "LinkUpDelay\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "LineSpeed\0" "LinkUpDelay\0" "QueuePairs\0"))
                     return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
                                             N_("Invalid configuration for VirtioNet device"));
 
@@ -2016,30 +2466,36 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     /* Initialize PCI config space */
     memcpy(pThis->config.mac.au8, pThis->macConfigured.au8, sizeof(pThis->config.mac.au8));
     pThis->config.uStatus = 0;
+    pThis->config.uMaxVirtqueuePairs = (uint16_t)pThis->cMaxQueuePairs;
 
     /* Initialize state structure */
     pThis->u32PktNo     = 1;
 
     /* Interfaces */
-    pThis->INetworkDown.pfnWaitReceiveAvail = vnetNetworkDown_WaitReceiveAvail;
-    pThis->INetworkDown.pfnReceive          = vnetNetworkDown_Receive;
-    pThis->INetworkDown.pfnReceiveGso       = vnetNetworkDown_ReceiveGso;
-    pThis->INetworkDown.pfnXmitPending      = vnetNetworkDown_XmitPending;
+    pThis->INetworkDown.pfnWaitReceiveAvail   = vnetNetworkDown_WaitReceiveAvail;
+    pThis->INetworkDown.pfnReceive            = vnetNetworkDown_Receive;
+    pThis->INetworkDown.pfnReceiveGso         = vnetNetworkDown_ReceiveGso;
+    pThis->INetworkDown.pfnXmitPending        = vnetNetworkDown_XmitPending;
+    pThis->INetworkDown.pfnNotifyReceiveBatch = vnetNetworkDown_NotifyReceiveBatch;
 
     pThis->INetworkConfig.pfnGetMac         = vnetGetMac;
     pThis->INetworkConfig.pfnGetLinkState   = vnetGetLinkState;
     pThis->INetworkConfig.pfnSetLinkState   = vnetSetLinkState;
 
-    /* Initialize critical section. */
-    // char szTmp[sizeof(pThis->VPCI.szInstance) + 2];
-    // RTStrPrintf(szTmp, sizeof(szTmp), "%sRX", pThis->VPCI.szInstance);
-    // rc = PDMDevHlpCritSectInit(pDevIns, &pThis->csRx, szTmp);
-    // if (RT_FAILURE(rc))
-    //     return rc;
+    /* Initialize the queue pair critical sections. */
+    for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        rc = PDMDevHlpCritSectInit(pDevIns, &pThis->aQueuePairs[i].csRx, RT_SRC_POS, "%sRX%u", pThis->VPCI.szInstance, i);
+        if (RT_FAILURE(rc))
+            return rc;
+        rc = PDMDevHlpCritSectInit(pDevIns, &pThis->aQueuePairs[i].csTx, RT_SRC_POS, "%sTX%u", pThis->VPCI.szInstance, i);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
 
-    /* Map our ports to IO space. */
+    /* Map our ports to IO space, leaving room for the MSI-X vector registers. */
     rc = PDMDevHlpPCIIORegionRegister(pDevIns, 0,
-                                      VPCI_CONFIG + sizeof(VNetPCIConfig),
+                                      VPCI_CONFIG_MSIX + sizeof(VNetPCIConfig),
                                       PCI_ADDRESS_SPACE_IO, vnetMap);
     if (RT_FAILURE(rc))
         return rc;
@@ -2107,6 +2563,25 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     if (RT_FAILURE(rc))
         return rc;
 
+    /* Create the TX workers, a single queue pair transmits on the EMT and the TX timer. */
+    if (pThis->cMaxQueuePairs > 1)
+    {
+        for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+        {
+            PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+            rc = RTSemEventCreate(&pPair->hTxEvent);
+            if (RT_FAILURE(rc))
+                return rc;
+
+            char szName[16];
+            RTStrPrintf(szName, sizeof(szName), "%sTx%u", pThis->VPCI.szInstance, i);
+            rc = PDMDevHlpThreadCreate(pDevIns, &pPair->pTxThread, pPair, vnetTxThread,
+                                       vnetTxThreadWakeUp, 0, RTTHREADTYPE_IO, szName);
+            if (RT_FAILURE(rc))
+                return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to create the TX worker thread"));
+        }
+    }
+
     rc = vnetIoCb_Reset(pThis);
     AssertRC(rc);
 
@@ -2119,6 +2594,13 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitPackets,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of sent packets",             "/Devices/VNet%d/Packets/Transmit", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitGSO,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of sent GSO packets",         "/Devices/VNet%d/Packets/Transmit-Gso", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitCSum,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of completed TX checksums",   "/Devices/VNet%d/Packets/Transmit-Csum", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveCoalesced,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,        "Receive interrupts saved by batching", "/Devices/VNet%d/Interrupts/ReceiveCoalesced", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveSteerFallback, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,        "Packets not received on the RSS queue", "/Devices/VNet%d/Packets/ReceiveSteerFallback", iInstance);
+    for (unsigned i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        PDMDevHlpSTAMRegisterF(pDevIns, &pThis->aQueuePairs[i].StatReceivePackets,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT, "Number of received packets", "/Devices/VNet%d/Queue%u/Receive", iInstance, i);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pThis->aQueuePairs[i].StatTransmitPackets, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT, "Number of sent packets",     "/Devices/VNet%d/Queue%u/Transmit", iInstance, i);
+    }
 #if defined(VBOX_WITH_STATISTICS)
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceive,            STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive",                  "/Devices/VNet%d/Receive/Total", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveStore,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive storing",          "/Devices/VNet%d/Receive/Store", iInstance);
@@ -0,0 +1,188 @@
+/* $Id: DevVirtioNetMQ.h $ */
+/** @file
+ * DevVirtioNet - Virtio Network Device, multi-queue flow steering.
+ *
+ * Kept apart from the device so the testcase can check it directly.
+ */
+
+/*
+ * Copyright (C) 2009-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___DevVirtioNetMQ_h
+#define ___DevVirtioNetMQ_h
+
+#include <iprt/types.h>
+#include <iprt/assert.h>
+#include <iprt/net.h>
+#include <iprt/string.h>
+
+#define VNET_MAX_QUEUE_PAIRS    8     /**< Maximum number of RX/TX queue pairs */
+#define VNET_RSS_TABLE_SIZE     128   /**< Number of entries in the RSS indirection table */
+
+/**
+ * The Toeplitz hash key commonly used for RSS (from the Microsoft RSS
+ * specification), so flows hash the same way as on real NICs.
+ */
+static const uint8_t g_abVNetRssKey[40] =
+{
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+/**
+ * Calculates the Toeplitz hash of the input.
+ *
+ * @returns 32-bit hash.
+ * @param   pbInput         The input (addresses and ports in network order).
+ * @param   cbInput         The size of the input, at most 36 bytes.
+ */
+DECLINLINE(uint32_t) vnetToeplitzHash(const uint8_t *pbInput, size_t cbInput)
+{
+    Assert(cbInput + 4 <= sizeof(g_abVNetRssKey));
+    uint32_t uHash = 0;
+    uint32_t uKey  = RT_MAKE_U32_FROM_U8(g_abVNetRssKey[3], g_abVNetRssKey[2], g_abVNetRssKey[1], g_abVNetRssKey[0]);
+    for (size_t i = 0; i < cbInput; i++)
+    {
+        uint8_t const bKeyNext = g_abVNetRssKey[i + 4];
+        for (int iBit = 7; iBit >= 0; iBit--)
+        {
+            if (pbInput[i] & RT_BIT(iBit))
+                uHash ^= uKey;
+            uKey = (uKey << 1) | ((bKeyNext >> iBit) & 1);
+        }
+    }
+    return uHash;
+}
+
+/**
+ * Calculates the RSS flow hash of an ethernet frame.
+ *
+ * TCP and UDP over IPv4 and IPv6 hash the addresses and the ports, other IP
+ * traffic and fragments only the addresses. Everything else hashes to 0.
+ *
+ * @returns 32-bit hash.
+ * @param   pvBuf           The ethernet frame.
+ * @param   cb              The size of the frame.
+ */
+DECLINLINE(uint32_t) vnetRssHash(const void *pvBuf, size_t cb)
+{
+    const uint8_t *pbFrame = (const uint8_t *)pvBuf;
+    uint8_t        abInput[36];
+    size_t         cbInput;
+    size_t         offL3 = sizeof(RTNETETHERHDR);
+
+    if (cb < offL3)
+        return 0;
+    uint16_t uEtherType = RT_MAKE_U16(pbFrame[13], pbFrame[12]);
+    if (uEtherType == RTNET_ETHERTYPE_VLAN)
+    {
+        offL3 += 4;
+        if (cb < offL3)
+            return 0;
+        uEtherType = RT_MAKE_U16(pbFrame[17], pbFrame[16]);
+    }
+
+    const uint8_t *pbL4;
+    uint8_t        uProto;
+    if (uEtherType == RTNET_ETHERTYPE_IPV4 && cb >= offL3 + RTNETIPV4_MIN_LEN)
+    {
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)(pbFrame + offL3);
+        memcpy(&abInput[0], &pIpHdr->ip_src, 8); /* source and destination */
+        cbInput = 8;
+        uProto  = pIpHdr->ip_p;
+        if (pIpHdr->ip_off & RT_H2N_U16_C(RTNETIPV4_FLAGS_MF | 0x1fff /* offset */))
+            uProto = 0; /* Fragments have no ports. */
+        pbL4 = pbFrame + offL3 + pIpHdr->ip_hl * 4;
+    }
+    else if (uEtherType == RTNET_ETHERTYPE_IPV6 && cb >= offL3 + sizeof(RTNETIPV6))
+    {
+        PCRTNETIPV6 pIpHdr = (PCRTNETIPV6)(pbFrame + offL3);
+        memcpy(&abInput[0], &pIpHdr->ip6_src, 32); /* source and destination */
+        cbInput = 32;
+        uProto  = pIpHdr->ip6_nxt; /* Extension headers are not followed. */
+        pbL4 = pbFrame + offL3 + sizeof(RTNETIPV6);
+    }
+    else
+        return 0;
+
+    if (   (uProto == RTNETIPV4_PROT_TCP || uProto == RTNETIPV4_PROT_UDP)
+        && pbL4 + 4 <= pbFrame + cb)
+    {
+        memcpy(&abInput[cbInput], pbL4, 4); /* source and destination ports */
+        cbInput += 4;
+    }
+    return vnetToeplitzHash(abInput, cbInput);
+}
+
+/**
+ * Fills the RSS indirection table for the given number of active queue pairs.
+ *
+ * @param   pau8Table       The table, VNET_RSS_TABLE_SIZE entries.
+ * @param   cPairs          The number of active queue pairs.
+ */
+DECLINLINE(void) vnetRssFillTable(uint8_t *pau8Table, uint32_t cPairs)
+{
+    Assert(cPairs >= 1 && cPairs <= VNET_MAX_QUEUE_PAIRS);
+    for (unsigned i = 0; i < VNET_RSS_TABLE_SIZE; i++)
+        pau8Table[i] = (uint8_t)(i % cPairs);
+}
+
+/**
+ * Returns the queue pair the RSS indirection table maps a frame to.
+ *
+ * @returns Index of the queue pair.
+ * @param   pau8Table       The indirection table.
+ * @param   cPairs          The number of active queue pairs.
+ * @param   pvBuf           The ethernet frame.
+ * @param   cb              The size of the frame.
+ */
+DECLINLINE(unsigned) vnetRssSelectPair(const uint8_t *pau8Table, uint32_t cPairs, const void *pvBuf, size_t cb)
+{
+    if (cPairs <= 1)
+        return 0;
+    return pau8Table[vnetRssHash(pvBuf, cb) % VNET_RSS_TABLE_SIZE];
+}
+
+/**
+ * Returns the index of the control queue.
+ *
+ * Without VNET_F_MQ the control queue follows the first queue pair,
+ * with it the control queue follows the last one.
+ *
+ * @returns Queue index.
+ * @param   fMultiQueue     Whether the guest negotiated VNET_F_MQ.
+ * @param   cMaxPairs       The number of configured queue pairs.
+ */
+DECLINLINE(unsigned) vnetMqCtlQueueIndex(bool fMultiQueue, uint32_t cMaxPairs)
+{
+    return fMultiQueue ? cMaxPairs * 2 : 2;
+}
+
+/**
+ * Checks the queue pair count of a VNET_CTRL_CMD_MQ_VQ_PAIRS_SET command.
+ *
+ * @returns true if the guest may enable that many pairs.
+ * @param   fMultiQueue     Whether the guest negotiated VNET_F_MQ.
+ * @param   cPairs          The requested number of queue pairs.
+ * @param   cMaxPairs       The number of configured queue pairs.
+ */
+DECLINLINE(bool) vnetMqIsValidPairCount(bool fMultiQueue, uint32_t cPairs, uint32_t cMaxPairs)
+{
+    return fMultiQueue
+        && cPairs >= 1
+        && cPairs <= cMaxPairs;
+}
+
+#endif /* !___DevVirtioNetMQ_h */
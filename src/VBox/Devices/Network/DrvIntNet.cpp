@@ -54,6 +54,18 @@
 /** Enables the ring-0 part. */
 #define VBOX_WITH_DRVINTNET_IN_R0
 
+/** The default number of frames committed to the send ring before they are
+ * pushed thru the switch (SendBatchSize). */
+#define DRVINTNET_DEF_SEND_BATCH        32
+/** The default max number of frames passed up in one receive batch
+ * (ReceiveBatchSize). */
+#define DRVINTNET_DEF_RECV_BATCH        64
+/** The default max time to poll the receive ring before blocking, in
+ * microseconds (ReceivePollMaxUs). */
+#define DRVINTNET_DEF_RECV_POLL_US      50
+/** The lower bound of the adaptive receive polling window, in nanoseconds. */
+#define DRVINTNET_MIN_RECV_POLL_NS      1000
+
 
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
@@ -140,8 +152,24 @@ typedef struct DRVINTNET
     /** Set if data transmission should start immediately and deactivate
      * as late as possible. */
     bool                            fActivateEarlyDeactivateLate;
+    /** Set while the receive thread has a batch open on the device above.
+     * Only accessed by the receive thread. */
+    bool                            fRecvInBatch;
+    /** Padding. */
+    bool                            afReserved[HC_ARCH_BITS == 64 ? 2 : 2];
+    /** Number of frames committed to the send ring since it was last pushed thru
+     * the switch.  Always accessed while owning the XmitLock. */
+    uint32_t                        cXmitPending;
+    /** Max number of frames to commit before pushing them thru the switch. */
+    uint32_t                        cXmitBatchMax;
+    /** Max number of frames to pass up in one receive batch. */
+    uint32_t                        cRecvBatchMax;
+    /** The max receive polling window in nanoseconds, 0 if polling is disabled. */
+    uint32_t                        cNsRecvPollMax;
+    /** The current (adaptive) receive polling window in nanoseconds. */
+    uint32_t                        cNsRecvPoll;
     /** Padding. */
-    bool                            afReserved[HC_ARCH_BITS == 64 ? 3 : 3];
+    uint32_t                        u32Alignment;
     /** Scratch space for holding the ring-0 scatter / gather descriptor.
      * The PDMSCATTERGATHER::fFlags member is used to indicate whether it is in
      * use or not.  Always accessed while owning the XmitLock. */
@@ -167,6 +195,14 @@ typedef struct DRVINTNET
     STAMCOUNTER                     StatXmitWakeupR3;
     /** The times the xmit thread has been told to process the ring. */
     STAMCOUNTER                     StatXmitProcessRing;
+    /** The number of times a full send batch was pushed thru the switch. */
+    STAMCOUNTER                     StatXmitBatchFull;
+    /** The number of receive batches passed up. */
+    STAMCOUNTER                     StatRecvBatches;
+    /** The number of times polling the receive ring found new frames. */
+    STAMCOUNTER                     StatRecvPollHits;
+    /** The number of times polling the receive ring came up empty. */
+    STAMCOUNTER                     StatRecvPollMisses;
 #ifdef VBOX_WITH_STATISTICS
     /** Profiling packet transmit runs. */
     STAMPROFILE                     StatTransmit;
@@ -289,6 +325,7 @@ DECLINLINE(int) drvIntNetSignalXmit(PDRVINTNET pThis)
 DECLINLINE(int) drvIntNetProcessXmit(PDRVINTNET pThis)
 {
     Assert(PDMCritSectIsOwner(&pThis->XmitLock));
+    pThis->cXmitPending = 0;
 
 #ifdef IN_RING3
     INTNETIFSENDREQ SendReq;
@@ -499,11 +536,20 @@ PDMBOTHCBDECL(int) drvIntNetUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGAT
     PDMDrvHlpFTSetCheckpoint(pThis->CTX_SUFF(pDrvIns), FTMCHECKPOINTTYPE_NETWORK);
 
     /*
-     * Commit the frame and push it thru the switch.
+     * Commit the frame and push it thru the switch once we've got a full batch
+     * or the ring is getting crowded.  Whatever is left when the caller is done
+     * is pushed by drvIntNetUp_EndXmit, so we get a single IntNetR0IfSend call
+     * (and ring-0 transition when in ring-3) per burst instead of per frame.
      */
     PINTNETHDR pHdr = (PINTNETHDR)pSgBuf->pvAllocator;
     IntNetRingCommitFrameEx(&pThis->CTX_SUFF(pBuf)->Send, pHdr, pSgBuf->cbUsed);
-    int rc = drvIntNetProcessXmit(pThis);
+    int rc = VINF_SUCCESS;
+    if (   ++pThis->cXmitPending >= pThis->cXmitBatchMax
+        || IntNetRingGetWritable(&pThis->CTX_SUFF(pBuf)->Send) < pThis->CTX_SUFF(pBuf)->cbSend / 2)
+    {
+        STAM_REL_COUNTER_INC(&pThis->StatXmitBatchFull);
+        rc = drvIntNetProcessXmit(pThis);
+    }
     STAM_PROFILE_STOP(&pThis->StatTransmit, a);
 
     /*
@@ -525,6 +571,11 @@ PDMBOTHCBDECL(int) drvIntNetUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGAT
 PDMBOTHCBDECL(void) drvIntNetUp_EndXmit(PPDMINETWORKUP pInterface)
 {
     PDRVINTNET pThis = RT_FROM_MEMBER(pInterface, DRVINTNET, CTX_SUFF(INetworkUp));
+
+    /* Push the rest of the batch thru the switch. */
+    if (pThis->cXmitPending)
+        drvIntNetProcessXmit(pThis);
+
     ASMAtomicUoWriteBool(&pThis->fXmitOnXmitThread, false);
     PDMCritSectLeave(&pThis->XmitLock);
 }
@@ -646,9 +697,86 @@ static DECLCALLBACK(int) drvR3IntNetXmitWakeUp(PPDMDRVINS pDrvIns, PPDMTHREAD pT
 
 /* -=-=-=-=- Receive Thread -=-=-=-=- */
 
+/**
+ * Opens a receive batch on the device above, if it cares.
+ *
+ * @param   pThis       Pointer to the instance data.
+ */
+DECLINLINE(void) drvR3IntNetRecvBatchBegin(PDRVINTNET pThis)
+{
+    if (   !pThis->fRecvInBatch
+        && pThis->pIAboveNet->pfnNotifyReceiveBatch)
+    {
+        pThis->pIAboveNet->pfnNotifyReceiveBatch(pThis->pIAboveNet, true /*fBegin*/);
+        pThis->fRecvInBatch = true;
+        STAM_REL_COUNTER_INC(&pThis->StatRecvBatches);
+    }
+}
+
+
+/**
+ * Closes the current receive batch, letting the device above notify the guest.
+ *
+ * @param   pThis       Pointer to the instance data.
+ */
+DECLINLINE(void) drvR3IntNetRecvBatchEnd(PDRVINTNET pThis)
+{
+    if (pThis->fRecvInBatch)
+    {
+        pThis->fRecvInBatch = false;
+        pThis->pIAboveNet->pfnNotifyReceiveBatch(pThis->pIAboveNet, false /*fBegin*/);
+    }
+}
+
+
+/**
+ * Polls the receive ring for a short while before we go to sleep in ring-0.
+ *
+ * The polling window adapts to the traffic: it is doubled (up to
+ * ReceivePollMaxUs) whenever polling pays off and halved whenever it doesn't,
+ * so an idle interface quickly stops burning CPU while a busy one stays out of
+ * IntNetR0IfWait (and the switch skips the wakeups as nobody is sleeping).
+ *
+ * @returns true if there are frames to read, false if the caller should block
+ *          (or check the state).
+ * @param   pThis       Pointer to the instance data.
+ * @param   pRingBuf    The receive ring.
+ */
+static bool drvR3IntNetRecvPoll(PDRVINTNET pThis, PINTNETRINGBUF pRingBuf)
+{
+    uint32_t const cNsPoll = pThis->cNsRecvPoll;
+    if (!cNsPoll)
+        return false;
+
+    uint64_t const u64Start = RTTimeNanoTS();
+    for (;;)
+    {
+        if (IntNetRingHasMoreToRead(pRingBuf))
+        {
+            STAM_REL_COUNTER_INC(&pThis->StatRecvPollHits);
+            pThis->cNsRecvPoll = RT_MIN(cNsPoll * 2, pThis->cNsRecvPollMax);
+            return true;
+        }
+        if (pThis->enmRecvState != RECVSTATE_RUNNING)
+            return false;
+        if (RTTimeNanoTS() - u64Start >= cNsPoll)
+            break;
+        ASMNopPause();
+    }
+
+    STAM_REL_COUNTER_INC(&pThis->StatRecvPollMisses);
+    pThis->cNsRecvPoll = RT_MAX(cNsPoll / 2, RT_MIN(DRVINTNET_MIN_RECV_POLL_NS, pThis->cNsRecvPollMax));
+    return false;
+}
+
+
 /**
  * Wait for space to become available up the driver/device chain.
  *
+ * The current receive batch is closed before blocking so the guest gets to see
+ * (and hopefully free up) the frames we've already passed up.  It is reopened
+ * if the wait succeeds.
+ *
  * @returns VINF_SUCCESS if space is available.
  * @returns VERR_STATE_CHANGED if the state changed.
  * @returns VBox status code on other errors.
@@ -657,9 +785,17 @@ static DECLCALLBACK(int) drvR3IntNetXmitWakeUp(PPDMDRVINS pDrvIns, PPDMTHREAD pT
 static int drvR3IntNetRecvWaitForSpace(PDRVINTNET pThis)
 {
     LogFlow(("drvR3IntNetRecvWaitForSpace:\n"));
+    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, 0);
+    if (rc == VINF_SUCCESS)
+        return rc;
+
+    bool const fInBatch = pThis->fRecvInBatch;
+    drvR3IntNetRecvBatchEnd(pThis);
     STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
-    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+    rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
     STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
+    if (RT_SUCCESS(rc) && fInBatch)
+        drvR3IntNetRecvBatchBegin(pThis);
     LogFlow(("drvR3IntNetRecvWaitForSpace: returns %Rrc\n", rc));
     return rc;
 }
@@ -683,6 +819,7 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
     STAM_PROFILE_ADV_START(&pThis->StatReceive, a);
     PINTNETBUF      pBuf     = pThis->CTX_SUFF(pBuf);
     PINTNETRINGBUF  pRingBuf = &pBuf->Recv;
+    uint32_t        cInBatch = 0;
     for (;;)
     {
         /*
@@ -696,6 +833,7 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
              */
             if (pThis->enmRecvState != RECVSTATE_RUNNING)
             {
+                drvR3IntNetRecvBatchEnd(pThis);
                 STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
                 LogFlow(("drvR3IntNetRecvRun: returns VERR_STATE_CHANGED (state changed - #0)\n"));
                 return VERR_STATE_CHANGED;
@@ -708,12 +846,22 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
                 &&  !pThis->fLinkDown)
             {
                 /*
-                 * Check if there is room for the frame and pass it up.
+                 * Check if there is room for the frame and pass it up.  Frames
+                 * are passed up in batches so the device can coalesce the
+                 * receive interrupts.
                  */
                 size_t cbFrame = pHdr->cbFrame;
                 int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, 0);
                 if (rc == VINF_SUCCESS)
                 {
+                    if (!pThis->fRecvInBatch || cInBatch >= pThis->cRecvBatchMax)
+                    {
+                        drvR3IntNetRecvBatchEnd(pThis);
+                        drvR3IntNetRecvBatchBegin(pThis);
+                        cInBatch = 0;
+                    }
+                    cInBatch++;
+
                     if (u8Type == INTNETHDR_TYPE_FRAME)
                     {
                         /*
@@ -836,6 +984,14 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
             }
         } /* while more received data */
 
+        /*
+         * Let the device notify the guest about what we've passed up so far,
+         * then poll for a little while before going to sleep.
+         */
+        drvR3IntNetRecvBatchEnd(pThis);
+        if (drvR3IntNetRecvPoll(pThis, pRingBuf))
+            continue;
+
         /*
          * Wait for data, checking the state before we block.
          */
@@ -1222,8 +1378,13 @@ static DECLCALLBACK(void) drvR3IntNetDestruct(PPDMDRVINS pDrvIns)
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend2);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv1);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv2);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatRecvWakeupsSkipped);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceivedGso);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatSentGso);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatXmitBatchFull);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvBatches);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvPollHits);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvPollMisses);
 #ifdef VBOX_WITH_STATISTICS
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
@@ -1382,6 +1543,9 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
                                   "|TrunkType"
                                   "|ReceiveBufferSize"
                                   "|SendBufferSize"
+                                  "|SendBatchSize"
+                                  "|ReceiveBatchSize"
+                                  "|ReceivePollMaxUs"
                                   "|SharedMacOnWire"
                                   "|RestrictAccess"
                                   "|RequireExactPolicyMatch"
@@ -1641,6 +1805,52 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     if (OpenReq.cbSend < VBOX_MAX_GSO_SIZE * 3)
         LogRel(("DrvIntNet: Warning! SendBufferSize=%u, Recommended minimum size %u butes.\n", OpenReq.cbSend, VBOX_MAX_GSO_SIZE * 4));
 
+    /** @cfgm{SendBatchSize, uint32_t, 32}
+     * The max number of frames committed to the send ring before they are
+     * pushed thru the switch.  Whatever is left at the end of a transmit run
+     * is pushed right away, so this only limits the latency of long bursts.
+     * 1 gives the old behaviour of one switch call per frame.
+     */
+    rc = CFGMR3QueryU32Def(pCfg, "SendBatchSize", &pThis->cXmitBatchMax, DRVINTNET_DEF_SEND_BATCH);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"SendBatchSize\" value"));
+    if (pThis->cXmitBatchMax < 1 || pThis->cXmitBatchMax > _4K)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("Configuration error: \"SendBatchSize\"=%u is out of range (1..4096)"),
+                                   pThis->cXmitBatchMax);
+
+    /** @cfgm{ReceiveBatchSize, uint32_t, 64}
+     * The max number of frames passed up to the device before it is told to
+     * notify the guest.  Only matters for devices implementing
+     * PDMINETWORKDOWN::pfnNotifyReceiveBatch.
+     */
+    rc = CFGMR3QueryU32Def(pCfg, "ReceiveBatchSize", &pThis->cRecvBatchMax, DRVINTNET_DEF_RECV_BATCH);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"ReceiveBatchSize\" value"));
+    if (pThis->cRecvBatchMax < 1 || pThis->cRecvBatchMax > _4K)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("Configuration error: \"ReceiveBatchSize\"=%u is out of range (1..4096)"),
+                                   pThis->cRecvBatchMax);
+
+    /** @cfgm{ReceivePollMaxUs, uint32_t, 50}
+     * The max number of microseconds the receive thread polls the ring for new
+     * frames before blocking in ring-0.  The actual polling window adapts to
+     * the traffic.  0 disables polling.
+     */
+    uint32_t cUsRecvPollMax;
+    rc = CFGMR3QueryU32Def(pCfg, "ReceivePollMaxUs", &cUsRecvPollMax, DRVINTNET_DEF_RECV_POLL_US);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"ReceivePollMaxUs\" value"));
+    if (cUsRecvPollMax > RT_US_1SEC / 100)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("Configuration error: \"ReceivePollMaxUs\"=%u is out of range (0..10000)"),
+                                   cUsRecvPollMax);
+    pThis->cNsRecvPollMax = cUsRecvPollMax * RT_NS_1US;
+    pThis->cNsRecvPoll    = pThis->cNsRecvPollMax;
+
     /** @cfgm{IsService, boolean, true}
      * This alterns the way the thread is suspended and resumed. When it's being used by
      * a service such as LWIP/iSCSI it shouldn't suspend immediately like for a NIC.
@@ -1804,6 +2014,11 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitWakeupR0,           "XmitWakeup-R0",        "Xmit thread wakeups from ring-0.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitWakeupR3,           "XmitWakeup-R3",        "Xmit thread wakeups from ring-3.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitProcessRing,        "XmitProcessRing",      "Time xmit thread was told to process the ring.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatXmitBatchFull,          "XmitBatchFull",        "Times a full send batch was pushed thru the switch.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatRecvBatches,            "RecvBatches",          "Number of receive batches passed up.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatRecvPollHits,           "RecvPollHits",         "Times polling the receive ring found new frames.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatRecvPollMisses,         "RecvPollMisses",       "Times polling the receive ring came up empty.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatRecvWakeupsSkipped, "RecvWakeupsSkipped", "Receive wakeups skipped because nobody was waiting.");
 
     /*
      * Create the async I/O threads.
@@ -44,6 +44,7 @@ extern "C" {
 #include <iprt/uuid.h>
 
 #include "VBoxDD.h"
+#include "DrvNATGso.h"
 
 #ifndef RT_OS_WINDOWS
 # include <unistd.h>
@@ -71,6 +72,12 @@ extern "C" {
 
 #define DRVNAT_MAXFRAMESIZE (16 * 1024)
 
+#ifdef VBOX_NAT_WITH_EPOLL
+/** The number of events collected per epoll_wait() call, whatever doesn't
+ * fit is reported again by the next one. */
+# define DRVNAT_EPOLL_EVENTS 256
+#endif
+
 /**
  * @todo: This is a bad hack to prevent freezing the guest during high network
  *        activity. Windows host only. This needs to be fixed properly.
@@ -281,6 +288,66 @@ static DECLCALLBACK(int) drvNATUrgRecvWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
     return VINF_SUCCESS;
 }
 
+/**
+ * Passes a frame produced by slirp to the device above.
+ *
+ * Large TCP segments (see slirp_set_gso_output) are handed over as GSO frames
+ * when the device takes them and segmented here otherwise.
+ *
+ * @returns VBox status code.
+ * @param   pThis               Pointer to the NAT instance.
+ * @param   pu8Buf              The frame. Modified when it needs segmenting.
+ * @param   cb                  The frame size.
+ * @param   m                   The mbuf holding the frame.
+ * @remarks Called owning DevAccessLock after waiting for receive buffers.
+ */
+static int drvNATRecvDeliver(PDRVNAT pThis, uint8_t *pu8Buf, int cb, struct mbuf *m)
+{
+    uint16_t const cbMaxSeg = slirp_ext_m_get_tso_segsz(m);
+    if (!cbMaxSeg)
+        return pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pu8Buf, cb);
+
+    PDMNETWORKGSO Gso;
+    if (!drvNATGsoInitFromFrame(&Gso, pu8Buf, cb, cbMaxSeg))
+    {
+        AssertMsgFailed(("cb=%#x cbMaxSeg=%#x\n", cb, cbMaxSeg));
+        return VERR_INVALID_PARAMETER;
+    }
+
+    STAM_COUNTER_INC(&pThis->StatNATRecvGso);
+    if (pThis->pIAboveNet->pfnReceiveGso)
+    {
+        /* The device computes the payload checksum, it wants the pseudo header one. */
+        PDMNetGsoPrepForDirectUse(&Gso, pu8Buf, cb, PDMNETCSUMTYPE_PSEUDO);
+        int rc = pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pu8Buf, cb, &Gso);
+        if (RT_SUCCESS(rc))
+            return rc;
+    }
+
+    /*
+     * No luck (e.g. the guest didn't negotiate it), segment it ourselves.
+     */
+    STAM_COUNTER_INC(&pThis->StatNATRecvGsoCarved);
+    uint8_t         abHdrScratch[256];
+    uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(&Gso, cb);
+    int             rc = VINF_SUCCESS;
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        if (iSeg)
+        {
+            rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+            if (RT_FAILURE(rc))
+                break; /* we drop the rest. */
+        }
+        uint32_t cbSegFrame;
+        void    *pvSegFrame = PDMNetGsoCarveSegmentQD(&Gso, pu8Buf, cb, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvSegFrame, cbSegFrame);
+        AssertRC(rc);
+    }
+    return rc;
+}
+
+
 static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int cb, struct mbuf *m)
 {
     int rc = RTCritSectEnter(&pThis->DevAccessLock);
@@ -288,7 +355,7 @@ static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, in
     rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
     if (RT_SUCCESS(rc))
     {
-        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pu8Buf, cb);
+        rc = drvNATRecvDeliver(pThis, pu8Buf, cb, m);
         AssertRC(rc);
     }
     else if (   rc != VERR_TIMEOUT
@@ -333,7 +400,7 @@ static DECLCALLBACK(void) drvNATRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int c
 
     if (RT_SUCCESS(rc))
     {
-        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pu8Buf, cb);
+        rc = drvNATRecvDeliver(pThis, pu8Buf, cb, m);
         AssertRC(rc);
     }
     else if (   rc != VERR_TIMEOUT
@@ -380,6 +447,58 @@ static void drvNATFreeSgBuf(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
     RTMemFree(pSgBuf);
 }
 
+/**
+ * Feeds a TCP/IPv4 GSO frame to slirp as a few large segments instead of
+ * carving it into MSS sized ones.
+ *
+ * Each chunk carries a whole number of segments and fits into the largest mbuf
+ * cluster.  The IP header is fixed up per chunk, the TCP checksum is left as the
+ * guest supplied it and the chunk is marked as validated for tcp_input.
+ *
+ * @returns true if the frame was consumed, false if it must be segmented.
+ * @param   pThis               Pointer to the NAT instance.
+ * @param   pGso                The GSO context.
+ * @param   pbFrame             The frame.
+ * @param   cbFrame             The frame size.
+ * @thread  NAT
+ */
+static bool drvNATSendGsoTcp(PDRVNAT pThis, PCPDMNETWORKGSO pGso, uint8_t const *pbFrame, uint32_t cbFrame)
+{
+    uint32_t const cbHdrs     = pGso->cbHdrsTotal;
+    uint32_t const cbChunkMax = drvNATGsoCalcChunkPayload(pGso, DRVNAT_MAXFRAMESIZE - 1);
+    if (!cbChunkMax)
+        return false;
+    STAM_COUNTER_INC(&pThis->StatNATSendGso);
+
+    PCRTNETIPV4    pIpHdr   = (PCRTNETIPV4)(pbFrame + pGso->offHdr1);
+    PCRTNETTCP     pTcpHdr  = (PCRTNETTCP)(pbFrame + pGso->offHdr2);
+    uint16_t const uIpId    = RT_N2H_U16(pIpHdr->ip_id);
+    uint32_t const uSeq     = RT_N2H_U32(pTcpHdr->th_seq);
+    uint32_t const cbPayload = cbFrame - cbHdrs;
+    uint32_t       offPayload = 0;
+    for (uint16_t iChunk = 0; offPayload < cbPayload; iChunk++)
+    {
+        uint32_t const cbChunk = RT_MIN(cbChunkMax, cbPayload - offPayload);
+        size_t         cbBuf;
+        void          *pvBuf;
+        struct mbuf   *m = slirp_ext_m_get(pThis->pNATState, cbHdrs + cbChunk, &pvBuf, &cbBuf);
+        if (!m)
+            break;
+
+        uint8_t *pbChunk = (uint8_t *)pvBuf;
+        memcpy(pbChunk, pbFrame, cbHdrs);
+        memcpy(pbChunk + cbHdrs, pbFrame + cbHdrs + offPayload, cbChunk);
+
+        drvNATGsoFixupChunk(pGso, pbChunk, iChunk, uIpId, uSeq, offPayload, cbChunk,
+                            offPayload + cbChunk >= cbPayload);
+        offPayload += cbChunk;
+
+        slirp_ext_m_set_csum_valid(m);
+        slirp_input(pThis->pNATState, m, cbHdrs + cbChunk);
+    }
+    return true;
+}
+
 /**
  * Worker function for drvNATSend().
  *
@@ -401,12 +520,12 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
             pSgBuf->pvAllocator = NULL;
             slirp_input(pThis->pNATState, m, pSgBuf->cbUsed);
         }
-        else
+        else if (!drvNATSendGsoTcp(pThis, (PCPDMNETWORKGSO)pSgBuf->pvUser,
+                                   (uint8_t const *)pSgBuf->aSegs[0].pvSeg, (uint32_t)pSgBuf->cbUsed))
         {
             /*
-             * GSO frame, need to segment it.
+             * GSO frame slirp can't take in one go, need to segment it.
              */
-            /** @todo Make the NAT engine grok large frames?  Could be more efficient... */
 #if 0 /* this is for testing PDMNetGsoCarveSegmentQD. */
             uint8_t         abHdrScratch[256];
 #endif
@@ -772,7 +891,54 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
         /*
          * To prevent concurrent execution of sending/receiving threads
          */
-#ifndef RT_OS_WINDOWS
+#if defined(VBOX_NAT_WITH_EPOLL)
+        /*
+         * The sockets (and the management pipe) stay registered with the
+         * epoll set, slirp_select_fill only updates what changed.
+         */
+        struct epoll_event aEvents[DRVNAT_EPOLL_EVENTS];
+        bool fPipe = false;
+
+        NOREF(nFDs);
+        slirp_select_fill(pThis->pNATState);
+
+        int cEvents = epoll_wait(slirp_get_epoll_fd(pThis->pNATState), aEvents, RT_ELEMENTS(aEvents),
+                                 slirp_get_timeout_ms(pThis->pNATState));
+        if (cEvents < 0)
+        {
+            if (errno == EINTR)
+            {
+                Log2(("NAT: signal was caught while sleep on epoll_wait\n"));
+                /* No error, just process all outstanding requests but don't wait */
+                cEvents = 0;
+            }
+            else if (cPollNegRet++ > 128)
+            {
+                LogRel(("NAT:epoll_wait returns (%s) suppressed %d\n", strerror(errno), cPollNegRet));
+                cPollNegRet = 0;
+            }
+        }
+
+        if (cEvents >= 0)
+        {
+            /* the management pipe is the only descriptor without a socket attached */
+            for (int i = 0; i < cEvents; i++)
+                if (aEvents[i].data.ptr == NULL)
+                    fPipe = true;
+
+            slirp_select_poll(pThis->pNATState, aEvents, cEvents);
+            if (fPipe)
+            {
+                /* drain the pipe, see the poll() variant below */
+                char ch;
+                size_t cbRead;
+                RTPipeRead(pThis->hPipeRead, &ch, 1, &cbRead);
+            }
+        }
+        /* process _all_ outstanding requests but don't wait */
+        RTReqQueueProcess(pThis->hSlirpReqQueue, 0);
+
+#elif !defined(RT_OS_WINDOWS)
         nFDs = slirp_get_nsock(pThis->pNATState);
         /* allocation for all sockets + Management pipe */
         struct pollfd *polls = (struct pollfd *)RTMemAlloc((1 + nFDs) * sizeof(struct pollfd) + sizeof(uint32_t));
@@ -1485,6 +1651,8 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
         slirp_set_dhcp_next_server(pThis->pNATState, pThis->pszNextServer);
         slirp_set_dhcp_dns_proxy(pThis->pNATState, !!fDNSProxy);
         slirp_set_mtu(pThis->pNATState, MTU);
+        /* Large receive segments if the device above can take GSO frames. */
+        slirp_set_gso_output(pThis->pNATState, pThis->pIAboveNet->pfnReceiveGso != NULL);
         slirp_set_somaxconn(pThis->pNATState, i32SoMaxConn);
         char *pszBindIP = NULL;
         GET_STRING_ALLOC(rc, pThis, pCfg, "BindIP", pszBindIP);
@@ -1576,6 +1744,10 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
              */
             rc = RTPipeCreate(&pThis->hPipeRead, &pThis->hPipeWrite, 0 /*fFlags*/);
             AssertRCReturn(rc, rc);
+# ifdef VBOX_NAT_WITH_EPOLL
+            rc = slirp_register_external_fd(pThis->pNATState, (int)RTPipeToNative(pThis->hPipeRead));
+            AssertRCReturn(rc, rc);
+# endif
 #else
             pThis->hWakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL); /* auto-reset event */
             slirp_register_external_event(pThis->pNATState, pThis->hWakeupEvent,
@@ -0,0 +1,114 @@
+/* $Id: DrvNATGso.h $ */
+/** @file
+ * DrvNAT - NAT network transport driver, large TCP segment helpers.
+ *
+ * Kept apart from the driver so the testcase can check it directly.  The
+ * includer must include VBox/vmm/pdmnetinline.h first, it has no include
+ * guard.
+ */
+
+/*
+ * Copyright (C) 2006-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___DrvNATGso_h
+#define ___DrvNATGso_h
+
+#include <VBox/vmm/pdmnetifs.h>
+#include <iprt/net.h>
+
+
+/**
+ * Calculates how much TCP payload of a GSO frame goes into one chunk fed to
+ * slirp, a whole number of segments.
+ *
+ * @returns The chunk payload size, 0 if chunks wouldn't carry more than a
+ *          single segment and the frame should be segmented the usual way.
+ * @param   pGso                The GSO context.
+ * @param   cbFrameMax          The largest frame slirp takes, headers included.
+ */
+DECLINLINE(uint32_t) drvNATGsoCalcChunkPayload(PCPDMNETWORKGSO pGso, uint32_t cbFrameMax)
+{
+    if (   pGso->u8Type != PDMNETWORKGSOTYPE_IPV4_TCP
+        || !pGso->cbMaxSeg
+        || pGso->cbHdrsTotal >= cbFrameMax)
+        return 0;
+    uint32_t const cbChunk = (cbFrameMax - pGso->cbHdrsTotal) / pGso->cbMaxSeg * pGso->cbMaxSeg;
+    return cbChunk > pGso->cbMaxSeg ? cbChunk : 0;
+}
+
+
+/**
+ * Fixes up the IPv4 and TCP headers of a chunk copied from a TCP/IPv4 GSO
+ * frame.
+ *
+ * The TCP checksum is left alone, the chunk must be marked as validated for
+ * tcp_input.
+ *
+ * @param   pGso                The GSO context.
+ * @param   pbChunk             The chunk, headers followed by @a cbChunk bytes
+ *                              of payload.
+ * @param   iChunk              The chunk number.
+ * @param   uIpId               The IP ID of the GSO frame (host order).
+ * @param   uSeq                The TCP sequence number of the GSO frame (host
+ *                              order).
+ * @param   offPayload          The offset of the chunk payload into the GSO
+ *                              frame payload.
+ * @param   cbChunk             The chunk payload size.
+ * @param   fLast               Whether this is the last chunk, which keeps FIN
+ *                              and PSH.
+ */
+DECLINLINE(void) drvNATGsoFixupChunk(PCPDMNETWORKGSO pGso, uint8_t *pbChunk, uint16_t iChunk, uint16_t uIpId,
+                                     uint32_t uSeq, uint32_t offPayload, uint32_t cbChunk, bool fLast)
+{
+    PRTNETIPV4 pIpHdr = (PRTNETIPV4)(pbChunk + pGso->offHdr1);
+    pIpHdr->ip_len = RT_H2N_U16((uint16_t)(pGso->cbHdrsTotal - pGso->offHdr1 + cbChunk));
+    pIpHdr->ip_id  = RT_H2N_U16((uint16_t)(uIpId + iChunk));
+    pIpHdr->ip_sum = RTNetIPv4HdrChecksum(pIpHdr);
+
+    PRTNETTCP pTcpHdr = (PRTNETTCP)(pbChunk + pGso->offHdr2);
+    pTcpHdr->th_seq = RT_H2N_U32(uSeq + offPayload);
+    if (!fLast)
+        pTcpHdr->th_flags &= ~(RTNETTCP_F_FIN | RTNETTCP_F_PSH);
+}
+
+
+/**
+ * Sets up the GSO context for a large TCP/IPv4 segment produced by slirp.
+ *
+ * @returns true if the context is valid for the frame, false if not.
+ * @param   pGso                Where to return the GSO context.
+ * @param   pbFrame             The frame, starting with the ethernet header.
+ * @param   cbFrame             The frame size.
+ * @param   cbMaxSeg            The TCP segment size.
+ */
+DECLINLINE(bool) drvNATGsoInitFromFrame(PPDMNETWORKGSO pGso, uint8_t const *pbFrame, uint32_t cbFrame, uint16_t cbMaxSeg)
+{
+    if (   !cbMaxSeg
+        || cbFrame < sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + RTNETTCP_MIN_LEN)
+        return false;
+    PCRTNETIPV4 pIpHdr  = (PCRTNETIPV4)(pbFrame + sizeof(RTNETETHERHDR));
+    uint32_t const cbIpHdr = pIpHdr->ip_hl * 4;
+    if (cbFrame < sizeof(RTNETETHERHDR) + cbIpHdr + RTNETTCP_MIN_LEN)
+        return false;
+    PCRTNETTCP  pTcpHdr = (PCRTNETTCP)((uint8_t const *)pIpHdr + cbIpHdr);
+
+    pGso->u8Type      = PDMNETWORKGSOTYPE_IPV4_TCP;
+    pGso->offHdr1     = sizeof(RTNETETHERHDR);
+    pGso->offHdr2     = (uint8_t)(pGso->offHdr1 + cbIpHdr);
+    pGso->cbHdrsTotal = (uint8_t)(pGso->offHdr2 + pTcpHdr->th_off * 4);
+    pGso->cbHdrsSeg   = pGso->cbHdrsTotal;
+    pGso->u8Unused    = 0;
+    pGso->cbMaxSeg    = cbMaxSeg;
+    return PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame);
+}
+
+#endif
@@ -248,6 +248,17 @@ static DECLCALLBACK(void) drvR3NetShaperDown_XmitPending(PPDMINETWORKDOWN pInter
 }
 
 
+/**
+ * @interface_method_impl{PDMINETWORKDOWN,pfnNotifyReceiveBatch}
+ */
+static DECLCALLBACK(void) drvR3NetShaperDown_NotifyReceiveBatch(PPDMINETWORKDOWN pInterface, bool fBegin)
+{
+    PDRVNETSHAPER pThis = RT_FROM_MEMBER(pInterface, DRVNETSHAPER, INetworkDown);
+    if (pThis->pIAboveNet->pfnNotifyReceiveBatch)
+        pThis->pIAboveNet->pfnNotifyReceiveBatch(pThis->pIAboveNet, fBegin);
+}
+
+
 /**
  * Gets the current Media Access Control (MAC) address.
  *
@@ -436,6 +447,7 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
     pThis->INetworkDown.pfnReceive                  = drvR3NetShaperDown_Receive;
     pThis->INetworkDown.pfnReceiveGso               = drvR3NetShaperDown_ReceiveGso;
     pThis->INetworkDown.pfnXmitPending              = drvR3NetShaperDown_XmitPending;
+    pThis->INetworkDown.pfnNotifyReceiveBatch       = drvR3NetShaperDown_NotifyReceiveBatch;
     /* INetworkConfig */
     pThis->INetworkConfig.pfnGetMac                 = drvR3NetShaperDownCfg_GetMac;
     pThis->INetworkConfig.pfnGetLinkState           = drvR3NetShaperDownCfg_GetLinkState;
@@ -23,20 +23,44 @@
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmnetifs.h>
 
+#include <VBox/vmm/pdmnetinline.h>
+
 #include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/asm-math.h>
 #include <iprt/assert.h>
 #include <iprt/critsect.h>
 #include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/process.h>
+#include <iprt/semaphore.h>
 #include <iprt/string.h>
 #include <iprt/time.h>
 #include <iprt/uuid.h>
 #include <VBox/param.h>
 
+#include "DrvNetSnifferCapture.h"
 #include "Pcap.h"
 #include "VBoxDD.h"
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The default snap length. */
+#define DRVNETSNIFFER_DEF_SNAPLEN           UINT32_C(0xffff)
+/** The default snap length in async mode, where every ring entry is
+ * dimensioned for it.  Covers a full (VLAN tagged) Ethernet frame. */
+#define DRVNETSNIFFER_DEF_ASYNC_SNAPLEN     UINT32_C(1536)
+/** The default number of ring entries in async mode. */
+#define DRVNETSNIFFER_DEF_RING_ENTRIES      UINT32_C(1024)
+/** The max number of ring entries in async mode. */
+#define DRVNETSNIFFER_MAX_RING_ENTRIES      UINT32_C(65536)
+/** The size of the buffer the writer thread collects blocks in. */
+#define DRVNETSNIFFER_WRITE_BUF_SIZE        _256K
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
@@ -75,9 +99,256 @@ typedef struct DRVNETSNIFFER
     /** For when we're the leaf driver. */
     RTCRITSECT              XmitLock;
 
+    /** Whether to write pcapng rather than classic pcap. */
+    bool                    fPcapNg;
+    /** Whether frames go through the capture ring and pWriterThread (pcapng
+     * only) instead of being written synchronously on the data path. */
+    bool                    fAsync;
+    /** Set by the writer thread before it goes to sleep. */
+    bool volatile           fWriterSleeping;
+    /** Set when a write to the file failed (logged once). */
+    bool                    fWriteError;
+    /** The max number of bytes recorded per frame. */
+    uint32_t                cbSnapLen;
+    /** The capture filter. */
+    DRVNETSNIFFERFILTER     Filter;
+    /** TM virtual time when the driver was constructed. */
+    uint64_t                u64VirtStart;
+    /** TM virtual clock frequency. */
+    uint64_t                u64VirtFreq;
+    /** Wall clock time (nanoseconds since the Unix epoch) matching u64VirtStart. */
+    uint64_t                u64EpochStart;
+
+    /** The capture ring (async mode), drained by the writer thread. */
+    DRVNETSNIFFERRING       Ring;
+    /** The buffer the writer thread collects blocks in. */
+    uint8_t                *pbWriteBuf;
+    /** The writer thread. */
+    PPDMTHREAD              pWriterThread;
+    /** Event semaphore the writer thread sleeps on. */
+    RTSEMEVENT              hEvtWriter;
+
+    /** Number of frames captured. */
+    STAMCOUNTER             StatCaptured;
+    /** Number of frames dropped because the ring was full. */
+    STAMCOUNTER             StatDropped;
+    /** Number of frames rejected by the filter. */
+    STAMCOUNTER             StatFiltered;
+    /** Number of bytes written to the file. */
+    STAMCOUNTER             StatWritten;
 } DRVNETSNIFFER, *PDRVNETSNIFFER;
 
 
+/**
+ * Gets the capture timestamp for a frame, nanoseconds since the Unix epoch.
+ *
+ * Derived from the TM virtual clock so it matches the guest's view of time
+ * and does not advance while the VM is paused.
+ *
+ * @returns Timestamp.
+ * @param   pThis           The sniffer instance.
+ */
+DECLINLINE(uint64_t) drvNetSnifferNanoTS(PDRVNETSNIFFER pThis)
+{
+    uint64_t u64Elapsed = PDMDrvHlpTMGetVirtualTime(pThis->pDrvIns) - pThis->u64VirtStart;
+    if (pThis->u64VirtFreq != RT_NS_1SEC)
+        u64Elapsed = ASMMultU64ByU32DivByU32(u64Elapsed, RT_NS_1SEC, (uint32_t)pThis->u64VirtFreq);
+    return pThis->u64EpochStart + u64Elapsed;
+}
+
+
+/**
+ * Puts a frame into the capture ring, dropping it when the ring is full.
+ *
+ * Safe to call from several threads at once.
+ *
+ * @param   pThis           The sniffer instance.
+ * @param   NanoTS          The timestamp.
+ * @param   fInbound        The direction.
+ * @param   pvHdrs          The start of the frame.
+ * @param   cbHdrs          The size of the first part.
+ * @param   pvPayload       The rest of the frame, optional.
+ * @param   cbPayload       The size of the rest of the frame.
+ * @param   cbMax           The max number of bytes to record, not more than
+ *                          cbSnapLen.
+ */
+static void drvNetSnifferRingPut(PDRVNETSNIFFER pThis, uint64_t NanoTS, bool fInbound,
+                                 const void *pvHdrs, size_t cbHdrs, const void *pvPayload, size_t cbPayload,
+                                 size_t cbMax)
+{
+    uint32_t           iPos;
+    PDRVNETSNIFFERSLOT pSlot = drvNetSnifferRingClaim(&pThis->Ring, &iPos);
+    if (!pSlot)
+    {
+        /* Full, never block the guest. */
+        STAM_REL_COUNTER_INC(&pThis->StatDropped);
+        return;
+    }
+
+    pSlot->cbBlock = (uint32_t)PcapNgFormatFrame(pSlot + 1, NanoTS, fInbound, pvHdrs, cbHdrs,
+                                                 pvPayload, cbPayload, cbMax);
+    drvNetSnifferRingCommit(pSlot, iPos);
+    STAM_REL_COUNTER_INC(&pThis->StatCaptured);
+
+    if (ASMAtomicReadBool(&pThis->fWriterSleeping))
+        RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
+/**
+ * Writes the collected blocks to the file.
+ */
+static void drvNetSnifferWrite(PDRVNETSNIFFER pThis, const void *pvBuf, size_t cb)
+{
+    int rc = RTFileWrite(pThis->hFile, pvBuf, cb, NULL);
+    if (RT_SUCCESS(rc))
+        STAM_REL_COUNTER_ADD(&pThis->StatWritten, cb);
+    else if (!pThis->fWriteError)
+    {
+        pThis->fWriteError = true;
+        LogRel(("NetSniffer#%u: Writing to '%s' failed: %Rrc\n", pThis->pDrvIns->iInstance, pThis->szFilename, rc));
+    }
+}
+
+
+/**
+ * Drains the capture ring into the file.
+ *
+ * @returns The number of frames written.
+ * @param   pThis           The sniffer instance.
+ * @thread  The writer thread, or the destructor after it has terminated.
+ */
+static uint32_t drvNetSnifferRingFlush(PDRVNETSNIFFER pThis)
+{
+    uint32_t cFrames = 0;
+    size_t   offBuf  = 0;
+    PDRVNETSNIFFERSLOT pSlot;
+    while ((pSlot = drvNetSnifferRingPeek(&pThis->Ring)) != NULL)
+    {
+        uint32_t const cbBlock = pSlot->cbBlock;
+        if (offBuf + cbBlock > DRVNETSNIFFER_WRITE_BUF_SIZE)
+        {
+            drvNetSnifferWrite(pThis, pThis->pbWriteBuf, offBuf);
+            offBuf = 0;
+        }
+        if (cbBlock <= DRVNETSNIFFER_WRITE_BUF_SIZE)
+        {
+            memcpy(pThis->pbWriteBuf + offBuf, pSlot + 1, cbBlock);
+            offBuf += cbBlock;
+        }
+        else
+            drvNetSnifferWrite(pThis, pSlot + 1, cbBlock);
+
+        drvNetSnifferRingRelease(&pThis->Ring, pSlot);
+        cFrames++;
+    }
+    if (offBuf)
+        drvNetSnifferWrite(pThis, pThis->pbWriteBuf, offBuf);
+    return cFrames;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADDRV, Writes the captured frames.}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        if (drvNetSnifferRingFlush(pThis))
+            continue;
+
+        /* Announce that we're going to sleep and recheck so we don't miss
+           a frame put in before the producer saw the flag. */
+        ASMAtomicWriteBool(&pThis->fWriterSleeping, true);
+        if (!drvNetSnifferRingPeek(&pThis->Ring))
+            RTSemEventWait(pThis->hEvtWriter, RT_INDEFINITE_WAIT);
+        ASMAtomicWriteBool(&pThis->fWriterSleeping, false);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDRV}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+    return RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
+/**
+ * Captures a frame, subject to the filter and snap length.
+ *
+ * @param   pThis           The sniffer instance.
+ * @param   fInbound        Whether the frame is received (true) or sent
+ *                          (false) by the guest.
+ * @param   pGso            The GSO context if a GSO frame, NULL if not.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   cbAvail         The number of bytes available at @a pvFrame.
+ */
+static void drvNetSnifferCapture(PDRVNETSNIFFER pThis, bool fInbound, PCPDMNETWORKGSO pGso,
+                                 const void *pvFrame, size_t cbFrame, size_t cbAvail)
+{
+    if (!(fInbound ? pThis->Filter.fInbound : pThis->Filter.fOutbound))
+        return;
+    if (   pThis->Filter.fActive
+        && !drvNetSnifferFilterMatch(&pThis->Filter, (const uint8_t *)pvFrame, cbAvail))
+    {
+        STAM_REL_COUNTER_INC(&pThis->StatFiltered);
+        return;
+    }
+
+    if (pThis->fAsync)
+    {
+        uint64_t const NanoTS = drvNetSnifferNanoTS(pThis);
+        if (!pGso)
+            drvNetSnifferRingPut(pThis, NanoTS, fInbound, pvFrame, cbFrame, NULL, 0, RT_MIN(cbAvail, pThis->cbSnapLen));
+        else
+        {
+            /* One entry per segment, like the synchronous writers do it. */
+            uint8_t const  *pbFrame = (uint8_t const *)pvFrame;
+            uint8_t         abHdrs[256];
+            uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+            for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+            {
+                uint32_t cbSegPayload, cbHdrs;
+                uint32_t offSegPayload = PDMNetGsoCarveSegment(pGso, pbFrame, cbFrame, iSeg, cSegs,
+                                                               abHdrs, &cbHdrs, &cbSegPayload);
+                drvNetSnifferRingPut(pThis, NanoTS, fInbound, abHdrs, cbHdrs, pbFrame + offSegPayload, cbSegPayload,
+                                     pThis->cbSnapLen);
+            }
+        }
+        return;
+    }
+
+    RTCritSectEnter(&pThis->Lock);
+    if (pThis->fPcapNg)
+    {
+        uint64_t const NanoTS = drvNetSnifferNanoTS(pThis);
+        if (!pGso)
+            PcapNgFileFrame(pThis->hFile, NanoTS, fInbound, pvFrame, cbFrame, RT_MIN(cbAvail, pThis->cbSnapLen));
+        else
+            PcapNgFileGsoFrame(pThis->hFile, NanoTS, fInbound, pGso, pvFrame, cbFrame,
+                               RT_MIN(cbAvail, pThis->cbSnapLen));
+    }
+    else if (!pGso)
+        PcapFileFrame(pThis->hFile, pThis->StartNanoTS, pvFrame, cbFrame, RT_MIN(cbAvail, pThis->cbSnapLen));
+    else
+        PcapFileGsoFrame(pThis->hFile, pThis->StartNanoTS, pGso, pvFrame, cbFrame, RT_MIN(cbAvail, pThis->cbSnapLen));
+    RTCritSectLeave(&pThis->Lock);
+    STAM_REL_COUNTER_INC(&pThis->StatCaptured);
+}
+
+
 
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
@@ -131,18 +402,10 @@ static DECLCALLBACK(int) drvNetSnifferUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
         return VERR_NET_DOWN;
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    if (!pSgBuf->pvUser)
-        PcapFileFrame(pThis->hFile, pThis->StartNanoTS,
-                      pSgBuf->aSegs[0].pvSeg,
-                      pSgBuf->cbUsed,
-                      RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    else
-        PcapFileGsoFrame(pThis->hFile, pThis->StartNanoTS, (PCPDMNETWORKGSO)pSgBuf->pvUser,
+    drvNetSnifferCapture(pThis, false /*fInbound*/, (PCPDMNETWORKGSO)pSgBuf->pvUser,
                          pSgBuf->aSegs[0].pvSeg,
                          pSgBuf->cbUsed,
                          RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    RTCritSectLeave(&pThis->Lock);
 
     return pThis->pIBelowNet->pfnSendBuf(pThis->pIBelowNet, pSgBuf, fOnWorkerThread);
 }
@@ -204,9 +467,7 @@ static DECLCALLBACK(int) drvNetSnifferDown_Receive(PPDMINETWORKDOWN pInterface,
     PDRVNETSNIFFER pThis = RT_FROM_MEMBER(pInterface, DRVNETSNIFFER, INetworkDown);
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    PcapFileFrame(pThis->hFile, pThis->StartNanoTS, pvBuf, cb, cb);
-    RTCritSectLeave(&pThis->Lock);
+    drvNetSnifferCapture(pThis, true /*fInbound*/, NULL /*pGso*/, pvBuf, cb, cb);
 
     /* pass up */
     int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvBuf, cb);
@@ -351,6 +612,38 @@ static DECLCALLBACK(void) drvNetSnifferDestruct(PPDMDRVINS pDrvIns)
     PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
+    /*
+     * Stop the writer thread and write what's left in the ring.
+     */
+    if (pThis->pWriterThread)
+    {
+        int rc = PDMR3ThreadDestroy(pThis->pWriterThread, NULL);
+        AssertRC(rc);
+        pThis->pWriterThread = NULL;
+    }
+    if (pThis->Ring.pbRing)
+    {
+        if (pThis->hFile != NIL_RTFILE && pThis->pbWriteBuf)
+            drvNetSnifferRingFlush(pThis);
+        RTMemFree(pThis->Ring.pbRing);
+        pThis->Ring.pbRing = NULL;
+    }
+    if (pThis->pbWriteBuf)
+    {
+        RTMemFree(pThis->pbWriteBuf);
+        pThis->pbWriteBuf = NULL;
+    }
+    if (pThis->hEvtWriter != NIL_RTSEMEVENT)
+    {
+        RTSemEventDestroy(pThis->hEvtWriter);
+        pThis->hEvtWriter = NIL_RTSEMEVENT;
+    }
+
+    /* Record the capture statistics in the trailer of pcapng files. */
+    if (pThis->fPcapNg && pThis->hFile != NIL_RTFILE)
+        PcapNgFileStats(pThis->hFile, drvNetSnifferNanoTS(pThis),
+                        pThis->StatCaptured.c + pThis->StatDropped.c, pThis->StatDropped.c);
+
     if (RTCritSectIsInitialized(&pThis->Lock))
         RTCritSectDelete(&pThis->Lock);
 
@@ -380,6 +673,7 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
      */
     pThis->pDrvIns                                  = pDrvIns;
     pThis->hFile                                    = NIL_RTFILE;
+    pThis->hEvtWriter                               = NIL_RTSEMEVENT;
     /* The pcap file *must* start at time offset 0,0. */
     pThis->StartNanoTS                              = RTTimeNanoTS() - RTTimeProgramNanoTS();
     /* IBase */
@@ -412,7 +706,16 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "File\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "File\0"
+                                    "PcapNg\0"
+                                    "Async\0"
+                                    "SnapLen\0"
+                                    "RingEntries\0"
+                                    "FilterDirection\0"
+                                    "FilterEtherType\0"
+                                    "FilterIpProto\0"
+                                    "FilterHost\0"
+                                    "FilterPort\0"))
         return VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES;
 
     if (CFGMR3GetFirstChild(pCfg))
@@ -436,6 +739,87 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
         return rc;
     }
 
+    /*
+     * Get the capture mode.  Asynchronous capture puts the frames into a ring
+     * which a dedicated thread writes out, dropping frames rather than
+     * blocking the data path when the ring is full.  It writes pcapng.
+     */
+    rc = CFGMR3QueryBoolDef(pCfg, "Async", &pThis->fAsync, false);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"Async\" value"));
+    rc = CFGMR3QueryBoolDef(pCfg, "PcapNg", &pThis->fPcapNg, pThis->fAsync);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"PcapNg\" value"));
+    if (pThis->fAsync && !pThis->fPcapNg)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: Asynchronous capture requires the pcapng format"));
+
+    rc = CFGMR3QueryU32Def(pCfg, "SnapLen", &pThis->cbSnapLen,
+                           pThis->fAsync ? DRVNETSNIFFER_DEF_ASYNC_SNAPLEN : DRVNETSNIFFER_DEF_SNAPLEN);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"SnapLen\" value"));
+    if (pThis->cbSnapLen < sizeof(RTNETETHERHDR) || pThis->cbSnapLen > DRVNETSNIFFER_DEF_SNAPLEN)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("Configuration error: \"SnapLen\" must be in the range %u..%u"),
+                                   sizeof(RTNETETHERHDR), DRVNETSNIFFER_DEF_SNAPLEN);
+
+    uint32_t cSlots;
+    rc = CFGMR3QueryU32Def(pCfg, "RingEntries", &cSlots, DRVNETSNIFFER_DEF_RING_ENTRIES);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RingEntries\" value"));
+    if (cSlots < 2 || cSlots > DRVNETSNIFFER_MAX_RING_ENTRIES || !RT_IS_POWER_OF_TWO(cSlots))
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("Configuration error: \"RingEntries\" must be a power of two in the range 2..%u"),
+                                   DRVNETSNIFFER_MAX_RING_ENTRIES);
+
+    /*
+     * Get the capture filter.
+     */
+    char szDirection[8];
+    rc = CFGMR3QueryStringDef(pCfg, "FilterDirection", szDirection, sizeof(szDirection), "both");
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"FilterDirection\" value"));
+    pThis->Filter.fInbound  = !RTStrICmp(szDirection, "both") || !RTStrICmp(szDirection, "in");
+    pThis->Filter.fOutbound = !RTStrICmp(szDirection, "both") || !RTStrICmp(szDirection, "out");
+    if (!pThis->Filter.fInbound && !pThis->Filter.fOutbound)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"FilterDirection\" must be 'both', 'in' or 'out'"));
+
+    rc = CFGMR3QueryU16Def(pCfg, "FilterEtherType", &pThis->Filter.u16EtherType, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"FilterEtherType\" value"));
+
+    uint8_t u8IpProto;
+    rc = CFGMR3QueryU8(pCfg, "FilterIpProto", &u8IpProto);
+    if (RT_SUCCESS(rc))
+        pThis->Filter.u16IpProto = u8IpProto;
+    else if (rc == VERR_CFGM_VALUE_NOT_FOUND)
+        pThis->Filter.u16IpProto = UINT16_MAX;
+    else
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"FilterIpProto\" value"));
+
+    rc = CFGMR3QueryU16Def(pCfg, "FilterPort", &pThis->Filter.u16Port, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"FilterPort\" value"));
+
+    char szHost[32];
+    rc = CFGMR3QueryString(pCfg, "FilterHost", szHost, sizeof(szHost));
+    if (RT_SUCCESS(rc))
+    {
+        rc = RTNetStrToIPv4Addr(szHost, &pThis->Filter.HostAddr);
+        if (RT_FAILURE(rc))
+            return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS,
+                                       N_("Configuration error: \"FilterHost\" must be an IPv4 address, not '%s'"), szHost);
+        pThis->Filter.fHost = true;
+    }
+    else if (rc != VERR_CFGM_VALUE_NOT_FOUND)
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"FilterHost\" value"));
+
+    pThis->Filter.fActive = pThis->Filter.u16EtherType
+                         || pThis->Filter.u16Port
+                         || pThis->Filter.u16IpProto != UINT16_MAX
+                         || pThis->Filter.fHost;
+
     /*
      * Query the network port interface.
      */
@@ -493,7 +877,54 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
      * Some time has gone by since capturing pThis->StartNanoTS so get the
      * current time again.
      */
-    PcapFileHdr(pThis->hFile, RTTimeNanoTS());
+    if (pThis->fPcapNg)
+    {
+        RTTIMESPEC Now;
+        pThis->u64VirtFreq   = PDMDrvHlpTMGetVirtualFreq(pDrvIns);
+        pThis->u64VirtStart  = PDMDrvHlpTMGetVirtualTime(pDrvIns);
+        pThis->u64EpochStart = RTTimeSpecGetNano(RTTimeNow(&Now));
+        PcapNgFileHdr(pThis->hFile, pThis->cbSnapLen);
+    }
+    else
+        PcapFileHdr(pThis->hFile, RTTimeNanoTS());
+
+    /*
+     * Set up the capture ring and the writer thread for async capturing.
+     */
+    if (pThis->fAsync)
+    {
+        uint32_t const cbSlot = RT_ALIGN_32(sizeof(DRVNETSNIFFERSLOT) + (uint32_t)PCAPNG_FRAME_BLOCK_SIZE(pThis->cbSnapLen), 64);
+        uint8_t       *pbRing = (uint8_t *)RTMemAllocZ((size_t)cSlots * cbSlot);
+        if (!pbRing)
+            return VERR_NO_MEMORY;
+        drvNetSnifferRingInit(&pThis->Ring, pbRing, cSlots, cbSlot);
+        pThis->pbWriteBuf = (uint8_t *)RTMemAlloc(DRVNETSNIFFER_WRITE_BUF_SIZE);
+        if (!pThis->pbWriteBuf)
+            return VERR_NO_MEMORY;
+
+        rc = RTSemEventCreate(&pThis->hEvtWriter);
+        AssertRCReturn(rc, rc);
+
+        rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pWriterThread, pThis, drvNetSnifferWriterThread,
+                                   drvNetSnifferWriterWakeup, 128 * _1K, RTTHREADTYPE_IO, "NetSniff");
+        AssertRCReturn(rc, rc);
+    }
+
+    LogRel(("NetSniffer#%u: Capturing to '%s' (%s%s, snaplen %u%s)\n", pDrvIns->iInstance, pThis->szFilename,
+            pThis->fPcapNg ? "pcapng" : "pcap", pThis->fAsync ? ", async" : "", pThis->cbSnapLen,
+            pThis->Filter.fActive || !pThis->Filter.fInbound || !pThis->Filter.fOutbound ? ", filtered" : ""));
+
+    /*
+     * Statistics.
+     */
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatCaptured, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Number of frames captured.",                     "/Drivers/NetSniffer%d/Captured", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatDropped,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Number of frames dropped because the capture ring was full.", "/Drivers/NetSniffer%d/Dropped", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatFiltered, STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,
+                           "Number of frames rejected by the capture filter.", "/Drivers/NetSniffer%d/Filtered", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatWritten,  STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_BYTES,
+                           "Number of bytes written by the writer thread.",  "/Drivers/NetSniffer%d/Written", pDrvIns->iInstance);
 
     return VINF_SUCCESS;
 }
@@ -0,0 +1,270 @@
+/* $Id: DrvNetSnifferCapture.h $ */
+/** @file
+ * DrvNetSniffer - Network sniffer filter driver, capture filter and ring.
+ *
+ * Kept apart from the driver so the testcase can check it directly.
+ */
+
+/*
+ * Copyright (C) 2006-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___DrvNetSnifferCapture_h
+#define ___DrvNetSnifferCapture_h
+
+#include <iprt/asm.h>
+#include <iprt/net.h>
+
+
+/**
+ * Capture filter.
+ *
+ * A frame is captured when it matches all the criteria which are set.
+ */
+typedef struct DRVNETSNIFFERFILTER
+{
+    /** Whether any of the protocol criteria below are set. */
+    bool                    fActive;
+    /** Capture frames received by the guest. */
+    bool                    fInbound;
+    /** Capture frames sent by the guest. */
+    bool                    fOutbound;
+    /** Whether HostAddr is set. */
+    bool                    fHost;
+    /** EtherType (host byte order) after any VLAN tag, 0 for any. */
+    uint16_t                u16EtherType;
+    /** TCP/UDP source or destination port (host byte order), 0 for any. */
+    uint16_t                u16Port;
+    /** IP protocol, UINT16_MAX for any. */
+    uint16_t                u16IpProto;
+    /** IPv4 source or destination address. */
+    RTNETADDRIPV4           HostAddr;
+} DRVNETSNIFFERFILTER;
+/** Pointer to a capture filter. */
+typedef DRVNETSNIFFERFILTER *PDRVNETSNIFFERFILTER;
+/** Pointer to a const capture filter. */
+typedef DRVNETSNIFFERFILTER const *PCDRVNETSNIFFERFILTER;
+
+/**
+ * Capture ring entry header, followed by a pcapng enhanced packet block.
+ */
+typedef struct DRVNETSNIFFERSLOT
+{
+    /** Sequence number: equals the ring position when the entry is free for
+     * the producer claiming that position, position + 1 when it has been
+     * filled and awaits the writer. */
+    uint32_t volatile       uSeq;
+    /** The size of the block. */
+    uint32_t                cbBlock;
+} DRVNETSNIFFERSLOT;
+/** Pointer to a capture ring entry. */
+typedef DRVNETSNIFFERSLOT *PDRVNETSNIFFERSLOT;
+
+/**
+ * Capture ring.
+ *
+ * A bounded multi-producer queue with per-entry sequence numbers and a single
+ * consumer, the writer thread.
+ */
+typedef struct DRVNETSNIFFERRING
+{
+    /** The entries. */
+    uint8_t                *pbRing;
+    /** The number of entries, power of two. */
+    uint32_t                cSlots;
+    /** The size of an entry. */
+    uint32_t                cbSlot;
+    /** The next position to be claimed by a producer. */
+    uint32_t volatile       iProducer;
+    /** The next position to be drained by the consumer. */
+    uint32_t                iConsumer;
+} DRVNETSNIFFERRING;
+/** Pointer to a capture ring. */
+typedef DRVNETSNIFFERRING *PDRVNETSNIFFERRING;
+
+
+/**
+ * Checks whether a frame matches the capture filter.
+ *
+ * @returns true if the frame should be captured, false if not.
+ * @param   pFilter         The filter.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The number of bytes available at @a pbFrame.
+ */
+DECLINLINE(bool) drvNetSnifferFilterMatch(PCDRVNETSNIFFERFILTER pFilter, const uint8_t *pbFrame, size_t cbFrame)
+{
+    if (cbFrame < sizeof(RTNETETHERHDR))
+        return false;
+    size_t   offL3       = sizeof(RTNETETHERHDR);
+    uint16_t u16EtherType = RT_BE2H_U16(((PCRTNETETHERHDR)pbFrame)->EtherType);
+    if (u16EtherType == RTNET_ETHERTYPE_VLAN)
+    {
+        if (cbFrame < offL3 + 4)
+            return false;
+        u16EtherType = RT_MAKE_U16(pbFrame[offL3 + 3], pbFrame[offL3 + 2]);
+        offL3 += 4;
+    }
+    if (pFilter->u16EtherType && pFilter->u16EtherType != u16EtherType)
+        return false;
+    if (!pFilter->fHost && !pFilter->u16Port && pFilter->u16IpProto == UINT16_MAX)
+        return true;
+
+    /* The IP layer. */
+    uint8_t  u8Proto;
+    size_t   offL4;
+    bool     fL4;
+    if (u16EtherType == RTNET_ETHERTYPE_IPV4)
+    {
+        if (cbFrame < offL3 + RTNETIPV4_MIN_LEN)
+            return false;
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)(pbFrame + offL3);
+        if (   pFilter->fHost
+            && pIpHdr->ip_src.u != pFilter->HostAddr.u
+            && pIpHdr->ip_dst.u != pFilter->HostAddr.u)
+            return false;
+        u8Proto = pIpHdr->ip_p;
+        offL4   = offL3 + pIpHdr->ip_hl * 4;
+        fL4     = !(RT_BE2H_U16(pIpHdr->ip_off) & UINT16_C(0x1fff)); /* no ports in non-first fragments */
+    }
+    else if (u16EtherType == RTNET_ETHERTYPE_IPV6)
+    {
+        if (pFilter->fHost || cbFrame < offL3 + RTNETIPV6_MIN_LEN)
+            return false;
+        u8Proto = ((PCRTNETIPV6)(pbFrame + offL3))->ip6_nxt;
+        offL4   = offL3 + RTNETIPV6_MIN_LEN;
+        fL4     = true;
+    }
+    else
+        return false;
+    if (pFilter->u16IpProto != UINT16_MAX && pFilter->u16IpProto != u8Proto)
+        return false;
+
+    /* The TCP/UDP ports. */
+    if (pFilter->u16Port)
+    {
+        if (   !fL4
+            || (u8Proto != RTNETIPV4_PROT_TCP && u8Proto != RTNETIPV4_PROT_UDP)
+            || cbFrame < offL4 + 4)
+            return false;
+        uint16_t const uSrcPort = RT_MAKE_U16(pbFrame[offL4 + 1], pbFrame[offL4]);
+        uint16_t const uDstPort = RT_MAKE_U16(pbFrame[offL4 + 3], pbFrame[offL4 + 2]);
+        if (uSrcPort != pFilter->u16Port && uDstPort != pFilter->u16Port)
+            return false;
+    }
+    return true;
+}
+
+
+/**
+ * Gets the ring entry for the given position.
+ */
+DECLINLINE(PDRVNETSNIFFERSLOT) drvNetSnifferRingSlot(PDRVNETSNIFFERRING pRing, uint32_t iPos)
+{
+    return (PDRVNETSNIFFERSLOT)(pRing->pbRing + (size_t)(iPos & (pRing->cSlots - 1)) * pRing->cbSlot);
+}
+
+
+/**
+ * Sets up an empty ring in the given memory.
+ *
+ * @param   pRing           The ring.
+ * @param   pbRing          The memory for the entries, @a cSlots times
+ *                          @a cbSlot bytes.
+ * @param   cSlots          The number of entries, power of two.
+ * @param   cbSlot          The size of an entry, header included.
+ */
+DECLINLINE(void) drvNetSnifferRingInit(PDRVNETSNIFFERRING pRing, uint8_t *pbRing, uint32_t cSlots, uint32_t cbSlot)
+{
+    pRing->pbRing    = pbRing;
+    pRing->cSlots    = cSlots;
+    pRing->cbSlot    = cbSlot;
+    pRing->iProducer = 0;
+    pRing->iConsumer = 0;
+    for (uint32_t i = 0; i < cSlots; i++)
+        drvNetSnifferRingSlot(pRing, i)->uSeq = i;
+}
+
+
+/**
+ * Claims the next free ring entry.
+ *
+ * Safe to call from several threads at once.
+ *
+ * @returns The entry, NULL if the ring is full.
+ * @param   pRing           The ring.
+ * @param   piPos           Where to return the position of the entry, for
+ *                          drvNetSnifferRingCommit.
+ */
+DECLINLINE(PDRVNETSNIFFERSLOT) drvNetSnifferRingClaim(PDRVNETSNIFFERRING pRing, uint32_t *piPos)
+{
+    uint32_t iPos = ASMAtomicReadU32(&pRing->iProducer);
+    for (;;)
+    {
+        PDRVNETSNIFFERSLOT pSlot = drvNetSnifferRingSlot(pRing, iPos);
+        int32_t iDiff = (int32_t)(ASMAtomicReadU32(&pSlot->uSeq) - iPos);
+        if (iDiff == 0)
+        {
+            if (ASMAtomicCmpXchgExU32(&pRing->iProducer, iPos + 1, iPos, &iPos))
+            {
+                *piPos = iPos;
+                return pSlot;
+            }
+        }
+        else if (iDiff < 0)
+            return NULL;
+        else
+            iPos = ASMAtomicReadU32(&pRing->iProducer);
+    }
+}
+
+
+/**
+ * Hands a filled entry over to the consumer.
+ *
+ * @param   pSlot           The entry, cbBlock set.
+ * @param   iPos            The position drvNetSnifferRingClaim returned.
+ */
+DECLINLINE(void) drvNetSnifferRingCommit(PDRVNETSNIFFERSLOT pSlot, uint32_t iPos)
+{
+    ASMAtomicWriteU32(&pSlot->uSeq, iPos + 1);
+}
+
+
+/**
+ * Gets the next filled entry.
+ *
+ * @returns The entry, NULL if the next one hasn't been committed yet.
+ * @param   pRing           The ring.
+ * @thread  The consumer.
+ */
+DECLINLINE(PDRVNETSNIFFERSLOT) drvNetSnifferRingPeek(PDRVNETSNIFFERRING pRing)
+{
+    PDRVNETSNIFFERSLOT pSlot = drvNetSnifferRingSlot(pRing, pRing->iConsumer);
+    if (ASMAtomicReadU32(&pSlot->uSeq) != pRing->iConsumer + 1)
+        return NULL;
+    return pSlot;
+}
+
+
+/**
+ * Hands the entry drvNetSnifferRingPeek returned back to the producers.
+ *
+ * @param   pRing           The ring.
+ * @param   pSlot           The entry.
+ * @thread  The consumer.
+ */
+DECLINLINE(void) drvNetSnifferRingRelease(PDRVNETSNIFFERRING pRing, PDRVNETSNIFFERSLOT pSlot)
+{
+    ASMAtomicWriteU32(&pSlot->uSeq, pRing->iConsumer + pRing->cSlots);
+    pRing->iConsumer++;
+}
+
+#endif
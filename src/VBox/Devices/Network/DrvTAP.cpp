@@ -60,10 +60,23 @@
 #else
 # include <sys/fcntl.h>
 #endif
+#ifdef RT_OS_LINUX
+# include <sys/uio.h>
+# include <net/if.h>
+# include <linux/if_tun.h>
+#endif
 #include <errno.h>
 #include <unistd.h>
 
 #include "VBoxDD.h"
+#include "DrvTAPVNetHdr.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The receive buffer size when the kernel may pass up GSO frames. */
+#define DRVTAP_GSO_RECV_BUF_SIZE        (_64K + _1K)
 
 
 /*******************************************************************************
@@ -102,6 +115,11 @@ typedef struct DRVTAP
     RTPIPE                  hPipeRead;
     /** Reader thread. */
     PPDMTHREAD              pThread;
+    /** Whether frames are exchanged with a virtio-net header (Linux IFF_VNET_HDR).
+     * When set the kernel segments our GSO frames and may pass up its own. */
+    bool                    fVNetHdr;
+    /** Receive buffer for frames up to 64KB, only used if fVNetHdr is set. */
+    uint8_t                *pbRecvBuf;
 
     /** @todo The transmit thread. */
     /** Transmit lock used by drvTAPNetworkUp_BeginXmit. */
@@ -116,6 +134,12 @@ typedef struct DRVTAP
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of GSO frames passed to the kernel in one piece. */
+    STAMCOUNTER             StatPktSentGso;
+    /** Number of GSO frames received from the kernel. */
+    STAMCOUNTER             StatPktRecvGso;
+    /** Number of received GSO frames we had to segment. */
+    STAMCOUNTER             StatPktRecvGsoCarved;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -143,6 +167,141 @@ static int              SolarisTAPAttach(PDRVTAP pThis);
 #endif
 
 
+/**
+ * Writes a frame to the TAP device, prefixed by the virtio-net header if the
+ * device was set up for it.
+ *
+ * @returns IPRT status code.
+ * @param   pThis           The instance data.
+ * @param   pVNetHdr        The virtio-net header. Ignored if !fVNetHdr.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The frame size.
+ */
+static int drvTAPWriteFrame(PDRVTAP pThis, PCDRVTAPVNETHDR pVNetHdr, const void *pvFrame, size_t cbFrame)
+{
+#ifdef RT_OS_LINUX
+    if (pThis->fVNetHdr)
+    {
+        struct iovec aIov[2];
+        aIov[0].iov_base = (void *)pVNetHdr;
+        aIov[0].iov_len  = sizeof(*pVNetHdr);
+        aIov[1].iov_base = (void *)pvFrame;
+        aIov[1].iov_len  = cbFrame;
+        if (writev(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov)) < 0)
+            return RTErrConvertFromErrno(errno);
+        return VINF_SUCCESS;
+    }
+#else
+    NOREF(pVNetHdr);
+#endif
+    return RTFileWrite(pThis->hFileDevice, pvFrame, cbFrame, NULL);
+}
+
+
+/**
+ * Sets up the virtio-net header for passing a GSO frame to the kernel in one
+ * piece.
+ *
+ * @returns true if the kernel will segment the frame, false if we have to.
+ * @param   pThis           The instance data.
+ * @param   pGso            The GSO context.
+ * @param   pbFrame         The frame. The headers are prepared for the kernel.
+ * @param   cbFrame         The frame size.
+ * @param   pVNetHdr        Where to return the virtio-net header.
+ */
+static bool drvTAPGsoToVNetHdr(PDRVTAP pThis, PCPDMNETWORKGSO pGso, uint8_t *pbFrame, size_t cbFrame,
+                               PDRVTAPVNETHDR pVNetHdr)
+{
+    if (!pThis->fVNetHdr)
+        return false;
+    return drvTAPVNetHdrFromGso(pGso, pbFrame, cbFrame, pVNetHdr);
+}
+
+
+#ifdef RT_OS_LINUX
+/**
+ * Reads a frame and its virtio-net header from the TAP device into pbRecvBuf.
+ *
+ * @returns IPRT status code.
+ * @param   pThis           The instance data.
+ * @param   pVNetHdr        Where to return the virtio-net header.
+ * @param   pcbFrame        Where to return the frame size.
+ */
+static int drvTAPLinuxReadVNet(PDRVTAP pThis, PDRVTAPVNETHDR pVNetHdr, size_t *pcbFrame)
+{
+    struct iovec aIov[2];
+    aIov[0].iov_base = pVNetHdr;
+    aIov[0].iov_len  = sizeof(*pVNetHdr);
+    aIov[1].iov_base = pThis->pbRecvBuf;
+    aIov[1].iov_len  = DRVTAP_GSO_RECV_BUF_SIZE;
+    ssize_t cbRead = readv(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov));
+    if (cbRead < 0)
+        return RTErrConvertFromErrno(errno);
+    if ((size_t)cbRead < sizeof(*pVNetHdr))
+        return VERR_BUFFER_UNDERFLOW;
+    *pcbFrame = cbRead - sizeof(*pVNetHdr);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Passes a frame read with its virtio-net header to the device above.
+ *
+ * Partial checksums are completed.  GSO frames are handed up as such if the
+ * device takes them and segmented here otherwise.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The instance data.
+ * @param   pVNetHdr        The virtio-net header of the frame.
+ * @param   pbFrame         The frame. Modified.
+ * @param   cbFrame         The frame size.
+ * @thread  TAP
+ */
+static int drvTAPLinuxRecvVNet(PDRVTAP pThis, PCDRVTAPVNETHDR pVNetHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+    uint8_t const u8GsoType = pVNetHdr->u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN;
+    if (u8GsoType == DRVTAP_VNETHDR_GSO_NONE)
+    {
+        if (   (pVNetHdr->u8Flags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+            && !drvTAPVNetHdrCompleteCSum(pVNetHdr, pbFrame, cbFrame))
+            return VERR_NET_PROTOCOL_ERROR;
+        return pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pbFrame, cbFrame);
+    }
+
+    PDMNETWORKGSO Gso;
+    if (!drvTAPVNetHdrToGso(pVNetHdr, pbFrame, cbFrame, &Gso))
+        return VERR_NET_PROTOCOL_ERROR;
+
+    STAM_COUNTER_INC(&pThis->StatPktRecvGso);
+    if (   pThis->pIAboveNet->pfnReceiveGso
+        && RT_SUCCESS(pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pbFrame, cbFrame, &Gso)))
+        return VINF_SUCCESS;
+
+    /*
+     * The device (or the guest) can't take it, segment it ourselves.
+     */
+    STAM_COUNTER_INC(&pThis->StatPktRecvGsoCarved);
+    uint8_t         abHdrScratch[256];
+    uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(&Gso, cbFrame);
+    int             rc    = VINF_SUCCESS;
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        if (iSeg)
+        {
+            rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+            if (RT_FAILURE(rc))
+                break; /* we drop the rest. */
+        }
+        uint32_t cbSegFrame;
+        void    *pvSegFrame = PDMNetGsoCarveSegmentQD(&Gso, pbFrame, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvSegFrame, cbSegFrame);
+        AssertRC(rc);
+    }
+    return rc;
+}
+#endif /* RT_OS_LINUX */
+
+
 
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
@@ -240,8 +399,18 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
     /* Set an FTM checkpoint as this operation changes the state permanently. */
     PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
 
-    int rc;
-    if (!pSgBuf->pvUser)
+    int             rc;
+    DRVTAPVNETHDR   VNetHdr;
+    RT_ZERO(VNetHdr);
+    PCPDMNETWORKGSO pGso = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+    if (   pGso
+        && drvTAPGsoToVNetHdr(pThis, pGso, (uint8_t *)pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, &VNetHdr))
+    {
+        /* The kernel does the segmentation. */
+        STAM_COUNTER_INC(&pThis->StatPktSentGso);
+        rc = drvTAPWriteFrame(pThis, &VNetHdr, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+    }
+    else if (!pGso)
     {
 #ifdef LOG_ENABLED
         uint64_t u64Now = RTTimeProgramNanoTS();
@@ -253,13 +422,12 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
               "%.*Rhxd\n",
               pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, pSgBuf->cbUsed, pSgBuf->aSegs[0].pvSeg));
 
-        rc = RTFileWrite(pThis->hFileDevice, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
+        rc = drvTAPWriteFrame(pThis, &VNetHdr, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
     }
     else
     {
         uint8_t         abHdrScratch[256];
         uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
-        PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
         uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
         rc = VINF_SUCCESS;
         for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
@@ -267,7 +435,7 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
             uint32_t cbSegFrame;
             void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
                                                        iSeg, cSegs, &cbSegFrame);
-            rc = RTFileWrite(pThis->hFileDevice, pvSegFrame, cbSegFrame, NULL);
+            rc = drvTAPWriteFrame(pThis, &VNetHdr, pvSegFrame, cbSegFrame);
             if (RT_FAILURE(rc))
                 break;
         }
@@ -367,11 +535,21 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
              * Read the frame.
              */
             char achBuf[16384];
+            uint8_t *pbBuf = (uint8_t *)&achBuf[0];
             size_t cbRead = 0;
             /** @note At least on Linux we will never receive more than one network packet
              *        after poll() returned successfully. I don't know why but a second
              *        RTFileRead() operation will return with VERR_TRY_AGAIN in any case. */
-            rc = RTFileRead(pThis->hFileDevice, achBuf, sizeof(achBuf), &cbRead);
+#ifdef RT_OS_LINUX
+            DRVTAPVNETHDR VNetHdr;
+            if (pThis->fVNetHdr)
+            {
+                pbBuf = pThis->pbRecvBuf;
+                rc = drvTAPLinuxReadVNet(pThis, &VNetHdr, &cbRead);
+            }
+            else
+#endif
+                rc = RTFileRead(pThis->hFileDevice, achBuf, sizeof(achBuf), &cbRead);
             if (RT_SUCCESS(rc))
             {
                 /*
@@ -407,11 +585,21 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
                          cbRead, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
                 pThis->u64LastReceiveTS = u64Now;
 #endif
-                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, achBuf));
+                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, pbBuf));
                 STAM_COUNTER_INC(&pThis->StatPktRecv);
                 STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbRead);
-                rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, achBuf, cbRead);
-                AssertRC(rc1);
+#ifdef RT_OS_LINUX
+                if (pThis->fVNetHdr)
+                {
+                    rc1 = drvTAPLinuxRecvVNet(pThis, &VNetHdr, pbBuf, cbRead);
+                    AssertMsg(RT_SUCCESS(rc1) || rc1 == VERR_NET_PROTOCOL_ERROR, ("%Rrc\n", rc1));
+                }
+                else
+#endif
+                {
+                    rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pbBuf, cbRead);
+                    AssertRC(rc1);
+                }
             }
             else
             {
@@ -820,6 +1008,9 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     if (RTCritSectIsInitialized(&pThis->XmitLock))
         RTCritSectDelete(&pThis->XmitLock);
 
+    RTMemFree(pThis->pbRecvBuf);
+    pThis->pbRecvBuf = NULL;
+
 #ifdef VBOX_WITH_STATISTICS
     /*
      * Deregister statistics.
@@ -828,6 +1019,9 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGsoCarved);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
 #endif /* VBOX_WITH_STATISTICS */
@@ -858,6 +1052,8 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
 #endif
     pThis->pszSetupApplication          = NULL;
     pThis->pszTerminateApplication      = NULL;
+    pThis->fVNetHdr                     = false;
+    pThis->pbRecvBuf                    = NULL;
 
     /* IBase */
     pDrvIns->IBase.pfnQueryInterface    = drvTAPQueryInterface;
@@ -878,6 +1074,9 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/TAP%d/Bytes/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/TAP%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/TAP%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentGso,    STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,        "Number of GSO frames segmented by the kernel.", "/Drivers/TAP%d/Packets/SentGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGso,    STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,        "Number of GSO frames received.",   "/Drivers/TAP%d/Packets/ReceivedGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGsoCarved, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,       "Number of received GSO frames we segmented.", "/Drivers/TAP%d/Packets/ReceivedGsoCarved", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/TAP%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/TAP%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -980,6 +1179,34 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     Log(("drvTAPContruct: %d (from fd)\n", pThis->hFileDevice));
     rc = VINF_SUCCESS;
 
+#if defined(RT_OS_LINUX) && defined(IFF_VNET_HDR) && defined(TUNGETIFF) && defined(TUNSETOFFLOAD)
+    /*
+     * If the device was opened with IFF_VNET_HDR (see Console::attachToTapInterface)
+     * the kernel does segmentation and checksumming for us and may pass up
+     * whole GSO frames, one read/write per frame instead of per segment.
+     */
+    struct ifreq IfReq;
+    RT_ZERO(IfReq);
+    if (   ioctl(RTFileToNative(pThis->hFileDevice), TUNGETIFF, &IfReq) == 0
+        && (IfReq.ifr_flags & IFF_VNET_HDR))
+    {
+        pThis->pbRecvBuf = (uint8_t *)RTMemAlloc(DRVTAP_GSO_RECV_BUF_SIZE);
+        if (!pThis->pbRecvBuf)
+            return VERR_NO_MEMORY;
+        pThis->fVNetHdr = true;
+
+        unsigned long fOffload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+        if (ioctl(RTFileToNative(pThis->hFileDevice), TUNSETOFFLOAD, fOffload) != 0)
+        {
+            LogRel(("TAP#%d: Failed to enable receive offloads (errno=%d)\n", pDrvIns->iInstance, errno));
+            fOffload = 0;
+            ioctl(RTFileToNative(pThis->hFileDevice), TUNSETOFFLOAD, fOffload);
+        }
+        LogRel(("TAP#%d: Using the virtio-net header, receive offloads %s\n",
+                pDrvIns->iInstance, fOffload ? "enabled" : "disabled"));
+    }
+#endif
+
     /*
      * Create the control pipe.
      */
@@ -0,0 +1,159 @@
+/* $Id: DrvTAPVNetHdr.h $ */
+/** @file
+ * DrvTAP - Universal TAP network transport driver, virtio-net header helpers.
+ *
+ * Kept apart from the driver so the testcase can check it directly.  The
+ * includer must include VBox/vmm/pdmnetinline.h first, it has no include
+ * guard.
+ */
+
+/*
+ * Copyright (C) 2006-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___DrvTAPVNetHdr_h
+#define ___DrvTAPVNetHdr_h
+
+#include <VBox/vmm/pdmnetifs.h>
+#include <iprt/assert.h>
+#include <iprt/net.h>
+
+
+/** @name Virtio-net header flags and GSO types (see DRVTAPVNETHDR).
+ * @{ */
+#define DRVTAP_VNETHDR_F_NEEDS_CSUM     1
+#define DRVTAP_VNETHDR_GSO_NONE         0
+#define DRVTAP_VNETHDR_GSO_TCPV4        1
+#define DRVTAP_VNETHDR_GSO_TCPV6        4
+#define DRVTAP_VNETHDR_GSO_ECN          0x80
+/** @} */
+
+
+/**
+ * The virtio-net header which the Linux TAP driver puts in front of every
+ * frame when the device was set up with IFF_VNET_HDR.
+ *
+ * It is the interface vhost-net uses as well and lets us exchange whole GSO
+ * frames and frames with partial checksums with the kernel.  Host endian.
+ */
+typedef struct DRVTAPVNETHDR
+{
+    uint8_t             u8Flags;
+    uint8_t             u8GsoType;
+    uint16_t            u16HdrLen;
+    uint16_t            u16GsoSize;
+    uint16_t            u16CSumStart;
+    uint16_t            u16CSumOffset;
+} DRVTAPVNETHDR;
+AssertCompileSize(DRVTAPVNETHDR, 10);
+typedef DRVTAPVNETHDR *PDRVTAPVNETHDR;
+typedef DRVTAPVNETHDR const *PCDRVTAPVNETHDR;
+
+
+/**
+ * Sets up the virtio-net header for passing a GSO frame to the kernel in one
+ * piece.
+ *
+ * @returns true if the kernel will segment the frame, false if we have to.
+ * @param   pGso            The GSO context.
+ * @param   pbFrame         The frame. The headers are prepared for the kernel.
+ * @param   cbFrame         The frame size.
+ * @param   pVNetHdr        Where to return the virtio-net header.
+ */
+DECLINLINE(bool) drvTAPVNetHdrFromGso(PCPDMNETWORKGSO pGso, uint8_t *pbFrame, size_t cbFrame, PDRVTAPVNETHDR pVNetHdr)
+{
+    switch (pGso->u8Type)
+    {
+        case PDMNETWORKGSOTYPE_IPV4_TCP:
+            pVNetHdr->u8GsoType = DRVTAP_VNETHDR_GSO_TCPV4;
+            break;
+        case PDMNETWORKGSOTYPE_IPV6_TCP:
+            pVNetHdr->u8GsoType = DRVTAP_VNETHDR_GSO_TCPV6;
+            break;
+        default:
+            /* UDP fragmentation offload and tunnelled frames are left to us. */
+            return false;
+    }
+    pVNetHdr->u8Flags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+    pVNetHdr->u16HdrLen     = pGso->cbHdrsTotal;
+    pVNetHdr->u16GsoSize    = pGso->cbMaxSeg;
+    pVNetHdr->u16CSumStart  = pGso->offHdr2;
+    pVNetHdr->u16CSumOffset = RT_OFFSETOF(RTNETTCP, th_sum);
+
+    /* The kernel sums the payload per segment, it wants the pseudo header sum in place. */
+    PDMNetGsoPrepForDirectUse(pGso, pbFrame, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+    return true;
+}
+
+
+/**
+ * Completes the partial checksum of a frame the kernel passed up with
+ * DRVTAP_VNETHDR_F_NEEDS_CSUM.
+ *
+ * @returns true on success, false if the checksum field is outside the frame.
+ * @param   pVNetHdr        The virtio-net header of the frame.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The frame size.
+ */
+DECLINLINE(bool) drvTAPVNetHdrCompleteCSum(PCDRVTAPVNETHDR pVNetHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+    uint32_t const offCSum = (uint32_t)pVNetHdr->u16CSumStart + pVNetHdr->u16CSumOffset;
+    if (offCSum + sizeof(uint16_t) > cbFrame)
+        return false;
+    /* The checksum field holds the pseudo header sum, so summing it along is right. */
+    bool     fOdd   = false;
+    uint32_t u32Sum = RTNetIPv4AddDataChecksum(pbFrame + pVNetHdr->u16CSumStart,
+                                               cbFrame - pVNetHdr->u16CSumStart, 0, &fOdd);
+    *(uint16_t *)(pbFrame + offCSum) = RTNetIPv4FinalizeChecksum(u32Sum);
+    return true;
+}
+
+
+/**
+ * Reconstructs the GSO context of a GSO frame the kernel passed up.
+ *
+ * We don't trust hdr_len which is only a hint.
+ *
+ * @returns true if the context is valid for the frame, false if not.
+ * @param   pVNetHdr        The virtio-net header of the frame, GSO type not
+ *                          DRVTAP_VNETHDR_GSO_NONE.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The frame size.
+ * @param   pGso            Where to return the GSO context.
+ */
+DECLINLINE(bool) drvTAPVNetHdrToGso(PCDRVTAPVNETHDR pVNetHdr, uint8_t const *pbFrame, size_t cbFrame, PPDMNETWORKGSO pGso)
+{
+    uint8_t const u8GsoType = pVNetHdr->u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN;
+    if (u8GsoType == DRVTAP_VNETHDR_GSO_TCPV4)
+        pGso->u8Type = PDMNETWORKGSOTYPE_IPV4_TCP;
+    else if (u8GsoType == DRVTAP_VNETHDR_GSO_TCPV6)
+        pGso->u8Type = PDMNETWORKGSOTYPE_IPV6_TCP;
+    else
+        return false; /* We don't enable anything else. */
+    uint32_t const offHdr2 = pVNetHdr->u16CSumStart;
+    if (offHdr2 + RTNETTCP_MIN_LEN > cbFrame)
+        return false;
+    PCRTNETETHERHDR pEthHdr     = (PCRTNETETHERHDR)pbFrame;
+    uint32_t const  cbHdrsTotal = offHdr2 + ((PCRTNETTCP)(pbFrame + offHdr2))->th_off * 4;
+    if (cbHdrsTotal > UINT8_MAX)
+        return false;
+    pGso->offHdr1     = pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_VLAN)
+                      ? sizeof(RTNETETHERHDR) + 4 : sizeof(RTNETETHERHDR);
+    pGso->offHdr2     = (uint8_t)offHdr2;
+    pGso->cbHdrsTotal = (uint8_t)cbHdrsTotal;
+    pGso->cbHdrsSeg   = pGso->cbHdrsTotal;
+    pGso->u8Unused    = 0;
+    pGso->cbMaxSeg    = pVNetHdr->u16GsoSize;
+    return pGso->cbMaxSeg
+        && PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame);
+}
+
+#endif
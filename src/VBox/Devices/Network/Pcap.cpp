@@ -1,6 +1,6 @@
 /* $Id: Pcap.cpp $ */
 /** @file
- * Helpers for writing libpcap files.
+ * Helpers for writing libpcap and pcapng files.
  */
 
 /*
@@ -22,6 +22,7 @@
 
 #include <iprt/file.h>
 #include <iprt/stream.h>
+#include <iprt/string.h>
 #include <iprt/time.h>
 #include <iprt/err.h>
 #include <VBox/vmm/pdmnetinline.h>
@@ -60,6 +61,94 @@ struct pcaprec_hdr_init
     struct pcap_hdr     pcap;
 };
 
+/* pcapng block types. */
+#define PCAPNG_BT_SHB       UINT32_C(0x0a0d0d0a)
+#define PCAPNG_BT_IDB       UINT32_C(0x00000001)
+#define PCAPNG_BT_ISB       UINT32_C(0x00000005)
+#define PCAPNG_BT_EPB       UINT32_C(0x00000006)
+/* pcapng byte order magic. */
+#define PCAPNG_BYTE_ORDER_MAGIC UINT32_C(0x1a2b3c4d)
+/* pcapng option codes. */
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+#define PCAPNG_OPT_ISB_IFRECV   4
+#define PCAPNG_OPT_ISB_IFDROP   5
+/* epb_flags direction values. */
+#define PCAPNG_EPB_FLAGS_INBOUND    UINT32_C(0x00000001)
+#define PCAPNG_EPB_FLAGS_OUTBOUND   UINT32_C(0x00000002)
+
+/* pcapng option header. */
+struct pcapng_opt
+{
+    uint16_t    code;
+    uint16_t    len;
+};
+
+/* pcapng section header block followed by an interface description block
+ * (Ethernet, nanosecond timestamps). */
+struct pcapng_hdr
+{
+    /* section header block */
+    uint32_t            shb_type;
+    uint32_t            shb_len;
+    uint32_t            shb_magic;
+    uint16_t            shb_version_major;  /* = 1 */
+    uint16_t            shb_version_minor;  /* = 0 */
+    uint32_t            shb_section_len[2]; /* = -1, unknown */
+    uint32_t            shb_len2;
+    /* interface description block */
+    uint32_t            idb_type;
+    uint32_t            idb_len;
+    uint16_t            idb_linktype;       /* = 1, Ethernet */
+    uint16_t            idb_reserved;
+    uint32_t            idb_snaplen;
+    struct pcapng_opt   idb_opt_tsresol;
+    uint8_t             idb_tsresol;        /* = 9, nanoseconds */
+    uint8_t             idb_pad[3];
+    struct pcapng_opt   idb_opt_end;
+    uint32_t            idb_len2;
+};
+
+/* pcapng enhanced packet block header, followed by the padded data. */
+struct pcapng_epb_hdr
+{
+    uint32_t            type;
+    uint32_t            len;
+    uint32_t            interface_id;
+    uint32_t            ts_high;
+    uint32_t            ts_low;
+    uint32_t            captured_len;
+    uint32_t            original_len;
+};
+
+/* pcapng enhanced packet block trailer with the direction option. */
+struct pcapng_epb_trailer
+{
+    struct pcapng_opt   opt_flags;
+    uint32_t            flags;
+    struct pcapng_opt   opt_end;
+    uint32_t            len;
+};
+
+/* pcapng interface statistics block. */
+struct pcapng_isb
+{
+    uint32_t            type;
+    uint32_t            len;
+    uint32_t            interface_id;
+    uint32_t            ts_high;
+    uint32_t            ts_low;
+    struct pcapng_opt   opt_ifrecv;
+    uint32_t            ifrecv[2];
+    struct pcapng_opt   opt_ifdrop;
+    uint32_t            ifdrop[2];
+    struct pcapng_opt   opt_end;
+    uint32_t            len2;
+};
+AssertCompileSize(struct pcapng_hdr, 60);
+AssertCompile(sizeof(struct pcapng_epb_hdr) + sizeof(struct pcapng_epb_trailer) == PCAPNG_FRAME_BLOCK_SIZE(0));
+
 
 /*******************************************************************************
 *   Global Variables                                                           *
@@ -254,3 +343,213 @@ int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
     return VINF_SUCCESS;
 }
 
+
+
+/**
+ * Internal helper.
+ */
+static void pcapNgCalcEpb(struct pcapng_epb_hdr *pHdr, struct pcapng_epb_trailer *pTrailer,
+                          uint64_t NanoTS, bool fInbound, size_t cbFrame, size_t cbMax)
+{
+    uint32_t const cbIncl  = (uint32_t)RT_MIN(cbFrame, cbMax);
+    uint32_t const cbBlock = (uint32_t)PCAPNG_FRAME_BLOCK_SIZE(cbIncl);
+
+    pHdr->type               = PCAPNG_BT_EPB;
+    pHdr->len                = cbBlock;
+    pHdr->interface_id       = 0;
+    pHdr->ts_high            = (uint32_t)(NanoTS >> 32);
+    pHdr->ts_low             = (uint32_t)NanoTS;
+    pHdr->captured_len       = cbIncl;
+    pHdr->original_len       = (uint32_t)cbFrame;
+
+    pTrailer->opt_flags.code = PCAPNG_OPT_EPB_FLAGS;
+    pTrailer->opt_flags.len  = sizeof(pTrailer->flags);
+    pTrailer->flags          = fInbound ? PCAPNG_EPB_FLAGS_INBOUND : PCAPNG_EPB_FLAGS_OUTBOUND;
+    pTrailer->opt_end.code   = PCAPNG_OPT_ENDOFOPT;
+    pTrailer->opt_end.len    = 0;
+    pTrailer->len            = cbBlock;
+}
+
+
+/**
+ * Internal helper for writing an enhanced packet block made up of a header
+ * part and a payload part.
+ */
+static int pcapNgFileWriteEpb(RTFILE File, uint64_t NanoTS, bool fInbound, const void *pvHdrs, size_t cbHdrs,
+                              const void *pvPayload, size_t cbPayload, size_t cbMax)
+{
+    struct pcapng_epb_hdr       Hdr;
+    struct pcapng_epb_trailer   Trailer;
+    pcapNgCalcEpb(&Hdr, &Trailer, NanoTS, fInbound, cbHdrs + cbPayload, cbMax);
+
+    int rc = RTFileWrite(File, &Hdr, sizeof(Hdr), NULL);
+    if (RT_SUCCESS(rc))
+        rc = RTFileWrite(File, pvHdrs, RT_MIN(Hdr.captured_len, cbHdrs), NULL);
+    if (RT_SUCCESS(rc) && Hdr.captured_len > cbHdrs)
+        rc = RTFileWrite(File, pvPayload, Hdr.captured_len - cbHdrs, NULL);
+    if (RT_SUCCESS(rc) && (Hdr.captured_len & 3))
+        rc = RTFileWrite(File, s_szDummyData, 4 - (Hdr.captured_len & 3), NULL);
+    if (RT_SUCCESS(rc))
+        rc = RTFileWrite(File, &Trailer, sizeof(Trailer), NULL);
+    return rc;
+}
+
+
+/**
+ * Writes the pcapng section header and the description of the one and only
+ * interface (Ethernet, nanosecond timestamp resolution).
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   cbSnapLen       The max number of bytes included for each frame.
+ */
+int PcapNgFileHdr(RTFILE File, uint32_t cbSnapLen)
+{
+    struct pcapng_hdr Hdr;
+    RT_ZERO(Hdr);
+    Hdr.shb_type                = PCAPNG_BT_SHB;
+    Hdr.shb_len                 = RT_OFFSETOF(struct pcapng_hdr, idb_type);
+    Hdr.shb_magic               = PCAPNG_BYTE_ORDER_MAGIC;
+    Hdr.shb_version_major       = 1;
+    Hdr.shb_version_minor       = 0;
+    Hdr.shb_section_len[0]      = UINT32_MAX;
+    Hdr.shb_section_len[1]      = UINT32_MAX;
+    Hdr.shb_len2                = Hdr.shb_len;
+    Hdr.idb_type                = PCAPNG_BT_IDB;
+    Hdr.idb_len                 = sizeof(Hdr) - Hdr.shb_len;
+    Hdr.idb_linktype            = 1;
+    Hdr.idb_snaplen             = cbSnapLen;
+    Hdr.idb_opt_tsresol.code    = PCAPNG_OPT_IF_TSRESOL;
+    Hdr.idb_opt_tsresol.len     = 1;
+    Hdr.idb_tsresol             = 9;
+    Hdr.idb_opt_end.code        = PCAPNG_OPT_ENDOFOPT;
+    Hdr.idb_len2                = Hdr.idb_len;
+    return RTFileWrite(File, &Hdr, sizeof(Hdr), NULL);
+}
+
+
+/**
+ * Writes a frame to a pcapng file.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   NanoTS          The timestamp, nanoseconds since the Unix epoch.
+ * @param   fInbound        Whether the frame was received (true) or sent
+ *                          (false) by the guest.
+ * @param   pvFrame         The start of the frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   cbMax           The max number of bytes to include in the file.
+ */
+int PcapNgFileFrame(RTFILE File, uint64_t NanoTS, bool fInbound, const void *pvFrame, size_t cbFrame, size_t cbMax)
+{
+    return pcapNgFileWriteEpb(File, NanoTS, fInbound, pvFrame, cbFrame, NULL, 0, cbMax);
+}
+
+
+/**
+ * Writes a GSO frame to a pcapng file, one block per segment.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   NanoTS          The timestamp, nanoseconds since the Unix epoch.
+ * @param   fInbound        Whether the frame was received (true) or sent
+ *                          (false) by the guest.
+ * @param   pGso            Pointer to the GSO context.
+ * @param   pvFrame         The start of the GSO frame.
+ * @param   cbFrame         The size of the GSO frame.
+ * @param   cbSegMax        The max number of bytes to include in the file for
+ *                          each segment.
+ */
+int PcapNgFileGsoFrame(RTFILE File, uint64_t NanoTS, bool fInbound, PCPDMNETWORKGSO pGso,
+                       const void *pvFrame, size_t cbFrame, size_t cbSegMax)
+{
+    uint8_t const  *pbFrame = (uint8_t const *)pvFrame;
+    uint8_t         abHdrs[256];
+    uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        uint32_t cbSegPayload, cbHdrs;
+        uint32_t offSegPayload = PDMNetGsoCarveSegment(pGso, pbFrame, cbFrame, iSeg, cSegs, abHdrs, &cbHdrs, &cbSegPayload);
+
+        int rc = pcapNgFileWriteEpb(File, NanoTS, fInbound, abHdrs, cbHdrs, pbFrame + offSegPayload, cbSegPayload, cbSegMax);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Writes a pcapng interface statistics block.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   NanoTS          The timestamp, nanoseconds since the Unix epoch.
+ * @param   cFramesRecv     The number of frames seen by the capturer.
+ * @param   cFramesDropped  The number of frames dropped for lack of buffer
+ *                          space.
+ */
+int PcapNgFileStats(RTFILE File, uint64_t NanoTS, uint64_t cFramesRecv, uint64_t cFramesDropped)
+{
+    struct pcapng_isb Isb;
+    Isb.type            = PCAPNG_BT_ISB;
+    Isb.len             = sizeof(Isb);
+    Isb.interface_id    = 0;
+    Isb.ts_high         = (uint32_t)(NanoTS >> 32);
+    Isb.ts_low          = (uint32_t)NanoTS;
+    Isb.opt_ifrecv.code = PCAPNG_OPT_ISB_IFRECV;
+    Isb.opt_ifrecv.len  = sizeof(Isb.ifrecv);
+    memcpy(Isb.ifrecv, &cFramesRecv, sizeof(Isb.ifrecv));
+    Isb.opt_ifdrop.code = PCAPNG_OPT_ISB_IFDROP;
+    Isb.opt_ifdrop.len  = sizeof(Isb.ifdrop);
+    memcpy(Isb.ifdrop, &cFramesDropped, sizeof(Isb.ifdrop));
+    Isb.opt_end.code    = PCAPNG_OPT_ENDOFOPT;
+    Isb.opt_end.len     = 0;
+    Isb.len2            = sizeof(Isb);
+    return RTFileWrite(File, &Isb, sizeof(Isb), NULL);
+}
+
+
+/**
+ * Formats a frame as a pcapng enhanced packet block in memory.
+ *
+ * The frame is given as a header part and a payload part so that segments
+ * carved out of GSO frames can be formatted without assembling them first.
+ *
+ * @returns The size of the block, PCAPNG_FRAME_BLOCK_SIZE(RT_MIN(cbHdrs +
+ *          cbPayload, cbMax)).
+ *
+ * @param   pvBlock         Where to format the block.  Must have room for
+ *                          PCAPNG_FRAME_BLOCK_SIZE(cbMax) bytes.
+ * @param   NanoTS          The timestamp, nanoseconds since the Unix epoch.
+ * @param   fInbound        Whether the frame was received (true) or sent
+ *                          (false) by the guest.
+ * @param   pvHdrs          The start of the frame.
+ * @param   cbHdrs          The size of the first part.
+ * @param   pvPayload       The rest of the frame, optional.
+ * @param   cbPayload       The size of the rest of the frame.
+ * @param   cbMax           The max number of bytes to include in the block.
+ */
+size_t PcapNgFormatFrame(void *pvBlock, uint64_t NanoTS, bool fInbound, const void *pvHdrs, size_t cbHdrs,
+                         const void *pvPayload, size_t cbPayload, size_t cbMax)
+{
+    struct pcapng_epb_hdr       *pHdr = (struct pcapng_epb_hdr *)pvBlock;
+    struct pcapng_epb_trailer    Trailer;
+    pcapNgCalcEpb(pHdr, &Trailer, NanoTS, fInbound, cbHdrs + cbPayload, cbMax);
+
+    uint8_t *pbDst = (uint8_t *)(pHdr + 1);
+    size_t   cbCopy = RT_MIN(pHdr->captured_len, cbHdrs);
+    memcpy(pbDst, pvHdrs, cbCopy);
+    if (pHdr->captured_len > cbHdrs)
+        memcpy(pbDst + cbCopy, pvPayload, pHdr->captured_len - cbHdrs);
+    pbDst += pHdr->captured_len;
+    while ((uintptr_t)(pbDst - (uint8_t *)pvBlock) & 3)
+        *pbDst++ = 0;
+    memcpy(pbDst, &Trailer, sizeof(Trailer));
+    return pHdr->len;
+}
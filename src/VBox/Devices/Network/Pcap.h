@@ -1,6 +1,6 @@
 /* $Id: Pcap.h $ */
 /** @file
- * Helpers for writing libpcap files.
+ * Helpers for writing libpcap and pcapng files.
  */
 
 /*
@@ -33,6 +33,18 @@ int PcapFileFrame(RTFILE File, uint64_t StartNanoTS, const void *pvFrame, size_t
 int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
                      const void *pvFrame, size_t cbFrame, size_t cbSegMax);
 
+/** The size of the pcapng enhanced packet block PcapNgFormatFrame produces for
+ * @a a_cbIncl bytes of captured frame data. */
+#define PCAPNG_FRAME_BLOCK_SIZE(a_cbIncl)   (RT_ALIGN_Z(a_cbIncl, 4) + 44)
+
+int PcapNgFileHdr(RTFILE File, uint32_t cbSnapLen);
+int PcapNgFileFrame(RTFILE File, uint64_t NanoTS, bool fInbound, const void *pvFrame, size_t cbFrame, size_t cbMax);
+int PcapNgFileGsoFrame(RTFILE File, uint64_t NanoTS, bool fInbound, PCPDMNETWORKGSO pGso,
+                       const void *pvFrame, size_t cbFrame, size_t cbSegMax);
+int PcapNgFileStats(RTFILE File, uint64_t NanoTS, uint64_t cFramesRecv, uint64_t cFramesDropped);
+size_t PcapNgFormatFrame(void *pvBlock, uint64_t NanoTS, bool fInbound, const void *pvHdrs, size_t cbHdrs,
+                         const void *pvPayload, size_t cbPayload, size_t cbMax);
+
 RT_C_DECLS_END
 
 #endif
@@ -60,6 +60,22 @@
 /** The wakeup bit in the INTNETIF::cBusy and INTNETRUNKIF::cBusy counters. */
 #define INTNET_BUSY_WAKEUP_MASK     RT_BIT_32(30)
 
+/** The number of buckets in the MAC address hash (INTNETMACTAB::aiHash). */
+#define INTNET_MAC_HASH_SIZE        256
+/** The log2 of INTNET_MAC_HASH_SIZE. */
+#define INTNET_MAC_HASH_SHIFT       8
+/** The end of chain / empty bucket index of the MAC address hash. */
+#define INTNET_MAC_HASH_NIL         UINT16_MAX
+AssertCompile(INTNET_MAX_IFS < INTNET_MAC_HASH_NIL);
+AssertCompile(RT_BIT_32(INTNET_MAC_HASH_SHIFT) == INTNET_MAC_HASH_SIZE);
+
+/** The number of buckets in the network layer address hash
+ *  (INTNETNETWORK::apAddrHash). */
+#define INTNET_ADDR_HASH_SIZE       256
+/** The log2 of INTNET_ADDR_HASH_SIZE. */
+#define INTNET_ADDR_HASH_SHIFT      8
+AssertCompile(RT_BIT_32(INTNET_ADDR_HASH_SHIFT) == INTNET_ADDR_HASH_SIZE);
+
 
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
@@ -80,6 +96,9 @@ typedef struct INTNETMACTABENTRY
      * to this interface onto the trunk.  The reasoning for this is that this could
      * be the interface of a VM that just has been teleported to a different host. */
     bool                    fActive;
+    /** The index of the next entry in the same MAC address hash bucket,
+     *  INTNET_MAC_HASH_NIL if this is the last one. */
+    uint16_t                iHashNext;
     /** Pointer to the network interface. */
     struct INTNETIF        *pIf;
 } INTNETMACTABENTRY;
@@ -106,6 +125,9 @@ typedef struct INTNETMACTAB
     /** The number of interface entries currently in promicuous mode that
      * shall not see unrelated trunk traffic. */
     uint32_t                cPromiscuousNoTrunkEntries;
+    /** The number of entries with a dummy MAC address, i.e. interfaces which
+     * haven't sent anything yet nor had their address set. */
+    uint32_t                cDummyEntries;
 
     /** The host MAC address (reported). */
     RTMAC                   HostMac;
@@ -127,6 +149,12 @@ typedef struct INTNETMACTAB
 
     /** Pointer to the trunk interface. */
     struct INTNETTRUNKIF   *pTrunk;
+
+    /** MAC address hash covering all the entries.  Each bucket holds the index
+     * of the first entry, the rest are chained via INTNETMACTABENTRY::iHashNext.
+     * This lets us switch unicast frames without looking at every interface
+     * when there are no promiscuous or unknown interfaces around. */
+    uint16_t                aiHash[INTNET_MAC_HASH_SIZE];
 } INTNETMACTAB;
 /** Pointer to a MAC address .  */
 typedef INTNETMACTAB *PINTNETMACTAB;
@@ -194,6 +222,28 @@ typedef INTNETADDR *PINTNETADDR;
 typedef INTNETADDR const *PCINTNETADDR;
 
 
+/**
+ * Network layer address hash node.
+ *
+ * There is one of these for each address cache entry, linking the address into
+ * INTNETNETWORK::apAddrHash so we can find the interface owning an address
+ * without searching the caches of all the interfaces on the network.
+ */
+typedef struct INTNETADDRNODE
+{
+    /** The next node in the hash bucket or in the free list of the cache. */
+    struct INTNETADDRNODE  *pNext;
+    /** The interface which address cache the address is in. */
+    struct INTNETIF        *pIf;
+    /** The address type. */
+    INTNETADDRTYPE          enmType;
+    /** The address. */
+    RTNETADDRU              Addr;
+} INTNETADDRNODE;
+/** Pointer to an address hash node. */
+typedef INTNETADDRNODE *PINTNETADDRNODE;
+
+
 /**
  * Address cache for a specific network layer.
  */
@@ -209,6 +259,11 @@ typedef struct INTNETADDRCACHE
     uint8_t                 cbAddress;
     /** The size of an entry. */
     uint8_t                 cbEntry;
+    /** The address hash nodes (cEntriesAlloc), preallocated for the same
+     * reasons as the entries. */
+    PINTNETADDRNODE         paNodes;
+    /** The unused nodes. */
+    PINTNETADDRNODE         pFreeNodes;
 } INTNETADDRCACHE;
 /** Pointer to an address cache. */
 typedef INTNETADDRCACHE *PINTNETADDRCACHE;
@@ -256,6 +311,10 @@ typedef struct INTNETIF
     RTSEMEVENT volatile     hRecvEvent;
     /** Number of threads sleeping on the event semaphore. */
     uint32_t                cSleepers;
+    /** Set when a frame was put into the receive ring without signalling
+     * hRecvEvent because nobody was sleeping.  IntNetR0IfWait consumes it
+     * instead of the event, so each wakeup is still reported exactly once. */
+    bool volatile           fRecvPending;
     /** The interface handle.
      * When this is INTNET_HANDLE_INVALID a sleeper which is waking up
      * should return with the appropriate error condition. */
@@ -356,6 +415,9 @@ typedef struct INTNETNETWORK
     /** MAC address table.
      * This doubles as interface collection. */
     INTNETMACTAB            MacTab;
+    /** Hash of the network layer addresses in the address caches of all the
+     * interfaces on the network.  Protected by hAddrSpinlock. */
+    PINTNETADDRNODE         apAddrHash[INTNET_ADDR_HASH_SIZE];
 
     /** Wait for an interface to stop being busy so it can be removed or have its
      * destination table replaced.  We have to wait upon this while owning the
@@ -816,6 +878,185 @@ DECL_FORCE_INLINE(bool) intnetR0IfHasMacAddr(PINTNETIF pIf)
 }
 
 
+/**
+ * Is it a multicast or broadcast MAC address?
+ *
+ * @returns true if multicast, false if not.
+ * @param   pMacAddr            The address to inspect.
+ */
+DECL_FORCE_INLINE(bool) intnetR0IsMacAddrMulticast(PCRTMAC pMacAddr)
+{
+    return !!(pMacAddr->au8[0] & 0x01);
+}
+
+
+/**
+ * Is it a dummy MAC address?
+ *
+ * We use dummy MAC addresses for interfaces which we don't know the MAC
+ * address of because they haven't sent anything (learning) or explicitly set
+ * it.
+ *
+ * @returns true if dummy, false if not.
+ * @param   pMacAddr            The address to inspect.
+ */
+DECL_FORCE_INLINE(bool) intnetR0IsMacAddrDummy(PCRTMAC pMacAddr)
+{
+    /* The dummy address are broadcast addresses, don't bother check it all. */
+    return pMacAddr->au16[0] == 0xffff;
+}
+
+
+/**
+ * Compares two MAC addresses.
+ *
+ * @returns true if equal, false if not.
+ * @param   pDstAddr1           Address 1.
+ * @param   pDstAddr2           Address 2.
+ */
+DECL_FORCE_INLINE(bool) intnetR0AreMacAddrsEqual(PCRTMAC pDstAddr1, PCRTMAC pDstAddr2)
+{
+    return pDstAddr1->au16[2] == pDstAddr2->au16[2]
+        && pDstAddr1->au16[1] == pDstAddr2->au16[1]
+        && pDstAddr1->au16[0] == pDstAddr2->au16[0];
+}
+
+
+/**
+ * Calculates the MAC address hash bucket for a MAC address.
+ *
+ * @returns Bucket index.
+ * @param   pMacAddr            The MAC address.
+ */
+DECL_FORCE_INLINE(uint32_t) intnetR0MacTabHash(PCRTMAC pMacAddr)
+{
+    /* The vendor part is usually the same for all interfaces on a network, so
+       fold everything and let the multiplication spread the NIC specific bits. */
+    uint32_t u = ((uint32_t)pMacAddr->au16[2] << 16 | pMacAddr->au16[1]) ^ pMacAddr->au16[0];
+    return (u * UINT32_C(0x9e3779b1)) >> (32 - INTNET_MAC_HASH_SHIFT);
+}
+
+
+/**
+ * Links a MAC address table entry into the MAC address hash.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pTab                The MAC address table.
+ * @param   iEntry              The index of the entry.
+ */
+static void intnetR0MacTabHashLink(PINTNETMACTAB pTab, uint32_t iEntry)
+{
+    PINTNETMACTABENTRY pEntry = &pTab->paEntries[iEntry];
+    uint32_t const     iHash  = intnetR0MacTabHash(&pEntry->MacAddr);
+    pEntry->iHashNext   = pTab->aiHash[iHash];
+    pTab->aiHash[iHash] = (uint16_t)iEntry;
+    if (intnetR0IsMacAddrDummy(&pEntry->MacAddr))
+        pTab->cDummyEntries++;
+}
+
+
+/**
+ * Unlinks a MAC address table entry from the MAC address hash.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pTab                The MAC address table.
+ * @param   iEntry              The index of the entry.
+ */
+static void intnetR0MacTabHashUnlink(PINTNETMACTAB pTab, uint32_t iEntry)
+{
+    PINTNETMACTABENTRY pEntry = &pTab->paEntries[iEntry];
+    uint16_t          *piCur  = &pTab->aiHash[intnetR0MacTabHash(&pEntry->MacAddr)];
+    while (*piCur != INTNET_MAC_HASH_NIL)
+    {
+        if (*piCur == iEntry)
+        {
+            *piCur            = pEntry->iHashNext;
+            pEntry->iHashNext = INTNET_MAC_HASH_NIL;
+            if (intnetR0IsMacAddrDummy(&pEntry->MacAddr))
+                pTab->cDummyEntries--;
+            return;
+        }
+        piCur = &pTab->paEntries[*piCur].iHashNext;
+    }
+    AssertMsgFailed(("iEntry=%u MAC=%.6Rhxs\n", iEntry, &pEntry->MacAddr));
+}
+
+
+/**
+ * Rebuilds the MAC address hash after entries have been moved around.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pTab                The MAC address table.
+ */
+static void intnetR0MacTabHashRebuild(PINTNETMACTAB pTab)
+{
+    memset(&pTab->aiHash[0], 0xff, sizeof(pTab->aiHash));
+    pTab->cDummyEntries = 0;
+    for (uint32_t iEntry = 0; iEntry < pTab->cEntries; iEntry++)
+        intnetR0MacTabHashLink(pTab, iEntry);
+}
+
+
+/**
+ * Changes the MAC address of a MAC address table entry.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pTab                The MAC address table.
+ * @param   pEntry              The entry.
+ * @param   pMacAddr            The new MAC address.
+ */
+static void intnetR0MacTabSetMacAddr(PINTNETMACTAB pTab, PINTNETMACTABENTRY pEntry, PCRTMAC pMacAddr)
+{
+    uint32_t const iEntry = (uint32_t)(pEntry - pTab->paEntries);
+    intnetR0MacTabHashUnlink(pTab, iEntry);
+    pEntry->MacAddr = *pMacAddr;
+    intnetR0MacTabHashLink(pTab, iEntry);
+}
+
+
+/**
+ * Checks whether unicast frames can be switched by looking only at the MAC
+ * address hash, i.e. there are no interfaces that want frames regardless of
+ * the destination address.
+ *
+ * @returns true if the hash is sufficient, false if all entries must be checked.
+ * @param   pTab                The MAC address table.
+ */
+DECL_FORCE_INLINE(bool) intnetR0MacTabIsHashSufficient(PINTNETMACTAB pTab)
+{
+    return !pTab->cPromiscuousEntries
+        && !pTab->cDummyEntries;
+}
+
+
+/**
+ * Checks whether there is an active interface with the given MAC address.
+ *
+ * The caller holds the MAC address table spinlock.
+ *
+ * @returns true if found, false if not.
+ * @param   pTab                The MAC address table.
+ * @param   pMacAddr            The MAC address to look for.
+ */
+DECLINLINE(bool) intnetR0MacTabHasActiveAddr(PINTNETMACTAB pTab, PCRTMAC pMacAddr)
+{
+    uint32_t iEntry = pTab->aiHash[intnetR0MacTabHash(pMacAddr)];
+    while (iEntry != INTNET_MAC_HASH_NIL)
+    {
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[iEntry];
+        if (   pEntry->fActive
+            && intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pMacAddr))
+            return true;
+        iEntry = pEntry->iHashNext;
+    }
+    return false;
+}
+
+
 /**
  * Locates the MAC address table entry for the given interface.
  *
@@ -827,11 +1068,14 @@ DECL_FORCE_INLINE(bool) intnetR0IfHasMacAddr(PINTNETIF pIf)
  */
 DECLINLINE(PINTNETMACTABENTRY) intnetR0NetworkFindMacAddrEntry(PINTNETNETWORK pNetwork, PINTNETIF pIf)
 {
-    uint32_t iIf = pNetwork->MacTab.cEntries;
-    while (iIf-- > 0)
+    /* The entry shadows the interface MAC address, so it's in that bucket. */
+    PINTNETMACTAB pTab   = &pNetwork->MacTab;
+    uint32_t      iEntry = pTab->aiHash[intnetR0MacTabHash(&pIf->MacAddr)];
+    while (iEntry != INTNET_MAC_HASH_NIL)
     {
-        if (pNetwork->MacTab.paEntries[iIf].pIf == pIf)
-            return &pNetwork->MacTab.paEntries[iIf];
+        if (pTab->paEntries[iEntry].pIf == pIf)
+            return &pTab->paEntries[iEntry];
+        iEntry = pTab->paEntries[iEntry].iHashNext;
     }
     return NULL;
 }
@@ -930,6 +1174,115 @@ DECLINLINE(bool) intnetR0AddrUIsEqualEx(PCRTNETADDRU pAddr1, PCRTNETADDRU pAddr2
 }
 
 
+/**
+ * Calculates the network address hash bucket for an address.
+ *
+ * @returns Bucket index.
+ * @param   pAddr           The address.
+ * @param   enmType         The address type.
+ * @param   cbAddr          The address size.
+ */
+DECLINLINE(uint32_t) intnetR0AddrHash(PCRTNETADDRU pAddr, INTNETADDRTYPE enmType, uint8_t const cbAddr)
+{
+    uint32_t u;
+    switch (cbAddr)
+    {
+        case 4:  /* IPv4 */
+            u = pAddr->au32[0];
+            break;
+        case 16: /* IPv6 */
+            u = pAddr->au32[0] ^ pAddr->au32[1] ^ pAddr->au32[2] ^ pAddr->au32[3];
+            break;
+        case 10: /* IPX */
+            u = pAddr->au32[0] ^ pAddr->au32[1] ^ pAddr->au16[4];
+            break;
+        default:
+            AssertFailedReturn(0);
+    }
+    return ((u ^ (uint32_t)enmType) * UINT32_C(0x9e3779b1)) >> (32 - INTNET_ADDR_HASH_SHIFT);
+}
+
+
+/**
+ * Links an address cache entry into the network address hash.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pNetwork        The network.
+ * @param   pIf             The interface owning the cache.
+ * @param   pCache          The address cache.
+ * @param   pAddr           The address being added to the cache.
+ */
+static void intnetR0NetworkAddrHashInsert(PINTNETNETWORK pNetwork, PINTNETIF pIf, PINTNETADDRCACHE pCache, PCRTNETADDRU pAddr)
+{
+    PINTNETADDRNODE pNode = pCache->pFreeNodes;
+    AssertReturnVoid(pNode);
+    pCache->pFreeNodes = pNode->pNext;
+
+    pNode->pIf     = pIf;
+    pNode->enmType = (INTNETADDRTYPE)(uintptr_t)(pCache - &pIf->aAddrCache[0]);
+    RT_ZERO(pNode->Addr);
+    memcpy(&pNode->Addr, pAddr, pCache->cbAddress);
+
+    PINTNETADDRNODE *ppHead = &pNetwork->apAddrHash[intnetR0AddrHash(&pNode->Addr, pNode->enmType, pCache->cbAddress)];
+    pNode->pNext = *ppHead;
+    *ppHead      = pNode;
+}
+
+
+/**
+ * Unlinks an address cache entry from the network address hash.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pNetwork        The network.
+ * @param   pIf             The interface owning the cache.
+ * @param   pCache          The address cache.
+ * @param   pAddr           The address being removed from the cache.
+ */
+static void intnetR0NetworkAddrHashRemove(PINTNETNETWORK pNetwork, PINTNETIF pIf, PINTNETADDRCACHE pCache, PCRTNETADDRU pAddr)
+{
+    INTNETADDRTYPE const enmType = (INTNETADDRTYPE)(uintptr_t)(pCache - &pIf->aAddrCache[0]);
+    PINTNETADDRNODE     *ppCur   = &pNetwork->apAddrHash[intnetR0AddrHash(pAddr, enmType, pCache->cbAddress)];
+    for (PINTNETADDRNODE pCur = *ppCur; pCur; ppCur = &pCur->pNext, pCur = *ppCur)
+        if (   pCur->pIf == pIf
+            && pCur->enmType == enmType
+            && intnetR0AddrUIsEqualEx(&pCur->Addr, pAddr, pCache->cbAddress))
+        {
+            *ppCur             = pCur->pNext;
+            pCur->pNext        = pCache->pFreeNodes;
+            pCache->pFreeNodes = pCur;
+            return;
+        }
+    AssertMsgFailed(("enmType=%d %.*Rhxs\n", enmType, pCache->cbAddress, pAddr));
+}
+
+
+/**
+ * Removes all the addresses cached by an interface from the network address
+ * hash and empties its caches.
+ *
+ * This is called when the interface leaves the network.  The caller must own
+ * the network spinlock.
+ *
+ * @param   pNetwork        The network.
+ * @param   pIf             The interface.
+ */
+static void intnetR0NetworkAddrHashRemoveIf(PINTNETNETWORK pNetwork, PINTNETIF pIf)
+{
+    for (int iType = kIntNetAddrType_Invalid + 1; iType < kIntNetAddrType_End; iType++)
+    {
+        PINTNETADDRCACHE pCache = &pIf->aAddrCache[iType];
+        while (pCache->cEntries > 0)
+        {
+            pCache->cEntries--;
+            intnetR0NetworkAddrHashRemove(pNetwork, pIf, pCache,
+                                          (PCRTNETADDRU)(pCache->pbEntries + pCache->cEntries * pCache->cbEntry));
+        }
+    }
+}
+
+
 /**
  * Worker for intnetR0IfAddrCacheLookup that performs the lookup
  * in the remaining cache entries after the caller has check the
@@ -1070,8 +1423,9 @@ DECLINLINE(int) intnetR0IfAddrCacheLookupUnlikely(PCINTNETADDRCACHE pCache, PCRT
  * Deletes a specific cache entry.
  *
  * Worker for intnetR0NetworkAddrCacheDelete and intnetR0NetworkAddrCacheDeleteMinusIf.
+ * The caller must own the network spinlock.
  *
- * @param   pIf             The interface (for logging).
+ * @param   pIf             The interface.
  * @param   pCache          The cache.
  * @param   iEntry          The entry to delete.
  * @param   pszMsg          Log message.
@@ -1100,6 +1454,10 @@ static void intnetR0IfAddrCacheDeleteIt(PINTNETIF pIf, PINTNETADDRCACHE pCache,
     }
 #endif
 
+    PINTNETNETWORK pNetwork = pIf->pNetwork;
+    if (pNetwork)
+        intnetR0NetworkAddrHashRemove(pNetwork, pIf, pCache, (PCRTNETADDRU)(pCache->pbEntries + iEntry * pCache->cbEntry));
+
     pCache->cEntries--;
     if (iEntry < pCache->cEntries)
         memmove(pCache->pbEntries +      iEntry  * pCache->cbEntry,
@@ -1111,7 +1469,7 @@ static void intnetR0IfAddrCacheDeleteIt(PINTNETIF pIf, PINTNETADDRCACHE pCache,
 /**
  * Deletes an address from the cache, assuming it isn't actually in the cache.
  *
- * May or may not own the spinlock when calling this.
+ * The caller must own the network spinlock.
  *
  * @param   pIf             The interface (for logging).
  * @param   pCache          The cache.
@@ -1143,13 +1501,19 @@ DECLINLINE(void) intnetR0NetworkAddrCacheDelete(PINTNETNETWORK pNetwork, PCRTNET
 {
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-    uint32_t iIf = pNetwork->MacTab.cEntries;
-    while (iIf--)
+    PINTNETADDRNODE pNode = pNetwork->apAddrHash[intnetR0AddrHash(pAddr, enmType, cbAddr)];
+    while (pNode)
     {
-        PINTNETIF pIf = pNetwork->MacTab.paEntries[iIf].pIf;
-        int i = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmType], pAddr, cbAddr);
-        if (RT_UNLIKELY(i >= 0))
-            intnetR0IfAddrCacheDeleteIt(pIf, &pIf->aAddrCache[enmType], i, pszMsg);
+        PINTNETADDRNODE pNext = pNode->pNext; /* the node is unlinked by the deletion */
+        if (   pNode->enmType == enmType
+            && intnetR0AddrUIsEqualEx(&pNode->Addr, pAddr, cbAddr))
+        {
+            PINTNETIF pIf = pNode->pIf;
+            int i = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmType], pAddr, cbAddr);
+            if (RT_LIKELY(i >= 0))
+                intnetR0IfAddrCacheDeleteIt(pIf, &pIf->aAddrCache[enmType], i, pszMsg);
+        }
+        pNode = pNext;
     }
 
     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
@@ -1173,16 +1537,20 @@ DECLINLINE(void) intnetR0NetworkAddrCacheDeleteMinusIf(PINTNETNETWORK pNetwork,
 {
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-    uint32_t iIf = pNetwork->MacTab.cEntries;
-    while (iIf--)
+    PINTNETADDRNODE pNode = pNetwork->apAddrHash[intnetR0AddrHash(pAddr, enmType, cbAddr)];
+    while (pNode)
     {
-        PINTNETIF pIf = pNetwork->MacTab.paEntries[iIf].pIf;
-        if (pIf != pIfSender)
+        PINTNETADDRNODE pNext = pNode->pNext; /* the node is unlinked by the deletion */
+        if (   pNode->pIf != pIfSender
+            && pNode->enmType == enmType
+            && intnetR0AddrUIsEqualEx(&pNode->Addr, pAddr, cbAddr))
         {
+            PINTNETIF pIf = pNode->pIf;
             int i = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmType], pAddr, cbAddr);
-            if (RT_UNLIKELY(i >= 0))
+            if (RT_LIKELY(i >= 0))
                 intnetR0IfAddrCacheDeleteIt(pIf, &pIf->aAddrCache[enmType], i, pszMsg);
         }
+        pNode = pNext;
     }
 
     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
@@ -1204,18 +1572,15 @@ DECLINLINE(PINTNETIF) intnetR0NetworkAddrCacheLookupIf(PINTNETNETWORK pNetwork,
 {
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-    uint32_t iIf = pNetwork->MacTab.cEntries;
-    while (iIf--)
-    {
-        PINTNETIF pIf = pNetwork->MacTab.paEntries[iIf].pIf;
-        int i = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmType], pAddr, cbAddr);
-        if (i >= 0)
+    for (PINTNETADDRNODE pNode = pNetwork->apAddrHash[intnetR0AddrHash(pAddr, enmType, cbAddr)]; pNode; pNode = pNode->pNext)
+        if (   pNode->enmType == enmType
+            && intnetR0AddrUIsEqualEx(&pNode->Addr, pAddr, cbAddr))
         {
+            PINTNETIF pIf = pNode->pIf;
             intnetR0BusyIncIf(pIf);
             RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
             return pIf;
         }
-    }
 
     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
     return NULL;
@@ -1246,11 +1611,20 @@ static void intnetR0IfAddrCacheAddIt(PINTNETIF pIf, PINTNETADDRCACHE pCache, PCR
         return;
     }
 
+    /* Don't add anything once the interface has left the switch table, the
+       address hash must not reference it after that. */
+    if (RT_UNLIKELY(!intnetR0NetworkFindMacAddrEntry(pNetwork, pIf)))
+    {
+        RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
+        return;
+    }
+
     /* When the table is full, drop the older entry (FIFO). Do proper ageing? */
     if (pCache->cEntries >= pCache->cEntriesAlloc)
     {
         Log(("intnetR0IfAddrCacheAddIt: type=%d replacing %.*Rhxs\n",
              (int)(uintptr_t)(pCache - &pIf->aAddrCache[0]), pCache->cbAddress, pCache->pbEntries));
+        intnetR0NetworkAddrHashRemove(pNetwork, pIf, pCache, (PCRTNETADDRU)pCache->pbEntries);
         memmove(pCache->pbEntries, pCache->pbEntries + pCache->cbEntry, pCache->cbEntry * (pCache->cEntries - 1));
         pCache->cEntries--;
         Assert(pCache->cEntries < pCache->cEntriesAlloc);
@@ -1282,6 +1656,7 @@ static void intnetR0IfAddrCacheAddIt(PINTNETIF pIf, PINTNETADDRCACHE pCache, PCR
 #endif
     pCache->cEntries++;
     Assert(pCache->cEntries <= pCache->cEntriesAlloc);
+    intnetR0NetworkAddrHashInsert(pNetwork, pIf, pCache, pAddr);
 
     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
 }
@@ -1359,6 +1734,11 @@ static void intnetR0IfAddrCacheDestroy(PINTNETADDRCACHE pCache)
     pCache->cEntries      = 0;
     pCache->cEntriesAlloc = 0;
     RTMemFree(pvFree);
+
+    pvFree = pCache->paNodes;
+    pCache->paNodes       = NULL;
+    pCache->pFreeNodes    = NULL;
+    RTMemFree(pvFree);
 }
 
 
@@ -1384,60 +1764,27 @@ static int intnetR0IfAddrCacheInit(PINTNETADDRCACHE pCache, INTNETADDRTYPE enmAd
         pCache->pbEntries     = (uint8_t *)RTMemAllocZ(pCache->cEntriesAlloc * pCache->cbEntry);
         if (!pCache->pbEntries)
             return VERR_NO_MEMORY;
+        pCache->paNodes       = (PINTNETADDRNODE)RTMemAllocZ(pCache->cEntriesAlloc * sizeof(INTNETADDRNODE));
+        if (!pCache->paNodes)
+            return VERR_NO_MEMORY;
+        pCache->pFreeNodes    = NULL;
+        for (unsigned i = pCache->cEntriesAlloc; i-- > 0;)
+        {
+            pCache->paNodes[i].pNext = pCache->pFreeNodes;
+            pCache->pFreeNodes       = &pCache->paNodes[i];
+        }
     }
     else
     {
         pCache->cEntriesAlloc = 0;
         pCache->pbEntries     = NULL;
+        pCache->paNodes       = NULL;
+        pCache->pFreeNodes    = NULL;
     }
     return VINF_SUCCESS;
 }
 
 
-/**
- * Is it a multicast or broadcast MAC address?
- *
- * @returns true if multicast, false if not.
- * @param   pMacAddr            The address to inspect.
- */
-DECL_FORCE_INLINE(bool) intnetR0IsMacAddrMulticast(PCRTMAC pMacAddr)
-{
-    return !!(pMacAddr->au8[0] & 0x01);
-}
-
-
-/**
- * Is it a dummy MAC address?
- *
- * We use dummy MAC addresses for interfaces which we don't know the MAC
- * address of because they haven't sent anything (learning) or explicitly set
- * it.
- *
- * @returns true if dummy, false if not.
- * @param   pMacAddr            The address to inspect.
- */
-DECL_FORCE_INLINE(bool) intnetR0IsMacAddrDummy(PCRTMAC pMacAddr)
-{
-    /* The dummy address are broadcast addresses, don't bother check it all. */
-    return pMacAddr->au16[0] == 0xffff;
-}
-
-
-/**
- * Compares two MAC addresses.
- *
- * @returns true if equal, false if not.
- * @param   pDstAddr1           Address 1.
- * @param   pDstAddr2           Address 2.
- */
-DECL_FORCE_INLINE(bool) intnetR0AreMacAddrsEqual(PCRTMAC pDstAddr1, PCRTMAC pDstAddr2)
-{
-    return pDstAddr1->au16[2] == pDstAddr2->au16[2]
-        && pDstAddr1->au16[1] == pDstAddr2->au16[1]
-        && pDstAddr1->au16[0] == pDstAddr2->au16[0];
-}
-
-
 /**
  * Switch a unicast frame based on the network layer address (OSI level 3) and
  * return a destination table.
@@ -1470,24 +1817,48 @@ static INTNETSWDECISION intnetR0NetworkSwitchLevel3(PINTNETNETWORK pNetwork, PCR
 
     /* Find exactly matching or promiscuous interfaces. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
-    {
-        if (pTab->paEntries[iIfMac].fActive)
-        {
-            PINTNETIF pIf    = pTab->paEntries[iIfMac].pIf;         AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
-            bool      fExact = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmL3AddrType], pL3Addr, cbL3Addr) >= 0;
-            if (fExact || pTab->paEntries[iIfMac].fPromiscuousSeeTrunk)
+    uint32_t iIfMac;
+    if (!pTab->cPromiscuousEntries)
+    {
+        /* Only exact matches, so the address hash has all the answers. */
+        PINTNETADDRNODE pNode = pNetwork->apAddrHash[intnetR0AddrHash(pL3Addr, enmL3AddrType, cbL3Addr)];
+        for (; pNode; pNode = pNode->pNext)
+            if (   pNode->enmType == enmL3AddrType
+                && pNode->pIf->fActive
+                && intnetR0AddrUIsEqualEx(&pNode->Addr, pL3Addr, cbL3Addr))
             {
-                cExactHits += fExact;
+                PINTNETIF pIf = pNode->pIf;                             Assert(pIf->pNetwork == pNetwork);
+                cExactHits++;
 
                 uint32_t iIfDst = pDstTab->cIfs++;
                 pDstTab->aIfs[iIfDst].pIf            = pIf;
-                pDstTab->aIfs[iIfDst].fReplaceDstMac = fExact;
+                pDstTab->aIfs[iIfDst].fReplaceDstMac = true;
                 intnetR0BusyIncIf(pIf);
 
-                if (fExact)
-                    pDstMacAddr = &pIf->MacAddr; /* Avoids duplicates being sent to the host. */
+                pDstMacAddr = &pIf->MacAddr; /* Avoids duplicates being sent to the host. */
+            }
+    }
+    else
+    {
+        iIfMac = pTab->cEntries;
+        while (iIfMac-- > 0)
+        {
+            if (pTab->paEntries[iIfMac].fActive)
+            {
+                PINTNETIF pIf    = pTab->paEntries[iIfMac].pIf;     AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                bool      fExact = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmL3AddrType], pL3Addr, cbL3Addr) >= 0;
+                if (fExact || pTab->paEntries[iIfMac].fPromiscuousSeeTrunk)
+                {
+                    cExactHits += fExact;
+
+                    uint32_t iIfDst = pDstTab->cIfs++;
+                    pDstTab->aIfs[iIfDst].pIf            = pIf;
+                    pDstTab->aIfs[iIfDst].fReplaceDstMac = fExact;
+                    intnetR0BusyIncIf(pIf);
+
+                    if (fExact)
+                        pDstMacAddr = &pIf->MacAddr; /* Avoids duplicates being sent to the host. */
+                }
             }
         }
     }
@@ -1570,6 +1941,21 @@ static INTNETSWDECISION intnetR0NetworkPreSwitchUnicast(PINTNETNETWORK pNetwork,
     PINTNETMACTAB       pTab            = &pNetwork->MacTab;
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
+    if (intnetR0MacTabIsHashSufficient(pTab))
+    {
+        /* No unknown or promiscuous interfaces, so just check the source
+           (paranoia) and destination addresses. */
+        if (   (   !pSrcAddr
+                || !intnetR0MacTabHasActiveAddr(pTab, pSrcAddr))
+            && intnetR0MacTabHasActiveAddr(pTab, pDstAddr))
+            enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
+                          ? INTNETSWDECISION_BROADCAST
+                          : INTNETSWDECISION_INTNET;
+
+        RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
+        return enmSwDecision;
+    }
+
     /* Iterate the internal network interfaces and look for matching source and
        destination addresses. */
     uint32_t iIfMac = pTab->cEntries;
@@ -1636,21 +2022,20 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
 
     /* Find exactly matching or promiscuous interfaces. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
+    uint32_t iIfMac;
+    if (intnetR0MacTabIsHashSufficient(pTab))
     {
-        if (pTab->paEntries[iIfMac].fActive)
+        /* No unknown or promiscuous interfaces, only the hash bucket matters. */
+        iIfMac = pTab->aiHash[intnetR0MacTabHash(pDstAddr)];
+        while (iIfMac != INTNET_MAC_HASH_NIL)
         {
-            bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
-            if (   fExact
-                || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
-                || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                    || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
-               )
+            PINTNETMACTABENTRY pEntry = &pTab->paEntries[iIfMac];
+            if (   pEntry->fActive
+                && intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pDstAddr))
             {
-                cExactHits += fExact;
+                cExactHits++;
 
-                PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                PINTNETIF pIf = pEntry->pIf;                        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
                 if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
                 {
                     uint32_t iIfDst = pDstTab->cIfs++;
@@ -1659,6 +2044,35 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
                     intnetR0BusyIncIf(pIf);
                 }
             }
+            iIfMac = pEntry->iHashNext;
+        }
+    }
+    else
+    {
+        iIfMac = pTab->cEntries;
+        while (iIfMac-- > 0)
+        {
+            if (pTab->paEntries[iIfMac].fActive)
+            {
+                bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
+                if (   fExact
+                    || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
+                    || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
+                        || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
+                   )
+                {
+                    cExactHits += fExact;
+
+                    PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;    AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                    if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
+                    {
+                        uint32_t iIfDst = pDstTab->cIfs++;
+                        pDstTab->aIfs[iIfDst].pIf            = pIf;
+                        pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                        intnetR0BusyIncIf(pIf);
+                    }
+                }
+            }
         }
     }
 
@@ -2101,12 +2515,13 @@ static void intnetR0NetworkSnoopDhcp(PINTNETNETWORK pNetwork, PCRTNETIPV4 pIpHdr
             if (intnetR0IPv4AddrIsGood(pDhcp->bp_yiaddr))
             {
                 PINTNETIF       pMatchingIf = NULL;
+                PINTNETMACTAB   pTab        = &pNetwork->MacTab;
                 RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-                uint32_t iIf = pNetwork->MacTab.cEntries;
-                while (iIf-- > 0)
+                uint32_t iIf = pTab->aiHash[intnetR0MacTabHash(&pDhcp->bp_chaddr.Mac)];
+                while (iIf != INTNET_MAC_HASH_NIL)
                 {
-                    PINTNETIF pCur = pNetwork->MacTab.paEntries[iIf].pIf;
+                    PINTNETIF pCur = pTab->paEntries[iIf].pIf;
                     if (    intnetR0IfHasMacAddr(pCur)
                         &&  !memcmp(&pCur->MacAddr, &pDhcp->bp_chaddr, sizeof(RTMAC)))
                     {
@@ -2118,6 +2533,7 @@ static void intnetR0NetworkSnoopDhcp(PINTNETNETWORK pNetwork, PCRTNETIPV4 pIpHdr
                             intnetR0BusyIncIf(pMatchingIf);
                         }
                     }
+                    iIf = pTab->paEntries[iIf].iHashNext;
                 }
 
                 RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
@@ -2137,12 +2553,13 @@ static void intnetR0NetworkSnoopDhcp(PINTNETNETWORK pNetwork, PCRTNETIPV4 pIpHdr
          */
         case RTNET_DHCP_MT_RELEASE:
         {
+            PINTNETMACTAB pTab = &pNetwork->MacTab;
             RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-            uint32_t iIf = pNetwork->MacTab.cEntries;
-            while (iIf-- > 0)
+            uint32_t iIf = pTab->aiHash[intnetR0MacTabHash(&pDhcp->bp_chaddr.Mac)];
+            while (iIf != INTNET_MAC_HASH_NIL)
             {
-                PINTNETIF pCur = pNetwork->MacTab.paEntries[iIf].pIf;
+                PINTNETIF pCur = pTab->paEntries[iIf].pIf;
                 if (    intnetR0IfHasMacAddr(pCur)
                     &&  !memcmp(&pCur->MacAddr, &pDhcp->bp_chaddr, sizeof(RTMAC)))
                 {
@@ -2151,6 +2568,7 @@ static void intnetR0NetworkSnoopDhcp(PINTNETNETWORK pNetwork, PCRTNETIPV4 pIpHdr
                     intnetR0IfAddrCacheDelete(pCur, &pCur->aAddrCache[kIntNetAddrType_IPv4],
                                               (PCRTNETADDRU)&pDhcp->bp_yiaddr, sizeof(RTNETADDRIPV4), "DHCP_MT_RELEASE");
                 }
+                iIf = pTab->paEntries[iIf].iHashNext;
             }
 
             RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
@@ -2512,8 +2930,13 @@ static void intnetR0IfSnoopArpAddr(PINTNETIF pIf, PCRTNETARPIPV4 pArpIPv4, uint3
              || pArpIPv4->ar_tha.au16[1]
              || pArpIPv4->ar_tha.au16[2])
         &&  intnetR0IPv4AddrIsGood(pArpIPv4->ar_tpa))
+    {
+        PINTNETNETWORK pNetwork = pIf->pNetwork;
+        RTSpinlockAcquire(pNetwork->hAddrSpinlock);
         intnetR0IfAddrCacheDelete(pIf, &pIf->aAddrCache[kIntNetAddrType_IPv4],
                                   (PCRTNETADDRU)&pArpIPv4->ar_tpa, sizeof(RTNETADDRIPV4), "if/arp");
+        RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
+    }
 
     if (    !memcmp(&pArpIPv4->ar_sha, &pIf->MacAddr, sizeof(RTMAC))
         &&  intnetR0IPv4AddrIsGood(pArpIPv4->ar_spa))
@@ -2618,7 +3041,19 @@ static void intnetR0IfSend(PINTNETIF pIf, PINTNETIF pIfSender, PINTNETSG pSG, PC
     if (RT_SUCCESS(rc))
     {
         pIf->cYields = 0;
-        RTSemEventSignal(pIf->hRecvEvent);
+
+        /*
+         * Only signal the receiver if it is (about to be) blocked in
+         * IntNetR0IfWait.  A consumer that is busy draining the ring or polling
+         * it will pick up the frame without our help.  The pending flag is set
+         * before we read cSleepers, and IntNetR0IfWait checks it after bumping
+         * cSleepers, so no wakeup gets lost.
+         */
+        ASMAtomicWriteBool(&pIf->fRecvPending, true);
+        if (ASMAtomicReadU32(&pIf->cSleepers))
+            RTSemEventSignal(pIf->hRecvEvent);
+        else
+            STAM_REL_COUNTER_INC(&pIf->pIntBuf->cStatRecvWakeupsSkipped);
         return;
     }
 
@@ -3735,7 +4170,7 @@ static INTNETSWDECISION intnetR0NetworkSend(PINTNETNETWORK pNetwork, PINTNETIF p
 
         PINTNETMACTABENTRY pIfEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIfSender);
         if (pIfEntry)
-            pIfEntry->MacAddr = EthHdr.SrcMac;
+            intnetR0MacTabSetMacAddr(&pNetwork->MacTab, pIfEntry, &EthHdr.SrcMac);
         pIfSender->MacAddr    = EthHdr.SrcMac;
 
         RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
@@ -4183,7 +4618,7 @@ INTNETR0DECL(int) IntNetR0IfSetMacAddress(INTNETIFHANDLE hIf, PSUPDRVSESSION pSe
             /* Update the two copies. */
             PINTNETMACTABENTRY pEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIf); Assert(pEntry);
             if (RT_LIKELY(pEntry))
-                pEntry->MacAddr = *pMac;
+                intnetR0MacTabSetMacAddr(&pNetwork->MacTab, pEntry, pMac);
             pIf->MacAddr        = *pMac;
             pIf->fMacSet        = true;
 
@@ -4426,21 +4861,28 @@ INTNETR0DECL(int) IntNetR0IfWait(INTNETIFHANDLE hIf, PSUPDRVSESSION pSession, ui
         return VERR_SEM_DESTROYED;
     }
 
-    /*
-     * It is tempting to check if there is data to be read here,
-     * but the problem with such an approach is that it will cause
-     * one unnecessary supervisor->user->supervisor trip. There is
-     * already a slight risk for such, so no need to increase it.
-     */
-
     /*
      * Increment the number of waiters before starting the wait.
      * Upon wakeup we must assert reality, checking that we're not
      * already destroyed or in the process of being destroyed. This
      * code must be aligned with the waiting code in intnetR0IfDestruct.
+     *
+     * Since intnetR0IfSend only signals the event when there are sleepers,
+     * we have to check for an unsignalled frame after announcing ourselves,
+     * otherwise a frame committed just before the increment could go
+     * unnoticed until the wait times out.  The flag is cleared again when we
+     * wake up since the frame(s) that signalled us also set it.
      */
     ASMAtomicIncU32(&pIf->cSleepers);
-    int rc = RTSemEventWaitNoResume(hRecvEvent, cMillies);
+    int rc;
+    if (!ASMAtomicXchgBool(&pIf->fRecvPending, false))
+    {
+        rc = RTSemEventWaitNoResume(hRecvEvent, cMillies);
+        if (RT_SUCCESS(rc))
+            ASMAtomicWriteBool(&pIf->fRecvPending, false);
+    }
+    else
+        rc = VINF_SUCCESS;
     if (pIf->hRecvEvent == hRecvEvent)
     {
         ASMAtomicDecU32(&pIf->cSleepers);
@@ -4672,11 +5114,18 @@ static DECLCALLBACK(void) intnetR0IfDestruct(void *pvObj, void *pvUser1, void *p
                 Assert(pNetwork->MacTab.cPromiscuousEntries        < pNetwork->MacTab.cEntries);
                 Assert(pNetwork->MacTab.cPromiscuousNoTrunkEntries < pNetwork->MacTab.cEntries);
 
+                intnetR0NetworkAddrHashRemoveIf(pNetwork, pIf);
+                intnetR0MacTabHashUnlink(&pNetwork->MacTab, iIf);
                 if (iIf + 1 < pNetwork->MacTab.cEntries)
+                {
                     memmove(&pNetwork->MacTab.paEntries[iIf],
                             &pNetwork->MacTab.paEntries[iIf + 1],
                             (pNetwork->MacTab.cEntries - iIf - 1) * sizeof(pNetwork->MacTab.paEntries[0]));
-                pNetwork->MacTab.cEntries--;
+                    pNetwork->MacTab.cEntries--;
+                    intnetR0MacTabHashRebuild(&pNetwork->MacTab); /* the indexes changed */
+                }
+                else
+                    pNetwork->MacTab.cEntries--;
                 break;
             }
 
@@ -4850,6 +5299,7 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
     //pIf->pIntBufDefaultR3 = NIL_RTR3PTR;
     pIf->hRecvEvent         = NIL_RTSEMEVENT;
     //pIf->cSleepers        = 0;
+    //pIf->fRecvPending     = false;
     pIf->hIf                = INTNET_HANDLE_INVALID;
     pIf->pNetwork           = pNetwork;
     pIf->pSession           = pSession;
@@ -4911,6 +5361,7 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
                     pNetwork->MacTab.paEntries[iIf].fPromiscuousEff      = false;
                     pNetwork->MacTab.paEntries[iIf].fPromiscuousSeeTrunk = false;
                     pNetwork->MacTab.paEntries[iIf].pIf                  = pIf;
+                    intnetR0MacTabHashLink(&pNetwork->MacTab, iIf);
 
                     pNetwork->MacTab.cEntries = iIf + 1;
                     pIf->pNetwork = pNetwork;
@@ -5583,6 +6034,8 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
         if (   iIf == pNetwork->MacTab.cEntries /* paranoia */
             && pIf->cBusy)
         {
+            intnetR0NetworkAddrHashRemoveIf(pNetwork, pIf);
+            intnetR0MacTabHashUnlink(&pNetwork->MacTab, iIf - 1);
             pIf->pNetwork = NULL;
             pNetwork->MacTab.cEntries--;
         }
@@ -5977,6 +6430,8 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     pNetwork->MacTab.fWirePromiscuousEff    = false;
     pNetwork->MacTab.fWireActive            = false;
     pNetwork->MacTab.pTrunk                 = NULL;
+    memset(&pNetwork->MacTab.aiHash[0], 0xff, sizeof(pNetwork->MacTab.aiHash)); /* INTNET_MAC_HASH_NIL */
+    //pNetwork->apAddrHash                  = {NULL};
     pNetwork->hEvtBusyIf                    = NIL_RTSEMEVENT;
     pNetwork->pIntNet                       = pIntNet;
     //pNetwork->pvObj                       = NULL;
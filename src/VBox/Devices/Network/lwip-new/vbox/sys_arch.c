@@ -45,8 +45,10 @@
 #define LWIPMutexRelease RTSemMutexRelease
 #endif
 
-/** Maximum number of threads lwIP is allowed to create. */
-#define THREADS_MAX 5
+/** Maximum number of threads lwIP is allowed to create.  The NAT
+ * network service creates one poll manager thread per shard (up to 16)
+ * in addition to the tcpip thread. */
+#define THREADS_MAX 24
 
 /** Maximum number of mbox entries needed for reasonable performance. */
 #define MBOX_ENTRIES_MAX 128
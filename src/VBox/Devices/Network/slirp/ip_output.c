@@ -163,9 +163,11 @@ ip_output0(PNATState pData, struct socket *so, struct mbuf *m0, int urg)
 
     eh = (struct ethhdr *)(m->m_data - ETH_HLEN);
     /*
-     * If small enough for interface, can just send directly.
+     * If small enough for interface, can just send directly.  Large TCP
+     * segments (CSUM_TSO) are segmented by the device above, never fragmented.
      */
-    if ((u_int16_t)ip->ip_len <= if_mtu)
+    if (   (u_int16_t)ip->ip_len <= if_mtu
+        || (m->m_pkthdr.csum_flags & CSUM_TSO))
     {
         ip->ip_len = RT_H2N_U16((u_int16_t)ip->ip_len);
         ip->ip_off = RT_H2N_U16((u_int16_t)ip->ip_off);
@@ -36,6 +36,15 @@ int inet_aton(const char *cp, struct in_addr *ia);
 # include <arpa/inet.h>
 #endif
 
+/*
+ * On Linux the sockets are kept registered with an epoll set instead of
+ * handing slirp_select_fill() a fresh pollfd array on every round.
+ */
+#if defined(RT_OS_LINUX) && !defined(VBOX_NAT_WITHOUT_EPOLL)
+# define VBOX_NAT_WITH_EPOLL
+# include <sys/epoll.h>
+#endif
+
 #include <VBox/types.h>
 
 typedef struct NATState *PNATState;
@@ -56,10 +65,15 @@ void slirp_link_down(PNATState);
 void slirp_select_fill(PNATState pData, int *pndfs);
 
 void slirp_select_poll(PNATState pData, int fTimeout, int fIcmp);
-#else /* RT_OS_WINDOWS */
+#elif defined(VBOX_NAT_WITH_EPOLL)
+void slirp_select_fill(PNATState pData);
+void slirp_select_poll(PNATState pData, struct epoll_event *paEvents, int cEvents);
+int slirp_get_epoll_fd(PNATState pData);
+int slirp_register_external_fd(PNATState pData, int fd);
+#else /* !RT_OS_WINDOWS && !VBOX_NAT_WITH_EPOLL */
 void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls);
 void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs);
-#endif /* !RT_OS_WINDOWS */
+#endif /* !RT_OS_WINDOWS && !VBOX_NAT_WITH_EPOLL */
 
 void slirp_input(PNATState pData, struct mbuf *m, size_t cbBuf);
 void slirp_set_ethaddr_and_activate_port_forwarding(PNATState pData, const uint8_t *ethaddr, uint32_t GuestIP);
@@ -92,6 +106,7 @@ void slirp_set_tcp_sndspace(PNATState pData, int kilobytes);
 
 int  slirp_set_binding_address(PNATState, char *addr);
 void slirp_set_mtu(PNATState, int);
+void slirp_set_gso_output(PNATState pData, bool fEnable);
 void slirp_info(PNATState pData, const void *pvArg, const char *pszArgs);
 void slirp_set_somaxconn(PNATState pData, int iSoMaxConn);
 
@@ -148,6 +163,8 @@ void slirp_register_external_event(PNATState pData, HANDLE hEvent, int index);
 
 struct mbuf *slirp_ext_m_get(PNATState pData, size_t cbMin, void **ppvBuf, size_t *pcbBuf);
 void slirp_ext_m_free(PNATState pData, struct mbuf *, uint8_t *pu8Buf);
+uint16_t slirp_ext_m_get_tso_segsz(struct mbuf *m);
+void slirp_ext_m_set_csum_valid(struct mbuf *m);
 
 /*
  * Returns the timeout.
@@ -532,6 +532,26 @@ void slirp_ext_m_free(PNATState pData, struct mbuf *m, uint8_t *pu8Buf)
     LogFlowFuncLeave();
 }
 
+/**
+ * Returns the segment size of a large TCP segment passed to slirp_output(),
+ * or 0 if the frame doesn't need segmenting.
+ */
+uint16_t slirp_ext_m_get_tso_segsz(struct mbuf *m)
+{
+    if (m->m_pkthdr.csum_flags & CSUM_TSO)
+        return m->m_pkthdr.tso_segsz;
+    return 0;
+}
+
+/**
+ * Marks a frame for slirp_input() as having valid IP and payload checksums,
+ * used for large TCP segments whose checksum the guest left to the device.
+ */
+void slirp_ext_m_set_csum_valid(struct mbuf *m)
+{
+    m->m_pkthdr.csum_flags |= CSUM_IP_CHECKED | CSUM_IP_VALID | CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
+}
+
 static void zone_destroy(uma_zone_t zone)
 {
     RTCritSectEnter(&zone->csZone);
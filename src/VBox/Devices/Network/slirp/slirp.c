@@ -106,6 +106,7 @@
  * used to catch POLLNVAL while logging and return false in case of error while
  * normal usage.
  */
+# ifndef VBOX_NAT_WITH_EPOLL
 #  define DO_CHECK_FD_SET(so, events, fdset)                        \
       (   ((so)->so_poll_index != -1)                               \
        && ((so)->so_poll_index <= ndfs)                             \
@@ -113,6 +114,14 @@
        && (polls[(so)->so_poll_index].revents & N_(fdset ## _poll)) \
        && (   N_(fdset ## _poll) == POLLNVAL                        \
            || !(polls[(so)->so_poll_index].revents & POLLNVAL)))
+# else
+/*
+ * The epoll event bits are the poll ones on Linux, and epoll_wait() only
+ * reports registered descriptors, so there's no POLLNVAL to take care of.
+ */
+#  define DO_CHECK_FD_SET(so, events, fdset)                        \
+      ((so)->so_poll_revents & N_(fdset ## _poll))
+# endif
 
   /* specific for Windows Winsock API */
 # define DO_WIN_CHECK_FD_SET(so, events, fdset) 0
@@ -252,6 +261,25 @@
 #define LOG_NAT_SOCK(so, proto, winevent, r_fdset, w_fdset, x_fdset) \
     DO_LOG_NAT_SOCK((so), proto, (winevent), r_fdset, w_fdset, x_fdset)
 
+/*
+ * Socket iteration in slirp_select_poll().  With epoll only the sockets
+ * epoll_wait() returned are visited, TCP ones first (see there).
+ */
+#ifdef VBOX_NAT_WITH_EPOLL
+AssertCompile(POLLIN == EPOLLIN && POLLOUT == EPOLLOUT && POLLPRI == EPOLLPRI);
+AssertCompile(POLLHUP == EPOLLHUP && POLLERR == EPOLLERR);
+
+# define QSOCKET_FOREACH_READY(so, so_next, label)                          \
+    for (iEvent = iFirst_ ## label; iEvent < iEnd_ ## label; iEvent++)      \
+    {                                                                       \
+        (so) = (struct socket *)paEvents[iEvent].data.ptr;                  \
+        (so_next) = (so)->so_next;                                          \
+        Log2(("%s:%d Processing so:%R[natsock]\n", __FUNCTION__, __LINE__, (so)));
+#else
+# define QSOCKET_FOREACH_READY(so, so_next, label)                          \
+    QSOCKET_FOREACH(so, so_next, label)
+#endif
+
 static void activate_port_forwarding(PNATState, const uint8_t *pEther);
 
 static const uint8_t special_ethaddr[6] =
@@ -336,6 +364,18 @@ int slirp_init(PNATState *ppData, uint32_t u32NetAddr, uint32_t u32Netmask,
         *ppData = NULL;
         return rc;
     }
+#ifdef VBOX_NAT_WITH_EPOLL
+    pData->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (pData->epoll_fd == -1)
+    {
+        rc = RTErrConvertFromErrno(errno);
+        LogRel(("NAT: epoll_create1 failed: %Rrc\n", rc));
+        bootp_dhcp_fini(pData);
+        RTMemFree(pData);
+        *ppData = NULL;
+        return rc;
+    }
+#endif
     debug_init(pData);
     if_init(pData);
     ip_init(pData);
@@ -546,6 +586,9 @@ void slirp_term(PNATState pData)
 #ifdef RT_OS_WINDOWS
     WSACleanup();
 #endif
+#ifdef VBOX_NAT_WITH_EPOLL
+    close(pData->epoll_fd);
+#endif
 #ifndef VBOX_WITH_SLIRP_BSD_SBUF
 #ifdef LOG_ENABLED
     Log(("\n"
@@ -592,33 +635,13 @@ static void updtime(PNATState pData)
 #endif
 }
 
-#ifdef RT_OS_WINDOWS
-void slirp_select_fill(PNATState pData, int *pnfds)
-#else /* RT_OS_WINDOWS */
-void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
-#endif /* !RT_OS_WINDOWS */
+/*
+ * Decide which of the timers slirp_select_poll has to run.
+ */
+static void slirpCheckTimers(PNATState pData)
 {
-    struct socket *so, *so_next;
-    int nfds;
-#if defined(RT_OS_WINDOWS)
-    int rc;
-    int error;
-#else
-    int poll_index = 0;
-#endif
     int i;
 
-    STAM_PROFILE_START(&pData->StatFill, a);
-
-    nfds = *pnfds;
-
-    /*
-     * First, TCP sockets
-     */
-    do_slowtimo = 0;
-    if (!link_up)
-        goto done;
-
     /*
      * *_slowtimo needs calling if there are IP fragments
      * in the fragment queue, or there are TCP connections active
@@ -638,6 +661,70 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
             }
         }
     }
+
+    /*
+     * See if we need a tcp_fasttimo
+     */
+    if (    time_fasttimo == 0
+        && !LIST_EMPTY(&pData->tcp_delack_list))
+        time_fasttimo = curtime; /* Flag when we want a fasttimo */
+}
+
+/*
+ * See if UDP socket so has timed out.
+ * Returns true if so was freed or isn't to be polled this time round.
+ */
+static bool slirpUdpCheckExpired(PNATState pData, struct socket *so, struct socket *so_next)
+{
+    if (   so->so_expire == 0
+        || so->so_expire > curtime)
+        return false;
+
+    Log2(("NAT: %R[natsock] expired\n", so));
+    if (so->so_timeout != NULL)
+    {
+        /* so_timeout - might change the so_expire value or
+         * drop so_timeout* from so.
+         */
+        so->so_timeout(pData, so, so->so_timeout_arg);
+        /* on 4.2 so->
+         */
+        if (   so_next->so_prev != so /* so_timeout freed the socket */
+            || so->so_timeout)  /* so_timeout just freed so_timeout */
+            return true;
+    }
+    UDP_DETACH(pData, so, so_next);
+    return true;
+}
+
+#ifndef VBOX_NAT_WITH_EPOLL
+# ifdef RT_OS_WINDOWS
+void slirp_select_fill(PNATState pData, int *pnfds)
+# else /* RT_OS_WINDOWS */
+void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
+# endif /* !RT_OS_WINDOWS */
+{
+    struct socket *so, *so_next;
+    int nfds;
+# if defined(RT_OS_WINDOWS)
+    int rc;
+    int error;
+# else
+    int poll_index = 0;
+# endif
+
+    STAM_PROFILE_START(&pData->StatFill, a);
+
+    nfds = *pnfds;
+
+    /*
+     * First, TCP sockets
+     */
+    do_slowtimo = 0;
+    if (!link_up)
+        goto done;
+
+    slirpCheckTimers(pData);
     /* always add the ICMP socket */
 #ifndef RT_OS_WINDOWS
     pData->icmp_socket.so_poll_index = -1;
@@ -658,16 +745,6 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
         /* TCP socket can't be cloned */
         Assert((!so->so_cloneOf));
 #endif
-        /*
-         * See if we need a tcp_fasttimo
-         */
-        if (    time_fasttimo == 0
-                && so->so_tcpcb != NULL
-                && so->so_tcpcb->t_flags & TF_DELACK)
-        {
-            time_fasttimo = curtime; /* Flag when we want a fasttimo */
-        }
-
         /*
          * NOFDREF can include still connecting to local-host,
          * newly socreated() sockets etc. Don't want to select these.
@@ -745,27 +822,8 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
         /*
          * See if it's timed out
          */
-        if (so->so_expire)
-        {
-            if (so->so_expire <= curtime)
-            {
-                Log2(("NAT: %R[natsock] expired\n", so));
-                if (so->so_timeout != NULL)
-                {
-                    /* so_timeout - might change the so_expire value or
-                     * drop so_timeout* from so.
-                     */
-                    so->so_timeout(pData, so, so->so_timeout_arg);
-                    /* on 4.2 so->
-                     */
-                    if (   so_next->so_prev != so /* so_timeout freed the socket */
-                        || so->so_timeout)  /* so_timeout just freed so_timeout */
-                      CONTINUE_NO_UNLOCK(udp);
-                }
-                UDP_DETACH(pData, so, so_next);
-                CONTINUE_NO_UNLOCK(udp);
-            }
-        }
+        if (slirpUdpCheckExpired(pData, so, so_next))
+            CONTINUE_NO_UNLOCK(udp);
 #ifdef VBOX_WITH_NAT_UDP_SOCKET_CLONE
         if (so->so_cloneOf)
                 CONTINUE_NO_UNLOCK(udp);
@@ -790,16 +848,197 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
     }
 done:
 
-#if defined(RT_OS_WINDOWS)
+# if defined(RT_OS_WINDOWS)
     *pnfds = VBOX_EVENT_COUNT;
-#else /* RT_OS_WINDOWS */
+# else /* RT_OS_WINDOWS */
     AssertRelease(poll_index <= *pnfds);
     *pnfds = poll_index;
-#endif /* !RT_OS_WINDOWS */
+# endif /* !RT_OS_WINDOWS */
 
     STAM_PROFILE_STOP(&pData->StatFill, a);
 }
 
+#else /* VBOX_NAT_WITH_EPOLL */
+
+/*
+ * Bring the epoll registration of so in line with the events it has to
+ * be polled for.  The kernel is only bothered if they changed.
+ */
+static void slirpEpollUpdate(PNATState pData, struct socket *so, uint32_t fEvents)
+{
+    struct epoll_event Event;
+    int iOp;
+    int rc;
+
+    /* The registration went away together with the descriptor it was made for. */
+    if (so->so_epoll_fd != so->s)
+    {
+        so->so_epoll_fd = -1;
+        so->so_epoll_events = 0;
+    }
+    if (   so->s == -1
+        || fEvents == so->so_epoll_events)
+        return;
+
+    if (fEvents == 0)
+        iOp = EPOLL_CTL_DEL;
+    else if (so->so_epoll_events == 0)
+        iOp = EPOLL_CTL_ADD;
+    else
+        iOp = EPOLL_CTL_MOD;
+    Event.events = fEvents;
+    Event.data.ptr = so;
+    rc = epoll_ctl(pData->epoll_fd, iOp, so->s, &Event);
+    if (rc != 0 && iOp == EPOLL_CTL_ADD && errno == EEXIST)
+        rc = epoll_ctl(pData->epoll_fd, iOp = EPOLL_CTL_MOD, so->s, &Event);
+    else if (rc != 0 && iOp == EPOLL_CTL_MOD && errno == ENOENT)
+        rc = epoll_ctl(pData->epoll_fd, iOp = EPOLL_CTL_ADD, so->s, &Event);
+    if (rc != 0 && iOp != EPOLL_CTL_DEL)
+    {
+        Log(("NAT: epoll_ctl(%d) failed for %R[natsock] (errno=%d)\n", iOp, so, errno));
+        fEvents = 0;
+    }
+
+    so->so_epoll_fd = fEvents ? so->s : -1;
+    so->so_epoll_events = fEvents;
+}
+
+/*
+ * The events a TCP socket has to be polled for, the same conditions the
+ * poll() variant of slirp_select_fill engages the socket for.
+ */
+static uint32_t slirpEpollTcpEvents(struct socket *so)
+{
+    uint32_t fEvents = 0;
+
+    /*
+     * NOFDREF can include still connecting to local-host,
+     * newly socreated() sockets etc. Don't want to select these.
+     */
+    if (so->so_state & SS_NOFDREF || so->s == -1)
+        return 0;
+
+    /* sockets which are accepting */
+    if (so->so_state & SS_FACCEPTCONN)
+        return N_(readfds_poll);
+
+    /* sockets which are connecting */
+    if (so->so_state & SS_ISFCONNECTING)
+        fEvents |= N_(writefds_poll);
+
+    /* connected, can send more, and have something to send */
+    if (CONN_CANFSEND(so) && SBUF_LEN(&so->so_rcv))
+        fEvents |= N_(writefds_poll);
+
+    /* connected, can receive more, and have room for it */
+    if (   CONN_CANFRCV(so)
+        && (SBUF_LEN(&so->so_snd) < (SBUF_SIZE(&so->so_snd)/2)))
+        fEvents |= N_(readfds_poll) | N_(xfds_poll);
+
+    return fEvents;
+}
+
+static uint32_t slirpEpollUdpEvents(struct socket *so)
+{
+    if (so->s == -1)
+        return 0;
+# ifdef VBOX_WITH_NAT_UDP_SOCKET_CLONE
+    /* clones share the descriptor of the socket they were made from */
+    if (so->so_cloneOf)
+        return 0;
+# endif
+    if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4)
+        return N_(readfds_poll);
+    return 0;
+}
+
+/*
+ * The epoll registrations are persistent, so unlike the poll() variant
+ * this only has to look at the sockets which were flagged dirty since the
+ * last call.  Every now and then (and when the link state changes) all
+ * sockets are looked at to run the UDP expiry and to catch a change which
+ * wasn't flagged.
+ */
+void slirp_select_fill(PNATState pData)
+{
+    struct socket *so, *so_next;
+
+    STAM_PROFILE_START(&pData->StatFill, a);
+
+    if (   pData->epoll_link_up != link_up
+        || curtime - pData->epoll_last_sweep >= 500)
+    {
+        pData->epoll_link_up = link_up;
+        pData->epoll_last_sweep = curtime;
+
+        STAM_COUNTER_RESET(&pData->StatTCP);
+        QSOCKET_FOREACH(so, so_next, tcp)
+        /* { */
+            STAM_COUNTER_INC(&pData->StatTCP);
+            SOCKET_EPOLL_DIRTY(pData, so);
+            LOOP_LABEL(tcp, so, so_next);
+        }
+
+        STAM_COUNTER_RESET(&pData->StatUDP);
+        QSOCKET_FOREACH(so, so_next, udp)
+        /* { */
+            STAM_COUNTER_INC(&pData->StatUDP);
+            if (   link_up
+                && slirpUdpCheckExpired(pData, so, so_next))
+                CONTINUE_NO_UNLOCK(udp);
+            SOCKET_EPOLL_DIRTY(pData, so);
+            LOOP_LABEL(udp, so, so_next);
+        }
+    }
+
+    do_slowtimo = 0;
+    if (link_up)
+        slirpCheckTimers(pData);
+
+    /* always add the ICMP socket */
+    slirpEpollUpdate(pData, &pData->icmp_socket, link_up ? N_(readfds_poll) : 0);
+
+    while ((so = LIST_FIRST(&pData->epoll_dirty)) != NULL)
+    {
+        uint32_t fEvents = 0;
+
+        LIST_REMOVE(so, so_epoll_dirty);
+        so->so_epoll_dirty.le_prev = NULL;
+        if (link_up)
+        {
+            if (so->so_type == IPPROTO_TCP)
+                fEvents = slirpEpollTcpEvents(so);
+            else if (so->so_type == IPPROTO_UDP)
+                fEvents = slirpEpollUdpEvents(so);
+        }
+        slirpEpollUpdate(pData, so, fEvents);
+    }
+
+    STAM_PROFILE_STOP(&pData->StatFill, a);
+}
+
+int slirp_get_epoll_fd(PNATState pData)
+{
+    return pData->epoll_fd;
+}
+
+/*
+ * Add a descriptor of the caller (e.g. a wakeup pipe) to the epoll set.
+ * Its events are reported with a NULL data.ptr and ignored by
+ * slirp_select_poll.
+ */
+int slirp_register_external_fd(PNATState pData, int fd)
+{
+    struct epoll_event Event;
+
+    Event.events = EPOLLIN | EPOLLPRI;
+    Event.data.ptr = NULL;
+    if (epoll_ctl(pData->epoll_fd, EPOLL_CTL_ADD, fd, &Event) != 0)
+        return RTErrConvertFromErrno(errno);
+    return VINF_SUCCESS;
+}
+#endif /* VBOX_NAT_WITH_EPOLL */
+
 
 /**
  * This function do Connection or sending tcp sequence to.
@@ -861,7 +1100,7 @@ static bool slirpConnectOrWrite(PNATState pData, struct socket *so, bool fConnec
              */
             struct tcpcb *tp = sototcpcb(so);
             if (RT_LIKELY(tp != NULL))
-                tp->t_flags |= TF_DELACK;
+                TCP_DELACK_SET(tp);
         }
     }
 
@@ -871,9 +1110,11 @@ static bool slirpConnectOrWrite(PNATState pData, struct socket *so, bool fConnec
 
 #if defined(RT_OS_WINDOWS)
 void slirp_select_poll(PNATState pData, int fTimeout, int fIcmp)
-#else /* RT_OS_WINDOWS */
+#elif defined(VBOX_NAT_WITH_EPOLL)
+void slirp_select_poll(PNATState pData, struct epoll_event *paEvents, int cEvents)
+#else /* !RT_OS_WINDOWS && !VBOX_NAT_WITH_EPOLL */
 void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
-#endif /* !RT_OS_WINDOWS */
+#endif /* !RT_OS_WINDOWS && !VBOX_NAT_WITH_EPOLL */
 {
     struct socket *so, *so_next;
     int ret;
@@ -881,10 +1122,53 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
     WSANETWORKEVENTS NetworkEvents;
     int rc;
     int error;
+#elif defined(VBOX_NAT_WITH_EPOLL)
+    int iEvent;
+    int iFirst_tcp = 0;
+    int iEnd_tcp = 0;
+    int iFirst_udp = 0;
+    int iEnd_udp = 0;
 #endif
 
     STAM_PROFILE_START(&pData->StatPoll, a);
 
+#ifdef VBOX_NAT_WITH_EPOLL
+    /*
+     * Latch the reported events and sort the sockets, TCP ones first.  All
+     * of them are put under polling right away, so whatever the timers or
+     * the processing of another socket do to them, they remain valid till
+     * we get to them.  Handling the events likely changes what they have
+     * to be polled for, hence they're flagged dirty as well.
+     */
+    pData->icmp_socket.so_poll_revents = 0;
+    for (iEvent = 0; iEvent < cEvents; iEvent++)
+    {
+        struct epoll_event Event = paEvents[iEvent];
+
+        so = (struct socket *)Event.data.ptr;
+        if (so == NULL) /* see slirp_register_external_fd */
+            continue;
+        so->so_poll_revents = Event.events;
+        if (   so == &pData->icmp_socket
+            || (   so->so_type != IPPROTO_TCP
+                && so->so_type != IPPROTO_UDP))
+            continue;
+
+        Assert(!so->fUnderPolling);
+        so->fUnderPolling = 1;
+        SOCKET_EPOLL_DIRTY(pData, so);
+        if (so->so_type == IPPROTO_TCP)
+        {
+            paEvents[iEnd_udp] = paEvents[iEnd_tcp];
+            paEvents[iEnd_tcp++] = Event;
+        }
+        else
+            paEvents[iEnd_udp] = Event;
+        iEnd_udp++;
+    }
+    iFirst_udp = iEnd_tcp;
+#endif
+
     /* Update time */
     updtime(pData);
 
@@ -918,7 +1202,18 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
      * Check sockets
      */
     if (!link_up)
+    {
+#ifdef VBOX_NAT_WITH_EPOLL
+        /* the next slirp_select_fill drops the registrations */
+        for (iEvent = 0; iEvent < iEnd_udp; iEvent++)
+        {
+            so = (struct socket *)paEvents[iEvent].data.ptr;
+            if (!slirpVerifyAndFreeSocket(pData, so))
+                so->fUnderPolling = 0;
+        }
+#endif
         goto done;
+    }
 #if defined(RT_OS_WINDOWS)
     /*XXX: before renaming please make see define
      * fIcmp in slirp_state.h
@@ -933,14 +1228,18 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
     /*
      * Check TCP sockets
      */
-    QSOCKET_FOREACH(so, so_next, tcp)
+    QSOCKET_FOREACH_READY(so, so_next, tcp)
     /* { */
         /* TCP socket can't be cloned */
 #ifdef VBOX_WITH_NAT_UDP_SOCKET_CLONE
         Assert((!so->so_cloneOf));
 #endif
+#ifndef VBOX_NAT_WITH_EPOLL
         Assert(!so->fUnderPolling);
         so->fUnderPolling = 1;
+#else
+        Assert(so->fUnderPolling); /* when the events were latched */
+#endif
         if (slirpVerifyAndFreeSocket(pData, so))
             CONTINUE(tcp);
         /*
@@ -1149,7 +1448,7 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
      * Incoming packets are sent straight away, they're not buffered.
      * Incoming UDP data isn't buffered either.
      */
-     QSOCKET_FOREACH(so, so_next, udp)
+     QSOCKET_FOREACH_READY(so, so_next, udp)
      /* { */
 #ifdef VBOX_WITH_NAT_UDP_SOCKET_CLONE
         if (so->so_cloneOf)
@@ -1161,6 +1460,10 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
             CONTINUE(udp);
         so->fUnderPolling = 0;
 #endif
+#ifdef VBOX_NAT_WITH_EPOLL
+        if (slirpVerifyAndFreeSocket(pData, so))
+            CONTINUE(udp);
+#endif
 
         POLL_UDP_EVENTS(rc, error, so, &NetworkEvents);
 
@@ -1170,6 +1473,10 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
         {
             SORECVFROM(pData, so);
         }
+#ifdef VBOX_NAT_WITH_EPOLL
+        if (!slirpVerifyAndFreeSocket(pData, so))
+            so->fUnderPolling = 0;
+#endif
         LOOP_LABEL(udp, so, so_next);
     }
 
@@ -2006,6 +2313,19 @@ void slirp_set_mtu(PNATState pData, int mtu)
     if_mru = mtu;
 }
 
+/**
+ * Enables or disables the generation of large TCP segments towards the guest.
+ *
+ * When enabled, tcp_output() may coalesce several MSS sized segments into one
+ * mbuf flagged with CSUM_TSO; the caller of slirp_output() is then responsible
+ * for the final checksums and, if required, the segmentation.
+ */
+void slirp_set_gso_output(PNATState pData, bool fEnable)
+{
+    LogRel(("NAT: large receive segments to the guest %s\n", fEnable ? "enabled" : "disabled"));
+    pData->fGsoOutput = fEnable;
+}
+
 /**
  * Info handler.
  */
@@ -2017,7 +2337,7 @@ void slirp_info(PNATState pData, const void *pvArg, const char *pszArgs)
     PCDBGFINFOHLP pHlp = (PCDBGFINFOHLP)pvArg;
     NOREF(pszArgs);
 
-    pHlp->pfnPrintf(pHlp, "NAT parameters: MTU=%d\n", if_mtu);
+    pHlp->pfnPrintf(pHlp, "NAT parameters: MTU=%d GSO=%RTbool\n", if_mtu, pData->fGsoOutput);
     pHlp->pfnPrintf(pHlp, "NAT TCP ports:\n");
     QSOCKET_FOREACH(so, so_next, tcp)
     /* { */
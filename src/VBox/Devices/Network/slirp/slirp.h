@@ -326,7 +326,7 @@ int tcp_mss (PNATState, register struct tcpcb *, u_int);
 
 /* tcp_output.c */
 int tcp_output (PNATState, register struct tcpcb *);
-void tcp_setpersist (register struct tcpcb *);
+void tcp_setpersist (PNATState, register struct tcpcb *);
 
 /* tcp_subr.c */
 void tcp_init (PNATState);
@@ -110,6 +110,9 @@ typedef struct NATState
     const char *bootp_filename;
     /* Stuff from if.c */
     int if_mtu, if_mru;
+    /** Whether the device above accepts large TCP segments (CSUM_TSO mbufs),
+     * see slirp_set_gso_output(). */
+    bool fGsoOutput;
     int if_comp;
     int if_maxlinkhdr;
     int if_queued;
@@ -131,6 +134,16 @@ typedef struct NATState
     uint32_t last_slowtimo;
     bool do_slowtimo;
     bool link_up;
+#ifdef VBOX_NAT_WITH_EPOLL
+    /** The epoll set the sockets are registered with. */
+    int epoll_fd;
+    /** Sockets whose registration must be recomputed by the next fill. */
+    struct socket_dirty_head epoll_dirty;
+    /** When the registrations of all sockets were recomputed last. */
+    uint32_t epoll_last_sweep;
+    /** The link state the registrations were computed for. */
+    bool epoll_link_up;
+#endif
     struct timeval tt;
     struct in_addr our_addr;
     struct in_addr alias_addr;
@@ -165,6 +178,10 @@ typedef struct NATState
     /* Stuff from tcp_timer.c */
     struct tcpstat_t tcpstat;
     uint32_t tcp_now;
+    /** Connections with running timers, hashed by their earliest deadline. */
+    struct tcpcbhead tcp_timer_wheel[TCP_TIMER_WHEEL_SIZE];
+    /** Connections owing a delayed ACK. */
+    struct tcpcbhead tcp_delack_list;
     int tcp_reass_qsize;
     int tcp_reass_maxqlen;
     int tcp_reass_maxseg;
@@ -174,11 +174,26 @@ socreate()
         so->s = -1;
 #if !defined(RT_OS_WINDOWS)
         so->so_poll_index = -1;
+#endif
+#ifdef VBOX_NAT_WITH_EPOLL
+        so->so_epoll_fd = -1;
 #endif
     }
     return so;
 }
 
+#ifdef VBOX_NAT_WITH_EPOLL
+/*
+ * Queue so for having its epoll registration recomputed
+ */
+void
+soepolldirty(PNATState pData, struct socket *so)
+{
+    if (so->so_epoll_dirty.le_prev == NULL)
+        LIST_INSERT_HEAD(&pData->epoll_dirty, so, so_epoll_dirty);
+}
+#endif
+
 /*
  * remque and free a socket, clobber cache
  */
@@ -227,6 +242,12 @@ sofree(PNATState pData, struct socket *so)
         NSOCK_DEC();
     }
 
+#ifdef VBOX_NAT_WITH_EPOLL
+    /* The descriptor is closed (or owned by someone else) by now, so there's
+     * no registration to drop, only the dirty list entry. */
+    if (so->so_epoll_dirty.le_prev != NULL)
+        LIST_REMOVE(so, so_epoll_dirty);
+#endif
     RTMemFree(so);
     LogFlowFuncLeave();
 }
@@ -1087,7 +1108,7 @@ solisten(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_in
      * SS_FACCEPTONCE sockets must time out.
      */
     if (flags & SS_FACCEPTONCE)
-        so->so_tcpcb->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT*2;
+        TCP_TIMER_ARM(so->so_tcpcb, TCPT_KEEP, TCPTV_KEEP_INIT*2);
 
     so->so_state = (SS_FACCEPTCONN|flags);
     so->so_lport = lport; /* Kept in network format */
@@ -1158,6 +1179,7 @@ no_sockopt:
         so->so_faddr = addr.sin_addr;
 
     so->s = s;
+    SOCKET_EPOLL_DIRTY(pData, so);
     SOCKET_UNLOCK(so);
     return so;
 }
@@ -88,6 +88,17 @@ struct socket
 #ifndef RT_OS_WINDOWS
     int so_poll_index;
 #endif /* !RT_OS_WINDOWS */
+#ifdef VBOX_NAT_WITH_EPOLL
+    /** The descriptor registered with the epoll set, -1 if none. */
+    int so_epoll_fd;
+    /** The events so_epoll_fd is registered for. */
+    uint32_t so_epoll_events;
+    /** The events epoll_wait() reported in the current poll pass. */
+    uint32_t so_poll_revents;
+    /** Entry on the list of sockets whose registration needs recomputing
+     *  (le_prev is NULL when the socket isn't on the list). */
+    LIST_ENTRY(socket) so_epoll_dirty;
+#endif
     /*
      * FD_CLOSE/POLLHUP event has been occurred on socket
      */
@@ -135,6 +146,19 @@ struct socket
 /* this function inform libalias about socket close */
 void slirpDeleteLinkSocket(void *pvLnk);
 
+#ifdef VBOX_NAT_WITH_EPOLL
+LIST_HEAD(socket_dirty_head, socket);
+void soepolldirty(PNATState pData, struct socket *so);
+/*
+ * The epoll registrations are persistent, so everything which may change the
+ * events a socket has to be polled for must flag the socket so the next
+ * slirp_select_fill() brings its registration up to date.
+ */
+# define SOCKET_EPOLL_DIRTY(pData, so) soepolldirty((pData), (so))
+#else
+# define SOCKET_EPOLL_DIRTY(pData, so) do {} while (0)
+#endif
+
 
 # define SOCKET_LOCK(so) do {} while (0)
 # define SOCKET_UNLOCK(so) do {} while (0)
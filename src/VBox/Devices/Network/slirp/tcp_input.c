@@ -78,10 +78,10 @@
                if (ti->ti_flags & TH_PUSH)          \
                        tp->t_flags |= TF_ACKNOW;    \
                else                                 \
-                       tp->t_flags |= TF_DELACK;
+                       TCP_DELACK_SET(tp);
 #else /* !TCP_ACK_HACK */
 #define DELAY_ACK(tp, ign)                          \
-                tp->t_flags |= TF_DELACK;
+                TCP_DELACK_SET(tp);
 #endif /* TCP_ACK_HACK */
 
 
@@ -381,8 +381,11 @@ tcp_input(PNATState pData, register struct mbuf *m, int iphlen, struct socket *i
     len = sizeof(struct ip) + tlen;
     /* keep checksum for ICMP reply
      * ti->ti_sum = cksum(m, len);
-     * if (ti->ti_sum) { */
-    if (cksum(m, len))
+     * if (ti->ti_sum) {
+     * Large segments from a GSO capable guest were validated by the caller of
+     * slirp_input() (CSUM_DATA_VALID), their TCP checksum isn't filled in. */
+    if (   !(m->m_pkthdr.csum_flags & CSUM_DATA_VALID)
+        && cksum(m, len))
     {
         tcpstat.tcps_rcvbadsum++;
         LogFlowFunc(("%d -> drop\n", __LINE__));
@@ -543,6 +546,7 @@ findso:
     }
 
     tp = sototcpcb(so);
+    SOCKET_EPOLL_DIRTY(pData, so);
 
     /* XXX Should never fail */
     if (tp == 0)
@@ -567,11 +571,11 @@ findso:
      * Segment received on connection.
      * Reset idle time and keep-alive timer.
      */
-    tp->t_idle = 0;
+    TCP_IDLE_RESET(tp);
     if (so_options)
-        tp->t_timer[TCPT_KEEP] = tcp_keepintvl;
+        TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepintvl);
     else
-        tp->t_timer[TCPT_KEEP] = tcp_keepidle;
+        TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepidle);
 
     /*
      * Process options if not in LISTEN state,
@@ -637,7 +641,7 @@ findso:
 #endif
                   if (   tp->t_rtt
                       && SEQ_GT(ti->ti_ack, tp->t_rtseq))
-                      tcp_xmit_timer(pData, tp, tp->t_rtt);
+                      tcp_xmit_timer(pData, tp, TCP_RTT(tp));
               acked = ti->ti_ack - tp->snd_una;
               tcpstat.tcps_rcvackpack++;
               tcpstat.tcps_rcvackbyte += acked;
@@ -663,9 +667,9 @@ findso:
                * decide between more output or persist.
                */
               if (tp->snd_una == tp->snd_max)
-                  tp->t_timer[TCPT_REXMT] = 0;
-              else if (tp->t_timer[TCPT_PERSIST] == 0)
-                  tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+                  TCP_TIMER_DISARM(tp, TCPT_REXMT);
+              else if (!TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
+                  TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
 
               /*
                * There's room in so_snd, sowwakup will read()
@@ -817,7 +821,7 @@ findso:
                  */
                 so->so_m = m;
                 so->so_ti = ti;
-                tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
+                TCP_TIMER_ARM(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
                 TCP_STATE_SWITCH_TO(tp, TCPS_SYN_RECEIVED);
             }
             SOCKET_UNLOCK(so);
@@ -852,7 +856,7 @@ cont_conn:
             tcp_rcvseqinit(tp);
             tp->t_flags |= TF_ACKNOW;
             TCP_STATE_SWITCH_TO(tp, TCPS_SYN_RECEIVED);
-            tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
+            TCP_TIMER_ARM(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
             tcpstat.tcps_accepts++;
             LogFlowFunc(("%d -> trimthenstep6\n", __LINE__));
             goto trimthenstep6;
@@ -899,7 +903,7 @@ cont_conn:
                     tp->snd_nxt = tp->snd_una;
             }
 
-            tp->t_timer[TCPT_REXMT] = 0;
+            TCP_TIMER_DISARM(tp, TCPT_REXMT);
             tp->irs = ti->ti_seq;
             tcp_rcvseqinit(tp);
             tp->t_flags |= TF_ACKNOW;
@@ -924,7 +928,7 @@ cont_conn:
                  * use its rtt as our initial srtt & rtt var.
                  */
                 if (tp->t_rtt)
-                    tcp_xmit_timer(pData, tp, tp->t_rtt);
+                    tcp_xmit_timer(pData, tp, TCP_RTT(tp));
             }
             else
                 TCP_STATE_SWITCH_TO(tp, TCPS_SYN_RECEIVED);
@@ -1273,7 +1277,7 @@ close:
                      * to keep a constant cwnd packets in the
                      * network.
                      */
-                    if (   tp->t_timer[TCPT_REXMT] == 0
+                    if (   !TCP_TIMER_ISARMED(tp, TCPT_REXMT)
                         || ti->ti_ack != tp->snd_una)
                         tp->t_dupacks = 0;
                     else if (++tp->t_dupacks == tcprexmtthresh)
@@ -1283,7 +1287,7 @@ close:
                         if (win < 2)
                             win = 2;
                         tp->snd_ssthresh = win * tp->t_maxseg;
-                        tp->t_timer[TCPT_REXMT] = 0;
+                        TCP_TIMER_DISARM(tp, TCPT_REXMT);
                         tp->t_rtt = 0;
                         tp->snd_nxt = ti->ti_ack;
                         tp->snd_cwnd = tp->t_maxseg;
@@ -1342,7 +1346,7 @@ synrx_to_est:
             else
 #endif
                 if (tp->t_rtt && SEQ_GT(ti->ti_ack, tp->t_rtseq))
-                    tcp_xmit_timer(pData, tp, tp->t_rtt);
+                    tcp_xmit_timer(pData, tp, TCP_RTT(tp));
 
             /*
              * If all outstanding data is acked, stop retransmit
@@ -1352,11 +1356,11 @@ synrx_to_est:
              */
             if (ti->ti_ack == tp->snd_max)
             {
-                tp->t_timer[TCPT_REXMT] = 0;
+                TCP_TIMER_DISARM(tp, TCPT_REXMT);
                 needoutput = 1;
             }
-            else if (tp->t_timer[TCPT_PERSIST] == 0)
-                tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+            else if (!TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
+                TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
             /*
              * When new data is acked, open the congestion window.
              * If the window gives us less than ssthresh packets
@@ -1424,7 +1428,7 @@ synrx_to_est:
                         if (so->so_state & SS_FCANTRCVMORE)
                         {
                             soisfdisconnected(so);
-                            tp->t_timer[TCPT_2MSL] = tcp_maxidle;
+                            TCP_TIMER_ARM(tp, TCPT_2MSL, tcp_maxidle);
                         }
                         TCP_STATE_SWITCH_TO(tp, TCPS_FIN_WAIT_2);
                     }
@@ -1441,7 +1445,7 @@ synrx_to_est:
                     {
                         TCP_STATE_SWITCH_TO(tp, TCPS_TIME_WAIT);
                         tcp_canceltimers(tp);
-                        tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+                        TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
                         soisfdisconnected(so);
                     }
                     break;
@@ -1467,7 +1471,7 @@ synrx_to_est:
                  * it and restart the finack timer.
                  */
                 case TCPS_TIME_WAIT:
-                    tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+                    TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
                     LogFlowFunc(("%d -> dropafterack\n", __LINE__));
                     goto dropafterack;
             }
@@ -1661,7 +1665,7 @@ dodata:
             case TCPS_FIN_WAIT_2:
                 TCP_STATE_SWITCH_TO(tp, TCPS_TIME_WAIT);
                 tcp_canceltimers(tp);
-                tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+                TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
                 soisfdisconnected(so);
                 break;
 
@@ -1669,7 +1673,7 @@ dodata:
              * In TIME_WAIT state restart the 2 MSL time_wait timer.
              */
             case TCPS_TIME_WAIT:
-                tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+                TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
                 break;
         }
     }
@@ -84,6 +84,9 @@ static const u_char  tcp_outflags[TCP_NSTATES] =
 
 
 #define MAX_TCPOPTLEN   32      /* max # bytes that go in options */
+/* largest frame (link + IP + TCP headers and data) we send as one segment when
+ * the device above does the segmentation, see slirp_set_gso_output() */
+#define TCP_GSO_MAXFRAME (MJUM16BYTES - 1)
 
 /*
  * Tcp output routine: figure out what should be sent and send it.
@@ -100,8 +103,10 @@ tcp_output(PNATState pData, register struct tcpcb *tp)
     unsigned optlen, hdrlen;
     int idle, sendalot;
     int size = 0;
+    long maxseg;
 
     LogFlowFunc(("ENTER: tcp_output: tp = %R[tcpcb793]\n", tp));
+    SOCKET_EPOLL_DIRTY(pData, so);
 
     /*
      * Determine length of data that should be transmitted,
@@ -110,7 +115,7 @@ tcp_output(PNATState pData, register struct tcpcb *tp)
      * to send, then transmit; otherwise, investigate further.
      */
     idle = (tp->snd_max == tp->snd_una);
-    if (idle && tp->t_idle >= tp->t_rxtcur)
+    if (idle && TCP_IDLE(tp) >= tp->t_rxtcur)
         /*
          * We have been idle for "a while" and no acks are
          * expected to clock out any data we send --
@@ -125,6 +130,19 @@ again:
 
     flags = tcp_outflags[tp->t_state];
 
+    /*
+     * If the device above can segment, send up to as many whole
+     * segments as fit into the largest cluster in one go.  Probes
+     * and urgent data go out the old way.
+     */
+    maxseg = tp->t_maxseg;
+    if (   pData->fGsoOutput
+        && TCPS_HAVEESTABLISHED(tp->t_state)
+        && !tp->t_force
+        && !SEQ_GT(tp->snd_up, tp->snd_una))
+        maxseg = RT_MAX(maxseg, (long)(TCP_GSO_MAXFRAME - ETH_HLEN - sizeof(struct tcpiphdr) - MAX_TCPOPTLEN)
+                                / tp->t_maxseg * tp->t_maxseg);
+
     Log2((" --- tcp_output flags = 0x%x\n", flags));
 
     /*
@@ -159,7 +177,7 @@ again:
         }
         else
         {
-            tp->t_timer[TCPT_PERSIST] = 0;
+            TCP_TIMER_DISARM(tp, TCPT_PERSIST);
             tp->t_rxtshift = 0;
         }
     }
@@ -180,13 +198,13 @@ again:
         len = 0;
         if (win == 0)
         {
-            tp->t_timer[TCPT_REXMT] = 0;
+            TCP_TIMER_DISARM(tp, TCPT_REXMT);
             tp->snd_nxt = tp->snd_una;
         }
     }
-    if (len > tp->t_maxseg)
+    if (len > maxseg)
     {
-        len = tp->t_maxseg;
+        len = maxseg;
         sendalot = 1;
     }
     if (SEQ_LT(tp->snd_nxt + len, tp->snd_una + SBUF_LEN(&so->so_snd)))
@@ -206,7 +224,7 @@ again:
      */
     if (len)
     {
-        if (len == tp->t_maxseg)
+        if (len >= tp->t_maxseg)
             goto send;
         if ((1 || idle || tp->t_flags & TF_NODELAY) &&
                 len + off >= SBUF_LEN(&so->so_snd))
@@ -284,11 +302,11 @@ again:
      * otherwise force out a byte.
      */
     if (   SBUF_LEN(&so->so_snd)
-        && tp->t_timer[TCPT_REXMT] == 0
-        && tp->t_timer[TCPT_PERSIST] == 0)
+        && !TCP_TIMER_ISARMED(tp, TCPT_REXMT)
+        && !TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
     {
         tp->t_rxtshift = 0;
-        tcp_setpersist(tp);
+        tcp_setpersist(pData, tp);
     }
 
     /*
@@ -364,10 +382,13 @@ send:
     /*
      * Adjust data length if insertion of options will
      * bump the packet length beyond the t_maxseg length.
+     * Segments carrying options are never sent large.
      */
-    if (len > tp->t_maxseg - optlen)
+    if (optlen)
+        maxseg = tp->t_maxseg;
+    if (len > maxseg - optlen)
     {
-        len = tp->t_maxseg - optlen;
+        len = maxseg - optlen;
         sendalot = 1;
     }
 
@@ -535,7 +556,7 @@ send:
      * case, since we know we aren't doing a retransmission.
      * (retransmit and persist are mutually exclusive...)
      */
-    if (len || (flags & (TH_SYN|TH_FIN)) || tp->t_timer[TCPT_PERSIST])
+    if (len || (flags & (TH_SYN|TH_FIN)) || TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
         ti->ti_seq = RT_H2N_U32(tp->snd_nxt);
     else
         ti->ti_seq = RT_H2N_U32(tp->snd_max);
@@ -585,13 +606,24 @@ send:
     if (len + optlen)
         ti->ti_len = RT_H2N_U16((u_int16_t)(sizeof (struct tcphdr)
                                             + optlen + len));
-    ti->ti_sum = cksum(m, (int)(hdrlen + len));
+    if (len > tp->t_maxseg)
+    {
+        /*
+         * Large segment: the device above fills in the checksum(s) when
+         * it segments, so don't bother summing the data here.
+         */
+        m->m_pkthdr.csum_flags |= CSUM_TSO;
+        m->m_pkthdr.tso_segsz = tp->t_maxseg;
+        ti->ti_sum = 0;
+    }
+    else
+        ti->ti_sum = cksum(m, (int)(hdrlen + len));
 
     /*
      * In transmit state, time the transmission and arrange for
      * the retransmit.  In persist state, just set snd_max.
      */
-    if (tp->t_force == 0 || tp->t_timer[TCPT_PERSIST] == 0)
+    if (tp->t_force == 0 || !TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
     {
         tcp_seq startseq = tp->snd_nxt;
 
@@ -618,7 +650,7 @@ send:
              */
             if (tp->t_rtt == 0)
             {
-                tp->t_rtt = 1;
+                TCP_RTT_START(tp);
                 tp->t_rtseq = startseq;
                 tcpstat.tcps_segstimed++;
             }
@@ -632,13 +664,13 @@ send:
          * Initialize shift counter which is used for backoff
          * of retransmit time.
          */
-        if (   tp->t_timer[TCPT_REXMT] == 0
+        if (   !TCP_TIMER_ISARMED(tp, TCPT_REXMT)
             && tp->snd_nxt != tp->snd_una)
         {
-            tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
-            if (tp->t_timer[TCPT_PERSIST])
+            TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
+            if (TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
             {
-                tp->t_timer[TCPT_PERSIST] = 0;
+                TCP_TIMER_DISARM(tp, TCPT_PERSIST);
                 tp->t_rxtshift = 0;
             }
         }
@@ -710,7 +742,8 @@ out:
     if (win > 0 && SEQ_GT(tp->rcv_nxt+win, tp->rcv_adv))
         tp->rcv_adv = tp->rcv_nxt + win;
     tp->last_ack_sent = tp->rcv_nxt;
-    tp->t_flags &= ~(TF_ACKNOW|TF_DELACK);
+    tp->t_flags &= ~TF_ACKNOW;
+    TCP_DELACK_CLEAR(tp);
     if (sendalot)
         goto again;
 
@@ -718,20 +751,22 @@ out:
 }
 
 void
-tcp_setpersist(struct tcpcb *tp)
+tcp_setpersist(PNATState pData, struct tcpcb *tp)
 {
     int t = ((tp->t_srtt >> 2) + tp->t_rttvar) >> 1;
+    int persist;
 
 #if 0
-    if (tp->t_timer[TCPT_REXMT])
+    if (TCP_TIMER_ISARMED(tp, TCPT_REXMT))
         panic("tcp_output REXMT");
 #endif
     /*
      * Start/restart persistence timer.
      */
-    TCPT_RANGESET(tp->t_timer[TCPT_PERSIST],
+    TCPT_RANGESET(persist,
                   t * tcp_backoff[tp->t_rxtshift],
                   TCPTV_PERSMIN, TCPTV_PERSMAX);
+    TCP_TIMER_ARM(tp, TCPT_PERSIST, persist);
     if (tp->t_rxtshift < TCP_MAXRXTSHIFT)
         tp->t_rxtshift++;
 }
@@ -70,9 +70,14 @@
 void
 tcp_init(PNATState pData)
 {
+    int i;
+
     tcp_iss = 1;            /* wrong */
     tcb.so_next = tcb.so_prev = &tcb;
     tcp_last_so = &tcb;
+    for (i = 0; i < TCP_TIMER_WHEEL_SIZE; i++)
+        LIST_INIT(&pData->tcp_timer_wheel[i]);
+    LIST_INIT(&pData->tcp_delack_list);
     tcp_reass_maxqlen = 48;
     tcp_reass_maxseg  = 256;
 }
@@ -292,6 +297,8 @@ tcp_close(PNATState pData, register struct tcpcb *tp)
         RTMemFree(te);
         tcp_reass_qsize--;
     }
+    tcp_timer_unlink(tp);
+    TCP_DELACK_CLEAR(tp);
     RTMemFree(tp);
     so->so_tcpcb = 0;
     soisfdisconnected(so);
@@ -450,6 +457,7 @@ int tcp_fconnect(PNATState pData, struct socket *so)
          * without clearing SS_NOFDREF
          */
         soisfconnecting(so);
+        SOCKET_EPOLL_DIRTY(pData, so);
     }
 
     return(ret);
@@ -577,6 +585,7 @@ tcp_connect(PNATState pData, struct socket *inso)
                                    /* if it's not FACCEPTONCE, it's already NOFDREF */
     }
     so->s = s;
+    SOCKET_EPOLL_DIRTY(pData, so);
 
     tp = sototcpcb(so);
 
@@ -592,7 +601,7 @@ tcp_connect(PNATState pData, struct socket *inso)
     tcpstat.tcps_connattempt++;
 
     TCP_STATE_SWITCH_TO(tp, TCPS_SYN_SENT);
-    tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
+    TCP_TIMER_ARM(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
     tp->iss = tcp_iss;
     tcp_iss += TCP_ISSINCR/2;
     tcp_sendseqinit(tp);
@@ -63,75 +63,141 @@ static struct tcpcb *tcp_timers(PNATState pData, register struct tcpcb *tp, int
 void
 tcp_fasttimo(PNATState pData)
 {
-    register struct socket *so, *so_next;
     register struct tcpcb *tp;
 
     LogFlowFuncEnter();
 
-    so = tcb.so_next;
-    if (so)
-        QSOCKET_FOREACH (so, so_next, tcp)
-        /* { */
-            if (   (tp = (struct tcpcb *)so->so_tcpcb)
-                && (tp->t_flags & TF_DELACK))
-            {
-                tp->t_flags &= ~TF_DELACK;
-                tp->t_flags |= TF_ACKNOW;
-                tcpstat.tcps_delack++;
-                TCP_OUTPUT(pData, tp);
-            }
-        LOOP_LABEL(tcp, so, so_next);
-        }
+    /*
+     * Only the connections owing a delayed ACK are on the list, and
+     * tcp_output takes them off as soon as the ACK went out.
+     */
+    while ((tp = LIST_FIRST(&pData->tcp_delack_list)) != NULL)
+    {
+        TCP_DELACK_CLEAR(tp);
+        tp->t_flags |= TF_ACKNOW;
+        tcpstat.tcps_delack++;
+        TCP_OUTPUT(pData, tp);
+    }
+}
+
+/*
+ * Put tp onto the wheel slot of its earliest running timer, or take it
+ * off the wheel if there is none.
+ */
+static void
+tcp_timer_reschedule(PNATState pData, struct tcpcb *tp)
+{
+    uint32_t deadline = 0;
+    int i;
+
+    tcp_timer_unlink(tp);
+    for (i = 0; i < TCPT_NTIMERS; i++)
+        if (   TCP_TIMER_ISARMED(tp, i)
+            && (   deadline == 0
+                || TCP_TICK_LEQ(tp->t_timer[i], deadline)))
+            deadline = tp->t_timer[i];
+    if (deadline == 0)
+        return;
+    tp->t_wheeldeadline = deadline;
+    LIST_INSERT_HEAD(&pData->tcp_timer_wheel[deadline & TCP_TIMER_WHEEL_MASK], tp, t_wheel);
 }
 
 /*
  * Tcp protocol timeout routine called every 500 ms.
- * Updates the timers in all active tcb's and
- * causes finite state machine actions if timers expire.
+ * Advances the clock and causes finite state machine actions for the
+ * timers which expire on this tick.  Only the connections hashed onto
+ * the current wheel slot are looked at.
  */
 void
 tcp_slowtimo(PNATState pData)
 {
-    register struct socket *ip, *ipnxt;
+    struct tcpcbhead *slot;
+    struct tcpcbhead later;
     register struct tcpcb *tp;
     register int i;
 
     LogFlowFuncEnter();
 
+    tcp_iss += TCP_ISSINCR / PR_SLOWHZ;         /* increment iss */
+#ifdef TCP_COMPAT_42
+    if ((int)tcp_iss < 0)
+        tcp_iss = 0;                            /* XXX */
+#endif
+    tcp_now++;                                  /* for timestamps */
+
     /*
-     * Search through tcb's and update active timers.
+     * Connections whose earliest deadline is a wheel revolution or more
+     * away are parked on a local list, everything armed while we're at
+     * it (including for this very tick) ends up on the slot itself.
      */
-    ip = tcb.so_next;
-    if (ip == 0)
-        return;
-    QSOCKET_FOREACH(ip, ipnxt, tcp)
-    /* { */
-        ipnxt = ip->so_next;
-        tp = sototcpcb(ip);
-        if (tp == 0)
-            CONTINUE(tcp);
+    LIST_INIT(&later);
+    slot = &pData->tcp_timer_wheel[tcp_now & TCP_TIMER_WHEEL_MASK];
+    while ((tp = LIST_FIRST(slot)) != NULL)
+    {
+        tcp_timer_unlink(tp);
+        if (!TCP_TICK_LEQ(tp->t_wheeldeadline, tcp_now))
+        {
+            LIST_INSERT_HEAD(&later, tp, t_wheel);
+            continue;
+        }
         for (i = 0; i < TCPT_NTIMERS; i++)
         {
-            if (tp->t_timer[i] && --tp->t_timer[i] == 0)
+            if (   TCP_TIMER_ISARMED(tp, i)
+                && TCP_TICK_LEQ(tp->t_timer[i], tcp_now))
             {
-                tcp_timers(pData, tp, i);
-                if (ipnxt->so_prev != ip)
-                    goto tpgone;
+                TCP_TIMER_DISARM(tp, i);
+                if (tcp_timers(pData, tp, i) == NULL)
+                    break;
             }
         }
-        tp->t_idle++;
-        if (tp->t_rtt)
-            tp->t_rtt++;
-tpgone:
-        ;
-    LOOP_LABEL(tcp, ip, ipnxt);
+        if (i == TCPT_NTIMERS)
+            tcp_timer_reschedule(pData, tp);
+    }
+    while ((tp = LIST_FIRST(&later)) != NULL)
+    {
+        LIST_REMOVE(tp, t_wheel);
+        LIST_INSERT_HEAD(slot, tp, t_wheel);
+    }
+}
+
+/*
+ * Start (or restart) timer of tp to go off in nticks.
+ */
+void
+tcp_timer_arm(PNATState pData, struct tcpcb *tp, int timer, int nticks)
+{
+    uint32_t deadline;
+
+    if (nticks <= 0)
+    {
+        TCP_TIMER_DISARM(tp, timer);
+        return;
+    }
+    deadline = tcp_now + nticks;
+    if (deadline == 0)
+        deadline = 1;
+    tp->t_timer[timer] = deadline;
+
+    /* the wheel only has to see tp no later than its earliest deadline */
+    if (   tp->t_wheel.le_prev != NULL
+        && TCP_TICK_LEQ(tp->t_wheeldeadline, deadline))
+        return;
+    tcp_timer_unlink(tp);
+    tp->t_wheeldeadline = deadline;
+    LIST_INSERT_HEAD(&pData->tcp_timer_wheel[deadline & TCP_TIMER_WHEEL_MASK], tp, t_wheel);
+}
+
+/*
+ * Take tp off the timer wheel.
+ */
+void
+tcp_timer_unlink(struct tcpcb *tp)
+{
+    if (tp->t_wheel.le_prev != NULL)
+    {
+        LIST_REMOVE(tp, t_wheel);
+        tp->t_wheel.le_prev = NULL;
     }
-    tcp_iss += TCP_ISSINCR / PR_SLOWHZ;         /* increment iss */
-#ifdef TCP_COMPAT_42
-    if ((int)tcp_iss < 0)
-        tcp_iss = 0;                            /* XXX */
-#endif
-    tcp_now++;                                  /* for timestamps */
 }
 
 /*
@@ -143,7 +209,7 @@ tcp_canceltimers(struct tcpcb *tp)
     register int i;
 
     for (i = 0; i < TCPT_NTIMERS; i++)
-        tp->t_timer[i] = 0;
+        TCP_TIMER_DISARM(tp, i);
 }
 
 const int  tcp_backoff[TCP_MAXRXTSHIFT + 1] =
@@ -179,8 +245,8 @@ tcp_timers(PNATState pData, register struct tcpcb *tp, int timer)
          */
         case TCPT_2MSL:
             if (tp->t_state != TCPS_TIME_WAIT &&
-                    tp->t_idle <= tcp_maxidle)
-                tp->t_timer[TCPT_2MSL] = tcp_keepintvl;
+                    TCP_IDLE(tp) <= tcp_maxidle)
+                TCP_TIMER_ARM(tp, TCPT_2MSL, tcp_keepintvl);
             else
                 tp = tcp_close(pData, tp);
             break;
@@ -235,7 +301,7 @@ tcp_timers(PNATState pData, register struct tcpcb *tp, int timer)
             rexmt = TCP_REXMTVAL(tp) * tcp_backoff[tp->t_rxtshift];
             TCPT_RANGESET(tp->t_rxtcur, rexmt,
                     (short)tp->t_rttmin, TCPTV_REXMTMAX); /* XXX */
-            tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+            TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
             /*
              * If losing, let the lower level know and try for
              * a better route.  Also, if we backed off this far,
@@ -296,7 +362,7 @@ tcp_timers(PNATState pData, register struct tcpcb *tp, int timer)
          */
         case TCPT_PERSIST:
             tcpstat.tcps_persisttimeo++;
-            tcp_setpersist(tp);
+            tcp_setpersist(pData, tp);
             tp->t_force = 1;
             (void) tcp_output(pData, tp);
             tp->t_force = 0;
@@ -313,7 +379,7 @@ tcp_timers(PNATState pData, register struct tcpcb *tp, int timer)
 /*          if (tp->t_socket->so_options & SO_KEEPALIVE && */
             if ((so_options) && tp->t_state <= TCPS_CLOSE_WAIT)
             {
-                if (tp->t_idle >= tcp_keepidle + tcp_maxidle)
+                if (TCP_IDLE(tp) >= tcp_keepidle + tcp_maxidle)
                     goto dropit;
                 /*
                  * Send a packet designed to force a response
@@ -339,10 +405,10 @@ tcp_timers(PNATState pData, register struct tcpcb *tp, int timer)
                 tcp_respond(pData, tp, &tp->t_template, (struct mbuf *)NULL,
                         tp->rcv_nxt, tp->snd_una - 1, 0);
 #endif
-                tp->t_timer[TCPT_KEEP] = tcp_keepintvl;
+                TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepintvl);
             }
             else
-                tp->t_timer[TCPT_KEEP] = tcp_keepidle;
+                TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepidle);
             break;
 
         dropit:
@@ -57,8 +57,8 @@
 #define _TCP_TIMER_H_
 
 /*
- * Definitions of the TCP timers.  These timers are counted
- * down PR_SLOWHZ times a second.
+ * Definitions of the TCP timers.  These timers expire after the
+ * given number of ticks, PR_SLOWHZ ticks a second.
  */
 #define TCPT_NTIMERS    4
 
@@ -144,6 +144,45 @@ char *tcptimers[] =
                 (tv) = (tvmax); \
 }
 
+/*
+ * Timers are kept as absolute deadlines in tcp_now ticks, 0 meaning the
+ * timer is off.  A connection with a running timer is hashed onto the timer
+ * wheel slot of its earliest deadline, so tcp_slowtimo only looks at the
+ * connections of the slot for the current tick.  Stopping a timer doesn't
+ * touch the wheel, the stale entry is dropped when its slot comes around.
+ */
+#define TCP_TIMER_WHEEL_SIZE    512     /* must be a power of two */
+#define TCP_TIMER_WHEEL_MASK    (TCP_TIMER_WHEEL_SIZE - 1)
+
+/* wrap safe tcp_now tick comparison */
+#define TCP_TICK_LEQ(a, b)      ((int32_t)((a) - (b)) <= 0)
+
+#define TCP_TIMER_ISARMED(tp, timer)    ((tp)->t_timer[(timer)] != 0)
+#define TCP_TIMER_DISARM(tp, timer)     ((tp)->t_timer[(timer)] = 0)
+#define TCP_TIMER_ARM(tp, timer, nticks) tcp_timer_arm(pData, (tp), (timer), (nticks))
+
+/*
+ * Delayed ACKs.  Connections owing an ACK are kept on a list so
+ * tcp_fasttimo doesn't have to scan all of them.
+ */
+#define TCP_DELACK_SET(tp)                                              \
+    do {                                                                \
+        if (!((tp)->t_flags & TF_DELACK))                               \
+        {                                                               \
+            (tp)->t_flags |= TF_DELACK;                                 \
+            LIST_INSERT_HEAD(&pData->tcp_delack_list, (tp), t_delack);  \
+        }                                                               \
+    } while (0)
+
+#define TCP_DELACK_CLEAR(tp)                                            \
+    do {                                                                \
+        if ((tp)->t_flags & TF_DELACK)                                  \
+        {                                                               \
+            (tp)->t_flags &= ~TF_DELACK;                                \
+            LIST_REMOVE((tp), t_delack);                                \
+        }                                                               \
+    } while (0)
+
 extern const int tcp_backoff[];
 
 struct tcpcb;
@@ -151,4 +190,6 @@ struct tcpcb;
 void tcp_fasttimo (PNATState);
 void tcp_slowtimo (PNATState);
 void tcp_canceltimers (struct tcpcb *);
+void tcp_timer_arm (PNATState, struct tcpcb *, int, int);
+void tcp_timer_unlink (struct tcpcb *);
 #endif
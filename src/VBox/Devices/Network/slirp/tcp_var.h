@@ -76,10 +76,13 @@ LIST_HEAD(tsegqe_head, tseg_qent);
 struct tcpcb
 {
     LIST_ENTRY(tcpcb) t_list;
+    LIST_ENTRY(tcpcb) t_wheel;       /* timer wheel slot linkage */
+    LIST_ENTRY(tcpcb) t_delack;      /* pending delayed ACK linkage */
     struct tsegqe_head t_segq;       /* segment reassembly queue */
     int       t_segqlen;             /* segment reassembly queue length */
     int16_t   t_state;               /* state of this connection */
-    int16_t   t_timer[TCPT_NTIMERS]; /* tcp timers */
+    uint32_t  t_timer[TCPT_NTIMERS]; /* tcp timer deadlines (tcp_now ticks, 0 = off) */
+    uint32_t  t_wheeldeadline;       /* deadline the wheel slot was picked for */
     int16_t   t_rxtshift;            /* log(2) of rexmt exp. backoff */
     int16_t   t_rxtcur;              /* current retransmit value */
     int16_t   t_dupacks;             /* consecutive dup acks recd */
@@ -138,8 +141,9 @@ struct tcpcb
  * transmit timing stuff.  See below for scale of srtt and rttvar.
  * "Variance" is actually smoothed difference.
  */
-    int16_t   t_idle;                /* inactivity time */
-    int16_t   t_rtt;                 /* round trip time */
+    uint32_t  t_idlestart;           /* tcp_now when last active, see TCP_IDLE */
+    int16_t   t_rtt;                 /* round trip time being measured, see TCP_RTT */
+    uint32_t  t_rttstart;            /* tcp_now when the measurement started */
     tcp_seq   t_rtseq;               /* sequence number being timed */
     int16_t   t_srtt;                /* smoothed round-trip time */
     int16_t   t_rttvar;              /* variance in round-trip time */
@@ -167,6 +171,16 @@ LIST_HEAD(tcpcbhead, tcpcb);
 
 #define sototcpcb(so)   ((so)->so_tcpcb)
 
+/*
+ * Idle and round trip times are not counted up by tcp_slowtimo any more,
+ * they're derived from tcp_now so that the slow timeout doesn't have to
+ * visit every connection.  Both require pData in scope.
+ */
+#define TCP_IDLE(tp)        ((int)(tcp_now - (tp)->t_idlestart))
+#define TCP_IDLE_RESET(tp)  ((tp)->t_idlestart = tcp_now)
+#define TCP_RTT(tp)         ((tp)->t_rtt ? 1 + (int)(tcp_now - (tp)->t_rttstart) : 0)
+#define TCP_RTT_START(tp)   do { (tp)->t_rtt = 1; (tp)->t_rttstart = tcp_now; } while (0)
+
 /*
  * The smoothed round-trip time and estimated variance
  * are stored as fixed point numbers scaled by the values below.
@@ -563,6 +563,7 @@ udp_attach(PNATState pData, struct socket *so)
     NSOCK_INC();
     QSOCKET_UNLOCK(udb);
     so->so_type = IPPROTO_UDP;
+    SOCKET_EPOLL_DIRTY(pData, so);
     return so->s;
 error:
     Log2(("NAT: can't create datagramm socket\n"));
@@ -667,6 +668,7 @@ udp_listen(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_
         so->so_expire = 0;
 
     so->so_state = SS_ISFCONNECTED;
+    SOCKET_EPOLL_DIRTY(pData, so);
 
     LogFlowFunc(("LEAVE: %R[natsock]\n", so));
     return so;
@@ -0,0 +1,230 @@
+/* $Id: tstDevE1000Itr.cpp $ */
+/** @file
+ * E1000 interrupt throttling tests.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+#include "../DevE1000Itr.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** Transmit descriptor written back, see DevE1000.cpp. */
+#define TST_ICR_TXDW        UINT32_C(0x00000001)
+/** Receive timer interrupt, see DevE1000.cpp. */
+#define TST_ICR_RXT0        UINT32_C(0x00000080)
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * The interrupt state of the device as far as throttling is concerned.
+ */
+typedef struct TSTE1K
+{
+    uint32_t    uItr;
+    bool        fItrEnabled;
+    bool        fItrRxEnabled;
+    bool        fIntRaised;
+    uint32_t    uIcr;
+    uint64_t    u64AckedAt;
+    /** When the late interrupt timer fires, 0 if not active. */
+    uint64_t    u64TimerDue;
+    /** When the oldest cause not yet seen by the guest came in, 0 if none. */
+    uint64_t    u64PendingSince;
+    uint32_t    cInts;
+    uint64_t    cNsMaxLatency;
+} TSTE1K;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+
+
+static void tstCalcDue(void)
+{
+    RTTestSub(g_hTest, "Due time");
+    uint64_t const u64Acked = UINT64_C(123456789);
+
+    /* no limit programmed */
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(0, u64Acked, u64Acked) == 0);
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(0, u64Acked, u64Acked + 1) == 0);
+
+    /* 488 * 256 ns is about 8000 interrupts per second */
+    uint64_t const cNs = 488 * 256;
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(488, u64Acked, u64Acked) == u64Acked + cNs);
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(488, u64Acked, u64Acked + cNs - 1) == u64Acked + cNs);
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(488, u64Acked, u64Acked + cNs) == 0);
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(488, u64Acked, u64Acked + 10 * cNs) == 0);
+
+    /* the whole register, no 32-bit overflow */
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(UINT32_MAX, u64Acked, u64Acked) == u64Acked + (uint64_t)UINT32_MAX * 256);
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(UINT32_MAX, 0, _4G) == (uint64_t)UINT32_MAX * 256);
+
+    /* nothing acknowledged since reset */
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(488, 0, 1000) == cNs);
+    RTTEST_CHECK(g_hTest, e1kItrCalcDue(488, 0, cNs) == 0);
+}
+
+
+static void tstApplies(void)
+{
+    RTTestSub(g_hTest, "Causes subject to throttling");
+    RTTEST_CHECK(g_hTest,  e1kItrApplies(true,  true,  false));
+    RTTEST_CHECK(g_hTest,  e1kItrApplies(true,  true,  true));
+    RTTEST_CHECK(g_hTest,  e1kItrApplies(true,  false, false));
+    RTTEST_CHECK(g_hTest, !e1kItrApplies(true,  false, true));
+    RTTEST_CHECK(g_hTest, !e1kItrApplies(false, true,  false));
+    RTTEST_CHECK(g_hTest, !e1kItrApplies(false, true,  true));
+    RTTEST_CHECK(g_hTest, !e1kItrApplies(false, false, false));
+    RTTEST_CHECK(g_hTest, !e1kItrApplies(false, false, true));
+}
+
+
+/**
+ * Mirrors the raise path of e1kRaiseInterrupt.
+ */
+static void tstRaise(TSTE1K *pThis, uint64_t u64Now, uint32_t fCause)
+{
+    if (fCause && !pThis->u64PendingSince)
+        pThis->u64PendingSince = u64Now;
+    pThis->uIcr |= fCause;
+    if (!pThis->uIcr || pThis->fIntRaised)
+        return;
+
+    uint64_t u64Due = 0;
+    if (e1kItrApplies(pThis->fItrEnabled, pThis->fItrRxEnabled, !!(pThis->uIcr & TST_ICR_RXT0)))
+        u64Due = e1kItrCalcDue(pThis->uItr, pThis->u64AckedAt, u64Now);
+    if (u64Due)
+    {
+        if (!pThis->u64TimerDue)
+            pThis->u64TimerDue = u64Due;
+    }
+    else
+    {
+        pThis->u64TimerDue = 0;
+        pThis->fIntRaised  = true;
+        pThis->cInts++;
+    }
+}
+
+
+/**
+ * Runs a steady stream of interrupt causes against a guest that reads ICR a
+ * little while after each interrupt.
+ *
+ * @param   pThis               The device state, ITR settings filled in.
+ * @param   fCause              The interrupt cause the stream raises.
+ * @param   cNsGap              The time between two causes.
+ * @param   cNsHandler          The time the guest takes to read ICR.
+ * @param   cNsRun              How long to run.
+ */
+static void tstRun(TSTE1K *pThis, uint32_t fCause, uint32_t cNsGap, uint32_t cNsHandler, uint64_t cNsRun)
+{
+    uint64_t u64RaisedAt = 0;
+    for (uint64_t u64Now = 1; u64Now <= cNsRun; u64Now++)
+    {
+        bool const fWasRaised = pThis->fIntRaised;
+        /* e1kLateIntTimer */
+        if (pThis->u64TimerDue && u64Now >= pThis->u64TimerDue)
+        {
+            pThis->u64TimerDue = 0;
+            tstRaise(pThis, u64Now, 0);
+        }
+        if (u64Now % cNsGap == 0)
+            tstRaise(pThis, u64Now, fCause);
+        if (!fWasRaised && pThis->fIntRaised)
+            u64RaisedAt = u64Now;
+
+        if (pThis->fIntRaised && u64Now - u64RaisedAt >= cNsHandler)
+        {
+            /* e1kRegReadICR */
+            pThis->cNsMaxLatency   = RT_MAX(pThis->cNsMaxLatency, u64Now - pThis->u64PendingSince);
+            pThis->u64PendingSince = 0;
+            pThis->uIcr            = 0;
+            pThis->fIntRaised      = false;
+            pThis->u64AckedAt      = u64Now;
+        }
+    }
+}
+
+
+static void tstStream(uint32_t uItr, bool fItrEnabled, bool fItrRxEnabled, uint32_t fCause)
+{
+    RTTestSubF(g_hTest, "Stream: ITR=%u%s%s, %s", uItr, fItrEnabled ? "" : " off", fItrRxEnabled ? "" : " RX off",
+               fCause == TST_ICR_RXT0 ? "RX" : "TX");
+    uint32_t const cNsGap     = 10000;
+    uint32_t const cNsHandler = 5000;
+    uint64_t const cNsRun     = 10000000;
+    uint64_t const cNsItr     = (uint64_t)uItr * 256;
+
+    TSTE1K This;
+    RT_ZERO(This);
+    This.uItr          = uItr;
+    This.fItrEnabled   = fItrEnabled;
+    This.fItrRxEnabled = fItrRxEnabled;
+    tstRun(&This, fCause, cNsGap, cNsHandler, cNsRun);
+
+    bool const fThrottled = cNsItr > cNsGap + cNsHandler && fItrEnabled && (fItrRxEnabled || fCause != TST_ICR_RXT0);
+    if (fThrottled)
+    {
+        /* no more interrupts than ITR allows, but no fewer either */
+        RTTEST_CHECK_MSG(g_hTest, This.cInts <= cNsRun / cNsItr + 1, (g_hTest, "cInts=%u\n", This.cInts));
+        RTTEST_CHECK_MSG(g_hTest, This.cInts >= cNsRun / (cNsItr + cNsHandler) - 1, (g_hTest, "cInts=%u\n", This.cInts));
+        /* causes wait for the interval to end, not for the next one */
+        RTTEST_CHECK_MSG(g_hTest, This.cNsMaxLatency <= cNsItr + cNsHandler,
+                         (g_hTest, "cNsMaxLatency=%RU64\n", This.cNsMaxLatency));
+    }
+    else
+    {
+        /* an interrupt per cause */
+        RTTEST_CHECK_MSG(g_hTest, This.cInts == cNsRun / cNsGap, (g_hTest, "cInts=%u\n", This.cInts));
+        RTTEST_CHECK_MSG(g_hTest, This.cNsMaxLatency == cNsHandler,
+                         (g_hTest, "cNsMaxLatency=%RU64\n", This.cNsMaxLatency));
+    }
+    RTTEST_CHECK(g_hTest, !This.fIntRaised || This.uIcr);
+    RTTEST_CHECK(g_hTest, !This.uIcr || This.fIntRaised || This.u64TimerDue);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDevE1000Itr", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstCalcDue();
+    tstApplies();
+    tstStream(488,  true,  true,  TST_ICR_RXT0);
+    tstStream(488,  true,  true,  TST_ICR_TXDW);
+    tstStream(488,  true,  false, TST_ICR_RXT0);
+    tstStream(488,  true,  false, TST_ICR_TXDW);
+    tstStream(488,  false, true,  TST_ICR_TXDW);
+    tstStream(3906, true,  true,  TST_ICR_RXT0);
+    tstStream(0,    true,  true,  TST_ICR_RXT0);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
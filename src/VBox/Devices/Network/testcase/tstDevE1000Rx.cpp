@@ -0,0 +1,147 @@
+/* $Id: tstDevE1000Rx.cpp $ */
+/** @file
+ * E1000 receive buffer fill tests.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+#include "../DevE1000Rx.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The largest frame the device takes with long packets enabled. */
+#define TST_MAX_FRAME       16384
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+/** The frame as passed down by the driver. */
+static uint8_t  g_abFrame[TST_MAX_FRAME];
+/** What ends up in guest memory, all buffers back to back. */
+static uint8_t  g_abGuest[TST_MAX_FRAME + 4];
+
+
+/**
+ * Stores a frame and its FCS the way e1kHandleRxPacket does and checks the
+ * guest gets the frame followed by the FCS, in full buffers except the last.
+ *
+ * @returns false on the first failure, true otherwise.
+ * @param   cb                  The frame size.
+ * @param   cbTail              The FCS size, 0 or 4.
+ * @param   cbBuf               The receive buffer size.
+ */
+static bool tstStore(size_t cb, size_t cbTail, size_t cbBuf)
+{
+    static uint8_t const s_abFcs[4] = { 0xfc, 0x5c, 0xa1, 0x7e };
+    uint8_t const *pbFrame = g_abFrame;
+    uint8_t const *pbTail  = s_abFcs;
+    size_t const   cbTotal = cb + cbTail;
+    size_t         offGuest = 0;
+    size_t         cBufs    = 0;
+    bool           fEOP     = false;
+    while (cb + cbTail > 0)
+    {
+        size_t cbFrag     = ~(size_t)0;
+        size_t cbFragTail = ~(size_t)0;
+        fEOP = e1kRxCalcFragment(cb, cbTail, cbBuf, &cbFrag, &cbFragTail);
+        cBufs++;
+        RTTEST_CHECK_RET(g_hTest, cbFrag <= cb && cbFragTail <= cbTail, false);
+        RTTEST_CHECK_RET(g_hTest, cbFrag + cbFragTail > 0 && cbFrag + cbFragTail <= cbBuf, false);
+        /* buffers are filled up, only the last one may be partial */
+        RTTEST_CHECK_RET(g_hTest, fEOP || cbFrag + cbFragTail == cbBuf, false);
+        RTTEST_CHECK_RET(g_hTest, fEOP == (cbFrag == cb && cbFragTail == cbTail), false);
+        /* the FCS comes after all the frame data */
+        RTTEST_CHECK_RET(g_hTest, !cbFragTail || cbFrag == cb, false);
+
+        memcpy(&g_abGuest[offGuest], pbFrame, cbFrag);
+        memcpy(&g_abGuest[offGuest + cbFrag], pbTail, cbFragTail);
+        offGuest += cbFrag + cbFragTail;
+        pbFrame  += cbFrag;
+        cb       -= cbFrag;
+        pbTail   += cbFragTail;
+        cbTail   -= cbFragTail;
+        if (fEOP)
+            break;
+    }
+    RTTEST_CHECK_RET(g_hTest, fEOP && !cb && !cbTail, false);
+    RTTEST_CHECK_RET(g_hTest, cBufs == (cbTotal + cbBuf - 1) / cbBuf, false);
+    RTTEST_CHECK_RET(g_hTest, offGuest == cbTotal, false);
+    RTTEST_CHECK_RET(g_hTest, memcmp(g_abGuest, g_abFrame, pbFrame - g_abFrame) == 0, false);
+    RTTEST_CHECK_RET(g_hTest, memcmp(&g_abGuest[pbFrame - g_abFrame], s_abFcs, pbTail - s_abFcs) == 0, false);
+    return true;
+}
+
+
+static void tstBufferSizes(size_t cbTail)
+{
+    RTTestSubF(g_hTest, "All frame sizes, %s FCS", cbTail ? "with" : "without");
+    /* the BSIZE/BSEX sizes, and a few tiny ones to get the FCS split every which way */
+    static size_t const s_acbBufs[] = { 1, 2, 3, 5, 256, 512, 1024, 2048, 4096, 8192, 16384 };
+    for (size_t cb = 60; cb <= TST_MAX_FRAME - 4; cb++)
+        for (unsigned i = 0; i < RT_ELEMENTS(s_acbBufs); i++)
+            if (   (s_acbBufs[i] >= 256 || cb < 2048)
+                && !tstStore(cb, cbTail, s_acbBufs[i]))
+            {
+                RTTestFailureDetails(g_hTest, "cb=%zu cbTail=%zu cbBuf=%zu\n", cb, cbTail, s_acbBufs[i]);
+                return;
+            }
+}
+
+
+static void tstFcsSplit(void)
+{
+    RTTestSub(g_hTest, "FCS across buffers");
+    /* the frame fills the first buffer up to 0..3 bytes short of the end */
+    for (size_t cbGap = 0; cbGap <= 4; cbGap++)
+    {
+        size_t cbFrag;
+        size_t cbFragTail;
+        RTTEST_CHECK(g_hTest, !e1kRxCalcFragment(2048 - cbGap, 4, 2048, &cbFrag, &cbFragTail) || cbGap == 4);
+        RTTEST_CHECK(g_hTest, cbFrag == 2048 - cbGap);
+        RTTEST_CHECK(g_hTest, cbFragTail == RT_MIN(cbGap, 4));
+        if (cbGap < 4)
+        {
+            RTTEST_CHECK(g_hTest, e1kRxCalcFragment(0, 4 - cbGap, 2048, &cbFrag, &cbFragTail));
+            RTTEST_CHECK(g_hTest, cbFrag == 0 && cbFragTail == 4 - cbGap);
+        }
+    }
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDevE1000Rx", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    for (size_t off = 0; off < sizeof(g_abFrame); off++)
+        g_abFrame[off] = (uint8_t)(off * 11 + off / 255);
+
+    tstFcsSplit();
+    tstBufferSizes(4);
+    tstBufferSizes(0);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -0,0 +1,256 @@
+/* $Id: tstDevVirtioNetMQ.cpp $ */
+/** @file
+ * Virtio network device multi-queue unit tests.
+ */
+
+/*
+ * Copyright (C) 2009-2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/test.h>
+
+#include "../DevVirtioNetMQ.h"
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * IPv4 flow with its expected Toeplitz hashes, from the RSS hash verification
+ * table of the Microsoft RSS specification.
+ */
+typedef struct TSTRSSFLOW4
+{
+    uint8_t  abSrc[4];
+    uint8_t  abDst[4];
+    uint16_t uSrcPort;
+    uint16_t uDstPort;
+    /** Hash over the addresses only. */
+    uint32_t uHashIp;
+    /** Hash over the addresses and the ports. */
+    uint32_t uHashIpPorts;
+} TSTRSSFLOW4;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST g_hTest = NIL_RTTEST;
+
+static const TSTRSSFLOW4 g_aFlows4[] =
+{
+    { {  66,   9, 149, 187 }, { 161, 142, 100,  80 },  2794,  1766, 0x323e8fc2, 0x51ccc178 },
+    { { 199,  92, 111,   2 }, {  65,  69, 140,  83 }, 14230,  4739, 0xd718262a, 0xc626b0ea },
+    { {  24,  19, 198,  95 }, {  12,  22, 207, 184 }, 12898, 38024, 0xd2d0a5de, 0x5c2b394a },
+    { {  38,  27, 205,  30 }, { 209, 142, 163,   6 }, 48228,  2217, 0x82989176, 0xafc7327f },
+    { { 153,  39, 163, 191 }, { 202, 188, 127,   2 }, 44251,  1303, 0x5d1809c5, 0x10e828a2 },
+};
+
+
+/**
+ * Builds an ethernet frame carrying an IPv4 packet of the given flow.
+ *
+ * @returns Size of the frame.
+ * @param   pbFrame         Where to build the frame, at least 64 bytes.
+ * @param   pFlow           The flow.
+ * @param   uProto          The IP protocol.
+ * @param   fVlan           Whether to add a VLAN tag.
+ * @param   fFragment       Whether the packet is a (non first) fragment.
+ */
+static size_t tstBuildFrame4(uint8_t *pbFrame, TSTRSSFLOW4 const *pFlow, uint8_t uProto, bool fVlan, bool fFragment)
+{
+    size_t off = 12;
+
+    memset(pbFrame, 0, 64);
+    memset(pbFrame, 0xff, 6);
+    pbFrame[6] = 0x08; pbFrame[11] = 0x01;
+    if (fVlan)
+    {
+        pbFrame[off++] = 0x81; pbFrame[off++] = 0x00;
+        pbFrame[off++] = 0x00; pbFrame[off++] = 0x05;
+    }
+    pbFrame[off++] = 0x08; pbFrame[off++] = 0x00;
+
+    uint8_t *pbIp = &pbFrame[off];
+    pbIp[0] = 0x45;
+    pbIp[3] = 20 + 8;
+    if (fFragment)
+        pbIp[7] = 0x10;
+    pbIp[8] = 64;
+    pbIp[9] = uProto;
+    memcpy(&pbIp[12], pFlow->abSrc, 4);
+    memcpy(&pbIp[16], pFlow->abDst, 4);
+    off += 20;
+
+    pbFrame[off++] = (uint8_t)(pFlow->uSrcPort >> 8); pbFrame[off++] = (uint8_t)pFlow->uSrcPort;
+    pbFrame[off++] = (uint8_t)(pFlow->uDstPort >> 8); pbFrame[off++] = (uint8_t)pFlow->uDstPort;
+    off += 4;
+    return off;
+}
+
+static void tstRssHash(void)
+{
+    RTTestSub(g_hTest, "RSS hash");
+
+    uint8_t abFrame[64];
+    for (unsigned i = 0; i < RT_ELEMENTS(g_aFlows4); i++)
+    {
+        TSTRSSFLOW4 const *pFlow = &g_aFlows4[i];
+        size_t cb;
+        uint32_t uHash;
+
+        cb = tstBuildFrame4(abFrame, pFlow, RTNETIPV4_PROT_TCP, false /*fVlan*/, false /*fFragment*/);
+        if ((uHash = vnetRssHash(abFrame, cb)) != pFlow->uHashIpPorts)
+            RTTestFailed(g_hTest, "flow #%u TCP: %#x, expected %#x", i, uHash, pFlow->uHashIpPorts);
+
+        cb = tstBuildFrame4(abFrame, pFlow, RTNETIPV4_PROT_UDP, false /*fVlan*/, false /*fFragment*/);
+        if ((uHash = vnetRssHash(abFrame, cb)) != pFlow->uHashIpPorts)
+            RTTestFailed(g_hTest, "flow #%u UDP: %#x, expected %#x", i, uHash, pFlow->uHashIpPorts);
+
+        cb = tstBuildFrame4(abFrame, pFlow, RTNETIPV4_PROT_TCP, true /*fVlan*/, false /*fFragment*/);
+        if ((uHash = vnetRssHash(abFrame, cb)) != pFlow->uHashIpPorts)
+            RTTestFailed(g_hTest, "flow #%u TCP with VLAN tag: %#x, expected %#x", i, uHash, pFlow->uHashIpPorts);
+
+        /* Fragments and protocols without ports only hash the addresses. */
+        cb = tstBuildFrame4(abFrame, pFlow, RTNETIPV4_PROT_TCP, false /*fVlan*/, true /*fFragment*/);
+        if ((uHash = vnetRssHash(abFrame, cb)) != pFlow->uHashIp)
+            RTTestFailed(g_hTest, "flow #%u TCP fragment: %#x, expected %#x", i, uHash, pFlow->uHashIp);
+
+        cb = tstBuildFrame4(abFrame, pFlow, RTNETIPV4_PROT_ICMP, false /*fVlan*/, false /*fFragment*/);
+        if ((uHash = vnetRssHash(abFrame, cb)) != pFlow->uHashIp)
+            RTTestFailed(g_hTest, "flow #%u ICMP: %#x, expected %#x", i, uHash, pFlow->uHashIp);
+
+        /* Truncated before the ports. */
+        cb = tstBuildFrame4(abFrame, pFlow, RTNETIPV4_PROT_TCP, false /*fVlan*/, false /*fFragment*/);
+        if ((uHash = vnetRssHash(abFrame, cb - 8 + 2)) != pFlow->uHashIp)
+            RTTestFailed(g_hTest, "flow #%u truncated TCP: %#x, expected %#x", i, uHash, pFlow->uHashIp);
+    }
+
+    /* IPv6 with TCP, also from the specification. */
+    static const uint8_t s_abSrc6[16] = { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff, 0, 0, 0, 0, 0, 0, 0, 7 };
+    static const uint8_t s_abDst6[16] = { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03, 0, 0, 0, 0, 0, 0, 0, 1 };
+    uint8_t abFrame6[14 + 40 + 8];
+    RT_ZERO(abFrame6);
+    abFrame6[12] = 0x86; abFrame6[13] = 0xdd;
+    abFrame6[14] = 0x60;
+    abFrame6[14 + 5] = 8;
+    abFrame6[14 + 6] = RTNETIPV4_PROT_TCP;
+    memcpy(&abFrame6[14 + 8],  s_abSrc6, 16);
+    memcpy(&abFrame6[14 + 24], s_abDst6, 16);
+    abFrame6[54] = 2794 >> 8; abFrame6[55] = 2794 & 0xff;
+    abFrame6[56] = 1766 >> 8; abFrame6[57] = 1766 & 0xff;
+    uint32_t uHash6 = vnetRssHash(abFrame6, sizeof(abFrame6));
+    if (uHash6 != 0x40207d3d)
+        RTTestFailed(g_hTest, "IPv6 TCP: %#x, expected %#x", uHash6, 0x40207d3d);
+
+    /* Non IP frames and runts all go to the same queue. */
+    tstBuildFrame4(abFrame, &g_aFlows4[0], RTNETIPV4_PROT_TCP, false /*fVlan*/, false /*fFragment*/);
+    abFrame[12] = 0x08; abFrame[13] = 0x06; /* ARP */
+    RTTEST_CHECK(g_hTest, vnetRssHash(abFrame, sizeof(abFrame)) == 0);
+    RTTEST_CHECK(g_hTest, vnetRssHash(abFrame, 10) == 0);
+}
+
+static void tstRssSteering(void)
+{
+    RTTestSub(g_hTest, "RSS steering");
+
+    uint8_t  au8Table[VNET_RSS_TABLE_SIZE];
+    uint8_t  abFrame[64];
+
+    for (uint32_t cPairs = 1; cPairs <= VNET_MAX_QUEUE_PAIRS; cPairs++)
+    {
+        unsigned acHits[VNET_MAX_QUEUE_PAIRS];
+        RT_ZERO(acHits);
+
+        vnetRssFillTable(au8Table, cPairs);
+        for (unsigned i = 0; i < RT_ELEMENTS(au8Table); i++)
+        {
+            if (au8Table[i] >= cPairs)
+                RTTestFailed(g_hTest, "%u pairs: table entry %u is %u", cPairs, i, au8Table[i]);
+            else
+                acHits[au8Table[i]]++;
+        }
+        for (unsigned i = 0; i < cPairs; i++)
+            if (!acHits[i])
+                RTTestFailed(g_hTest, "%u pairs: pair %u is not in the table", cPairs, i);
+
+        /* Every flow sticks to the pair its hash selects. */
+        for (unsigned i = 0; i < RT_ELEMENTS(g_aFlows4); i++)
+        {
+            size_t cb = tstBuildFrame4(abFrame, &g_aFlows4[i], RTNETIPV4_PROT_TCP, false /*fVlan*/, false /*fFragment*/);
+            unsigned iPair = vnetRssSelectPair(au8Table, cPairs, abFrame, cb);
+            unsigned iPairExpected = (g_aFlows4[i].uHashIpPorts % VNET_RSS_TABLE_SIZE) % cPairs;
+            if (iPair != iPairExpected)
+                RTTestFailed(g_hTest, "%u pairs: flow #%u went to pair %u instead of %u", cPairs, i, iPair, iPairExpected);
+        }
+    }
+
+    /* With a single active pair everything goes to the first one, whatever the table says. */
+    vnetRssFillTable(au8Table, VNET_MAX_QUEUE_PAIRS);
+    for (unsigned i = 0; i < RT_ELEMENTS(g_aFlows4); i++)
+    {
+        size_t cb = tstBuildFrame4(abFrame, &g_aFlows4[i], RTNETIPV4_PROT_UDP, false /*fVlan*/, false /*fFragment*/);
+        RTTEST_CHECK(g_hTest, vnetRssSelectPair(au8Table, 1, abFrame, cb) == 0);
+    }
+
+    /* Many flows spread over all pairs. */
+    unsigned acHits[4];
+    RT_ZERO(acHits);
+    vnetRssFillTable(au8Table, RT_ELEMENTS(acHits));
+    for (unsigned i = 0; i < 256; i++)
+    {
+        TSTRSSFLOW4 Flow = g_aFlows4[0];
+        Flow.uSrcPort = (uint16_t)(1024 + i);
+        size_t cb = tstBuildFrame4(abFrame, &Flow, RTNETIPV4_PROT_TCP, false /*fVlan*/, false /*fFragment*/);
+        acHits[vnetRssSelectPair(au8Table, RT_ELEMENTS(acHits), abFrame, cb)]++;
+    }
+    for (unsigned i = 0; i < RT_ELEMENTS(acHits); i++)
+        if (acHits[i] < 256 / RT_ELEMENTS(acHits) / 4)
+            RTTestFailed(g_hTest, "Only %u of 256 flows went to pair %u", acHits[i], i);
+}
+
+static void tstNegotiation(void)
+{
+    RTTestSub(g_hTest, "VNET_F_MQ negotiation");
+
+    /* A single pair device and a guest not negotiating VNET_F_MQ keep the legacy layout. */
+    RTTEST_CHECK(g_hTest, vnetMqCtlQueueIndex(false, 1) == 2);
+    RTTEST_CHECK(g_hTest, vnetMqCtlQueueIndex(false, VNET_MAX_QUEUE_PAIRS) == 2);
+    /* The control queue follows the last pair once VNET_F_MQ is negotiated. */
+    RTTEST_CHECK(g_hTest, vnetMqCtlQueueIndex(true, 2) == 4);
+    RTTEST_CHECK(g_hTest, vnetMqCtlQueueIndex(true, VNET_MAX_QUEUE_PAIRS) == VNET_MAX_QUEUE_PAIRS * 2);
+
+    /* VQ_PAIRS_SET is refused without VNET_F_MQ and outside 1..max. */
+    RTTEST_CHECK(g_hTest, !vnetMqIsValidPairCount(false, 1, 4));
+    RTTEST_CHECK(g_hTest, !vnetMqIsValidPairCount(false, 4, 4));
+    RTTEST_CHECK(g_hTest, !vnetMqIsValidPairCount(true, 0, 4));
+    RTTEST_CHECK(g_hTest, !vnetMqIsValidPairCount(true, 5, 4));
+    RTTEST_CHECK(g_hTest, vnetMqIsValidPairCount(true, 1, 4));
+    RTTEST_CHECK(g_hTest, vnetMqIsValidPairCount(true, 4, 4));
+}
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDevVirtioNetMQ", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstRssHash();
+    tstRssSteering();
+    tstNegotiation();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -0,0 +1,285 @@
+/* $Id: tstDrvNATGso.cpp $ */
+/** @file
+ * NAT network transport driver, large TCP segment helper tests.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/pdmnetinline.h>
+#include <iprt/test.h>
+
+#include "../DrvNATGso.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The largest frame slirp takes, see DRVNAT_MAXFRAMESIZE. */
+#define TST_MAXFRAME        (16 * 1024 - 1)
+/** The TCP segment size used throughout. */
+#define TST_MSS             1460
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+/** The frame under test. */
+static uint8_t  g_abFrame[_64K + 128];
+/** Where chunks and segments are put together. */
+static uint8_t  g_abOut[_64K + 128];
+
+
+/**
+ * Builds a TCP/IPv4 frame with NOP IP options, a 12 byte TCP timestamp
+ * option and a payload
+ * pattern depending on the payload offset only.
+ *
+ * @returns The frame size.
+ * @param   cbPayload           The payload size.
+ * @param   uSeq                The TCP sequence number.
+ * @param   fFlags              The TCP flags.
+ * @param   cbIpOpts            The size of the IP options, a multiple of 4.
+ */
+static uint32_t tstBuildFrame(uint32_t cbPayload, uint32_t uSeq, uint8_t fFlags, uint32_t cbIpOpts)
+{
+    RT_ZERO(g_abFrame);
+    PRTNETETHERHDR pEthHdr = (PRTNETETHERHDR)&g_abFrame[0];
+    pEthHdr->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4);
+
+    PRTNETIPV4 pIpHdr = (PRTNETIPV4)(pEthHdr + 1);
+    pIpHdr->ip_v   = 4;
+    pIpHdr->ip_hl  = (RTNETIPV4_MIN_LEN + cbIpOpts) / 4;
+    pIpHdr->ip_len = RT_H2N_U16((uint16_t)(RTNETIPV4_MIN_LEN + cbIpOpts + RTNETTCP_MIN_LEN + 12 + cbPayload));
+    pIpHdr->ip_id  = RT_H2N_U16_C(0xfffe);
+    pIpHdr->ip_ttl = 64;
+    pIpHdr->ip_p   = RTNETIPV4_PROT_TCP;
+    pIpHdr->ip_src.u = RT_H2N_U32_C(0x0a00020f);
+    pIpHdr->ip_dst.u = RT_H2N_U32_C(0x5db8d822);
+    memset((uint8_t *)pIpHdr + RTNETIPV4_MIN_LEN, 1, cbIpOpts);
+    pIpHdr->ip_sum = RTNetIPv4HdrChecksum(pIpHdr);
+
+    PRTNETTCP pTcpHdr = (PRTNETTCP)((uint8_t *)pIpHdr + RTNETIPV4_MIN_LEN + cbIpOpts);
+    pTcpHdr->th_sport = RT_H2N_U16_C(49152);
+    pTcpHdr->th_dport = RT_H2N_U16_C(80);
+    pTcpHdr->th_seq   = RT_H2N_U32(uSeq);
+    pTcpHdr->th_ack   = RT_H2N_U32_C(0x12345678);
+    pTcpHdr->th_off   = (RTNETTCP_MIN_LEN + 12) / 4;
+    pTcpHdr->th_flags = fFlags;
+    pTcpHdr->th_win   = RT_H2N_U16_C(0xffff);
+    uint8_t *pbOpt = (uint8_t *)pTcpHdr + RTNETTCP_MIN_LEN;
+    pbOpt[0] = 1; pbOpt[1] = 1; pbOpt[2] = 8; pbOpt[3] = 10;
+
+    uint8_t *pbPayload = pbOpt + 12;
+    for (uint32_t off = 0; off < cbPayload; off++)
+        pbPayload[off] = (uint8_t)(off * 7 + off / 251);
+    return (uint32_t)(pbPayload - &g_abFrame[0]) + cbPayload;
+}
+
+
+static void tstChunkPayload(void)
+{
+    RTTestSub(g_hTest, "Chunk size");
+    PDMNETWORKGSO Gso;
+    RT_ZERO(Gso);
+    Gso.u8Type      = PDMNETWORKGSOTYPE_IPV4_TCP;
+    Gso.offHdr1     = sizeof(RTNETETHERHDR);
+    Gso.offHdr2     = Gso.offHdr1 + RTNETIPV4_MIN_LEN;
+    Gso.cbHdrsTotal = Gso.offHdr2 + RTNETTCP_MIN_LEN + 12;
+    Gso.cbHdrsSeg   = Gso.cbHdrsTotal;
+    Gso.cbMaxSeg    = TST_MSS;
+
+    uint32_t cbChunk = drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME);
+    RTTEST_CHECK_MSG(g_hTest, cbChunk == (uint32_t)(TST_MAXFRAME - Gso.cbHdrsTotal) / TST_MSS * TST_MSS,
+                     (g_hTest, "cbChunk=%u\n", cbChunk));
+    RTTEST_CHECK(g_hTest, cbChunk % TST_MSS == 0);
+    RTTEST_CHECK(g_hTest, cbChunk + Gso.cbHdrsTotal <= TST_MAXFRAME);
+
+    /* a chunk that only holds one segment is no better than segmenting */
+    Gso.cbMaxSeg = 9000;
+    RTTEST_CHECK(g_hTest, drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME) == 0);
+    Gso.cbMaxSeg = (TST_MAXFRAME - Gso.cbHdrsTotal) / 2;
+    RTTEST_CHECK(g_hTest, drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME) == 2 * Gso.cbMaxSeg);
+    Gso.cbMaxSeg = 0;
+    RTTEST_CHECK(g_hTest, drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME) == 0);
+    Gso.cbMaxSeg = TST_MSS;
+    RTTEST_CHECK(g_hTest, drvNATGsoCalcChunkPayload(&Gso, Gso.cbHdrsTotal) == 0);
+
+    /* slirp only does TCP over IPv4 */
+    Gso.u8Type = PDMNETWORKGSOTYPE_IPV4_UDP;
+    RTTEST_CHECK(g_hTest, drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME) == 0);
+    Gso.u8Type = PDMNETWORKGSOTYPE_IPV6_TCP;
+    RTTEST_CHECK(g_hTest, drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME) == 0);
+}
+
+
+/**
+ * Splits a guest GSO frame the way drvNATSendGsoTcp does and checks the
+ * chunks add up to the original.
+ */
+static void tstSendChunks(uint32_t cbPayload, uint32_t uSeq, uint32_t cbIpOpts)
+{
+    RTTestSubF(g_hTest, "Guest frame to chunks, %u bytes, seq %#x, %u bytes of IP options", cbPayload, uSeq, cbIpOpts);
+    uint8_t const fFlags  = RTNETTCP_F_ACK | RTNETTCP_F_PSH | RTNETTCP_F_FIN;
+    uint32_t const cbFrame = tstBuildFrame(cbPayload, uSeq, fFlags, cbIpOpts);
+
+    PDMNETWORKGSO Gso;
+    RT_ZERO(Gso);
+    Gso.u8Type      = PDMNETWORKGSOTYPE_IPV4_TCP;
+    Gso.offHdr1     = sizeof(RTNETETHERHDR);
+    Gso.offHdr2     = Gso.offHdr1 + RTNETIPV4_MIN_LEN + cbIpOpts;
+    Gso.cbHdrsTotal = Gso.offHdr2 + RTNETTCP_MIN_LEN + 12;
+    Gso.cbHdrsSeg   = Gso.cbHdrsTotal;
+    Gso.cbMaxSeg    = TST_MSS;
+    RTTEST_CHECK_RETV(g_hTest, PDMNetGsoIsValid(&Gso, sizeof(Gso), cbFrame));
+
+    uint32_t const cbHdrs     = Gso.cbHdrsTotal;
+    uint32_t const cbChunkMax = drvNATGsoCalcChunkPayload(&Gso, TST_MAXFRAME);
+    RTTEST_CHECK_RETV(g_hTest, cbChunkMax > TST_MSS);
+
+    uint8_t *pbPayloadOut = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cbPayload);
+    RTTEST_CHECK_RETV(g_hTest, pbPayloadOut);
+    uint32_t offPayload = 0;
+    uint16_t iChunk;
+    for (iChunk = 0; offPayload < cbPayload; iChunk++)
+    {
+        uint32_t const cbChunk = RT_MIN(cbChunkMax, cbPayload - offPayload);
+        bool const     fLast   = offPayload + cbChunk >= cbPayload;
+        memcpy(g_abOut, g_abFrame, cbHdrs);
+        memcpy(&g_abOut[cbHdrs], &g_abFrame[cbHdrs + offPayload], cbChunk);
+        drvNATGsoFixupChunk(&Gso, g_abOut, iChunk, 0xfffe, uSeq, offPayload, cbChunk, fLast);
+
+        RTTEST_CHECK(g_hTest, cbHdrs + cbChunk <= TST_MAXFRAME);
+        RTTEST_CHECK_MSG(g_hTest, fLast || cbChunk % TST_MSS == 0, (g_hTest, "chunk %u: %u bytes\n", iChunk, cbChunk));
+
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&g_abOut[Gso.offHdr1];
+        RTTEST_CHECK(g_hTest, RTNetIPv4IsHdrValid(pIpHdr, Gso.offHdr2 - Gso.offHdr1, cbHdrs + cbChunk - Gso.offHdr1, true /*fChecksum*/));
+        RTTEST_CHECK(g_hTest, RT_N2H_U16(pIpHdr->ip_len) == cbHdrs - Gso.offHdr1 + cbChunk);
+        RTTEST_CHECK(g_hTest, RT_N2H_U16(pIpHdr->ip_id) == (uint16_t)(0xfffe + iChunk));
+
+        PCRTNETTCP pTcpHdr = (PCRTNETTCP)&g_abOut[Gso.offHdr2];
+        RTTEST_CHECK_MSG(g_hTest, RT_N2H_U32(pTcpHdr->th_seq) == uSeq + offPayload,
+                         (g_hTest, "chunk %u: seq %#x\n", iChunk, RT_N2H_U32(pTcpHdr->th_seq)));
+        RTTEST_CHECK(g_hTest, pTcpHdr->th_flags == (fLast ? fFlags : RTNETTCP_F_ACK));
+        RTTEST_CHECK(g_hTest, RT_N2H_U32(pTcpHdr->th_ack) == 0x12345678);
+        RTTEST_CHECK(g_hTest, memcmp(&g_abOut[Gso.offHdr1 + RTNETIPV4_MIN_LEN], &g_abFrame[Gso.offHdr1 + RTNETIPV4_MIN_LEN],
+                                     cbIpOpts) == 0);
+        RTTEST_CHECK(g_hTest, memcmp(&g_abOut[Gso.offHdr2 + RTNETTCP_MIN_LEN], &g_abFrame[Gso.offHdr2 + RTNETTCP_MIN_LEN], 12) == 0);
+
+        memcpy(&pbPayloadOut[offPayload], &g_abOut[cbHdrs], cbChunk);
+        offPayload += cbChunk;
+    }
+    RTTEST_CHECK(g_hTest, iChunk == (cbPayload + cbChunkMax - 1) / cbChunkMax);
+    RTTEST_CHECK(g_hTest, memcmp(pbPayloadOut, &g_abFrame[cbHdrs], cbPayload) == 0);
+    RTTestGuardedFree(g_hTest, pbPayloadOut);
+}
+
+
+/**
+ * Sets up the GSO context for a large segment from slirp the way
+ * drvNATRecvDeliver does and checks both ways of delivering it: as a GSO
+ * frame and carved into segments.
+ */
+static void tstRecvSegment(uint32_t cbPayload, uint32_t cbIpOpts)
+{
+    RTTestSubF(g_hTest, "Large segment to the guest, %u bytes, %u bytes of IP options", cbPayload, cbIpOpts);
+    uint8_t const fFlags  = RTNETTCP_F_ACK | RTNETTCP_F_PSH;
+    uint32_t const cbFrame = tstBuildFrame(cbPayload, UINT32_C(0xffffff00), fFlags, cbIpOpts);
+
+    PDMNETWORKGSO Gso;
+    RTTEST_CHECK_RETV(g_hTest, drvNATGsoInitFromFrame(&Gso, g_abFrame, cbFrame, TST_MSS));
+    RTTEST_CHECK(g_hTest, Gso.u8Type == PDMNETWORKGSOTYPE_IPV4_TCP);
+    RTTEST_CHECK(g_hTest, Gso.offHdr1 == sizeof(RTNETETHERHDR));
+    RTTEST_CHECK(g_hTest, Gso.offHdr2 == sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + cbIpOpts);
+    RTTEST_CHECK(g_hTest, Gso.cbHdrsTotal == Gso.offHdr2 + RTNETTCP_MIN_LEN + 12);
+    RTTEST_CHECK(g_hTest, Gso.cbHdrsSeg == Gso.cbHdrsTotal);
+    RTTEST_CHECK(g_hTest, Gso.cbMaxSeg == TST_MSS);
+
+    /* carved: every segment must be a complete and valid TCP/IPv4 frame */
+    memcpy(g_abOut, g_abFrame, cbFrame);
+    uint8_t        abHdrScratch[256];
+    uint32_t const cSegs = PDMNetGsoCalcSegmentCount(&Gso, cbFrame);
+    RTTEST_CHECK(g_hTest, cSegs == (cbPayload + TST_MSS - 1) / TST_MSS);
+    uint32_t offPayload = 0;
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        uint32_t cbSegFrame;
+        uint8_t *pbSeg = (uint8_t *)PDMNetGsoCarveSegmentQD(&Gso, g_abOut, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        uint32_t const cbSegPayload = cbSegFrame - Gso.cbHdrsTotal;
+        RTTEST_CHECK(g_hTest, cbSegPayload == RT_MIN(TST_MSS, cbPayload - offPayload));
+
+        PCRTNETIPV4 pIpHdr  = (PCRTNETIPV4)&pbSeg[Gso.offHdr1];
+        PCRTNETTCP  pTcpHdr = (PCRTNETTCP)&pbSeg[Gso.offHdr2];
+        RTTEST_CHECK(g_hTest, RTNetIPv4IsHdrValid(pIpHdr, Gso.offHdr2 - Gso.offHdr1, cbSegFrame - Gso.offHdr1, true /*fChecksum*/));
+        RTTEST_CHECK_MSG(g_hTest, RTNetIPv4IsTCPValid(pIpHdr, pTcpHdr, Gso.cbHdrsTotal - Gso.offHdr2, &pbSeg[Gso.cbHdrsTotal],
+                                                      cbSegFrame - Gso.offHdr2, true /*fChecksum*/),
+                         (g_hTest, "segment %u\n", iSeg));
+        RTTEST_CHECK(g_hTest, RT_N2H_U32(pTcpHdr->th_seq) == UINT32_C(0xffffff00) + offPayload);
+        RTTEST_CHECK(g_hTest, pTcpHdr->th_flags == (iSeg + 1 == cSegs ? fFlags : RTNETTCP_F_ACK));
+        RTTEST_CHECK(g_hTest, memcmp(&pbSeg[Gso.cbHdrsTotal], &g_abFrame[Gso.cbHdrsTotal + offPayload], cbSegPayload) == 0);
+        offPayload += cbSegPayload;
+    }
+    RTTEST_CHECK(g_hTest, offPayload == cbPayload);
+
+    /* passed up as is: the headers must describe the whole frame */
+    memcpy(g_abOut, g_abFrame, cbFrame);
+    PDMNetGsoPrepForDirectUse(&Gso, g_abOut, cbFrame, PDMNETCSUMTYPE_PSEUDO);
+    PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&g_abOut[Gso.offHdr1];
+    RTTEST_CHECK(g_hTest, RT_N2H_U16(pIpHdr->ip_len) == cbFrame - Gso.offHdr1);
+    RTTEST_CHECK(g_hTest, RTNetIPv4IsHdrValid(pIpHdr, Gso.offHdr2 - Gso.offHdr1, cbFrame - Gso.offHdr1, true /*fChecksum*/));
+}
+
+
+/**
+ * Frames that don't make a valid GSO context are refused.
+ */
+static void tstRecvInvalid(void)
+{
+    RTTestSub(g_hTest, "Invalid large segments");
+    PDMNETWORKGSO Gso;
+    uint32_t const cbFrame = tstBuildFrame(4 * TST_MSS, 1, RTNETTCP_F_ACK, 0);
+    RTTEST_CHECK(g_hTest, !drvNATGsoInitFromFrame(&Gso, g_abFrame, sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN, TST_MSS));
+    RTTEST_CHECK(g_hTest, !drvNATGsoInitFromFrame(&Gso, g_abFrame, cbFrame, 0));
+
+    /* the TCP header would start right at the end of the frame, it must not be touched */
+    uint32_t const cbShort = sizeof(RTNETETHERHDR) + 60;
+    tstBuildFrame(0, 1, RTNETTCP_F_ACK, 60 - RTNETIPV4_MIN_LEN);
+    uint8_t *pbShort = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cbShort);
+    RTTEST_CHECK_RETV(g_hTest, pbShort);
+    memcpy(pbShort, g_abFrame, cbShort);
+    RTTEST_CHECK(g_hTest, !drvNATGsoInitFromFrame(&Gso, pbShort, cbShort, TST_MSS));
+    RTTestGuardedFree(g_hTest, pbShort);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDrvNATGso", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstChunkPayload();
+    tstSendChunks(64000, 1000, 0);
+    tstSendChunks(_64K - 1 - RTNETIPV4_MIN_LEN - RTNETTCP_MIN_LEN - 12, UINT32_C(0xfffff000), 0);
+    tstSendChunks(3 * TST_MSS + 1, 0, 8);
+    tstRecvSegment(11 * TST_MSS, 0);
+    tstRecvSegment(5 * TST_MSS + 17, 4);
+    tstRecvInvalid();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
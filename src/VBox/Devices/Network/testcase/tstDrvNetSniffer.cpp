@@ -0,0 +1,627 @@
+/* $Id: tstDrvNetSniffer.cpp $ */
+/** @file
+ * Network sniffer capture filter, capture ring and pcapng writer tests.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/pdmnetinline.h>
+#include <iprt/err.h>
+#include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/path.h>
+#include <iprt/process.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+#include "../DrvNetSnifferCapture.h"
+#include "../Pcap.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The number of producer threads in the ring stress test. */
+#define TST_PRODUCERS       4
+/** The number of entries each producer puts in the ring stress test. */
+#define TST_PUTS            200000
+/** How long the ring stress test waits for an entry before giving up. */
+#define TST_STALL_MS        10000
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A ring stress test producer.
+ */
+typedef struct TSTPRODUCER
+{
+    PDRVNETSNIFFERRING  pRing;
+    uint32_t            iProducer;
+    uint32_t            cFull;
+} TSTPRODUCER;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+/** The frame under test. */
+static uint8_t  g_abFrame[8192];
+/** Tells the ring stress test producers to give up. */
+static bool volatile g_fStop = false;
+
+
+/**
+ * Builds a TCP or UDP frame over IPv4 or IPv6, optionally VLAN tagged.
+ *
+ * @returns The frame size.
+ * @param   fIPv6               IPv6 instead of IPv4.
+ * @param   fVlan               Whether to add a VLAN tag.
+ * @param   bProto              The IP protocol.
+ * @param   uSrcPort            The source port.
+ * @param   uDstPort            The destination port.
+ * @param   cbPayload           The payload size.
+ */
+static uint32_t tstBuildFrame(bool fIPv6, bool fVlan, uint8_t bProto, uint16_t uSrcPort, uint16_t uDstPort, uint32_t cbPayload)
+{
+    RT_ZERO(g_abFrame);
+    PRTNETETHERHDR pEthHdr = (PRTNETETHERHDR)&g_abFrame[0];
+    uint32_t       offL3   = sizeof(RTNETETHERHDR);
+    if (fVlan)
+    {
+        pEthHdr->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_VLAN);
+        *(uint16_t *)&g_abFrame[offL3]     = RT_H2N_U16_C(42);
+        *(uint16_t *)&g_abFrame[offL3 + 2] = RT_H2N_U16(fIPv6 ? RTNET_ETHERTYPE_IPV6 : RTNET_ETHERTYPE_IPV4);
+        offL3 += 4;
+    }
+    else
+        pEthHdr->EtherType = RT_H2N_U16(fIPv6 ? RTNET_ETHERTYPE_IPV6 : RTNET_ETHERTYPE_IPV4);
+
+    uint32_t const cbL4Hdr = bProto == RTNETIPV4_PROT_TCP ? RTNETTCP_MIN_LEN : RTNETUDP_MIN_LEN;
+    uint32_t       offL4;
+    if (fIPv6)
+    {
+        PRTNETIPV6 pIp6Hdr = (PRTNETIPV6)&g_abFrame[offL3];
+        pIp6Hdr->ip6_vfc  = RT_H2N_U32_C(0x60000000);
+        pIp6Hdr->ip6_plen = RT_H2N_U16((uint16_t)(cbL4Hdr + cbPayload));
+        pIp6Hdr->ip6_nxt  = bProto;
+        pIp6Hdr->ip6_hlim = 64;
+        offL4 = offL3 + RTNETIPV6_MIN_LEN;
+    }
+    else
+    {
+        PRTNETIPV4 pIpHdr = (PRTNETIPV4)&g_abFrame[offL3];
+        pIpHdr->ip_v   = 4;
+        pIpHdr->ip_hl  = RTNETIPV4_MIN_LEN / 4;
+        pIpHdr->ip_len = RT_H2N_U16((uint16_t)(RTNETIPV4_MIN_LEN + cbL4Hdr + cbPayload));
+        pIpHdr->ip_ttl = 64;
+        pIpHdr->ip_p   = bProto;
+        pIpHdr->ip_src.u = RT_H2N_U32_C(0x0a00020f);
+        pIpHdr->ip_dst.u = RT_H2N_U32_C(0x0a000202);
+        pIpHdr->ip_sum = RTNetIPv4HdrChecksum(pIpHdr);
+        offL4 = offL3 + RTNETIPV4_MIN_LEN;
+    }
+
+    *(uint16_t *)&g_abFrame[offL4]     = RT_H2N_U16(uSrcPort);
+    *(uint16_t *)&g_abFrame[offL4 + 2] = RT_H2N_U16(uDstPort);
+    if (bProto == RTNETIPV4_PROT_TCP)
+        ((PRTNETTCP)&g_abFrame[offL4])->th_off = RTNETTCP_MIN_LEN / 4;
+    else
+        ((PRTNETUDP)&g_abFrame[offL4])->uh_ulen = RT_H2N_U16((uint16_t)(RTNETUDP_MIN_LEN + cbPayload));
+
+    uint32_t const cbFrame = offL4 + cbL4Hdr + cbPayload;
+    for (uint32_t off = offL4 + cbL4Hdr; off < cbFrame; off++)
+        g_abFrame[off] = (uint8_t)(off * 7 + 1);
+    return cbFrame;
+}
+
+
+/**
+ * Checks a pcapng enhanced packet block.
+ *
+ * @returns The block size, 0 on failure.
+ * @param   pbBlock             The block.
+ * @param   cbAvail             The number of bytes available at @a pbBlock.
+ * @param   NanoTS              The expected timestamp.
+ * @param   fInbound            The expected direction.
+ * @param   pvFrame             The expected frame data.
+ * @param   cbIncl              The expected number of bytes included.
+ * @param   cbOrig              The expected original frame size.
+ */
+static uint32_t tstCheckEpb(uint8_t const *pbBlock, size_t cbAvail, uint64_t NanoTS, bool fInbound,
+                            void const *pvFrame, uint32_t cbIncl, uint32_t cbOrig)
+{
+    uint32_t const *pau32 = (uint32_t const *)pbBlock;
+    uint32_t const  cbBlock = (uint32_t)PCAPNG_FRAME_BLOCK_SIZE(cbIncl);
+    RTTEST_CHECK_RET(g_hTest, cbAvail >= cbBlock, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[0] == 6, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[1] == cbBlock, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[2] == 0, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[3] == (uint32_t)(NanoTS >> 32), 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[4] == (uint32_t)NanoTS, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[5] == cbIncl, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32[6] == cbOrig, 0);
+    RTTEST_CHECK_RET(g_hTest, memcmp(&pbBlock[28], pvFrame, cbIncl) == 0, 0);
+    for (uint32_t off = 28 + cbIncl; off < 28 + RT_ALIGN_32(cbIncl, 4); off++)
+        RTTEST_CHECK_RET(g_hTest, pbBlock[off] == 0, 0);
+
+    /* epb_flags, the end of options and the block size again */
+    uint32_t const *pau32Trailer = (uint32_t const *)&pbBlock[28 + RT_ALIGN_32(cbIncl, 4)];
+    RTTEST_CHECK_RET(g_hTest, pau32Trailer[0] == RT_MAKE_U32(2, 4), 0);
+    RTTEST_CHECK_RET(g_hTest, pau32Trailer[1] == (fInbound ? 1U : 2U), 0);
+    RTTEST_CHECK_RET(g_hTest, pau32Trailer[2] == 0, 0);
+    RTTEST_CHECK_RET(g_hTest, pau32Trailer[3] == cbBlock, 0);
+    RTTEST_CHECK_RET(g_hTest, (uint8_t const *)&pau32Trailer[4] == pbBlock + cbBlock, 0);
+    return cbBlock;
+}
+
+
+static void tstFormat(void)
+{
+    RTTestSub(g_hTest, "pcapng frame blocks");
+    for (uint32_t i = 0; i < 64; i++)
+        g_abFrame[i] = (uint8_t)(i * 13 + 5);
+    uint64_t const NanoTS = UINT64_C(0x0123456789abcdef);
+
+    for (uint32_t cbFrame = 0; cbFrame <= 64; cbFrame++)
+        for (uint32_t cbMax = 0; cbMax <= 64; cbMax += 7)
+            for (uint32_t cbHdrs = 0; cbHdrs <= cbFrame; cbHdrs += 5)
+            {
+                /* the block must fit into what the caller dimensioned for cbMax */
+                size_t const cbBuf   = PCAPNG_FRAME_BLOCK_SIZE(cbMax);
+                uint8_t     *pbBlock = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cbBuf);
+                if (!pbBlock)
+                    return;
+                memset(pbBlock, 0xcc, cbBuf);
+                uint32_t const cbIncl  = RT_MIN(cbFrame, cbMax);
+                bool const     fInbound = cbFrame & 1;
+                size_t const   cbBlock = PcapNgFormatFrame(pbBlock, NanoTS, fInbound, g_abFrame, cbHdrs,
+                                                           &g_abFrame[cbHdrs], cbFrame - cbHdrs, cbMax);
+                bool const     fOk     = cbBlock == PCAPNG_FRAME_BLOCK_SIZE(cbIncl)
+                                      && tstCheckEpb(pbBlock, cbBuf, NanoTS, fInbound, g_abFrame, cbIncl, cbFrame) != 0;
+                RTTestGuardedFree(g_hTest, pbBlock);
+                if (!fOk)
+                {
+                    RTTestFailureDetails(g_hTest, "cbFrame=%u cbMax=%u cbHdrs=%u\n", cbFrame, cbMax, cbHdrs);
+                    return;
+                }
+            }
+}
+
+
+static void tstFile(void)
+{
+    RTTestSub(g_hTest, "pcapng file");
+    char szPath[RTPATH_MAX];
+    RTTESTI_CHECK_RC_RETV(RTPathTemp(szPath, sizeof(szPath)), VINF_SUCCESS);
+    char szName[64];
+    RTStrPrintf(szName, sizeof(szName), "tstDrvNetSniffer-%u.pcapng", RTProcSelf());
+    RTTESTI_CHECK_RC_RETV(RTPathAppend(szPath, sizeof(szPath), szName), VINF_SUCCESS);
+    RTFILE hFile;
+    RTTESTI_CHECK_RC_RETV(RTFileOpen(&hFile, szPath, RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_NONE),
+                          VINF_SUCCESS);
+
+    /* a TCP/IPv4 GSO frame of three segments */
+    uint32_t const cbGsoFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_TCP, 80, 49152, 2500);
+    PDMNETWORKGSO  Gso;
+    Gso.u8Type      = PDMNETWORKGSOTYPE_IPV4_TCP;
+    Gso.offHdr1     = sizeof(RTNETETHERHDR);
+    Gso.offHdr2     = sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN;
+    Gso.cbHdrsTotal = sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + RTNETTCP_MIN_LEN;
+    Gso.cbHdrsSeg   = Gso.cbHdrsTotal;
+    Gso.u8Unused    = 0;
+    Gso.cbMaxSeg    = 1000;
+    RTTEST_CHECK(g_hTest, PDMNetGsoIsValid(&Gso, sizeof(Gso), cbGsoFrame));
+    uint8_t abGsoFrame[4096];
+    memcpy(abGsoFrame, g_abFrame, cbGsoFrame);
+
+    uint32_t const cbFrame = tstBuildFrame(false, true, RTNETIPV4_PROT_UDP, 53, 49153, 55);
+    RTTESTI_CHECK_RC(PcapNgFileHdr(hFile, 1536), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(PcapNgFileFrame(hFile, 1000, true, g_abFrame, cbFrame, 64), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(PcapNgFileFrame(hFile, 2000, false, g_abFrame, cbFrame, 1536), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(PcapNgFileGsoFrame(hFile, 3000, false, &Gso, abGsoFrame, cbGsoFrame, 1536), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(PcapNgFileStats(hFile, 4000, UINT64_C(0x100000010), 3), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(RTFileClose(hFile), VINF_SUCCESS);
+
+    void  *pvFile;
+    size_t cbFile;
+    int rc = RTFileReadAll(szPath, &pvFile, &cbFile);
+    RTTESTI_CHECK_RC_OK(rc);
+    RTFileDelete(szPath);
+    if (RT_FAILURE(rc))
+        return;
+    uint8_t const  *pbFile = (uint8_t const *)pvFile;
+    uint32_t const *pau32  = (uint32_t const *)pbFile;
+    size_t          off    = 0;
+
+    /* the section header block */
+    RTTEST_CHECK(g_hTest, cbFile >= 60);
+    RTTEST_CHECK(g_hTest, pau32[0] == UINT32_C(0x0a0d0d0a) && pau32[1] == 28 && pau32[6] == 28);
+    RTTEST_CHECK(g_hTest, pau32[2] == UINT32_C(0x1a2b3c4d) && pau32[3] == RT_MAKE_U32(1, 0));
+    RTTEST_CHECK(g_hTest, pau32[4] == UINT32_MAX && pau32[5] == UINT32_MAX);
+    /* the interface description block: Ethernet, snaplen, if_tsresol 9 */
+    RTTEST_CHECK(g_hTest, pau32[7] == 1 && pau32[8] == 32 && pau32[14] == 32);
+    RTTEST_CHECK(g_hTest, pau32[9] == 1 && pau32[10] == 1536);
+    RTTEST_CHECK(g_hTest, pau32[11] == RT_MAKE_U32(9, 1) && pbFile[48] == 9 && pau32[13] == 0);
+    off = 60;
+
+    /* the frames, truncated and not */
+    uint32_t cbBlock = tstCheckEpb(&pbFile[off], cbFile - off, 1000, true, g_abFrame, 64, cbFrame);
+    off += cbBlock;
+    if (cbBlock)
+    {
+        cbBlock = tstCheckEpb(&pbFile[off], cbFile - off, 2000, false, g_abFrame, cbFrame, cbFrame);
+        off += cbBlock;
+    }
+
+    /* one block per GSO segment */
+    uint32_t const cSegs = PDMNetGsoCalcSegmentCount(&Gso, cbGsoFrame);
+    RTTEST_CHECK(g_hTest, cSegs == 3);
+    for (uint32_t iSeg = 0; iSeg < cSegs && cbBlock; iSeg++)
+    {
+        uint8_t  abSeg[2048];
+        uint32_t cbHdrs, cbSegPayload;
+        uint32_t offPayload = PDMNetGsoCarveSegment(&Gso, abGsoFrame, cbGsoFrame, iSeg, cSegs, abSeg, &cbHdrs, &cbSegPayload);
+        memcpy(&abSeg[cbHdrs], &abGsoFrame[offPayload], cbSegPayload);
+        cbBlock = tstCheckEpb(&pbFile[off], cbFile - off, 3000, false, abSeg, cbHdrs + cbSegPayload, cbHdrs + cbSegPayload);
+        off += cbBlock;
+    }
+
+    /* the interface statistics block */
+    if (cbBlock)
+    {
+        RTTEST_CHECK(g_hTest, cbFile - off == 52);
+        if (cbFile - off == 52)
+        {
+            pau32 = (uint32_t const *)&pbFile[off];
+            RTTEST_CHECK(g_hTest, pau32[0] == 5 && pau32[1] == 52 && pau32[12] == 52);
+            RTTEST_CHECK(g_hTest, pau32[2] == 0 && pau32[3] == 0 && pau32[4] == 4000);
+            RTTEST_CHECK(g_hTest, pau32[5] == RT_MAKE_U32(4, 8) && pau32[6] == 0x10 && pau32[7] == 1);
+            RTTEST_CHECK(g_hTest, pau32[8] == RT_MAKE_U32(5, 8) && pau32[9] == 3 && pau32[10] == 0);
+            RTTEST_CHECK(g_hTest, pau32[11] == 0);
+        }
+    }
+    RTFileReadAllFree(pvFile, cbFile);
+}
+
+
+/**
+ * Runs a frame against a filter, also checking the filter doesn't look past
+ * the end of the frame.
+ */
+static bool tstMatch(PCDRVNETSNIFFERFILTER pFilter, uint32_t cbFrame)
+{
+    uint8_t *pbFrame = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cbFrame);
+    if (!pbFrame)
+        return false;
+    memcpy(pbFrame, g_abFrame, cbFrame);
+    bool fMatch = drvNetSnifferFilterMatch(pFilter, pbFrame, cbFrame);
+    RTTestGuardedFree(g_hTest, pbFrame);
+    return fMatch;
+}
+
+
+static void tstFilter(void)
+{
+    RTTestSub(g_hTest, "Filter");
+    DRVNETSNIFFERFILTER Filter;
+    RT_ZERO(Filter);
+    Filter.u16IpProto = UINT16_MAX;
+
+    /* no criteria, anything with an Ethernet header goes */
+    uint32_t cbFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_TCP, 80, 49152, 10);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, sizeof(RTNETETHERHDR)));
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, sizeof(RTNETETHERHDR) - 1));
+
+    /* EtherType, through a VLAN tag */
+    Filter.u16EtherType = RTNET_ETHERTYPE_IPV4;
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    cbFrame = tstBuildFrame(true, false, RTNETIPV4_PROT_TCP, 80, 49152, 10);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    cbFrame = tstBuildFrame(false, true, RTNETIPV4_PROT_TCP, 80, 49152, 10);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, sizeof(RTNETETHERHDR) + 4));
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, sizeof(RTNETETHERHDR) + 3));
+    Filter.u16EtherType = RTNET_ETHERTYPE_VLAN;
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    Filter.u16EtherType = 0;
+
+    /* IP protocol */
+    Filter.u16IpProto = RTNETIPV4_PROT_UDP;
+    cbFrame = tstBuildFrame(false, true, RTNETIPV4_PROT_UDP, 53, 49153, 10);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, sizeof(RTNETETHERHDR) + 4 + RTNETIPV4_MIN_LEN - 1));
+    cbFrame = tstBuildFrame(true, false, RTNETIPV4_PROT_UDP, 53, 49153, 10);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, sizeof(RTNETETHERHDR) + RTNETIPV6_MIN_LEN - 1));
+    cbFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_TCP, 53, 49153, 10);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    /* not IP at all */
+    ((PRTNETETHERHDR)g_abFrame)->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_ARP);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    Filter.u16IpProto = UINT16_MAX;
+
+    /* IPv4 host, source or destination, never IPv6 */
+    Filter.fHost = true;
+    Filter.HostAddr.u = RT_H2N_U32_C(0x0a000202);
+    cbFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_TCP, 80, 49152, 10);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    Filter.HostAddr.u = RT_H2N_U32_C(0x0a00020f);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    Filter.HostAddr.u = RT_H2N_U32_C(0x0a000203);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    cbFrame = tstBuildFrame(true, false, RTNETIPV4_PROT_TCP, 80, 49152, 10);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    Filter.fHost = false;
+
+    /* TCP and UDP ports, source or destination */
+    for (unsigned iFrame = 0; iFrame < 8; iFrame++)
+    {
+        bool const    fIPv6  = iFrame & 1;
+        bool const    fVlan  = (iFrame >> 1) & 1;
+        uint8_t const bProto = iFrame & 4 ? RTNETIPV4_PROT_UDP : RTNETIPV4_PROT_TCP;
+        cbFrame = tstBuildFrame(fIPv6, fVlan, bProto, 80, 49152, 10);
+        uint32_t const cbL4Off = sizeof(RTNETETHERHDR) + (fVlan ? 4 : 0) + (fIPv6 ? RTNETIPV6_MIN_LEN : RTNETIPV4_MIN_LEN);
+        Filter.u16Port = 80;
+        RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+        RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbL4Off + 4));
+        RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbL4Off + 3));
+        Filter.u16Port = 49152;
+        RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+        Filter.u16Port = 81;
+        RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    }
+    Filter.u16Port = 80;
+    cbFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_ICMP, 80, 49152, 10);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+
+    /* the ports follow the IPv4 options */
+    cbFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_UDP, 1, 1, 10);
+    PRTNETIPV4 pIpHdr = (PRTNETIPV4)&g_abFrame[sizeof(RTNETETHERHDR)];
+    pIpHdr->ip_hl = (RTNETIPV4_MIN_LEN + 8) / 4;
+    *(uint16_t *)&g_abFrame[sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + 8] = RT_H2N_U16_C(80);
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + 8 + 3));
+    pIpHdr->ip_hl = RTNETIPV4_MIN_LEN / 4;
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+
+    /* only the first fragment has ports */
+    cbFrame = tstBuildFrame(false, false, RTNETIPV4_PROT_UDP, 80, 49152, 10);
+    pIpHdr->ip_off = RT_H2N_U16_C(0x2000); /* more fragments */
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+    pIpHdr->ip_off = RT_H2N_U16_C(0x0001);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    pIpHdr->ip_off = RT_H2N_U16_C(0x1000);
+    RTTEST_CHECK(g_hTest, !tstMatch(&Filter, cbFrame));
+    pIpHdr->ip_off = RT_H2N_U16_C(0x4000); /* don't fragment */
+    RTTEST_CHECK(g_hTest, tstMatch(&Filter, cbFrame));
+}
+
+
+/**
+ * Puts an entry recording the producer and a sequence number into the ring.
+ */
+static bool tstRingPut(PDRVNETSNIFFERRING pRing, uint32_t iProducer, uint32_t uValue)
+{
+    uint32_t           iPos;
+    PDRVNETSNIFFERSLOT pSlot = drvNetSnifferRingClaim(pRing, &iPos);
+    if (!pSlot)
+        return false;
+    uint32_t *pau32 = (uint32_t *)(pSlot + 1);
+    pau32[0] = iProducer;
+    pau32[1] = uValue;
+    pSlot->cbBlock = sizeof(uint32_t) * 2;
+    drvNetSnifferRingCommit(pSlot, iPos);
+    return true;
+}
+
+
+/**
+ * Takes the next entry out of the ring.
+ */
+static bool tstRingGet(PDRVNETSNIFFERRING pRing, uint32_t *piProducer, uint32_t *puValue)
+{
+    PDRVNETSNIFFERSLOT pSlot = drvNetSnifferRingPeek(pRing);
+    if (!pSlot)
+        return false;
+    RTTEST_CHECK(g_hTest, pSlot->cbBlock == sizeof(uint32_t) * 2);
+    uint32_t const *pau32 = (uint32_t const *)(pSlot + 1);
+    *piProducer = pau32[0];
+    *puValue    = pau32[1];
+    drvNetSnifferRingRelease(pRing, pSlot);
+    return true;
+}
+
+
+static void tstRing(void)
+{
+    RTTestSub(g_hTest, "Ring");
+    uint32_t const     cSlots = 8;
+    uint32_t const     cbSlot = 64;
+    uint8_t           *pbRing = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cSlots * cbSlot);
+    if (!pbRing)
+        return;
+    DRVNETSNIFFERRING  Ring;
+    drvNetSnifferRingInit(&Ring, pbRing, cSlots, cbSlot);
+
+    /* empty, then full */
+    uint32_t iProducer, uValue;
+    RTTEST_CHECK(g_hTest, !tstRingGet(&Ring, &iProducer, &uValue));
+    for (uint32_t i = 0; i < cSlots; i++)
+        RTTEST_CHECK(g_hTest, tstRingPut(&Ring, 0, i));
+    RTTEST_CHECK(g_hTest, !tstRingPut(&Ring, 0, cSlots));
+    RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == 0);
+    RTTEST_CHECK(g_hTest, tstRingPut(&Ring, 0, cSlots));
+    RTTEST_CHECK(g_hTest, !tstRingPut(&Ring, 0, cSlots + 1));
+    for (uint32_t i = 1; i <= cSlots; i++)
+        RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == i);
+    RTTEST_CHECK(g_hTest, !tstRingGet(&Ring, &iProducer, &uValue));
+
+    /* a claimed entry is only seen once committed */
+    uint32_t           iPos;
+    PDRVNETSNIFFERSLOT pSlot = drvNetSnifferRingClaim(&Ring, &iPos);
+    RTTEST_CHECK(g_hTest, pSlot && tstRingPut(&Ring, 0, 1));
+    RTTEST_CHECK(g_hTest, !tstRingGet(&Ring, &iProducer, &uValue));
+    if (pSlot)
+    {
+        ((uint32_t *)(pSlot + 1))[0] = 0;
+        ((uint32_t *)(pSlot + 1))[1] = 0;
+        pSlot->cbBlock = sizeof(uint32_t) * 2;
+        drvNetSnifferRingCommit(pSlot, iPos);
+    }
+    RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == 0);
+    RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == 1);
+
+    /* the positions wrapping around */
+    uint32_t const iStart = UINT32_MAX - 3 * cSlots / 2;
+    Ring.iProducer = Ring.iConsumer = iStart;
+    for (uint32_t i = 0; i < cSlots; i++)
+        drvNetSnifferRingSlot(&Ring, iStart + i)->uSeq = iStart + i;
+    uint32_t uPut  = 0;
+    uint32_t uNext = 0;
+    for (uint32_t i = 0; i < 4 * cSlots; i++)
+    {
+        for (uint32_t j = 0; j <= cSlots && tstRingPut(&Ring, 0, uPut); j++)
+            uPut++;
+        RTTEST_CHECK(g_hTest, Ring.iProducer - Ring.iConsumer == cSlots);
+        for (uint32_t j = 0; j < 3; j++)
+            RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == uNext++);
+    }
+    while (tstRingGet(&Ring, &iProducer, &uValue))
+        RTTEST_CHECK(g_hTest, uValue == uNext++);
+    RTTEST_CHECK(g_hTest, Ring.iProducer == Ring.iConsumer && Ring.iProducer < iStart);
+
+    /* the smallest ring the driver takes */
+    drvNetSnifferRingInit(&Ring, pbRing, 2, cbSlot);
+    RTTEST_CHECK(g_hTest, tstRingPut(&Ring, 0, 0) && tstRingPut(&Ring, 0, 1));
+    RTTEST_CHECK(g_hTest, !tstRingPut(&Ring, 0, 2));
+    RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == 0);
+    RTTEST_CHECK(g_hTest, tstRingPut(&Ring, 0, 2));
+    RTTEST_CHECK(g_hTest, !tstRingPut(&Ring, 0, 3));
+    RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == 1);
+    RTTEST_CHECK(g_hTest, tstRingGet(&Ring, &iProducer, &uValue) && uValue == 2);
+    RTTEST_CHECK(g_hTest, !tstRingGet(&Ring, &iProducer, &uValue));
+
+    RTTestGuardedFree(g_hTest, pbRing);
+}
+
+
+/**
+ * Ring stress test producer thread.
+ */
+static DECLCALLBACK(int) tstRingProducer(RTTHREAD hThread, void *pvUser)
+{
+    TSTPRODUCER *pProducer = (TSTPRODUCER *)pvUser;
+    for (uint32_t i = 0; i < TST_PUTS; i++)
+        while (!tstRingPut(pProducer->pRing, pProducer->iProducer, i))
+        {
+            if (ASMAtomicReadBool(&g_fStop))
+                return VINF_SUCCESS;
+            pProducer->cFull++;
+            RTThreadYield();
+        }
+    return VINF_SUCCESS;
+}
+
+
+static void tstRingStress(void)
+{
+    RTTestSub(g_hTest, "Ring, several producers");
+    uint32_t const     cSlots = 16;
+    uint32_t const     cbSlot = 32;
+    uint8_t           *pbRing = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cSlots * cbSlot);
+    if (!pbRing)
+        return;
+    DRVNETSNIFFERRING  Ring;
+    drvNetSnifferRingInit(&Ring, pbRing, cSlots, cbSlot);
+
+    TSTPRODUCER aProducers[TST_PRODUCERS];
+    RTTHREAD    ahThreads[TST_PRODUCERS];
+    uint32_t    auNext[TST_PRODUCERS];
+    for (uint32_t i = 0; i < TST_PRODUCERS; i++)
+    {
+        aProducers[i].pRing     = &Ring;
+        aProducers[i].iProducer = i;
+        aProducers[i].cFull     = 0;
+        auNext[i]               = 0;
+        int rc = RTThreadCreate(&ahThreads[i], tstRingProducer, &aProducers[i], 0, RTTHREADTYPE_DEFAULT,
+                                RTTHREADFLAGS_WAITABLE, "tstProd");
+        RTTESTI_CHECK_RC_OK_RETV(rc);
+    }
+
+    /* each producer's entries come out once and in order */
+    uint32_t cGot      = 0;
+    uint64_t u64LastMs = RTTimeMilliTS();
+    while (cGot < TST_PRODUCERS * TST_PUTS)
+    {
+        uint32_t iProducer, uValue;
+        if (!tstRingGet(&Ring, &iProducer, &uValue))
+        {
+            if (RTTimeMilliTS() - u64LastMs > TST_STALL_MS)
+            {
+                RTTestFailed(g_hTest, "stalled after %u entries\n", cGot);
+                break;
+            }
+            RTThreadYield();
+            continue;
+        }
+        u64LastMs = RTTimeMilliTS();
+        if (iProducer >= TST_PRODUCERS || uValue != auNext[iProducer])
+        {
+            RTTestFailed(g_hTest, "producer %u: got %u, expected %u\n", iProducer, uValue,
+                         iProducer < TST_PRODUCERS ? auNext[iProducer] : 0);
+            break;
+        }
+        auNext[iProducer]++;
+        cGot++;
+    }
+    ASMAtomicWriteBool(&g_fStop, true);
+
+    uint32_t cFull = 0;
+    for (uint32_t i = 0; i < TST_PRODUCERS; i++)
+    {
+        RTTESTI_CHECK_RC(RTThreadWait(ahThreads[i], RT_INDEFINITE_WAIT, NULL), VINF_SUCCESS);
+        cFull += aProducers[i].cFull;
+    }
+    RTTestPrintf(g_hTest, RTTESTLVL_ALWAYS, "%u entries, ring full %u times\n", cGot, cFull);
+    uint32_t iProducer, uValue;
+    RTTEST_CHECK(g_hTest, !tstRingGet(&Ring, &iProducer, &uValue));
+    RTTEST_CHECK(g_hTest, Ring.iProducer == TST_PRODUCERS * TST_PUTS);
+    RTTestGuardedFree(g_hTest, pbRing);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDrvNetSniffer", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstFormat();
+    tstFile();
+    tstFilter();
+    tstRing();
+    tstRingStress();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -0,0 +1,405 @@
+/* $Id: tstDrvTAPVNetHdr.cpp $ */
+/** @file
+ * TAP network transport driver, virtio-net header helper tests.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/pdmnetinline.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+#include "../DrvTAPVNetHdr.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The TCP segment size used throughout. */
+#define TST_MSS             1448
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * Where things are in a frame built by tstBuildFrame.
+ */
+typedef struct TSTFRAME
+{
+    uint32_t    offHdr1;
+    uint32_t    offHdr2;
+    uint32_t    cbHdrs;
+    uint32_t    cbFrame;
+} TSTFRAME;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+/** The frame under test. */
+static uint8_t  g_abFrame[_64K + _1K];
+/** Copy of g_abFrame for checking it was left alone. */
+static uint8_t  g_abCopy[_64K + _1K];
+
+
+/**
+ * Builds a TCP or UDP frame over IPv4 or IPv6, optionally VLAN tagged, with
+ * a payload pattern depending on the payload offset only.  TCP gets a 12 byte
+ * timestamp option.  The L4 checksum is left zero.
+ *
+ * @returns The frame size.
+ * @param   fIPv6               IPv6 instead of IPv4.
+ * @param   fVlan               Whether to add a VLAN tag.
+ * @param   bProto              RTNETIPV4_PROT_TCP or RTNETIPV4_PROT_UDP.
+ * @param   cbPayload           The payload size.
+ * @param   uSeq                The TCP sequence number.
+ * @param   pInfo               Where to return the layout.
+ */
+static uint32_t tstBuildFrame(bool fIPv6, bool fVlan, uint8_t bProto, uint32_t cbPayload, uint32_t uSeq, TSTFRAME *pInfo)
+{
+    RT_ZERO(g_abFrame);
+    PRTNETETHERHDR pEthHdr = (PRTNETETHERHDR)&g_abFrame[0];
+    pInfo->offHdr1 = sizeof(RTNETETHERHDR);
+    if (fVlan)
+    {
+        pEthHdr->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_VLAN);
+        *(uint16_t *)&g_abFrame[sizeof(RTNETETHERHDR)]     = RT_H2N_U16_C(42);
+        *(uint16_t *)&g_abFrame[sizeof(RTNETETHERHDR) + 2] = RT_H2N_U16(fIPv6 ? RTNET_ETHERTYPE_IPV6 : RTNET_ETHERTYPE_IPV4);
+        pInfo->offHdr1 += 4;
+    }
+    else
+        pEthHdr->EtherType = RT_H2N_U16(fIPv6 ? RTNET_ETHERTYPE_IPV6 : RTNET_ETHERTYPE_IPV4);
+
+    uint32_t const cbL4Hdr = bProto == RTNETIPV4_PROT_TCP ? RTNETTCP_MIN_LEN + 12 : RTNETUDP_MIN_LEN;
+    if (fIPv6)
+    {
+        PRTNETIPV6 pIp6Hdr = (PRTNETIPV6)&g_abFrame[pInfo->offHdr1];
+        pIp6Hdr->ip6_vfc  = RT_H2N_U32_C(0x60000000);
+        pIp6Hdr->ip6_plen = RT_H2N_U16((uint16_t)(cbL4Hdr + cbPayload));
+        pIp6Hdr->ip6_nxt  = bProto;
+        pIp6Hdr->ip6_hlim = 64;
+        pIp6Hdr->ip6_src.au32[0] = RT_H2N_U32_C(0xfd000000);
+        pIp6Hdr->ip6_src.au32[3] = RT_H2N_U32_C(0x0000000f);
+        pIp6Hdr->ip6_dst.au32[0] = RT_H2N_U32_C(0xfd000000);
+        pIp6Hdr->ip6_dst.au32[3] = RT_H2N_U32_C(0x00000002);
+        pInfo->offHdr2 = pInfo->offHdr1 + RTNETIPV6_MIN_LEN;
+    }
+    else
+    {
+        PRTNETIPV4 pIpHdr = (PRTNETIPV4)&g_abFrame[pInfo->offHdr1];
+        pIpHdr->ip_v   = 4;
+        pIpHdr->ip_hl  = RTNETIPV4_MIN_LEN / 4;
+        pIpHdr->ip_len = RT_H2N_U16((uint16_t)(RTNETIPV4_MIN_LEN + cbL4Hdr + cbPayload));
+        pIpHdr->ip_id  = RT_H2N_U16_C(0x4242);
+        pIpHdr->ip_ttl = 64;
+        pIpHdr->ip_p   = bProto;
+        pIpHdr->ip_src.u = RT_H2N_U32_C(0x0a00020f);
+        pIpHdr->ip_dst.u = RT_H2N_U32_C(0x0a000202);
+        pIpHdr->ip_sum = RTNetIPv4HdrChecksum(pIpHdr);
+        pInfo->offHdr2 = pInfo->offHdr1 + RTNETIPV4_MIN_LEN;
+    }
+
+    if (bProto == RTNETIPV4_PROT_TCP)
+    {
+        PRTNETTCP pTcpHdr = (PRTNETTCP)&g_abFrame[pInfo->offHdr2];
+        pTcpHdr->th_sport = RT_H2N_U16_C(22);
+        pTcpHdr->th_dport = RT_H2N_U16_C(49152);
+        pTcpHdr->th_seq   = RT_H2N_U32(uSeq);
+        pTcpHdr->th_ack   = RT_H2N_U32_C(0x87654321);
+        pTcpHdr->th_off   = (RTNETTCP_MIN_LEN + 12) / 4;
+        pTcpHdr->th_flags = RTNETTCP_F_ACK | RTNETTCP_F_PSH;
+        pTcpHdr->th_win   = RT_H2N_U16_C(0x1000);
+        uint8_t *pbOpt = &g_abFrame[pInfo->offHdr2 + RTNETTCP_MIN_LEN];
+        pbOpt[0] = 1; pbOpt[1] = 1; pbOpt[2] = 8; pbOpt[3] = 10;
+    }
+    else
+    {
+        PRTNETUDP pUdpHdr = (PRTNETUDP)&g_abFrame[pInfo->offHdr2];
+        pUdpHdr->uh_sport = RT_H2N_U16_C(53);
+        pUdpHdr->uh_dport = RT_H2N_U16_C(49153);
+        pUdpHdr->uh_ulen  = RT_H2N_U16((uint16_t)(RTNETUDP_MIN_LEN + cbPayload));
+    }
+
+    pInfo->cbHdrs  = pInfo->offHdr2 + cbL4Hdr;
+    pInfo->cbFrame = pInfo->cbHdrs + cbPayload;
+    for (uint32_t off = 0; off < cbPayload; off++)
+        g_abFrame[pInfo->cbHdrs + off] = (uint8_t)(off * 13 + off / 253);
+    return pInfo->cbFrame;
+}
+
+
+/**
+ * Checks the TCP checksum of a (segment) frame.
+ */
+static bool tstIsTcpSumOk(uint8_t const *pbFrame, uint32_t cbFrame, uint32_t offHdr1, uint32_t offHdr2, bool fIPv6)
+{
+    PCRTNETTCP     pTcpHdr  = (PCRTNETTCP)&pbFrame[offHdr2];
+    uint32_t const cbTcpHdr = pTcpHdr->th_off * 4;
+    if (fIPv6)
+    {
+        uint32_t u32Sum = RTNetIPv6PseudoChecksum((PCRTNETIPV6)&pbFrame[offHdr1]);
+        return RTNetTCPChecksum(u32Sum, pTcpHdr, &pbFrame[offHdr2 + cbTcpHdr], cbFrame - offHdr2 - cbTcpHdr)
+            == pTcpHdr->th_sum;
+    }
+    return RTNetIPv4IsTCPValid((PCRTNETIPV4)&pbFrame[offHdr1], pTcpHdr, cbTcpHdr, &pbFrame[offHdr2 + cbTcpHdr],
+                               cbFrame - offHdr2, true /*fChecksum*/);
+}
+
+
+/**
+ * Puts the pseudo header sum into the checksum field the way the kernel
+ * passes up frames with a partial checksum.
+ */
+static void tstSetPartialSum(uint32_t offSum, TSTFRAME const *pInfo, bool fIPv6)
+{
+    uint32_t u32Sum;
+    if (fIPv6)
+        u32Sum = RTNetIPv6PseudoChecksum((PCRTNETIPV6)&g_abFrame[pInfo->offHdr1]);
+    else
+        u32Sum = RTNetIPv4PseudoChecksum((PCRTNETIPV4)&g_abFrame[pInfo->offHdr1]);
+    *(uint16_t *)&g_abFrame[pInfo->offHdr2 + offSum] = ~RTNetIPv4FinalizeChecksum(u32Sum);
+}
+
+
+/**
+ * A GSO frame from the guest handed to the kernel in one piece.
+ */
+static void tstFromGso(bool fIPv6)
+{
+    RTTestSubF(g_hTest, "GSO frame to the kernel, %s", fIPv6 ? "IPv6" : "IPv4");
+    TSTFRAME Info;
+    uint32_t const cbPayload = 9 * TST_MSS + 100;
+    tstBuildFrame(fIPv6, false, RTNETIPV4_PROT_TCP, cbPayload, 1000, &Info);
+    /* guests leave the lengths of GSO frames in any state */
+    if (fIPv6)
+        ((PRTNETIPV6)&g_abFrame[Info.offHdr1])->ip6_plen = 0;
+    else
+        ((PRTNETIPV4)&g_abFrame[Info.offHdr1])->ip_len = 0;
+
+    PDMNETWORKGSO Gso;
+    Gso.u8Type      = fIPv6 ? PDMNETWORKGSOTYPE_IPV6_TCP : PDMNETWORKGSOTYPE_IPV4_TCP;
+    Gso.offHdr1     = (uint8_t)Info.offHdr1;
+    Gso.offHdr2     = (uint8_t)Info.offHdr2;
+    Gso.cbHdrsTotal = (uint8_t)Info.cbHdrs;
+    Gso.cbHdrsSeg   = Gso.cbHdrsTotal;
+    Gso.u8Unused    = 0;
+    Gso.cbMaxSeg    = TST_MSS;
+    RTTEST_CHECK_RETV(g_hTest, PDMNetGsoIsValid(&Gso, sizeof(Gso), Info.cbFrame));
+
+    DRVTAPVNETHDR VNetHdr;
+    RT_ZERO(VNetHdr);
+    RTTEST_CHECK_RETV(g_hTest, drvTAPVNetHdrFromGso(&Gso, g_abFrame, Info.cbFrame, &VNetHdr));
+    RTTEST_CHECK(g_hTest, VNetHdr.u8Flags == DRVTAP_VNETHDR_F_NEEDS_CSUM);
+    RTTEST_CHECK(g_hTest, VNetHdr.u8GsoType == (fIPv6 ? DRVTAP_VNETHDR_GSO_TCPV6 : DRVTAP_VNETHDR_GSO_TCPV4));
+    RTTEST_CHECK(g_hTest, VNetHdr.u16HdrLen == Info.cbHdrs);
+    RTTEST_CHECK(g_hTest, VNetHdr.u16GsoSize == TST_MSS);
+    RTTEST_CHECK(g_hTest, VNetHdr.u16CSumStart == Info.offHdr2);
+    RTTEST_CHECK(g_hTest, VNetHdr.u16CSumOffset == 16);
+
+    /* the lengths describe the whole frame */
+    if (fIPv6)
+        RTTEST_CHECK(g_hTest, RT_N2H_U16(((PCRTNETIPV6)&g_abFrame[Info.offHdr1])->ip6_plen) == Info.cbFrame - Info.offHdr2);
+    else
+    {
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&g_abFrame[Info.offHdr1];
+        RTTEST_CHECK(g_hTest, RT_N2H_U16(pIpHdr->ip_len) == Info.cbFrame - Info.offHdr1);
+        RTTEST_CHECK(g_hTest, RTNetIPv4IsHdrValid(pIpHdr, RTNETIPV4_MIN_LEN, Info.cbFrame - Info.offHdr1, true /*fChecksum*/));
+    }
+
+    /* finishing the checksum the way the kernel does must give the right one */
+    RTTEST_CHECK(g_hTest, !tstIsTcpSumOk(g_abFrame, Info.cbFrame, Info.offHdr1, Info.offHdr2, fIPv6));
+    RTTEST_CHECK_RETV(g_hTest, drvTAPVNetHdrCompleteCSum(&VNetHdr, g_abFrame, Info.cbFrame));
+    RTTEST_CHECK(g_hTest, tstIsTcpSumOk(g_abFrame, Info.cbFrame, Info.offHdr1, Info.offHdr2, fIPv6));
+
+    /* the rest is segmented by us */
+    Gso.u8Type = fIPv6 ? PDMNETWORKGSOTYPE_IPV6_UDP : PDMNETWORKGSOTYPE_IPV4_UDP;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrFromGso(&Gso, g_abFrame, Info.cbFrame, &VNetHdr));
+    Gso.u8Type = PDMNETWORKGSOTYPE_IPV4_IPV6_TCP;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrFromGso(&Gso, g_abFrame, Info.cbFrame, &VNetHdr));
+}
+
+
+/**
+ * An ordinary frame passed up with a partial checksum.
+ */
+static void tstCompleteCSum(bool fIPv6, uint8_t bProto, uint32_t cbPayload)
+{
+    RTTestSubF(g_hTest, "Partial checksum, %s %s, %u bytes", fIPv6 ? "IPv6" : "IPv4",
+               bProto == RTNETIPV4_PROT_TCP ? "TCP" : "UDP", cbPayload);
+    TSTFRAME Info;
+    tstBuildFrame(fIPv6, false, bProto, cbPayload, 0x7fffffff, &Info);
+    uint32_t const offSum = bProto == RTNETIPV4_PROT_TCP ? RT_OFFSETOF(RTNETTCP, th_sum) : RT_OFFSETOF(RTNETUDP, uh_sum);
+    tstSetPartialSum(offSum, &Info, fIPv6);
+
+    DRVTAPVNETHDR VNetHdr;
+    RT_ZERO(VNetHdr);
+    VNetHdr.u8Flags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+    VNetHdr.u8GsoType     = DRVTAP_VNETHDR_GSO_NONE;
+    VNetHdr.u16CSumStart  = (uint16_t)Info.offHdr2;
+    VNetHdr.u16CSumOffset = (uint16_t)offSum;
+    RTTEST_CHECK_RETV(g_hTest, drvTAPVNetHdrCompleteCSum(&VNetHdr, g_abFrame, Info.cbFrame));
+
+    if (bProto == RTNETIPV4_PROT_TCP)
+        RTTEST_CHECK(g_hTest, tstIsTcpSumOk(g_abFrame, Info.cbFrame, Info.offHdr1, Info.offHdr2, fIPv6));
+    else if (!fIPv6)
+    {
+        PCRTNETIPV4 pIpHdr  = (PCRTNETIPV4)&g_abFrame[Info.offHdr1];
+        PCRTNETUDP  pUdpHdr = (PCRTNETUDP)&g_abFrame[Info.offHdr2];
+        RTTEST_CHECK(g_hTest, RTNetIPv4IsUDPValid(pIpHdr, pUdpHdr, pUdpHdr + 1, Info.cbFrame - Info.offHdr2, true /*fChecksum*/));
+    }
+    else
+    {
+        PCRTNETUDP pUdpHdr = (PCRTNETUDP)&g_abFrame[Info.offHdr2];
+        uint32_t   u32Sum  = RTNetIPv6PseudoChecksum((PCRTNETIPV6)&g_abFrame[Info.offHdr1]);
+        RTTEST_CHECK(g_hTest, RTNetUDPChecksum(u32Sum, pUdpHdr) == pUdpHdr->uh_sum);
+    }
+
+    /* a checksum field outside the frame leaves it alone */
+    memcpy(g_abCopy, g_abFrame, sizeof(g_abCopy));
+    VNetHdr.u16CSumStart = (uint16_t)(Info.cbFrame - offSum - 1);
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrCompleteCSum(&VNetHdr, g_abFrame, Info.cbFrame));
+    VNetHdr.u16CSumStart  = UINT16_MAX;
+    VNetHdr.u16CSumOffset = UINT16_MAX;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrCompleteCSum(&VNetHdr, g_abFrame, Info.cbFrame));
+    RTTEST_CHECK(g_hTest, memcmp(g_abCopy, g_abFrame, sizeof(g_abCopy)) == 0);
+}
+
+
+/**
+ * A GRO/TSO frame from the kernel: the GSO context and the segments we carve
+ * from it if the device can't take it.
+ */
+static void tstToGso(bool fIPv6, bool fVlan, uint32_t cbPayload)
+{
+    RTTestSubF(g_hTest, "GSO frame from the kernel, %s%s, %u bytes", fIPv6 ? "IPv6" : "IPv4", fVlan ? " VLAN" : "", cbPayload);
+    TSTFRAME Info;
+    uint32_t const uSeq = UINT32_C(0xfffffc00);
+    tstBuildFrame(fIPv6, fVlan, RTNETIPV4_PROT_TCP, cbPayload, uSeq, &Info);
+    tstSetPartialSum(RT_OFFSETOF(RTNETTCP, th_sum), &Info, fIPv6);
+
+    DRVTAPVNETHDR VNetHdr;
+    VNetHdr.u8Flags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+    VNetHdr.u8GsoType     = (fIPv6 ? DRVTAP_VNETHDR_GSO_TCPV6 : DRVTAP_VNETHDR_GSO_TCPV4) | DRVTAP_VNETHDR_GSO_ECN;
+    VNetHdr.u16HdrLen     = 0; /* only a hint */
+    VNetHdr.u16GsoSize    = TST_MSS;
+    VNetHdr.u16CSumStart  = (uint16_t)Info.offHdr2;
+    VNetHdr.u16CSumOffset = RT_OFFSETOF(RTNETTCP, th_sum);
+
+    PDMNETWORKGSO Gso;
+    RTTEST_CHECK_RETV(g_hTest, drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+    RTTEST_CHECK(g_hTest, Gso.u8Type == (fIPv6 ? PDMNETWORKGSOTYPE_IPV6_TCP : PDMNETWORKGSOTYPE_IPV4_TCP));
+    RTTEST_CHECK(g_hTest, Gso.offHdr1 == Info.offHdr1);
+    RTTEST_CHECK(g_hTest, Gso.offHdr2 == Info.offHdr2);
+    RTTEST_CHECK(g_hTest, Gso.cbHdrsTotal == Info.cbHdrs);
+    RTTEST_CHECK(g_hTest, Gso.cbHdrsSeg == Info.cbHdrs);
+    RTTEST_CHECK(g_hTest, Gso.cbMaxSeg == TST_MSS);
+
+    uint8_t        abHdrScratch[256];
+    uint32_t const cSegs = PDMNetGsoCalcSegmentCount(&Gso, Info.cbFrame);
+    RTTEST_CHECK(g_hTest, cSegs == (cbPayload + TST_MSS - 1) / TST_MSS);
+    uint32_t offPayload = 0;
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        uint32_t cbSegFrame;
+        uint8_t *pbSeg = (uint8_t *)PDMNetGsoCarveSegmentQD(&Gso, g_abFrame, Info.cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        uint32_t const cbSegPayload = cbSegFrame - Info.cbHdrs;
+        RTTEST_CHECK(g_hTest, cbSegPayload == RT_MIN(TST_MSS, cbPayload - offPayload));
+        RTTEST_CHECK_MSG(g_hTest, tstIsTcpSumOk(pbSeg, cbSegFrame, Info.offHdr1, Info.offHdr2, fIPv6),
+                         (g_hTest, "segment %u\n", iSeg));
+        RTTEST_CHECK(g_hTest, RT_N2H_U32(((PCRTNETTCP)&pbSeg[Info.offHdr2])->th_seq) == uSeq + offPayload);
+        RTTEST_CHECK(g_hTest, memcmp(&pbSeg[Info.cbHdrs], &g_abFrame[Info.cbHdrs + offPayload], cbSegPayload) == 0);
+        offPayload += cbSegPayload;
+    }
+    RTTEST_CHECK(g_hTest, offPayload == cbPayload);
+}
+
+
+/**
+ * GSO frames from the kernel we can't make sense of are dropped.
+ */
+static void tstToGsoInvalid(void)
+{
+    RTTestSub(g_hTest, "Invalid GSO frames from the kernel");
+    TSTFRAME Info;
+    tstBuildFrame(false, false, RTNETIPV4_PROT_TCP, 4 * TST_MSS, 1, &Info);
+
+    DRVTAPVNETHDR VNetHdr;
+    VNetHdr.u8Flags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+    VNetHdr.u8GsoType     = DRVTAP_VNETHDR_GSO_TCPV4;
+    VNetHdr.u16HdrLen     = (uint16_t)Info.cbHdrs;
+    VNetHdr.u16GsoSize    = TST_MSS;
+    VNetHdr.u16CSumStart  = (uint16_t)Info.offHdr2;
+    VNetHdr.u16CSumOffset = RT_OFFSETOF(RTNETTCP, th_sum);
+    PDMNETWORKGSO Gso;
+    RTTEST_CHECK_RETV(g_hTest, drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+
+    /* UFO (3) and plain frames are not GSO frames we take */
+    VNetHdr.u8GsoType = 3;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+    VNetHdr.u8GsoType = DRVTAP_VNETHDR_GSO_NONE;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+    VNetHdr.u8GsoType = DRVTAP_VNETHDR_GSO_TCPV4;
+
+    /* nothing to segment by */
+    VNetHdr.u16GsoSize = 0;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+    VNetHdr.u16GsoSize = TST_MSS;
+
+    /* the TCP header must be inside the frame and the headers fit the context */
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.offHdr2 + RTNETTCP_MIN_LEN - 1, &Gso));
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, sizeof(RTNETETHERHDR) - 1, &Gso));
+    VNetHdr.u16CSumStart = 300;
+    ((PRTNETTCP)&g_abFrame[300])->th_off = 8;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+    VNetHdr.u16CSumStart = 200;
+    ((PRTNETTCP)&g_abFrame[200])->th_off = 15;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, g_abFrame, Info.cbFrame, &Gso));
+
+    /* a frame ending before the TCP data offset must not be read beyond */
+    uint32_t const cbShort = Info.offHdr2 + 12;
+    uint8_t *pbShort = (uint8_t *)RTTestGuardedAllocTail(g_hTest, cbShort);
+    RTTEST_CHECK_RETV(g_hTest, pbShort);
+    memcpy(pbShort, g_abFrame, cbShort);
+    VNetHdr.u16CSumStart = (uint16_t)Info.offHdr2;
+    RTTEST_CHECK(g_hTest, !drvTAPVNetHdrToGso(&VNetHdr, pbShort, cbShort, &Gso));
+    RTTestGuardedFree(g_hTest, pbShort);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDrvTAPVNetHdr", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstFromGso(false);
+    tstFromGso(true);
+    tstCompleteCSum(false, RTNETIPV4_PROT_TCP, 1000);
+    tstCompleteCSum(false, RTNETIPV4_PROT_TCP, 999);
+    tstCompleteCSum(true,  RTNETIPV4_PROT_TCP, 1001);
+    tstCompleteCSum(false, RTNETIPV4_PROT_UDP, 513);
+    tstCompleteCSum(true,  RTNETIPV4_PROT_UDP, 512);
+    tstToGso(false, false, 44 * TST_MSS);
+    tstToGso(false, true,  3 * TST_MSS + 7);
+    tstToGso(true,  false, 20 * TST_MSS + 1);
+    tstToGsoInvalid();
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -662,6 +662,76 @@ static void doUnicastTest(PTSTSTATE pThis, bool fHeadGuard)
                       cb, pvBuf, sizeof(s_au16Frame), s_au16Frame);
 }
 
+/**
+ * Receive thread for doRecvWakeupTest, just waits for something to arrive on
+ * the first interface.
+ */
+static DECLCALLBACK(int) tstRecvWakeupThread(RTTHREAD hThreadSelf, void *pvArg)
+{
+    PTSTSTATE pThis = (PTSTSTATE)pvArg;
+    NOREF(hThreadSelf);
+    return IntNetR0IfWait(pThis->hIf0, g_pSession, 30000);
+}
+
+
+/**
+ * Checks that receive wakeups are only signalled when somebody is sleeping in
+ * IntNetR0IfWait, without losing or duplicating any.
+ *
+ * @param   pThis               The test instance.
+ */
+static void doRecvWakeupTest(PTSTSTATE pThis)
+{
+    static uint16_t const s_au16Frame[7] = { /* dst:*/ 0x8086, 0, 0,      /*src:*/0x8086, 0, 1, 0x0800 };
+    PINTNETRINGBUF const  pRecv = &pThis->pBuf0->Recv;
+    uint64_t const        cSkipped = pThis->pBuf0->cStatRecvWakeupsSkipped.c;
+
+    /*
+     * Nobody is waiting, so the signal is skipped.  The next wait must still
+     * return right away, but only once.
+     */
+    RTTESTI_CHECK_RC_RETV(tstIntNetSendBuf(&pThis->pBuf1->Send, pThis->hIf1, g_pSession, s_au16Frame, sizeof(s_au16Frame)),
+                          VINF_SUCCESS);
+    RTTESTI_CHECK(pThis->pBuf0->cStatRecvWakeupsSkipped.c == cSkipped + 1);
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 0), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 0), VERR_TIMEOUT);
+    RTTESTI_CHECK_RETV(IntNetRingHasMoreToRead(pRecv));
+    IntNetRingSkipFrame(pRecv);
+    RTTESTI_CHECK(!IntNetRingHasMoreToRead(pRecv));
+
+    /*
+     * With a thread sleeping on the interface the event must be signalled.
+     */
+    PINTNETIF pIf0 = (PINTNETIF)RTHandleTableLookupWithCtx(g_pIntNet->hHtIfs, pThis->hIf0, g_pSession);
+    RTTESTI_CHECK_RETV(pIf0);
+
+    RTTHREAD hThread;
+    int rc = RTThreadCreate(&hThread, tstRecvWakeupThread, pThis, 0, RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "WAKEUP");
+    if (RT_SUCCESS(rc))
+    {
+        for (uint32_t i = 0; i < 10000 && !ASMAtomicReadU32(&pIf0->cSleepers); i++)
+            RTThreadSleep(1);
+        RTTESTI_CHECK(ASMAtomicReadU32(&pIf0->cSleepers) == 1);
+
+        RTTESTI_CHECK_RC(tstIntNetSendBuf(&pThis->pBuf1->Send, pThis->hIf1, g_pSession, s_au16Frame, sizeof(s_au16Frame)),
+                         VINF_SUCCESS);
+
+        int rcThread = VERR_INTERNAL_ERROR;
+        RTTESTI_CHECK_RC(RTThreadWait(hThread, 10000, &rcThread), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(rcThread, VINF_SUCCESS);
+        RTTESTI_CHECK(pThis->pBuf0->cStatRecvWakeupsSkipped.c == cSkipped + 1);
+        RTTESTI_CHECK_RC(IntNetR0IfWait(pThis->hIf0, g_pSession, 0), VERR_TIMEOUT);
+
+        RTTESTI_CHECK(IntNetRingHasMoreToRead(pRecv));
+        while (IntNetRingHasMoreToRead(pRecv))
+            IntNetRingSkipFrame(pRecv);
+    }
+    else
+        RTTestIFailed("RTThreadCreate failed: %Rrc\n", rc);
+
+    intnetR0IfRelease(pIf0, g_pSession);
+}
+
 static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
 {
 
@@ -706,6 +776,12 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
     doUnicastTest(pThis, false /*fHeadGuard*/);
     doUnicastTest(pThis, true /*fHeadGuard*/);
 
+    /*
+     * Receive wakeups.
+     */
+    RTTestISub("Receive wakeups");
+    doRecvWakeupTest(pThis);
+
     /*
      * Do the big bi-directional transfer test if the basics worked out.
      */
@@ -730,6 +806,447 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
     IntNetR0Term();
 }
 
+/**
+ * Sends a unicast frame from interface @a iSrc to @a pDstMac and checks that
+ * exactly the interfaces in @a fExpect get it, and that they get it unchanged.
+ *
+ * Closed interfaces (INTNET_HANDLE_INVALID) are skipped.
+ */
+static void tstMacHashSendAndCheck(PINTNETIFHANDLE pahIfs, PINTNETBUF *papBufs, PCRTMAC paMacs, uint32_t cIfs,
+                                   uint32_t iSrc, PCRTMAC pDstMac, uint32_t fExpect, const char *pszWhat)
+{
+    static uint32_t s_iSeqNo = 0;
+    uint32_t const  iSeqNo   = ++s_iSeqNo;
+
+    uint8_t abFrame[64];
+    RT_ZERO(abFrame);
+    memcpy(&abFrame[0], pDstMac, sizeof(RTMAC));
+    memcpy(&abFrame[6], &paMacs[iSrc], sizeof(RTMAC));
+    abFrame[12] = 0x08;
+    abFrame[13] = 0x00;
+    memcpy(&abFrame[14], &iSeqNo, sizeof(iSeqNo));
+
+    RTTESTI_CHECK_RC_RETV(tstIntNetSendBuf(&papBufs[iSrc]->Send, pahIfs[iSrc], g_pSession, abFrame, sizeof(abFrame)),
+                          VINF_SUCCESS);
+
+    for (uint32_t i = 0; i < cIfs; i++)
+    {
+        if (pahIfs[i] == INTNET_HANDLE_INVALID)
+            continue;
+
+        uint32_t cFrames = 0;
+        while (IntNetRingHasMoreToRead(&papBufs[i]->Recv))
+        {
+            uint8_t  abRecv[1536];
+            uint32_t cb = IntNetRingGetNextFrameToRead(&papBufs[i]->Recv)->cbFrame;
+            if (cb <= sizeof(abRecv))
+            {
+                IntNetRingReadAndSkipFrame(&papBufs[i]->Recv, abRecv);
+                if (cb != sizeof(abFrame) || memcmp(abRecv, abFrame, sizeof(abFrame)))
+                    RTTestIFailed("%s: interface #%u got the wrong frame: %.*Rhxs\n", pszWhat, i, RT_MIN(cb, 20), abRecv);
+            }
+            else
+            {
+                RTTestIFailed("%s: interface #%u got an oversized frame (%#x bytes)\n", pszWhat, i, cb);
+                IntNetRingSkipFrame(&papBufs[i]->Recv);
+            }
+            cFrames++;
+        }
+
+        uint32_t const cExpected = fExpect & RT_BIT_32(i) ? 1 : 0;
+        if (cFrames != cExpected)
+            RTTestIFailed("%s: interface #%u received %u frames, expected %u\n", pszWhat, i, cFrames, cExpected);
+    }
+}
+
+
+/**
+ * Checks that unicast frames are switched to the right interfaces via the MAC
+ * address hash, including bucket collisions, MAC address changes, interface
+ * (de)activation and removal, and the fallback to the full table scan when
+ * there are promiscuous interfaces or interfaces without a MAC address.
+ */
+static void doMacHashTest(uint32_t cbRecv, uint32_t cbSend)
+{
+    enum { kcIfs = 9, kiLate = 8 };
+    INTNETIFHANDLE  ahIfs[kcIfs];
+    PINTNETBUF      apBufs[kcIfs];
+    RTMAC           aMacs[kcIfs];
+    uint32_t const  fOpen = INTNET_OPEN_FLAGS_PROMISC_ALLOW_CLIENTS | INTNET_OPEN_FLAGS_IF_PROMISC_ALLOW;
+
+    RTTestISub("MAC address hash");
+    RTTESTI_CHECK_RC_RETV(IntNetR0Init(), VINF_SUCCESS);
+
+    /*
+     * Interfaces #1 and #4 thru #7 all land in the same hash bucket.  #7
+     * differs from #1 only in ways the hash folds away, the others are just
+     * the next addresses which happen to hash to the same bucket.  We also
+     * want an unused address in that bucket.
+     */
+    for (uint32_t i = 0; i < kcIfs; i++)
+    {
+        aMacs[i].au16[0] = 0x8086;
+        aMacs[i].au16[1] = 0x5a5a;
+        aMacs[i].au16[2] = (uint16_t)i;
+    }
+    uint32_t const iBucket = intnetR0MacTabHash(&aMacs[1]);
+    RTMAC          MacUnused;
+    uint32_t       iCollide = 4;
+    for (uint32_t u = 0x100; u < 0x10000; u++)
+    {
+        RTMAC Mac = aMacs[1];
+        Mac.au16[2] = (uint16_t)u;
+        if (intnetR0MacTabHash(&Mac) != iBucket)
+            continue;
+        if (iCollide < 7)
+            aMacs[iCollide++] = Mac;
+        else
+        {
+            MacUnused = Mac;
+            iCollide++;
+            break;
+        }
+    }
+    RTTESTI_CHECK_RETV(iCollide == 8);
+    aMacs[7].au16[0] = 0x0a02;
+    aMacs[7].au16[1] = 0x5a5a ^ 0x8086 ^ 0x0a02;
+    aMacs[7].au16[2] = 1;
+    for (uint32_t i = 4; i < 8; i++)
+        RTTESTI_CHECK(intnetR0MacTabHash(&aMacs[i]) == iBucket);
+
+    /*
+     * Open all but the last interface, that one is for checking how
+     * interfaces without a MAC address are dealt with.
+     */
+    for (uint32_t i = 0; i < kcIfs; i++)
+        ahIfs[i] = INTNET_HANDLE_INVALID;
+    for (uint32_t i = 0; i < kiLate; i++)
+    {
+        int rc = IntNetR0Open(g_pSession, "machash", kIntNetTrunkType_None, "", fOpen, cbSend, cbRecv, &ahIfs[i]);
+        if (RT_FAILURE(rc))
+        {
+            RTTestIFailed("IntNetR0Open #%u failed: %Rrc\n", i, rc);
+            break;
+        }
+        RTTESTI_CHECK_RC_BREAK(IntNetR0IfGetBufferPtrs(ahIfs[i], g_pSession, &apBufs[i], NULL), VINF_SUCCESS);
+        RTTESTI_CHECK_RC_BREAK(IntNetR0IfSetMacAddress(ahIfs[i], g_pSession, &aMacs[i]), VINF_SUCCESS);
+        RTTESTI_CHECK_RC_BREAK(IntNetR0IfSetActive(ahIfs[i], g_pSession, true), VINF_SUCCESS);
+    }
+
+    PINTNETNETWORK pNetwork = g_pIntNet ? g_pIntNet->pNetworks : NULL;
+    if (pNetwork && !RTTestIErrorCount())
+    {
+        PINTNETMACTAB pTab = &pNetwork->MacTab;
+        RTTESTI_CHECK(intnetR0MacTabIsHashSufficient(pTab));
+
+        /* Every interface gets its own frames and nothing else. */
+        for (uint32_t i = 0; i < kiLate; i++)
+            tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, i ? 0 : 1, &aMacs[i], RT_BIT_32(i), "exact");
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &MacUnused, 0, "unused address in bucket");
+
+        /* A MAC address change moves the entry to another bucket. */
+        RTMAC const MacOld5 = aMacs[5];
+        aMacs[5].au16[2] ^= 0x8000;
+        RTTESTI_CHECK(intnetR0MacTabHash(&aMacs[5]) != iBucket);
+        RTTESTI_CHECK_RC(IntNetR0IfSetMacAddress(ahIfs[5], g_pSession, &aMacs[5]), VINF_SUCCESS);
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &MacOld5,   0,            "old MAC address");
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[5], RT_BIT_32(5), "new MAC address");
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[4], RT_BIT_32(4), "bucket after MAC change");
+
+        /* Inactive interfaces stay in the hash but must not get anything. */
+        RTTESTI_CHECK_RC(IntNetR0IfSetActive(ahIfs[4], g_pSession, false), VINF_SUCCESS);
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[4], 0,            "inactive");
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[6], RT_BIT_32(6), "bucket with inactive");
+        RTTESTI_CHECK_RC(IntNetR0IfSetActive(ahIfs[4], g_pSession, true), VINF_SUCCESS);
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[4], RT_BIT_32(4), "reactivated");
+
+        /* A promiscuous interface forces the full scan and sees everything. */
+        RTTESTI_CHECK_RC(IntNetR0IfSetPromiscuousMode(ahIfs[2], g_pSession, true), VINF_SUCCESS);
+        RTTESTI_CHECK(!intnetR0MacTabIsHashSufficient(pTab));
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[1],  RT_BIT_32(1) | RT_BIT_32(2), "promiscuous");
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &MacUnused, RT_BIT_32(2),                "promiscuous, unused");
+        RTTESTI_CHECK_RC(IntNetR0IfSetPromiscuousMode(ahIfs[2], g_pSession, false), VINF_SUCCESS);
+        RTTESTI_CHECK(intnetR0MacTabIsHashSufficient(pTab));
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[1], RT_BIT_32(1), "promiscuous off");
+
+        /* So does an active interface which hasn't got a MAC address yet. */
+        RTTESTI_CHECK_RC_OK(IntNetR0Open(g_pSession, "machash", kIntNetTrunkType_None, "", fOpen, cbSend, cbRecv,
+                                         &ahIfs[kiLate]));
+        RTTESTI_CHECK_RC(IntNetR0IfGetBufferPtrs(ahIfs[kiLate], g_pSession, &apBufs[kiLate], NULL), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(IntNetR0IfSetActive(ahIfs[kiLate], g_pSession, true), VINF_SUCCESS);
+        RTTESTI_CHECK(!intnetR0MacTabIsHashSufficient(pTab));
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[1], RT_BIT_32(1) | RT_BIT_32(kiLate), "no MAC address");
+        RTTESTI_CHECK_RC(IntNetR0IfSetMacAddress(ahIfs[kiLate], g_pSession, &aMacs[kiLate]), VINF_SUCCESS);
+        RTTESTI_CHECK(intnetR0MacTabIsHashSufficient(pTab));
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[1],      RT_BIT_32(1),      "MAC address set");
+        tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, 0, &aMacs[kiLate], RT_BIT_32(kiLate), "MAC address set, self");
+
+        /* Removing interfaces moves the table entries around; the hash must follow. */
+        RTTESTI_CHECK_RC_OK(IntNetR0IfClose(ahIfs[6], g_pSession));
+        ahIfs[6] = INTNET_HANDLE_INVALID;
+        RTTESTI_CHECK_RC_OK(IntNetR0IfClose(ahIfs[3], g_pSession));
+        ahIfs[3] = INTNET_HANDLE_INVALID;
+        for (uint32_t i = 0; i < kcIfs; i++)
+            tstMacHashSendAndCheck(ahIfs, apBufs, aMacs, kcIfs, i ? 0 : 1, &aMacs[i],
+                                   ahIfs[i] != INTNET_HANDLE_INVALID ? RT_BIT_32(i) : 0, "after close");
+    }
+
+    for (uint32_t i = 0; i < kcIfs; i++)
+        if (ahIfs[i] != INTNET_HANDLE_INVALID)
+            RTTESTI_CHECK_RC_OK(IntNetR0IfClose(ahIfs[i], g_pSession));
+    RTTESTI_CHECK(IntNetR0GetNetworkCount() == 0);
+    IntNetR0Term();
+}
+
+
+/**
+ * Checks the network layer address hash used for the level-3 switching on
+ * shared MAC networks: lookups, collisions, stale entry deletion, cache
+ * overflow and interface removal.
+ */
+static void doAddrHashTest(uint32_t cbRecv, uint32_t cbSend)
+{
+    RTTestISub("Address hash");
+    RTTESTI_CHECK_RC_RETV(IntNetR0Init(), VINF_SUCCESS);
+
+    INTNETIFHANDLE  ahIfs[2] = { INTNET_HANDLE_INVALID, INTNET_HANDLE_INVALID };
+    PINTNETIF       apIfs[2] = { NULL, NULL };
+    for (uint32_t i = 0; i < RT_ELEMENTS(ahIfs); i++)
+    {
+        int rc = IntNetR0Open(g_pSession, "addrhash", kIntNetTrunkType_None, "", INTNET_OPEN_FLAGS_SHARED_MAC_ON_WIRE,
+                              cbSend, cbRecv, &ahIfs[i]);
+        if (RT_FAILURE(rc))
+        {
+            RTTestIFailed("IntNetR0Open #%u failed: %Rrc\n", i, rc);
+            break;
+        }
+        RTMAC Mac;
+        Mac.au16[0] = 0x8086;
+        Mac.au16[1] = 0xadd0;
+        Mac.au16[2] = (uint16_t)i;
+        RTTESTI_CHECK_RC_BREAK(IntNetR0IfSetMacAddress(ahIfs[i], g_pSession, &Mac), VINF_SUCCESS);
+        RTTESTI_CHECK_RC_BREAK(IntNetR0IfSetActive(ahIfs[i], g_pSession, true), VINF_SUCCESS);
+        apIfs[i] = (PINTNETIF)RTHandleTableLookupWithCtx(g_pIntNet->hHtIfs, ahIfs[i], g_pSession);
+        RTTESTI_CHECK_BREAK(apIfs[i]);
+    }
+
+    if (!RTTestIErrorCount())
+    {
+        PINTNETNETWORK   pNetwork = apIfs[0]->pNetwork;
+        PINTNETADDRCACHE pCache0  = &apIfs[0]->aAddrCache[kIntNetAddrType_IPv4];
+        PINTNETADDRCACHE pCache1  = &apIfs[1]->aAddrCache[kIntNetAddrType_IPv4];
+        RTTESTI_CHECK(pCache0->cEntriesAlloc > 0 && pCache0->cEntriesAlloc < 64);
+
+        /*
+         * Pick eight addresses which collide in one bucket plus an unused one,
+         * and eight ordinary ones.
+         */
+        RTNETADDRU aCollide[9];
+        RTNETADDRU aPlain[8];
+        RT_ZERO(aCollide);
+        RT_ZERO(aPlain);
+        aCollide[0].IPv4.u = RT_H2N_U32_C(0x0a000001);
+        uint32_t const iBucket   = intnetR0AddrHash(&aCollide[0], kIntNetAddrType_IPv4, sizeof(RTNETADDRIPV4));
+        uint32_t       cCollide  = 1;
+        for (uint32_t u = 0x0a000002; u < 0x0a100000 && cCollide < RT_ELEMENTS(aCollide); u++)
+        {
+            RTNETADDRU Addr;
+            RT_ZERO(Addr);
+            Addr.IPv4.u = RT_H2N_U32(u);
+            if (intnetR0AddrHash(&Addr, kIntNetAddrType_IPv4, sizeof(RTNETADDRIPV4)) == iBucket)
+                aCollide[cCollide++] = Addr;
+        }
+        RTTESTI_CHECK(cCollide == RT_ELEMENTS(aCollide));
+        for (uint32_t i = 0; i < RT_ELEMENTS(aPlain); i++)
+            aPlain[i].IPv4.u = RT_H2N_U32(UINT32_C(0xc0a80001) + i);
+
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            intnetR0IfAddrCacheAdd(apIfs[0], pCache0, &aCollide[i], sizeof(RTNETADDRIPV4), "tst");
+            intnetR0IfAddrCacheAdd(apIfs[1], pCache1, &aPlain[i],   sizeof(RTNETADDRIPV4), "tst");
+        }
+
+#define TST_ADDR_LOOKUP_CHECK(a_Addr, a_pIfExpect) \
+        do { \
+            PINTNETIF pIfFound = intnetR0NetworkAddrCacheLookupIf(pNetwork, &(a_Addr), kIntNetAddrType_IPv4, sizeof(RTNETADDRIPV4)); \
+            if (pIfFound != (a_pIfExpect)) \
+                RTTestIFailed("line %u: %RTnaipv4 -> %p, expected %p\n", __LINE__, (a_Addr).IPv4, pIfFound, (a_pIfExpect)); \
+            if (pIfFound) \
+                intnetR0BusyDecIf(pIfFound); \
+        } while (0)
+
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            TST_ADDR_LOOKUP_CHECK(aCollide[i], apIfs[0]);
+            TST_ADDR_LOOKUP_CHECK(aPlain[i],   apIfs[1]);
+        }
+        TST_ADDR_LOOKUP_CHECK(aCollide[8], (PINTNETIF)NULL);
+
+        /*
+         * An address showing up on the other interface: the stale entry goes
+         * away, the new one stays.  Then delete it from the whole network.
+         */
+        intnetR0IfAddrCacheAdd(apIfs[1], pCache1, &aCollide[3], sizeof(RTNETADDRIPV4), "tst");
+        intnetR0NetworkAddrCacheDeleteMinusIf(pNetwork, apIfs[1], &aCollide[3], kIntNetAddrType_IPv4, sizeof(RTNETADDRIPV4), "tst");
+        RTTESTI_CHECK(intnetR0IfAddrCacheLookup(pCache0, &aCollide[3], sizeof(RTNETADDRIPV4)) < 0);
+        TST_ADDR_LOOKUP_CHECK(aCollide[3], apIfs[1]);
+        TST_ADDR_LOOKUP_CHECK(aCollide[4], apIfs[0]);
+
+        intnetR0NetworkAddrCacheDelete(pNetwork, &aCollide[3], kIntNetAddrType_IPv4, sizeof(RTNETADDRIPV4), "tst");
+        RTTESTI_CHECK(intnetR0IfAddrCacheLookup(pCache1, &aCollide[3], sizeof(RTNETADDRIPV4)) < 0);
+        TST_ADDR_LOOKUP_CHECK(aCollide[3], (PINTNETIF)NULL);
+        TST_ADDR_LOOKUP_CHECK(aCollide[2], apIfs[0]);
+
+        /*
+         * Overflow the cache of the first interface.  Whatever drops out of
+         * the cache must drop out of the hash as well.
+         */
+        uint32_t const cExtra = pCache0->cEntriesAlloc + 8;
+        for (uint32_t i = 0; i < cExtra; i++)
+        {
+            RTNETADDRU Addr;
+            RT_ZERO(Addr);
+            Addr.IPv4.u = RT_H2N_U32(UINT32_C(0xac100001) + i);
+            intnetR0IfAddrCacheAdd(apIfs[0], pCache0, &Addr, sizeof(RTNETADDRIPV4), "tst");
+        }
+        RTTESTI_CHECK(pCache0->cEntries == pCache0->cEntriesAlloc);
+        for (uint32_t i = 0; i < cExtra; i++)
+        {
+            RTNETADDRU Addr;
+            RT_ZERO(Addr);
+            Addr.IPv4.u = RT_H2N_U32(UINT32_C(0xac100001) + i);
+            TST_ADDR_LOOKUP_CHECK(Addr, i >= cExtra - pCache0->cEntriesAlloc ? apIfs[0] : (PINTNETIF)NULL);
+        }
+        for (uint32_t i = 0; i < 8; i++)
+            TST_ADDR_LOOKUP_CHECK(aCollide[i], (PINTNETIF)NULL);
+
+        /*
+         * Closing an interface takes all its addresses out of the hash.
+         */
+        intnetR0IfAddrCacheAdd(apIfs[0], pCache0, &aCollide[5], sizeof(RTNETADDRIPV4), "tst");
+        TST_ADDR_LOOKUP_CHECK(aCollide[5], apIfs[0]);
+        intnetR0IfRelease(apIfs[0], g_pSession);
+        apIfs[0] = NULL;
+        RTTESTI_CHECK_RC_OK(IntNetR0IfClose(ahIfs[0], g_pSession));
+        ahIfs[0] = INTNET_HANDLE_INVALID;
+        TST_ADDR_LOOKUP_CHECK(aCollide[5], (PINTNETIF)NULL);
+        for (uint32_t i = 0; i < 8; i++)
+            TST_ADDR_LOOKUP_CHECK(aPlain[i], apIfs[1]);
+#undef TST_ADDR_LOOKUP_CHECK
+    }
+
+    for (uint32_t i = 0; i < RT_ELEMENTS(ahIfs); i++)
+    {
+        if (apIfs[i])
+            intnetR0IfRelease(apIfs[i], g_pSession);
+        if (ahIfs[i] != INTNET_HANDLE_INVALID)
+            RTTESTI_CHECK_RC_OK(IntNetR0IfClose(ahIfs[i], g_pSession));
+    }
+    RTTESTI_CHECK(IntNetR0GetNetworkCount() == 0);
+    IntNetR0Term();
+}
+
+/**
+ * Measures how the cost of switching a unicast frame scales with the number of
+ * interfaces attached to the network.
+ *
+ * Interface 0 sends to the other interfaces in turn and the receiving ring is
+ * drained right away, so the figures are dominated by the switching and not
+ * by ring buffer overflows.
+ */
+static void doSwitchScalingBenchmark(uint32_t cbRecv, uint32_t cbSend)
+{
+    static uint32_t const s_acIfs[] = { 2, 8, 32, 128, 512 };
+    uint32_t const        cFrames   = 200000;
+
+    RTTestISub("IntNetR0Init");
+    RTTESTI_CHECK_RC_RETV(IntNetR0Init(), VINF_SUCCESS);
+
+    for (unsigned iTest = 0; iTest < RT_ELEMENTS(s_acIfs); iTest++)
+    {
+        uint32_t const cIfs = s_acIfs[iTest];
+        RTTestISubF("switch scaling, %u interfaces", cIfs);
+
+        PINTNETIFHANDLE pahIfs  = (PINTNETIFHANDLE)RTMemAllocZ(sizeof(pahIfs[0]) * cIfs);
+        PINTNETBUF     *papBufs = (PINTNETBUF *)RTMemAllocZ(sizeof(papBufs[0]) * cIfs);
+        RTTESTI_CHECK_RETV(pahIfs && papBufs);
+
+        /*
+         * Open the interfaces and give them distinct MAC addresses.
+         */
+        uint32_t cOpened = 0;
+        for (uint32_t i = 0; i < cIfs; i++)
+        {
+            pahIfs[i] = INTNET_HANDLE_INVALID;
+            int rc = IntNetR0Open(g_pSession, "scaling", kIntNetTrunkType_None, "", 0 /*fFlags*/, cbSend, cbRecv, &pahIfs[i]);
+            if (RT_FAILURE(rc))
+            {
+                RTTestIFailed("IntNetR0Open #%u failed: %Rrc\n", i, rc);
+                break;
+            }
+            cOpened = i + 1;
+            RTTESTI_CHECK_RC_BREAK(IntNetR0IfGetBufferPtrs(pahIfs[i], g_pSession, &papBufs[i], NULL), VINF_SUCCESS);
+
+            RTMAC Mac;
+            Mac.au16[0] = 0x8086;
+            Mac.au16[1] = 0x5a5a;
+            Mac.au16[2] = (uint16_t)i;
+            RTTESTI_CHECK_RC_BREAK(IntNetR0IfSetMacAddress(pahIfs[i], g_pSession, &Mac), VINF_SUCCESS);
+            RTTESTI_CHECK_RC_BREAK(IntNetR0IfSetActive(pahIfs[i], g_pSession, true), VINF_SUCCESS);
+        }
+
+        /*
+         * Send the frames from interface 0 round robin to the others.
+         */
+        if (cOpened == cIfs && !RTTestIErrorCount())
+        {
+            uint16_t au16Frame[32];
+            RT_ZERO(au16Frame);
+            au16Frame[0] = 0x8086;   /* dst */
+            au16Frame[1] = 0x5a5a;
+            au16Frame[3] = 0x8086;   /* src */
+            au16Frame[4] = 0x5a5a;
+            au16Frame[5] = 0;
+            au16Frame[6] = 0x0800;
+
+            uint32_t       cReceived = 0;
+            uint64_t const nsStart   = RTTimeNanoTS();
+            for (uint32_t iFrame = 0; iFrame < cFrames; iFrame++)
+            {
+                uint32_t const iDst = 1 + iFrame % (cIfs - 1);
+                au16Frame[2] = (uint16_t)iDst;
+                int rc = tstIntNetSendBuf(&papBufs[0]->Send, pahIfs[0], g_pSession, au16Frame, sizeof(au16Frame));
+                if (RT_FAILURE(rc))
+                {
+                    RTTestIFailed("iFrame=%u: %Rrc\n", iFrame, rc);
+                    break;
+                }
+                while (IntNetRingHasMoreToRead(&papBufs[iDst]->Recv))
+                {
+                    IntNetRingSkipFrame(&papBufs[iDst]->Recv);
+                    cReceived++;
+                }
+            }
+            uint64_t const cNsElapsed = RTTimeNanoTS() - nsStart;
+
+            RTTESTI_CHECK_MSG(cReceived == cFrames, ("cReceived=%u cFrames=%u\n", cReceived, cFrames));
+            RTTestIValueF(cNsElapsed / cFrames, RTTESTUNIT_NS_PER_FRAME, "%u interfaces", cIfs);
+        }
+
+        /*
+         * Close them again.
+         */
+        for (uint32_t i = 0; i < cOpened; i++)
+            RTTESTI_CHECK_RC_OK(IntNetR0IfClose(pahIfs[i], g_pSession));
+        RTTESTI_CHECK(IntNetR0GetNetworkCount() == 0);
+
+        RTMemFree(papBufs);
+        RTMemFree(pahIfs);
+    }
+
+    IntNetR0Term();
+}
+
 
 int main(int argc, char **argv)
 {
@@ -779,6 +1296,10 @@ int main(int argc, char **argv)
     TSTSTATE This;
     RT_ZERO(This);
     doTest(&This, cbRecv, cbSend);
+    doMacHashTest(cbRecv, cbSend);
+    doAddrHashTest(cbRecv, cbSend);
+    if (!RTTestErrorCount(g_hTest))
+        doSwitchScalingBenchmark(cbRecv, cbSend);
 
     return RTTestSummaryAndDestroy(g_hTest);
 }
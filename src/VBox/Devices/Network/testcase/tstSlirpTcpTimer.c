@@ -0,0 +1,436 @@
+/* $Id: tstSlirpTcpTimer.c $ */
+/** @file
+ * NAT - TCP timer wheel and delayed ACK list testcase.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <slirp.h>
+
+#include <iprt/test.h>
+#include <iprt/mem.h>
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A connection as seen by the timer code plus what the callbacks below
+ * recorded for it.
+ */
+typedef struct TSTTCB
+{
+    /** The control block, must come first. */
+    struct tcpcb    Tcb;
+    /** tcp_now when tcp_close or tcp_drop was called, 0 if not yet. */
+    uint32_t        uGoneAt;
+    /** Whether it was dropped rather than closed. */
+    bool            fDropped;
+    /** Number of tcp_output calls. */
+    unsigned        cOutputs;
+    /** Number of persist timeouts and the ticks they happened at. */
+    unsigned        cPersists;
+    uint32_t        auPersistAt[16];
+} TSTTCB;
+typedef TSTTCB *PTSTTCB;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+/** The NAT state the timer code is run against. */
+static PNATState g_pData = NULL;
+/** The persist interval tcp_setpersist re-arms with. */
+static int      g_cPersistTicks = 5;
+
+
+/*
+ * The timer code, built against the stand-ins below instead of the
+ * rest of the TCP code.
+ */
+#include "../slirp/tcp_timer.c"
+
+
+/*******************************************************************************
+*   Stand-ins for the TCP code the timers call back into                       *
+*******************************************************************************/
+
+static struct tcpcb *tstTcbGone(PNATState pData, struct tcpcb *tp, bool fDropped)
+{
+    PTSTTCB pTst = (PTSTTCB)tp;
+    RTTEST_CHECK_MSG(g_hTest, pTst->uGoneAt == 0, (g_hTest, "tp=%p went away twice\n", tp));
+    pTst->uGoneAt  = tcp_now;
+    pTst->fDropped = fDropped;
+    tcp_canceltimers(tp);
+    tcp_timer_unlink(tp);
+    TCP_DELACK_CLEAR(tp);
+    tp->t_state = TCPS_CLOSED;
+    return NULL;
+}
+
+struct tcpcb *tcp_close(PNATState pData, register struct tcpcb *tp)
+{
+    return tstTcbGone(pData, tp, false);
+}
+
+struct tcpcb *tcp_drop(PNATState pData, struct tcpcb *tp, int err)
+{
+    NOREF(err);
+    return tstTcbGone(pData, tp, true);
+}
+
+int tcp_output(PNATState pData, register struct tcpcb *tp)
+{
+    NOREF(pData);
+    RTTEST_CHECK(g_hTest, tp->t_state != TCPS_CLOSED);
+    ((PTSTTCB)tp)->cOutputs++;
+    return 0;
+}
+
+void tcp_setpersist(PNATState pData, register struct tcpcb *tp)
+{
+    PTSTTCB pTst = (PTSTTCB)tp;
+    if (pTst->cPersists < RT_ELEMENTS(pTst->auPersistAt))
+        pTst->auPersistAt[pTst->cPersists] = tcp_now;
+    pTst->cPersists++;
+    TCP_TIMER_ARM(tp, TCPT_PERSIST, g_cPersistTicks);
+}
+
+void tcp_respond(PNATState pData, struct tcpcb *tp, register struct tcpiphdr *ti,
+                 register struct mbuf *m, tcp_seq ack, tcp_seq seq, int flags)
+{
+    NOREF(pData); NOREF(tp); NOREF(ti); NOREF(m); NOREF(ack); NOREF(seq); NOREF(flags);
+}
+
+/*
+ * The mbuf inlines in the slirp headers reference these, the timers must
+ * never get there.
+ */
+void *uma_zalloc_arg(uma_zone_t zone, void *pvArg, int how)
+{
+    NOREF(zone); NOREF(pvArg); NOREF(how);
+    RTTestFailed(g_hTest, "uma_zalloc_arg called\n");
+    return NULL;
+}
+
+void uma_zfree(uma_zone_t zone, void *pv)
+{
+    NOREF(zone); NOREF(pv);
+    RTTestFailed(g_hTest, "uma_zfree called\n");
+}
+
+void uma_zfree_arg(uma_zone_t zone, void *pv, void *pvArg)
+{
+    NOREF(zone); NOREF(pv); NOREF(pvArg);
+    RTTestFailed(g_hTest, "uma_zfree_arg called\n");
+}
+
+uint32_t *uma_find_refcnt(uma_zone_t zone, void *pv)
+{
+    NOREF(zone); NOREF(pv);
+    RTTestFailed(g_hTest, "uma_find_refcnt called\n");
+    return NULL;
+}
+
+void mb_free_ext(PNATState pData, struct mbuf *m)
+{
+    NOREF(pData); NOREF(m);
+    RTTestFailed(g_hTest, "mb_free_ext called\n");
+}
+
+struct m_tag *m_tag_alloc(u_int32_t uCookie, int iType, int cbLen, int fWait)
+{
+    NOREF(uCookie); NOREF(iType); NOREF(cbLen); NOREF(fWait);
+    RTTestFailed(g_hTest, "m_tag_alloc called\n");
+    return NULL;
+}
+
+struct m_tag *m_tag_locate(struct mbuf *m, u_int32_t uCookie, int iType, struct m_tag *pStart)
+{
+    NOREF(m); NOREF(uCookie); NOREF(iType); NOREF(pStart);
+    RTTestFailed(g_hTest, "m_tag_locate called\n");
+    return NULL;
+}
+
+
+/*******************************************************************************
+*   Helpers                                                                    *
+*******************************************************************************/
+
+/**
+ * Resets the NAT state to an empty wheel at the given tick.
+ */
+static void tstReset(uint32_t uNow)
+{
+    PNATState pData = g_pData;
+    unsigned i;
+
+    RT_BZERO(pData, sizeof(*pData));
+    for (i = 0; i < TCP_TIMER_WHEEL_SIZE; i++)
+        LIST_INIT(&pData->tcp_timer_wheel[i]);
+    LIST_INIT(&pData->tcp_delack_list);
+    tcp_now = uNow;
+}
+
+/**
+ * Creates a connection in the given state, idle since now.
+ */
+static PTSTTCB tstTcbCreate(int iState)
+{
+    PNATState pData = g_pData;
+    PTSTTCB pTst = (PTSTTCB)RTMemAllocZ(sizeof(*pTst));
+    RTTEST_CHECK_RET(g_hTest, pTst, NULL);
+    pTst->Tcb.t_state = iState;
+    pTst->Tcb.t_maxseg = 1460;
+    pTst->Tcb.t_template.ti_src.s_addr = RT_H2N_U32_C(0x0a00020f);
+    pTst->Tcb.t_template.ti_dst.s_addr = RT_H2N_U32_C(0x0a000202);
+    TCP_IDLE_RESET(&pTst->Tcb);
+    return pTst;
+}
+
+/**
+ * Runs the slow timeout for the given number of ticks.
+ */
+static void tstRunTicks(uint32_t cTicks)
+{
+    while (cTicks-- > 0)
+        tcp_slowtimo(g_pData);
+}
+
+/**
+ * Counts the wheel entries, each connection must be on it at most once.
+ */
+static unsigned tstWheelCount(void)
+{
+    PNATState pData = g_pData;
+    struct tcpcb *tp;
+    unsigned cEntries = 0;
+    unsigned i;
+
+    for (i = 0; i < TCP_TIMER_WHEEL_SIZE; i++)
+        LIST_FOREACH(tp, &pData->tcp_timer_wheel[i], t_wheel)
+            cEntries++;
+    return cEntries;
+}
+
+
+/*******************************************************************************
+*   Tests                                                                      *
+*******************************************************************************/
+
+/**
+ * TIME_WAIT connections must be closed on the very tick their 2MSL timer
+ * runs out, also when that is one or more wheel revolutions away.
+ */
+static void tstExpiry(uint32_t uStart)
+{
+    static const int s_acTicks[] =
+    {
+        1, 2, 7, TCP_TIMER_WHEEL_SIZE - 1, TCP_TIMER_WHEEL_SIZE, TCP_TIMER_WHEEL_SIZE + 1,
+        2 * TCP_TIMER_WHEEL_SIZE + 3, 1500, TCPTV_MSL * 2
+    };
+    PNATState pData = g_pData;
+    PTSTTCB apTcbs[RT_ELEMENTS(s_acTicks)];
+    unsigned i;
+
+    tstReset(uStart);
+    for (i = 0; i < RT_ELEMENTS(s_acTicks); i++)
+    {
+        apTcbs[i] = tstTcbCreate(TCPS_TIME_WAIT);
+        if (!apTcbs[i])
+            return;
+        TCP_TIMER_ARM(&apTcbs[i]->Tcb, TCPT_2MSL, s_acTicks[i]);
+    }
+    RTTEST_CHECK(g_hTest, tstWheelCount() == RT_ELEMENTS(s_acTicks));
+
+    tstRunTicks(3 * TCP_TIMER_WHEEL_SIZE);
+    for (i = 0; i < RT_ELEMENTS(s_acTicks); i++)
+    {
+        RTTEST_CHECK_MSG(g_hTest, apTcbs[i]->uGoneAt == uStart + s_acTicks[i] && !apTcbs[i]->fDropped,
+                         (g_hTest, "%d ticks from %#x: gone at %#x (dropped=%RTbool)\n",
+                          s_acTicks[i], uStart, apTcbs[i]->uGoneAt, apTcbs[i]->fDropped));
+        RTMemFree(apTcbs[i]);
+    }
+    RTTEST_CHECK(g_hTest, tstWheelCount() == 0);
+}
+
+/**
+ * Moving a timer earlier or later, stopping it and re-arming it from its
+ * own handler, with another timer of the same connection running.
+ */
+static void tstRearm(uint32_t uStart)
+{
+    PNATState pData = g_pData;
+    PTSTTCB pEarlier, pLater, pStopped, pPersist;
+    unsigned i;
+
+    tstReset(uStart);
+    /* Not yet established, so the keepalive timer drops the connection. */
+    pEarlier = tstTcbCreate(TCPS_SYN_SENT);
+    pLater   = tstTcbCreate(TCPS_SYN_SENT);
+    pStopped = tstTcbCreate(TCPS_SYN_SENT);
+    pPersist = tstTcbCreate(TCPS_TIME_WAIT);
+    if (!pEarlier || !pLater || !pStopped || !pPersist)
+        return;
+    TCP_TIMER_ARM(&pEarlier->Tcb, TCPT_KEEP, 300);
+    TCP_TIMER_ARM(&pLater->Tcb,   TCPT_KEEP, 50);
+    TCP_TIMER_ARM(&pStopped->Tcb, TCPT_KEEP, 20);
+    g_cPersistTicks = 5;
+    TCP_TIMER_ARM(&pPersist->Tcb, TCPT_PERSIST, g_cPersistTicks);
+    TCP_TIMER_ARM(&pPersist->Tcb, TCPT_2MSL, 2 * TCP_TIMER_WHEEL_SIZE + 2);
+
+    tstRunTicks(10);
+    TCP_TIMER_ARM(&pEarlier->Tcb, TCPT_KEEP, 40);
+    TCP_TIMER_ARM(&pLater->Tcb,   TCPT_KEEP, 600);
+    TCP_TIMER_DISARM(&pStopped->Tcb, TCPT_KEEP);
+
+    tstRunTicks(3 * TCP_TIMER_WHEEL_SIZE);
+    RTTEST_CHECK_MSG(g_hTest, pEarlier->uGoneAt == uStart + 50 && pEarlier->fDropped,
+                     (g_hTest, "earlier: gone at %u\n", pEarlier->uGoneAt));
+    RTTEST_CHECK_MSG(g_hTest, pLater->uGoneAt == uStart + 610 && pLater->fDropped,
+                     (g_hTest, "later: gone at %u\n", pLater->uGoneAt));
+    RTTEST_CHECK_MSG(g_hTest, pStopped->uGoneAt == 0,
+                     (g_hTest, "stopped: gone at %u\n", pStopped->uGoneAt));
+
+    /* The persist timer kept going every 5 ticks until TIME_WAIT ran out. */
+    RTTEST_CHECK_MSG(g_hTest, pPersist->uGoneAt == uStart + 2 * TCP_TIMER_WHEEL_SIZE + 2 && !pPersist->fDropped,
+                     (g_hTest, "persist: gone at %u\n", pPersist->uGoneAt));
+    RTTEST_CHECK_MSG(g_hTest, pPersist->cPersists == (2 * TCP_TIMER_WHEEL_SIZE + 2) / 5,
+                     (g_hTest, "persist: %u timeouts\n", pPersist->cPersists));
+    RTTEST_CHECK(g_hTest, pPersist->cOutputs == pPersist->cPersists);
+    for (i = 0; i < RT_MIN(pPersist->cPersists, RT_ELEMENTS(pPersist->auPersistAt)); i++)
+        RTTEST_CHECK_MSG(g_hTest, pPersist->auPersistAt[i] == uStart + 5 * (i + 1),
+                         (g_hTest, "persist #%u at %u\n", i, pPersist->auPersistAt[i]));
+
+    /* Only the stopped connection is still around, and off the wheel. */
+    RTTEST_CHECK(g_hTest, tstWheelCount() == 0);
+    tcp_timer_unlink(&pStopped->Tcb);
+    RTMemFree(pEarlier);
+    RTMemFree(pLater);
+    RTMemFree(pStopped);
+    RTMemFree(pPersist);
+}
+
+/**
+ * Established connections with the keepalive timer running get probed and
+ * re-armed rather than dropped, a connection without any timer is never
+ * looked at.
+ */
+static void tstKeepalive(void)
+{
+    PNATState pData = g_pData;
+    PTSTTCB pEst = tstTcbCreate(TCPS_ESTABLISHED);
+    PTSTTCB pIdle = tstTcbCreate(TCPS_ESTABLISHED);
+    if (!pEst || !pIdle)
+        return;
+
+    tstReset(UINT32_MAX - 100);
+    TCP_IDLE_RESET(&pEst->Tcb);
+    TCP_TIMER_ARM(&pEst->Tcb, TCPT_KEEP, 200);
+    tstRunTicks(199);
+    RTTEST_CHECK(g_hTest, tcpstat.tcps_keeptimeo == 0);
+    tstRunTicks(1);
+    RTTEST_CHECK(g_hTest, tcpstat.tcps_keeptimeo == 1);
+    RTTEST_CHECK(g_hTest, pEst->uGoneAt == 0);
+    RTTEST_CHECK(g_hTest, pEst->Tcb.t_timer[TCPT_KEEP]
+                 == (uint32_t)(UINT32_MAX - 100 + 200 + (so_options ? tcp_keepintvl : tcp_keepidle)));
+    RTTEST_CHECK(g_hTest, tstWheelCount() == 1);
+    RTTEST_CHECK(g_hTest, pIdle->Tcb.t_wheel.le_prev == NULL);
+    RTTEST_CHECK(g_hTest, pIdle->cOutputs == 0);
+
+    /* A stopped timer leaves its wheel entry behind until the old deadline. */
+    tcp_canceltimers(&pEst->Tcb);
+    tstRunTicks(so_options ? tcp_keepintvl : tcp_keepidle);
+    RTTEST_CHECK(g_hTest, tstWheelCount() == 0);
+    RTTEST_CHECK(g_hTest, tcpstat.tcps_keeptimeo == 1);
+    RTMemFree(pEst);
+    RTMemFree(pIdle);
+}
+
+/**
+ * Delayed ACKs go out on the next fast timeout, once per connection.
+ */
+static void tstDelAck(void)
+{
+    PNATState pData = g_pData;
+    PTSTTCB apTcbs[3];
+    PTSTTCB pClosed;
+    unsigned i;
+
+    tstReset(42);
+    for (i = 0; i < RT_ELEMENTS(apTcbs); i++)
+    {
+        apTcbs[i] = tstTcbCreate(TCPS_ESTABLISHED);
+        if (!apTcbs[i])
+            return;
+        TCP_DELACK_SET(&apTcbs[i]->Tcb);
+    }
+    TCP_DELACK_SET(&apTcbs[1]->Tcb);
+    pClosed = tstTcbCreate(TCPS_ESTABLISHED);
+    if (!pClosed)
+        return;
+    TCP_DELACK_SET(&pClosed->Tcb);
+    tcp_close(pData, &pClosed->Tcb);
+
+    tcp_fasttimo(pData);
+    RTTEST_CHECK(g_hTest, LIST_EMPTY(&pData->tcp_delack_list));
+    RTTEST_CHECK(g_hTest, tcpstat.tcps_delack == RT_ELEMENTS(apTcbs));
+    for (i = 0; i < RT_ELEMENTS(apTcbs); i++)
+    {
+        RTTEST_CHECK_MSG(g_hTest, apTcbs[i]->cOutputs == 1, (g_hTest, "#%u: %u outputs\n", i, apTcbs[i]->cOutputs));
+        RTTEST_CHECK(g_hTest, (apTcbs[i]->Tcb.t_flags & (TF_ACKNOW | TF_DELACK)) == TF_ACKNOW);
+    }
+    RTTEST_CHECK(g_hTest, pClosed->cOutputs == 0);
+
+    tcp_fasttimo(pData);
+    RTTEST_CHECK(g_hTest, tcpstat.tcps_delack == RT_ELEMENTS(apTcbs));
+    for (i = 0; i < RT_ELEMENTS(apTcbs); i++)
+    {
+        RTTEST_CHECK(g_hTest, apTcbs[i]->cOutputs == 1);
+        RTMemFree(apTcbs[i]);
+    }
+    RTMemFree(pClosed);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstSlirpTcpTimer", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    g_pData = (PNATState)RTMemAllocZ(sizeof(*g_pData));
+    RTTEST_CHECK_RET(g_hTest, g_pData, RTTestSummaryAndDestroy(g_hTest));
+
+    RTTestSub(g_hTest, "Expiry");
+    tstExpiry(0);
+    tstExpiry(12345);
+    RTTestSub(g_hTest, "Expiry across tcp_now wraparound");
+    tstExpiry(UINT32_MAX - 600);
+    RTTestSub(g_hTest, "Re-arming and stopping");
+    tstRearm(1000);
+    tstRearm(UINT32_MAX - 1000);
+    RTTestSub(g_hTest, "Keepalive");
+    tstKeepalive();
+    RTTestSub(g_hTest, "Delayed ACKs");
+    tstDelAck();
+
+    RTMemFree(g_pData);
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -80,6 +80,10 @@
 
 #define AHCI_MAX_ALLOC_TOO_MUCH 20
 
+/** Maximum number of guest pages mapped for a zero copy transfer.
+ * Bigger transfers go through a bounce buffer. */
+#define AHCI_ZERO_COPY_PAGES_MAX    4096
+
  /** The current saved state version. */
 #define AHCI_SAVED_STATE_VERSION                        8
 /** The saved state version before changing the port reset logic in an incompatible way. */
@@ -329,6 +333,14 @@ typedef struct AHCIREQ
     size_t                     cbAlloc;
     /** Number of times we had too much memory allocated for the request. */
     unsigned                   cAllocTooMuch;
+    /** Mapping locks of the guest pages used for a zero copy transfer. */
+    PPGMPAGEMAPLOCK            paPageLocks;
+    /** Segments describing the mapped guest memory of a zero copy transfer. */
+    PRTSGSEG                   paPageSegs;
+    /** Number of entries in the page lock and segment arrays. */
+    unsigned                   cPageLocksMax;
+    /** Number of page mapping locks held. */
+    unsigned                   cPageLocks;
     /** Data dependent on the transfer direction. */
     union
     {
@@ -337,6 +349,11 @@ typedef struct AHCIREQ
         {
             /** Data segment. */
             RTSGSEG            DataSeg;
+            /** Segments passed to the driver, either the data segment
+             * or the mapped guest memory. */
+            PCRTSGSEG          paSeg;
+            /** Number of segments. */
+            unsigned           cSeg;
             /** Post processing callback.
              * If this is set we will use a buffer for the data
              * and the callback returns a buffer with the final data. */
@@ -538,6 +555,8 @@ typedef struct AHCIPort
 
     /** Release statistics: number of DMA commands. */
     STAMCOUNTER                     StatDMA;
+    /** Release statistics: number of DMA commands transferring directly from/to guest memory. */
+    STAMCOUNTER                     StatDMAZeroCopy;
     /** Release statistics: number of bytes written. */
     STAMCOUNTER                     StatBytesWritten;
     /** Release statistics: number of bytes read. */
@@ -5593,9 +5612,162 @@ static size_t ahciCopyFromPrdtl(PPDMDEVINS pDevIns, PAHCIREQ pAhciReq,
     return cbCopied;
 }
 
+/**
+ * Releases the guest pages mapped for a zero copy transfer.
+ *
+ * @returns nothing.
+ * @param   pDevIns     Pointer to the device instance data.
+ * @param   pAhciReq    AHCI request structure.
+ */
+static void ahciReqGuestMemUnmap(PPDMDEVINS pDevIns, PAHCIREQ pAhciReq)
+{
+    for (unsigned i = 0; i < pAhciReq->cPageLocks; i++)
+        PDMDevHlpPhysReleasePageMappingLock(pDevIns, &pAhciReq->paPageLocks[i]);
+    pAhciReq->cPageLocks = 0;
+}
+
+/**
+ * Tries to map the guest buffer described by the PRDTL for a zero copy transfer.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if the buffer can't be mapped, a bounce buffer
+ *          must be used then.
+ * @param   pDevIns     Pointer to the device instance data.
+ * @param   pAhciReq    AHCI request structure.
+ * @param   cbTransfer  Number of bytes to map.
+ */
+static int ahciReqGuestMemMap(PPDMDEVINS pDevIns, PAHCIREQ pAhciReq, size_t cbTransfer)
+{
+    SGLEntry aPrdtlEntries[32];
+    RTGCPHYS GCPhysPrdtl = pAhciReq->GCPhysPrdtl;
+    unsigned cPrdtlEntries = pAhciReq->cPrdtlEntries;
+    unsigned cSegs = 0;
+    size_t cbLeft = cbTransfer;
+    int rc = VINF_SUCCESS;
+
+    Assert(!pAhciReq->cPageLocks);
+
+    if (   !cPrdtlEntries
+        || cbTransfer > (AHCI_ZERO_COPY_PAGES_MAX - 1) * PAGE_SIZE)
+        return VERR_NOT_SUPPORTED;
+
+    do
+    {
+        uint32_t cPrdtlEntriesRead =   (cPrdtlEntries < RT_ELEMENTS(aPrdtlEntries))
+                                     ? cPrdtlEntries
+                                     : RT_ELEMENTS(aPrdtlEntries);
+
+        PDMDevHlpPhysRead(pDevIns, GCPhysPrdtl, &aPrdtlEntries[0], cPrdtlEntriesRead * sizeof(SGLEntry));
+
+        for (uint32_t i = 0; i < cPrdtlEntriesRead && cbLeft && RT_SUCCESS(rc); i++)
+        {
+            RTGCPHYS GCPhys = AHCI_RTGCPHYS_FROM_U32(aPrdtlEntries[i].u32DBAUp, aPrdtlEntries[i].u32DBA);
+            size_t cbEntry = (aPrdtlEntries[i].u32DescInf & SGLENTRY_DESCINF_DBC) + 1;
+
+            cbEntry = RT_MIN(cbEntry, cbLeft);
+            cbLeft -= cbEntry;
+
+            /* Map every page touched by the entry, merging adjacent host mappings. */
+            while (cbEntry)
+            {
+                size_t cbThisPage = RT_MIN(cbEntry, PAGE_SIZE - (GCPhys & PAGE_OFFSET_MASK));
+                void *pv;
+
+                if (pAhciReq->cPageLocks == pAhciReq->cPageLocksMax)
+                {
+                    unsigned cNew = pAhciReq->cPageLocksMax ? pAhciReq->cPageLocksMax * 2 : 64;
+                    if (cNew > AHCI_ZERO_COPY_PAGES_MAX)
+                    {
+                        rc = VERR_NOT_SUPPORTED;
+                        break;
+                    }
+
+                    PPGMPAGEMAPLOCK paPageLocks = (PPGMPAGEMAPLOCK)RTMemRealloc(pAhciReq->paPageLocks, cNew * sizeof(PGMPAGEMAPLOCK));
+                    if (paPageLocks)
+                        pAhciReq->paPageLocks = paPageLocks;
+                    PRTSGSEG paPageSegs = (PRTSGSEG)RTMemRealloc(pAhciReq->paPageSegs, cNew * sizeof(RTSGSEG));
+                    if (paPageSegs)
+                        pAhciReq->paPageSegs = paPageSegs;
+                    if (!paPageLocks || !paPageSegs)
+                    {
+                        rc = VERR_NOT_SUPPORTED;
+                        break;
+                    }
+                    pAhciReq->cPageLocksMax = cNew;
+                }
+
+                /* The device writes to guest memory when reading from the medium. */
+                if (pAhciReq->enmTxDir == AHCITXDIR_READ)
+                    rc = PDMDevHlpPhysGCPhys2CCPtr(pDevIns, GCPhys, 0, &pv,
+                                                   &pAhciReq->paPageLocks[pAhciReq->cPageLocks]);
+                else
+                    rc = PDMDevHlpPhysGCPhys2CCPtrReadOnly(pDevIns, GCPhys, 0, (void const **)&pv,
+                                                           &pAhciReq->paPageLocks[pAhciReq->cPageLocks]);
+                if (RT_FAILURE(rc))
+                {
+                    /* MMIO or otherwise special memory, needs the slow path. */
+                    rc = VERR_NOT_SUPPORTED;
+                    break;
+                }
+                pAhciReq->cPageLocks++;
+
+                if (   cSegs
+                    && (uint8_t *)pAhciReq->paPageSegs[cSegs - 1].pvSeg + pAhciReq->paPageSegs[cSegs - 1].cbSeg == pv)
+                    pAhciReq->paPageSegs[cSegs - 1].cbSeg += cbThisPage;
+                else
+                {
+                    pAhciReq->paPageSegs[cSegs].pvSeg = pv;
+                    pAhciReq->paPageSegs[cSegs].cbSeg = cbThisPage;
+                    cSegs++;
+                }
+
+                GCPhys  += cbThisPage;
+                cbEntry -= cbThisPage;
+            }
+        }
+
+        GCPhysPrdtl   += cPrdtlEntriesRead * sizeof(SGLEntry);
+        cPrdtlEntries -= cPrdtlEntriesRead;
+    } while (cPrdtlEntries && cbLeft && RT_SUCCESS(rc));
+
+    /* A PRDTL too small for the transfer is an overflow, handled by the copy path. */
+    if (RT_SUCCESS(rc) && cbLeft)
+        rc = VERR_NOT_SUPPORTED;
+
+    if (RT_SUCCESS(rc))
+    {
+        pAhciReq->u.Io.paSeg = pAhciReq->paPageSegs;
+        pAhciReq->u.Io.cSeg  = cSegs;
+    }
+    else
+        ahciReqGuestMemUnmap(pDevIns, pAhciReq);
+
+    return rc;
+}
+
+/**
+ * Frees the arrays used for zero copy transfers of the given request.
+ *
+ * @returns nothing.
+ * @param   pAhciReq    The request.
+ */
+static void ahciReqGuestMemFree(PAHCIREQ pAhciReq)
+{
+    Assert(!pAhciReq->cPageLocks);
+
+    RTMemFree(pAhciReq->paPageLocks);
+    RTMemFree(pAhciReq->paPageSegs);
+    pAhciReq->paPageLocks   = NULL;
+    pAhciReq->paPageSegs    = NULL;
+    pAhciReq->cPageLocksMax = 0;
+}
+
 /**
  * Allocate I/O memory and copies the guest buffer for writes.
  *
+ * Requests for the async interface transfer directly from/to guest memory
+ * if possible.
+ *
  * @returns VBox status code.
  * @param   pAhciPort   The AHCI port.
  * @param   pAhciReq    The request state.
@@ -5607,11 +5779,21 @@ static int ahciIoBufAllocate(PAHCIPort pAhciPort, PAHCIREQ pAhciReq, size_t cbTr
               || pAhciReq->enmTxDir == AHCITXDIR_WRITE,
               ("Allocating I/O memory for a non I/O request is not allowed\n"));
 
+    if (   pAhciPort->fAsyncInterface
+        && !pAhciReq->u.Io.pfnPostProcess
+        && RT_SUCCESS(ahciReqGuestMemMap(pAhciPort->pDevInsR3, pAhciReq, cbTransfer)))
+    {
+        STAM_REL_COUNTER_INC(&pAhciPort->StatDMAZeroCopy);
+        return VINF_SUCCESS;
+    }
+
     pAhciReq->u.Io.DataSeg.pvSeg = ahciReqMemAlloc(pAhciPort, pAhciReq, cbTransfer);
     if (!pAhciReq->u.Io.DataSeg.pvSeg)
         return VERR_NO_MEMORY;
 
     pAhciReq->u.Io.DataSeg.cbSeg = cbTransfer;
+    pAhciReq->u.Io.paSeg = &pAhciReq->u.Io.DataSeg;
+    pAhciReq->u.Io.cSeg  = 1;
     if (pAhciReq->enmTxDir == AHCITXDIR_WRITE)
     {
         ahciCopyFromPrdtl(pAhciPort->pDevInsR3, pAhciReq,
@@ -5637,6 +5819,15 @@ static void ahciIoBufFree(PAHCIPort pAhciPort, PAHCIREQ pAhciReq,
               || pAhciReq->enmTxDir == AHCITXDIR_WRITE,
               ("Freeing I/O memory for a non I/O request is not allowed\n"));
 
+    if (pAhciReq->cPageLocks)
+    {
+        /* The data was transferred to the guest directly. */
+        ahciReqGuestMemUnmap(pAhciPort->pDevInsR3, pAhciReq);
+        pAhciReq->u.Io.paSeg = NULL;
+        pAhciReq->u.Io.cSeg  = 0;
+        return;
+    }
+
     if (   pAhciReq->enmTxDir == AHCITXDIR_READ
         && fCopyToGuest)
     {
@@ -5661,6 +5852,9 @@ static void ahciIoBufFree(PAHCIPort pAhciPort, PAHCIREQ pAhciReq,
     ahciReqMemFree(pAhciPort, pAhciReq, false /* fForceFree */);
     pAhciReq->u.Io.DataSeg.pvSeg = NULL;
     pAhciReq->u.Io.DataSeg.cbSeg = 0;
+    pAhciReq->u.Io.paSeg          = NULL;
+    pAhciReq->u.Io.cSeg           = 0;
+    pAhciReq->u.Io.pfnPostProcess = NULL;
 }
 
 
@@ -5677,6 +5871,7 @@ static void ahciR3PortCachedReqsFree(PAHCIPort pAhciPort)
         if (pAhciPort->aCachedTasks[i])
         {
             ahciReqMemFree(pAhciPort, pAhciPort->aCachedTasks[i], true /* fForceFree */);
+            ahciReqGuestMemFree(pAhciPort->aCachedTasks[i]);
             RTMemFree(pAhciPort->aCachedTasks[i]);
             pAhciPort->aCachedTasks[i] = NULL;
         }
@@ -6416,6 +6611,7 @@ static AHCITXDIR ahciProcessCmd(PAHCIPort pAhciPort, PAHCIREQ pAhciReq, uint8_t
                                 ahciIoBufFree(pAhciPort, pTaskErr, false /* fCopyToGuest */);
 
                             /* Finally free the error task state structure because it is completely unused now. */
+                            ahciReqGuestMemFree(pTaskErr);
                             RTMemFree(pTaskErr);
                         }
 
@@ -6779,7 +6975,7 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
                             {
                                 pAhciPort->Led.Asserted.s.fReading = pAhciPort->Led.Actual.s.fReading = 1;
                                 rc = pAhciPort->pDrvBlockAsync->pfnStartRead(pAhciPort->pDrvBlockAsync, pAhciReq->uOffset,
-                                                                             &pAhciReq->u.Io.DataSeg, 1,
+                                                                             pAhciReq->u.Io.paSeg, pAhciReq->u.Io.cSeg,
                                                                              pAhciReq->cbTransfer,
                                                                              pAhciReq);
                             }
@@ -6787,7 +6983,7 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
                             {
                                 pAhciPort->Led.Asserted.s.fWriting = pAhciPort->Led.Actual.s.fWriting = 1;
                                 rc = pAhciPort->pDrvBlockAsync->pfnStartWrite(pAhciPort->pDrvBlockAsync, pAhciReq->uOffset,
-                                                                              &pAhciReq->u.Io.DataSeg, 1,
+                                                                              pAhciReq->u.Io.paSeg, pAhciReq->u.Io.cSeg,
                                                                               pAhciReq->cbTransfer,
                                                                               pAhciReq);
                             }
@@ -8370,6 +8566,8 @@ static DECLCALLBACK(int) ahciR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFG
 
         PDMDevHlpSTAMRegisterF(pDevIns, &pAhciPort->StatDMA, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
                                "Number of DMA transfers.", "/Devices/SATA%d/Port%d/DMA", iInstance, i);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pAhciPort->StatDMAZeroCopy, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of DMA transfers using guest memory directly.", "/Devices/SATA%d/Port%d/DMAZeroCopy", iInstance, i);
         PDMDevHlpSTAMRegisterF(pDevIns, &pAhciPort->StatBytesRead, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
                                "Amount of data read.", "/Devices/SATA%d/Port%d/ReadBytes", iInstance, i);
         PDMDevHlpSTAMRegisterF(pDevIns, &pAhciPort->StatBytesWritten, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
@@ -71,6 +71,13 @@ extern bool DevINIPConfigured(void);
 #define PDMIMEDIAASYNC_2_VBOXDISK(pInterface) \
     ( (PVBOXDISK)((uintptr_t)pInterface - RT_OFFSETOF(VBOXDISK, IMediaAsync)) )
 
+/** Size of the range the online compaction processes in one step. */
+#define DRVVD_COMPACT_CHUNK_SIZE        _1M
+/** How often a step is retried if the disk is busy before it is skipped. */
+#define DRVVD_COMPACT_RETRIES_MAX       100
+/** Time to wait before retrying a step if the disk is busy in milliseconds. */
+#define DRVVD_COMPACT_RETRY_INTERVAL_MS 10
+
 /**
  * VBox disk container, image information, private part.
  */
@@ -181,6 +188,8 @@ typedef struct VBOXDISK
 
     /** I/O interface for a cache image. */
     VDINTERFACEIO            VDIfIoCache;
+    /** Configuration interface for a cache image. */
+    VDINTERFACECONFIG        VDIfConfigCache;
     /** Interface list for the cache image. */
     PVDINTERFACE             pVDIfsCache;
 
@@ -199,6 +208,40 @@ typedef struct VBOXDISK
     /** The secret key interface used to retrieve keys. */
     PPDMISECKEY              pIfSecKey;
     /** @} */
+
+    /** Online compaction
+     * @{ */
+    /** Flag whether online compaction is enabled. */
+    bool                     fCompact;
+    /** Flag whether a compaction pass is in progress. */
+    bool                     fCompactPass;
+    /** The compaction thread. */
+    PPDMTHREAD               pThreadCompact;
+    /** Maximum number of bytes to scan per second. */
+    uint32_t                 cbCompactRate;
+    /** Interval between two compaction passes in seconds. */
+    uint32_t                 cSecCompactInterval;
+    /** Offset the current pass continues at. */
+    uint64_t                 offCompact;
+    /** Number of times the current step was retried because the disk was busy. */
+    unsigned                 cCompactRetries;
+    /** Start timestamp of the current pass in milliseconds. */
+    uint64_t                 tsCompactPassStart;
+    /** Number of bytes reclaimed during the current pass. */
+    uint64_t                 cbCompactPassReclaimed;
+    /** Number of bytes scanned. */
+    STAMCOUNTER              StatCompactBytesScanned;
+    /** Number of bytes the image shrunk. */
+    STAMCOUNTER              StatCompactBytesReclaimed;
+    /** Number of times a step was deferred because of guest I/O. */
+    STAMCOUNTER              StatCompactBusy;
+    /** Number of completed passes. */
+    STAMCOUNTER              StatCompactPasses;
+    /** Progress of the current pass in percent. */
+    uint32_t                 uCompactProgress;
+    /** Scan throughput of the current pass in KB/s. */
+    uint32_t                 cKBCompactThroughput;
+    /** @} */
 } VBOXDISK, *PVBOXDISK;
 
 
@@ -2232,6 +2275,116 @@ static int drvvdSetupFilters(PVBOXDISK pThis, PCFGMNODE pCfg)
     return rc;
 }
 
+/*******************************************************************************
+*   Online compaction                                                          *
+*******************************************************************************/
+
+/**
+ * Walks over the disk in small steps and frees unused blocks of the last image
+ * while the VM is running.
+ *
+ * @returns VBox status code.
+ * @param   pDrvIns     The driver instance.
+ * @param   pThread     The compaction thread.
+ */
+static DECLCALLBACK(int) drvvdCompactThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PVBOXDISK pThis = PDMINS_2_DATA(pDrvIns, PVBOXDISK);
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        if (!pThis->fCompact)
+        {
+            PDMR3ThreadSleep(pThread, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        if (!pThis->fCompactPass)
+        {
+            /* Wait for the next pass, a state change interrupts the wait. */
+            int rc = PDMR3ThreadSleep(pThread, pThis->cSecCompactInterval * RT_MS_1SEC);
+            if (rc != VERR_TIMEOUT)
+                continue;
+
+            pThis->fCompactPass           = true;
+            pThis->offCompact             = 0;
+            pThis->cCompactRetries        = 0;
+            pThis->tsCompactPassStart     = RTTimeMilliTS();
+            pThis->cbCompactPassReclaimed = 0;
+        }
+
+        uint64_t cbDisk = VDGetSize(pThis->pDisk, VD_LAST_IMAGE);
+        size_t cbThis = (size_t)RT_MIN(cbDisk - RT_MIN(pThis->offCompact, cbDisk), DRVVD_COMPACT_CHUNK_SIZE);
+        uint64_t tsStart = RTTimeMilliTS();
+        uint64_t cbReclaimed = 0;
+        int rc = VINF_SUCCESS;
+
+        if (cbThis)
+            rc = VDCompactOnline(pThis->pDisk, pThis->offCompact, cbThis, &cbReclaimed);
+        if (   rc == VERR_TRY_AGAIN
+            && ++pThis->cCompactRetries < DRVVD_COMPACT_RETRIES_MAX)
+        {
+            /* Guest I/O is going on, don't get in the way. */
+            STAM_REL_COUNTER_INC(&pThis->StatCompactBusy);
+            PDMR3ThreadSleep(pThread, DRVVD_COMPACT_RETRY_INTERVAL_MS);
+            continue;
+        }
+        else if (rc == VERR_NOT_SUPPORTED)
+        {
+            LogRel(("VD#%u: Online compaction is not supported by the image format, disabled\n",
+                    pDrvIns->iInstance));
+            pThis->fCompact = false;
+            continue;
+        }
+        else if (RT_FAILURE(rc))
+            Log(("VD#%u: Online compaction of %llu..%llu skipped with %Rrc\n",
+                 pDrvIns->iInstance, pThis->offCompact, pThis->offCompact + cbThis, rc));
+
+        pThis->cCompactRetries         = 0;
+        pThis->offCompact             += cbThis;
+        pThis->cbCompactPassReclaimed += cbReclaimed;
+        STAM_REL_COUNTER_ADD(&pThis->StatCompactBytesScanned, cbThis);
+        STAM_REL_COUNTER_ADD(&pThis->StatCompactBytesReclaimed, cbReclaimed);
+
+        uint64_t cMsPass = RT_MAX(RTTimeMilliTS() - pThis->tsCompactPassStart, 1);
+        pThis->uCompactProgress     = cbDisk ? (uint32_t)(RT_MIN(pThis->offCompact, cbDisk) * 100 / cbDisk) : 100;
+        pThis->cKBCompactThroughput = (uint32_t)(pThis->offCompact * RT_MS_1SEC / cMsPass / _1K);
+
+        if (pThis->offCompact >= cbDisk)
+        {
+            LogRel(("VD#%u: Online compaction pass finished, reclaimed %llu bytes\n",
+                    pDrvIns->iInstance, pThis->cbCompactPassReclaimed));
+            STAM_REL_COUNTER_INC(&pThis->StatCompactPasses);
+            pThis->fCompactPass = false;
+            continue;
+        }
+
+        /* Throttle to the configured rate. */
+        uint64_t cMsStep    = (uint64_t)cbThis * RT_MS_1SEC / pThis->cbCompactRate;
+        uint64_t cMsElapsed = RTTimeMilliTS() - tsStart;
+        if (cMsElapsed < cMsStep)
+            PDMR3ThreadSleep(pThread, (RTMSINTERVAL)(cMsStep - cMsElapsed));
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Wakes up the compaction thread, PDMR3ThreadSleep() takes care of it already.
+ *
+ * @returns VBox status code.
+ * @param   pDrvIns     The driver instance.
+ * @param   pThread     The compaction thread.
+ */
+static DECLCALLBACK(int) drvvdCompactThreadWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    NOREF(pDrvIns); NOREF(pThread);
+    return VINF_SUCCESS;
+}
+
 /*******************************************************************************
 *   Base interface methods                                                     *
 *******************************************************************************/
@@ -2340,6 +2493,13 @@ static DECLCALLBACK(void) drvvdSuspend(PPDMDRVINS pDrvIns)
         AssertRC(rc);
     }
 
+    /*
+     * PDM suspends the threads only after all drivers, make sure
+     * the compaction doesn't access the image while it is reopened.
+     */
+    if (pThis->pThreadCompact)
+        PDMR3ThreadSuspend(pThis->pThreadCompact);
+
     drvvdSetReadonly(pThis);
 }
 
@@ -2406,6 +2566,15 @@ static DECLCALLBACK(void) drvvdDestruct(PPDMDRVINS pDrvIns)
         AssertRC(rc);
     }
 
+    /* PDM destroys driver threads after the destructor ran but the disk goes away here. */
+    if (pThis->pThreadCompact)
+    {
+        int rcThread;
+        int rc = PDMR3ThreadDestroy(pThis->pThreadCompact, &rcThread);
+        AssertRC(rc);
+        pThis->pThreadCompact = NULL;
+    }
+
     if (RT_VALID_PTR(pThis->pBlkCache))
     {
         PDMR3BlkCacheRelease(pThis->pBlkCache);
@@ -2452,6 +2621,7 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     char *pszFormat = NULL;      /**< The format backed to use for this image. */
     char *pszCachePath = NULL;   /**< The path to the cache image. */
     char *pszCacheFormat = NULL; /**< The format backend to use for the cache image. */
+    PCFGMNODE pCfgCacheConfig = NULL; /**< Configuration of the cache image. */
     bool fReadOnly;              /**< True if the media is read-only. */
     bool fMaybeReadOnly;         /**< True if the media may or may not be read-only. */
     bool fHonorZeroWrites;       /**< True if zero blocks should be written. */
@@ -2472,6 +2642,9 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     pThis->uMergeTarget                 = VD_LAST_IMAGE;
     pThis->pCfgCrypto                   = NULL;
     pThis->pIfSecKey                    = NULL;
+    pThis->fCompact                     = false;
+    pThis->fCompactPass                 = false;
+    pThis->pThreadCompact               = NULL;
 
     /* IMedia */
     pThis->IMedia.pfnRead               = drvvdRead;
@@ -2551,7 +2724,8 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           "HostIPStack\0UseNewIo\0BootAcceleration\0BootAccelerationBuffer\0"
                                           "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0"
                                           "CachePath\0CacheFormat\0Discard\0InformAboutZeroBlocks\0"
-                                          "SkipConsistencyChecks\0");
+                                          "SkipConsistencyChecks\0OnlineCompact\0OnlineCompactRate\0"
+                                          "OnlineCompactInterval\0");
         }
         else
         {
@@ -2700,6 +2874,33 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                       N_("DrvVD: Configuration error: Querying \"SKipConsistencyChecks\" as boolean failed"));
                 break;
             }
+            rc = CFGMR3QueryBoolDef(pCurNode, "OnlineCompact", &pThis->fCompact, false);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"OnlineCompact\" as boolean failed"));
+                break;
+            }
+            if (fReadOnly && pThis->fCompact)
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, VERR_PDM_DRIVER_INVALID_PROPERTIES,
+                                      N_("DrvVD: Configuration error: Both \"ReadOnly\" and \"OnlineCompact\" are set"));
+                break;
+            }
+            rc = CFGMR3QueryU32Def(pCurNode, "OnlineCompactRate", &pThis->cbCompactRate, 8 * _1M);
+            if (RT_FAILURE(rc) || !pThis->cbCompactRate)
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, RT_FAILURE(rc) ? rc : VERR_OUT_OF_RANGE,
+                                      N_("DrvVD: Configuration error: Querying \"OnlineCompactRate\" as integer failed"));
+                break;
+            }
+            rc = CFGMR3QueryU32Def(pCurNode, "OnlineCompactInterval", &pThis->cSecCompactInterval, 3600);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"OnlineCompactInterval\" as integer failed"));
+                break;
+            }
 
             char *psz;
             rc = CFGMR3QueryStringAlloc(pCfg, "Type", &psz);
@@ -2742,6 +2943,9 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           N_("DrvVD: Configuration error: Querying \"CacheFormat\" as string failed"));
                     break;
                 }
+
+                /* Backend specific settings like the write-back mode. */
+                pCfgCacheConfig = CFGMR3GetChild(pCurNode, "CacheConfig");
             }
         }
 
@@ -3017,7 +3221,10 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
             uOpenFlags |= VD_OPEN_FLAGS_ASYNC_IO;
         if (pThis->fShareable)
             uOpenFlags |= VD_OPEN_FLAGS_SHAREABLE;
-        if (fDiscard && iLevel == 0)
+        /* Online compaction frees blocks through the discard code of the backend,
+         * which needs the image to be opened for discarding. The guest only gets
+         * to discard if it is configured though. */
+        if ((fDiscard || pThis->fCompact) && iLevel == 0)
             uOpenFlags |= VD_OPEN_FLAGS_DISCARD;
         if (fInformAboutZeroBlocks)
             uOpenFlags |= VD_OPEN_FLAGS_INFORM_ABOUT_ZERO_BLOCKS;
@@ -3116,7 +3323,48 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
             AssertRC(rc);
         }
 
-        rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, VD_OPEN_FLAGS_NORMAL, pThis->pVDIfsCache);
+        if (   RT_SUCCESS(rc)
+            && pCfgCacheConfig)
+        {
+            pThis->VDIfConfigCache.pfnAreKeysValid = drvvdCfgAreKeysValid;
+            pThis->VDIfConfigCache.pfnQuerySize    = drvvdCfgQuerySize;
+            pThis->VDIfConfigCache.pfnQuery        = drvvdCfgQuery;
+            pThis->VDIfConfigCache.pfnQueryBytes   = NULL;
+            rc = VDInterfaceAdd(&pThis->VDIfConfigCache.Core, "DrvVD_Config", VDINTERFACETYPE_CONFIG,
+                                pCfgCacheConfig, sizeof(VDINTERFACECONFIG), &pThis->pVDIfsCache);
+            AssertRC(rc);
+        }
+
+        if (RT_SUCCESS(rc))
+        {
+            unsigned uOpenFlags = VD_OPEN_FLAGS_NORMAL;
+
+            /*
+             * The cache has to support async I/O as well if the disk uses it,
+             * fall back to synchronous I/O for the whole disk otherwise.
+             */
+            if (pThis->fAsyncIOSupported)
+                uOpenFlags |= VD_OPEN_FLAGS_ASYNC_IO;
+
+            rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, uOpenFlags, pThis->pVDIfsCache);
+            if (rc == VERR_NOT_SUPPORTED)
+            {
+                LogRel(("VD: Cache image '%s' doesn't support async I/O, switching to synchronous I/O\n",
+                        pszCachePath));
+                pThis->fAsyncIOSupported = false;
+                uOpenFlags &= ~VD_OPEN_FLAGS_ASYNC_IO;
+                rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, uOpenFlags, pThis->pVDIfsCache);
+                if (RT_SUCCESS(rc))
+                {
+                    /* Not fatal, but the user should know why the disk got slower. */
+                    int rc2 = PDMDrvHlpVMSetRuntimeError(pDrvIns, 0 /* fFlags */, "DrvVD_CACHENOASYNC",
+                                                         N_("The cache image '%s' doesn't support asynchronous I/O. "
+                                                            "The disk uses synchronous I/O now which may reduce its performance"),
+                                                         pszCachePath);
+                    AssertRC(rc2);
+                }
+            }
+        }
         if (RT_FAILURE(rc))
             rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not open cache image"));
     }
@@ -3200,6 +3448,34 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                     NULL /*pfnSavePrep*/, NULL /*pfnSaveExec*/, NULL /*pfnSaveDone*/,
                                     NULL /*pfnDonePrep*/, NULL /*pfnLoadExec*/, drvvdLoadDone);
 
+    /* Start the online compaction if enabled. */
+    if (   RT_SUCCESS(rc)
+        && pThis->fCompact
+        && !pThis->fShareable
+        && enmType == VDTYPE_HDD)
+    {
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatCompactBytesScanned, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                               "Amount of data scanned by the online compaction.", "/Drivers/VD%d/Compact/BytesScanned", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatCompactBytesReclaimed, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                               "Amount of space reclaimed in the image file.", "/Drivers/VD%d/Compact/BytesReclaimed", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatCompactBusy, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                               "Number of steps deferred because of guest I/O.", "/Drivers/VD%d/Compact/Busy", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatCompactPasses, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                               "Number of completed passes.", "/Drivers/VD%d/Compact/Passes", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->uCompactProgress, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_PCT,
+                               "Progress of the current pass.", "/Drivers/VD%d/Compact/Progress", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->cKBCompactThroughput, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_KILOBYTES,
+                               "Scan throughput of the current pass per second.", "/Drivers/VD%d/Compact/Throughput", pDrvIns->iInstance);
+
+        rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pThreadCompact, pThis, drvvdCompactThread,
+                                   drvvdCompactThreadWakeup, 0, RTTHREADTYPE_IO, "VDCompact");
+        if (RT_FAILURE(rc))
+            rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Failed to create the online compaction thread"));
+        else
+            LogRel(("VD#%u: Online compaction enabled, %u bytes/s every %u seconds\n",
+                    pDrvIns->iInstance, pThis->cbCompactRate, pThis->cSecCompactInterval));
+    }
+
     /* Setup the boot acceleration stuff if enabled. */
     if (RT_SUCCESS(rc) && pThis->fBootAccelEnabled)
     {
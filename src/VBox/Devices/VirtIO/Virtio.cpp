@@ -49,6 +49,7 @@ static void vqueueReset(PVQUEUE pQueue)
     pQueue->uNextAvailIndex       = 0;
     pQueue->uNextUsedIndex        = 0;
     pQueue->uPageNumber           = 0;
+    pQueue->uMsixVector           = VPCI_NO_VECTOR;
 }
 
 static void vqueueInit(PVQUEUE pQueue, uint32_t uPageNumber)
@@ -231,7 +232,7 @@ void vqueueNotify(PVPCISTATE pState, PVQUEUE pQueue)
     if (!(vringReadAvailFlags(pState, &pQueue->VRing) & VRINGAVAIL_F_NO_INTERRUPT)
         || ((pState->uGuestFeatures & VPCI_F_NOTIFY_ON_EMPTY) && vqueueIsEmpty(pState, pQueue)))
     {
-        int rc = vpciRaiseInterrupt(pState, VERR_INTERNAL_ERROR, VPCI_ISR_QUEUE);
+        int rc = vpciRaiseQueueInterrupt(pState, pQueue);
         if (RT_FAILURE(rc))
             Log(("%s vqueueNotify: Failed to raise an interrupt (%Rrc).\n", INSTANCE(pState), rc));
     }
@@ -242,12 +243,21 @@ void vqueueNotify(PVPCISTATE pState, PVQUEUE pQueue)
 
 }
 
-void vqueueSync(PVPCISTATE pState, PVQUEUE pQueue)
+/**
+ * Publishes the used elements put since the last sync to the guest.
+ *
+ * @param   pState      The device state structure.
+ * @param   pQueue      The queue.
+ * @param   fNotify     Whether to notify the guest as well.  Callers passing
+ *                      false must call vqueueNotify themselves later on.
+ */
+void vqueueSync(PVPCISTATE pState, PVQUEUE pQueue, bool fNotify)
 {
     Log2(("%s vqueueSync: %s old_used_idx=%u new_used_idx=%u\n", INSTANCE(pState),
           QUEUENAME(pState, pQueue), vringReadUsedIndex(pState, &pQueue->VRing), pQueue->uNextUsedIndex));
     vringWriteUsedIndex(pState, &pQueue->VRing, pQueue->uNextUsedIndex);
-    vqueueNotify(pState, pQueue);
+    if (fNotify)
+        vqueueNotify(pState, pQueue);
 }
 
 void vpciReset(PVPCISTATE pState)
@@ -256,6 +266,7 @@ void vpciReset(PVPCISTATE pState)
     pState->uQueueSelector = 0;
     pState->uStatus        = 0;
     pState->uISR           = 0;
+    pState->uMsixConfigVector = VPCI_NO_VECTOR;
 
     for (unsigned i = 0; i < pState->nQueues; i++)
         vqueueReset(&pState->Queues[i]);
@@ -280,11 +291,43 @@ int vpciRaiseInterrupt(VPCISTATE *pState, int rcBusy, uint8_t u8IntCause)
              INSTANCE(pState), u8IntCause));
 
     pState->uISR |= u8IntCause;
+    if (vpciIsMsixEnabled(pState))
+    {
+        /* There is no ISR with MSI-X, configuration changes have a vector of their own. */
+        if (pState->uMsixConfigVector != VPCI_NO_VECTOR)
+            PDMDevHlpPCISetIrq(pState->CTX_SUFF(pDevIns), pState->uMsixConfigVector, PDM_IRQ_LEVEL_HIGH);
+        return VINF_SUCCESS;
+    }
     PDMDevHlpPCISetIrq(pState->CTX_SUFF(pDevIns), 0, 1);
     // vpciCsLeave(pState);
     return VINF_SUCCESS;
 }
 
+/**
+ * Raise the interrupt associated with a queue.
+ *
+ * With MSI-X enabled each queue signals the vector the guest has assigned to
+ * it, so the interrupts of different queues can be handled on different CPUs.
+ * Otherwise this is the same as raising VPCI_ISR_QUEUE on the shared line.
+ *
+ * @param   pState      The device state structure.
+ * @param   pQueue      The queue to raise the interrupt for.
+ */
+int vpciRaiseQueueInterrupt(VPCISTATE *pState, PVQUEUE pQueue)
+{
+    if (!vpciIsMsixEnabled(pState))
+        return vpciRaiseInterrupt(pState, VERR_INTERNAL_ERROR, VPCI_ISR_QUEUE);
+
+    if (pQueue->uMsixVector != VPCI_NO_VECTOR)
+    {
+        STAM_COUNTER_INC(&pState->StatIntsRaised);
+        LogFlow(("%s vpciRaiseQueueInterrupt: %s vector=%u\n",
+                 INSTANCE(pState), QUEUENAME(pState, pQueue), pQueue->uMsixVector));
+        PDMDevHlpPCISetIrq(pState->CTX_SUFF(pDevIns), pQueue->uMsixVector, PDM_IRQ_LEVEL_HIGH);
+    }
+    return VINF_SUCCESS;
+}
+
 /**
  * Lower interrupt.
  *
@@ -293,7 +336,22 @@ int vpciRaiseInterrupt(VPCISTATE *pState, int rcBusy, uint8_t u8IntCause)
 static void vpciLowerInterrupt(VPCISTATE *pState)
 {
     LogFlow(("%s vpciLowerInterrupt\n", INSTANCE(pState)));
-    PDMDevHlpPCISetIrq(pState->CTX_SUFF(pDevIns), 0, 0);
+    /* MSI-X messages are edge triggered, there is nothing to lower. */
+    if (!vpciIsMsixEnabled(pState))
+        PDMDevHlpPCISetIrq(pState->CTX_SUFF(pDevIns), 0, 0);
+}
+
+/**
+ * Validates an MSI-X vector number written by the guest.
+ *
+ * @returns The vector or VPCI_NO_VECTOR if it is out of range.
+ * @param   pState      The device state structure.
+ * @param   uVector     The vector number.
+ */
+DECLINLINE(uint16_t) vpciCheckMsixVector(PVPCISTATE pState, uint32_t uVector)
+{
+    uVector &= 0xFFFF;
+    return uVector < pState->cMsixVectors ? (uint16_t)uVector : VPCI_NO_VECTOR;
 }
 
 DECLINLINE(uint32_t) vpciGetHostFeatures(PVPCISTATE pState,
@@ -382,9 +440,22 @@ int vpciIOPortIn(PPDMDEVINS         pDevIns,
             vpciLowerInterrupt(pState);
             break;
 
+        case VPCI_MSIX_CONFIG_VECTOR:
+        case VPCI_MSIX_QUEUE_VECTOR:
+            if (vpciIsMsixEnabled(pState))
+            {
+                Assert(cb == 2);
+                if (Port == VPCI_MSIX_CONFIG_VECTOR)
+                    *(uint16_t*)pu32 = pState->uMsixConfigVector;
+                else
+                    *(uint16_t*)pu32 = pState->Queues[pState->uQueueSelector].uMsixVector;
+                break;
+            }
+            /* Without MSI-X this is the device-specific configuration. */
+            /* fall thru */
         default:
-            if (Port >= VPCI_CONFIG)
-                rc = pCallbacks->pfnGetConfig(pState, Port - VPCI_CONFIG, cb, pu32);
+            if (Port >= vpciConfigOffset(pState))
+                rc = pCallbacks->pfnGetConfig(pState, Port - vpciConfigOffset(pState), cb, pu32);
             else
             {
                 *pu32 = 0xFFFFFFFF;
@@ -511,9 +582,23 @@ int vpciIOPortOut(PPDMDEVINS                pDevIns,
                 pCallbacks->pfnReady(pState);
             break;
 
+        case VPCI_MSIX_CONFIG_VECTOR:
+        case VPCI_MSIX_QUEUE_VECTOR:
+            if (vpciIsMsixEnabled(pState))
+            {
+                /* The guest reads the vector back to find out if the assignment succeeded. */
+                Assert(cb == 2);
+                if (Port == VPCI_MSIX_CONFIG_VECTOR)
+                    pState->uMsixConfigVector = vpciCheckMsixVector(pState, u32);
+                else
+                    pState->Queues[pState->uQueueSelector].uMsixVector = vpciCheckMsixVector(pState, u32);
+                break;
+            }
+            /* Without MSI-X this is the device-specific configuration. */
+            /* fall thru */
         default:
-            if (Port >= VPCI_CONFIG)
-                rc = pCallbacks->pfnSetConfig(pState, Port - VPCI_CONFIG, cb, &u32);
+            if (Port >= vpciConfigOffset(pState))
+                rc = pCallbacks->pfnSetConfig(pState, Port - vpciConfigOffset(pState), cb, &u32);
             else
                 rc = PDMDevHlpDBGFStop(pDevIns, RT_SRC_POS, "%s vpciIOPortOut: no valid port at offset Port=%RTiop cb=%08x\n",
                                        INSTANCE(pState), Port, cb);
@@ -640,12 +725,14 @@ static void vpciDumpState(PVPCISTATE pState, const char *pcszCaller)
           "  uGuestFeatures = 0x%08x\n"
           "  uQueueSelector = 0x%04x\n"
           "  uStatus        = 0x%02x\n"
-          "  uISR           = 0x%02x\n",
+          "  uISR           = 0x%02x\n"
+          "  uMsixConfigVector = 0x%04x\n",
           pcszCaller,
           pState->uGuestFeatures,
           pState->uQueueSelector,
           pState->uStatus,
-          pState->uISR));
+          pState->uISR,
+          pState->uMsixConfigVector));
 
     for (unsigned i = 0; i < pState->nQueues; i++)
         Log2((" %s queue:\n"
@@ -655,7 +742,8 @@ static void vpciDumpState(PVPCISTATE pState, const char *pcszCaller)
               "  VRing.addrUsed        = %p\n"
               "  uNextAvailIndex       = %u\n"
               "  uNextUsedIndex        = %u\n"
-              "  uPageNumber           = %x\n",
+              "  uPageNumber           = %x\n"
+              "  uMsixVector           = %x\n",
               pState->Queues[i].pcszName,
               pState->Queues[i].VRing.uSize,
               pState->Queues[i].VRing.addrDescriptors,
@@ -663,7 +751,8 @@ static void vpciDumpState(PVPCISTATE pState, const char *pcszCaller)
               pState->Queues[i].VRing.addrUsed,
               pState->Queues[i].uNextAvailIndex,
               pState->Queues[i].uNextUsedIndex,
-              pState->Queues[i].uPageNumber));
+              pState->Queues[i].uPageNumber,
+              pState->Queues[i].uMsixVector));
 }
 #else
 # define vpciDumpState(x, s)  do {} while (0)
@@ -690,6 +779,8 @@ int vpciSaveExec(PVPCISTATE pState, PSSMHANDLE pSSM)
     AssertRCReturn(rc, rc);
     rc = SSMR3PutU8( pSSM, pState->uISR);
     AssertRCReturn(rc, rc);
+    rc = SSMR3PutU16(pSSM, pState->uMsixConfigVector);
+    AssertRCReturn(rc, rc);
 
     /* Save queue states */
     rc = SSMR3PutU32(pSSM, pState->nQueues);
@@ -704,6 +795,8 @@ int vpciSaveExec(PVPCISTATE pState, PSSMHANDLE pSSM)
         AssertRCReturn(rc, rc);
         rc = SSMR3PutU16(pSSM, pState->Queues[i].uNextUsedIndex);
         AssertRCReturn(rc, rc);
+        rc = SSMR3PutU16(pSSM, pState->Queues[i].uMsixVector);
+        AssertRCReturn(rc, rc);
     }
 
     return VINF_SUCCESS;
@@ -733,15 +826,24 @@ int vpciLoadExec(PVPCISTATE pState, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
         AssertRCReturn(rc, rc);
         rc = SSMR3GetU8( pSSM, &pState->uISR);
         AssertRCReturn(rc, rc);
+        if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_MQ)
+        {
+            rc = SSMR3GetU16(pSSM, &pState->uMsixConfigVector);
+            AssertRCReturn(rc, rc);
+        }
+        else
+            pState->uMsixConfigVector = VPCI_NO_VECTOR;
 
         /* Restore queues */
+        uint32_t cQueues = nQueues;
         if (uVersion > VIRTIO_SAVEDSTATE_VERSION_3_1_BETA1)
         {
-            rc = SSMR3GetU32(pSSM, &pState->nQueues);
+            rc = SSMR3GetU32(pSSM, &cQueues);
             AssertRCReturn(rc, rc);
         }
-        else
-            pState->nQueues = nQueues;
+        if (cQueues != pState->nQueues)
+            return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("The number of queues differs: config=%u saved=%u"),
+                                    pState->nQueues, cQueues);
         for (unsigned i = 0; i < pState->nQueues; i++)
         {
             rc = SSMR3GetU16(pSSM, &pState->Queues[i].VRing.uSize);
@@ -756,6 +858,13 @@ int vpciLoadExec(PVPCISTATE pState, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             AssertRCReturn(rc, rc);
             rc = SSMR3GetU16(pSSM, &pState->Queues[i].uNextUsedIndex);
             AssertRCReturn(rc, rc);
+            if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_MQ)
+            {
+                rc = SSMR3GetU16(pSSM, &pState->Queues[i].uMsixVector);
+                AssertRCReturn(rc, rc);
+            }
+            else
+                pState->Queues[i].uMsixVector = VPCI_NO_VECTOR;
         }
     }
 
@@ -837,21 +946,27 @@ DECLCALLBACK(int) vpciConstruct(PPDMDEVINS pDevIns, VPCISTATE *pState,
     if (RT_FAILURE(rc))
         return rc;
 
+    pState->cMsixVectors = 0;
 #ifdef VBOX_WITH_MSI_DEVICES
-#if 0
     {
+        /* One vector per queue plus one for configuration changes. */
         PDMMSIREG aMsiReg;
 
         RT_ZERO(aMsiReg);
-        aMsiReg.cMsixVectors = 1;
-        aMsiReg.iMsixCapOffset = 0x80;
+        aMsiReg.cMsixVectors = RT_MIN(nQueues + 1, VBOX_MSIX_MAX_ENTRIES);
+        aMsiReg.iMsixCapOffset = VPCI_MSIX_CAP_OFFSET;
         aMsiReg.iMsixNextOffset = 0x0;
-        aMsiReg.iMsixBar = 0;
+        aMsiReg.iMsixBar = VPCI_MSIX_BAR;
         rc = PDMDevHlpPCIRegisterMsi(pDevIns, &aMsiReg);
-        if (RT_FAILURE (rc))
+        if (RT_SUCCESS(rc))
+            pState->cMsixVectors = aMsiReg.cMsixVectors;
+        else
+        {
+            /* That's OK, we can work without MSI-X (e.g. on the PIIX3 chipset). */
             PCIDevSetCapabilityList(&pState->pciDevice, 0x0);
+            rc = VINF_SUCCESS;
+        }
     }
-#endif
 #endif
 
     /* Status driver */
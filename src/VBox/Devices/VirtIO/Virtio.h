@@ -19,6 +19,7 @@
 #define ___VBox_Virtio_h
 
 #include <iprt/ctype.h>
+#include <VBox/msi.h>
 
 
 /** @name Saved state versions.
@@ -28,14 +29,16 @@
  * for example.
  */
 #define VIRTIO_SAVEDSTATE_VERSION_3_1_BETA1 1
-#define VIRTIO_SAVEDSTATE_VERSION           2
+#define VIRTIO_SAVEDSTATE_VERSION_PRE_MQ    2
+#define VIRTIO_SAVEDSTATE_VERSION           3
 /** @} */
 
 #define DEVICE_PCI_VENDOR_ID                0x1AF4
 #define DEVICE_PCI_DEVICE_ID                0x1000
 #define DEVICE_PCI_SUBSYSTEM_VENDOR_ID      0x1AF4
 
-#define VIRTIO_MAX_NQUEUES                  3
+/** Enough for virtio-net with 8 RX/TX queue pairs plus the control queue. */
+#define VIRTIO_MAX_NQUEUES                  17
 
 #define VPCI_HOST_FEATURES                  0x0
 #define VPCI_GUEST_FEATURES                 0x4
@@ -46,6 +49,20 @@
 #define VPCI_STATUS                         0x12
 #define VPCI_ISR                            0x13
 #define VPCI_CONFIG                         0x14
+/** @name Registers present only while MSI-X is enabled by the guest.
+ * They shift the device-specific configuration to VPCI_CONFIG_MSIX.
+ * @{ */
+#define VPCI_MSIX_CONFIG_VECTOR             0x14
+#define VPCI_MSIX_QUEUE_VECTOR              0x16
+#define VPCI_CONFIG_MSIX                    0x18
+/** @} */
+
+/** Vector value meaning "do not deliver interrupts for this source". */
+#define VPCI_NO_VECTOR                      0xFFFF
+/** Offset of the MSI-X capability in PCI configuration space. */
+#define VPCI_MSIX_CAP_OFFSET                0x80
+/** The PCI region the MSI-X table and PBA live in. */
+#define VPCI_MSIX_BAR                       1
 
 #define VPCI_ISR_QUEUE                      0x1
 #define VPCI_ISR_CONFIG                     0x3
@@ -124,6 +141,9 @@ typedef struct VQueue
     uint16_t uNextAvailIndex;
     uint16_t uNextUsedIndex;
     uint32_t uPageNumber;
+    /** MSI-X vector assigned by the guest, VPCI_NO_VECTOR if none. */
+    uint16_t uMsixVector;
+    uint16_t au16Padding[3];
     R3PTRTYPE(PFNVPCIQUEUECALLBACK) pfnCallback;
     R3PTRTYPE(const char *)         pcszName;
 } VQUEUE;
@@ -198,6 +218,11 @@ typedef struct VPCIState_st
     uint16_t               uQueueSelector;         /**< An index in aQueues array. */
     uint8_t                uStatus; /**< Device Status (bits are device-specific). */
     uint8_t                uISR;                   /**< Interrupt Status Register. */
+    /** MSI-X vector for configuration change notifications. */
+    uint16_t               uMsixConfigVector;
+    /** Number of MSI-X vectors, zero if MSI-X could not be registered. */
+    uint16_t               cMsixVectors;
+    uint32_t               padding4;
 
 #if HC_ARCH_BITS != 64
     uint32_t               padding3;
@@ -240,6 +265,7 @@ typedef const VPCIIOCALLBACKS *PCVPCIIOCALLBACKS;
 /** @} */
 
 int vpciRaiseInterrupt(VPCISTATE *pState, int rcBusy, uint8_t u8IntCause);
+int vpciRaiseQueueInterrupt(VPCISTATE *pState, PVQUEUE pQueue);
 int vpciIOPortIn(PPDMDEVINS         pDevIns,
                  void              *pvUser,
                  RTIOPORT           port,
@@ -266,6 +292,29 @@ void  vpciReset(PVPCISTATE pState);
 void *vpciQueryInterface(struct PDMIBASE *pInterface, const char *pszIID);
 PVQUEUE vpciAddQueue(VPCISTATE* pState, unsigned uSize, PFNVPCIQUEUECALLBACK pfnCallback, const char *pcszName);
 
+/**
+ * Checks whether the guest has enabled MSI-X for the device.
+ *
+ * @returns true if interrupts are delivered as MSI-X messages.
+ * @param   pState      The device state structure.
+ */
+DECLINLINE(bool) vpciIsMsixEnabled(VPCISTATE *pState)
+{
+    return pState->cMsixVectors
+        && (PCIDevGetWord(&pState->pciDevice, VPCI_MSIX_CAP_OFFSET + VBOX_MSIX_CAP_MESSAGE_CONTROL)
+            & VBOX_PCI_MSIX_FLAGS_ENABLE);
+}
+
+/**
+ * Returns the offset of the device-specific configuration in the I/O region.
+ *
+ * @param   pState      The device state structure.
+ */
+DECLINLINE(uint32_t) vpciConfigOffset(VPCISTATE *pState)
+{
+    return vpciIsMsixEnabled(pState) ? VPCI_CONFIG_MSIX : VPCI_CONFIG;
+}
+
 #define VPCI_CS
 DECLINLINE(int) vpciCsEnter(VPCISTATE *pState, int rcBusy)
 {
@@ -302,7 +351,7 @@ bool vqueueSkip(PVPCISTATE pState, PVQUEUE pQueue);
 bool vqueueGet(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, bool fRemove = true);
 void vqueuePut(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, uint32_t uLen, uint32_t uReserved = 0);
 void vqueueNotify(PVPCISTATE pState, PVQUEUE pQueue);
-void vqueueSync(PVPCISTATE pState, PVQUEUE pQueue);
+void vqueueSync(PVPCISTATE pState, PVQUEUE pQueue, bool fNotify);
 
 DECLINLINE(bool) vqueuePeek(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem)
 {
@@ -86,6 +86,10 @@ typedef struct VUSBIRHCONFIG *PVUSBIRHCONFIG;
             return setError(E_ACCESSDENIED, tr("The console is not powered up")); \
     } while (0)
 
+/** The name of the bandwidth group limiting the link bandwidth used by
+ *  teleportation, see IConsole::teleport. */
+#define TELEPORTER_BW_GROUP_NAME    "Teleporter"
+
 // Console
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -817,6 +821,7 @@ private:
     HRESULT                     teleporterSrc(TeleporterStateSrc *pState);
     HRESULT                     teleporterSrcReadACK(TeleporterStateSrc *pState, const char *pszWhich, const char *pszNAckMsg = NULL);
     HRESULT                     teleporterSrcSubmitCommand(TeleporterStateSrc *pState, const char *pszCommand, bool fWaitForAck = true);
+    static void                 teleporterSrcThrottle(TeleporterStateSrc *pState, size_t cbWritten);
     HRESULT                     teleporterTrg(PUVM pUVM, IMachine *pMachine, Utf8Str *pErrorMsg, bool fStartPaused,
                                               Progress *pProgress, bool *pfPowerOffOnFailure);
     static DECLCALLBACK(int)    teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser);
@@ -953,6 +958,17 @@ private:
      * operation before starting. */
     ComObjPtr<Progress> mptrCancelableProgress;
 
+    /** @name Teleporter pre-copy limits, taken from the machine settings.
+     * These are read by the SSM I/O thread, so they are updated atomically.
+     * @{ */
+    /** The CPU execution cap of the machine, the pre-copy throttling never
+     * goes above it. */
+    uint32_t volatile   muTeleporterCpuCap;
+    /** The limit of the "Teleporter" bandwidth group in bytes per second,
+     * 0 if unlimited. */
+    uint64_t volatile   mcbTeleporterMaxPerSec;
+    /** @} */
+
     /* The purpose of caching of some events is probably in order to
        automatically fire them at new event listeners.  However, there is no
        (longer?) any code making use of this... */
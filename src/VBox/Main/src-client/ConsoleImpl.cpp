@@ -415,6 +415,8 @@ Console::Console()
     , mVMStateChangeCallbackDisabled(false)
     , mfUseHostClipboard(true)
     , mMachineState(MachineState_PoweredOff)
+    , muTeleporterCpuCap(100)
+    , mcbTeleporterMaxPerSec(0)
 {
 }
 
@@ -5052,6 +5054,9 @@ HRESULT Console::onCPUExecutionCapChange(ULONG aExecutionCap)
             || mMachineState == MachineState_LiveSnapshotting
             )
         {
+            /* The teleporter throttling picks this up as its new ceiling. */
+            ASMAtomicWriteU32(&muTeleporterCpuCap, aExecutionCap);
+
             /* No need to call in the EMT thread. */
             rc = VMR3SetCpuExecutionCap(ptrVM.rawUVM(), aExecutionCap);
         }
@@ -5547,6 +5552,9 @@ HRESULT Console::onBandwidthGroupChange(IBandwidthGroup *aBandwidthGroup)
                     rc = E_NOTIMPL;
 #endif /* VBOX_WITH_NETSHAPER */
                 AssertRC(vrc);
+
+                if (strName == TELEPORTER_BW_GROUP_NAME)
+                    ASMAtomicWriteU64(&mcbTeleporterMaxPerSec, cMax > 0 ? (uint64_t)cMax : 0);
             }
         }
         else
@@ -8701,6 +8709,14 @@ HRESULT Console::attachToTapInterface(INetworkAdapter *networkAdapter)
             Utf8Str str(tapDeviceName);
             RTStrCopy(IfReq.ifr_name, sizeof(IfReq.ifr_name), str.c_str()); /** @todo bitch about names which are too long... */
             IfReq.ifr_flags = IFF_TAP | IFF_NO_PI;
+#  if defined(IFF_VNET_HDR) && defined(TUNGETFEATURES)
+            /* Exchange frames with a virtio-net header if the kernel can, this
+               lets DrvTAP pass whole GSO frames in and out. */
+            unsigned int fTunFeatures = 0;
+            if (   ioctl(maTapFD[slot], TUNGETFEATURES, &fTunFeatures) == 0
+                && (fTunFeatures & IFF_VNET_HDR))
+                IfReq.ifr_flags |= IFF_VNET_HDR;
+#  endif
             rcVBox = ioctl(maTapFD[slot], TUNSETIFF, &IfReq);
             if (rcVBox != 0)
             {
@@ -28,13 +28,18 @@
 #include "HashedPw.h"
 
 #include <iprt/asm.h>
+#include <iprt/critsect.h>
 #include <iprt/err.h>
+#include <iprt/param.h>
 #include <iprt/rand.h>
+#include <iprt/semaphore.h>
 #include <iprt/socket.h>
 #include <iprt/tcp.h>
+#include <iprt/thread.h>
 #include <iprt/timer.h>
 
 #include <VBox/vmm/vmapi.h>
+#include <VBox/vmm/pgm.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/err.h>
 #include <VBox/version.h>
@@ -104,6 +109,20 @@ public:
     MachineState_T      menmOldMachineState;
     bool                mfSuspendedByUs;
     bool                mfUnlockedMedia;
+    /** Set if the target agreed to a post-copy teleportation. */
+    bool                mfPostCopy;
+
+    /** @name pre-copy throttling
+     * @{  */
+    /** The CPU execution cap the VM had when we started. */
+    uint32_t            muCpuCapOrg;
+    /** The CPU execution cap we've currently imposed. */
+    uint32_t            muCpuCap;
+    /** Bytes written since the current link speed sample was started. */
+    uint64_t            mcbSample;
+    /** When the current link speed sample was started (RTTimeMilliTS). */
+    uint64_t            mmsSampleStart;
+    /** @} */
 
     TeleporterStateSrc(Console *pConsole, PUVM pUVM, Progress *pProgress, MachineState_T enmOldMachineState)
         : TeleporterState(pConsole, pUVM, pProgress, true /*fIsSource*/)
@@ -112,6 +131,11 @@ public:
         , menmOldMachineState(enmOldMachineState)
         , mfSuspendedByUs(false)
         , mfUnlockedMedia(false)
+        , mfPostCopy(false)
+        , muCpuCapOrg(100)
+        , muCpuCap(100)
+        , mcbSample(0)
+        , mmsSampleStart(0)
     {
     }
 };
@@ -131,6 +155,22 @@ public:
     int                         mRc;
     Utf8Str                     mErrorText;
 
+    /** @name post-copy
+     * @{  */
+    /** Set if the source asked for a post-copy teleportation. */
+    bool                        mfPostCopy;
+    /** The thread receiving the pages from the source. */
+    RTTHREAD                    mhPostCopyThread;
+    /** Serializes the page requests. */
+    RTCRITSECT                  mPostCopyCritSect;
+    /** Signalled when the requested page has arrived or the link failed. */
+    RTSEMEVENT                  mhPostCopyEvent;
+    /** The page being requested, NIL_RTGCPHYS if none. */
+    uint64_t volatile           mGCPhysPostCopyRequest;
+    /** The post-copy status, failure means the link to the source is gone. */
+    int32_t volatile            mrcPostCopy;
+    /** @} */
+
     TeleporterStateTrg(Console *pConsole, PUVM pUVM, Progress *pProgress,
                        IMachine *pMachine, IInternalMachineControl *pControl,
                        PRTTIMERLR phTimerLR, bool fStartPaused)
@@ -142,7 +182,13 @@ public:
         , mfLockedMedia(false)
         , mRc(VINF_SUCCESS)
         , mErrorText()
+        , mfPostCopy(false)
+        , mhPostCopyThread(NIL_RTTHREAD)
+        , mhPostCopyEvent(NIL_RTSEMEVENT)
+        , mGCPhysPostCopyRequest(NIL_RTGCPHYS)
+        , mrcPostCopy(VINF_SUCCESS)
     {
+        RT_ZERO(mPostCopyCritSect);
     }
 };
 
@@ -168,6 +214,42 @@ typedef struct TELEPORTERTCPHDR
 #define TELEPORTERTCPHDR_MAX_SIZE    UINT32_C(0x00fffff8)
 
 
+/**
+ * Post-copy page header.
+ *
+ * After the hand-over of a post-copy teleportation the target requests the
+ * pages it is missing and the source sends them, along with all the other
+ * missing pages, each followed by the page content.
+ */
+typedef struct TELEPORTERPAGEHDR
+{
+    /** Magic value. */
+    uint32_t    u32Magic;
+    /** The message type (TELEPORTERPAGEHDR_TYPE_XXX). */
+    uint32_t    u32Type;
+    /** The guest physical address of the page, NIL_RTGCPHYS for DONE. */
+    uint64_t    GCPhys;
+} TELEPORTERPAGEHDR;
+/** Magic value for TELEPORTERPAGEHDR::u32Magic. (Hermeto Pascoal) */
+#define TELEPORTERPAGEHDR_MAGIC         UINT32_C(0x19360622)
+/** @name TELEPORTERPAGEHDR::u32Type values.
+ * @{ */
+/** Target -> source: send this page right away. */
+#define TELEPORTERPAGEHDR_TYPE_REQUEST  UINT32_C(1)
+/** Source -> target: the page content follows. */
+#define TELEPORTERPAGEHDR_TYPE_PAGE     UINT32_C(2)
+/** Source -> target: all pages sent; target -> source: all pages installed. */
+#define TELEPORTERPAGEHDR_TYPE_DONE     UINT32_C(3)
+/** @} */
+/** How long the post-copy phase tolerates a silent link (milliseconds). */
+#define TELEPORTER_POST_COPY_TIMEOUT_MS 60000
+
+/** How often the pre-copy throttling is reconsidered (milliseconds). */
+#define TELEPORTER_THROTTLE_INTERVAL_MS     1000
+/** The lowest CPU execution cap the pre-copy throttling will impose. */
+#define TELEPORTER_THROTTLE_MIN_CPU_CAP     10
+
+
 /*******************************************************************************
 *   Global Variables                                                           *
 *******************************************************************************/
@@ -304,6 +386,161 @@ Console::teleporterSrcSubmitCommand(TeleporterStateSrc *pState, const char *pszC
 }
 
 
+/**
+ * Limits the link bandwidth and adjusts the CPU execution cap of the source VM
+ * according to how fast it dirties RAM compared to how fast we get it across
+ * the link.
+ *
+ * The link is limited to the "Teleporter" bandwidth group of the machine, if
+ * there is one.  Should the guest dirty memory at close to the link speed, the
+ * live passes will never converge and the final pass would blow the downtime
+ * budget.  So, we cut down on the CPU time it gets until the dirty rate drops
+ * well below the link speed, and give it back gradually when that happens.
+ * The CPU execution cap of the machine is the ceiling for this, changes to it
+ * are picked up while teleporting.
+ *
+ * @param   pState          The teleporter source state.
+ * @param   cbWritten       The number of bytes being written to the link.
+ */
+/*static*/ void
+Console::teleporterSrcThrottle(TeleporterStateSrc *pState, size_t cbWritten)
+{
+    Console *pConsole = pState->mptrConsole;
+    pState->mcbSample += cbWritten;
+    uint64_t       msNow      = RTTimeMilliTS();
+    uint64_t       cMsElapsed = msNow - pState->mmsSampleStart;
+
+    uint64_t const cbMaxPerSec = ASMAtomicReadU64(&pConsole->mcbTeleporterMaxPerSec);
+    if (cbMaxPerSec)
+    {
+        uint64_t const cMsDue = pState->mcbSample * 1000 / cbMaxPerSec;
+        if (cMsDue > cMsElapsed)
+        {
+            RTThreadSleep((RTMSINTERVAL)RT_MIN(cMsDue - cMsElapsed, TELEPORTER_THROTTLE_INTERVAL_MS));
+            msNow      = RTTimeMilliTS();
+            cMsElapsed = msNow - pState->mmsSampleStart;
+        }
+    }
+
+    if (cMsElapsed < TELEPORTER_THROTTLE_INTERVAL_MS)
+        return;
+    uint64_t const cbPerSec   = pState->mcbSample * 1000 / cMsElapsed;
+    pState->mcbSample      = 0;
+    pState->mmsSampleStart = msNow;
+
+    uint32_t const uCpuCapMax = ASMAtomicReadU32(&pConsole->muTeleporterCpuCap);
+    if (uCpuCapMax != pState->muCpuCapOrg)
+    {
+        /* The user changed the setting, which also replaced our cap. */
+        LogRel(("Teleporter: CPU execution cap of the machine changed to %u%%\n", uCpuCapMax));
+        pState->muCpuCapOrg = uCpuCapMax;
+        pState->muCpuCap    = uCpuCapMax;
+    }
+
+    uint64_t cbDirtiedPerSec;
+    int vrc = PGMR3QueryLiveSaveStats(pState->mpUVM, NULL, &cbDirtiedPerSec);
+    if (RT_FAILURE(vrc))
+        return; /* not in the live phase */
+
+    uint32_t uCpuCap = pState->muCpuCap;
+    if (cbDirtiedPerSec > cbPerSec / 4 * 3)
+        uCpuCap = RT_MAX(uCpuCap / 2, TELEPORTER_THROTTLE_MIN_CPU_CAP);
+    else if (cbDirtiedPerSec < cbPerSec / 4)
+        uCpuCap = RT_MIN(uCpuCap + 10, pState->muCpuCapOrg);
+    if (uCpuCap != pState->muCpuCap)
+    {
+        LogRel(("Teleporter: link %RU64 bytes/s, guest dirtying %RU64 bytes/s -> CPU execution cap %u%%\n",
+                cbPerSec, cbDirtiedPerSec, uCpuCap));
+        vrc = VMR3SetCpuExecutionCap(pState->mpUVM, uCpuCap);
+        if (RT_SUCCESS(vrc))
+            pState->muCpuCap = uCpuCap;
+    }
+}
+
+
+/**
+ * Serves the RAM pages left out by the final pass to the target (post-copy).
+ *
+ * Requests from the target are answered first as the guest is waiting for
+ * them, the remaining pages are pushed whenever there are none.  Returns when
+ * the target reports that it has got everything.
+ *
+ * @returns VBox status code.
+ * @param   pState          The teleporter source state.
+ */
+static int teleporterSrcPostCopy(TeleporterStateSrc *pState)
+{
+    struct
+    {
+        TELEPORTERPAGEHDR   Hdr;
+        uint8_t             abPage[PAGE_SIZE];
+    }          Msg;
+    uint32_t   cRequested = 0;
+    uint32_t   cPushed    = 0;
+    bool       fPushing   = true;
+    int        rc;
+    for (;;)
+    {
+        rc = RTTcpSelectOne(pState->mhSocket, fPushing ? 0 : TELEPORTER_POST_COPY_TIMEOUT_MS);
+        bool const fRequest = RT_SUCCESS(rc);
+        if (fRequest)
+        {
+            rc = RTTcpRead(pState->mhSocket, &Msg.Hdr, sizeof(Msg.Hdr), NULL);
+            if (RT_FAILURE(rc))
+                break;
+            if (   Msg.Hdr.u32Magic != TELEPORTERPAGEHDR_MAGIC
+                || (   Msg.Hdr.u32Type != TELEPORTERPAGEHDR_TYPE_REQUEST
+                    && Msg.Hdr.u32Type != TELEPORTERPAGEHDR_TYPE_DONE))
+            {
+                LogRel(("Teleporter: Invalid post-copy header %.*Rhxs\n", sizeof(Msg.Hdr), &Msg.Hdr));
+                rc = VERR_IO_GEN_FAILURE;
+                break;
+            }
+            if (Msg.Hdr.u32Type == TELEPORTERPAGEHDR_TYPE_DONE)
+                break;
+        }
+        else if (rc == VERR_TIMEOUT && fPushing)
+            Msg.Hdr.GCPhys = NIL_RTGCPHYS;
+        else
+            break;
+
+        size_t cbMsg = sizeof(Msg);
+        Msg.Hdr.u32Magic = TELEPORTERPAGEHDR_MAGIC;
+        Msg.Hdr.u32Type  = TELEPORTERPAGEHDR_TYPE_PAGE;
+        rc = PGMR3PhysPostCopyReadPage(pState->mpUVM, (PRTGCPHYS)&Msg.Hdr.GCPhys, Msg.abPage);
+        if (RT_SUCCESS(rc))
+        {
+            if (fRequest)
+                cRequested++;
+            else
+                cPushed++;
+        }
+        else if (rc == VERR_NOT_FOUND)
+        {
+            /* Everything has been pushed, the target will answer DONE once
+               it has installed the lot. */
+            fPushing         = false;
+            Msg.Hdr.u32Type  = TELEPORTERPAGEHDR_TYPE_DONE;
+            Msg.Hdr.GCPhys   = NIL_RTGCPHYS;
+            cbMsg            = sizeof(Msg.Hdr);
+        }
+        else
+        {
+            LogRel(("Teleporter: PGMR3PhysPostCopyReadPage(%RX64) -> %Rrc\n", Msg.Hdr.GCPhys, rc));
+            break;
+        }
+
+        rc = RTTcpWrite(pState->mhSocket, &Msg, cbMsg);
+        if (RT_FAILURE(rc))
+            break;
+    }
+
+    LogRel(("Teleporter: Post-copy %s: %u pages requested, %u pushed (%Rrc)\n",
+            RT_SUCCESS(rc) ? "complete" : "failed", cRequested, cPushed, rc));
+    return rc;
+}
+
+
 /**
  * @copydoc SSMSTRMOPS::pfnWrite
  */
@@ -314,6 +551,7 @@ static DECLCALLBACK(int) teleporterTcpOpWrite(void *pvUser, uint64_t offStream,
     AssertReturn(cbToWrite > 0, VINF_SUCCESS);
     AssertReturn(cbToWrite < UINT32_MAX, VERR_OUT_OF_RANGE);
     AssertReturn(pState->mfIsSource, VERR_INVALID_HANDLE);
+    Console::teleporterSrcThrottle(static_cast<TeleporterStateSrc *>(pState), cbToWrite);
 
     for (;;)
     {
@@ -679,11 +917,57 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
      * Note! The saved state includes vital configuration data which will be
      *       verified against the VM config on the other end.  This is all done
      *       in the first pass, so we should fail pretty promptly on misconfig.
+     *
+     * In post-copy mode the final pass leaves out the pages the guest dirtied
+     * during the live passes; the target gets them after the hand-over.
      */
+    Bstr bstrPostCopy;
+    hrc = mMachine->GetExtraData(Bstr("VBoxInternal2/TeleporterPostCopy").raw(), bstrPostCopy.asOutParam());
+    if (   SUCCEEDED(hrc)
+        && bstrPostCopy == "1")
+    {
+        hrc = teleporterSrcSubmitCommand(pState, "post-copy");
+        if (FAILED(hrc))
+            return hrc;
+        vrc = PGMR3PhysPostCopyArm(pState->mpUVM);
+        if (RT_FAILURE(vrc))
+            return setError(E_FAIL, tr("PGMR3PhysPostCopyArm -> %Rrc"), vrc);
+        pState->mfPostCopy = true;
+    }
+
     hrc = teleporterSrcSubmitCommand(pState, "load");
     if (FAILED(hrc))
         return hrc;
 
+    /*
+     * Pick up the limits from the machine settings.  The console keeps them
+     * up to date should they be changed while we're teleporting.
+     */
+    ULONG ulCpuExecutionCap = 100;
+    hrc = mMachine->COMGETTER(CPUExecutionCap)(&ulCpuExecutionCap);
+    if (FAILED(hrc))
+        return hrc;
+    ASMAtomicWriteU32(&muTeleporterCpuCap, ulCpuExecutionCap);
+    pState->muCpuCapOrg    = ulCpuExecutionCap;
+    pState->muCpuCap       = ulCpuExecutionCap;
+
+    LONG64 cbMaxPerSec = 0;
+    ComPtr<IBandwidthControl> ptrBwCtrl;
+    hrc = mMachine->COMGETTER(BandwidthControl)(ptrBwCtrl.asOutParam());
+    if (SUCCEEDED(hrc))
+    {
+        ComPtr<IBandwidthGroup> ptrBwGroup;
+        hrc = ptrBwCtrl->GetBandwidthGroup(Bstr(TELEPORTER_BW_GROUP_NAME).raw(), ptrBwGroup.asOutParam());
+        if (SUCCEEDED(hrc))
+            hrc = ptrBwGroup->COMGETTER(MaxBytesPerSec)(&cbMaxPerSec);
+        if (FAILED(hrc))
+            cbMaxPerSec = 0; /* no such group, no limit */
+    }
+    ASMAtomicWriteU64(&mcbTeleporterMaxPerSec, cbMaxPerSec > 0 ? (uint64_t)cbMaxPerSec : 0);
+    if (cbMaxPerSec > 0)
+        LogRel(("Teleporter: Link limited to %RI64 bytes/s by the bandwidth group '%s'\n", cbMaxPerSec, TELEPORTER_BW_GROUP_NAME));
+    pState->mmsSampleStart = RTTimeMilliTS();
+
     RTSocketRetain(pState->mhSocket);
     void *pvUser = static_cast<void *>(static_cast<TeleporterState *>(pState));
     vrc = VMR3Teleport(pState->mpUVM,
@@ -692,6 +976,11 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
                        teleporterProgressCallback,  pvUser,
                        &pState->mfSuspendedByUs);
     RTSocketRelease(pState->mhSocket);
+    if (pState->muCpuCap != pState->muCpuCapOrg)
+    {
+        VMR3SetCpuExecutionCap(pState->mpUVM, pState->muCpuCapOrg);
+        pState->muCpuCap = pState->muCpuCapOrg;
+    }
     if (RT_FAILURE(vrc))
     {
         if (   vrc == VERR_SSM_CANCELLED
@@ -743,6 +1032,17 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    /*
+     * The target is now running without the pages left out by the final
+     * pass, so stick around and serve them till it has got everything.
+     */
+    if (pState->mfPostCopy)
+    {
+        vrc = teleporterSrcPostCopy(pState);
+        if (RT_FAILURE(vrc))
+            return setError(E_FAIL, tr("Post-copy teleportation failed: %Rrc"), vrc);
+    }
+
     /*
      * teleporterSrcThreadWrapper will do the automatic power off because it
      * has to release the AutoVMCaller.
@@ -1249,6 +1549,219 @@ static int teleporterTcpWriteNACK(TeleporterStateTrg *pState, int32_t rc2, const
 }
 
 
+/**
+ * @callback_method_impl{FNPGMPHYSPOSTCOPYREQUEST,
+ *      Requests a missing page from the source and waits for the receiver
+ *      thread to hand it to PGM.}
+ */
+static DECLCALLBACK(int) teleporterTrgPostCopyRequest(PUVM pUVM, RTGCPHYS GCPhys, void *pvUser)
+{
+    TeleporterStateTrg *pState = (TeleporterStateTrg *)pvUser;
+    NOREF(pUVM);
+
+    int rc = RTCritSectEnter(&pState->mPostCopyCritSect);
+    AssertRCReturn(rc, rc);
+    rc = ASMAtomicReadS32(&pState->mrcPostCopy);
+    if (RT_SUCCESS(rc))
+    {
+        ASMAtomicWriteU64(&pState->mGCPhysPostCopyRequest, GCPhys);
+
+        TELEPORTERPAGEHDR Hdr;
+        Hdr.u32Magic = TELEPORTERPAGEHDR_MAGIC;
+        Hdr.u32Type  = TELEPORTERPAGEHDR_TYPE_REQUEST;
+        Hdr.GCPhys   = GCPhys;
+        rc = RTTcpWrite(pState->mhSocket, &Hdr, sizeof(Hdr));
+        while (   RT_SUCCESS(rc)
+               && ASMAtomicReadU64(&pState->mGCPhysPostCopyRequest) == GCPhys)
+        {
+            rc = RTSemEventWait(pState->mhPostCopyEvent, TELEPORTER_POST_COPY_TIMEOUT_MS);
+            if (RT_SUCCESS(rc))
+                rc = ASMAtomicReadS32(&pState->mrcPostCopy);
+        }
+        ASMAtomicWriteU64(&pState->mGCPhysPostCopyRequest, NIL_RTGCPHYS);
+    }
+    RTCritSectLeave(&pState->mPostCopyCritSect);
+
+    if (RT_FAILURE(rc))
+        LogRel(("Teleporter: Requesting page %RGp failed: %Rrc\n", GCPhys, rc));
+    return rc;
+}
+
+
+/**
+ * Thread receiving the pages from the source in the post-copy phase.
+ *
+ * @returns VBox status code.
+ * @param   hThread         The thread handle.
+ * @param   pvUser          Pointer to the TeleporterStateTrg instance.
+ */
+static DECLCALLBACK(int) teleporterTrgPostCopyThread(RTTHREAD hThread, void *pvUser)
+{
+    TeleporterStateTrg *pState = (TeleporterStateTrg *)pvUser;
+    uint8_t             abPage[PAGE_SIZE];
+    uint32_t            cPages = 0;
+    int                 rc;
+    NOREF(hThread);
+
+    for (;;)
+    {
+        rc = RTTcpSelectOne(pState->mhSocket, TELEPORTER_POST_COPY_TIMEOUT_MS);
+        if (RT_FAILURE(rc))
+            break;
+        TELEPORTERPAGEHDR Hdr;
+        rc = RTTcpRead(pState->mhSocket, &Hdr, sizeof(Hdr), NULL);
+        if (RT_FAILURE(rc))
+            break;
+        if (   Hdr.u32Magic != TELEPORTERPAGEHDR_MAGIC
+            || (   Hdr.u32Type != TELEPORTERPAGEHDR_TYPE_PAGE
+                && Hdr.u32Type != TELEPORTERPAGEHDR_TYPE_DONE))
+        {
+            LogRel(("Teleporter: Invalid post-copy header %.*Rhxs\n", sizeof(Hdr), &Hdr));
+            rc = VERR_IO_GEN_FAILURE;
+            break;
+        }
+        if (Hdr.u32Type == TELEPORTERPAGEHDR_TYPE_DONE)
+            break;
+
+        rc = RTTcpRead(pState->mhSocket, abPage, sizeof(abPage), NULL);
+        if (RT_FAILURE(rc))
+            break;
+        rc = PGMR3PhysPostCopyPutPage(pState->mpUVM, Hdr.GCPhys, abPage);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("Teleporter: PGMR3PhysPostCopyPutPage(%RX64) -> %Rrc\n", Hdr.GCPhys, rc));
+            break;
+        }
+        cPages++;
+        if (ASMAtomicCmpXchgU64(&pState->mGCPhysPostCopyRequest, NIL_RTGCPHYS, Hdr.GCPhys))
+            RTSemEventSignal(pState->mhPostCopyEvent);
+    }
+
+    /*
+     * Everything has arrived.  Wait for the EMTs to install the pages still
+     * staged, after which PGM won't call teleporterTrgPostCopyRequest again,
+     * and tell the source it can go away.
+     */
+    while (   RT_SUCCESS(rc)
+           && PGMR3PhysPostCopyGetPending(pState->mpUVM) > 0)
+    {
+        switch (VMR3GetStateU(pState->mpUVM))
+        {
+            case VMSTATE_OFF:
+            case VMSTATE_OFF_LS:
+            case VMSTATE_POWERING_OFF:
+            case VMSTATE_POWERING_OFF_LS:
+            case VMSTATE_FATAL_ERROR:
+            case VMSTATE_FATAL_ERROR_LS:
+            case VMSTATE_GURU_MEDITATION:
+            case VMSTATE_GURU_MEDITATION_LS:
+            case VMSTATE_DESTROYING:
+            case VMSTATE_TERMINATED:
+                rc = VERR_VM_INVALID_VM_STATE;
+                break;
+            default:
+                RTThreadSleep(10);
+                break;
+        }
+    }
+    if (RT_SUCCESS(rc))
+    {
+        TELEPORTERPAGEHDR Hdr;
+        Hdr.u32Magic = TELEPORTERPAGEHDR_MAGIC;
+        Hdr.u32Type  = TELEPORTERPAGEHDR_TYPE_DONE;
+        Hdr.GCPhys   = NIL_RTGCPHYS;
+        rc = RTTcpWrite(pState->mhSocket, &Hdr, sizeof(Hdr));
+    }
+
+    if (RT_FAILURE(rc))
+    {
+        /* Fail pending and future requests. */
+        ASMAtomicCmpXchgS32(&pState->mrcPostCopy, rc, VINF_SUCCESS);
+        RTSemEventSignal(pState->mhPostCopyEvent);
+        PGMR3PhysPostCopyAbort(pState->mpUVM);
+    }
+    LogRel(("Teleporter: Post-copy %s: %u pages received (%Rrc)\n",
+            RT_SUCCESS(rc) ? "complete" : "failed", cPages, rc));
+    return rc;
+}
+
+
+/**
+ * Starts the post-copy phase right after ACKing the hand-over.
+ *
+ * Must be paired with a teleporterTrgPostCopyFinish call.
+ *
+ * @returns VBox status code.
+ * @param   pState          The teleporter target state.
+ */
+static int teleporterTrgPostCopyStart(TeleporterStateTrg *pState)
+{
+    int rc = RTCritSectInit(&pState->mPostCopyCritSect);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pState->mhPostCopyEvent);
+    if (RT_SUCCESS(rc))
+    {
+        RTSocketRetain(pState->mhSocket); /* For concurrent access by the receiver thread and EMTs. */
+        rc = RTThreadCreate(&pState->mhPostCopyThread, teleporterTrgPostCopyThread, pState, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "TeleportPC");
+        if (RT_FAILURE(rc))
+        {
+            pState->mhPostCopyThread = NIL_RTTHREAD;
+            RTSocketRelease(pState->mhSocket);
+        }
+    }
+    if (RT_SUCCESS(rc))
+        rc = PGMR3PhysPostCopyStart(pState->mpUVM, teleporterTrgPostCopyRequest, pState);
+    if (RT_FAILURE(rc))
+        LogRel(("Teleporter: Failed to start the post-copy phase: %Rrc\n", rc));
+    return rc;
+}
+
+
+/**
+ * Waits for the post-copy phase to complete and cleans up after it.
+ *
+ * @returns VBox status code.
+ * @param   pState          The teleporter target state.
+ * @param   rc              The status so far.  The post-copy phase is aborted
+ *                          if this is a failure.
+ */
+static int teleporterTrgPostCopyFinish(TeleporterStateTrg *pState, int rc)
+{
+    if (pState->mhPostCopyThread != NIL_RTTHREAD)
+    {
+        if (RT_FAILURE(rc))
+        {
+            ASMAtomicCmpXchgS32(&pState->mrcPostCopy, rc, VINF_SUCCESS);
+            RTSemEventSignal(pState->mhPostCopyEvent);
+            RTSocketShutdown(pState->mhSocket, true /*fRead*/, true /*fWrite*/);
+        }
+
+        int rcThread = VERR_INTERNAL_ERROR;
+        int rc2 = RTThreadWait(pState->mhPostCopyThread, RT_INDEFINITE_WAIT, &rcThread);
+        AssertLogRelRC(rc2);
+        if (RT_SUCCESS(rc))
+            rc = RT_SUCCESS(rc2) ? rcThread : rc2;
+        pState->mhPostCopyThread = NIL_RTTHREAD;
+        RTSocketRelease(pState->mhSocket);
+    }
+
+    /* Make sure PGM is done with teleporterTrgPostCopyRequest before the
+       state goes away. */
+    if (RT_FAILURE(rc))
+        PGMR3PhysPostCopyAbort(pState->mpUVM);
+
+    if (pState->mhPostCopyEvent != NIL_RTSEMEVENT)
+    {
+        RTSemEventDestroy(pState->mhPostCopyEvent);
+        pState->mhPostCopyEvent = NIL_RTSEMEVENT;
+    }
+    if (RTCritSectIsInitialized(&pState->mPostCopyCritSect))
+        RTCritSectDelete(&pState->mPostCopyCritSect);
+    return rc;
+}
+
+
 /**
  * @copydoc FNRTTCPSERVE
  *
@@ -1375,6 +1888,11 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
 
             vrc = teleporterTcpWriteACK(pState);
         }
+        else if (!strcmp(szCmd, "post-copy"))
+        {
+            pState->mfPostCopy = true;
+            vrc = teleporterTcpWriteACK(pState);
+        }
         else if (!strcmp(szCmd, "cancel"))
         {
             /* Don't ACK this. */
@@ -1415,10 +1933,19 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
                 vrc = teleporterTcpWriteACK(pState);
                 if (RT_SUCCESS(vrc))
                 {
-                    if (!strcmp(szCmd, "hand-over-resume"))
-                        vrc = VMR3Resume(pState->mpUVM, VMRESUMEREASON_TELEPORTED);
-                    else
-                        pState->mptrConsole->setMachineState(MachineState_Paused);
+                    /* In post-copy mode, the missing pages are pulled in
+                       on demand while the VM runs. */
+                    if (pState->mfPostCopy)
+                        vrc = teleporterTrgPostCopyStart(pState);
+                    if (RT_SUCCESS(vrc))
+                    {
+                        if (!strcmp(szCmd, "hand-over-resume"))
+                            vrc = VMR3Resume(pState->mpUVM, VMRESUMEREASON_TELEPORTED);
+                        else
+                            pState->mptrConsole->setMachineState(MachineState_Paused);
+                    }
+                    if (pState->mfPostCopy)
+                        vrc = teleporterTrgPostCopyFinish(pState, vrc);
                     fDone = true;
                     break;
                 }
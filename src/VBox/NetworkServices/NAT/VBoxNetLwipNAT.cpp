@@ -96,6 +96,7 @@ extern "C"
 #include "netif/etharp.h"
 
 #include "proxy.h"
+#include "proxy_pollmgr.h"
 #include "pxremap.h"
 #include "portfwd.h"
 }
@@ -630,6 +631,7 @@ VBoxNetLwipNAT::VBoxNetLwipNAT(SOCKET icmpsock4, SOCKET icmpsock6) : VBoxNetBase
     m_src6.sin6_len = sizeof(m_src6);
 #endif
     m_ProxyOptions.nameservers = NULL;
+    m_ProxyOptions.pollmgr_threads = 0;
 
     m_LwipNetIf.name[0] = 'N';
     m_LwipNetIf.name[1] = 'T';
@@ -819,6 +821,21 @@ int VBoxNetLwipNAT::init()
         }
     }
 
+    /* number of poll manager threads, default is one per host cpu */
+    com::Bstr bstrThreadsKey = com::BstrFmt("NAT/%s/PollManagerThreads", networkName.c_str());
+    com::Bstr bstrThreads;
+    hrc = virtualbox->GetExtraData(bstrThreadsKey.raw(), bstrThreads.asOutParam());
+    if (SUCCEEDED(hrc) && !bstrThreads.isEmpty())
+    {
+        uint32_t cThreads = 0;
+        rc = RTStrToUInt32Full(com::Utf8Str(bstrThreads).c_str(), 10, &cThreads);
+        if (rc == VINF_SUCCESS && cThreads <= POLLMGR_MAX_SHARDS)
+            m_ProxyOptions.pollmgr_threads = (int)cThreads;
+        else
+            LogRel(("Ignoring invalid %ls value \"%ls\"\n",
+                    bstrThreadsKey.raw(), bstrThreads.raw()));
+    }
+
     if (!fDontLoadRulesOnStartup)
     {
         fetchNatPortForwardRules(m_net, false, m_vecPortForwardRule4);
@@ -1029,6 +1046,8 @@ int VBoxNetLwipNAT::run()
     /* Father starts receiving thread and enter event loop. */
     VBoxNetBaseService::run();
 
+    pollmgr_log_stats();
+
     vboxLwipCoreFinalize(VBoxNetLwipNAT::onLwipTcpIpFini, this);
 
     m_vecPortForwardRule4.clear();
@@ -122,7 +122,7 @@ fwtcp_del(struct fwspec *fwspec)
 
     DPRINTF0(("%s\n", __func__));
 
-    pollmgr_del_slot(fwtcp->pmhdl.slot);
+    pollmgr_del_slot(&fwtcp->pmhdl);
     fwtcp->pmhdl.slot = -1;
 
     closesocket(fwtcp->sock);
@@ -155,6 +155,7 @@ fwtcp_create(struct fwspec *fwspec)
     fwtcp->pmhdl.callback = fwtcp_pmgr_listen;
     fwtcp->pmhdl.data = (void *)fwtcp;
     fwtcp->pmhdl.slot = -1;
+    fwtcp->pmhdl.shard = POLLMGR_SHARD_MAIN;
 
     fwtcp->sock = lsock;
     fwtcp->fwspec = *fwspec;    /* struct copy */
@@ -153,7 +153,7 @@ fwudp_del(struct fwspec *fwspec)
 
     DPRINTF0(("%s\n", __func__));
 
-    pollmgr_del_slot(fwudp->pmhdl.slot);
+    pollmgr_del_slot(&fwudp->pmhdl);
     fwudp->pmhdl.slot = -1;
 
     /* let pending msg_send be processed before we delete fwudp */
@@ -182,6 +182,7 @@ fwudp_create(struct fwspec *fwspec)
     fwudp->pmhdl.callback = fwudp_pmgr_pump;
     fwudp->pmhdl.data = (void *)fwudp;
     fwudp->pmhdl.slot = -1;
+    fwudp->pmhdl.shard = POLLMGR_SHARD_MAIN;
 
     fwudp->sock = sock;
     fwudp->fwspec = *fwspec;    /* struct copy */
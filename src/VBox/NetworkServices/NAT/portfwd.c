@@ -41,6 +41,7 @@ portfwd_init(void)
     portfwd_pmgr_chan_hdl.callback = portfwd_pmgr_chan;
     portfwd_pmgr_chan_hdl.data = NULL;
     portfwd_pmgr_chan_hdl.slot = -1;
+    portfwd_pmgr_chan_hdl.shard = POLLMGR_SHARD_MAIN;
     pollmgr_add_chan(POLLMGR_CHAN_PORTFWD, &portfwd_pmgr_chan_hdl);
 
     /* add preconfigured forwarders */
@@ -54,7 +55,8 @@ portfwd_chan_send(struct portfwd_msg *msg)
 {
     ssize_t nsent;
 
-    nsent = pollmgr_chan_send(POLLMGR_CHAN_PORTFWD, &msg, sizeof(msg));
+    nsent = pollmgr_chan_send(POLLMGR_SHARD_MAIN, POLLMGR_CHAN_PORTFWD,
+                              &msg, sizeof(msg));
     if (nsent < 0) {
         free(msg);
         return -1;
@@ -12,6 +12,8 @@
 #include "lwip/sys.h"
 #include "lwip/tcpip.h"
 
+#include <iprt/mp.h>
+
 #ifndef RT_OS_WINDOWS
 #include <sys/poll.h>
 #include <sys/socket.h>
@@ -39,7 +41,7 @@ static FNRTSTRFORMATTYPE proxy_sockerr_rtstrfmt;
 static SOCKET proxy_create_socket(int, int);
 
 volatile struct proxy_options *g_proxy_options;
-static sys_thread_t pollmgr_tid;
+static sys_thread_t pollmgr_tid[POLLMGR_MAX_SHARDS];
 
 /* XXX: for mapping loopbacks to addresses in our network (ip4) */
 struct netif *g_proxy_netif;
@@ -53,7 +55,9 @@ struct netif *g_proxy_netif;
 void
 proxy_init(struct netif *proxy_netif, struct proxy_options *opts)
 {
+    int nshards;
     int status;
+    int i;
 
     LWIP_ASSERT1(opts != NULL);
     LWIP_UNUSED_ARG(proxy_netif);
@@ -81,7 +85,16 @@ proxy_init(struct netif *proxy_netif, struct proxy_options *opts)
         tftpd_init(proxy_netif, opts->tftp_root);
     }
 
-    status = pollmgr_init();
+    /*
+     * Proxied flows are spread over poll manager shards, one thread
+     * each.  By default use one shard per online cpu.
+     */
+    nshards = opts->pollmgr_threads;
+    if (nshards <= 0) {
+        nshards = (int)RTMpGetOnlineCount();
+    }
+
+    status = pollmgr_init(nshards);
     if (status < 0) {
         errx(EXIT_FAILURE, "failed to initialize poll manager");
         /* NOTREACHED */
@@ -96,14 +109,20 @@ proxy_init(struct netif *proxy_netif, struct proxy_options *opts)
 
     pxping_init(proxy_netif, opts->icmpsock4, opts->icmpsock6);
 
-    pollmgr_tid = sys_thread_new("pollmgr_thread",
-                                 pollmgr_thread, NULL,
-                                 DEFAULT_THREAD_STACKSIZE,
-                                 DEFAULT_THREAD_PRIO);
-    if (!pollmgr_tid) {
-        errx(EXIT_FAILURE, "failed to create poll manager thread");
-        /* NOTREACHED */
+    nshards = pollmgr_shard_count();
+    for (i = 0; i < nshards; ++i) {
+        pollmgr_tid[i] = sys_thread_new("pollmgr_thread",
+                                        pollmgr_thread, (void *)(intptr_t)i,
+                                        DEFAULT_THREAD_STACKSIZE,
+                                        DEFAULT_THREAD_PRIO);
+        if (!pollmgr_tid[i]) {
+            errx(EXIT_FAILURE, "failed to create poll manager thread");
+            /* NOTREACHED */
+        }
     }
+
+    DPRINTF0(("%s: %d poll manager shard%s\n",
+              __func__, nshards, (nshards == 1 ? "" : "s")));
 }
 
 
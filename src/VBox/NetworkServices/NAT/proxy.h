@@ -39,6 +39,7 @@ struct proxy_options {
     const struct sockaddr_in6 *src6;
     const struct ip4_lomap_desc *lomap_desc;
     const char **nameservers;
+    int pollmgr_threads;        /* poll manager shards, 0 - one per cpu */
 };
 
 extern volatile struct proxy_options *g_proxy_options;
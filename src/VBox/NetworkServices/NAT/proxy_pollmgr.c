@@ -23,6 +23,7 @@
 #include <string.h>
 #include "winpoll.h"
 #endif
+#include <iprt/log.h>
 
 #define POLLMGR_GARBAGE (-1)
 
@@ -36,12 +37,21 @@ struct pollmgr {
     SOCKET chan[POLLMGR_SLOT_STATIC_COUNT][2];
 #define POLLMGR_CHFD_RD 0       /* - pollmgr side */
 #define POLLMGR_CHFD_WR 1       /* - client side */
-} pollmgr;
 
+    int shard;                  /* our index in pollmgr_shards[] */
+    u8_t *udpbuf;               /* see pollmgr_udpbuf_get() */
+    struct pollmgr_stats stats;
+};
 
-static void pollmgr_loop(void);
+static struct pollmgr pollmgr_shards[POLLMGR_MAX_SHARDS];
+static int pollmgr_nshards;
 
-static void pollmgr_add_at(int, struct pollmgr_handler *, SOCKET, int);
+
+static int pollmgr_init_shard(struct pollmgr *, int);
+static void pollmgr_fini_shard(struct pollmgr *);
+static void pollmgr_loop(struct pollmgr *);
+
+static void pollmgr_add_at(struct pollmgr *, int, struct pollmgr_handler *, SOCKET, int);
 static void pollmgr_refptr_delete(struct pollmgr_refptr *);
 
 
@@ -54,13 +64,94 @@ static void pollmgr_refptr_delete(struct pollmgr_refptr *);
  * fragmentation.
  *
  * We can use shared buffer here since we read from sockets
- * sequentially in a loop over pollfd.
+ * sequentially in a loop over pollfd.  That's only true within a
+ * shard, so each shard has its own buffer and this one is used by
+ * the main shard.
  */
-u8_t pollmgr_udpbuf[64 * 1024];
+u8_t pollmgr_udpbuf[POLLMGR_UDPBUF_SIZE];
 
 
+/**
+ * Initialize "nshards" poll manager shards.  The shard threads are
+ * created by the caller with pollmgr_thread() after all channels have
+ * been registered.
+ */
 int
-pollmgr_init(void)
+pollmgr_init(int nshards)
+{
+    int status;
+    int i;
+
+    if (nshards < 1) {
+        nshards = 1;
+    }
+    else if (nshards > POLLMGR_MAX_SHARDS) {
+        nshards = POLLMGR_MAX_SHARDS;
+    }
+
+    for (i = 0; i < nshards; ++i) {
+        status = pollmgr_init_shard(&pollmgr_shards[i], i);
+        if (status < 0) {
+            while (i-- > 0) {
+                pollmgr_fini_shard(&pollmgr_shards[i]);
+            }
+            return -1;
+        }
+    }
+
+    pollmgr_nshards = nshards;
+    return 0;
+}
+
+
+int
+pollmgr_shard_count(void)
+{
+    return pollmgr_nshards;
+}
+
+
+/**
+ * Map a flow to a shard.  The hash is symmetric in the endpoints, so
+ * both directions of a conversation end up on the same shard.
+ */
+int
+pollmgr_flow_shard(int is_ipv6,
+                   const ipX_addr_t *addr1, u16_t port1,
+                   const ipX_addr_t *addr2, u16_t port2)
+{
+    u32_t h1, h2, h;
+
+    if (pollmgr_nshards <= 1) {
+        return POLLMGR_SHARD_MAIN;
+    }
+
+    if (is_ipv6) {
+        const u32_t *a1 = addr1->ip6.addr;
+        const u32_t *a2 = addr2->ip6.addr;
+        h1 = a1[0] ^ a1[1] ^ a1[2] ^ a1[3];
+        h2 = a2[0] ^ a2[1] ^ a2[2] ^ a2[3];
+    }
+    else {
+        h1 = addr1->ip4.addr;
+        h2 = addr2->ip4.addr;
+    }
+
+    h = (h1 ^ h2) ^ ((u32_t)port1 ^ (u32_t)port2) * 0x9e3779b1U;
+
+    /* final avalanche (murmur3 fmix32) */
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return (int)(h % (u32_t)pollmgr_nshards);
+}
+
+
+static int
+pollmgr_init_shard(struct pollmgr *pollmgr, int shard)
 {
     struct pollfd *newfds;
     struct pollmgr_handler **newhdls;
@@ -68,25 +159,38 @@ pollmgr_init(void)
     int status;
     nfds_t i;
 
-    pollmgr.fds = NULL;
-    pollmgr.handlers = NULL;
-    pollmgr.capacity = 0;
-    pollmgr.nfds = 0;
+    pollmgr->fds = NULL;
+    pollmgr->handlers = NULL;
+    pollmgr->capacity = 0;
+    pollmgr->nfds = 0;
+    pollmgr->shard = shard;
+    memset(&pollmgr->stats, 0, sizeof(pollmgr->stats));
+
+    if (shard == POLLMGR_SHARD_MAIN) {
+        pollmgr->udpbuf = pollmgr_udpbuf;
+    }
+    else {
+        pollmgr->udpbuf = (u8_t *)malloc(POLLMGR_UDPBUF_SIZE);
+        if (pollmgr->udpbuf == NULL) {
+            DPRINTF(("%s: Failed to allocate udp buffer\n", __func__));
+            return -1;
+        }
+    }
 
     for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
-        pollmgr.chan[i][POLLMGR_CHFD_RD] = -1;
-        pollmgr.chan[i][POLLMGR_CHFD_WR] = -1;
+        pollmgr->chan[i][POLLMGR_CHFD_RD] = -1;
+        pollmgr->chan[i][POLLMGR_CHFD_WR] = -1;
     }
 
     for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
 #ifndef RT_OS_WINDOWS
-        status = socketpair(PF_LOCAL, SOCK_DGRAM, 0, pollmgr.chan[i]);
+        status = socketpair(PF_LOCAL, SOCK_DGRAM, 0, pollmgr->chan[i]);
         if (status < 0) {
             DPRINTF(("socketpair: %R[sockerr]\n", SOCKERRNO()));
             goto cleanup_close;
         }
 #else
-        status = RTWinSocketPair(PF_INET, SOCK_DGRAM, 0, pollmgr.chan[i]);
+        status = RTWinSocketPair(PF_INET, SOCK_DGRAM, 0, pollmgr->chan[i]);
         if (RT_FAILURE(status)) {
             goto cleanup_close;
         }
@@ -98,94 +202,138 @@ pollmgr_init(void)
     LWIP_ASSERT1(newcap >= POLLMGR_SLOT_STATIC_COUNT);
 
     newfds = (struct pollfd *)
-        malloc(newcap * sizeof(*pollmgr.fds));
+        malloc(newcap * sizeof(*pollmgr->fds));
     if (newfds == NULL) {
         DPRINTF(("%s: Failed to allocate fds array\n", __func__));
         goto cleanup_close;
     }
 
     newhdls = (struct pollmgr_handler **)
-        malloc(newcap * sizeof(*pollmgr.handlers));
+        malloc(newcap * sizeof(*pollmgr->handlers));
     if (newhdls == NULL) {
         DPRINTF(("%s: Failed to allocate handlers array\n", __func__));
         free(newfds);
         goto cleanup_close;
     }
 
-    pollmgr.capacity = newcap;
-    pollmgr.fds = newfds;
-    pollmgr.handlers = newhdls;
+    pollmgr->capacity = newcap;
+    pollmgr->fds = newfds;
+    pollmgr->handlers = newhdls;
 
-    pollmgr.nfds = POLLMGR_SLOT_STATIC_COUNT;
+    pollmgr->nfds = POLLMGR_SLOT_STATIC_COUNT;
 
-    for (i = 0; i < pollmgr.capacity; ++i) {
-        pollmgr.fds[i].fd = INVALID_SOCKET;
-        pollmgr.fds[i].events = 0;
-        pollmgr.fds[i].revents = 0;
+    for (i = 0; i < pollmgr->capacity; ++i) {
+        pollmgr->fds[i].fd = INVALID_SOCKET;
+        pollmgr->fds[i].events = 0;
+        pollmgr->fds[i].revents = 0;
+        pollmgr->handlers[i] = NULL;
     }
 
     return 0;
 
   cleanup_close:
+    pollmgr_fini_shard(pollmgr);
+    return -1;
+}
+
+
+/*
+ * Undo pollmgr_init_shard() for the init failure path.  Shards are
+ * never torn down once their threads run.
+ */
+static void
+pollmgr_fini_shard(struct pollmgr *pollmgr)
+{
+    nfds_t i;
+
     for (i = 0; i < POLLMGR_SLOT_STATIC_COUNT; ++i) {
-        SOCKET *chan = pollmgr.chan[i];
+        SOCKET *chan = pollmgr->chan[i];
         if (chan[POLLMGR_CHFD_RD] >= 0) {
             closesocket(chan[POLLMGR_CHFD_RD]);
             closesocket(chan[POLLMGR_CHFD_WR]);
+            chan[POLLMGR_CHFD_RD] = -1;
+            chan[POLLMGR_CHFD_WR] = -1;
         }
     }
 
-    return -1;
+    free(pollmgr->fds);
+    free(pollmgr->handlers);
+    pollmgr->fds = NULL;
+    pollmgr->handlers = NULL;
+    pollmgr->capacity = 0;
+    pollmgr->nfds = 0;
+
+    if (pollmgr->udpbuf != pollmgr_udpbuf) {
+        free(pollmgr->udpbuf);
+    }
+    pollmgr->udpbuf = NULL;
 }
 
 
 /*
  * Must be called before pollmgr loop is started, so no locking.
+ *
+ * The channel is registered with every shard, so that flows on any
+ * shard can be reached over it.  Channel handlers are stateless and
+ * the slot number is the same in every shard.
  */
 SOCKET
 pollmgr_add_chan(int slot, struct pollmgr_handler *handler)
 {
+    int i;
+
     if (slot >= POLLMGR_SLOT_FIRST_DYNAMIC) {
         handler->slot = -1;
         return -1;
     }
 
-    pollmgr_add_at(slot, handler, pollmgr.chan[slot][POLLMGR_CHFD_RD], POLLIN);
-    return pollmgr.chan[slot][POLLMGR_CHFD_WR];
+    for (i = 0; i < pollmgr_nshards; ++i) {
+        struct pollmgr *pollmgr = &pollmgr_shards[i];
+        pollmgr_add_at(pollmgr, slot, handler,
+                       pollmgr->chan[slot][POLLMGR_CHFD_RD], POLLIN);
+    }
+    handler->shard = POLLMGR_SHARD_MAIN;
+
+    return pollmgr_shards[POLLMGR_SHARD_MAIN].chan[slot][POLLMGR_CHFD_WR];
 }
 
 
 /*
- * Must be called from pollmgr loop (via callbacks), so no locking.
+ * Must be called from the pollmgr loop of the handler's shard (via
+ * callbacks), or before the loops are started, so no locking.
  */
 int
 pollmgr_add(struct pollmgr_handler *handler, SOCKET fd, int events)
 {
+    struct pollmgr *pollmgr;
     int slot;
 
-    DPRINTF2(("%s: new fd %d\n", __func__, fd));
+    LWIP_ASSERT1(handler->shard >= 0 && handler->shard < pollmgr_nshards);
+    pollmgr = &pollmgr_shards[handler->shard];
 
-    if (pollmgr.nfds == pollmgr.capacity) {
+    DPRINTF2(("%s: new fd %d (shard %d)\n", __func__, fd, handler->shard));
+
+    if (pollmgr->nfds == pollmgr->capacity) {
         struct pollfd *newfds;
         struct pollmgr_handler **newhdls;
         nfds_t newcap;
         nfds_t i;
 
-        newcap = pollmgr.capacity * 2;
+        newcap = pollmgr->capacity * 2;
 
         newfds = (struct pollfd *)
-            realloc(pollmgr.fds, newcap * sizeof(*pollmgr.fds));
+            realloc(pollmgr->fds, newcap * sizeof(*pollmgr->fds));
         if (newfds == NULL) {
             DPRINTF(("%s: Failed to reallocate fds array\n", __func__));
             handler->slot = -1;
             return -1;
         }
 
-        pollmgr.fds = newfds; /* don't crash/leak if realloc(handlers) fails */
+        pollmgr->fds = newfds; /* don't crash/leak if realloc(handlers) fails */
         /* but don't update capacity yet! */
 
         newhdls = (struct pollmgr_handler **)
-            realloc(pollmgr.handlers, newcap * sizeof(*pollmgr.handlers));
+            realloc(pollmgr->handlers, newcap * sizeof(*pollmgr->handlers));
         if (newhdls == NULL) {
             DPRINTF(("%s: Failed to reallocate handlers array\n", __func__));
             /* if we failed to realloc here, then fds points to the
@@ -194,10 +342,10 @@ pollmgr_add(struct pollmgr_handler *handler, SOCKET fd, int events)
             return -1;
         }
 
-        pollmgr.handlers = newhdls;
-        pollmgr.capacity = newcap;
+        pollmgr->handlers = newhdls;
+        pollmgr->capacity = newcap;
 
-        for (i = pollmgr.nfds; i < newcap; ++i) {
+        for (i = pollmgr->nfds; i < newcap; ++i) {
             newfds[i].fd = INVALID_SOCKET;
             newfds[i].events = 0;
             newfds[i].revents = 0;
@@ -205,28 +353,40 @@ pollmgr_add(struct pollmgr_handler *handler, SOCKET fd, int events)
         }
     }
 
-    slot = pollmgr.nfds;
-    ++pollmgr.nfds;
+    slot = pollmgr->nfds;
+    ++pollmgr->nfds;
+
+    ++pollmgr->stats.added;
+    ++pollmgr->stats.nfds;
+    if (pollmgr->stats.nfds > pollmgr->stats.maxfds) {
+        pollmgr->stats.maxfds = pollmgr->stats.nfds;
+    }
 
-    pollmgr_add_at(slot, handler, fd, events);
+    pollmgr_add_at(pollmgr, slot, handler, fd, events);
     return slot;
 }
 
 
 static void
-pollmgr_add_at(int slot, struct pollmgr_handler *handler, SOCKET fd, int events)
+pollmgr_add_at(struct pollmgr *pollmgr, int slot,
+               struct pollmgr_handler *handler, SOCKET fd, int events)
 {
-    pollmgr.fds[slot].fd = fd;
-    pollmgr.fds[slot].events = events;
-    pollmgr.fds[slot].revents = 0;
-    pollmgr.handlers[slot] = handler;
+    pollmgr->fds[slot].fd = fd;
+    pollmgr->fds[slot].events = events;
+    pollmgr->fds[slot].revents = 0;
+    pollmgr->handlers[slot] = handler;
 
     handler->slot = slot;
+    handler->shard = pollmgr->shard;
 }
 
 
+/**
+ * Send to the channel "slot" of the given shard.  Messages about a
+ * flow must be sent to the shard that polls it (pmhdl.shard).
+ */
 ssize_t
-pollmgr_chan_send(int slot, void *buf, size_t nbytes)
+pollmgr_chan_send(int shard, int slot, void *buf, size_t nbytes)
 {
     SOCKET fd;
     ssize_t nsent;
@@ -235,7 +395,9 @@ pollmgr_chan_send(int slot, void *buf, size_t nbytes)
         return -1;
     }
 
-    fd = pollmgr.chan[slot][POLLMGR_CHFD_WR];
+    LWIP_ASSERT1(shard >= 0 && shard < pollmgr_nshards);
+
+    fd = pollmgr_shards[shard].chan[slot][POLLMGR_CHFD_WR];
     nsent = send(fd, buf, (int)nbytes, 0);
     if (nsent == SOCKET_ERROR) {
         DPRINTF(("send on chan %d: %R[sockerr]\n", slot, SOCKERRNO()));
@@ -287,38 +449,97 @@ pollmgr_chan_recv_ptr(struct pollmgr_handler *handler, SOCKET fd, int revents)
 }
 
 
+/*
+ * Must be called from the pollmgr loop of the handler's shard.
+ */
 void
-pollmgr_update_events(int slot, int events)
+pollmgr_update_events(struct pollmgr_handler *handler, int events)
 {
+    struct pollmgr *pollmgr = &pollmgr_shards[handler->shard];
+    const int slot = handler->slot;
+
     LWIP_ASSERT1(slot >= POLLMGR_SLOT_FIRST_DYNAMIC);
-    LWIP_ASSERT1((nfds_t)slot < pollmgr.nfds);
+    LWIP_ASSERT1((nfds_t)slot < pollmgr->nfds);
 
-    pollmgr.fds[slot].events = events;
+    pollmgr->fds[slot].events = events;
 }
 
 
+/*
+ * Must be called from the pollmgr loop of the handler's shard.
+ */
 void
-pollmgr_del_slot(int slot)
+pollmgr_del_slot(struct pollmgr_handler *handler)
 {
+    struct pollmgr *pollmgr = &pollmgr_shards[handler->shard];
+    const int slot = handler->slot;
+
     LWIP_ASSERT1(slot >= POLLMGR_SLOT_FIRST_DYNAMIC);
 
     DPRINTF2(("%s(%d): fd %d ! DELETED\n",
-              __func__, slot, pollmgr.fds[slot].fd));
+              __func__, slot, pollmgr->fds[slot].fd));
+
+    pollmgr->fds[slot].fd = INVALID_SOCKET; /* see poll loop */
+}
+
+
+/**
+ * Thread function for a poll manager shard.  The argument is the
+ * shard index cast to a pointer.
+ */
+void
+pollmgr_thread(void *arg)
+{
+    const int shard = (int)(intptr_t)arg;
+
+    LWIP_ASSERT1(shard >= 0 && shard < pollmgr_nshards);
+    pollmgr_loop(&pollmgr_shards[shard]);
+}
+
+
+/**
+ * Receive buffer for udp callbacks of the handler's shard.
+ */
+u8_t *
+pollmgr_udpbuf_get(struct pollmgr_handler *handler)
+{
+    LWIP_ASSERT1(handler->shard >= 0 && handler->shard < pollmgr_nshards);
+    return pollmgr_shards[handler->shard].udpbuf;
+}
 
-    pollmgr.fds[slot].fd = INVALID_SOCKET; /* see poll loop */
+
+/**
+ * Snapshot of shard counters.  They are updated without locking by
+ * the shard thread, so values read from other threads are
+ * approximate.
+ */
+void
+pollmgr_get_stats(int shard, struct pollmgr_stats *stats)
+{
+    LWIP_ASSERT1(shard >= 0 && shard < pollmgr_nshards);
+    *stats = pollmgr_shards[shard].stats;
 }
 
 
 void
-pollmgr_thread(void *ignored)
+pollmgr_log_stats(void)
 {
-    LWIP_UNUSED_ARG(ignored);
-    pollmgr_loop();
+    struct pollmgr_stats stats;
+    int i;
+
+    for (i = 0; i < pollmgr_nshards; ++i) {
+        pollmgr_get_stats(i, &stats);
+        LogRel(("NAT: pollmgr shard %d: polls %RU64, events %RU64"
+                " (channel %RU64), fds %RU32 (max %RU32),"
+                " added %RU64, deleted %RU64\n",
+                i, stats.polls, stats.events, stats.chanmsgs,
+                stats.nfds, stats.maxfds, stats.added, stats.deleted));
+    }
 }
 
 
 static void
-pollmgr_loop(void)
+pollmgr_loop(struct pollmgr *pollmgr)
 {
     int nready;
     SOCKET delfirst;
@@ -327,9 +548,9 @@ pollmgr_loop(void)
 
     for (;;) {
 #ifndef RT_OS_WINDOWS
-        nready = poll(pollmgr.fds, pollmgr.nfds, -1);
+        nready = poll(pollmgr->fds, pollmgr->nfds, -1);
 #else
-        int rc = RTWinPoll(pollmgr.fds, pollmgr.nfds,RT_INDEFINITE_WAIT, &nready);
+        int rc = RTWinPoll(pollmgr->fds, pollmgr->nfds,RT_INDEFINITE_WAIT, &nready);
         if (RT_FAILURE(rc)) {
             err(EXIT_FAILURE, "poll"); /* XXX: what to do on error? */
             /* NOTREACHED*/
@@ -351,17 +572,18 @@ pollmgr_loop(void)
             continue;           /* - but be defensive */
         }
 
+        ++pollmgr->stats.polls;
 
         delfirst = INVALID_SOCKET;
         pdelprev = &delfirst;
 
-        for (i = 0; (nfds_t)i < pollmgr.nfds && nready > 0; ++i) {
+        for (i = 0; (nfds_t)i < pollmgr->nfds && nready > 0; ++i) {
             struct pollmgr_handler *handler;
             SOCKET fd;
             int revents, nevents;
 
-            fd = pollmgr.fds[i].fd;
-            revents = pollmgr.fds[i].revents;
+            fd = pollmgr->fds[i].fd;
+            revents = pollmgr->fds[i].revents;
 
             /*
              * Channel handlers can request deletion of dynamic slots
@@ -383,7 +605,7 @@ pollmgr_loop(void)
             }
             --nready;
 
-            handler = pollmgr.handlers[i];
+            handler = pollmgr->handlers[i];
 
             if (handler != NULL && handler->callback != NULL) {
 #if LWIP_PROXY_DEBUG /* DEBUG */
@@ -401,6 +623,10 @@ pollmgr_loop(void)
                               __func__, fd, revents));
                 }
 #endif /* DEBUG */
+                ++pollmgr->stats.events;
+                if (i < POLLMGR_SLOT_FIRST_DYNAMIC) {
+                    ++pollmgr->stats.chanmsgs;
+                }
                 nevents = (*handler->callback)(handler, fd, revents);
             }
             else {
@@ -416,32 +642,35 @@ pollmgr_loop(void)
 
           update_events:
             if (nevents >= 0) {
-                if (nevents != pollmgr.fds[i].events) {
+                if (nevents != pollmgr->fds[i].events) {
                     DPRINTF2(("%s: fd %d ! nevents 0x%x\n",
                               __func__, fd, nevents));
                 }
-                pollmgr.fds[i].events = nevents;
+                pollmgr->fds[i].events = nevents;
             }
             else if (i < POLLMGR_SLOT_FIRST_DYNAMIC) {
                 /* Don't garbage-collect channels. */
                 DPRINTF2(("%s: fd %d ! DELETED (channel %d)\n",
                           __func__, fd, i));
-                pollmgr.fds[i].fd = INVALID_SOCKET;
-                pollmgr.fds[i].events = 0;
-                pollmgr.fds[i].revents = 0;
-                pollmgr.handlers[i] = NULL;
+                pollmgr->fds[i].fd = INVALID_SOCKET;
+                pollmgr->fds[i].events = 0;
+                pollmgr->fds[i].revents = 0;
+                pollmgr->handlers[i] = NULL;
             }
             else {
                 DPRINTF2(("%s: fd %d ! DELETED\n", __func__, fd));
 
+                ++pollmgr->stats.deleted;
+                --pollmgr->stats.nfds;
+
                 /* schedule for deletion (see g/c loop for details) */
                 *pdelprev = i;  /* make previous entry point to us */
-                pdelprev = &pollmgr.fds[i].fd;
+                pdelprev = &pollmgr->fds[i].fd;
 
-                pollmgr.fds[i].fd = INVALID_SOCKET; /* end of list (for now) */
-                pollmgr.fds[i].events = POLLMGR_GARBAGE;
-                pollmgr.fds[i].revents = 0;
-                pollmgr.handlers[i] = NULL;
+                pollmgr->fds[i].fd = INVALID_SOCKET; /* end of list (for now) */
+                pollmgr->fds[i].events = POLLMGR_GARBAGE;
+                pollmgr->fds[i].revents = 0;
+                pollmgr->handlers[i] = NULL;
             }
         } /* processing loop */
 
@@ -459,33 +688,33 @@ pollmgr_loop(void)
          * processing loop above.
          */
         while (delfirst != INVALID_SOCKET) {
-            const int last = pollmgr.nfds - 1;
+            const int last = pollmgr->nfds - 1;
 
             /*
              * We want a live entry in the last slot to swap into the
              * freed slot, so make sure we have one.
              */
-            if (pollmgr.fds[last].events == POLLMGR_GARBAGE /* garbage */
-                || pollmgr.fds[last].fd == INVALID_SOCKET)  /* or killed */
+            if (pollmgr->fds[last].events == POLLMGR_GARBAGE /* garbage */
+                || pollmgr->fds[last].fd == INVALID_SOCKET)  /* or killed */
             {
                 /* drop garbage entry at the end of the array */
-                --pollmgr.nfds;
+                --pollmgr->nfds;
 
                 if (delfirst == last) {
-                    /* congruent to delnext >= pollmgr.nfds test below */
+                    /* congruent to delnext >= pollmgr->nfds test below */
                     delfirst = INVALID_SOCKET; /* done */
                 }
             }
             else {
-                const SOCKET delnext = pollmgr.fds[delfirst].fd;
+                const SOCKET delnext = pollmgr->fds[delfirst].fd;
 
                 /* copy live entry at the end to the first slot being freed */
-                pollmgr.fds[delfirst] = pollmgr.fds[last]; /* struct copy */
-                pollmgr.handlers[delfirst] = pollmgr.handlers[last];
-                pollmgr.handlers[delfirst]->slot = (int)delfirst;
-                --pollmgr.nfds;
+                pollmgr->fds[delfirst] = pollmgr->fds[last]; /* struct copy */
+                pollmgr->handlers[delfirst] = pollmgr->handlers[last];
+                pollmgr->handlers[delfirst]->slot = (int)delfirst;
+                --pollmgr->nfds;
 
-                if ((nfds_t)delnext >= pollmgr.nfds) {
+                if ((nfds_t)delnext >= pollmgr->nfds) {
                     delfirst = INVALID_SOCKET; /* done */
                 }
                 else {
@@ -493,10 +722,10 @@ pollmgr_loop(void)
                 }
             }
 
-            pollmgr.fds[last].fd = INVALID_SOCKET;
-            pollmgr.fds[last].events = 0;
-            pollmgr.fds[last].revents = 0;
-            pollmgr.handlers[last] = NULL;
+            pollmgr->fds[last].fd = INVALID_SOCKET;
+            pollmgr->fds[last].events = 0;
+            pollmgr->fds[last].revents = 0;
+            pollmgr->handlers[last] = NULL;
         }
     } /* poll loop */
 }
@@ -6,6 +6,17 @@
 # include <unistd.h>             /* for ssize_t */
 #endif
 #include "lwip/sys.h"
+#include "lwip/ip_addr.h"
+
+/*
+ * Poll manager is sharded: each shard is a thread with its own poll
+ * array and its own set of channels.  Shard 0 is the main shard that
+ * hosts everything that is not a proxied flow (port-forwarding
+ * listeners, dns, ping).  Proxied tcp/udp flows are spread over all
+ * shards by flow hash and stay on their shard for their lifetime.
+ */
+#define POLLMGR_MAX_SHARDS 16
+#define POLLMGR_SHARD_MAIN 0
 
 enum pollmgr_slot_t {
     POLLMGR_CHAN_PXTCP_ADD,     /* new proxy tcp connection from guest */
@@ -31,6 +42,7 @@ struct pollmgr_handler {
     pollmgr_callback callback;
     void *data;
     int slot;
+    int shard;                  /* shard that polls this handler */
 };
 
 struct pollmgr_refptr {
@@ -40,11 +52,25 @@ struct pollmgr_refptr {
     size_t weak;
 };
 
-int pollmgr_init(void);
+/* per-shard counters, only updated by the shard's own thread */
+struct pollmgr_stats {
+    uint64_t polls;             /* poll(2) wakeups */
+    uint64_t events;            /* callbacks dispatched */
+    uint64_t chanmsgs;          /* ... of them on channels */
+    uint64_t added;             /* dynamic slots added */
+    uint64_t deleted;           /* dynamic slots garbage collected */
+    uint32_t nfds;              /* dynamic slots in use */
+    uint32_t maxfds;            /* high-water mark of the above */
+};
+
+int pollmgr_init(int nshards);
+int pollmgr_shard_count(void);
+int pollmgr_flow_shard(int is_ipv6,
+                       const ipX_addr_t *, u16_t, const ipX_addr_t *, u16_t);
 
 /* static named slots (aka "channels") */
 SOCKET pollmgr_add_chan(int, struct pollmgr_handler *);
-ssize_t pollmgr_chan_send(int, void *buf, size_t nbytes);
+ssize_t pollmgr_chan_send(int shard, int slot, void *buf, size_t nbytes);
 void *pollmgr_chan_recv_ptr(struct pollmgr_handler *, SOCKET, int);
 
 /* dynamic slots */
@@ -56,12 +82,21 @@ void pollmgr_refptr_weak_ref(struct pollmgr_refptr *);
 struct pollmgr_handler *pollmgr_refptr_get(struct pollmgr_refptr *);
 void pollmgr_refptr_unref(struct pollmgr_refptr *);
 
-void pollmgr_update_events(int, int);
-void pollmgr_del_slot(int);
+void pollmgr_update_events(struct pollmgr_handler *, int);
+void pollmgr_del_slot(struct pollmgr_handler *);
 
 void pollmgr_thread(void *);
 
-/* buffer for callbacks to receive udp without worrying about truncation */
-extern u8_t pollmgr_udpbuf[64 * 1024];
+void pollmgr_get_stats(int shard, struct pollmgr_stats *);
+void pollmgr_log_stats(void);
+
+/*
+ * Buffer for callbacks to receive udp without worrying about
+ * truncation.  The global one belongs to the main shard, callbacks
+ * for sharded flows must use pollmgr_udpbuf_get() instead.
+ */
+#define POLLMGR_UDPBUF_SIZE (64 * 1024)
+extern u8_t pollmgr_udpbuf[POLLMGR_UDPBUF_SIZE];
+u8_t *pollmgr_udpbuf_get(struct pollmgr_handler *);
 
 #endif /* _PROXY_POLLMGR_H_ */
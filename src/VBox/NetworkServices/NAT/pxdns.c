@@ -210,10 +210,12 @@ pxdns_init(struct netif *proxy_netif)
     pxdns->pmhdl4.callback = pxdns_pmgr_pump;
     pxdns->pmhdl4.data = (void *)pxdns;
     pxdns->pmhdl4.slot = -1;
+    pxdns->pmhdl4.shard = POLLMGR_SHARD_MAIN;
 
     pxdns->pmhdl6.callback = pxdns_pmgr_pump;
     pxdns->pmhdl6.data = (void *)pxdns;
     pxdns->pmhdl6.slot = -1;
+    pxdns->pmhdl6.shard = POLLMGR_SHARD_MAIN;
 
     pxdns->pcb4 = udp_new();
     if (pxdns->pcb4 == NULL) {
@@ -279,6 +279,7 @@ pxping_init(struct netif *netif, SOCKET sock4, SOCKET sock6)
         g_pxping.pmhdl4.callback = pxping_pmgr_pump;
         g_pxping.pmhdl4.data = (void *)&g_pxping;
         g_pxping.pmhdl4.slot = -1;
+        g_pxping.pmhdl4.shard = POLLMGR_SHARD_MAIN;
         pollmgr_add(&g_pxping.pmhdl4, g_pxping.sock4, POLLIN);
 
         ping_proxy_accept(pxping_recv4, &g_pxping);
@@ -324,6 +325,7 @@ pxping_init(struct netif *netif, SOCKET sock4, SOCKET sock6)
         g_pxping.pmhdl6.callback = pxping_pmgr_pump;
         g_pxping.pmhdl6.data = (void *)&g_pxping;
         g_pxping.pmhdl6.slot = -1;
+        g_pxping.pmhdl6.shard = POLLMGR_SHARD_MAIN;
         pollmgr_add(&g_pxping.pmhdl6, g_pxping.sock6, POLLIN);
 
         ping6_proxy_accept(pxping_recv6, &g_pxping);
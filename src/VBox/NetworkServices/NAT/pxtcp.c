@@ -324,7 +324,8 @@ pxtcp_init(void)
 static ssize_t
 pxtcp_chan_send(enum pollmgr_slot_t slot, struct pxtcp *pxtcp)
 {
-    return pollmgr_chan_send(slot, &pxtcp, sizeof(pxtcp));
+    return pollmgr_chan_send(pxtcp->pmhdl.shard, slot,
+                             &pxtcp, sizeof(pxtcp));
 }
 
 
@@ -336,7 +337,8 @@ static ssize_t
 pxtcp_chan_send_weak(enum pollmgr_slot_t slot, struct pxtcp *pxtcp)
 {
     pollmgr_refptr_weak_ref(pxtcp->rp);
-    return pollmgr_chan_send(slot, &pxtcp->rp, sizeof(pxtcp->rp));
+    return pollmgr_chan_send(pxtcp->pmhdl.shard, slot,
+                             &pxtcp->rp, sizeof(pxtcp->rp));
 }
 
 
@@ -405,7 +407,7 @@ pxtcp_pmgr_del(struct pxtcp *pxtcp)
 {
     LWIP_ASSERT1(pxtcp != NULL);
 
-    pollmgr_del_slot(pxtcp->pmhdl.slot);
+    pollmgr_del_slot(&pxtcp->pmhdl);
 }
 
 
@@ -456,7 +458,7 @@ pxtcp_pmgr_chan_pollout(struct pollmgr_handler *handler, SOCKET fd, int revents)
     LWIP_ASSERT1(pxtcp->pmhdl.slot > 0);
 
     pxtcp->events |= POLLOUT;
-    pollmgr_update_events(pxtcp->pmhdl.slot, pxtcp->events);
+    pollmgr_update_events(&pxtcp->pmhdl, pxtcp->events);
 
     return POLLIN;
 }
@@ -485,7 +487,7 @@ pxtcp_pmgr_chan_pollin(struct pollmgr_handler *handler, SOCKET fd, int revents)
     }
 
     pxtcp->events |= POLLIN;
-    pollmgr_update_events(pxtcp->pmhdl.slot, pxtcp->events);
+    pollmgr_update_events(&pxtcp->pmhdl, pxtcp->events);
 
     return POLLIN;
 }
@@ -570,6 +572,7 @@ pxtcp_allocate(void)
     pxtcp->pmhdl.callback = NULL;
     pxtcp->pmhdl.data = (void *)pxtcp;
     pxtcp->pmhdl.slot = -1;
+    pxtcp->pmhdl.shard = POLLMGR_SHARD_MAIN;
 
     pxtcp->pcb = NULL;
     pxtcp->sock = INVALID_SOCKET;
@@ -624,7 +627,9 @@ pxtcp_allocate(void)
 
 /**
  * Exported to fwtcp to create pxtcp for incoming port-forwarded
- * connections.  Completed with pcb in pxtcp_pcb_connect().
+ * connections.  Completed with pcb in pxtcp_pcb_connect().  These
+ * are accepted and registered on the main poll manager shard and
+ * stay there.
  */
 struct pxtcp *
 pxtcp_create_forwarded(SOCKET sock)
@@ -1029,6 +1034,9 @@ pxtcp_pcb_heard(void *arg, struct tcp_pcb *newpcb, err_t error)
     pxtcp->sock = sock;
 
     pxtcp->pmhdl.callback = pxtcp_pmgr_connect;
+    pxtcp->pmhdl.shard = pollmgr_flow_shard(PCB_ISIPV6(newpcb),
+                                            &newpcb->remote_ip, newpcb->remote_port,
+                                            &newpcb->local_ip, newpcb->local_port);
     pxtcp->events = POLLOUT;
 
     nsent = pxtcp_chan_send(POLLMGR_CHAN_PXTCP_ADD, pxtcp);
@@ -166,7 +166,8 @@ pxudp_init(void)
 static ssize_t
 pxudp_chan_send(enum pollmgr_slot_t chan, struct pxudp *pxudp)
 {
-    return pollmgr_chan_send(chan, &pxudp, sizeof(pxudp));
+    return pollmgr_chan_send(pxudp->pmhdl.shard, chan,
+                             &pxudp, sizeof(pxudp));
 }
 
 
@@ -178,7 +179,8 @@ static ssize_t
 pxudp_chan_send_weak(enum pollmgr_slot_t chan, struct pxudp *pxudp)
 {
     pollmgr_refptr_weak_ref(pxudp->rp);
-    return pollmgr_chan_send(chan, &pxudp->rp, sizeof(pxudp->rp));
+    return pollmgr_chan_send(pxudp->pmhdl.shard, chan,
+                             &pxudp->rp, sizeof(pxudp->rp));
 }
 
 
@@ -258,7 +260,7 @@ pxudp_pmgr_chan_del(struct pollmgr_handler *handler, SOCKET fd, int revents)
 
     DPRINTF(("pxudp_del: pxudp %p; socket %d\n", (void *)pxudp, pxudp->sock));
 
-    pollmgr_del_slot(pxudp->pmhdl.slot);
+    pollmgr_del_slot(&pxudp->pmhdl);
 
     /*
      * Go back to lwip thread to delete after any pending callbacks
@@ -284,6 +286,7 @@ pxudp_allocate(void)
     pxudp->pmhdl.callback = NULL;
     pxudp->pmhdl.data = (void *)pxudp;
     pxudp->pmhdl.slot = -1;
+    pxudp->pmhdl.shard = POLLMGR_SHARD_MAIN;
 
     pxudp->pcb = NULL;
     pxudp->sock = INVALID_SOCKET;
@@ -531,6 +534,9 @@ pxudp_pcb_accept(void *arg, struct udp_pcb *newpcb, struct pbuf *p,
     udp_recv(newpcb, pxudp_pcb_recv, pxudp);
 
     pxudp->pmhdl.callback = pxudp_pmgr_pump;
+    pxudp->pmhdl.shard = pollmgr_flow_shard(PCB_ISIPV6(newpcb),
+                                            &newpcb->remote_ip, newpcb->remote_port,
+                                            &newpcb->local_ip, newpcb->local_port);
     pxudp_chan_send(POLLMGR_CHAN_PXUDP_ADD, pxudp);
 
     /* dispatch directly instead of calling pxudp_pcb_recv() */
@@ -702,6 +708,7 @@ pxudp_pmgr_pump(struct pollmgr_handler *handler, SOCKET fd, int revents)
 {
     struct pxudp *pxudp;
     struct pbuf *p;
+    u8_t *udpbuf;
     ssize_t nread;
     err_t error;
 
@@ -742,7 +749,8 @@ pxudp_pmgr_pump(struct pollmgr_handler *handler, SOCKET fd, int revents)
         return POLLIN;
     }
 
-    nread = recv(pxudp->sock, pollmgr_udpbuf, sizeof(pollmgr_udpbuf), 0);
+    udpbuf = pollmgr_udpbuf_get(handler);
+    nread = recv(pxudp->sock, udpbuf, POLLMGR_UDPBUF_SIZE, 0);
     if (nread == SOCKET_ERROR) {
         DPRINTF(("%s: %R[sockerr]\n", __func__, SOCKERRNO()));
         return POLLIN;
@@ -754,7 +762,7 @@ pxudp_pmgr_pump(struct pollmgr_handler *handler, SOCKET fd, int revents)
         return POLLIN;
     }
 
-    error = pbuf_take(p, pollmgr_udpbuf, (u16_t)nread);
+    error = pbuf_take(p, udpbuf, (u16_t)nread);
     if (error != ERR_OK) {
         DPRINTF(("%s: pbuf_take(%d) failed\n", __func__, (int)nread));
         pbuf_free(p);
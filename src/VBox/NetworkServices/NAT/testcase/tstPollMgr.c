@@ -0,0 +1,383 @@
+/* $Id: tstPollMgr.c $ */
+/** @file
+ * NAT Network - Poll manager shard testcase.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+/* The poll manager itself, so the shards can be inspected directly. */
+#include "../proxy_pollmgr.c"
+
+#include <iprt/asm.h>
+#include <iprt/err.h>
+#include <iprt/semaphore.h>
+#include <iprt/test.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A socket polled by one of the shards.
+ */
+typedef struct TSTFLOW
+{
+    struct pollmgr_handler  Handler;
+    /** Our end, the other one is polled. */
+    SOCKET                  hSockPeer;
+    /** The thread the last callback ran on. */
+    RTTHREAD volatile       hThreadCalled;
+    /** Number of callbacks. */
+    uint32_t volatile       cCalls;
+    /** Signalled after each callback. */
+    RTSEMEVENT              hEvt;
+} TSTFLOW;
+typedef TSTFLOW *PTSTFLOW;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+static RTTEST   g_hTest = NIL_RTTEST;
+/** The channel handler shared by all shards. */
+static struct pollmgr_handler g_ChanHdl;
+/** The thread the last channel message was received on. */
+static RTTHREAD volatile g_hThreadChan = NIL_RTTHREAD;
+/** The last pointer received over the channel. */
+static void * volatile g_pvChan = NULL;
+/** Signalled after each channel message. */
+static RTSEMEVENT g_hEvtChan = NIL_RTSEMEVENT;
+
+
+/**
+ * Tears down all shards so pollmgr_init can be called again.
+ */
+static void tstFini(void)
+{
+    int i;
+    for (i = 0; i < pollmgr_nshards; ++i)
+        pollmgr_fini_shard(&pollmgr_shards[i]);
+    pollmgr_nshards = 0;
+}
+
+/**
+ * Polls the channel read ends of all shards without blocking and returns
+ * the shard that has a message on the given slot, -1 for none and -2 if
+ * more than one has.
+ */
+static int tstChanPending(int slot)
+{
+    int iShard = -1;
+    int i;
+
+    for (i = 0; i < pollmgr_nshards; ++i)
+    {
+        struct pollfd Fd;
+        Fd.fd = pollmgr_shards[i].chan[slot][POLLMGR_CHFD_RD];
+        Fd.events = POLLIN;
+        Fd.revents = 0;
+        if (poll(&Fd, 1, 0) == 1 && (Fd.revents & POLLIN))
+        {
+            void *pv;
+            recv(Fd.fd, (char *)&pv, sizeof(pv), 0);
+            iShard = iShard == -1 ? i : -2;
+        }
+    }
+    return iShard;
+}
+
+
+static int tstChanCallback(struct pollmgr_handler *handler, SOCKET fd, int revents)
+{
+    g_pvChan = pollmgr_chan_recv_ptr(handler, fd, revents);
+    ASMAtomicWritePtr(&g_hThreadChan, RTThreadSelf());
+    RTSemEventSignal(g_hEvtChan);
+    return POLLIN;
+}
+
+
+static int tstFlowCallback(struct pollmgr_handler *handler, SOCKET fd, int revents)
+{
+    PTSTFLOW pFlow = (PTSTFLOW)handler->data;
+    char ch = 0;
+
+    RTTEST_CHECK(g_hTest, revents & POLLIN);
+    recv(fd, &ch, 1, 0);
+    ASMAtomicWritePtr(&pFlow->hThreadCalled, RTThreadSelf());
+    ASMAtomicIncU32(&pFlow->cCalls);
+    RTSemEventSignal(pFlow->hEvt);
+
+    /* 'q' asks us to go away */
+    return ch == 'q' ? -1 : POLLIN;
+}
+
+
+static DECLCALLBACK(int) tstShardThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    NOREF(hThreadSelf);
+    pollmgr_thread(pvUser);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * The flow hash must be symmetric, stay within the shard count and spread
+ * the flows reasonably evenly.
+ */
+static void tstFlowShard(int cShards)
+{
+    unsigned acHits[POLLMGR_MAX_SHARDS];
+    unsigned const cFlows = 256 * cShards;
+    unsigned i;
+
+    RTTestSubF(g_hTest, "Flow hash, %d shard(s)", cShards);
+    RTTEST_CHECK_RETV(g_hTest, pollmgr_init(cShards) == 0);
+    RTTEST_CHECK(g_hTest, pollmgr_shard_count() == cShards);
+    RT_ZERO(acHits);
+
+    for (i = 0; i < cFlows; i++)
+    {
+        ipX_addr_t Guest, Host;
+        u16_t uGuestPort = (u16_t)(49152 + i);
+        u16_t uHostPort = (u16_t)(i & 1 ? 80 : 443);
+        int iShard4, iShard6;
+
+        RT_ZERO(Guest);
+        RT_ZERO(Host);
+        Guest.ip4.addr = PP_HTONL(0x0a000200 | (i & 0x1f));
+        Host.ip4.addr  = PP_HTONL(0x5db8d822 + (i >> 5));
+
+        iShard4 = pollmgr_flow_shard(0, &Guest, uGuestPort, &Host, uHostPort);
+        RTTEST_CHECK_MSG(g_hTest, iShard4 >= 0 && iShard4 < cShards, (g_hTest, "flow %u: shard %d\n", i, iShard4));
+        RTTEST_CHECK(g_hTest, pollmgr_flow_shard(0, &Host, uHostPort, &Guest, uGuestPort) == iShard4);
+        if (iShard4 >= 0 && iShard4 < cShards)
+            acHits[iShard4]++;
+
+        Guest.ip6.addr[0] = PP_HTONL(0xfd000000);
+        Guest.ip6.addr[3] = PP_HTONL(0x100 | (i & 0x1f));
+        Host.ip6.addr[0]  = PP_HTONL(0x2a001450);
+        Host.ip6.addr[3]  = PP_HTONL(0x200e + (i >> 5));
+        iShard6 = pollmgr_flow_shard(1, &Guest, uGuestPort, &Host, uHostPort);
+        RTTEST_CHECK(g_hTest, iShard6 >= 0 && iShard6 < cShards);
+        RTTEST_CHECK(g_hTest, pollmgr_flow_shard(1, &Host, uHostPort, &Guest, uGuestPort) == iShard6);
+    }
+
+    if (cShards == 1)
+        RTTEST_CHECK(g_hTest, acHits[POLLMGR_SHARD_MAIN] == cFlows);
+    else
+        for (i = 0; i < (unsigned)cShards; i++)
+            RTTEST_CHECK_MSG(g_hTest, acHits[i] >= 256 / 2 && acHits[i] <= 256 * 3 / 2,
+                             (g_hTest, "shard %u got %u of %u flows\n", i, acHits[i], cFlows));
+    tstFini();
+}
+
+
+/**
+ * Out of range shard counts are clamped.
+ */
+static void tstShardCount(void)
+{
+    RTTestSub(g_hTest, "Shard count");
+    RTTEST_CHECK_RETV(g_hTest, pollmgr_init(0) == 0);
+    RTTEST_CHECK(g_hTest, pollmgr_shard_count() == 1);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[0].udpbuf == pollmgr_udpbuf);
+    tstFini();
+
+    RTTEST_CHECK_RETV(g_hTest, pollmgr_init(POLLMGR_MAX_SHARDS + 5) == 0);
+    RTTEST_CHECK(g_hTest, pollmgr_shard_count() == POLLMGR_MAX_SHARDS);
+    tstFini();
+}
+
+
+/**
+ * Channels and dynamic slots end up on the right shard, each shard with
+ * its own channel sockets and udp buffer.
+ */
+static void tstSlots(void)
+{
+    struct pollmgr_handler aHdls[3];
+    struct pollmgr_stats Stats;
+    int aSocks[2];
+    int i;
+
+    RTTestSub(g_hTest, "Slots");
+    RTTEST_CHECK_RETV(g_hTest, pollmgr_init(3) == 0);
+
+    RT_ZERO(g_ChanHdl);
+    g_ChanHdl.callback = tstChanCallback;
+    g_ChanHdl.slot = -1;
+    RTTEST_CHECK(g_hTest,    pollmgr_add_chan(POLLMGR_CHAN_PXUDP_ADD, &g_ChanHdl)
+                          == pollmgr_shards[POLLMGR_SHARD_MAIN].chan[POLLMGR_CHAN_PXUDP_ADD][POLLMGR_CHFD_WR]);
+    RTTEST_CHECK(g_hTest, g_ChanHdl.slot == POLLMGR_CHAN_PXUDP_ADD);
+    for (i = 0; i < 3; i++)
+    {
+        RTTEST_CHECK(g_hTest, pollmgr_shards[i].handlers[POLLMGR_CHAN_PXUDP_ADD] == &g_ChanHdl);
+        RTTEST_CHECK(g_hTest, pollmgr_shards[i].fds[POLLMGR_CHAN_PXUDP_ADD].fd
+                              == pollmgr_shards[i].chan[POLLMGR_CHAN_PXUDP_ADD][POLLMGR_CHFD_RD]);
+    }
+
+    /* a message for a shard is only seen by that shard */
+    for (i = 0; i < 3; i++)
+    {
+        void *pv = &aHdls[i];
+        RTTEST_CHECK(g_hTest, pollmgr_chan_send(i, POLLMGR_CHAN_PXUDP_ADD, &pv, sizeof(pv)) == sizeof(pv));
+        RTTEST_CHECK_MSG(g_hTest, tstChanPending(POLLMGR_CHAN_PXUDP_ADD) == i,
+                         (g_hTest, "message for shard %d\n", i));
+    }
+    RTTEST_CHECK(g_hTest, pollmgr_chan_send(0, POLLMGR_SLOT_FIRST_DYNAMIC, &aHdls[0], sizeof(void *)) == -1);
+
+    /* dynamic slots go into the handler's shard only */
+    RTTEST_CHECK_RETV(g_hTest, socketpair(PF_LOCAL, SOCK_DGRAM, 0, aSocks) == 0);
+    for (i = 0; i < 3; i++)
+    {
+        RT_ZERO(aHdls[i]);
+        aHdls[i].callback = tstFlowCallback;
+        aHdls[i].slot = -1;
+        aHdls[i].shard = 2;
+        RTTEST_CHECK(g_hTest, pollmgr_add(&aHdls[i], aSocks[0], POLLIN) == POLLMGR_SLOT_FIRST_DYNAMIC + i);
+        RTTEST_CHECK(g_hTest, aHdls[i].shard == 2);
+        RTTEST_CHECK(g_hTest, pollmgr_shards[2].handlers[aHdls[i].slot] == &aHdls[i]);
+    }
+    RTTEST_CHECK(g_hTest, pollmgr_shards[0].nfds == POLLMGR_SLOT_STATIC_COUNT);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[1].nfds == POLLMGR_SLOT_STATIC_COUNT);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[2].nfds == POLLMGR_SLOT_STATIC_COUNT + 3);
+
+    pollmgr_update_events(&aHdls[1], POLLOUT);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[2].fds[aHdls[1].slot].events == POLLOUT);
+    pollmgr_del_slot(&aHdls[1]);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[2].fds[aHdls[1].slot].fd == INVALID_SOCKET);
+
+    pollmgr_get_stats(2, &Stats);
+    RTTEST_CHECK(g_hTest, Stats.added == 3 && Stats.nfds == 3 && Stats.maxfds == 3);
+    pollmgr_get_stats(1, &Stats);
+    RTTEST_CHECK(g_hTest, Stats.added == 0 && Stats.nfds == 0);
+
+    RTTEST_CHECK(g_hTest, pollmgr_udpbuf_get(&g_ChanHdl) == pollmgr_udpbuf);
+    RTTEST_CHECK(g_hTest, pollmgr_udpbuf_get(&aHdls[0]) == pollmgr_shards[2].udpbuf);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[1].udpbuf != pollmgr_udpbuf);
+    RTTEST_CHECK(g_hTest, pollmgr_shards[2].udpbuf != pollmgr_shards[1].udpbuf);
+
+    closesocket(aSocks[0]);
+    closesocket(aSocks[1]);
+    tstFini();
+}
+
+
+/**
+ * Runs the shard threads and checks that each callback is made on the
+ * thread of the shard the handler belongs to.  The threads never return,
+ * so this has to be the last test.
+ */
+static void tstThreads(void)
+{
+    enum { TST_SHARDS = 4 };
+    RTTHREAD ahThreads[TST_SHARDS];
+    TSTFLOW aFlows[TST_SHARDS];
+    struct pollmgr_stats Stats;
+    int i;
+
+    RTTestSub(g_hTest, "Threads");
+    RTTEST_CHECK_RETV(g_hTest, pollmgr_init(TST_SHARDS) == 0);
+    RTTEST_CHECK_RC_RETV(g_hTest, RTSemEventCreate(&g_hEvtChan), VINF_SUCCESS);
+
+    RT_ZERO(g_ChanHdl);
+    g_ChanHdl.callback = tstChanCallback;
+    g_ChanHdl.slot = -1;
+    pollmgr_add_chan(POLLMGR_CHAN_PXUDP_ADD, &g_ChanHdl);
+
+    /* one flow per shard, added before the loops start */
+    for (i = 0; i < TST_SHARDS; i++)
+    {
+        SOCKET aSocks[2];
+        RT_ZERO(aFlows[i]);
+        RTTEST_CHECK_RC_RETV(g_hTest, RTSemEventCreate(&aFlows[i].hEvt), VINF_SUCCESS);
+        RTTEST_CHECK_RETV(g_hTest, socketpair(PF_LOCAL, SOCK_DGRAM, 0, aSocks) == 0);
+        aFlows[i].hSockPeer = aSocks[1];
+        aFlows[i].hThreadCalled = NIL_RTTHREAD;
+        aFlows[i].Handler.callback = tstFlowCallback;
+        aFlows[i].Handler.data = &aFlows[i];
+        aFlows[i].Handler.slot = -1;
+        aFlows[i].Handler.shard = TST_SHARDS - 1 - i;
+        RTTEST_CHECK(g_hTest, pollmgr_add(&aFlows[i].Handler, aSocks[0], POLLIN) == POLLMGR_SLOT_FIRST_DYNAMIC);
+    }
+
+    for (i = 0; i < TST_SHARDS; i++)
+        RTTEST_CHECK_RC_RETV(g_hTest, RTThreadCreate(&ahThreads[i], tstShardThread, (void *)(intptr_t)i, 0,
+                                                     RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "pollmgr"),
+                             VINF_SUCCESS);
+
+    for (i = 0; i < TST_SHARDS; i++)
+    {
+        int const iShard = aFlows[i].Handler.shard;
+        void *pv = &aFlows[i];
+
+        RTTEST_CHECK(g_hTest, send(aFlows[i].hSockPeer, "x", 1, 0) == 1);
+        RTTEST_CHECK_RC_RETV(g_hTest, RTSemEventWait(aFlows[i].hEvt, 10000), VINF_SUCCESS);
+        RTTEST_CHECK_MSG(g_hTest, aFlows[i].hThreadCalled == ahThreads[iShard],
+                         (g_hTest, "flow %d: called on the wrong thread\n", i));
+
+        RTTEST_CHECK(g_hTest, pollmgr_chan_send(iShard, POLLMGR_CHAN_PXUDP_ADD, &pv, sizeof(pv)) == sizeof(pv));
+        RTTEST_CHECK_RC_RETV(g_hTest, RTSemEventWait(g_hEvtChan, 10000), VINF_SUCCESS);
+        RTTEST_CHECK(g_hTest, g_pvChan == pv);
+        RTTEST_CHECK_MSG(g_hTest, g_hThreadChan == ahThreads[iShard],
+                         (g_hTest, "channel message for shard %d received on the wrong thread\n", iShard));
+    }
+
+    /* a flow asking to be deleted is garbage collected by its shard */
+    RTTEST_CHECK(g_hTest, send(aFlows[0].hSockPeer, "q", 1, 0) == 1);
+    RTTEST_CHECK_RC_RETV(g_hTest, RTSemEventWait(aFlows[0].hEvt, 10000), VINF_SUCCESS);
+    for (i = 0; i < 1000; i++)
+    {
+        pollmgr_get_stats(aFlows[0].Handler.shard, &Stats);
+        if (Stats.deleted)
+            break;
+        RTThreadSleep(10);
+    }
+    RTTEST_CHECK(g_hTest, Stats.deleted == 1 && Stats.nfds == 0 && Stats.maxfds == 1);
+    RTTEST_CHECK(g_hTest, Stats.events >= 3 && Stats.chanmsgs == 1);
+
+    /* other shards are not affected */
+    pollmgr_get_stats(aFlows[1].Handler.shard, &Stats);
+    RTTEST_CHECK(g_hTest, Stats.deleted == 0 && Stats.nfds == 1);
+    RTTEST_CHECK(g_hTest, send(aFlows[1].hSockPeer, "y", 1, 0) == 1);
+    RTTEST_CHECK_RC_RETV(g_hTest, RTSemEventWait(aFlows[1].hEvt, 10000), VINF_SUCCESS);
+    RTTEST_CHECK(g_hTest, aFlows[1].cCalls == 2);
+    RTTEST_CHECK(g_hTest, aFlows[0].cCalls == 2);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstPollMgr", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstShardCount();
+    tstFlowShard(1);
+    tstFlowShard(4);
+    tstFlowShard(7);
+    tstFlowShard(POLLMGR_MAX_SHARDS);
+    tstSlots();
+    tstThreads();
+
+    /* the shard threads are still blocked in poll, that's fine */
+    return RTTestSummaryAndDestroy(g_hTest);
+}
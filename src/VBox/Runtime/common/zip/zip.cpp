@@ -35,6 +35,12 @@
 #define RTZIP_LZF_BLOCK_BY_BLOCK
 //#define RTZIP_USE_LZJB 1
 //#define RTZIP_USE_LZO 1
+#define RTZIP_USE_LZ4 1
+
+/** LZ4 uses the block framed stream format. */
+#ifdef RTZIP_USE_LZ4
+# define RTZIP_USE_BLK_STREAM 1
+#endif
 
 /** @todo FastLZ? QuickLZ? Others? */
 
@@ -62,7 +68,7 @@
 #include <iprt/zip.h>
 #include "internal/iprt.h"
 
-/*#include <iprt/asm.h>*/
+#include <iprt/asm.h>
 #include <iprt/alloc.h>
 #include <iprt/assert.h>
 #include <iprt/err.h>
@@ -113,6 +119,44 @@ typedef const RTZIPLZFHDR *PCRTZIPLZFHDR;
 
 #endif /* RTZIP_USE_LZF */
 
+#ifdef RTZIP_USE_BLK_STREAM
+
+/**
+ * Block header used by the LZ4 streams.
+ *
+ * LZ4 is a pure block compressor, so the stream is a sequence of
+ * independently compressed blocks, each prefixed by this header.  Blocks
+ * which do not compress are stored raw (RTZIPBLKHDR_F_STORED).
+ */
+#pragma pack(1)
+typedef struct RTZIPBLKHDR
+{
+    /** Magic word (RTZIPBLKHDR_MAGIC). */
+    uint16_t    u16Magic;
+    /** Flags, RTZIPBLKHDR_F_XXX. */
+    uint16_t    fFlags;
+    /** The number of bytes of data following this header. */
+    uint32_t    cbData;
+    /** The size of the uncompressed data in bytes. */
+    uint32_t    cbUncompressed;
+} RTZIPBLKHDR;
+#pragma pack()
+AssertCompileSize(RTZIPBLKHDR, 12);
+/** Pointer to a block stream header. */
+typedef RTZIPBLKHDR *PRTZIPBLKHDR;
+/** Pointer to a const block stream header. */
+typedef const RTZIPBLKHDR *PCRTZIPBLKHDR;
+
+/** The magic of a block stream header. */
+#define RTZIPBLKHDR_MAGIC                       ('Z' | ('B' << 8))
+/** The block data is stored uncompressed. */
+#define RTZIPBLKHDR_F_STORED                    UINT16_C(0x0001)
+
+/** The max uncompressed (and thereby also compressed) data size of a block. */
+#define RTZIPBLK_MAX_DATA_SIZE                  (64*_1K)
+
+#endif /* RTZIP_USE_BLK_STREAM */
+
 
 /**
  * Compressor/Decompressor instance data.
@@ -176,6 +220,20 @@ typedef struct RTZIPCOMP
             uint8_t     abInput[RTZIPLZF_MAX_UNCOMPRESSED_DATA_SIZE];
         } LZF;
 #endif
+#ifdef RTZIP_USE_BLK_STREAM
+        /** LZ4 block stream. */
+        struct
+        {
+            /** Current output buffer position. */
+            uint8_t    *pbOutput;
+            /** The number of bytes in the input buffer. */
+            size_t      cbInput;
+            /** The compression level to pass to RTZipBlockCompress. */
+            RTZIPLEVEL  enmLevel;
+            /** The input buffer. */
+            uint8_t     abInput[RTZIPBLK_MAX_DATA_SIZE];
+        } Blk;
+#endif
 
     } u;
 } RTZIPCOMP;
@@ -248,6 +306,18 @@ typedef struct RTZIPDECOMP
             uint8_t    *pbSpill;
         } LZF;
 #endif
+#ifdef RTZIP_USE_BLK_STREAM
+        /** LZ4 block stream. */
+        struct
+        {
+            /** The number of bytes left spill buffer. */
+            size_t      cbSpill;
+            /** The current spill buffer position. */
+            uint8_t    *pbSpill;
+            /** The spill buffer, see the LZF one. */
+            uint8_t     abSpill[RTZIPBLK_MAX_DATA_SIZE];
+        } Blk;
+#endif
 
     } u;
 } RTZIPDECOM;
@@ -1352,6 +1422,576 @@ static DECLCALLBACK(int) rtZipLZFDecompInit(PRTZIPDECOMP pZip)
 #endif /* RTZIP_USE_LZF */
 
 
+#ifdef RTZIP_USE_LZ4
+
+/** @name LZ4 block format constants.
+ * @{ */
+/** The minimum match length. */
+# define RTZIPLZ4_MIN_MATCH             4
+/** The last sequence must contain at least this many literals. */
+# define RTZIPLZ4_LAST_LITERALS         5
+/** No match may start within this many bytes of the end of the input. */
+# define RTZIPLZ4_MF_LIMIT              12
+/** The max match distance (16-bit offset). */
+# define RTZIPLZ4_MAX_DISTANCE          65535
+/** The max input size of a block. */
+# define RTZIPLZ4_MAX_INPUT_SIZE        UINT32_C(0x7e000000)
+/** The number of hash table bits for the compressor. */
+# define RTZIPLZ4_HASH_BITS             12
+/** @} */
+
+
+/**
+ * Unaligned 32-bit read.
+ */
+DECLINLINE(uint32_t) rtZipLz4Read32(const uint8_t *pb)
+{
+    uint32_t u32;
+    memcpy(&u32, pb, sizeof(u32));
+    return u32;
+}
+
+
+/**
+ * Calculates the compressor hash table index for the 4 bytes at @a pb.
+ */
+DECLINLINE(uint32_t) rtZipLz4Hash(const uint8_t *pb)
+{
+    return (rtZipLz4Read32(pb) * UINT32_C(2654435761)) >> (32 - RTZIPLZ4_HASH_BITS);
+}
+
+
+/**
+ * Counts the number of matching bytes, comparing a machine word at a time.
+ *
+ * @returns Number of equal bytes.
+ * @param   pbIn        The current input position.
+ * @param   pbRef       The match candidate (before pbIn).
+ * @param   pbInLimit   Where to stop comparing.
+ */
+DECLINLINE(size_t) rtZipLz4MatchLength(const uint8_t *pbIn, const uint8_t *pbRef, const uint8_t *pbInLimit)
+{
+    const uint8_t * const pbStart = pbIn;
+#ifdef RT_LITTLE_ENDIAN
+    while ((size_t)(pbInLimit - pbIn) >= sizeof(uint64_t))
+    {
+        uint64_t u64In, u64Ref;
+        memcpy(&u64In, pbIn, sizeof(u64In));
+        memcpy(&u64Ref, pbRef, sizeof(u64Ref));
+        uint64_t const uDiff = u64In ^ u64Ref;
+        if (uDiff)
+        {
+            if ((uint32_t)uDiff)
+                return pbIn - pbStart + (ASMBitFirstSetU32((uint32_t)uDiff) - 1) / 8;
+            return pbIn - pbStart + 4 + (ASMBitFirstSetU32((uint32_t)(uDiff >> 32)) - 1) / 8;
+        }
+        pbIn  += sizeof(uint64_t);
+        pbRef += sizeof(uint64_t);
+    }
+#endif
+    while (pbIn < pbInLimit && *pbIn == *pbRef)
+        pbIn++, pbRef++;
+    return pbIn - pbStart;
+}
+
+
+/**
+ * Compresses a buffer into a raw LZ4 block (no frame).
+ *
+ * @returns The size of the compressed block, 0 if it doesn't fit.
+ * @param   pbSrc       The data to compress.
+ * @param   cbSrc       The amount of data to compress.
+ * @param   pbDst       The output buffer.
+ * @param   cbDst       The size of the output buffer.
+ * @param   uAccel      The acceleration factor, 1 or higher.  Higher values
+ *                      skip faster over incompressible data.
+ */
+static size_t rtZipLz4CompressBlock(const uint8_t *pbSrc, size_t cbSrc, uint8_t *pbDst, size_t cbDst, unsigned uAccel)
+{
+    if (cbSrc > RTZIPLZ4_MAX_INPUT_SIZE)
+        return 0;
+
+    const uint8_t * const   pbEnd        = pbSrc + cbSrc;
+    const uint8_t          *pbIn         = pbSrc;
+    const uint8_t          *pbAnchor     = pbSrc;
+    uint8_t                *pbOut        = pbDst;
+    uint8_t * const         pbOutEnd     = pbDst + cbDst;
+
+    if (cbSrc > RTZIPLZ4_MF_LIMIT)
+    {
+        const uint8_t * const pbMfLimit    = pbEnd - RTZIPLZ4_MF_LIMIT;
+        const uint8_t * const pbMatchLimit = pbEnd - RTZIPLZ4_LAST_LITERALS;
+        uint32_t aoffHash[1 << RTZIPLZ4_HASH_BITS];
+        RT_ZERO(aoffHash);
+
+        aoffHash[rtZipLz4Hash(pbIn)] = 0;
+        pbIn++;
+        for (;;)
+        {
+            /*
+             * Find a match, stepping faster the longer we go without one.
+             */
+            const uint8_t *pbRef;
+            unsigned cSearch = uAccel << 6;
+            for (;;)
+            {
+                if (pbIn > pbMfLimit)
+                    goto l_last_literals;
+                uint32_t const iHash = rtZipLz4Hash(pbIn);
+                pbRef = pbSrc + aoffHash[iHash];
+                aoffHash[iHash] = (uint32_t)(pbIn - pbSrc);
+                if (   pbIn - pbRef <= RTZIPLZ4_MAX_DISTANCE
+                    && rtZipLz4Read32(pbRef) == rtZipLz4Read32(pbIn))
+                    break;
+                pbIn += cSearch++ >> 6;
+            }
+
+            /* Extend it backwards. */
+            while (pbIn > pbAnchor && pbRef > pbSrc && pbIn[-1] == pbRef[-1])
+                pbIn--, pbRef--;
+
+            /*
+             * Emit the token and the literals.
+             */
+            size_t const cLiterals = pbIn - pbAnchor;
+            if ((size_t)(pbOutEnd - pbOut) < 1 + cLiterals / 255 + 1 + cLiterals + 2)
+                return 0;
+            uint8_t *pbToken = pbOut++;
+            if (cLiterals >= 15)
+            {
+                *pbToken = 15 << 4;
+                size_t cLeft = cLiterals - 15;
+                for (; cLeft >= 255; cLeft -= 255)
+                    *pbOut++ = 255;
+                *pbOut++ = (uint8_t)cLeft;
+            }
+            else
+                *pbToken = (uint8_t)(cLiterals << 4);
+            memcpy(pbOut, pbAnchor, cLiterals);
+            pbOut += cLiterals;
+
+            /*
+             * Emit the match, and any match found right after it.
+             */
+            for (;;)
+            {
+                uint16_t const offMatch = (uint16_t)(pbIn - pbRef);
+                *pbOut++ = (uint8_t)offMatch;
+                *pbOut++ = (uint8_t)(offMatch >> 8);
+
+                size_t cbMatch = rtZipLz4MatchLength(pbIn + RTZIPLZ4_MIN_MATCH, pbRef + RTZIPLZ4_MIN_MATCH, pbMatchLimit);
+                pbIn += RTZIPLZ4_MIN_MATCH + cbMatch;
+                if (cbMatch >= 15)
+                {
+                    *pbToken |= 15;
+                    cbMatch -= 15;
+                    if ((size_t)(pbOutEnd - pbOut) < cbMatch / 255 + 1)
+                        return 0;
+                    for (; cbMatch >= 255; cbMatch -= 255)
+                        *pbOut++ = 255;
+                    *pbOut++ = (uint8_t)cbMatch;
+                }
+                else
+                    *pbToken |= (uint8_t)cbMatch;
+
+                pbAnchor = pbIn;
+                if (pbIn > pbMfLimit)
+                    goto l_last_literals;
+
+                aoffHash[rtZipLz4Hash(pbIn - 2)] = (uint32_t)(pbIn - 2 - pbSrc);
+                uint32_t const iHash = rtZipLz4Hash(pbIn);
+                pbRef = pbSrc + aoffHash[iHash];
+                aoffHash[iHash] = (uint32_t)(pbIn - pbSrc);
+                if (   pbIn - pbRef > RTZIPLZ4_MAX_DISTANCE
+                    || rtZipLz4Read32(pbRef) != rtZipLz4Read32(pbIn))
+                    break;
+
+                /* Zero literals token. */
+                if ((size_t)(pbOutEnd - pbOut) < 1 + 2)
+                    return 0;
+                pbToken = pbOut++;
+                *pbToken = 0;
+            }
+            pbIn++;
+        }
+    }
+
+l_last_literals:
+    /*
+     * The last sequence consists of literals only.
+     */
+    size_t const cLiterals = pbEnd - pbAnchor;
+    if ((size_t)(pbOutEnd - pbOut) < 1 + (cLiterals + 255 - 15) / 255 + cLiterals)
+        return 0;
+    if (cLiterals >= 15)
+    {
+        *pbOut++ = 15 << 4;
+        size_t cLeft = cLiterals - 15;
+        for (; cLeft >= 255; cLeft -= 255)
+            *pbOut++ = 255;
+        *pbOut++ = (uint8_t)cLeft;
+    }
+    else
+        *pbOut++ = (uint8_t)(cLiterals << 4);
+    memcpy(pbOut, pbAnchor, cLiterals);
+    pbOut += cLiterals;
+
+    return pbOut - pbDst;
+}
+
+
+/**
+ * Decompresses a raw LZ4 block (no frame).
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_ZIP_CORRUPTED if the block is malformed.
+ * @retval  VERR_BUFFER_OVERFLOW if the output buffer is too small.
+ * @param   pbSrc           The compressed block.
+ * @param   cbSrc           The size of the compressed block.
+ * @param   pbDst           The output buffer.
+ * @param   cbDst           The size of the output buffer.
+ * @param   pcbDstActual    Where to return the decompressed size.
+ */
+static int rtZipLz4DecompressBlock(const uint8_t *pbSrc, size_t cbSrc, uint8_t *pbDst, size_t cbDst, size_t *pcbDstActual)
+{
+    const uint8_t          *pbIn     = pbSrc;
+    const uint8_t * const   pbInEnd  = pbSrc + cbSrc;
+    uint8_t                *pbOut    = pbDst;
+    uint8_t * const         pbOutEnd = pbDst + cbDst;
+
+    for (;;)
+    {
+        if (RT_UNLIKELY(pbIn >= pbInEnd))
+            return VERR_ZIP_CORRUPTED;
+        uint8_t const bToken = *pbIn++;
+
+        /*
+         * Literals.
+         */
+        size_t cLiterals = bToken >> 4;
+        if (cLiterals == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (RT_UNLIKELY(pbIn >= pbInEnd))
+                    return VERR_ZIP_CORRUPTED;
+                b = *pbIn++;
+                cLiterals += b;
+            } while (b == 255);
+        }
+        if (RT_UNLIKELY(cLiterals > (size_t)(pbInEnd - pbIn)))
+            return VERR_ZIP_CORRUPTED;
+        if (RT_UNLIKELY(cLiterals > (size_t)(pbOutEnd - pbOut)))
+            return VERR_BUFFER_OVERFLOW;
+        memcpy(pbOut, pbIn, cLiterals);
+        pbOut += cLiterals;
+        pbIn  += cLiterals;
+
+        /* The last sequence has no match part. */
+        if (pbIn == pbInEnd)
+            break;
+
+        /*
+         * Match.
+         */
+        if (RT_UNLIKELY(pbInEnd - pbIn < 2))
+            return VERR_ZIP_CORRUPTED;
+        size_t const offMatch = pbIn[0] | ((size_t)pbIn[1] << 8);
+        pbIn += 2;
+        if (RT_UNLIKELY(!offMatch || offMatch > (size_t)(pbOut - pbDst)))
+            return VERR_ZIP_CORRUPTED;
+
+        size_t cbMatch = bToken & 15;
+        if (cbMatch == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (RT_UNLIKELY(pbIn >= pbInEnd))
+                    return VERR_ZIP_CORRUPTED;
+                b = *pbIn++;
+                cbMatch += b;
+            } while (b == 255);
+        }
+        cbMatch += RTZIPLZ4_MIN_MATCH;
+        if (RT_UNLIKELY(cbMatch > (size_t)(pbOutEnd - pbOut)))
+            return VERR_BUFFER_OVERFLOW;
+
+        /* Copy 8 bytes at a time when the source and destination chunks cannot overlap. */
+        const uint8_t *pbRef = pbOut - offMatch;
+        if (offMatch >= sizeof(uint64_t))
+        {
+            while (cbMatch >= sizeof(uint64_t))
+            {
+                memcpy(pbOut, pbRef, sizeof(uint64_t));
+                pbOut   += sizeof(uint64_t);
+                pbRef   += sizeof(uint64_t);
+                cbMatch -= sizeof(uint64_t);
+            }
+        }
+        while (cbMatch-- > 0)
+            *pbOut++ = *pbRef++;
+    }
+
+    *pcbDstActual = pbOut - pbDst;
+    return VINF_SUCCESS;
+}
+
+#endif /* RTZIP_USE_LZ4 */
+
+
+#ifdef RTZIP_USE_BLK_STREAM
+
+/**
+ * Compresses one block and appends it to the output buffer, flushing the
+ * output buffer first if the block might not fit.
+ *
+ * @returns iprt status code.
+ * @param   pZip        The compressor instance.
+ * @param   pbBuf       The block data.
+ * @param   cbBuf       The block size, at most RTZIPBLK_MAX_DATA_SIZE.
+ */
+static int rtZipBlkCompressBlock(PRTZIPCOMP pZip, const uint8_t *pbBuf, size_t cbBuf)
+{
+    Assert(cbBuf > 0 && cbBuf <= RTZIPBLK_MAX_DATA_SIZE);
+
+    size_t cbFree = sizeof(pZip->abBuffer) - (pZip->u.Blk.pbOutput - &pZip->abBuffer[0]);
+    if (cbFree < sizeof(RTZIPBLKHDR) + cbBuf)
+    {
+        size_t cb = pZip->u.Blk.pbOutput - &pZip->abBuffer[0];
+        pZip->u.Blk.pbOutput = &pZip->abBuffer[0];
+        int rc = pZip->pfnOut(pZip->pvUser, &pZip->abBuffer[0], cb);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    /*
+     * Compress it, storing it raw if it doesn't get any smaller.
+     */
+    PRTZIPBLKHDR pHdr = (PRTZIPBLKHDR)pZip->u.Blk.pbOutput; /* warning: This might be unaligned! */
+    uint8_t *pbData = pZip->u.Blk.pbOutput + sizeof(*pHdr);
+    size_t cbData = 0;
+    int rc = RTZipBlockCompress(pZip->enmType, pZip->u.Blk.enmLevel, 0 /*fFlags*/, pbBuf, cbBuf,
+                                pbData, cbBuf - 1, &cbData);
+    if (RT_SUCCESS(rc))
+        pHdr->fFlags = 0;
+    else if (rc == VERR_BUFFER_OVERFLOW)
+    {
+        memcpy(pbData, pbBuf, cbBuf);
+        cbData = cbBuf;
+        pHdr->fFlags = RTZIPBLKHDR_F_STORED;
+    }
+    else
+        return rc;
+
+    pHdr->u16Magic       = RTZIPBLKHDR_MAGIC;
+    pHdr->cbData         = (uint32_t)cbData;
+    pHdr->cbUncompressed = (uint32_t)cbBuf;
+    pZip->u.Blk.pbOutput = pbData + cbData;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @copydoc RTZipCompress
+ */
+static DECLCALLBACK(int) rtZipBlkCompress(PRTZIPCOMP pZip, const void *pvBuf, size_t cbBuf)
+{
+    const uint8_t *pbBuf = (const uint8_t *)pvBuf;
+    while (cbBuf > 0)
+    {
+        /*
+         * Compress full blocks directly from the caller's buffer when
+         * nothing is pending, elsewise top up the input buffer.
+         */
+        if (   !pZip->u.Blk.cbInput
+            && cbBuf >= RTZIPBLK_MAX_DATA_SIZE)
+        {
+            int rc = rtZipBlkCompressBlock(pZip, pbBuf, RTZIPBLK_MAX_DATA_SIZE);
+            if (RT_FAILURE(rc))
+                return rc;
+            pbBuf += RTZIPBLK_MAX_DATA_SIZE;
+            cbBuf -= RTZIPBLK_MAX_DATA_SIZE;
+            continue;
+        }
+
+        size_t cb = RT_MIN(cbBuf, sizeof(pZip->u.Blk.abInput) - pZip->u.Blk.cbInput);
+        memcpy(&pZip->u.Blk.abInput[pZip->u.Blk.cbInput], pbBuf, cb);
+        pZip->u.Blk.cbInput += cb;
+        pbBuf += cb;
+        cbBuf -= cb;
+        if (pZip->u.Blk.cbInput == sizeof(pZip->u.Blk.abInput))
+        {
+            pZip->u.Blk.cbInput = 0;
+            int rc = rtZipBlkCompressBlock(pZip, pZip->u.Blk.abInput, sizeof(pZip->u.Blk.abInput));
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @copydoc RTZipCompFinish
+ */
+static DECLCALLBACK(int) rtZipBlkCompFinish(PRTZIPCOMP pZip)
+{
+    if (pZip->u.Blk.cbInput)
+    {
+        size_t cb = pZip->u.Blk.cbInput;
+        pZip->u.Blk.cbInput = 0;
+        int rc = rtZipBlkCompressBlock(pZip, pZip->u.Blk.abInput, cb);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    size_t cb = pZip->u.Blk.pbOutput - &pZip->abBuffer[0];
+    pZip->u.Blk.pbOutput = &pZip->abBuffer[0];
+    return pZip->pfnOut(pZip->pvUser, &pZip->abBuffer[0], cb);
+}
+
+
+/**
+ * @copydoc RTZipCompDestroy
+ */
+static DECLCALLBACK(int) rtZipBlkCompDestroy(PRTZIPCOMP pZip)
+{
+    NOREF(pZip);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Initializes the compressor instance.
+ * @returns iprt status code.
+ * @param   pZip        The compressor instance.
+ * @param   enmLevel    The desired compression level.
+ */
+static DECLCALLBACK(int) rtZipBlkCompInit(PRTZIPCOMP pZip, RTZIPLEVEL enmLevel)
+{
+    pZip->pfnCompress = rtZipBlkCompress;
+    pZip->pfnFinish   = rtZipBlkCompFinish;
+    pZip->pfnDestroy  = rtZipBlkCompDestroy;
+
+    pZip->u.Blk.pbOutput = &pZip->abBuffer[1];
+    pZip->u.Blk.cbInput  = 0;
+    pZip->u.Blk.enmLevel = enmLevel;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @copydoc RTZipDecompress
+ */
+static DECLCALLBACK(int) rtZipBlkDecompress(PRTZIPDECOMP pZip, void *pvBuf, size_t cbBuf, size_t *pcbWritten)
+{
+    size_t cbWritten = 0;
+    while (cbBuf > 0)
+    {
+        /*
+         * Anything in the spill buffer?
+         */
+        if (pZip->u.Blk.cbSpill > 0)
+        {
+            size_t cb = RT_MIN(pZip->u.Blk.cbSpill, cbBuf);
+            memcpy(pvBuf, pZip->u.Blk.pbSpill, cb);
+            pZip->u.Blk.pbSpill += cb;
+            pZip->u.Blk.cbSpill -= cb;
+            cbWritten += cb;
+            cbBuf -= cb;
+            if (!cbBuf)
+                break;
+            pvBuf = (uint8_t *)pvBuf + cb;
+        }
+
+        /*
+         * Read and validate the next block.
+         */
+        RTZIPBLKHDR Hdr;
+        int rc = pZip->pfnIn(pZip->pvUser, &Hdr, sizeof(Hdr), NULL);
+        if (RT_FAILURE(rc))
+            return rc;
+        if (    Hdr.u16Magic != RTZIPBLKHDR_MAGIC
+            ||  (Hdr.fFlags & ~RTZIPBLKHDR_F_STORED)
+            ||  !Hdr.cbUncompressed
+            ||  Hdr.cbUncompressed > RTZIPBLK_MAX_DATA_SIZE
+            ||  !Hdr.cbData
+            ||  Hdr.cbData > Hdr.cbUncompressed
+            ||  ((Hdr.fFlags & RTZIPBLKHDR_F_STORED) && Hdr.cbData != Hdr.cbUncompressed))
+        {
+            AssertMsgFailed(("Invalid block header! %.*Rhxs\n", sizeof(Hdr), &Hdr));
+            return VERR_ZIP_CORRUPTED;
+        }
+        rc = pZip->pfnIn(pZip->pvUser, &pZip->abBuffer[0], Hdr.cbData, NULL);
+        if (RT_FAILURE(rc))
+            return rc;
+
+        /*
+         * Decompress directly into the user buffer if it fits, elsewise go via the spill buffer.
+         */
+        uint8_t *pbDst = Hdr.cbUncompressed <= cbBuf ? (uint8_t *)pvBuf : &pZip->u.Blk.abSpill[0];
+        if (Hdr.fFlags & RTZIPBLKHDR_F_STORED)
+            memcpy(pbDst, &pZip->abBuffer[0], Hdr.cbData);
+        else
+        {
+            size_t cbOutput = 0;
+            rc = RTZipBlockDecompress(pZip->enmType, 0 /*fFlags*/, &pZip->abBuffer[0], Hdr.cbData, NULL,
+                                      pbDst, Hdr.cbUncompressed, &cbOutput);
+            if (RT_FAILURE(rc))
+                return rc;
+            if (cbOutput != Hdr.cbUncompressed)
+                return VERR_ZIP_CORRUPTED;
+        }
+
+        if (pbDst == pvBuf)
+        {
+            cbBuf -= Hdr.cbUncompressed;
+            pvBuf = (uint8_t *)pvBuf + Hdr.cbUncompressed;
+            cbWritten += Hdr.cbUncompressed;
+        }
+        else
+        {
+            pZip->u.Blk.pbSpill = &pZip->u.Blk.abSpill[0];
+            pZip->u.Blk.cbSpill = Hdr.cbUncompressed;
+        }
+    }
+
+    if (pcbWritten)
+        *pcbWritten = cbWritten;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @copydoc RTZipDecompDestroy
+ */
+static DECLCALLBACK(int) rtZipBlkDecompDestroy(PRTZIPDECOMP pZip)
+{
+    NOREF(pZip);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Initialize the decompressor instance.
+ * @returns iprt status code.
+ * @param   pZip        The decompressor instance.
+ */
+static DECLCALLBACK(int) rtZipBlkDecompInit(PRTZIPDECOMP pZip)
+{
+    pZip->pfnDecompress = rtZipBlkDecompress;
+    pZip->pfnDestroy    = rtZipBlkDecompDestroy;
+
+    pZip->u.Blk.cbSpill = 0;
+    pZip->u.Blk.pbSpill = NULL;
+    return VINF_SUCCESS;
+}
+
+#endif /* RTZIP_USE_BLK_STREAM */
+
+
 /**
  * Create a compressor instance.
  *
@@ -1442,6 +2082,12 @@ RTDECL(int)     RTZipCompCreate(PRTZIPCOMP *ppZip, void *pvUser, PFNRTZIPOUT pfn
         case RTZIPTYPE_LZO:
             break;
 
+        case RTZIPTYPE_LZ4:
+#ifdef RTZIP_USE_LZ4
+            rc = rtZipBlkCompInit(pZip, enmLevel);
+#endif
+            break;
+
         default:
             AssertFailedBreak();
     }
@@ -1639,6 +2285,14 @@ static int rtzipDecompInit(PRTZIPDECOMP pZip)
 #endif
             break;
 
+        case RTZIPTYPE_LZ4:
+#ifdef RTZIP_USE_LZ4
+            rc = rtZipBlkDecompInit(pZip);
+#else
+            AssertMsgFailed(("LZ4 is not include in this build!\n"));
+#endif
+            break;
+
         default:
             AssertMsgFailed(("Invalid compression type %d (%#x)!\n", pZip->enmType, pZip->enmType));
             rc = VERR_INVALID_MAGIC;
@@ -1817,6 +2471,20 @@ RTDECL(int) RTZipBlockCompress(RTZIPTYPE enmType, RTZIPLEVEL enmLevel, uint32_t
 #endif
         }
 
+        case RTZIPTYPE_LZ4:
+        {
+#ifdef RTZIP_USE_LZ4
+            size_t cbDstActual = rtZipLz4CompressBlock((const uint8_t *)pvSrc, cbSrc, (uint8_t *)pvDst, cbDst,
+                                                       enmLevel == RTZIPLEVEL_FAST ? 4 : 1);
+            if (RT_UNLIKELY(!cbDstActual))
+                return VERR_BUFFER_OVERFLOW;
+            *pcbDstActual = cbDstActual;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_ZLIB:
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
@@ -1973,6 +2641,23 @@ RTDECL(int) RTZipBlockDecompress(RTZIPTYPE enmType, uint32_t fFlags,
 #endif
         }
 
+        case RTZIPTYPE_LZ4:
+        {
+#ifdef RTZIP_USE_LZ4
+            size_t cbDstActual = 0;
+            int rc = rtZipLz4DecompressBlock((const uint8_t *)pvSrc, cbSrc, (uint8_t *)pvDst, cbDst, &cbDstActual);
+            if (RT_FAILURE(rc))
+                return rc;
+            if (pcbDstActual)
+                *pcbDstActual = cbDstActual;
+            if (pcbSrcActual)
+                *pcbSrcActual = cbSrc;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
 
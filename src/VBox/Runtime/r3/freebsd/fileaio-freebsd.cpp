@@ -136,6 +136,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 
     pAioLimits->cReqsOutstandingMax = cReqsOutstandingMax;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fFlags              = 0;
 
     return VINF_SUCCESS;
 }
@@ -309,6 +310,10 @@ RTDECL(int) RTFileAioCtxCreate(PRTFILEAIOCTX phAioCtx, uint32_t cAioReqsMax,
     AssertPtrReturn(phAioCtx, VERR_INVALID_POINTER);
     AssertReturn(!(fFlags & ~RTFILEAIOCTX_FLAGS_VALID_MASK), VERR_INVALID_PARAMETER);
 
+    /* Buffered requests are not guaranteed to be asynchronous here. */
+    if (fFlags & RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC)
+        return VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED;
+
     pCtxInt = (PRTFILEAIOCTXINTERNAL)RTMemAllocZ(sizeof(RTFILEAIOCTXINTERNAL));
     if (RT_UNLIKELY(!pCtxInt))
         return VERR_NO_MEMORY;
@@ -626,6 +631,13 @@ RTDECL(int) RTFileAioCtxWait(RTFILEAIOCTX hAioCtx, size_t cMinReqs, RTMSINTERVAL
     return rc;
 }
 
+RTDECL(int) RTFileAioCtxRegisterBuffers(RTFILEAIOCTX hAioCtx, PCRTSGSEG paSegs, size_t cSegs)
+{
+    /* Not supported by the host API. */
+    NOREF(hAioCtx); NOREF(paSegs); NOREF(cSegs);
+    return VERR_NOT_SUPPORTED;
+}
+
 RTDECL(int) RTFileAioCtxWakeup(RTFILEAIOCTX hAioCtx)
 {
     PRTFILEAIOCTXINTERNAL pCtxInt = hAioCtx;
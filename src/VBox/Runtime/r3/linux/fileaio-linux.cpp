@@ -40,6 +40,17 @@
  * compensated if the user of this API implements caching itself. The next
  * limitation is that data buffers must be aligned at a 512 byte boundary or the
  * request will fail.
+ *
+ * Newer kernels (5.1+) provide io_uring which doesn't suffer from these
+ * limitations: Requests are queued into a submission ring shared with the
+ * kernel and completions are posted to a completion ring which we can reap
+ * without entering the kernel. Buffered I/O is truly asynchronous as well.
+ * If io_uring is available it is used for all new contexts, otherwise we fall
+ * back to the io_* syscalls. The request preparation is the same for both
+ * backends, the control block is just translated into a submission queue
+ * entry when the request is submitted. Buffers can be registered with the
+ * kernel using RTFileAioCtxRegisterBuffers() to avoid mapping the pages for
+ * every request.
  */
 /** @todo r=bird: What's this about "must be opened with O_DIRECT"? An
  *        explanation would be nice, esp. seeing what Linus is quoted saying
@@ -60,11 +71,50 @@
 
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <errno.h>
 
 #include <iprt/file.h>
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The max number of events to get in one call. */
+#define AIO_MAXIMUM_REQUESTS_PER_CONTEXT 64
+
+#ifndef __NR_io_uring_setup
+# define __NR_io_uring_setup    425
+#endif
+#ifndef __NR_io_uring_enter
+# define __NR_io_uring_enter    426
+#endif
+#ifndef __NR_io_uring_register
+# define __NR_io_uring_register 427
+#endif
+
+/** io_uring_enter: Wait for the given number of completions. */
+#define LNXIOURING_ENTER_GETEVENTS          RT_BIT_32(0)
+/** io_uring_register: Register buffers. */
+#define LNXIOURING_REGISTER_BUFFERS         0
+/** io_uring_register: Unregister all buffers. */
+#define LNXIOURING_UNREGISTER_BUFFERS       1
+/** Feature: The submission and completion rings share one mapping. */
+#define LNXIOURING_FEAT_SINGLE_MMAP         RT_BIT_32(0)
+/** mmap offset of the submission ring. */
+#define LNXIOURING_OFF_SQ_RING              UINT64_C(0)
+/** mmap offset of the completion ring. */
+#define LNXIOURING_OFF_CQ_RING              UINT64_C(0x8000000)
+/** mmap offset of the submission queue entry array. */
+#define LNXIOURING_OFF_SQES                 UINT64_C(0x10000000)
+/** Maximum number of submission queue entries older kernels accept. */
+#define LNXIOURING_ENTRIES_MAX              4096
+/** Maximum number of buffers we allow to be registered with a context. */
+#define LNXIOURING_REG_BUFFERS_MAX          16
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
@@ -166,13 +216,193 @@ typedef struct LNXKAIOIOEVENT
 } LNXKAIOIOEVENT, *PLNXKAIOIOEVENT;
 
 
+/**
+ * io_uring opcodes we make use of.
+ */
+enum
+{
+    LNXIOURING_OP_NOP         = 0,
+    LNXIOURING_OP_READV       = 1,
+    LNXIOURING_OP_WRITEV      = 2,
+    LNXIOURING_OP_FSYNC       = 3,
+    LNXIOURING_OP_READ_FIXED  = 4,
+    LNXIOURING_OP_WRITE_FIXED = 5
+};
+
+/**
+ * io_uring submission queue entry (struct io_uring_sqe).
+ *
+ * Redefined here as the headers of older build hosts don't have it.
+ */
+typedef struct LNXIOURINGSQE
+{
+    /** The opcode (LNXIOURING_OP_XXX). */
+    uint8_t     u8Opcode;
+    /** Submission flags. */
+    uint8_t     fSqe;
+    /** Request priority. */
+    uint16_t    u16IoPrio;
+    /** The file descriptor. */
+    int32_t     iFd;
+    /** At which offset to start the transfer. */
+    uint64_t    off;
+    /** The buffer address or iovec array pointer. */
+    uint64_t    u64Addr;
+    /** Buffer size or number of iovecs. */
+    uint32_t    u32Len;
+    /** Opcode specific flags (RWF_XXX, fsync flags, ...). */
+    uint32_t    fOp;
+    /** Opaque data which is passed back in the completion queue entry. */
+    uint64_t    u64User;
+    /** Index of the registered buffer for the fixed opcodes. */
+    uint16_t    u16BufIdx;
+    /** Personality to use. */
+    uint16_t    u16Personality;
+    /** Splice stuff, unused. */
+    int32_t     i32SpliceFdIn;
+    /** Padding. */
+    uint64_t    au64Pad[2];
+} LNXIOURINGSQE;
+AssertCompileSize(LNXIOURINGSQE, 64);
+/** Pointer to a submission queue entry. */
+typedef LNXIOURINGSQE *PLNXIOURINGSQE;
+
+/**
+ * io_uring completion queue entry (struct io_uring_cqe).
+ */
+typedef struct LNXIOURINGCQE
+{
+    /** The opaque data from the submission queue entry. */
+    uint64_t    u64User;
+    /** Result code of the operation (negative errno on failure). */
+    int32_t     rcLnx;
+    /** Flags. */
+    uint32_t    fCqe;
+} LNXIOURINGCQE;
+AssertCompileSize(LNXIOURINGCQE, 16);
+/** Pointer to a completion queue entry. */
+typedef LNXIOURINGCQE *PLNXIOURINGCQE;
+
+/**
+ * Offsets into the submission ring mapping (struct io_sqring_offsets).
+ */
+typedef struct LNXIOURINGSQOFF
+{
+    uint32_t    offHead;
+    uint32_t    offTail;
+    uint32_t    offRingMask;
+    uint32_t    offRingEntries;
+    uint32_t    offFlags;
+    uint32_t    offDropped;
+    uint32_t    offArray;
+    uint32_t    u32Rsvd1;
+    uint64_t    u64Rsvd2;
+} LNXIOURINGSQOFF;
+AssertCompileSize(LNXIOURINGSQOFF, 40);
+
+/**
+ * Offsets into the completion ring mapping (struct io_cqring_offsets).
+ */
+typedef struct LNXIOURINGCQOFF
+{
+    uint32_t    offHead;
+    uint32_t    offTail;
+    uint32_t    offRingMask;
+    uint32_t    offRingEntries;
+    uint32_t    offOverflow;
+    uint32_t    offCqes;
+    uint32_t    offFlags;
+    uint32_t    u32Rsvd1;
+    uint64_t    u64Rsvd2;
+} LNXIOURINGCQOFF;
+AssertCompileSize(LNXIOURINGCQOFF, 40);
+
+/**
+ * Parameters for io_uring_setup (struct io_uring_params).
+ */
+typedef struct LNXIOURINGPARAMS
+{
+    /** Number of submission queue entries (set by the kernel). */
+    uint32_t        cSqEntries;
+    /** Number of completion queue entries (set by the kernel). */
+    uint32_t        cCqEntries;
+    /** Setup flags. */
+    uint32_t        fSetup;
+    /** CPU for the submission queue polling thread. */
+    uint32_t        u32SqThreadCpu;
+    /** Idle time of the submission queue polling thread. */
+    uint32_t        cMsSqThreadIdle;
+    /** Features supported by the kernel (LNXIOURING_FEAT_XXX). */
+    uint32_t        fFeatures;
+    /** Work queue file descriptor to share. */
+    uint32_t        u32WqFd;
+    /** Reserved. */
+    uint32_t        au32Rsvd[3];
+    /** Submission ring offsets. */
+    LNXIOURINGSQOFF SqOffsets;
+    /** Completion ring offsets. */
+    LNXIOURINGCQOFF CqOffsets;
+} LNXIOURINGPARAMS;
+AssertCompileSize(LNXIOURINGPARAMS, 120);
+
+
+/**
+ * io_uring instance state of a context.
+ */
+typedef struct LNXIOURING
+{
+    /** The io_uring file descriptor. */
+    int                 iFdRing;
+    /** Number of submission queue entries. */
+    uint32_t            cSqEntries;
+    /** The submission ring mapping. */
+    void               *pvSqRing;
+    /** Size of the submission ring mapping. */
+    size_t              cbSqRing;
+    /** The completion ring mapping, can be the same as pvSqRing. */
+    void               *pvCqRing;
+    /** Size of the completion ring mapping. */
+    size_t              cbCqRing;
+    /** The submission queue entry array. */
+    PLNXIOURINGSQE      paSqes;
+    /** Size of the submission queue entry array mapping. */
+    size_t              cbSqes;
+    /** Pointer to the submission ring head index (written by the kernel). */
+    volatile uint32_t  *pidxSqHead;
+    /** Pointer to the submission ring tail index (written by us). */
+    volatile uint32_t  *pidxSqTail;
+    /** Pointer to the submission ring index array. */
+    volatile uint32_t  *paidxSqArray;
+    /** The submission ring mask. */
+    uint32_t            fSqRingMask;
+    /** The completion ring mask. */
+    uint32_t            fCqRingMask;
+    /** Pointer to the completion ring head index (written by us). */
+    volatile uint32_t  *pidxCqHead;
+    /** Pointer to the completion ring tail index (written by the kernel). */
+    volatile uint32_t  *pidxCqTail;
+    /** The completion queue entry array. */
+    PLNXIOURINGCQE      paCqes;
+    /** Number of registered buffers. */
+    uint32_t            cBufsRegistered;
+    /** The registered buffers. */
+    struct iovec        aBufsRegistered[LNXIOURING_REG_BUFFERS_MAX];
+} LNXIOURING;
+/** Pointer to the io_uring instance state. */
+typedef LNXIOURING *PLNXIOURING;
+
+
 /**
  * Async I/O completion context state.
  */
 typedef struct RTFILEAIOCTXINTERNAL
 {
-    /** Handle to the async I/O context. */
+    /** Handle to the async I/O context (io_* syscall backend). */
     LNXKAIOCONTEXT      AioContext;
+    /** Flag whether the io_uring backend is used for this context. */
+    bool                fIoUring;
+    /** The io_uring state if fIoUring is set. */
+    LNXIOURING          IoUring;
     /** Maximum number of requests this context can handle. */
     int                 cRequestsMax;
     /** Current number of requests active on this context. */
@@ -209,6 +439,9 @@ typedef struct RTFILEAIOREQINTERNAL
     size_t                cbTransfered;
     /** Completion context we are assigned to. */
     PRTFILEAIOCTXINTERNAL pCtxInt;
+    /** I/O vector for the io_uring backend, must stay valid until the
+     * request completed. */
+    struct iovec          IoVec;
     /** Magic value  (RTFILEAIOREQ_MAGIC). */
     uint32_t              u32Magic;
 } RTFILEAIOREQINTERNAL;
@@ -217,10 +450,11 @@ typedef RTFILEAIOREQINTERNAL *PRTFILEAIOREQINTERNAL;
 
 
 /*******************************************************************************
-*   Defined Constants And Macros                                               *
+*   Global Variables                                                           *
 *******************************************************************************/
-/** The max number of events to get in one call. */
-#define AIO_MAXIMUM_REQUESTS_PER_CONTEXT 64
+/** Whether io_uring is supported by the host kernel.
+ * -1 if not yet probed, 0 if not supported, 1 if supported. */
+static int32_t volatile g_iLnxIoUringSupported = -1;
 
 
 /**
@@ -287,6 +521,372 @@ DECLINLINE(int) rtFileAsyncIoLinuxGetEvents(LNXKAIOCONTEXT AioContext, long cReq
     return rc;
 }
 
+/**
+ * Sets up a new io_uring instance.
+ */
+DECLINLINE(int) rtFileAsyncIoLinuxIoUringSetup(uint32_t cEntries, LNXIOURINGPARAMS *pParams, int *piFdRing)
+{
+    int rc = syscall(__NR_io_uring_setup, cEntries, pParams);
+    if (RT_UNLIKELY(rc == -1))
+        return RTErrConvertFromErrno(errno);
+
+    *piFdRing = rc;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Submits queued entries and/or waits for completions on an io_uring instance.
+ * @returns Number of consumed submission queue entries (natural number w/ 0), IPRT error code (negative).
+ */
+DECLINLINE(int) rtFileAsyncIoLinuxIoUringEnter(int iFdRing, uint32_t cToSubmit, uint32_t cMinComplete, uint32_t fFlags)
+{
+    int rc = syscall(__NR_io_uring_enter, iFdRing, cToSubmit, cMinComplete, fFlags, NULL, 0);
+    if (RT_UNLIKELY(rc == -1))
+        return RTErrConvertFromErrno(errno);
+
+    return rc;
+}
+
+/**
+ * Registers resources with an io_uring instance.
+ */
+DECLINLINE(int) rtFileAsyncIoLinuxIoUringRegister(int iFdRing, uint32_t uOpc, void *pvArg, uint32_t cArgs)
+{
+    int rc = syscall(__NR_io_uring_register, iFdRing, uOpc, pvArg, cArgs);
+    if (RT_UNLIKELY(rc == -1))
+        return RTErrConvertFromErrno(errno);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Checks whether the host kernel supports io_uring, probing it on the first call.
+ */
+static bool rtFileAsyncIoLinuxIoUringIsSupported(void)
+{
+    int32_t iSupported = ASMAtomicReadS32(&g_iLnxIoUringSupported);
+    if (RT_UNLIKELY(iSupported == -1))
+    {
+        /* The outcome is always the same so racing here doesn't matter. */
+        LNXIOURINGPARAMS Params;
+        RT_ZERO(Params);
+        int iFdRing = -1;
+        int rc = rtFileAsyncIoLinuxIoUringSetup(1, &Params, &iFdRing);
+        if (RT_SUCCESS(rc))
+        {
+            close(iFdRing);
+            iSupported = 1;
+        }
+        else
+        {
+            LogRel(("IPRT: io_uring is not available (rc=%Rrc), using the io_* interface for async I/O\n", rc));
+            iSupported = 0;
+        }
+        ASMAtomicWriteS32(&g_iLnxIoUringSupported, iSupported);
+    }
+
+    return iSupported == 1;
+}
+
+/**
+ * Unmaps the rings and closes the io_uring instance.
+ */
+static void rtFileAsyncIoLinuxIoUringTerm(PLNXIOURING pIoUring)
+{
+    if (pIoUring->paSqes)
+        munmap(pIoUring->paSqes, pIoUring->cbSqes);
+    if (   pIoUring->pvCqRing
+        && pIoUring->pvCqRing != pIoUring->pvSqRing)
+        munmap(pIoUring->pvCqRing, pIoUring->cbCqRing);
+    if (pIoUring->pvSqRing)
+        munmap(pIoUring->pvSqRing, pIoUring->cbSqRing);
+    if (pIoUring->iFdRing != -1)
+        close(pIoUring->iFdRing);
+
+    pIoUring->iFdRing  = -1;
+    pIoUring->paSqes   = NULL;
+    pIoUring->pvSqRing = NULL;
+    pIoUring->pvCqRing = NULL;
+}
+
+/**
+ * Creates a new io_uring instance and maps the submission and completion rings.
+ */
+static int rtFileAsyncIoLinuxIoUringInit(PLNXIOURING pIoUring, uint32_t cEntries)
+{
+    LNXIOURINGPARAMS Params;
+    RT_ZERO(Params);
+    RT_ZERO(*pIoUring);
+    pIoUring->iFdRing = -1;
+
+    int rc = rtFileAsyncIoLinuxIoUringSetup(cEntries, &Params, &pIoUring->iFdRing);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pIoUring->cSqEntries = Params.cSqEntries;
+    pIoUring->cbSqRing   = Params.SqOffsets.offArray + Params.cSqEntries * sizeof(uint32_t);
+    pIoUring->cbCqRing   = Params.CqOffsets.offCqes  + Params.cCqEntries * sizeof(LNXIOURINGCQE);
+    if (Params.fFeatures & LNXIOURING_FEAT_SINGLE_MMAP)
+    {
+        pIoUring->cbSqRing = RT_MAX(pIoUring->cbSqRing, pIoUring->cbCqRing);
+        pIoUring->cbCqRing = pIoUring->cbSqRing;
+    }
+
+    void *pv = mmap(NULL, pIoUring->cbSqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    pIoUring->iFdRing, LNXIOURING_OFF_SQ_RING);
+    if (pv != MAP_FAILED)
+    {
+        pIoUring->pvSqRing = pv;
+
+        if (Params.fFeatures & LNXIOURING_FEAT_SINGLE_MMAP)
+            pv = pIoUring->pvSqRing;
+        else
+            pv = mmap(NULL, pIoUring->cbCqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      pIoUring->iFdRing, LNXIOURING_OFF_CQ_RING);
+        if (pv != MAP_FAILED)
+        {
+            pIoUring->pvCqRing = pv;
+
+            pIoUring->cbSqes = Params.cSqEntries * sizeof(LNXIOURINGSQE);
+            pv = mmap(NULL, pIoUring->cbSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      pIoUring->iFdRing, LNXIOURING_OFF_SQES);
+            if (pv != MAP_FAILED)
+            {
+                uint8_t *pbSqRing = (uint8_t *)pIoUring->pvSqRing;
+                uint8_t *pbCqRing = (uint8_t *)pIoUring->pvCqRing;
+
+                pIoUring->paSqes       = (PLNXIOURINGSQE)pv;
+                pIoUring->pidxSqHead   = (volatile uint32_t *)(pbSqRing + Params.SqOffsets.offHead);
+                pIoUring->pidxSqTail   = (volatile uint32_t *)(pbSqRing + Params.SqOffsets.offTail);
+                pIoUring->paidxSqArray = (volatile uint32_t *)(pbSqRing + Params.SqOffsets.offArray);
+                pIoUring->fSqRingMask  = *(uint32_t *)(pbSqRing + Params.SqOffsets.offRingMask);
+                pIoUring->pidxCqHead   = (volatile uint32_t *)(pbCqRing + Params.CqOffsets.offHead);
+                pIoUring->pidxCqTail   = (volatile uint32_t *)(pbCqRing + Params.CqOffsets.offTail);
+                pIoUring->paCqes       = (PLNXIOURINGCQE)(pbCqRing + Params.CqOffsets.offCqes);
+                pIoUring->fCqRingMask  = *(uint32_t *)(pbCqRing + Params.CqOffsets.offRingMask);
+                return VINF_SUCCESS;
+            }
+        }
+    }
+
+    rc = RTErrConvertFromErrno(errno);
+    rtFileAsyncIoLinuxIoUringTerm(pIoUring);
+    return rc;
+}
+
+/**
+ * Fills in the submission queue entry for the given request.
+ */
+static void rtFileAsyncIoLinuxIoUringPrepSqe(PLNXIOURING pIoUring, PLNXIOURINGSQE pSqe, PRTFILEAIOREQINTERNAL pReqInt)
+{
+    PLNXKAIOIOCB pIoCB = &pReqInt->AioCB;
+
+    RT_ZERO(*pSqe);
+    pSqe->iFd     = (int32_t)pIoCB->uFileDesc;
+    pSqe->u64User = (uintptr_t)pReqInt;
+
+    if (pIoCB->u16IoOpCode == LNXKAIO_IOCB_CMD_FSYNC)
+    {
+        pSqe->u8Opcode = LNXIOURING_OP_FSYNC;
+        return;
+    }
+
+    bool const fWrite = pIoCB->u16IoOpCode == LNXKAIO_IOCB_CMD_WRITE;
+    pSqe->off = (uint64_t)pIoCB->off;
+
+    /* Use the fixed variants if the buffer lies completely in a registered one. */
+    uintptr_t const uBuf = (uintptr_t)pIoCB->pvBuf;
+    for (uint32_t iBuf = 0; iBuf < pIoUring->cBufsRegistered; iBuf++)
+    {
+        uintptr_t const uBufReg = (uintptr_t)pIoUring->aBufsRegistered[iBuf].iov_base;
+        if (   uBuf >= uBufReg
+            && uBuf - uBufReg + pIoCB->cbTransfer <= pIoUring->aBufsRegistered[iBuf].iov_len)
+        {
+            pSqe->u8Opcode  = fWrite ? LNXIOURING_OP_WRITE_FIXED : LNXIOURING_OP_READ_FIXED;
+            pSqe->u64Addr   = uBuf;
+            pSqe->u32Len    = (uint32_t)pIoCB->cbTransfer;
+            pSqe->u16BufIdx = (uint16_t)iBuf;
+            return;
+        }
+    }
+
+    pReqInt->IoVec.iov_base = pIoCB->pvBuf;
+    pReqInt->IoVec.iov_len  = pIoCB->cbTransfer;
+    pSqe->u8Opcode = fWrite ? LNXIOURING_OP_WRITEV : LNXIOURING_OP_READV;
+    pSqe->u64Addr  = (uintptr_t)&pReqInt->IoVec;
+    pSqe->u32Len   = 1;
+}
+
+/**
+ * Reaps completed requests from the completion ring without entering the kernel.
+ *
+ * @returns Number of requests reaped.
+ * @param   pIoUring    The io_uring instance.
+ * @param   pahReqs     Where to store the completed request handles.
+ * @param   cReqs       Maximum number of requests to reap.
+ */
+static uint32_t rtFileAsyncIoLinuxIoUringReap(PLNXIOURING pIoUring, PRTFILEAIOREQ pahReqs, size_t cReqs)
+{
+    uint32_t cReaped = 0;
+    uint32_t idxHead = *pIoUring->pidxCqHead;
+    uint32_t idxTail = ASMAtomicReadU32(pIoUring->pidxCqTail);
+
+    while (   idxHead != idxTail
+           && cReaped < cReqs)
+    {
+        PLNXIOURINGCQE        pCqe    = &pIoUring->paCqes[idxHead & pIoUring->fCqRingMask];
+        PRTFILEAIOREQINTERNAL pReqInt = (PRTFILEAIOREQINTERNAL)(uintptr_t)pCqe->u64User;
+        AssertPtr(pReqInt);
+        Assert(pReqInt->u32Magic == RTFILEAIOREQ_MAGIC);
+
+        if (RT_UNLIKELY(pCqe->rcLnx < 0))
+            pReqInt->Rc = RTErrConvertFromErrno(-pCqe->rcLnx);
+        else
+        {
+            pReqInt->Rc = VINF_SUCCESS;
+            pReqInt->cbTransfered = pCqe->rcLnx;
+        }
+
+        RTFILEAIOREQ_SET_STATE(pReqInt, COMPLETED);
+        pahReqs[cReaped++] = (RTFILEAIOREQ)pReqInt;
+        idxHead++;
+    }
+
+    /* Hand the entries back to the kernel. */
+    if (cReaped)
+        ASMAtomicWriteU32(pIoUring->pidxCqHead, idxHead);
+
+    return cReaped;
+}
+
+/**
+ * Submits the given requests to the io_uring instance of the context.
+ *
+ * All requests are put into the submission ring and handed to the kernel with
+ * as few io_uring_enter calls as possible.
+ */
+static int rtFileAsyncIoLinuxIoUringSubmit(PRTFILEAIOCTXINTERNAL pCtxInt, PRTFILEAIOREQ pahReqs, size_t cReqs)
+{
+    PLNXIOURING pIoUring = &pCtxInt->IoUring;
+    int         rc       = VINF_SUCCESS;
+
+    while (cReqs)
+    {
+        /* We are the only producer, so the tail can be accessed without atomics. */
+        uint32_t idxTail  = *pIoUring->pidxSqTail;
+        uint32_t idxHead  = ASMAtomicReadU32(pIoUring->pidxSqHead);
+        uint32_t cFree    = pIoUring->cSqEntries - (idxTail - idxHead);
+        uint32_t cQueued  = (uint32_t)RT_MIN(cReqs, cFree);
+        AssertBreakStmt(cQueued, rc = VERR_FILE_AIO_INSUFFICIENT_RESSOURCES);
+
+        for (uint32_t i = 0; i < cQueued; i++)
+        {
+            uint32_t idxSqe = (idxTail + i) & pIoUring->fSqRingMask;
+            rtFileAsyncIoLinuxIoUringPrepSqe(pIoUring, &pIoUring->paSqes[idxSqe], pahReqs[i]);
+            pIoUring->paidxSqArray[idxSqe] = idxSqe;
+        }
+        ASMAtomicWriteU32(pIoUring->pidxSqTail, idxTail + cQueued);
+
+        rc = rtFileAsyncIoLinuxIoUringEnter(pIoUring->iFdRing, cQueued, 0 /*cMinComplete*/, 0 /*fFlags*/);
+        uint32_t cSubmitted = RT_SUCCESS(rc) ? (uint32_t)rc : 0;
+        if (cSubmitted < cQueued)
+        {
+            /*
+             * Nothing polls the submission ring asynchronously, so the kernel
+             * only consumes entries inside io_uring_enter and we can take
+             * back everything it didn't get to.
+             */
+            ASMAtomicWriteU32(pIoUring->pidxSqTail, idxTail + cSubmitted);
+            if (RT_SUCCESS(rc))
+                rc = VERR_FILE_AIO_INSUFFICIENT_RESSOURCES;
+        }
+        else
+            rc = VINF_SUCCESS;
+
+        /* Advance. */
+        cReqs   -= cSubmitted;
+        pahReqs += cSubmitted;
+        ASMAtomicAddS32(&pCtxInt->cRequests, cSubmitted);
+
+        if (RT_FAILURE(rc))
+        {
+            /* Revert the requests which weren't submitted into the prepared state. */
+            for (size_t i = 0; i < cReqs; i++)
+            {
+                PRTFILEAIOREQINTERNAL pReqInt = pahReqs[i];
+                pReqInt->pCtxInt = NULL;
+                RTFILEAIOREQ_SET_STATE(pReqInt, PREPARED);
+            }
+
+            if (   rc == VERR_TRY_AGAIN
+                || rc == VERR_RESOURCE_BUSY)
+                rc = VERR_FILE_AIO_INSUFFICIENT_RESSOURCES;
+            break;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Waits for completed requests on the io_uring instance of the context.
+ *
+ * @returns IPRT status code.
+ * @param   pCtxInt     The context.
+ * @param   cMinReqs    Minimum number of requests to wait for.
+ * @param   cMillies    Timeout or RT_INDEFINITE_WAIT.
+ * @param   pahReqs     Where to store the completed request handles.
+ * @param   cReqs       Size of the request handle array.
+ * @param   pcReqs      Where to store the number of completed requests.
+ */
+static int rtFileAsyncIoLinuxIoUringWait(PRTFILEAIOCTXINTERNAL pCtxInt, size_t cMinReqs, RTMSINTERVAL cMillies,
+                                         PRTFILEAIOREQ pahReqs, size_t cReqs, uint32_t *pcReqs)
+{
+    PLNXIOURING pIoUring    = &pCtxInt->IoUring;
+    uint64_t    StartNanoTS = cMillies != RT_INDEFINITE_WAIT ? RTTimeNanoTS() : 0;
+    uint32_t    cCompleted  = 0;
+    int         rc          = VINF_SUCCESS;
+
+    while (!pCtxInt->fWokenUp)
+    {
+        /* Reap whatever completed so far without entering the kernel. */
+        cCompleted += rtFileAsyncIoLinuxIoUringReap(pIoUring, &pahReqs[cCompleted], cReqs - cCompleted);
+        if (cCompleted >= cMinReqs)
+            break;
+
+        ASMAtomicXchgBool(&pCtxInt->fWaiting, true);
+        if (cMillies == RT_INDEFINITE_WAIT)
+            rc = rtFileAsyncIoLinuxIoUringEnter(pIoUring->iFdRing, 0 /*cToSubmit*/, (uint32_t)(cMinReqs - cCompleted),
+                                                LNXIOURING_ENTER_GETEVENTS);
+        else
+        {
+            uint64_t cMilliesElapsed = (RTTimeNanoTS() - StartNanoTS) / RT_NS_1MS;
+            if (cMilliesElapsed < cMillies)
+            {
+                /* io_uring_enter can't time out on older kernels, so poll the ring instead. */
+                struct pollfd PollFd;
+                PollFd.fd      = pIoUring->iFdRing;
+                PollFd.events  = POLLIN;
+                PollFd.revents = 0;
+                int rcLnx = poll(&PollFd, 1, (int)(cMillies - cMilliesElapsed));
+                if (rcLnx == -1)
+                    rc = RTErrConvertFromErrno(errno);
+                else if (rcLnx == 0)
+                    rc = VERR_TIMEOUT;
+            }
+            else
+                rc = VERR_TIMEOUT;
+        }
+        ASMAtomicXchgBool(&pCtxInt->fWaiting, false);
+        if (RT_FAILURE(rc))
+            break;
+        rc = VINF_SUCCESS;
+    }
+
+    *pcReqs = cCompleted;
+    return rc;
+}
+
 RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 {
     int rc = VINF_SUCCESS;
@@ -308,6 +908,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
     /* Supported - fill in the limits. The alignment is the only restriction. */
     pAioLimits->cReqsOutstandingMax = RTFILEAIO_UNLIMITED_REQS;
     pAioLimits->cbBufferAlignment   = 512;
+    pAioLimits->fFlags              = rtFileAsyncIoLinuxIoUringIsSupported() ? RTFILEAIOLIMITS_F_BUFFERED_ASYNC : 0;
 
     return VINF_SUCCESS;
 }
@@ -436,6 +1037,13 @@ RTDECL(int) RTFileAioReqCancel(RTFILEAIOREQ hReq)
     RTFILEAIOREQ_VALID_RETURN(pReqInt);
     RTFILEAIOREQ_STATE_RETURN_RC(pReqInt, SUBMITTED, VERR_FILE_AIO_NOT_SUBMITTED);
 
+    /*
+     * Cancelling is asynchronous with io_uring and the request would show up
+     * on the completion ring anyway, so just let it complete.
+     */
+    if (pReqInt->pCtxInt->fIoUring)
+        return VERR_FILE_AIO_IN_PROGRESS;
+
     LNXKAIOIOEVENT AioEvent;
     int rc = rtFileAsyncIoLinuxCancel(pReqInt->AioContext, &pReqInt->AioCB, &AioEvent);
     if (RT_SUCCESS(rc))
@@ -489,8 +1097,31 @@ RTDECL(int) RTFileAioCtxCreate(PRTFILEAIOCTX phAioCtx, uint32_t cAioReqsMax,
     if (RT_UNLIKELY(!pCtxInt))
         return VERR_NO_MEMORY;
 
-    /* Init the event handle. */
-    int rc = rtFileAsyncIoLinuxCreate(cAioReqsMax, &pCtxInt->AioContext);
+    /*
+     * Prefer io_uring and fall back to the io_* interface if it is not
+     * available or can't handle the number of requests. The io_* interface
+     * blocks on buffered files, so don't fall back if the caller relies on
+     * buffered requests being asynchronous.
+     */
+    int rc = VERR_NOT_SUPPORTED;
+    if (   cAioReqsMax <= LNXIOURING_ENTRIES_MAX
+        && rtFileAsyncIoLinuxIoUringIsSupported())
+    {
+        rc = rtFileAsyncIoLinuxIoUringInit(&pCtxInt->IoUring, cAioReqsMax);
+        if (RT_SUCCESS(rc))
+            pCtxInt->fIoUring = true;
+        else if (fFlags & RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC)
+            LogRel(("RTFileAioCtxCreate: Setting up io_uring failed with %Rrc\n", rc));
+        else
+            LogRel(("RTFileAioCtxCreate: Setting up io_uring failed with %Rrc, using the io_* interface\n", rc));
+    }
+    if (!pCtxInt->fIoUring)
+    {
+        if (fFlags & RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC)
+            rc = VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED;
+        else
+            rc = rtFileAsyncIoLinuxCreate(cAioReqsMax, &pCtxInt->AioContext);
+    }
     if (RT_SUCCESS(rc))
     {
         pCtxInt->fWokenUp     = false;
@@ -521,9 +1152,14 @@ RTDECL(int) RTFileAioCtxDestroy(RTFILEAIOCTX hAioCtx)
         return VERR_FILE_AIO_BUSY;
 
     /* The native bit first, then mark it as dead and free it. */
-    int rc = rtFileAsyncIoLinuxDestroy(pCtxInt->AioContext);
-    if (RT_FAILURE(rc))
-        return rc;
+    if (pCtxInt->fIoUring)
+        rtFileAsyncIoLinuxIoUringTerm(&pCtxInt->IoUring);
+    else
+    {
+        int rc = rtFileAsyncIoLinuxDestroy(pCtxInt->AioContext);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
     ASMAtomicUoWriteU32(&pCtxInt->u32Magic, RTFILEAIOCTX_MAGIC_DEAD);
     RTMemFree(pCtxInt);
 
@@ -590,6 +1226,9 @@ RTDECL(int) RTFileAioCtxSubmit(RTFILEAIOCTX hAioCtx, PRTFILEAIOREQ pahReqs, size
         RTFILEAIOREQ_SET_STATE(pReqInt, SUBMITTED);
     }
 
+    if (pCtxInt->fIoUring)
+        return rtFileAsyncIoLinuxIoUringSubmit(pCtxInt, pahReqs, cReqs);
+
     do
     {
         /*
@@ -695,72 +1334,81 @@ RTDECL(int) RTFileAioCtxWait(RTFILEAIOCTX hAioCtx, size_t cMinReqs, RTMSINTERVAL
      */
     int rc = VINF_SUCCESS;
     int cRequestsCompleted = 0;
-    while (!pCtxInt->fWokenUp)
+    if (pCtxInt->fIoUring)
     {
-        LNXKAIOIOEVENT  aPortEvents[AIO_MAXIMUM_REQUESTS_PER_CONTEXT];
-        int             cRequestsToWait = RT_MIN(cReqs, AIO_MAXIMUM_REQUESTS_PER_CONTEXT);
-        ASMAtomicXchgBool(&pCtxInt->fWaiting, true);
-        rc = rtFileAsyncIoLinuxGetEvents(pCtxInt->AioContext, cMinReqs, cRequestsToWait, &aPortEvents[0], pTimeout);
-        ASMAtomicXchgBool(&pCtxInt->fWaiting, false);
-        if (RT_FAILURE(rc))
-            break;
-        uint32_t const cDone = rc;
-        rc = VINF_SUCCESS;
-
-        /*
-         * Process received events / requests.
-         */
-        for (uint32_t i = 0; i < cDone; i++)
+        uint32_t cDone = 0;
+        rc = rtFileAsyncIoLinuxIoUringWait(pCtxInt, cMinReqs, cMillies, pahReqs, cReqs, &cDone);
+        cRequestsCompleted = cDone;
+    }
+    else
+    {
+        while (!pCtxInt->fWokenUp)
         {
+            LNXKAIOIOEVENT  aPortEvents[AIO_MAXIMUM_REQUESTS_PER_CONTEXT];
+            int             cRequestsToWait = RT_MIN(cReqs, AIO_MAXIMUM_REQUESTS_PER_CONTEXT);
+            ASMAtomicXchgBool(&pCtxInt->fWaiting, true);
+            rc = rtFileAsyncIoLinuxGetEvents(pCtxInt->AioContext, cMinReqs, cRequestsToWait, &aPortEvents[0], pTimeout);
+            ASMAtomicXchgBool(&pCtxInt->fWaiting, false);
+            if (RT_FAILURE(rc))
+                break;
+            uint32_t const cDone = rc;
+            rc = VINF_SUCCESS;
+
             /*
-             * The iocb is the first element in our request structure.
-             * So we can safely cast it directly to the handle (see above)
+             * Process received events / requests.
              */
-            PRTFILEAIOREQINTERNAL pReqInt = (PRTFILEAIOREQINTERNAL)aPortEvents[i].pIoCB;
-            AssertPtr(pReqInt);
-            Assert(pReqInt->u32Magic == RTFILEAIOREQ_MAGIC);
-
-            /** @todo aeichner: The rc field contains the result code
-             *  like you can find in errno for the normal read/write ops.
-             *  But there is a second field called rc2. I don't know the
-             *  purpose for it yet.
-             */
-            if (RT_UNLIKELY(aPortEvents[i].rc < 0))
-                pReqInt->Rc = RTErrConvertFromErrno(-aPortEvents[i].rc); /* Convert to positive value. */
-            else
+            for (uint32_t i = 0; i < cDone; i++)
             {
-                pReqInt->Rc = VINF_SUCCESS;
-                pReqInt->cbTransfered = aPortEvents[i].rc;
-            }
-
-            /* Mark the request as finished. */
-            RTFILEAIOREQ_SET_STATE(pReqInt, COMPLETED);
+                /*
+                 * The iocb is the first element in our request structure.
+                 * So we can safely cast it directly to the handle (see above)
+                 */
+                PRTFILEAIOREQINTERNAL pReqInt = (PRTFILEAIOREQINTERNAL)aPortEvents[i].pIoCB;
+                AssertPtr(pReqInt);
+                Assert(pReqInt->u32Magic == RTFILEAIOREQ_MAGIC);
+
+                /** @todo aeichner: The rc field contains the result code
+                 *  like you can find in errno for the normal read/write ops.
+                 *  But there is a second field called rc2. I don't know the
+                 *  purpose for it yet.
+                 */
+                if (RT_UNLIKELY(aPortEvents[i].rc < 0))
+                    pReqInt->Rc = RTErrConvertFromErrno(-aPortEvents[i].rc); /* Convert to positive value. */
+                else
+                {
+                    pReqInt->Rc = VINF_SUCCESS;
+                    pReqInt->cbTransfered = aPortEvents[i].rc;
+                }
+
+                /* Mark the request as finished. */
+                RTFILEAIOREQ_SET_STATE(pReqInt, COMPLETED);
 
-            pahReqs[cRequestsCompleted++] = (RTFILEAIOREQ)pReqInt;
-        }
+                pahReqs[cRequestsCompleted++] = (RTFILEAIOREQ)pReqInt;
+            }
 
-        /*
-         * Done Yet? If not advance and try again.
-         */
-        if (cDone >= cMinReqs)
-            break;
-        cMinReqs -= cDone;
-        cReqs    -= cDone;
+            /*
+             * Done Yet? If not advance and try again.
+             */
+            if (cDone >= cMinReqs)
+                break;
+            cMinReqs -= cDone;
+            cReqs    -= cDone;
 
-        if (cMillies != RT_INDEFINITE_WAIT)
-        {
-            /* The API doesn't return ETIMEDOUT, so we have to fix that ourselves. */
-            uint64_t NanoTS = RTTimeNanoTS();
-            uint64_t cMilliesElapsed = (NanoTS - StartNanoTS) / 1000000;
-            if (cMilliesElapsed >= cMillies)
+            if (cMillies != RT_INDEFINITE_WAIT)
             {
-                rc = VERR_TIMEOUT;
-                break;
+                /* The API doesn't return ETIMEDOUT, so we have to fix that ourselves. */
+                uint64_t NanoTS = RTTimeNanoTS();
+                uint64_t cMilliesElapsed = (NanoTS - StartNanoTS) / 1000000;
+                if (cMilliesElapsed >= cMillies)
+                {
+                    rc = VERR_TIMEOUT;
+                    break;
+                }
+
+                /* The syscall supposedly updates it, but we're paranoid. :-) */
+                Timeout.tv_sec  = (cMillies - (RTMSINTERVAL)cMilliesElapsed) / 1000;
+                Timeout.tv_nsec = (cMillies - (RTMSINTERVAL)cMilliesElapsed) % 1000 * 1000000;
             }
-
-            /* The syscall supposedly updates it, but we're paranoid. :-) */
-            Timeout.tv_sec  = (cMillies - (RTMSINTERVAL)cMilliesElapsed) / 1000;
-            Timeout.tv_nsec = (cMillies - (RTMSINTERVAL)cMilliesElapsed) % 1000 * 1000000;
         }
     }
 
@@ -830,3 +1478,47 @@ RTDECL(int) RTFileAioCtxWakeup(RTFILEAIOCTX hAioCtx)
     return VINF_SUCCESS;
 }
 
+
+
+RTDECL(int) RTFileAioCtxRegisterBuffers(RTFILEAIOCTX hAioCtx, PCRTSGSEG paSegs, size_t cSegs)
+{
+    PRTFILEAIOCTXINTERNAL pCtxInt = hAioCtx;
+    RTFILEAIOCTX_VALID_RETURN(pCtxInt);
+    AssertReturn(!cSegs || VALID_PTR(paSegs), VERR_INVALID_POINTER);
+    AssertReturn(cSegs <= LNXIOURING_REG_BUFFERS_MAX, VERR_OUT_OF_RANGE);
+
+    /* Only io_uring knows about registered buffers. */
+    if (!pCtxInt->fIoUring)
+        return VERR_NOT_SUPPORTED;
+
+    /* The kernel refuses to change the buffers while requests are using them. */
+    if (RT_UNLIKELY(ASMAtomicReadS32(&pCtxInt->cRequests)))
+        return VERR_FILE_AIO_BUSY;
+
+    PLNXIOURING pIoUring = &pCtxInt->IoUring;
+    int rc = VINF_SUCCESS;
+    if (pIoUring->cBufsRegistered)
+    {
+        rc = rtFileAsyncIoLinuxIoUringRegister(pIoUring->iFdRing, LNXIOURING_UNREGISTER_BUFFERS, NULL, 0);
+        if (RT_FAILURE(rc))
+            return rc;
+        pIoUring->cBufsRegistered = 0;
+    }
+
+    if (cSegs)
+    {
+        for (size_t i = 0; i < cSegs; i++)
+        {
+            pIoUring->aBufsRegistered[i].iov_base = paSegs[i].pvSeg;
+            pIoUring->aBufsRegistered[i].iov_len  = paSegs[i].cbSeg;
+        }
+
+        rc = rtFileAsyncIoLinuxIoUringRegister(pIoUring->iFdRing, LNXIOURING_REGISTER_BUFFERS,
+                                               &pIoUring->aBufsRegistered[0], (uint32_t)cSegs);
+        if (RT_SUCCESS(rc))
+            pIoUring->cBufsRegistered = (uint32_t)cSegs;
+    }
+
+    return rc;
+}
+
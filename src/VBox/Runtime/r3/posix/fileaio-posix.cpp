@@ -315,6 +315,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 
     pAioLimits->cReqsOutstandingMax = cReqsOutstandingMax;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fFlags              = 0;
 #elif defined(RT_OS_FREEBSD)
     /*
      * The AIO API is implemented in a kernel module which is not
@@ -340,9 +341,11 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
 
     pAioLimits->cReqsOutstandingMax = cReqsOutstandingMax;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fFlags              = 0;
 #else
     pAioLimits->cReqsOutstandingMax = RTFILEAIO_UNLIMITED_REQS;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fFlags              = 0;
 #endif
 
     return VINF_SUCCESS;
@@ -533,6 +536,10 @@ RTDECL(int) RTFileAioCtxCreate(PRTFILEAIOCTX phAioCtx, uint32_t cAioReqsMax,
     AssertPtrReturn(phAioCtx, VERR_INVALID_POINTER);
     AssertReturn(!(fFlags & ~RTFILEAIOCTX_FLAGS_VALID_MASK), VERR_INVALID_PARAMETER);
 
+    /* Buffered requests are not guaranteed to be asynchronous here. */
+    if (fFlags & RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC)
+        return VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED;
+
     if (cAioReqsMax == RTFILEAIO_UNLIMITED_REQS)
         return VERR_OUT_OF_RANGE;
 
@@ -1044,6 +1051,13 @@ RTDECL(int) RTFileAioCtxWait(RTFILEAIOCTX hAioCtx, size_t cMinReqs, RTMSINTERVAL
 }
 
 
+RTDECL(int) RTFileAioCtxRegisterBuffers(RTFILEAIOCTX hAioCtx, PCRTSGSEG paSegs, size_t cSegs)
+{
+    /* Not supported by the host API. */
+    NOREF(hAioCtx); NOREF(paSegs); NOREF(cSegs);
+    return VERR_NOT_SUPPORTED;
+}
+
 RTDECL(int) RTFileAioCtxWakeup(RTFILEAIOCTX hAioCtx)
 {
     PRTFILEAIOCTXINTERNAL pCtxInt = hAioCtx;
@@ -129,6 +129,7 @@ RTR3DECL(int) RTFileAioGetLimits(PRTFILEAIOLIMITS pAioLimits)
     /* No limits known. */
     pAioLimits->cReqsOutstandingMax = RTFILEAIO_UNLIMITED_REQS;
     pAioLimits->cbBufferAlignment   = 0;
+    pAioLimits->fFlags              = 0;
 
     return VINF_SUCCESS;
 }
@@ -275,6 +276,10 @@ RTDECL(int) RTFileAioCtxCreate(PRTFILEAIOCTX phAioCtx, uint32_t cAioReqsMax,
     AssertPtrReturn(phAioCtx, VERR_INVALID_POINTER);
     AssertReturn(!(fFlags & ~RTFILEAIOCTX_FLAGS_VALID_MASK), VERR_INVALID_PARAMETER);
 
+    /* Buffered requests are not guaranteed to be asynchronous here. */
+    if (fFlags & RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC)
+        return VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED;
+
     pCtxInt = (PRTFILEAIOCTXINTERNAL)RTMemAllocZ(sizeof(RTFILEAIOCTXINTERNAL));
     if (RT_UNLIKELY(!pCtxInt))
         return VERR_NO_MEMORY;
@@ -506,6 +511,13 @@ RTDECL(int) RTFileAioCtxWait(RTFILEAIOCTX hAioCtx, size_t cMinReqs, RTMSINTERVAL
     return rc;
 }
 
+RTDECL(int) RTFileAioCtxRegisterBuffers(RTFILEAIOCTX hAioCtx, PCRTSGSEG paSegs, size_t cSegs)
+{
+    /* Not supported by the host API. */
+    NOREF(hAioCtx); NOREF(paSegs); NOREF(cSegs);
+    return VERR_NOT_SUPPORTED;
+}
+
 RTDECL(int) RTFileAioCtxWakeup(RTFILEAIOCTX hAioCtx)
 {
     int rc = VINF_SUCCESS;
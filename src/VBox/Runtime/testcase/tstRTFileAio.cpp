@@ -51,8 +51,17 @@
 static RTTEST g_hTest = NIL_RTTEST;
 
 
+/**
+ * Opens the test file created by the write test.
+ */
+static int tstFileAioOpenTestFile(PRTFILE phFile, uint64_t fOpenExtra)
+{
+    return RTFileOpen(phFile, "tstFileAio#1.tst", RTFILE_O_READWRITE | RTFILE_O_OPEN | RTFILE_O_DENY_NONE | fOpenExtra);
+}
+
 void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
-                                  size_t cbTestBuf, size_t cbTestFile, uint32_t cMaxReqsInFlight)
+                                  size_t cbTestBuf, size_t cbTestFile, uint32_t cMaxReqsInFlight,
+                                  uint32_t fCtxFlags, bool fRegisterBuffers)
 {
     /* Allocate request array. */
     RTFILEAIOREQ *paReqs;
@@ -84,9 +93,28 @@ void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
 
     /* Create a context and associate the file handle with it. */
     RTFILEAIOCTX hAioContext;
-    RTTESTI_CHECK_RC_RETV(RTFileAioCtxCreate(&hAioContext, cMaxReqsInFlight, 0 /* fFlags */), VINF_SUCCESS);
+    RTTESTI_CHECK_RC_RETV(RTFileAioCtxCreate(&hAioContext, cMaxReqsInFlight, fCtxFlags), VINF_SUCCESS);
     RTTESTI_CHECK_RC_RETV(RTFileAioCtxAssociateWithFile(hAioContext, File), VINF_SUCCESS);
 
+    /* Register the data buffers if requested so the fixed buffer path gets exercised. */
+    PRTSGSEG paSegs = NULL;
+    if (fRegisterBuffers)
+    {
+        paSegs = (PRTSGSEG)RTTestGuardedAllocHead(g_hTest, cMaxReqsInFlight * sizeof(RTSGSEG));
+        RTTESTI_CHECK_RETV(paSegs);
+        for (unsigned i = 0; i < cMaxReqsInFlight; i++)
+        {
+            paSegs[i].pvSeg = papvBuf[i];
+            paSegs[i].cbSeg = cbTestBuf;
+        }
+
+        int rc = RTFileAioCtxRegisterBuffers(hAioContext, paSegs, cMaxReqsInFlight);
+        if (rc == VERR_NOT_SUPPORTED)
+            RTTestIPrintf(RTTESTLVL_ALWAYS, "Registering buffers is not supported by the host\n");
+        else
+            RTTESTI_CHECK_RC(rc, VINF_SUCCESS);
+    }
+
     /* Initialize requests. */
     for (unsigned i = 0; i < cMaxReqsInFlight; i++)
         RTFileAioReqCreate(&paReqs[i]);
@@ -166,6 +194,8 @@ void tstFileAioTestReadWriteBasic(RTFILE File, bool fWrite, void *pvTestBuf,
     for (unsigned i = 0; i < cMaxReqsInFlight; i++)
         RTTESTI_CHECK_RC(RTFileAioReqDestroy(paReqs[i]), VINF_SUCCESS);
     RTTESTI_CHECK_RC(RTFileAioCtxDestroy(hAioContext), VINF_SUCCESS);
+    if (paSegs)
+        RTTestGuardedFree(g_hTest, paSegs);
     RTTestGuardedFree(g_hTest, paReqs);
 }
 
@@ -199,7 +229,8 @@ int main()
 
             /* Basic write test. */
             RTTestIPrintf(RTTESTLVL_ALWAYS, "Preparing test file, this can take some time and needs quite a bit of harddisk space...\n");
-            tstFileAioTestReadWriteBasic(hFile, true /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax);
+            tstFileAioTestReadWriteBasic(hFile, true /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax,
+                                         0 /*fCtxFlags*/, false /*fRegisterBuffers*/);
 
             /* Reopen the file before doing the next test. */
             RTTESTI_CHECK_RC(RTFileClose(hFile), VINF_SUCCESS);
@@ -211,11 +242,64 @@ int main()
                                  VINF_SUCCESS);
                 if (RT_SUCCESS(rc))
                 {
-                    tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax);
+                    tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax,
+                                                 0 /*fCtxFlags*/, false /*fRegisterBuffers*/);
                     RTFileClose(hFile);
                 }
             }
 
+            if (RTTestErrorCount(g_hTest) == 0)
+            {
+                RTTestSub(g_hTest, "Read/Write registered buffers");
+                RTTESTI_CHECK_RC(rc = tstFileAioOpenTestFile(&hFile, RTFILE_O_ASYNC_IO), VINF_SUCCESS);
+                if (RT_SUCCESS(rc))
+                {
+                    tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 100*_1M, cReqsMax,
+                                                 0 /*fCtxFlags*/, true /*fRegisterBuffers*/);
+                    RTFileClose(hFile);
+                }
+            }
+
+            /*
+             * Buffered I/O. A context asked for it must either process such requests
+             * asynchronously or fail, never quietly block in RTFileAioCtxSubmit().
+             */
+            if (RTTestErrorCount(g_hTest) == 0)
+            {
+                RTTestSub(g_hTest, "Buffered Read/Write");
+                RTFILEAIOCTX hAioCtx = NIL_RTFILEAIOCTX;
+                rc = RTFileAioCtxCreate(&hAioCtx, cReqsMax, RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC);
+                if (!(AioLimits.fFlags & RTFILEAIOLIMITS_F_BUFFERED_ASYNC))
+                    RTTESTI_CHECK_RC(rc, VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED);
+                else
+                    RTTESTI_CHECK_MSG(rc == VINF_SUCCESS || rc == VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED, ("rc=%Rrc\n", rc));
+                RTTESTI_CHECK_RC(RTFileAioCtxDestroy(hAioCtx), VINF_SUCCESS);
+
+                if (rc == VINF_SUCCESS)
+                {
+                    /* RTFILE_O_ASYNC_IO implies O_DIRECT on Linux, so leave it out. */
+                    RTTESTI_CHECK_RC(rc = tstFileAioOpenTestFile(&hFile, 0), VINF_SUCCESS);
+                    if (RT_SUCCESS(rc))
+                    {
+                        tstFileAioTestReadWriteBasic(hFile, true /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 16*_1M, cReqsMax,
+                                                     RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC, false /*fRegisterBuffers*/);
+                        tstFileAioTestReadWriteBasic(hFile, false /*fWrite*/, pbTestBuf, TSTFILEAIO_BUFFER_SIZE, 16*_1M, cReqsMax,
+                                                     RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC, true /*fRegisterBuffers*/);
+                        RTFileClose(hFile);
+                    }
+                }
+                else
+                    RTTestSkipped(g_hTest, "Buffered async I/O is not supported by the host");
+
+#ifdef RT_OS_LINUX
+                /* io_uring can't handle that many requests and the io_* interface blocks on buffered files. */
+                rc = RTFileAioCtxCreate(&hAioCtx, 8192, RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC);
+                RTTESTI_CHECK_RC(rc, VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED);
+                if (RT_SUCCESS(rc))
+                    RTFileAioCtxDestroy(hAioCtx);
+#endif
+            }
+
             /* Cleanup */
             RTFileDelete("tstFileAio#1.tst");
         }
@@ -0,0 +1,286 @@
+/* $Id: tstRTZip.cpp $ */
+/** @file
+ * IPRT Testcase - RTZip block and stream compression, with benchmark.
+ */
+
+/*
+ * Copyright (C) 2014 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ *
+ * The contents of this file may alternatively be used under the terms
+ * of the Common Development and Distribution License Version 1.0
+ * (CDDL) only, as it comes in the "COPYING.CDDL" file of the
+ * VirtualBox OSE distribution, in which case the provisions of the
+ * CDDL are applicable instead of those of the GPL.
+ *
+ * You may elect to license modified versions of this file under the
+ * terms and conditions of either the GPL or the CDDL or both.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <iprt/zip.h>
+
+#include <iprt/err.h>
+#include <iprt/mem.h>
+#include <iprt/param.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/** Memory stream for the stream API callbacks. */
+typedef struct TSTRTZIPSTRM
+{
+    uint8_t    *pb;
+    size_t      cb;
+    size_t      off;
+} TSTRTZIPSTRM;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+#include "72kb-random.h"
+
+/** The test data, a mix of page types resembling guest RAM. */
+static uint8_t     *g_pbData;
+/** The size of the test data. */
+static size_t const g_cbData = _1M;
+
+
+/**
+ * Fills g_pbData with zero pages, text-like pages and random pages.
+ */
+static void tstRTZipInitData(void)
+{
+    static const char s_szText[] = "The quick brown fox jumps over the lazy dog. 0123456789 ";
+    for (size_t offPage = 0; offPage < g_cbData; offPage += PAGE_SIZE)
+    {
+        uint8_t *pbPage = &g_pbData[offPage];
+        unsigned iPage  = (unsigned)(offPage / PAGE_SIZE);
+        switch (iPage % 10)
+        {
+            case 0: case 1: case 2: case 3:
+                memset(pbPage, 0, PAGE_SIZE);
+                break;
+            case 4: case 5: case 6:
+                for (size_t off = 0; off < PAGE_SIZE; off++)
+                    pbPage[off] = s_szText[(off + iPage) % (sizeof(s_szText) - 1)] ^ (uint8_t)(off % 97 == 0 ? iPage : 0);
+                break;
+            default:
+                memcpy(pbPage, &g_abRandom72KB[(iPage * PAGE_SIZE) % (sizeof(g_abRandom72KB) - PAGE_SIZE)], PAGE_SIZE);
+                break;
+        }
+    }
+}
+
+
+/**
+ * Tests the block API for one compressor and reports page sized block
+ * throughput and ratio.
+ */
+static void tstRTZipBlock(RTZIPTYPE enmType, const char *pszName)
+{
+    RTTestISubF("Block %s", pszName);
+
+    uint8_t abComp[PAGE_SIZE * 2];
+    uint8_t abDecomp[PAGE_SIZE];
+    size_t  cbComp;
+    int rc = RTZipBlockCompress(enmType, RTZIPLEVEL_FAST, 0 /*fFlags*/, g_pbData, PAGE_SIZE, abComp, sizeof(abComp), &cbComp);
+    RTTESTI_CHECK_RC_OK_RETV(rc);
+
+    /*
+     * Round trip every page, and odd sizes of the start of the data.
+     */
+    for (size_t off = 0; off < g_cbData; off += PAGE_SIZE)
+    {
+        RTTESTI_CHECK_RC_OK_RETV(RTZipBlockCompress(enmType, RTZIPLEVEL_FAST, 0 /*fFlags*/, &g_pbData[off], PAGE_SIZE,
+                                                    abComp, sizeof(abComp), &cbComp));
+        size_t cbDecomp = 0;
+        RTTESTI_CHECK_RC_OK_RETV(RTZipBlockDecompress(enmType, 0 /*fFlags*/, abComp, cbComp, NULL,
+                                                      abDecomp, sizeof(abDecomp), &cbDecomp));
+        RTTESTI_CHECK_RETV(cbDecomp == PAGE_SIZE);
+        RTTESTI_CHECK_RETV(!memcmp(abDecomp, &g_pbData[off], PAGE_SIZE));
+    }
+    for (size_t cb = 1; cb < 300; cb++)
+    {
+        size_t const off = PAGE_SIZE * 4 + cb;
+        RTTESTI_CHECK_RC_OK_RETV(RTZipBlockCompress(enmType, RTZIPLEVEL_FAST, 0 /*fFlags*/, &g_pbData[off], cb,
+                                                    abComp, sizeof(abComp), &cbComp));
+        size_t cbDecomp = 0;
+        RTTESTI_CHECK_RC_OK_RETV(RTZipBlockDecompress(enmType, 0 /*fFlags*/, abComp, cbComp, NULL,
+                                                      abDecomp, sizeof(abDecomp), &cbDecomp));
+        RTTESTI_CHECK_RETV(cbDecomp == cb);
+        RTTESTI_CHECK_RETV(!memcmp(abDecomp, &g_pbData[off], cb));
+    }
+
+    /* A too small output buffer must be reported, not overrun. */
+    RTTESTI_CHECK_RC(RTZipBlockCompress(enmType, RTZIPLEVEL_FAST, 0 /*fFlags*/, &g_pbData[PAGE_SIZE * 9], PAGE_SIZE,
+                                        abComp, PAGE_SIZE / 2, &cbComp), VERR_BUFFER_OVERFLOW);
+
+    /*
+     * Benchmark.  SSM uses fast page sized blocks, so do the same.
+     */
+    uint32_t const cLoops = 64;
+    size_t   cbTotalComp = 0;
+    RTThreadYield();
+    uint64_t uStartTS = RTTimeNanoTS();
+    for (uint32_t iLoop = 0; iLoop < cLoops; iLoop++)
+        for (size_t off = 0; off < g_cbData; off += PAGE_SIZE)
+        {
+            rc = RTZipBlockCompress(enmType, RTZIPLEVEL_FAST, 0 /*fFlags*/, &g_pbData[off], PAGE_SIZE,
+                                    abComp, PAGE_SIZE - PAGE_SIZE / 16, &cbComp);
+            cbTotalComp += RT_SUCCESS(rc) ? cbComp : PAGE_SIZE;
+        }
+    uint64_t cNsElapsed = RT_MAX(RTTimeNanoTS() - uStartTS, 1);
+    RTTestIValueF((uint64_t)cLoops * g_cbData / _1M / (0.000000001 * cNsElapsed), RTTESTUNIT_MEGABYTES_PER_SEC,
+                  "%s compression", pszName);
+    RTTestIValueF((uint64_t)cbTotalComp * 1000 / ((uint64_t)cLoops * g_cbData), RTTESTUNIT_PP1K,
+                  "%s compressed size", pszName);
+
+    /* Decompression of a compressible (text-like) page. */
+    RTTESTI_CHECK_RC_OK_RETV(RTZipBlockCompress(enmType, RTZIPLEVEL_FAST, 0 /*fFlags*/, &g_pbData[PAGE_SIZE * 4], PAGE_SIZE,
+                                                abComp, sizeof(abComp), &cbComp));
+    uint32_t const cDecompLoops = cLoops * (uint32_t)(g_cbData / PAGE_SIZE);
+    rc = VINF_SUCCESS;
+    RTThreadYield();
+    uStartTS = RTTimeNanoTS();
+    for (uint32_t iLoop = 0; iLoop < cDecompLoops; iLoop++)
+        rc |= RTZipBlockDecompress(enmType, 0 /*fFlags*/, abComp, cbComp, NULL, abDecomp, sizeof(abDecomp), NULL);
+    cNsElapsed = RT_MAX(RTTimeNanoTS() - uStartTS, 1);
+    RTTESTI_CHECK_RC_OK(rc);
+    RTTestIValueF((uint64_t)cDecompLoops * PAGE_SIZE / _1M / (0.000000001 * cNsElapsed), RTTESTUNIT_MEGABYTES_PER_SEC,
+                  "%s decompression", pszName);
+}
+
+
+/**
+ * @callback_method_impl{FNRTZIPOUT}
+ */
+static DECLCALLBACK(int) tstRTZipStrmOut(void *pvUser, const void *pvBuf, size_t cbBuf)
+{
+    TSTRTZIPSTRM *pStrm = (TSTRTZIPSTRM *)pvUser;
+    if (pStrm->off + cbBuf > pStrm->cb)
+        return VERR_BUFFER_OVERFLOW;
+    memcpy(&pStrm->pb[pStrm->off], pvBuf, cbBuf);
+    pStrm->off += cbBuf;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNRTZIPIN}
+ */
+static DECLCALLBACK(int) tstRTZipStrmIn(void *pvUser, void *pvBuf, size_t cbBuf, size_t *pcbBuf)
+{
+    TSTRTZIPSTRM *pStrm = (TSTRTZIPSTRM *)pvUser;
+    size_t cbLeft = pStrm->cb - pStrm->off;
+    if (cbBuf > cbLeft)
+    {
+        if (!pcbBuf)
+            return VERR_EOF;
+        cbBuf = cbLeft;
+    }
+    memcpy(pvBuf, &pStrm->pb[pStrm->off], cbBuf);
+    pStrm->off += cbBuf;
+    if (pcbBuf)
+        *pcbBuf = cbBuf;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Round trips the test data through the stream API in odd sized chunks.
+ */
+static void tstRTZipStream(RTZIPTYPE enmType, const char *pszName)
+{
+    RTTestISubF("Stream %s", pszName);
+
+    TSTRTZIPSTRM Strm;
+    Strm.cb  = g_cbData * 2;
+    Strm.off = 0;
+    Strm.pb  = (uint8_t *)RTMemAlloc(Strm.cb);
+    uint8_t *pbDecomp = (uint8_t *)RTMemAlloc(g_cbData);
+    RTTESTI_CHECK_RETV(Strm.pb && pbDecomp);
+
+    PRTZIPCOMP pZip;
+    int rc = RTZipCompCreate(&pZip, &Strm, tstRTZipStrmOut, enmType, RTZIPLEVEL_DEFAULT);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t uStartTS = RTTimeNanoTS();
+        size_t   cbChunk  = 1;
+        for (size_t off = 0; off < g_cbData && RT_SUCCESS(rc); off += cbChunk, cbChunk = cbChunk * 3 + 1)
+            rc = RTZipCompress(pZip, &g_pbData[off], RT_MIN(cbChunk, g_cbData - off));
+        RTTESTI_CHECK_RC_OK(rc);
+        RTTESTI_CHECK_RC_OK(RTZipCompFinish(pZip));
+        uint64_t cNsElapsed = RT_MAX(RTTimeNanoTS() - uStartTS, 1);
+        RTTESTI_CHECK_RC_OK(RTZipCompDestroy(pZip));
+        RTTestIValueF((uint64_t)g_cbData / _1K / (0.000000001 * cNsElapsed), RTTESTUNIT_KILOBYTES_PER_SEC,
+                      "%s stream compression", pszName);
+        RTTestIValueF((uint64_t)Strm.off * 1000 / g_cbData, RTTESTUNIT_PP1K, "%s stream compressed size", pszName);
+
+        PRTZIPDECOMP pUnzip;
+        Strm.cb  = Strm.off;
+        Strm.off = 0;
+        RTTESTI_CHECK_RC_OK(rc = RTZipDecompCreate(&pUnzip, &Strm, tstRTZipStrmIn));
+        if (RT_SUCCESS(rc))
+        {
+            cbChunk = 7;
+            for (size_t off = 0; off < g_cbData && RT_SUCCESS(rc); off += cbChunk, cbChunk = cbChunk * 2 + 3)
+                RTTESTI_CHECK_RC_OK(rc = RTZipDecompress(pUnzip, &pbDecomp[off], RT_MIN(cbChunk, g_cbData - off), NULL));
+            RTTESTI_CHECK_RC_OK(RTZipDecompDestroy(pUnzip));
+            RTTESTI_CHECK(!memcmp(pbDecomp, g_pbData, g_cbData));
+        }
+    }
+    else
+        RTTestIFailed("RTZipCompCreate -> %Rrc", rc);
+
+    RTMemFree(pbDecomp);
+    RTMemFree(Strm.pb);
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    int rc = RTTestInitAndCreate("tstRTZip", &hTest);
+    if (rc)
+        return rc;
+    RTTestBanner(hTest);
+
+    g_pbData = (uint8_t *)RTMemPageAlloc(g_cbData);
+    if (!g_pbData)
+        return RTTestSummaryAndDestroy(hTest);
+    tstRTZipInitData();
+
+    static const struct { RTZIPTYPE enmType; const char *pszName; bool fBlock; } s_aTypes[] =
+    {
+        { RTZIPTYPE_STORE, "Store", true  },
+        { RTZIPTYPE_ZLIB,  "Zlib",  false },
+        { RTZIPTYPE_LZF,   "LZF",   true  },
+        { RTZIPTYPE_LZ4,   "LZ4",   true  },
+    };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_aTypes); i++)
+    {
+        if (s_aTypes[i].fBlock)
+            tstRTZipBlock(s_aTypes[i].enmType, s_aTypes[i].pszName);
+        tstRTZipStream(s_aTypes[i].enmType, s_aTypes[i].pszName);
+    }
+
+    RTMemPageFree(g_pbData, g_cbData);
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -0,0 +1,2451 @@
+/* $Id: Dedup.cpp $ */
+/** @file
+ * Dedup - Content addressed, deduplicating disk image, core code.
+ */
+
+/*
+ * Copyright (C) 2014 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_vd_dedup   VD Deduplicating Image Backend
+ *
+ * A dedup image (.vdd) contains only a header and a block map. The data of
+ * the blocks lives in a block store (.vddstore) which can be shared by any
+ * number of images. Every block in the store is identified by the SHA-256
+ * hash of its content and carries a reference count, so identical blocks
+ * written by different guests or to different locations occupy disk space
+ * only once.
+ *
+ * The store consists of segments, each starting with a table describing
+ * DEDUP_STORE_SEGMENT_SLOTS slots (hash and reference count) followed by
+ * the data of these slots. The store grows by appending segments. Slots
+ * are referenced from the block map of the images by a 1 based index.
+ *
+ * Blocks are never changed in place. Writing to a block hashes the new
+ * content of the whole block, looks it up in the hash index of the store
+ * and either references the existing slot or stores the data in a free one.
+ * The new slot is referenced before the block map is updated and the old one
+ * is released afterwards, so an interrupted write can only leak a slot.
+ *
+ * All images referencing the same store in a process share one instance of
+ * the store, including the hash index and a cache for the block data keyed
+ * by the slot. Identical blocks read by different images are therefore
+ * cached only once. Every image accesses the store file through its own
+ * storage handle. The store is not protected against concurrent modification
+ * from different processes.
+ */
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_VD
+#include <VBox/vd-plugin.h>
+#include <VBox/err.h>
+
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/critsect.h>
+#include <iprt/list.h>
+#include <iprt/mem.h>
+#include <iprt/once.h>
+#include <iprt/path.h>
+#include <iprt/semaphore.h>
+#include <iprt/sha.h>
+#include <iprt/string.h>
+#include <iprt/uuid.h>
+
+#include "VDBackends.h"
+#include "VDMetaCache.h"
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+
+/** Magic of the image header ('VDDI'). */
+#define DEDUP_IMAGE_MAGIC               UINT32_C(0x49444456)
+/** Magic of the store header ('VDDS'). */
+#define DEDUP_STORE_MAGIC               UINT32_C(0x53444456)
+/** The current version of the image and store format. */
+#define DEDUP_VERSION                   1
+/** Default block size. */
+#define DEDUP_BLOCK_SIZE_DEFAULT        _64K
+/** Number of slots in one store segment. */
+#define DEDUP_STORE_SEGMENT_SLOTS       1024
+/** Maximum length of the store path in the image header. */
+#define DEDUP_STORE_NAME_MAX            512
+/** Name of the store created next to the image if nothing else is configured. */
+#define DEDUP_STORE_NAME_DEFAULT        "Dedup.vddstore"
+/** Name of the configuration key for the store used by a new image. */
+#define DEDUP_CFG_STORE                 "Store"
+/** Default size of the block data cache of a store. */
+#define DEDUP_BLOCK_CACHE_SIZE_DEFAULT  (32 * _1M)
+
+/** Block map entry of a block which is not allocated. */
+#define DEDUP_BLOCK_FREE                UINT32_C(0)
+/** Block map entry of a block which contains only zeroes. */
+#define DEDUP_BLOCK_ZERO                UINT32_MAX
+/** Checks whether the block map entry references a slot. */
+#define DEDUP_BLOCK_IS_ALLOCATED(a_idSlot) ((a_idSlot) != DEDUP_BLOCK_FREE && (a_idSlot) != DEDUP_BLOCK_ZERO)
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+
+#pragma pack(1)
+/**
+ * Dedup image header, all fields are stored in little endian format.
+ */
+typedef struct DedupHeader
+{
+    /** Magic, DEDUP_IMAGE_MAGIC. */
+    uint32_t    u32Magic;
+    /** Format version. */
+    uint32_t    u32Version;
+    /** Size of the header. */
+    uint32_t    cbHeader;
+    /** Image flags, VD_IMAGE_FLAGS_*. */
+    uint32_t    fFlags;
+    /** Size of the disk in bytes. */
+    uint64_t    cbDisk;
+    /** Size of a block in bytes. */
+    uint32_t    cbBlock;
+    /** Number of blocks in the block map. */
+    uint32_t    cBlocks;
+    /** Offset of the block map in the image. */
+    uint64_t    offBlockMap;
+    /** UUID of the image. */
+    RTUUID      uuidCreate;
+    /** UUID of the last modification. */
+    RTUUID      uuidModify;
+    /** UUID of the parent image. */
+    RTUUID      uuidParent;
+    /** Modification UUID of the parent image. */
+    RTUUID      uuidParentModify;
+    /** Physical geometry. */
+    uint32_t    cPCHSCylinders;
+    uint32_t    cPCHSHeads;
+    uint32_t    cPCHSSectors;
+    /** Logical geometry. */
+    uint32_t    cLCHSCylinders;
+    uint32_t    cLCHSHeads;
+    uint32_t    cLCHSSectors;
+    /** Path of the block store, relative to the image directory if it has
+     * no path component. Zero terminated. */
+    char        szStore[DEDUP_STORE_NAME_MAX];
+} DedupHeader;
+AssertCompileSize(DedupHeader, 640);
+
+/**
+ * Dedup block store header, all fields are stored in little endian format.
+ */
+typedef struct DedupStoreHeader
+{
+    /** Magic, DEDUP_STORE_MAGIC. */
+    uint32_t    u32Magic;
+    /** Format version. */
+    uint32_t    u32Version;
+    /** Size of the header. */
+    uint32_t    cbHeader;
+    /** Size of a block in bytes. */
+    uint32_t    cbBlock;
+    /** Number of slots in a segment. */
+    uint32_t    cSlotsPerSegment;
+    /** Number of segments in the store. */
+    uint32_t    cSegments;
+    /** UUID of the store. */
+    RTUUID      uuidStore;
+} DedupStoreHeader;
+AssertCompileSize(DedupStoreHeader, 40);
+
+/**
+ * Slot table entry of the block store.
+ */
+typedef struct DedupSlotEntry
+{
+    /** SHA-256 hash of the block data, all zero if the slot was never used. */
+    uint8_t     abHash[RTSHA256_HASH_SIZE];
+    /** Number of block map entries referencing the slot (little endian). */
+    uint32_t    cRefs;
+    /** Reserved, zero. */
+    uint32_t    u32Reserved;
+} DedupSlotEntry;
+AssertCompileSize(DedupSlotEntry, 40);
+#pragma pack()
+
+/**
+ * In memory state of a store slot.
+ */
+typedef struct DEDUPSLOT
+{
+    /** SHA-256 hash of the block data, all zero if unused. */
+    uint8_t             abHash[RTSHA256_HASH_SIZE];
+    /** Reference count. */
+    uint32_t            cRefs;
+    /** Flag whether the slot is on the free list. */
+    bool                fFree;
+} DEDUPSLOT;
+/** Pointer to the in memory state of a slot. */
+typedef DEDUPSLOT *PDEDUPSLOT;
+
+/**
+ * Block store shared by the images in the process.
+ */
+typedef struct DEDUPSTORE
+{
+    /** Node for the global store list. */
+    RTLISTNODE          NodeStores;
+    /** Absolute path of the store. */
+    char               *pszFilename;
+    /** Number of images using the store, protected by g_hDedupStoreMtx. */
+    uint32_t            cUsers;
+    /** Critical section protecting the rest of the store state. */
+    RTCRITSECT          CritSect;
+    /** UUID of the store. */
+    RTUUID              Uuid;
+    /** Size of a block in bytes. */
+    uint32_t            cbBlock;
+    /** Size of the slot table at the start of each segment, aligned to the block size. */
+    uint32_t            cbSegmentTable;
+    /** Size of a segment in bytes. */
+    uint64_t            cbSegment;
+    /** Number of segments. */
+    uint32_t            cSegments;
+    /** Number of slots. */
+    uint32_t            cSlots;
+    /** Slot states, indexed by slot number - 1. */
+    PDEDUPSLOT          paSlots;
+    /** Hash index, open addressing table of slot numbers (0 for empty). */
+    uint32_t           *paidHash;
+    /** Number of entries in the hash index (power of two). */
+    uint32_t            cHash;
+    /** Stack of free slot numbers. */
+    uint32_t           *paidFree;
+    /** Number of entries on the free stack. */
+    uint32_t            cFree;
+    /** Number of slots with at least one reference. */
+    uint32_t            cSlotsUsed;
+    /** Cache for the block data, keyed by slot number. */
+    PVDMETACACHE        pCache;
+    /** Number of blocks which were already present when they were written. */
+    uint64_t            cDedupHits;
+} DEDUPSTORE;
+/** Pointer to a block store. */
+typedef DEDUPSTORE *PDEDUPSTORE;
+
+/**
+ * Dedup image instance data.
+ */
+typedef struct DEDUPIMAGE
+{
+    /** Image file name. */
+    const char         *pszFilename;
+    /** Opaque storage handle of the image. */
+    PVDIOSTORAGE        pStorage;
+    /** Opaque storage handle of the block store. */
+    PVDIOSTORAGE        pStorageStore;
+
+    /** Pointer to the per-disk VD interface list. */
+    PVDINTERFACE        pVDIfsDisk;
+    /** Pointer to the per-image VD interface list. */
+    PVDINTERFACE        pVDIfsImage;
+    /** Error interface. */
+    PVDINTERFACEERROR   pIfError;
+    /** I/O interface. */
+    PVDINTERFACEIOINT   pIfIo;
+
+    /** Open flags passed by VBoxHDD layer. */
+    unsigned            uOpenFlags;
+    /** Image header, in host endianess. */
+    DedupHeader         Header;
+    /** Flag whether the header needs to be written. */
+    bool                fHeaderDirty;
+    /** Physical geometry of this image. */
+    VDGEOMETRY          PCHSGeometry;
+    /** Logical geometry of this image. */
+    VDGEOMETRY          LCHSGeometry;
+    /** Block map, in host endianess. */
+    uint32_t           *paBlockMap;
+    /** Buffer of one block for assembling the new block content. */
+    void               *pvBlock;
+    /** The block store. */
+    PDEDUPSTORE         pStore;
+} DEDUPIMAGE;
+/** Pointer to the dedup image instance data. */
+typedef DEDUPIMAGE *PDEDUPIMAGE;
+
+/*******************************************************************************
+*   Static Variables                                                           *
+*******************************************************************************/
+
+/** NULL-terminated array of supported file extensions. */
+static const VDFILEEXTENSION s_aDedupFileExtensions[] =
+{
+    {"vdd", VDTYPE_HDD},
+    {NULL, VDTYPE_INVALID}
+};
+
+static const VDCONFIGINFO s_aDedupConfigInfo[] =
+{
+    { DEDUP_CFG_STORE,          NULL,         VDCFGVALUETYPE_STRING,     0 },
+    { VD_METACACHE_CFG_SIZE,    "33554432",   VDCFGVALUETYPE_INTEGER,    VD_CFGKEY_EXPERT },
+    { NULL,                     NULL,         VDCFGVALUETYPE_INTEGER,    0 }
+};
+
+/** Init once structure for the global store list. */
+static RTONCE           g_DedupStoreInitOnce = RTONCE_INITIALIZER;
+/** Mutex protecting the global store list. */
+static RTSEMFASTMUTEX   g_hDedupStoreMtx = NIL_RTSEMFASTMUTEX;
+/** List of stores in use. */
+static RTLISTANCHOR     g_ListDedupStores;
+
+/*******************************************************************************
+*   Internal Functions                                                         *
+*******************************************************************************/
+
+/**
+ * Internal: Converts the header fields between little and host endianess
+ * (in place, the conversion works in both directions).
+ */
+static void dedupHeaderConvEndianess(DedupHeader *pHdr)
+{
+    pHdr->u32Magic       = RT_LE2H_U32(pHdr->u32Magic);
+    pHdr->u32Version     = RT_LE2H_U32(pHdr->u32Version);
+    pHdr->cbHeader       = RT_LE2H_U32(pHdr->cbHeader);
+    pHdr->fFlags         = RT_LE2H_U32(pHdr->fFlags);
+    pHdr->cbDisk         = RT_LE2H_U64(pHdr->cbDisk);
+    pHdr->cbBlock        = RT_LE2H_U32(pHdr->cbBlock);
+    pHdr->cBlocks        = RT_LE2H_U32(pHdr->cBlocks);
+    pHdr->offBlockMap    = RT_LE2H_U64(pHdr->offBlockMap);
+    pHdr->cPCHSCylinders = RT_LE2H_U32(pHdr->cPCHSCylinders);
+    pHdr->cPCHSHeads     = RT_LE2H_U32(pHdr->cPCHSHeads);
+    pHdr->cPCHSSectors   = RT_LE2H_U32(pHdr->cPCHSSectors);
+    pHdr->cLCHSCylinders = RT_LE2H_U32(pHdr->cLCHSCylinders);
+    pHdr->cLCHSHeads     = RT_LE2H_U32(pHdr->cLCHSHeads);
+    pHdr->cLCHSSectors   = RT_LE2H_U32(pHdr->cLCHSSectors);
+}
+
+/**
+ * Internal: Converts the store header fields between little and host
+ * endianess (in place).
+ */
+static void dedupStoreHeaderConvEndianess(DedupStoreHeader *pHdr)
+{
+    pHdr->u32Magic         = RT_LE2H_U32(pHdr->u32Magic);
+    pHdr->u32Version       = RT_LE2H_U32(pHdr->u32Version);
+    pHdr->cbHeader         = RT_LE2H_U32(pHdr->cbHeader);
+    pHdr->cbBlock          = RT_LE2H_U32(pHdr->cbBlock);
+    pHdr->cSlotsPerSegment = RT_LE2H_U32(pHdr->cSlotsPerSegment);
+    pHdr->cSegments        = RT_LE2H_U32(pHdr->cSegments);
+}
+
+/**
+ * Internal: Returns the offset of the slot table entry in the store.
+ */
+DECLINLINE(uint64_t) dedupStoreSlotOffset(PDEDUPSTORE pStore, uint32_t idSlot)
+{
+    uint32_t idx = idSlot - 1;
+    return   pStore->cbBlock
+           + (idx / DEDUP_STORE_SEGMENT_SLOTS) * pStore->cbSegment
+           + (idx % DEDUP_STORE_SEGMENT_SLOTS) * sizeof(DedupSlotEntry);
+}
+
+/**
+ * Internal: Returns the offset of the slot data in the store.
+ */
+DECLINLINE(uint64_t) dedupStoreDataOffset(PDEDUPSTORE pStore, uint32_t idSlot)
+{
+    uint32_t idx = idSlot - 1;
+    return   pStore->cbBlock
+           + (idx / DEDUP_STORE_SEGMENT_SLOTS) * pStore->cbSegment
+           + pStore->cbSegmentTable
+           + (uint64_t)(idx % DEDUP_STORE_SEGMENT_SLOTS) * pStore->cbBlock;
+}
+
+/**
+ * Internal: Returns the home position of the given hash in the hash index.
+ */
+DECLINLINE(uint32_t) dedupStoreHashHome(PDEDUPSTORE pStore, const uint8_t *pbHash)
+{
+    uint32_t u32;
+    memcpy(&u32, pbHash, sizeof(u32));
+    return u32 & (pStore->cHash - 1);
+}
+
+/**
+ * Internal: Checks whether the slot state describes a slot which was used.
+ */
+DECLINLINE(bool) dedupSlotHasHash(PDEDUPSLOT pSlot)
+{
+    return ASMMemIsAll8(pSlot->abHash, sizeof(pSlot->abHash), 0) != NULL;
+}
+
+/**
+ * Internal: Inserts a slot into the hash index, which must have room left.
+ */
+static void dedupStoreHashInsert(PDEDUPSTORE pStore, uint32_t idSlot)
+{
+    uint32_t i = dedupStoreHashHome(pStore, pStore->paSlots[idSlot - 1].abHash);
+
+    while (pStore->paidHash[i])
+        i = (i + 1) & (pStore->cHash - 1);
+    pStore->paidHash[i] = idSlot;
+}
+
+/**
+ * Internal: Removes a slot from the hash index.
+ *
+ * Entries following it in the same probe sequence are moved up to keep
+ * lookups working without tombstones.
+ */
+static void dedupStoreHashRemove(PDEDUPSTORE pStore, uint32_t idSlot)
+{
+    uint32_t fMask = pStore->cHash - 1;
+    uint32_t i = dedupStoreHashHome(pStore, pStore->paSlots[idSlot - 1].abHash);
+
+    while (pStore->paidHash[i] != idSlot)
+    {
+        AssertReturnVoid(pStore->paidHash[i]);
+        i = (i + 1) & fMask;
+    }
+
+    pStore->paidHash[i] = 0;
+    uint32_t j = i;
+    for (;;)
+    {
+        j = (j + 1) & fMask;
+        if (!pStore->paidHash[j])
+            break;
+
+        /* Move the entry if the now empty position lies between its home and j. */
+        uint32_t k = dedupStoreHashHome(pStore, pStore->paSlots[pStore->paidHash[j] - 1].abHash);
+        if (   (i <= j && (k <= i || k > j))
+            || (i > j && k <= i && k > j))
+        {
+            pStore->paidHash[i] = pStore->paidHash[j];
+            pStore->paidHash[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/**
+ * Internal: Looks up the slot containing a block with the given hash.
+ *
+ * @returns Slot number or 0 if there is none.
+ */
+static uint32_t dedupStoreHashLookup(PDEDUPSTORE pStore, const uint8_t *pbHash)
+{
+    uint32_t i = dedupStoreHashHome(pStore, pbHash);
+
+    while (pStore->paidHash[i])
+    {
+        uint32_t idSlot = pStore->paidHash[i];
+        if (!memcmp(pStore->paSlots[idSlot - 1].abHash, pbHash, RTSHA256_HASH_SIZE))
+            return idSlot;
+        i = (i + 1) & (pStore->cHash - 1);
+    }
+
+    return 0;
+}
+
+/**
+ * Internal: Sizes the hash index and free slot stack for the current number
+ * of slots, rebuilding the index.
+ *
+ * @returns VBox status code.
+ * @param   pStore    The store.
+ */
+static int dedupStoreIndexResize(PDEDUPSTORE pStore)
+{
+    uint32_t cHash = 64;
+    while (cHash < 2 * pStore->cSlots)
+        cHash <<= 1;
+
+    uint32_t *paidFree = (uint32_t *)RTMemRealloc(pStore->paidFree, RT_MAX(pStore->cSlots, 1) * sizeof(uint32_t));
+    if (!paidFree)
+        return VERR_NO_MEMORY;
+    pStore->paidFree = paidFree;
+
+    if (cHash == pStore->cHash)
+        return VINF_SUCCESS;
+
+    uint32_t *paidHash = (uint32_t *)RTMemAllocZ(cHash * sizeof(uint32_t));
+    if (!paidHash)
+        return VERR_NO_MEMORY;
+
+    RTMemFree(pStore->paidHash);
+    pStore->paidHash = paidHash;
+    pStore->cHash    = cHash;
+    for (uint32_t idSlot = 1; idSlot <= pStore->cSlots; idSlot++)
+        if (dedupSlotHasHash(&pStore->paSlots[idSlot - 1]))
+            dedupStoreHashInsert(pStore, idSlot);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Puts a slot without references on the free stack.
+ */
+static void dedupStoreSlotPushFree(PDEDUPSTORE pStore, uint32_t idSlot)
+{
+    PDEDUPSLOT pSlot = &pStore->paSlots[idSlot - 1];
+
+    if (!pSlot->fFree)
+    {
+        Assert(pStore->cFree < pStore->cSlots);
+        pSlot->fFree = true;
+        pStore->paidFree[pStore->cFree++] = idSlot;
+    }
+}
+
+/**
+ * Internal: Writes the slot table entry of the given slot.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image accessing the store.
+ * @param   idSlot    The slot to write.
+ */
+static int dedupStoreSlotWrite(PDEDUPIMAGE pImage, uint32_t idSlot)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    PDEDUPSLOT pSlot = &pStore->paSlots[idSlot - 1];
+    DedupSlotEntry Entry;
+
+    memcpy(Entry.abHash, pSlot->abHash, sizeof(Entry.abHash));
+    Entry.cRefs       = RT_H2LE_U32(pSlot->cRefs);
+    Entry.u32Reserved = 0;
+    return vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorageStore,
+                                  dedupStoreSlotOffset(pStore, idSlot),
+                                  &Entry, sizeof(Entry));
+}
+
+/**
+ * Internal: Writes the store header.
+ */
+static int dedupStoreHeaderWrite(PDEDUPIMAGE pImage)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    DedupStoreHeader Hdr;
+
+    RT_ZERO(Hdr);
+    Hdr.u32Magic         = DEDUP_STORE_MAGIC;
+    Hdr.u32Version       = DEDUP_VERSION;
+    Hdr.cbHeader         = sizeof(Hdr);
+    Hdr.cbBlock          = pStore->cbBlock;
+    Hdr.cSlotsPerSegment = DEDUP_STORE_SEGMENT_SLOTS;
+    Hdr.cSegments        = pStore->cSegments;
+    Hdr.uuidStore        = pStore->Uuid;
+    dedupStoreHeaderConvEndianess(&Hdr);
+    return vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorageStore, 0, &Hdr, sizeof(Hdr));
+}
+
+/**
+ * Internal: Adds a segment to the store.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image accessing the store.
+ */
+static int dedupStoreGrow(PDEDUPIMAGE pImage)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    uint32_t cSlotsNew = pStore->cSlots + DEDUP_STORE_SEGMENT_SLOTS;
+
+    if (cSlotsNew >= DEDUP_BLOCK_ZERO)
+        return VERR_DISK_FULL;
+
+    PDEDUPSLOT paSlots = (PDEDUPSLOT)RTMemRealloc(pStore->paSlots, cSlotsNew * sizeof(DEDUPSLOT));
+    if (!paSlots)
+        return VERR_NO_MEMORY;
+    memset(&paSlots[pStore->cSlots], 0, DEDUP_STORE_SEGMENT_SLOTS * sizeof(DEDUPSLOT));
+    pStore->paSlots = paSlots;
+
+    /* The new slot table is all zero, the file system takes care of that. */
+    int rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorageStore,
+                                  pStore->cbBlock + (pStore->cSegments + 1) * pStore->cbSegment);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    uint32_t idSlotFirst = pStore->cSlots + 1;
+    pStore->cSegments++;
+    pStore->cSlots = cSlotsNew;
+    rc = dedupStoreIndexResize(pStore);
+    if (RT_SUCCESS(rc))
+    {
+        /* Push in reverse order to hand out the slots front to back. */
+        for (uint32_t idSlot = cSlotsNew; idSlot >= idSlotFirst; idSlot--)
+            dedupStoreSlotPushFree(pStore, idSlot);
+
+        rc = dedupStoreHeaderWrite(pImage);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Takes a slot from the free stack, growing the store if required.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image accessing the store.
+ * @param   pidSlot   Where to store the slot number.
+ */
+static int dedupStoreSlotAlloc(PDEDUPIMAGE pImage, uint32_t *pidSlot)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+
+    for (;;)
+    {
+        if (!pStore->cFree)
+        {
+            int rc = dedupStoreGrow(pImage);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+
+        uint32_t idSlot = pStore->paidFree[--pStore->cFree];
+        PDEDUPSLOT pSlot = &pStore->paSlots[idSlot - 1];
+        pSlot->fFree = false;
+
+        /* Slots referenced again after they were freed stay where they are. */
+        if (pSlot->cRefs)
+            continue;
+
+        if (dedupSlotHasHash(pSlot))
+        {
+            dedupStoreHashRemove(pStore, idSlot);
+            RT_ZERO(pSlot->abHash);
+
+            /* Drop the stale data from the cache. */
+            if (vdMetaCacheIsCached(pStore->pCache, idSlot))
+            {
+                PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pStore->pCache, idSlot);
+                vdMetaCacheEntryRelease(pEntry);
+                vdMetaCacheEntryFree(pStore->pCache, pEntry);
+            }
+        }
+
+        *pidSlot = idSlot;
+        return VINF_SUCCESS;
+    }
+}
+
+/**
+ * Internal: Stores a block, referencing an existing slot with the same content
+ * if there is one.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image accessing the store.
+ * @param   pvBlock   The block data.
+ * @param   pidSlot   Where to store the slot number. One reference is
+ *                    retained for the caller.
+ */
+static int dedupStoreBlock(PDEDUPIMAGE pImage, const void *pvBlock, uint32_t *pidSlot)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    uint8_t abHash[RTSHA256_HASH_SIZE];
+    int rc;
+
+    RTSha256(pvBlock, pStore->cbBlock, abHash);
+
+    RTCritSectEnter(&pStore->CritSect);
+
+    uint32_t idSlot = dedupStoreHashLookup(pStore, abHash);
+    if (idSlot)
+    {
+        PDEDUPSLOT pSlot = &pStore->paSlots[idSlot - 1];
+        if (!pSlot->cRefs++)
+            pStore->cSlotsUsed++;
+        pStore->cDedupHits++;
+        rc = dedupStoreSlotWrite(pImage, idSlot);
+    }
+    else
+    {
+        rc = dedupStoreSlotAlloc(pImage, &idSlot);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorageStore,
+                                        dedupStoreDataOffset(pStore, idSlot),
+                                        pvBlock, pStore->cbBlock);
+        if (RT_SUCCESS(rc))
+        {
+            PDEDUPSLOT pSlot = &pStore->paSlots[idSlot - 1];
+            memcpy(pSlot->abHash, abHash, sizeof(abHash));
+            pSlot->cRefs = 1;
+            pStore->cSlotsUsed++;
+            rc = dedupStoreSlotWrite(pImage, idSlot);
+            dedupStoreHashInsert(pStore, idSlot);
+
+            /* Keep the data if there is room, it is likely to be read soon. */
+            PVDMETACACHEENTRY pEntry = vdMetaCacheEntryAlloc(pStore->pCache, true /* fPrefetch */);
+            if (pEntry)
+            {
+                memcpy(pEntry->pvData, pvBlock, pStore->cbBlock);
+                vdMetaCacheEntryInsert(pStore->pCache, pEntry, idSlot);
+                vdMetaCacheEntryRelease(pEntry);
+            }
+        }
+        else if (idSlot)
+            dedupStoreSlotPushFree(pStore, idSlot);
+    }
+
+    RTCritSectLeave(&pStore->CritSect);
+
+    if (RT_SUCCESS(rc))
+        *pidSlot = idSlot;
+    return rc;
+}
+
+/**
+ * Internal: Drops a reference to a slot.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image accessing the store.
+ * @param   idSlot    The slot to release.
+ */
+static int dedupStoreRelease(PDEDUPIMAGE pImage, uint32_t idSlot)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    int rc;
+
+    RTCritSectEnter(&pStore->CritSect);
+
+    PDEDUPSLOT pSlot = &pStore->paSlots[idSlot - 1];
+    AssertMsg(pSlot->cRefs, ("Slot %u is not in use\n", idSlot));
+    if (pSlot->cRefs && !--pSlot->cRefs)
+    {
+        /* The content stays in the index until the slot is reused. */
+        pStore->cSlotsUsed--;
+        dedupStoreSlotPushFree(pStore, idSlot);
+    }
+    rc = dedupStoreSlotWrite(pImage, idSlot);
+
+    RTCritSectLeave(&pStore->CritSect);
+    return rc;
+}
+
+/**
+ * Internal: Reads a part of a slot, going through the block cache.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image accessing the store.
+ * @param   idSlot    The slot to read from.
+ * @param   offRead   Offset inside the block.
+ * @param   pIoCtx    The I/O context to copy the data to.
+ * @param   cbRead    Number of bytes to read.
+ */
+static int dedupStoreRead(PDEDUPIMAGE pImage, uint32_t idSlot, uint32_t offRead,
+                          PVDIOCTX pIoCtx, size_t cbRead)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    int rc = VINF_SUCCESS;
+
+    RTCritSectEnter(&pStore->CritSect);
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pStore->pCache, idSlot);
+    if (!pEntry)
+    {
+        pEntry = vdMetaCacheEntryAlloc(pStore->pCache, false /* fPrefetch */);
+        if (pEntry)
+        {
+            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorageStore,
+                                       dedupStoreDataOffset(pStore, idSlot),
+                                       pEntry->pvData, pStore->cbBlock);
+            if (RT_SUCCESS(rc))
+                vdMetaCacheEntryInsert(pStore->pCache, pEntry, idSlot);
+            else
+            {
+                vdMetaCacheEntryRelease(pEntry);
+                vdMetaCacheEntryFree(pStore->pCache, pEntry);
+                pEntry = NULL;
+            }
+        }
+    }
+    RTCritSectLeave(&pStore->CritSect);
+
+    if (pEntry)
+    {
+        /* The entry can't go away while it is referenced. */
+        vdIfIoIntIoCtxCopyTo(pImage->pIfIo, pIoCtx, (uint8_t *)pEntry->pvData + offRead, cbRead);
+
+        RTCritSectEnter(&pStore->CritSect);
+        vdMetaCacheEntryRelease(pEntry);
+        RTCritSectLeave(&pStore->CritSect);
+    }
+    else if (RT_SUCCESS(rc))
+    {
+        /* All cache entries are in use, read directly. */
+        rc = vdIfIoIntFileReadUser(pImage->pIfIo, pImage->pStorageStore,
+                                   dedupStoreDataOffset(pStore, idSlot) + offRead,
+                                   pIoCtx, cbRead);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Reads a whole slot into the given buffer.
+ */
+static int dedupStoreReadBlock(PDEDUPIMAGE pImage, uint32_t idSlot, void *pvBlock)
+{
+    PDEDUPSTORE pStore = pImage->pStore;
+    int rc = VINF_SUCCESS;
+
+    RTCritSectEnter(&pStore->CritSect);
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pStore->pCache, idSlot);
+    if (pEntry)
+    {
+        memcpy(pvBlock, pEntry->pvData, pStore->cbBlock);
+        vdMetaCacheEntryRelease(pEntry);
+    }
+    else
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorageStore,
+                                   dedupStoreDataOffset(pStore, idSlot),
+                                   pvBlock, pStore->cbBlock);
+    RTCritSectLeave(&pStore->CritSect);
+
+    return rc;
+}
+
+/**
+ * Internal: Loads the state of a store from the store file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image which opened the store file.
+ * @param   pStore    The store to initialize.
+ */
+static int dedupStoreLoad(PDEDUPIMAGE pImage, PDEDUPSTORE pStore)
+{
+    DedupStoreHeader Hdr;
+    int rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorageStore, 0, &Hdr, sizeof(Hdr));
+    if (RT_FAILURE(rc))
+        return rc;
+
+    dedupStoreHeaderConvEndianess(&Hdr);
+    if (   Hdr.u32Magic != DEDUP_STORE_MAGIC
+        || Hdr.u32Version != DEDUP_VERSION
+        || Hdr.cSlotsPerSegment != DEDUP_STORE_SEGMENT_SLOTS
+        || Hdr.cbBlock < 512
+        || !RT_IS_POWER_OF_TWO(Hdr.cbBlock)
+        || Hdr.cSegments > (DEDUP_BLOCK_ZERO - 1) / DEDUP_STORE_SEGMENT_SLOTS)
+        return VERR_VD_DEDUP_INVALID_HEADER;
+
+    pStore->Uuid           = Hdr.uuidStore;
+    pStore->cbBlock        = Hdr.cbBlock;
+    pStore->cbSegmentTable = RT_ALIGN_32(DEDUP_STORE_SEGMENT_SLOTS * sizeof(DedupSlotEntry), Hdr.cbBlock);
+    pStore->cbSegment      = pStore->cbSegmentTable + (uint64_t)DEDUP_STORE_SEGMENT_SLOTS * Hdr.cbBlock;
+    pStore->cSegments      = Hdr.cSegments;
+    pStore->cSlots         = Hdr.cSegments * DEDUP_STORE_SEGMENT_SLOTS;
+
+    if (pStore->cSlots)
+    {
+        pStore->paSlots = (PDEDUPSLOT)RTMemAllocZ(pStore->cSlots * sizeof(DEDUPSLOT));
+        if (!pStore->paSlots)
+            return VERR_NO_MEMORY;
+    }
+
+    DedupSlotEntry *paEntries = (DedupSlotEntry *)RTMemTmpAlloc(DEDUP_STORE_SEGMENT_SLOTS * sizeof(DedupSlotEntry));
+    if (!paEntries)
+        return VERR_NO_MEMORY;
+
+    for (uint32_t iSeg = 0; iSeg < pStore->cSegments && RT_SUCCESS(rc); iSeg++)
+    {
+        uint32_t idSlotFirst = iSeg * DEDUP_STORE_SEGMENT_SLOTS + 1;
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorageStore,
+                                   dedupStoreSlotOffset(pStore, idSlotFirst), paEntries,
+                                   DEDUP_STORE_SEGMENT_SLOTS * sizeof(DedupSlotEntry));
+        if (RT_SUCCESS(rc))
+        {
+            for (uint32_t i = 0; i < DEDUP_STORE_SEGMENT_SLOTS; i++)
+            {
+                PDEDUPSLOT pSlot = &pStore->paSlots[idSlotFirst - 1 + i];
+                memcpy(pSlot->abHash, paEntries[i].abHash, sizeof(pSlot->abHash));
+                pSlot->cRefs = RT_LE2H_U32(paEntries[i].cRefs);
+                if (pSlot->cRefs)
+                    pStore->cSlotsUsed++;
+            }
+        }
+    }
+    RTMemTmpFree(paEntries);
+
+    if (RT_SUCCESS(rc))
+        rc = dedupStoreIndexResize(pStore);
+    if (RT_SUCCESS(rc))
+    {
+        for (uint32_t idSlot = pStore->cSlots; idSlot > 0; idSlot--)
+            if (!pStore->paSlots[idSlot - 1].cRefs)
+                dedupStoreSlotPushFree(pStore, idSlot);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Frees the in memory state of a store.
+ */
+static void dedupStoreDestroy(PDEDUPSTORE pStore)
+{
+    if (pStore->pCache)
+    {
+        vdMetaCacheLogStats(pStore->pCache, "Dedup", pStore->pszFilename);
+        vdMetaCacheDestroy(pStore->pCache);
+    }
+    if (RTCritSectIsInitialized(&pStore->CritSect))
+        RTCritSectDelete(&pStore->CritSect);
+    RTMemFree(pStore->paSlots);
+    RTMemFree(pStore->paidHash);
+    RTMemFree(pStore->paidFree);
+    RTStrFree(pStore->pszFilename);
+    RTMemFree(pStore);
+}
+
+/**
+ * Internal: Initializes the global store list.
+ */
+static DECLCALLBACK(int32_t) dedupStoreInitOnce(void *pvUser)
+{
+    NOREF(pvUser);
+    RTListInit(&g_ListDedupStores);
+    return RTSemFastMutexCreate(&g_hDedupStoreMtx);
+}
+
+/**
+ * Internal: Opens the block store for an image, creating it if requested and
+ * it doesn't exist yet.
+ *
+ * @returns VBox status code.
+ * @param   pImage      The image to open the store for.
+ * @param   pszStore    Absolute path of the store.
+ * @param   fCreate     Flag whether to create the store if it doesn't exist.
+ * @param   cbBlock     Block size for a newly created store.
+ */
+static int dedupStoreOpen(PDEDUPIMAGE pImage, const char *pszStore, bool fCreate, uint32_t cbBlock)
+{
+    int rc = RTOnce(&g_DedupStoreInitOnce, dedupStoreInitOnce, NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * The store is modified by all images using it, which coordinate through
+     * the shared state, so it must not be locked against other writers.
+     */
+    unsigned uOpenFlags = pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY;
+    if (!uOpenFlags)
+        uOpenFlags |= VD_OPEN_FLAGS_SHAREABLE;
+
+    RTSemFastMutexRequest(g_hDedupStoreMtx);
+
+    bool fCreated = false;
+    rc = vdIfIoIntFileOpen(pImage->pIfIo, pszStore,
+                           VDOpenFlagsToFileOpenFlags(uOpenFlags, false /* fCreate */),
+                           &pImage->pStorageStore);
+    if (   rc == VERR_FILE_NOT_FOUND
+        && fCreate)
+    {
+        rc = vdIfIoIntFileOpen(pImage->pIfIo, pszStore,
+                               VDOpenFlagsToFileOpenFlags(uOpenFlags, true /* fCreate */),
+                               &pImage->pStorageStore);
+        fCreated = RT_SUCCESS(rc);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        PDEDUPSTORE pStore;
+        RTListForEach(&g_ListDedupStores, pStore, DEDUPSTORE, NodeStores)
+        {
+            if (!RTPathCompare(pStore->pszFilename, pszStore))
+            {
+                pStore->cUsers++;
+                pImage->pStore = pStore;
+                break;
+            }
+        }
+
+        if (!pImage->pStore)
+        {
+            pStore = (PDEDUPSTORE)RTMemAllocZ(sizeof(DEDUPSTORE));
+            if (pStore)
+            {
+                pStore->pszFilename = RTStrDup(pszStore);
+                rc = pStore->pszFilename ? RTCritSectInit(&pStore->CritSect) : VERR_NO_MEMORY;
+                if (RT_SUCCESS(rc))
+                {
+                    pImage->pStore = pStore;
+                    if (fCreated)
+                    {
+                        /* The first block of the store holds the header. */
+                        pStore->cbBlock        = cbBlock;
+                        pStore->cbSegmentTable = RT_ALIGN_32(DEDUP_STORE_SEGMENT_SLOTS * sizeof(DedupSlotEntry), cbBlock);
+                        pStore->cbSegment      = pStore->cbSegmentTable + (uint64_t)DEDUP_STORE_SEGMENT_SLOTS * cbBlock;
+                        RTUuidCreate(&pStore->Uuid);
+                        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorageStore, cbBlock);
+                        if (RT_SUCCESS(rc))
+                            rc = dedupStoreHeaderWrite(pImage);
+                        if (RT_SUCCESS(rc))
+                            rc = dedupStoreIndexResize(pStore);
+                    }
+                    else
+                        rc = dedupStoreLoad(pImage, pStore);
+                }
+
+                if (RT_SUCCESS(rc))
+                {
+                    size_t cbCache = vdMetaCacheQuerySize(pImage->pVDIfsImage, DEDUP_BLOCK_CACHE_SIZE_DEFAULT);
+                    rc = vdMetaCacheCreate(&pStore->pCache, pStore->cbBlock, cbCache);
+                }
+
+                if (RT_SUCCESS(rc))
+                {
+                    pStore->cUsers = 1;
+                    RTListAppend(&g_ListDedupStores, &pStore->NodeStores);
+                }
+                else
+                {
+                    pImage->pStore = NULL;
+                    dedupStoreDestroy(pStore);
+                }
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+
+        if (RT_FAILURE(rc))
+        {
+            vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorageStore);
+            pImage->pStorageStore = NULL;
+            if (fCreated)
+                vdIfIoIntFileDelete(pImage->pIfIo, pszStore);
+        }
+    }
+
+    RTSemFastMutexRelease(g_hDedupStoreMtx);
+    return rc;
+}
+
+/**
+ * Internal: Closes the block store of an image.
+ */
+static int dedupStoreClose(PDEDUPIMAGE pImage)
+{
+    int rc = VINF_SUCCESS;
+
+    RTSemFastMutexRequest(g_hDedupStoreMtx);
+
+    if (pImage->pStorageStore)
+    {
+        rc = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorageStore);
+        pImage->pStorageStore = NULL;
+    }
+
+    PDEDUPSTORE pStore = pImage->pStore;
+    if (pStore)
+    {
+        pImage->pStore = NULL;
+        if (!--pStore->cUsers)
+        {
+            LogRel(("Dedup: Store '%s' has %u of %u slots in use, %llu blocks were deduplicated\n",
+                    pStore->pszFilename, pStore->cSlotsUsed, pStore->cSlots, pStore->cDedupHits));
+            RTListNodeRemove(&pStore->NodeStores);
+            dedupStoreDestroy(pStore);
+        }
+    }
+
+    RTSemFastMutexRelease(g_hDedupStoreMtx);
+    return rc;
+}
+
+/**
+ * Internal: Resolves the store path recorded in the image header.
+ *
+ * @returns Absolute store path, free with RTStrFree().
+ * @param   pszFilename The image filename.
+ * @param   pszStore    The store path from the header.
+ */
+static char *dedupStorePathResolve(const char *pszFilename, const char *pszStore)
+{
+    if (RTPathHasPath(pszStore))
+        return RTPathAbsDup(pszStore);
+
+    char *pszDir = RTPathAbsDup(pszFilename);
+    if (!pszDir)
+        return NULL;
+    RTPathStripFilename(pszDir);
+    char *pszPath = RTPathJoinA(pszDir, pszStore);
+    RTStrFree(pszDir);
+    return pszPath;
+}
+
+/**
+ * Internal: Records the store path in the image header, without a path if
+ * the store lives next to the image.
+ *
+ * @returns VBox status code.
+ * @param   pImage      The image.
+ * @param   pszFilename The image filename.
+ * @param   pszStore    Absolute path of the store.
+ */
+static int dedupStorePathSet(PDEDUPIMAGE pImage, const char *pszFilename, const char *pszStore)
+{
+    char *pszDir = RTPathAbsDup(pszFilename);
+    if (!pszDir)
+        return VERR_NO_MEMORY;
+    RTPathStripFilename(pszDir);
+
+    char *pszStoreDir = RTStrDup(pszStore);
+    if (!pszStoreDir)
+    {
+        RTStrFree(pszDir);
+        return VERR_NO_MEMORY;
+    }
+    RTPathStripFilename(pszStoreDir);
+
+    const char *pszName = RTPathCompare(pszDir, pszStoreDir) ? pszStore : RTPathFilename(pszStore);
+    int rc = RTStrCopy(pImage->Header.szStore, sizeof(pImage->Header.szStore), pszName);
+    if (RT_SUCCESS(rc))
+        pImage->fHeaderDirty = true;
+    else
+        rc = VERR_FILENAME_TOO_LONG;
+
+    RTStrFree(pszStoreDir);
+    RTStrFree(pszDir);
+    return rc;
+}
+
+/**
+ * Internal: Writes the image header.
+ */
+static int dedupHeaderWrite(PDEDUPIMAGE pImage)
+{
+    DedupHeader Hdr = pImage->Header;
+
+    Hdr.cPCHSCylinders = pImage->PCHSGeometry.cCylinders;
+    Hdr.cPCHSHeads     = pImage->PCHSGeometry.cHeads;
+    Hdr.cPCHSSectors   = pImage->PCHSGeometry.cSectors;
+    Hdr.cLCHSCylinders = pImage->LCHSGeometry.cCylinders;
+    Hdr.cLCHSHeads     = pImage->LCHSGeometry.cHeads;
+    Hdr.cLCHSSectors   = pImage->LCHSGeometry.cSectors;
+    dedupHeaderConvEndianess(&Hdr);
+
+    int rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, 0, &Hdr, sizeof(Hdr));
+    if (RT_SUCCESS(rc))
+        pImage->fHeaderDirty = false;
+    return rc;
+}
+
+/**
+ * Internal: Writes a block map entry.
+ */
+static int dedupBlockMapWrite(PDEDUPIMAGE pImage, uint32_t uBlock)
+{
+    uint32_t idSlot = RT_H2LE_U32(pImage->paBlockMap[uBlock]);
+    return vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage,
+                                  pImage->Header.offBlockMap + uBlock * sizeof(uint32_t),
+                                  &idSlot, sizeof(idSlot));
+}
+
+/**
+ * Internal: Changes a block map entry, referencing the new slot before and
+ * releasing the old one after the block map was updated.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image.
+ * @param   uBlock    The block to change.
+ * @param   idSlot    The new entry, a reference to the slot must be retained already.
+ */
+static int dedupBlockMapSet(PDEDUPIMAGE pImage, uint32_t uBlock, uint32_t idSlot)
+{
+    uint32_t idSlotOld = pImage->paBlockMap[uBlock];
+
+    if (idSlotOld == idSlot)
+    {
+        /* Same content as before, drop the extra reference. */
+        return DEDUP_BLOCK_IS_ALLOCATED(idSlot) ? dedupStoreRelease(pImage, idSlot) : VINF_SUCCESS;
+    }
+
+    pImage->paBlockMap[uBlock] = idSlot;
+    int rc = dedupBlockMapWrite(pImage, uBlock);
+    if (RT_SUCCESS(rc))
+    {
+        if (DEDUP_BLOCK_IS_ALLOCATED(idSlotOld))
+            rc = dedupStoreRelease(pImage, idSlotOld);
+    }
+    else
+    {
+        pImage->paBlockMap[uBlock] = idSlotOld;
+        if (DEDUP_BLOCK_IS_ALLOCATED(idSlot))
+            dedupStoreRelease(pImage, idSlot);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Flush image data to disk.
+ */
+static int dedupFlushImage(PDEDUPIMAGE pImage)
+{
+    int rc = VINF_SUCCESS;
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VINF_SUCCESS;
+
+    if (pImage->fHeaderDirty)
+        rc = dedupHeaderWrite(pImage);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+    if (RT_SUCCESS(rc) && pImage->pStorageStore)
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorageStore);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Free all allocated space for representing an image except pImage,
+ * and optionally delete the image from disk.
+ */
+static int dedupFreeImage(PDEDUPIMAGE pImage, bool fDelete)
+{
+    int rc = VINF_SUCCESS;
+
+    /* Freeing a never allocated image (e.g. because the open failed) is
+     * not signalled as an error. After all nothing bad happens. */
+    if (pImage)
+    {
+        /* The blocks of a deleted image are not referenced anymore. */
+        if (   fDelete
+            && pImage->pStore
+            && pImage->paBlockMap
+            && !(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        {
+            for (uint32_t uBlock = 0; uBlock < pImage->Header.cBlocks; uBlock++)
+                if (DEDUP_BLOCK_IS_ALLOCATED(pImage->paBlockMap[uBlock]))
+                    dedupStoreRelease(pImage, pImage->paBlockMap[uBlock]);
+            if (pImage->pStorageStore)
+                vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorageStore);
+        }
+
+        if (pImage->pStorage)
+        {
+            /* No point updating the file that is deleted anyway. */
+            if (!fDelete)
+                dedupFlushImage(pImage);
+
+            rc = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+            pImage->pStorage = NULL;
+        }
+
+        if (pImage->pStore || pImage->pStorageStore)
+        {
+            int rc2 = dedupStoreClose(pImage);
+            if (RT_SUCCESS(rc))
+                rc = rc2;
+        }
+
+        if (pImage->paBlockMap)
+        {
+            RTMemFree(pImage->paBlockMap);
+            pImage->paBlockMap = NULL;
+        }
+
+        if (pImage->pvBlock)
+        {
+            RTMemFree(pImage->pvBlock);
+            pImage->pvBlock = NULL;
+        }
+
+        if (fDelete && pImage->pszFilename)
+            vdIfIoIntFileDelete(pImage->pIfIo, pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Validates the image header.
+ */
+static bool dedupHeaderIsValid(const DedupHeader *pHdr, uint64_t cbFile)
+{
+    return    pHdr->u32Magic == DEDUP_IMAGE_MAGIC
+           && pHdr->u32Version == DEDUP_VERSION
+           && pHdr->cbHeader >= sizeof(DedupHeader)
+           && pHdr->cbBlock >= 512
+           && RT_IS_POWER_OF_TWO(pHdr->cbBlock)
+           && pHdr->cbDisk
+           && pHdr->cBlocks == (pHdr->cbDisk + pHdr->cbBlock - 1) / pHdr->cbBlock
+           && pHdr->offBlockMap >= pHdr->cbHeader
+           && pHdr->offBlockMap + (uint64_t)pHdr->cBlocks * sizeof(uint32_t) <= cbFile
+           && RTStrNLen(pHdr->szStore, sizeof(pHdr->szStore)) < sizeof(pHdr->szStore);
+}
+
+/**
+ * Internal: Open an image, constructing all necessary data structures.
+ */
+static int dedupOpenImage(PDEDUPIMAGE pImage, unsigned uOpenFlags)
+{
+    int rc;
+    uint64_t cbFile;
+    char *pszStore = NULL;
+
+    pImage->uOpenFlags = uOpenFlags;
+
+    pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+    pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+    AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+    rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
+                           VDOpenFlagsToFileOpenFlags(uOpenFlags, false /* fCreate */),
+                           &pImage->pStorage);
+    if (RT_FAILURE(rc))
+    {
+        /* Do NOT signal an appropriate error here, as the VD layer has the
+         * choice of retrying the open if it failed. */
+        goto out;
+    }
+
+    rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, 0,
+                                   &pImage->Header, sizeof(pImage->Header));
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: error reading the header in '%s'"), pImage->pszFilename);
+        goto out;
+    }
+
+    dedupHeaderConvEndianess(&pImage->Header);
+    if (!dedupHeaderIsValid(&pImage->Header, cbFile))
+    {
+        rc = vdIfError(pImage->pIfError, VERR_VD_DEDUP_INVALID_HEADER, RT_SRC_POS, N_("Dedup: invalid header in '%s'"), pImage->pszFilename);
+        goto out;
+    }
+
+    pImage->PCHSGeometry.cCylinders = pImage->Header.cPCHSCylinders;
+    pImage->PCHSGeometry.cHeads     = pImage->Header.cPCHSHeads;
+    pImage->PCHSGeometry.cSectors   = pImage->Header.cPCHSSectors;
+    pImage->LCHSGeometry.cCylinders = pImage->Header.cLCHSCylinders;
+    pImage->LCHSGeometry.cHeads     = pImage->Header.cLCHSHeads;
+    pImage->LCHSGeometry.cSectors   = pImage->Header.cLCHSSectors;
+
+    pImage->paBlockMap = (uint32_t *)RTMemAlloc(pImage->Header.cBlocks * sizeof(uint32_t));
+    pImage->pvBlock = RTMemAlloc(pImage->Header.cbBlock);
+    if (   !pImage->paBlockMap
+        || !pImage->pvBlock)
+    {
+        rc = VERR_NO_MEMORY;
+        goto out;
+    }
+
+    rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, pImage->Header.offBlockMap,
+                               pImage->paBlockMap, pImage->Header.cBlocks * sizeof(uint32_t));
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: error reading the block map in '%s'"), pImage->pszFilename);
+        goto out;
+    }
+    for (uint32_t i = 0; i < pImage->Header.cBlocks; i++)
+        pImage->paBlockMap[i] = RT_LE2H_U32(pImage->paBlockMap[i]);
+
+    pszStore = dedupStorePathResolve(pImage->pszFilename, pImage->Header.szStore);
+    if (!pszStore)
+    {
+        rc = VERR_NO_MEMORY;
+        goto out;
+    }
+
+    rc = dedupStoreOpen(pImage, pszStore, false /* fCreate */, 0);
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: error opening the block store '%s' of '%s'"),
+                       pszStore, pImage->pszFilename);
+        goto out;
+    }
+
+    if (pImage->pStore->cbBlock != pImage->Header.cbBlock)
+    {
+        rc = vdIfError(pImage->pIfError, VERR_VD_DEDUP_INVALID_HEADER, RT_SRC_POS,
+                       N_("Dedup: block size of the store '%s' doesn't match the image '%s'"),
+                       pszStore, pImage->pszFilename);
+        goto out;
+    }
+
+    /* Catch references beyond the end of the store before they do any harm. */
+    for (uint32_t i = 0; i < pImage->Header.cBlocks; i++)
+    {
+        if (   DEDUP_BLOCK_IS_ALLOCATED(pImage->paBlockMap[i])
+            && pImage->paBlockMap[i] > pImage->pStore->cSlots)
+        {
+            rc = vdIfError(pImage->pIfError, VERR_VD_DEDUP_INVALID_HEADER, RT_SRC_POS,
+                           N_("Dedup: block %u of '%s' references a slot beyond the end of the store"),
+                           i, pImage->pszFilename);
+            goto out;
+        }
+    }
+
+out:
+    if (pszStore)
+        RTStrFree(pszStore);
+    if (RT_FAILURE(rc))
+        dedupFreeImage(pImage, false);
+    return rc;
+}
+
+/**
+ * Internal: Create a dedup image.
+ */
+static int dedupCreateImage(PDEDUPIMAGE pImage, uint64_t cbSize,
+                            unsigned uImageFlags, PCVDGEOMETRY pPCHSGeometry,
+                            PCVDGEOMETRY pLCHSGeometry, PCRTUUID pUuid,
+                            unsigned uOpenFlags, PFNVDPROGRESS pfnProgress,
+                            void *pvUser, unsigned uPercentStart,
+                            unsigned uPercentSpan)
+{
+    int rc;
+    char *pszStoreCfg = NULL;
+    char *pszStore = NULL;
+
+    pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+    pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+    AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+    if (uImageFlags & VD_IMAGE_FLAGS_FIXED)
+    {
+        rc = vdIfError(pImage->pIfError, VERR_VD_INVALID_TYPE, RT_SRC_POS, N_("Dedup: cannot create fixed image '%s'"), pImage->pszFilename);
+        goto out;
+    }
+
+    pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
+    pImage->PCHSGeometry = *pPCHSGeometry;
+    pImage->LCHSGeometry = *pLCHSGeometry;
+
+    /* Figure out the store to use. */
+    PVDINTERFACECONFIG pIfConfig;
+    pIfConfig = VDIfConfigGet(pImage->pVDIfsImage);
+    if (pIfConfig)
+    {
+        rc = VDCFGQueryStringAllocDef(pIfConfig, DEDUP_CFG_STORE, &pszStoreCfg, DEDUP_STORE_NAME_DEFAULT);
+        if (RT_FAILURE(rc))
+        {
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: cannot query the store for '%s'"), pImage->pszFilename);
+            goto out;
+        }
+    }
+    pszStore = dedupStorePathResolve(pImage->pszFilename, pszStoreCfg ? pszStoreCfg : DEDUP_STORE_NAME_DEFAULT);
+    if (!pszStore)
+    {
+        rc = VERR_NO_MEMORY;
+        goto out;
+    }
+
+    RT_ZERO(pImage->Header);
+    pImage->Header.u32Magic         = DEDUP_IMAGE_MAGIC;
+    pImage->Header.u32Version       = DEDUP_VERSION;
+    pImage->Header.cbHeader         = sizeof(DedupHeader);
+    pImage->Header.fFlags           = uImageFlags;
+    pImage->Header.cbDisk           = cbSize;
+    pImage->Header.offBlockMap      = RT_ALIGN_64(sizeof(DedupHeader), 512);
+    pImage->Header.uuidCreate       = *pUuid;
+    RTUuidCreate(&pImage->Header.uuidModify);
+    rc = dedupStorePathSet(pImage, pImage->pszFilename, pszStore);
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: store path '%s' is too long"), pszStore);
+        goto out;
+    }
+
+    /* Create image file. */
+    rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
+                           VDOpenFlagsToFileOpenFlags(pImage->uOpenFlags, true /* fCreate */),
+                           &pImage->pStorage);
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: cannot create image '%s'"), pImage->pszFilename);
+        goto out;
+    }
+
+    rc = dedupStoreOpen(pImage, pszStore, true /* fCreate */, DEDUP_BLOCK_SIZE_DEFAULT);
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: cannot open the block store '%s' for '%s'"),
+                       pszStore, pImage->pszFilename);
+        goto out;
+    }
+
+    /* Existing stores dictate the block size. */
+    pImage->Header.cbBlock = pImage->pStore->cbBlock;
+    pImage->Header.cBlocks = (uint32_t)((cbSize + pImage->Header.cbBlock - 1) / pImage->Header.cbBlock);
+    if ((cbSize + pImage->Header.cbBlock - 1) / pImage->Header.cbBlock >= DEDUP_BLOCK_ZERO)
+    {
+        rc = vdIfError(pImage->pIfError, VERR_VD_INVALID_SIZE, RT_SRC_POS, N_("Dedup: disk too big for '%s'"), pImage->pszFilename);
+        goto out;
+    }
+
+    pImage->paBlockMap = (uint32_t *)RTMemAllocZ(pImage->Header.cBlocks * sizeof(uint32_t));
+    pImage->pvBlock = RTMemAlloc(pImage->Header.cbBlock);
+    if (   !pImage->paBlockMap
+        || !pImage->pvBlock)
+    {
+        rc = VERR_NO_MEMORY;
+        goto out;
+    }
+
+    /* All blocks are free, which is all zeroes on disk. */
+    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage,
+                              pImage->Header.offBlockMap + pImage->Header.cBlocks * sizeof(uint32_t));
+    if (RT_SUCCESS(rc))
+        rc = dedupHeaderWrite(pImage);
+    if (RT_SUCCESS(rc))
+        rc = dedupFlushImage(pImage);
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Dedup: cannot write the header of '%s'"), pImage->pszFilename);
+        goto out;
+    }
+
+out:
+    if (RT_SUCCESS(rc) && pfnProgress)
+        pfnProgress(pvUser, uPercentStart + uPercentSpan);
+
+    if (pszStoreCfg)
+        RTMemFree(pszStoreCfg);
+    if (pszStore)
+        RTStrFree(pszStore);
+    if (RT_FAILURE(rc))
+        dedupFreeImage(pImage, rc != VERR_ALREADY_EXISTS);
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnCheckIfValid */
+static int dedupCheckIfValid(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
+                             PVDINTERFACE pVDIfsImage, VDTYPE *penmType)
+{
+    LogFlowFunc(("pszFilename=\"%s\" pVDIfsDisk=%#p pVDIfsImage=%#p\n", pszFilename, pVDIfsDisk, pVDIfsImage));
+    PVDIOSTORAGE pStorage;
+    DedupHeader Hdr;
+    uint64_t cbFile;
+    int rc;
+
+    PVDINTERFACEIOINT pIfIo = VDIfIoIntGet(pVDIfsImage);
+    AssertPtrReturn(pIfIo, VERR_INVALID_PARAMETER);
+
+    rc = vdIfIoIntFileOpen(pIfIo, pszFilename,
+                           VDOpenFlagsToFileOpenFlags(VD_OPEN_FLAGS_READONLY,
+                                                      false /* fCreate */),
+                           &pStorage);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    rc = vdIfIoIntFileGetSize(pIfIo, pStorage, &cbFile);
+    if (   RT_SUCCESS(rc)
+        && cbFile >= sizeof(Hdr))
+    {
+        rc = vdIfIoIntFileReadSync(pIfIo, pStorage, 0, &Hdr, sizeof(Hdr));
+        if (RT_SUCCESS(rc))
+        {
+            dedupHeaderConvEndianess(&Hdr);
+            if (dedupHeaderIsValid(&Hdr, cbFile))
+                *penmType = VDTYPE_HDD;
+            else
+                rc = VERR_VD_DEDUP_INVALID_HEADER;
+        }
+        else
+            rc = VERR_VD_DEDUP_INVALID_HEADER;
+    }
+    else
+        rc = VERR_VD_DEDUP_INVALID_HEADER;
+
+    vdIfIoIntFileClose(pIfIo, pStorage);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnOpen */
+static int dedupOpen(const char *pszFilename, unsigned uOpenFlags,
+                     PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
+                     VDTYPE enmType, void **ppBackendData)
+{
+    LogFlowFunc(("pszFilename=\"%s\" uOpenFlags=%#x pVDIfsDisk=%#p pVDIfsImage=%#p ppBackendData=%#p\n", pszFilename, uOpenFlags, pVDIfsDisk, pVDIfsImage, ppBackendData));
+    int rc;
+    PDEDUPIMAGE pImage;
+
+    /* Check open flags. All valid flags are supported. */
+    if (uOpenFlags & ~VD_OPEN_FLAGS_MASK)
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    /* Check remaining arguments. */
+    if (   !VALID_PTR(pszFilename)
+        || !*pszFilename)
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    pImage = (PDEDUPIMAGE)RTMemAllocZ(sizeof(DEDUPIMAGE));
+    if (!pImage)
+    {
+        rc = VERR_NO_MEMORY;
+        goto out;
+    }
+
+    pImage->pszFilename = pszFilename;
+    pImage->pStorage = NULL;
+    pImage->pVDIfsDisk = pVDIfsDisk;
+    pImage->pVDIfsImage = pVDIfsImage;
+
+    rc = dedupOpenImage(pImage, uOpenFlags);
+    if (RT_SUCCESS(rc))
+        *ppBackendData = pImage;
+    else
+        RTMemFree(pImage);
+
+out:
+    LogFlowFunc(("returns %Rrc (pBackendData=%#p)\n", rc, *ppBackendData));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnCreate */
+static int dedupCreate(const char *pszFilename, uint64_t cbSize,
+                       unsigned uImageFlags, const char *pszComment,
+                       PCVDGEOMETRY pPCHSGeometry, PCVDGEOMETRY pLCHSGeometry,
+                       PCRTUUID pUuid, unsigned uOpenFlags,
+                       unsigned uPercentStart, unsigned uPercentSpan,
+                       PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
+                       PVDINTERFACE pVDIfsOperation, void **ppBackendData)
+{
+    LogFlowFunc(("pszFilename=\"%s\" cbSize=%llu uImageFlags=%#x pszComment=\"%s\" pPCHSGeometry=%#p pLCHSGeometry=%#p Uuid=%RTuuid uOpenFlags=%#x uPercentStart=%u uPercentSpan=%u pVDIfsDisk=%#p pVDIfsImage=%#p pVDIfsOperation=%#p ppBackendData=%#p",
+                 pszFilename, cbSize, uImageFlags, pszComment, pPCHSGeometry, pLCHSGeometry, pUuid, uOpenFlags, uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation, ppBackendData));
+    int rc = VINF_SUCCESS;
+    PDEDUPIMAGE pImage;
+
+    PFNVDPROGRESS pfnProgress = NULL;
+    void *pvUser = NULL;
+    PVDINTERFACEPROGRESS pIfProgress = VDIfProgressGet(pVDIfsOperation);
+    if (pIfProgress)
+    {
+        pfnProgress = pIfProgress->pfnProgress;
+        pvUser = pIfProgress->Core.pvUser;
+    }
+
+    /* Check open flags. All valid flags are supported. */
+    if (uOpenFlags & ~VD_OPEN_FLAGS_MASK)
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    /* Check remaining arguments. */
+    if (   !VALID_PTR(pszFilename)
+        || !*pszFilename
+        || !cbSize
+        || !VALID_PTR(pPCHSGeometry)
+        || !VALID_PTR(pLCHSGeometry)
+        || !VALID_PTR(pUuid))
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    pImage = (PDEDUPIMAGE)RTMemAllocZ(sizeof(DEDUPIMAGE));
+    if (!pImage)
+    {
+        rc = VERR_NO_MEMORY;
+        goto out;
+    }
+    pImage->pszFilename = pszFilename;
+    pImage->pStorage = NULL;
+    pImage->pVDIfsDisk = pVDIfsDisk;
+    pImage->pVDIfsImage = pVDIfsImage;
+
+    rc = dedupCreateImage(pImage, cbSize, uImageFlags, pPCHSGeometry, pLCHSGeometry,
+                          pUuid, uOpenFlags, pfnProgress, pvUser, uPercentStart,
+                          uPercentSpan);
+    if (RT_SUCCESS(rc))
+    {
+        /* So far the image is opened in read/write mode. Make sure the
+         * image is opened in read-only mode if the caller requested that. */
+        if (uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        {
+            dedupFreeImage(pImage, false);
+            rc = dedupOpenImage(pImage, uOpenFlags);
+            if (RT_FAILURE(rc))
+            {
+                RTMemFree(pImage);
+                goto out;
+            }
+        }
+        *ppBackendData = pImage;
+    }
+    else
+        RTMemFree(pImage);
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnRename */
+static int dedupRename(void *pBackendData, const char *pszFilename)
+{
+    LogFlowFunc(("pBackendData=%#p pszFilename=%#p\n", pBackendData, pszFilename));
+    int rc = VINF_SUCCESS;
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    /* Check arguments. */
+    if (   !pImage
+        || !pszFilename
+        || !*pszFilename)
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    /* Keep the store reference working from the new location. */
+    if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+    {
+        rc = dedupStorePathSet(pImage, pszFilename, pImage->pStore->pszFilename);
+        if (RT_FAILURE(rc))
+            goto out;
+    }
+
+    /* Close the image. */
+    rc = dedupFreeImage(pImage, false);
+    if (RT_FAILURE(rc))
+        goto out;
+
+    /* Rename the file. */
+    rc = vdIfIoIntFileMove(pImage->pIfIo, pImage->pszFilename, pszFilename, 0);
+    if (RT_FAILURE(rc))
+    {
+        /* The move failed, try to reopen the original image. */
+        int rc2 = dedupOpenImage(pImage, pImage->uOpenFlags);
+        if (RT_FAILURE(rc2))
+            rc = rc2;
+
+        goto out;
+    }
+
+    /* Update pImage with the new information. */
+    pImage->pszFilename = pszFilename;
+
+    /* Open the old image with new name. */
+    rc = dedupOpenImage(pImage, pImage->uOpenFlags);
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnClose */
+static int dedupClose(void *pBackendData, bool fDelete)
+{
+    LogFlowFunc(("pBackendData=%#p fDelete=%d\n", pBackendData, fDelete));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc;
+
+    rc = dedupFreeImage(pImage, fDelete);
+    RTMemFree(pImage);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnRead */
+static int dedupRead(void *pBackendData, uint64_t uOffset, size_t cbToRead,
+                     PVDIOCTX pIoCtx, size_t *pcbActuallyRead)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToRead=%zu pcbActuallyRead=%#p\n",
+                 pBackendData, uOffset, pIoCtx, cbToRead, pcbActuallyRead));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    Assert(!(uOffset % 512));
+    Assert(!(cbToRead % 512));
+
+    if (   uOffset + cbToRead > pImage->Header.cbDisk
+        || !VALID_PTR(pIoCtx)
+        || !cbToRead)
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    uint32_t uBlock;
+    uint32_t offRead;
+    uBlock  = (uint32_t)(uOffset / pImage->Header.cbBlock);
+    offRead = (uint32_t)(uOffset % pImage->Header.cbBlock);
+
+    /* Clip read range to at most the rest of the block. */
+    cbToRead = RT_MIN(cbToRead, pImage->Header.cbBlock - offRead);
+
+    if (pImage->paBlockMap[uBlock] == DEDUP_BLOCK_FREE)
+        rc = VERR_VD_BLOCK_FREE;
+    else if (pImage->paBlockMap[uBlock] == DEDUP_BLOCK_ZERO)
+        vdIfIoIntIoCtxSet(pImage->pIfIo, pIoCtx, 0, cbToRead);
+    else
+        rc = dedupStoreRead(pImage, pImage->paBlockMap[uBlock], offRead, pIoCtx, cbToRead);
+
+    if (pcbActuallyRead)
+        *pcbActuallyRead = cbToRead;
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnWrite */
+static int dedupWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
+                      PVDIOCTX pIoCtx, size_t *pcbWriteProcess, size_t *pcbPreRead,
+                      size_t *pcbPostRead, unsigned fWrite)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToWrite=%zu pcbWriteProcess=%#p pcbPreRead=%#p pcbPostRead=%#p\n",
+                 pBackendData, uOffset, pIoCtx, cbToWrite, pcbWriteProcess, pcbPreRead, pcbPostRead));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    Assert(!(uOffset % 512));
+    Assert(!(cbToWrite % 512));
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+    {
+        rc = VERR_VD_IMAGE_READ_ONLY;
+        goto out;
+    }
+
+    if (   uOffset + cbToWrite > pImage->Header.cbDisk
+        || !VALID_PTR(pIoCtx)
+        || !cbToWrite)
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    uint32_t uBlock;
+    uint32_t offWrite;
+    uint32_t idSlot;
+    uBlock   = (uint32_t)(uOffset / pImage->Header.cbBlock);
+    offWrite = (uint32_t)(uOffset % pImage->Header.cbBlock);
+    idSlot   = pImage->paBlockMap[uBlock];
+
+    /* Clip write range to at most the rest of the block. */
+    cbToWrite = RT_MIN(cbToWrite, pImage->Header.cbBlock - offWrite);
+    *pcbPreRead  = 0;
+    *pcbPostRead = 0;
+
+    if (   idSlot == DEDUP_BLOCK_FREE
+        && (   cbToWrite != pImage->Header.cbBlock
+            || (fWrite & VD_WRITE_NO_ALLOC)))
+    {
+        /* Let the upper layer assemble the whole block, it might come from a parent. */
+        *pcbPreRead  = offWrite;
+        *pcbPostRead = pImage->Header.cbBlock - cbToWrite - offWrite;
+        rc = VERR_VD_BLOCK_FREE;
+    }
+    else
+    {
+        /*
+         * Blocks are never changed in place because they might be shared.
+         * Assemble the new content of the whole block and store it.
+         */
+        if (idSlot == DEDUP_BLOCK_ZERO)
+            memset(pImage->pvBlock, 0, pImage->Header.cbBlock);
+        else if (idSlot != DEDUP_BLOCK_FREE && cbToWrite != pImage->Header.cbBlock)
+            rc = dedupStoreReadBlock(pImage, idSlot, pImage->pvBlock);
+
+        if (RT_SUCCESS(rc))
+        {
+            uint32_t idSlotNew;
+
+            vdIfIoIntIoCtxCopyFrom(pImage->pIfIo, pIoCtx, (uint8_t *)pImage->pvBlock + offWrite, cbToWrite);
+            if (ASMBitFirstSet(pImage->pvBlock, pImage->Header.cbBlock * 8) == -1)
+                idSlotNew = DEDUP_BLOCK_ZERO;
+            else
+                rc = dedupStoreBlock(pImage, pImage->pvBlock, &idSlotNew);
+
+            if (RT_SUCCESS(rc))
+                rc = dedupBlockMapSet(pImage, uBlock, idSlotNew);
+        }
+    }
+
+    if (pcbWriteProcess)
+        *pcbWriteProcess = cbToWrite;
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnFlush */
+static int dedupFlush(void *pBackendData, PVDIOCTX pIoCtx)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    NOREF(pIoCtx);
+
+    /* All metadata updates are written straight away, only the header may be pending. */
+    rc = dedupFlushImage(pImage);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetVersion */
+static unsigned dedupGetVersion(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+        return pImage->Header.u32Version;
+    else
+        return 0;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetSectorSize */
+static uint32_t dedupGetSectorSize(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    uint32_t cb = 0;
+
+    AssertPtr(pImage);
+
+    if (pImage && pImage->pStorage)
+        cb = 512;
+
+    LogFlowFunc(("returns %u\n", cb));
+    return cb;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetSize */
+static uint64_t dedupGetSize(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    uint64_t cb = 0;
+
+    AssertPtr(pImage);
+
+    if (pImage && pImage->pStorage)
+        cb = pImage->Header.cbDisk;
+
+    LogFlowFunc(("returns %llu\n", cb));
+    return cb;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetFileSize */
+static uint64_t dedupGetFileSize(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    uint64_t cb = 0;
+
+    AssertPtr(pImage);
+
+    if (pImage && pImage->pStorage)
+    {
+        /* Only the image file, the store is shared with other images. */
+        uint64_t cbFile;
+        int rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+        if (RT_SUCCESS(rc))
+            cb = cbFile;
+    }
+
+    LogFlowFunc(("returns %lld\n", cb));
+    return cb;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetPCHSGeometry */
+static int dedupGetPCHSGeometry(void *pBackendData, PVDGEOMETRY pPCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pPCHSGeometry=%#p\n", pBackendData, pPCHSGeometry));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+    {
+        if (pImage->PCHSGeometry.cCylinders)
+        {
+            *pPCHSGeometry = pImage->PCHSGeometry;
+            rc = VINF_SUCCESS;
+        }
+        else
+            rc = VERR_VD_GEOMETRY_NOT_SET;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc (PCHS=%u/%u/%u)\n", rc, pPCHSGeometry->cCylinders, pPCHSGeometry->cHeads, pPCHSGeometry->cSectors));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetPCHSGeometry */
+static int dedupSetPCHSGeometry(void *pBackendData, PCVDGEOMETRY pPCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pPCHSGeometry=%#p PCHS=%u/%u/%u\n", pBackendData, pPCHSGeometry, pPCHSGeometry->cCylinders, pPCHSGeometry->cHeads, pPCHSGeometry->cSectors));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+    {
+        if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        {
+            pImage->PCHSGeometry = *pPCHSGeometry;
+            pImage->fHeaderDirty = true;
+        }
+        else
+            rc = VERR_VD_IMAGE_READ_ONLY;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetLCHSGeometry */
+static int dedupGetLCHSGeometry(void *pBackendData, PVDGEOMETRY pLCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pLCHSGeometry=%#p\n", pBackendData, pLCHSGeometry));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+    {
+        if (pImage->LCHSGeometry.cCylinders)
+        {
+            *pLCHSGeometry = pImage->LCHSGeometry;
+            rc = VINF_SUCCESS;
+        }
+        else
+            rc = VERR_VD_GEOMETRY_NOT_SET;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc (LCHS=%u/%u/%u)\n", rc, pLCHSGeometry->cCylinders, pLCHSGeometry->cHeads, pLCHSGeometry->cSectors));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetLCHSGeometry */
+static int dedupSetLCHSGeometry(void *pBackendData, PCVDGEOMETRY pLCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pLCHSGeometry=%#p LCHS=%u/%u/%u\n", pBackendData, pLCHSGeometry, pLCHSGeometry->cCylinders, pLCHSGeometry->cHeads, pLCHSGeometry->cSectors));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+    {
+        if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        {
+            pImage->LCHSGeometry = *pLCHSGeometry;
+            pImage->fHeaderDirty = true;
+        }
+        else
+            rc = VERR_VD_IMAGE_READ_ONLY;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetImageFlags */
+static unsigned dedupGetImageFlags(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    unsigned uImageFlags;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+        uImageFlags = pImage->Header.fFlags;
+    else
+        uImageFlags = 0;
+
+    LogFlowFunc(("returns %#x\n", uImageFlags));
+    return uImageFlags;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetOpenFlags */
+static unsigned dedupGetOpenFlags(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    unsigned uOpenFlags;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+        uOpenFlags = pImage->uOpenFlags;
+    else
+        uOpenFlags = 0;
+
+    LogFlowFunc(("returns %#x\n", uOpenFlags));
+    return uOpenFlags;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetOpenFlags */
+static int dedupSetOpenFlags(void *pBackendData, unsigned uOpenFlags)
+{
+    LogFlowFunc(("pBackendData=%#p\n uOpenFlags=%#x", pBackendData, uOpenFlags));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc;
+
+    /* Image must be opened and the new flags must be valid. */
+    if (!pImage || (uOpenFlags & ~(  VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO
+                                   | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL
+                                   | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)))
+    {
+        rc = VERR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    /* Implement this operation via reopening the image. */
+    dedupFreeImage(pImage, false);
+    rc = dedupOpenImage(pImage, uOpenFlags);
+
+out:
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetComment */
+static int dedupGetComment(void *pBackendData, char *pszComment, size_t cbComment)
+{
+    LogFlowFunc(("pBackendData=%#p pszComment=%#p cbComment=%zu\n", pBackendData, pszComment, cbComment));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+        rc = VERR_NOT_SUPPORTED;
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc comment='%s'\n", rc, pszComment));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetComment */
+static int dedupSetComment(void *pBackendData, const char *pszComment)
+{
+    LogFlowFunc(("pBackendData=%#p pszComment=\"%s\"\n", pBackendData, pszComment));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+    int rc;
+
+    AssertPtr(pImage);
+
+    if (pImage)
+    {
+        if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+            rc = VERR_VD_IMAGE_READ_ONLY;
+        else
+            rc = VERR_NOT_SUPPORTED;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Returns one of the UUIDs from the header.
+ */
+static int dedupUuidGet(PDEDUPIMAGE pImage, PCRTUUID pUuidHdr, PRTUUID pUuid)
+{
+    if (!pImage)
+        return VERR_VD_NOT_OPENED;
+
+    *pUuid = *pUuidHdr;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Changes one of the UUIDs in the header, it is written on the next flush.
+ */
+static int dedupUuidSet(PDEDUPIMAGE pImage, PRTUUID pUuidHdr, PCRTUUID pUuid)
+{
+    if (!pImage)
+        return VERR_VD_NOT_OPENED;
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VERR_VD_IMAGE_READ_ONLY;
+
+    *pUuidHdr = *pUuid;
+    pImage->fHeaderDirty = true;
+    return VINF_SUCCESS;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetUuid */
+static int dedupGetUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidGet(pImage, pImage ? &pImage->Header.uuidCreate : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc (%RTuuid)\n", rc, pUuid));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetUuid */
+static int dedupSetUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidSet(pImage, pImage ? &pImage->Header.uuidCreate : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetModificationUuid */
+static int dedupGetModificationUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidGet(pImage, pImage ? &pImage->Header.uuidModify : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc (%RTuuid)\n", rc, pUuid));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetModificationUuid */
+static int dedupSetModificationUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidSet(pImage, pImage ? &pImage->Header.uuidModify : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetParentUuid */
+static int dedupGetParentUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidGet(pImage, pImage ? &pImage->Header.uuidParent : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc (%RTuuid)\n", rc, pUuid));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetParentUuid */
+static int dedupSetParentUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidSet(pImage, pImage ? &pImage->Header.uuidParent : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnGetParentModificationUuid */
+static int dedupGetParentModificationUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidGet(pImage, pImage ? &pImage->Header.uuidParentModify : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc (%RTuuid)\n", rc, pUuid));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnSetParentModificationUuid */
+static int dedupSetParentModificationUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+
+    int rc = dedupUuidSet(pImage, pImage ? &pImage->Header.uuidParentModify : NULL, pUuid);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnDump */
+static void dedupDump(void *pBackendData)
+{
+    PDEDUPIMAGE pImage = (PDEDUPIMAGE)pBackendData;
+
+    AssertPtr(pImage);
+    if (pImage)
+    {
+        uint32_t cBlocksAllocated = 0;
+        for (uint32_t i = 0; i < pImage->Header.cBlocks; i++)
+            if (DEDUP_BLOCK_IS_ALLOCATED(pImage->paBlockMap[i]))
+                cBlocksAllocated++;
+
+        vdIfErrorMessage(pImage->pIfError, "Header: Version=%u cbDisk=%llu cbBlock=%u cBlocks=%u cBlocksAllocated=%u\n",
+                         pImage->Header.u32Version, pImage->Header.cbDisk, pImage->Header.cbBlock,
+                         pImage->Header.cBlocks, cBlocksAllocated);
+        vdIfErrorMessage(pImage->pIfError, "Header: Geometry PCHS=%u/%u/%u LCHS=%u/%u/%u\n",
+                         pImage->PCHSGeometry.cCylinders, pImage->PCHSGeometry.cHeads, pImage->PCHSGeometry.cSectors,
+                         pImage->LCHSGeometry.cCylinders, pImage->LCHSGeometry.cHeads, pImage->LCHSGeometry.cSectors);
+        vdIfErrorMessage(pImage->pIfError, "Header: uuidCreation={%RTuuid} uuidModification={%RTuuid}\n",
+                         &pImage->Header.uuidCreate, &pImage->Header.uuidModify);
+        vdIfErrorMessage(pImage->pIfError, "Header: uuidParent={%RTuuid} uuidParentModification={%RTuuid}\n",
+                         &pImage->Header.uuidParent, &pImage->Header.uuidParentModify);
+        if (pImage->pStore)
+        {
+            PDEDUPSTORE pStore = pImage->pStore;
+            RTCritSectEnter(&pStore->CritSect);
+            vdIfErrorMessage(pImage->pIfError, "Store: \"%s\" cSlots=%u cSlotsUsed=%u cSlotsFree=%u cDedupHits=%llu\n",
+                             pStore->pszFilename, pStore->cSlots, pStore->cSlotsUsed, pStore->cFree, pStore->cDedupHits);
+            RTCritSectLeave(&pStore->CritSect);
+        }
+    }
+}
+
+
+
+const VBOXHDDBACKEND g_DedupBackend =
+{
+    /* pszBackendName */
+    "Dedup",
+    /* cbSize */
+    sizeof(VBOXHDDBACKEND),
+    /* uBackendCaps */
+    VD_CAP_UUID | VD_CAP_CREATE_DYNAMIC | VD_CAP_DIFF | VD_CAP_FILE,
+    /* paFileExtensions */
+    s_aDedupFileExtensions,
+    /* paConfigInfo */
+    s_aDedupConfigInfo,
+    /* pfnCheckIfValid */
+    dedupCheckIfValid,
+    /* pfnOpen */
+    dedupOpen,
+    /* pfnCreate */
+    dedupCreate,
+    /* pfnRename */
+    dedupRename,
+    /* pfnClose */
+    dedupClose,
+    /* pfnRead */
+    dedupRead,
+    /* pfnWrite */
+    dedupWrite,
+    /* pfnFlush */
+    dedupFlush,
+    /* pfnDiscard */
+    NULL,
+    /* pfnGetVersion */
+    dedupGetVersion,
+    /* pfnGetSectorSize */
+    dedupGetSectorSize,
+    /* pfnGetSize */
+    dedupGetSize,
+    /* pfnGetFileSize */
+    dedupGetFileSize,
+    /* pfnGetPCHSGeometry */
+    dedupGetPCHSGeometry,
+    /* pfnSetPCHSGeometry */
+    dedupSetPCHSGeometry,
+    /* pfnGetLCHSGeometry */
+    dedupGetLCHSGeometry,
+    /* pfnSetLCHSGeometry */
+    dedupSetLCHSGeometry,
+    /* pfnGetImageFlags */
+    dedupGetImageFlags,
+    /* pfnGetOpenFlags */
+    dedupGetOpenFlags,
+    /* pfnSetOpenFlags */
+    dedupSetOpenFlags,
+    /* pfnGetComment */
+    dedupGetComment,
+    /* pfnSetComment */
+    dedupSetComment,
+    /* pfnGetUuid */
+    dedupGetUuid,
+    /* pfnSetUuid */
+    dedupSetUuid,
+    /* pfnGetModificationUuid */
+    dedupGetModificationUuid,
+    /* pfnSetModificationUuid */
+    dedupSetModificationUuid,
+    /* pfnGetParentUuid */
+    dedupGetParentUuid,
+    /* pfnSetParentUuid */
+    dedupSetParentUuid,
+    /* pfnGetParentModificationUuid */
+    dedupGetParentModificationUuid,
+    /* pfnSetParentModificationUuid */
+    dedupSetParentModificationUuid,
+    /* pfnDump */
+    dedupDump,
+    /* pfnGetTimeStamp */
+    NULL,
+    /* pfnGetParentTimeStamp */
+    NULL,
+    /* pfnSetParentTimeStamp */
+    NULL,
+    /* pfnGetParentFilename */
+    NULL,
+    /* pfnSetParentFilename */
+    NULL,
+    /* pfnComposeLocation */
+    genericFileComposeLocation,
+    /* pfnComposeName */
+    genericFileComposeName,
+    /* pfnCompact */
+    NULL,
+    /* pfnResize */
+    NULL,
+    /* pfnRepair */
+    NULL,
+    /* pfnTraverseMetadata */
+    NULL
+};
@@ -31,6 +31,7 @@
 #include <iprt/list.h>
 
 #include "VDBackends.h"
+#include "VDMetaCache.h"
 
 /**
  * The QCOW backend implements support for the qemu copy on write format (short QCOW)
@@ -134,24 +135,14 @@ typedef QCowHeader *PQCowHeader;
 *   Constants And Macros, Structures and Typedefs                              *
 *******************************************************************************/
 
-/**
- * QCOW L2 cache entry.
- */
-typedef struct QCOWL2CACHEENTRY
-{
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
-    /** List node for the LRU list. */
-    RTLISTNODE              NodeLru;
-    /** Reference counter. */
-    uint32_t                cRefs;
-    /** The offset of the L2 table, used as search key. */
-    uint64_t                offL2Tbl;
-    /** Pointer to the cached L2 table. */
-    uint64_t               *paL2Tbl;
-} QCOWL2CACHEENTRY, *PQCOWL2CACHEENTRY;
-
-/** Maximum amount of memory the cache is allowed to use. */
+/** QCOW L2 cache entry, the key is the offset of the L2 table in the image. */
+typedef VDMETACACHEENTRY QCOWL2CACHEENTRY, *PQCOWL2CACHEENTRY;
+/** Accessor for the offset of the L2 table in a cache entry. */
+#define QCOW_L2_ENTRY_OFFSET(a_pL2Entry) ((a_pL2Entry)->Core.Key)
+/** Accessor for the L2 table data in a cache entry. */
+#define QCOW_L2_ENTRY_TBL(a_pL2Entry)    ((uint64_t *)(a_pL2Entry)->pvData)
+
+/** Default amount of memory the cache is allowed to use. */
 #define QCOW_L2_CACHE_MEMORY_MAX (2*_1M)
 
 /** QCOW default cluster size for image version 2. */
@@ -220,12 +211,8 @@ typedef struct QCOWIMAGE
     uint32_t            cbL2Table;
     /** Number of entries in the L2 table. */
     uint32_t            cL2TableEntries;
-    /** Memory occupied by the L2 table cache. */
-    size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
-    /** The LRU L2 entry list used for eviction. */
-    RTLISTNODE          ListLru;
+    /** The L2 table cache. */
+    PVDMETACACHE        pL2Cache;
 
     /** Offset of the refcount table. */
     uint64_t            offRefcountTable;
@@ -299,6 +286,12 @@ static const VDFILEEXTENSION s_aQCowFileExtensions[] =
     {NULL,  VDTYPE_INVALID}
 };
 
+static const VDCONFIGINFO s_aQCowConfigInfo[] =
+{
+    { VD_METACACHE_CFG_SIZE,    "2097152",    VDCFGVALUETYPE_INTEGER,    VD_CFGKEY_EXPERT },
+    { NULL,                     NULL,         VDCFGVALUETYPE_INTEGER,    0 }
+};
+
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
@@ -490,11 +483,9 @@ static void qcowRefcountTableConvertFromHostEndianess(uint16_t *paTblImg, uint16
  */
 static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    size_t cbCache = vdMetaCacheQuerySize(pImage->pVDIfsImage, QCOW_L2_CACHE_MEMORY_MAX);
 
-    return VINF_SUCCESS;
+    return vdMetaCacheCreate(&pImage->pL2Cache, pImage->cbL2Table, cbCache);
 }
 
 /**
@@ -505,21 +496,9 @@ static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
  */
 static void qcowL2TblCacheDestroy(PQCOWIMAGE pImage)
 {
-    PQCOWL2CACHEENTRY pL2Entry = NULL;
-    PQCOWL2CACHEENTRY pL2Next  = NULL;
-
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QCOWL2CACHEENTRY, NodeSearch)
-    {
-        Assert(!pL2Entry->cRefs);
-
-        RTListNodeRemove(&pL2Entry->NodeSearch);
-        RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
-        RTMemFree(pL2Entry);
-    }
-
-    pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    vdMetaCacheLogStats(pImage->pL2Cache, "QCow", pImage->pszFilename);
+    vdMetaCacheDestroy(pImage->pL2Cache);
+    pImage->pL2Cache = NULL;
 }
 
 /**
@@ -529,38 +508,20 @@ static void qcowL2TblCacheDestroy(PQCOWIMAGE pImage)
  * @param   pImage    The image instance data.
  * @param   offL2Tbl  Offset of the L2 table to search for.
  */
-static PQCOWL2CACHEENTRY qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2Tbl)
+DECLINLINE(PQCOWL2CACHEENTRY) qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2Tbl)
 {
-    PQCOWL2CACHEENTRY pL2Entry = NULL;
-
-    RTListForEach(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
-    {
-        /* Update LRU list. */
-        RTListNodeRemove(&pL2Entry->NodeLru);
-        RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-        pL2Entry->cRefs++;
-        return pL2Entry;
-    }
-    else
-        return NULL;
+    return vdMetaCacheRetain(pImage->pL2Cache, offL2Tbl);
 }
 
 /**
  * Releases a L2 table cache entry.
  *
  * @returns nothing.
- * @param   pL2Entry    The L2 cache entry.
+ * @param   pL2Entry  The L2 cache entry.
  */
-static void qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
+DECLINLINE(void) qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
 {
-    Assert(pL2Entry->cRefs > 0);
-    pL2Entry->cRefs--;
+    vdMetaCacheEntryRelease(pL2Entry);
 }
 
 /**
@@ -569,53 +530,9 @@ static void qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
  * @returns Pointer to the L2 cache entry or NULL.
  * @param   pImage    The image instance data.
  */
-static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
+DECLINLINE(PQCOWL2CACHEENTRY) qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
 {
-    PQCOWL2CACHEENTRY pL2Entry = NULL;
-    int rc = VINF_SUCCESS;
-
-    if (pImage->cbL2Cache + pImage->cbL2Table <= QCOW_L2_CACHE_MEMORY_MAX)
-    {
-        /* Add a new entry. */
-        pL2Entry = (PQCOWL2CACHEENTRY)RTMemAllocZ(sizeof(QCOWL2CACHEENTRY));
-        if (pL2Entry)
-        {
-            pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbL2Table);
-            if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
-            {
-                RTMemFree(pL2Entry);
-                pL2Entry = NULL;
-            }
-            else
-            {
-                pL2Entry->cRefs    = 1;
-                pImage->cbL2Cache += pImage->cbL2Table;
-            }
-        }
-    }
-    else
-    {
-        /* Evict the last not in use entry and use it */
-        Assert(!RTListIsEmpty(&pImage->ListLru));
-
-        RTListForEachReverse(&pImage->ListLru, pL2Entry, QCOWL2CACHEENTRY, NodeLru)
-        {
-            if (!pL2Entry->cRefs)
-                break;
-        }
-
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
-        {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
-            RTListNodeRemove(&pL2Entry->NodeLru);
-            pL2Entry->offL2Tbl = 0;
-            pL2Entry->cRefs    = 1;
-        }
-        else
-            pL2Entry = NULL;
-    }
-
-    return pL2Entry;
+    return vdMetaCacheEntryAlloc(pImage->pL2Cache, false /* fPrefetch */);
 }
 
 /**
@@ -625,62 +542,63 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
  * @param   pImage    The image instance data.
  * @param   pL2Entry  The L2 cache entry to free.
  */
-static void qcowL2TblCacheEntryFree(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
+DECLINLINE(void) qcowL2TblCacheEntryFree(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
 {
-    Assert(!pL2Entry->cRefs);
-    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
-    RTMemFree(pL2Entry);
-
-    pImage->cbL2Cache -= pImage->cbL2Table;
+    vdMetaCacheEntryFree(pImage->pL2Cache, pL2Entry);
 }
 
 /**
- * Inserts an entry in the L2 table cache.
+ * Inserts an entry in the L2 table cache, the key is taken from the
+ * table offset stored in the entry.
  *
  * @returns nothing.
  * @param   pImage    The image instance data.
  * @param   pL2Entry  The L2 cache entry to insert.
  */
-static void qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
+DECLINLINE(void) qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
 {
-    PQCOWL2CACHEENTRY pIt = NULL;
-
-    Assert(pL2Entry->offL2Tbl > 0);
+    Assert(QCOW_L2_ENTRY_OFFSET(pL2Entry) > 0);
+    vdMetaCacheEntryInsert(pImage->pL2Cache, pL2Entry, QCOW_L2_ENTRY_OFFSET(pL2Entry));
+}
 
-    /* Insert at the top of the LRU list. */
-    RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
+/**
+ * Reads a L2 table into the given cache entry.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   pIoCtx    The I/O context.
+ * @param   pL2Entry  The L2 cache entry to read into.
+ * @param   offL2Tbl  The offset of the L2 table in the image.
+ */
+static int qcowL2TblCacheEntryRead(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
+                                   PQCOWL2CACHEENTRY pL2Entry, uint64_t offL2Tbl)
+{
+    PVDMETAXFER pMetaXfer;
 
-    if (RTListIsEmpty(&pImage->ListSearch))
+    QCOW_L2_ENTRY_OFFSET(pL2Entry) = offL2Tbl;
+    int rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
+                                   offL2Tbl, QCOW_L2_ENTRY_TBL(pL2Entry),
+                                   pImage->cbL2Table, pIoCtx,
+                                   &pMetaXfer, NULL, NULL);
+    if (RT_SUCCESS(rc))
     {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
+        vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+#if defined(RT_LITTLE_ENDIAN)
+        qcowTableConvertToHostEndianess(QCOW_L2_ENTRY_TBL(pL2Entry), pImage->cL2TableEntries);
+#endif
+        qcowL2TblCacheEntryInsert(pImage, pL2Entry);
     }
     else
     {
-        /* Insert into search list. */
-        pIt = RTListGetFirst(&pImage->ListSearch, QCOWL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
-
-            RTListForEach(&pImage->ListSearch, pIt, QCOWL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-             Assert(fInserted);
-        }
+        qcowL2TblCacheEntryRelease(pL2Entry);
+        qcowL2TblCacheEntryFree(pImage, pL2Entry);
     }
+
+    return rc;
 }
 
 /**
- * Fetches the L2 from the given offset trying the LRU cache first and
+ * Fetches the L2 from the given offset trying the cache first and
  * reading it from the image after a cache miss.
  *
  * @returns VBox status code.
@@ -699,31 +617,8 @@ static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offL
     if (!pL2Entry)
     {
         pL2Entry = qcowL2TblCacheEntryAlloc(pImage);
-
         if (pL2Entry)
-        {
-            /* Read from the image. */
-            PVDMETAXFER pMetaXfer;
-
-            pL2Entry->offL2Tbl = offL2Tbl;
-            rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
-                                       offL2Tbl, pL2Entry->paL2Tbl,
-                                       pImage->cbL2Table, pIoCtx,
-                                       &pMetaXfer, NULL, NULL);
-            if (RT_SUCCESS(rc))
-            {
-                vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
-#if defined(RT_LITTLE_ENDIAN)
-                qcowTableConvertToHostEndianess(pL2Entry->paL2Tbl, pImage->cL2TableEntries);
-#endif
-                qcowL2TblCacheEntryInsert(pImage, pL2Entry);
-            }
-            else
-            {
-                qcowL2TblCacheEntryRelease(pL2Entry);
-                qcowL2TblCacheEntryFree(pImage, pL2Entry);
-            }
-        }
+            rc = qcowL2TblCacheEntryRead(pImage, pIoCtx, pL2Entry, offL2Tbl);
         else
             rc = VERR_NO_MEMORY;
     }
@@ -734,6 +629,35 @@ static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offL
     return rc;
 }
 
+/**
+ * Reads the L2 table following the given L1 index ahead of time if there
+ * is room left in the cache.
+ *
+ * Only done for synchronous requests because an asynchronous read would stall
+ * the request until the metadata transfer completed.
+ *
+ * @returns nothing.
+ * @param   pImage    Image instance data.
+ * @param   pIoCtx    The I/O context.
+ * @param   idxL1     The L1 index of the table just used.
+ */
+static void qcowL2TblCachePrefetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxL1)
+{
+    if (   idxL1 + 1 >= pImage->cL1TableEntries
+        || !pImage->paL1Table[idxL1 + 1]
+        || !vdIfIoIntIoCtxIsSynchronous(pImage->pIfIo, pIoCtx)
+        || vdMetaCacheIsCached(pImage->pL2Cache, pImage->paL1Table[idxL1 + 1]))
+        return;
+
+    PQCOWL2CACHEENTRY pL2Entry = vdMetaCacheEntryAlloc(pImage->pL2Cache, true /* fPrefetch */);
+    if (pL2Entry)
+    {
+        int rc = qcowL2TblCacheEntryRead(pImage, pIoCtx, pL2Entry, pImage->paL1Table[idxL1 + 1]);
+        if (RT_SUCCESS(rc))
+            qcowL2TblCacheEntryRelease(pL2Entry);
+    }
+}
+
 /**
  * Sets the L1, L2 and offset bitmasks and L1 and L2 bit shift members.
  *
@@ -848,9 +772,9 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
         if (RT_SUCCESS(rc))
         {
             /* Get real file offset. */
-            if (pL2Entry->paL2Tbl[idxL2])
+            if (QCOW_L2_ENTRY_TBL(pL2Entry)[idxL2])
             {
-                uint64_t off = pL2Entry->paL2Tbl[idxL2];
+                uint64_t off = QCOW_L2_ENTRY_TBL(pL2Entry)[idxL2];
 
                 /* Strip flags */
                 if (pImage->uVersion == 2)
@@ -874,6 +798,10 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
                 rc = VERR_VD_BLOCK_FREE;
 
             qcowL2TblCacheEntryRelease(pL2Entry);
+
+            /* Sequential access will most likely need the next L2 table soon. */
+            if (idxL2 == pImage->cL2TableEntries - 1)
+                qcowL2TblCachePrefetch(pImage, pIoCtx, idxL1);
         }
     }
 
@@ -1033,9 +961,6 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    rc = qcowL2TblCacheCreate(pImage);
-    AssertRC(rc);
-
     /*
      * Open the image.
      */
@@ -1166,6 +1091,15 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
                                    pImage->pszFilename);
             }
 
+            if (RT_SUCCESS(rc))
+            {
+                rc = qcowL2TblCacheCreate(pImage);
+                if (RT_FAILURE(rc))
+                    rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                   N_("QCow: Failed to create L2 cache for image '%s'"),
+                                   pImage->pszFilename);
+            }
+
             if (RT_SUCCESS(rc))
             {
                 qcowTableMasksInit(pImage);
@@ -1352,7 +1286,7 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
     {
         case QCOWCLUSTERASYNCALLOCSTATE_L2_ALLOC:
         {
-            uint64_t offUpdateLe = RT_H2BE_U64(pClusterAlloc->pL2Entry->offL2Tbl);
+            uint64_t offUpdateLe = RT_H2BE_U64(QCOW_L2_ENTRY_OFFSET(pClusterAlloc->pL2Entry));
 
             /* Update the link in the on disk L1 table now. */
             pClusterAlloc->enmAllocState = QCOWCLUSTERASYNCALLOCSTATE_L2_LINK;
@@ -1376,7 +1310,7 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
             uint64_t offData = qcowClusterAllocate(pImage, 1);
 
             /* Update the link in the in memory L1 table now. */
-            pImage->paL1Table[pClusterAlloc->idxL1] = pClusterAlloc->pL2Entry->offL2Tbl;
+            pImage->paL1Table[pClusterAlloc->idxL1] = QCOW_L2_ENTRY_OFFSET(pClusterAlloc->pL2Entry);
             qcowL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry);
 
             pClusterAlloc->enmAllocState     = QCOWCLUSTERASYNCALLOCSTATE_USER_ALLOC;
@@ -1419,7 +1353,7 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
         case QCOWCLUSTERASYNCALLOCSTATE_USER_LINK:
         {
             /* Everything done without errors, signal completion. */
-            pClusterAlloc->pL2Entry->paL2Tbl[pClusterAlloc->idxL2] = pClusterAlloc->offClusterNew;
+            QCOW_L2_ENTRY_TBL(pClusterAlloc->pL2Entry)[pClusterAlloc->idxL2] = pClusterAlloc->offClusterNew;
             qcowL2TblCacheEntryRelease(pClusterAlloc->pL2Entry);
             RTMemFree(pClusterAlloc);
             rc = VINF_SUCCESS;
@@ -1811,8 +1745,8 @@ static int qcowWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                     }
 
                     offL2Tbl = qcowClusterAllocate(pImage, qcowByte2Cluster(pImage, pImage->cbL2Table));
-                    pL2Entry->offL2Tbl = offL2Tbl;
-                    memset(pL2Entry->paL2Tbl, 0, pImage->cbL2Table);
+                    QCOW_L2_ENTRY_OFFSET(pL2Entry) = offL2Tbl;
+                    memset(QCOW_L2_ENTRY_TBL(pL2Entry), 0, pImage->cbL2Table);
 
                     pL2ClusterAlloc->enmAllocState     = QCOWCLUSTERASYNCALLOCSTATE_L2_ALLOC;
                     pL2ClusterAlloc->offNextClusterOld = offL2Tbl;
@@ -1828,7 +1762,7 @@ static int qcowWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                      * is a leak of some clusters.
                      */
                     rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
-                                                offL2Tbl, pL2Entry->paL2Tbl, pImage->cbL2Table, pIoCtx,
+                                                offL2Tbl, QCOW_L2_ENTRY_TBL(pL2Entry), pImage->cbL2Table, pIoCtx,
                                                 qcowAsyncClusterAllocUpdate, pL2ClusterAlloc);
                     if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
                         break;
@@ -2472,7 +2406,7 @@ const VBOXHDDBACKEND g_QCowBackend =
     /* paFileExtensions */
     s_aQCowFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aQCowConfigInfo,
     /* pfnCheckIfValid */
     qcowCheckIfValid,
     /* pfnOpen */
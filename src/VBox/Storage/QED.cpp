@@ -31,6 +31,7 @@
 #include <iprt/list.h>
 
 #include "VDBackends.h"
+#include "VDMetaCache.h"
 
 /**
  * The QED backend implements support for the qemu enhanced disk format (short QED)
@@ -122,24 +123,14 @@ typedef QedHeader *PQedHeader;
 *   Constants And Macros, Structures and Typedefs                              *
 *******************************************************************************/
 
-/**
- * QED L2 cache entry.
- */
-typedef struct QEDL2CACHEENTRY
-{
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
-    /** List node for the LRU list. */
-    RTLISTNODE              NodeLru;
-    /** Reference counter. */
-    uint32_t                cRefs;
-    /** The offset of the L2 table, used as search key. */
-    uint64_t                offL2Tbl;
-    /** Pointer to the cached L2 table. */
-    uint64_t               *paL2Tbl;
-} QEDL2CACHEENTRY, *PQEDL2CACHEENTRY;
-
-/** Maximum amount of memory the cache is allowed to use. */
+/** QED L2 cache entry, the key is the offset of the L2 table in the image. */
+typedef VDMETACACHEENTRY QEDL2CACHEENTRY, *PQEDL2CACHEENTRY;
+/** Accessor for the offset of the L2 table in a cache entry. */
+#define QED_L2_ENTRY_OFFSET(a_pL2Entry) ((a_pL2Entry)->Core.Key)
+/** Accessor for the L2 table data in a cache entry. */
+#define QED_L2_ENTRY_TBL(a_pL2Entry)    ((uint64_t *)(a_pL2Entry)->pvData)
+
+/** Default amount of memory the cache is allowed to use. */
 #define QED_L2_CACHE_MEMORY_MAX (2*_1M)
 
 /**
@@ -203,12 +194,8 @@ typedef struct QEDIMAGE
     /** Number of bits to shift to get the L2 index. */
     uint32_t            cL2Shift;
 
-    /** Memory occupied by the L2 table cache. */
-    size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
-    /** The LRU L2 entry list used for eviction. */
-    RTLISTNODE          ListLru;
+    /** The L2 table cache. */
+    PVDMETACACHE        pL2Cache;
 
 } QEDIMAGE, *PQEDIMAGE;
 
@@ -263,6 +250,12 @@ static const VDFILEEXTENSION s_aQedFileExtensions[] =
     {NULL,  VDTYPE_INVALID}
 };
 
+static const VDCONFIGINFO s_aQedConfigInfo[] =
+{
+    { VD_METACACHE_CFG_SIZE,    "2097152",    VDCFGVALUETYPE_INTEGER,    VD_CFGKEY_EXPERT },
+    { NULL,                     NULL,         VDCFGVALUETYPE_INTEGER,    0 }
+};
+
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
@@ -366,11 +359,9 @@ static void qedTableConvertFromHostEndianess(uint64_t *paTblImg, uint64_t *paTbl
  */
 static int qedL2TblCacheCreate(PQEDIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    size_t cbCache = vdMetaCacheQuerySize(pImage->pVDIfsImage, QED_L2_CACHE_MEMORY_MAX);
 
-    return VINF_SUCCESS;
+    return vdMetaCacheCreate(&pImage->pL2Cache, pImage->cbTable, cbCache);
 }
 
 /**
@@ -381,21 +372,9 @@ static int qedL2TblCacheCreate(PQEDIMAGE pImage)
  */
 static void qedL2TblCacheDestroy(PQEDIMAGE pImage)
 {
-    PQEDL2CACHEENTRY pL2Entry = NULL;
-    PQEDL2CACHEENTRY pL2Next  = NULL;
-
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QEDL2CACHEENTRY, NodeSearch)
-    {
-        Assert(!pL2Entry->cRefs);
-
-        RTListNodeRemove(&pL2Entry->NodeSearch);
-        RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
-        RTMemFree(pL2Entry);
-    }
-
-    pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    vdMetaCacheLogStats(pImage->pL2Cache, "Qed", pImage->pszFilename);
+    vdMetaCacheDestroy(pImage->pL2Cache);
+    pImage->pL2Cache = NULL;
 }
 
 /**
@@ -405,38 +384,20 @@ static void qedL2TblCacheDestroy(PQEDIMAGE pImage)
  * @param   pImage    The image instance data.
  * @param   offL2Tbl  Offset of the L2 table to search for.
  */
-static PQEDL2CACHEENTRY qedL2TblCacheRetain(PQEDIMAGE pImage, uint64_t offL2Tbl)
+DECLINLINE(PQEDL2CACHEENTRY) qedL2TblCacheRetain(PQEDIMAGE pImage, uint64_t offL2Tbl)
 {
-    PQEDL2CACHEENTRY pL2Entry = NULL;
-
-    RTListForEach(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch))
-    {
-        /* Update LRU list. */
-        RTListNodeRemove(&pL2Entry->NodeLru);
-        RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-        pL2Entry->cRefs++;
-        return pL2Entry;
-    }
-    else
-        return NULL;
+    return vdMetaCacheRetain(pImage->pL2Cache, offL2Tbl);
 }
 
 /**
  * Releases a L2 table cache entry.
  *
  * @returns nothing.
- * @param   pL2Entry    The L2 cache entry.
+ * @param   pL2Entry  The L2 cache entry.
  */
-static void qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
+DECLINLINE(void) qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
 {
-    Assert(pL2Entry->cRefs > 0);
-    pL2Entry->cRefs--;
+    vdMetaCacheEntryRelease(pL2Entry);
 }
 
 /**
@@ -445,53 +406,9 @@ static void qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
  * @returns Pointer to the L2 cache entry or NULL.
  * @param   pImage    The image instance data.
  */
-static PQEDL2CACHEENTRY qedL2TblCacheEntryAlloc(PQEDIMAGE pImage)
+DECLINLINE(PQEDL2CACHEENTRY) qedL2TblCacheEntryAlloc(PQEDIMAGE pImage)
 {
-    PQEDL2CACHEENTRY pL2Entry = NULL;
-    int rc = VINF_SUCCESS;
-
-    if (pImage->cbL2Cache + pImage->cbTable <= QED_L2_CACHE_MEMORY_MAX)
-    {
-        /* Add a new entry. */
-        pL2Entry = (PQEDL2CACHEENTRY)RTMemAllocZ(sizeof(QEDL2CACHEENTRY));
-        if (pL2Entry)
-        {
-            pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbTable);
-            if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
-            {
-                RTMemFree(pL2Entry);
-                pL2Entry = NULL;
-            }
-            else
-            {
-                pL2Entry->cRefs    = 1;
-                pImage->cbL2Cache += pImage->cbTable;
-            }
-        }
-    }
-    else
-    {
-        /* Evict the last not in use entry and use it */
-        Assert(!RTListIsEmpty(&pImage->ListLru));
-
-        RTListForEachReverse(&pImage->ListLru, pL2Entry, QEDL2CACHEENTRY, NodeLru)
-        {
-            if (!pL2Entry->cRefs)
-                break;
-        }
-
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch))
-        {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
-            RTListNodeRemove(&pL2Entry->NodeLru);
-            pL2Entry->offL2Tbl = 0;
-            pL2Entry->cRefs    = 1;
-        }
-        else
-            pL2Entry = NULL;
-    }
-
-    return pL2Entry;
+    return vdMetaCacheEntryAlloc(pImage->pL2Cache, false /* fPrefetch */);
 }
 
 /**
@@ -501,62 +418,63 @@ static PQEDL2CACHEENTRY qedL2TblCacheEntryAlloc(PQEDIMAGE pImage)
  * @param   pImage    The image instance data.
  * @param   pL2Entry  The L2 cache entry to free.
  */
-static void qedL2TblCacheEntryFree(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
+DECLINLINE(void) qedL2TblCacheEntryFree(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
 {
-    Assert(!pL2Entry->cRefs);
-    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
-    RTMemFree(pL2Entry);
-
-    pImage->cbL2Cache -= pImage->cbTable;
+    vdMetaCacheEntryFree(pImage->pL2Cache, pL2Entry);
 }
 
 /**
- * Inserts an entry in the L2 table cache.
+ * Inserts an entry in the L2 table cache, the key is taken from the
+ * table offset stored in the entry.
  *
  * @returns nothing.
  * @param   pImage    The image instance data.
  * @param   pL2Entry  The L2 cache entry to insert.
  */
-static void qedL2TblCacheEntryInsert(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
+DECLINLINE(void) qedL2TblCacheEntryInsert(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
 {
-    PQEDL2CACHEENTRY pIt = NULL;
-
-    Assert(pL2Entry->offL2Tbl > 0);
+    Assert(QED_L2_ENTRY_OFFSET(pL2Entry) > 0);
+    vdMetaCacheEntryInsert(pImage->pL2Cache, pL2Entry, QED_L2_ENTRY_OFFSET(pL2Entry));
+}
 
-    /* Insert at the top of the LRU list. */
-    RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
+/**
+ * Reads a L2 table into the given cache entry.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   pIoCtx    The I/O context.
+ * @param   pL2Entry  The L2 cache entry to read into.
+ * @param   offL2Tbl  The offset of the L2 table in the image.
+ */
+static int qedL2TblCacheEntryRead(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
+                                   PQEDL2CACHEENTRY pL2Entry, uint64_t offL2Tbl)
+{
+    PVDMETAXFER pMetaXfer;
 
-    if (RTListIsEmpty(&pImage->ListSearch))
+    QED_L2_ENTRY_OFFSET(pL2Entry) = offL2Tbl;
+    int rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
+                                   offL2Tbl, QED_L2_ENTRY_TBL(pL2Entry),
+                                   pImage->cbTable, pIoCtx,
+                                   &pMetaXfer, NULL, NULL);
+    if (RT_SUCCESS(rc))
     {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
+        vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+#if defined(RT_BIG_ENDIAN)
+        qedTableConvertToHostEndianess(QED_L2_ENTRY_TBL(pL2Entry), pImage->cTableEntries);
+#endif
+        qedL2TblCacheEntryInsert(pImage, pL2Entry);
     }
     else
     {
-        /* Insert into search list. */
-        pIt = RTListGetFirst(&pImage->ListSearch, QEDL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
-
-            RTListForEach(&pImage->ListSearch, pIt, QEDL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-             Assert(fInserted);
-        }
+        qedL2TblCacheEntryRelease(pL2Entry);
+        qedL2TblCacheEntryFree(pImage, pL2Entry);
     }
+
+    return rc;
 }
 
 /**
- * Fetches the L2 from the given offset trying the LRU cache first and
+ * Fetches the L2 from the given offset trying the cache first and
  * reading it from the image after a cache miss.
  *
  * @returns VBox status code.
@@ -580,13 +498,13 @@ static int qedL2TblCacheFetch(PQEDIMAGE pImage, uint64_t offL2Tbl, PQEDL2CACHEEN
         if (pL2Entry)
         {
             /* Read from the image. */
-            pL2Entry->offL2Tbl = offL2Tbl;
+            QED_L2_ENTRY_OFFSET(pL2Entry) = offL2Tbl;
             rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offL2Tbl,
-                                       pL2Entry->paL2Tbl, pImage->cbTable);
+                                       QED_L2_ENTRY_TBL(pL2Entry), pImage->cbTable);
             if (RT_SUCCESS(rc))
             {
 #if defined(RT_BIG_ENDIAN)
-                qedTableConvertToHostEndianess(pL2Entry->paL2Tbl, pImage->cTableEntries);
+                qedTableConvertToHostEndianess(QED_L2_ENTRY_TBL(pL2Entry), pImage->cTableEntries);
 #endif
                 qedL2TblCacheEntryInsert(pImage, pL2Entry);
             }
@@ -608,7 +526,7 @@ static int qedL2TblCacheFetch(PQEDIMAGE pImage, uint64_t offL2Tbl, PQEDL2CACHEEN
 }
 
 /**
- * Fetches the L2 from the given offset trying the LRU cache first and
+ * Fetches the L2 from the given offset trying the cache first and
  * reading it from the image after a cache miss - version for async I/O.
  *
  * @returns VBox status code.
@@ -627,31 +545,8 @@ static int qedL2TblCacheFetchAsync(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
     if (!pL2Entry)
     {
         pL2Entry = qedL2TblCacheEntryAlloc(pImage);
-
         if (pL2Entry)
-        {
-            /* Read from the image. */
-            PVDMETAXFER pMetaXfer;
-
-            pL2Entry->offL2Tbl = offL2Tbl;
-            rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
-                                       offL2Tbl, pL2Entry->paL2Tbl,
-                                       pImage->cbTable, pIoCtx,
-                                       &pMetaXfer, NULL, NULL);
-            if (RT_SUCCESS(rc))
-            {
-                vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
-#if defined(RT_BIG_ENDIAN)
-                qedTableConvertToHostEndianess(pL2Entry->paL2Tbl, pImage->cTableEntries);
-#endif
-                qedL2TblCacheEntryInsert(pImage, pL2Entry);
-            }
-            else
-            {
-                qedL2TblCacheEntryRelease(pL2Entry);
-                qedL2TblCacheEntryFree(pImage, pL2Entry);
-            }
-        }
+            rc = qedL2TblCacheEntryRead(pImage, pIoCtx, pL2Entry, offL2Tbl);
         else
             rc = VERR_NO_MEMORY;
     }
@@ -662,6 +557,35 @@ static int qedL2TblCacheFetchAsync(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
     return rc;
 }
 
+/**
+ * Reads the L2 table following the given L1 index ahead of time if there
+ * is room left in the cache.
+ *
+ * Only done for synchronous requests because an asynchronous read would stall
+ * the request until the metadata transfer completed.
+ *
+ * @returns nothing.
+ * @param   pImage    Image instance data.
+ * @param   pIoCtx    The I/O context.
+ * @param   idxL1     The L1 index of the table just used.
+ */
+static void qedL2TblCachePrefetch(PQEDIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxL1)
+{
+    if (   idxL1 + 1 >= pImage->cTableEntries
+        || !pImage->paL1Table[idxL1 + 1]
+        || !vdIfIoIntIoCtxIsSynchronous(pImage->pIfIo, pIoCtx)
+        || vdMetaCacheIsCached(pImage->pL2Cache, pImage->paL1Table[idxL1 + 1]))
+        return;
+
+    PQEDL2CACHEENTRY pL2Entry = vdMetaCacheEntryAlloc(pImage->pL2Cache, true /* fPrefetch */);
+    if (pL2Entry)
+    {
+        int rc = qedL2TblCacheEntryRead(pImage, pIoCtx, pL2Entry, pImage->paL1Table[idxL1 + 1]);
+        if (RT_SUCCESS(rc))
+            qedL2TblCacheEntryRelease(pL2Entry);
+    }
+}
+
 /**
  * Return power of 2 or 0 if num error.
  *
@@ -797,12 +721,16 @@ static int qedConvertToImageOffset(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
         if (RT_SUCCESS(rc))
         {
             /* Get real file offset. */
-            if (pL2Entry->paL2Tbl[idxL2])
-                *poffImage = pL2Entry->paL2Tbl[idxL2] + offCluster;
+            if (QED_L2_ENTRY_TBL(pL2Entry)[idxL2])
+                *poffImage = QED_L2_ENTRY_TBL(pL2Entry)[idxL2] + offCluster;
             else
                 rc = VERR_VD_BLOCK_FREE;
 
             qedL2TblCacheEntryRelease(pL2Entry);
+
+            /* Sequential access will most likely need the next L2 table soon. */
+            if (idxL2 == pImage->cTableEntries - 1)
+                qedL2TblCachePrefetch(pImage, pIoCtx, idxL1);
         }
     }
 
@@ -1179,20 +1107,6 @@ static int qedOpenImage(PQEDIMAGE pImage, unsigned uOpenFlags)
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    /*
-     * Create the L2 cache before opening the image so we can call qedFreeImage()
-     * even if opening the image file fails.
-     */
-    rc = qedL2TblCacheCreate(pImage);
-    if (RT_FAILURE(rc))
-    {
-        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                       N_("Qed: Creating the L2 table cache for image '%s' failed"),
-                       pImage->pszFilename);
-
-        goto out;
-    }
-
     /*
      * Open the image.
      */
@@ -1259,6 +1173,15 @@ static int qedOpenImage(PQEDIMAGE pImage, unsigned uOpenFlags)
                     pImage->cbSize        = Header.u64Size;
                     qedTableMasksInit(pImage);
 
+                    rc = qedL2TblCacheCreate(pImage);
+                    if (RT_FAILURE(rc))
+                        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                       N_("Qed: Creating the L2 table cache for image '%s' failed"),
+                                       pImage->pszFilename);
+                }
+
+                if (RT_SUCCESS(rc))
+                {
                     /* Allocate L1 table. */
                     pImage->paL1Table     = (uint64_t *)RTMemAllocZ(pImage->cbTable);
                     if (pImage->paL1Table)
@@ -1446,7 +1369,7 @@ static DECLCALLBACK(int) qedAsyncClusterAllocUpdate(void *pBackendData, PVDIOCTX
     {
         case QEDCLUSTERASYNCALLOCSTATE_L2_ALLOC:
         {
-            uint64_t offUpdateLe = RT_H2LE_U64(pClusterAlloc->pL2Entry->offL2Tbl);
+            uint64_t offUpdateLe = RT_H2LE_U64(QED_L2_ENTRY_OFFSET(pClusterAlloc->pL2Entry));
 
             /* Update the link in the on disk L1 table now. */
             pClusterAlloc->enmAllocState = QEDCLUSTERASYNCALLOCSTATE_L2_LINK;
@@ -1470,7 +1393,7 @@ static DECLCALLBACK(int) qedAsyncClusterAllocUpdate(void *pBackendData, PVDIOCTX
             uint64_t offData = qedClusterAllocate(pImage, 1);
 
             /* Update the link in the in memory L1 table now. */
-            pImage->paL1Table[pClusterAlloc->idxL1] = pClusterAlloc->pL2Entry->offL2Tbl;
+            pImage->paL1Table[pClusterAlloc->idxL1] = QED_L2_ENTRY_OFFSET(pClusterAlloc->pL2Entry);
             qedL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry);
 
             pClusterAlloc->enmAllocState = QEDCLUSTERASYNCALLOCSTATE_USER_ALLOC;
@@ -1513,7 +1436,7 @@ static DECLCALLBACK(int) qedAsyncClusterAllocUpdate(void *pBackendData, PVDIOCTX
         case QEDCLUSTERASYNCALLOCSTATE_USER_LINK:
         {
             /* Everything done without errors, signal completion. */
-            pClusterAlloc->pL2Entry->paL2Tbl[pClusterAlloc->idxL2] = pClusterAlloc->offClusterNew;
+            QED_L2_ENTRY_TBL(pClusterAlloc->pL2Entry)[pClusterAlloc->idxL2] = pClusterAlloc->offClusterNew;
             qedL2TblCacheEntryRelease(pClusterAlloc->pL2Entry);
             RTMemFree(pClusterAlloc);
             rc = VINF_SUCCESS;
@@ -1905,8 +1828,8 @@ static int qedWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                     }
 
                     offL2Tbl = qedClusterAllocate(pImage, qedByte2Cluster(pImage, pImage->cbTable));
-                    pL2Entry->offL2Tbl = offL2Tbl;
-                    memset(pL2Entry->paL2Tbl, 0, pImage->cbTable);
+                    QED_L2_ENTRY_OFFSET(pL2Entry) = offL2Tbl;
+                    memset(QED_L2_ENTRY_TBL(pL2Entry), 0, pImage->cbTable);
 
                     pL2ClusterAlloc->enmAllocState = QEDCLUSTERASYNCALLOCSTATE_L2_ALLOC;
                     pL2ClusterAlloc->cbImageOld    = offL2Tbl;
@@ -1922,7 +1845,7 @@ static int qedWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                      * is a leak of some clusters.
                      */
                     rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
-                                                offL2Tbl, pL2Entry->paL2Tbl, pImage->cbTable, pIoCtx,
+                                                offL2Tbl, QED_L2_ENTRY_TBL(pL2Entry), pImage->cbTable, pIoCtx,
                                                 qedAsyncClusterAllocUpdate, pL2ClusterAlloc);
                     if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
                         break;
@@ -2617,7 +2540,7 @@ const VBOXHDDBACKEND g_QedBackend =
     /* paFileExtensions */
     s_aQedFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aQedConfigInfo,
     /* pfnCheckIfValid */
     qedCheckIfValid,
     /* pfnOpen */
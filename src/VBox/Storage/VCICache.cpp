@@ -27,6 +27,12 @@
 #include <iprt/alloc.h>
 #include <iprt/file.h>
 #include <iprt/asm.h>
+#include <iprt/avl.h>
+#include <iprt/crc.h>
+#include <iprt/critsect.h>
+#include <iprt/list.h>
+#include <iprt/string.h>
+#include <iprt/time.h>
 
 #include "VDBackends.h"
 
@@ -47,6 +53,13 @@
 /** Convert byte offset/size to block number/size. */
 #define VCI_BYTE2BLOCK(u)          ((u) >> 9)
 
+/** Number of blocks in a cache slot, the unit of allocation in the cache. */
+#define VCI_SLOT_BLOCKS            128
+/** Size of a cache slot in bytes. */
+#define VCI_SLOT_SIZE              (VCI_SLOT_BLOCKS * VCI_BLOCK_SIZE)
+/** Size of the per slot block bitmaps in bytes. */
+#define VCI_SLOT_BITMAP_SIZE       (VCI_SLOT_BLOCKS / 8)
+
 /**
  * The VCI header - at the beginning of the file.
  *
@@ -66,18 +79,28 @@ typedef struct VciHdr
     uint8_t     fUncleanShutdown;
     /** Cache type. */
     uint32_t    u32CacheType;
-    /** Offset of the B+-Tree root in the image in blocks. */
-    uint64_t    offTreeRoot;
-    /** Offset of the block allocation bitmap in blocks. */
-    uint64_t    offBlkMap;
-    /** Size of the block allocation bitmap in blocks. */
-    uint32_t    cBlkMap;
+    /** Offset of the slot table in the image in blocks. */
+    uint64_t    offSlotTable;
+    /** Offset of the journal in blocks. */
+    uint64_t    offJournal;
+    /** Size of the journal in blocks. */
+    uint32_t    cJournalBlocks;
     /** UUID of the image. */
     RTUUID      uuidImage;
     /** Modification UUID for the cache. */
     RTUUID      uuidModification;
+    /** Offset of the first slot holding cached data in blocks. */
+    uint64_t    offData;
+    /** Number of slots in the cache. */
+    uint32_t    cSlots;
+    /** Number of blocks in one slot. */
+    uint32_t    cSlotBlocks;
+    /** Journal block where the replay starts. */
+    uint32_t    idxJournalHead;
+    /** Sequence number of the journal block at idxJournalHead. */
+    uint64_t    u64JournalSeq;
     /** Reserved for future use. */
-    uint8_t     abReserved[951];
+    uint8_t     abReserved[923];
 } VciHdr, *PVciHdr;
 #pragma pack()
 AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
@@ -85,7 +108,7 @@ AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 /** VCI signature to identify a valid image. */
 #define VCI_HDR_SIGNATURE          UINT32_C(0x00494356) /* \0ICV */
 /** Current version we support. */
-#define VCI_HDR_VERSION            UINT32_C(0x00000001)
+#define VCI_HDR_VERSION            UINT32_C(0x00000002)
 
 /** Value for an unclean cache shutdown. */
 #define VCI_HDR_UNCLEAN_SHUTDOWN   UINT8_C(0x01)
@@ -98,236 +121,224 @@ AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 #define VCI_HDR_CACHE_TYPE_FIXED   UINT32_C(0x00000002)
 
 /**
- * On disk representation of an extent describing a range of cached data.
+ * On disk representation of a slot table entry.
  *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciCacheExtent
-{
-    /** Block address of the previous extent in the LRU list. */
-    uint64_t    u64ExtentPrev;
-    /** Block address of the next extent in the LRU list. */
-    uint64_t    u64ExtentNext;
-    /** Flags (for compression, encryption etc.) - currently unused and should be always 0. */
-    uint8_t     u8Flags;
-    /** Reserved */
-    uint8_t     u8Reserved;
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VciCacheExtent, *PVciCacheExtent;
-#pragma pack()
-AssertCompileSize(VciCacheExtent, 38);
-
-/**
- * On disk representation of an internal node.
+ * The table is updated with the state recorded in the journal during a
+ * checkpoint. The valid bitmap is only trusted after a clean shutdown,
+ * after a crash only the dirty blocks are kept.
  *
  * All entries a stored in little endian order.
  */
 #pragma pack(1)
-typedef struct VciTreeNodeInternal
-{
-    /** First block of cached data the internal node represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t    u32Blocks;
-    /** Block address in the image where the next node in the tree is stored. */
-    uint64_t    u64ChildAddr;
-} VciTreeNodeInternal, *PVciTreeNodeInternal;
+typedef struct VciSlotEntry
+{
+    /** Slot sized block of the disk cached in this slot,
+     * VCI_SLOT_ENTRY_FREE if the slot is unused. */
+    uint64_t    u64BlockDisk;
+    /** Reserved. */
+    uint64_t    u64Reserved;
+    /** Bitmap of blocks holding valid data. */
+    uint8_t     abValid[VCI_SLOT_BITMAP_SIZE];
+    /** Bitmap of blocks not yet written back to the image. */
+    uint8_t     abDirty[VCI_SLOT_BITMAP_SIZE];
+    /** Reserved. */
+    uint8_t     abReserved[16];
+} VciSlotEntry, *PVciSlotEntry;
 #pragma pack()
-AssertCompileSize(VciTreeNodeInternal, 20);
+AssertCompileSize(VciSlotEntry, 64);
+
+/** Marker for an unused slot. */
+#define VCI_SLOT_ENTRY_FREE        UINT64_C(0xffffffffffffffff)
+/** Number of slot table entries in one block. */
+#define VCI_SLOT_ENTRIES_PER_BLOCK (VCI_BLOCK_SIZE / sizeof(VciSlotEntry))
 
 /**
- * On-disk representation of a node in the B+-Tree.
- *
- * All entries a stored in little endian order.
+ * On disk representation of a journal record, describing the dirty state of
+ * a slot.
  */
 #pragma pack(1)
-typedef struct VciTreeNode
+typedef struct VciJournalEntry
 {
-    /** Type of the node (root, internal, leaf). */
-    uint8_t     u8Type;
-    /** Data in the node. */
-    uint8_t     au8Data[4095];
-} VciTreeNode, *PVciTreeNode;
+    /** The slot index. */
+    uint32_t    idxSlot;
+    /** Reserved. */
+    uint32_t    u32Reserved;
+    /** Slot sized block of the disk cached in this slot,
+     * VCI_SLOT_ENTRY_FREE if the slot holds no dirty data anymore. */
+    uint64_t    u64BlockDisk;
+    /** Bitmap of blocks not yet written back to the image. */
+    uint8_t     abDirty[VCI_SLOT_BITMAP_SIZE];
+} VciJournalEntry, *PVciJournalEntry;
 #pragma pack()
-AssertCompileSize(VciTreeNode, 8 * VCI_BLOCK_SIZE);
-
-/** Node type: Internal node containing links to other nodes (VciTreeNodeInternal). */
-#define VCI_TREE_NODE_TYPE_INTERNAL UINT8_C(0x01)
-/** Node type: Leaf of the tree (VciCacheExtent). */
-#define VCI_TREE_NODE_TYPE_LEAF     UINT8_C(0x02)
+AssertCompileSize(VciJournalEntry, 32);
 
-/** Number of cache extents described by one node. */
-#define VCI_TREE_EXTENTS_PER_NODE        ((sizeof(VciTreeNode)-1) / sizeof(VciCacheExtent))
-/** Number of internal nodes managed by one tree node. */
-#define VCI_TREE_INTERNAL_NODES_PER_NODE ((sizeof(VciTreeNode)-1) / sizeof(VciTreeNodeInternal))
+/** Number of journal records in a journal block. */
+#define VCI_JOURNAL_ENTRIES_PER_BLOCK 15
 
 /**
- * VCI block bitmap header.
- *
- * All entries a stored in little endian order.
+ * On disk representation of a journal block.
  */
 #pragma pack(1)
-typedef struct VciBlkMap
-{
-    /** Magic of the block bitmap. */
-    uint32_t     u32Magic;
-    /** Version of the block bitmap. */
-    uint32_t     u32Version;
-    /** Number of blocks this block map manages. */
-    uint64_t     cBlocks;
-    /** Number of free blocks. */
-    uint64_t     cBlocksFree;
-    /** Number of blocks allocated for metadata. */
-    uint64_t     cBlocksAllocMeta;
-    /** Number of blocks allocated for actual cached data. */
-    uint64_t     cBlocksAllocData;
-    /** Reserved for future use. */
-    uint8_t      au8Reserved[472];
-} VciBlkMap, *PVciBlkMap;
+typedef struct VciJournalBlock
+{
+    /** Magic identifying a journal block. */
+    uint32_t        u32Magic;
+    /** CRC32 of the whole block, computed with this member set to 0. */
+    uint32_t        u32Crc;
+    /** Sequence number. */
+    uint64_t        u64Seq;
+    /** Number of valid records. */
+    uint32_t        cEntries;
+    /** Reserved. */
+    uint32_t        u32Reserved;
+    /** The records. */
+    VciJournalEntry aEntries[VCI_JOURNAL_ENTRIES_PER_BLOCK];
+    /** Padding. */
+    uint8_t         abPadding[8];
+} VciJournalBlock, *PVciJournalBlock;
 #pragma pack()
-AssertCompileSize(VciBlkMap, VCI_BLOCK_SIZE);
-
-/** The magic which identifies a block map. */
-#define VCI_BLKMAP_MAGIC   UINT32_C(0x4b4c4256) /* KLBV */
-/** Current version. */
-#define VCI_BLKMAP_VERSION UINT32_C(0x00000001)
+AssertCompileSize(VciJournalBlock, VCI_BLOCK_SIZE);
 
-/** Block bitmap entry */
-typedef uint8_t VciBlkMapEnt;
+/** Journal block magic. */
+#define VCI_JOURNAL_MAGIC          UINT32_C(0x4c4e524a) /* JRNL */
+/** Smallest journal size in blocks. */
+#define VCI_JOURNAL_BLOCKS_MIN     UINT32_C(512)
+/** Biggest journal size in blocks. */
+#define VCI_JOURNAL_BLOCKS_MAX     UINT32_C(16384)
 
 /*******************************************************************************
-*   Constants And Macros, Structures and Typedefs                              *
+* Constants And Macros, Structures and Typedefs                                *
 *******************************************************************************/
 
-/**
- * Block range descriptor.
- */
-typedef struct VCIBLKRANGEDESC
-{
-    /** Previous entry in the list. */
-    struct VCIBLKRANGEDESC    *pPrev;
-    /** Next entry in the list. */
-    struct VCIBLKRANGEDESC    *pNext;
-    /** Start address of the range. */
-    uint64_t                   offAddrStart;
-    /** Number of blocks in the range. */
-    uint64_t                   cBlocks;
-    /** Flag whether the range is free or allocated. */
-    bool                       fFree;
-} VCIBLKRANGEDESC, *PVCIBLKRANGEDESC;
-
-/**
- * Block map for the cache image - in memory structure.
- */
-typedef struct VCIBLKMAP
-{
-    /** Number of blocks the map manages. */
-    uint64_t     cBlocks;
-    /** Number of blocks allocated for metadata. */
-    uint64_t     cBlocksAllocMeta;
-    /** Number of blocks allocated for actual cached data. */
-    uint64_t     cBlocksAllocData;
-    /** Number of free blocks. */
-    uint64_t     cBlocksFree;
-
-    /** Pointer to the head of the block range list. */
-    PVCIBLKRANGEDESC pRangesHead;
-    /** Pointer to the tail of the block range list. */
-    PVCIBLKRANGEDESC pRangesTail;
-
-} VCIBLKMAP;
-/** Pointer to a block map. */
-typedef VCIBLKMAP *PVCIBLKMAP;
-
-/**
- * B+-Tree node header.
- */
-typedef struct VCITREENODE
-{
-    /** Type of the node (VCI_TREE_NODE_TYPE_*). */
-    uint8_t             u8Type;
-    /** Block address where the node is stored. */
-    uint64_t            u64BlockAddr;
-    /** Pointer to the parent. */
-    struct VCITREENODE *pParent;
-} VCITREENODE, *PVCITREENODE;
+/** Name of the configuration key enabling write-back mode. */
+#define VCI_CFG_WRITE_BACK          "WriteBack"
+/** Name of the configuration key for the percentage of dirty slots which
+ * makes the cache start writing back dirty data. */
+#define VCI_CFG_DIRTY_LOW_WATER     "DirtyLowWater"
+/** Name of the configuration key for the percentage of dirty slots above
+ * which new writes bypass the cache. */
+#define VCI_CFG_DIRTY_HIGH_WATER    "DirtyHighWater"
+/** Name of the configuration key for the maximum time in milliseconds dirty
+ * data may stay in the cache before it is written back. */
+#define VCI_CFG_DIRTY_MAX_AGE       "DirtyMaxAge"
 
 /**
- * B+-Tree node pointer.
+ * In memory state of a cache slot.
  */
-typedef struct VCITREENODEPTR
+typedef struct VCISLOT
 {
-    /** Flag whether the node is in memory or still on the disk. */
-    bool         fInMemory;
-    /** Type dependent data. */
-    union
-    {
-        /** Pointer to a in memory node. */
-        PVCITREENODE pNode;
-        /** Start block address of the node. */
-        uint64_t     offAddrBlockNode;
-    } u;
-} VCITREENODEPTR, *PVCITREENODEPTR;
+    /** AVL tree node, the key is the slot sized block of the disk (no ranges). */
+    AVLRU64NODECORE    Core;
+    /** Node for the list of dirty slots, oldest first. */
+    RTLISTNODE        NodeDirty;
+    /** Node for the list of slots whose dirty state changed since the last
+     * journal commit. */
+    RTLISTNODE        NodeJournal;
+    /** Disk block recorded for this slot in the journal or slot table. */
+    uint64_t          u64BlockDurable;
+    /** Disk block of the last record handed to the journal or slot table,
+     * which might still be in flight. */
+    uint64_t          u64BlockLogged;
+    /** Commit the durable state was recorded by. */
+    uint64_t          u64CommitDurable;
+    /** Commit the logged state was handed to. */
+    uint64_t          u64CommitLogged;
+    /** Timestamp when the slot became dirty in milliseconds. */
+    uint64_t          tsDirty;
+    /** Bitmap of blocks holding valid data. */
+    uint32_t          au32Valid[VCI_SLOT_BLOCKS / 32];
+    /** Bitmap of blocks not yet written back to the image. */
+    uint32_t          au32Dirty[VCI_SLOT_BLOCKS / 32];
+    /** Dirty bitmap as recorded in the journal or slot table. */
+    uint32_t          au32DirtyDurable[VCI_SLOT_BLOCKS / 32];
+    /** Dirty bitmap of the last record handed to the journal or slot table. */
+    uint32_t          au32DirtyLogged[VCI_SLOT_BLOCKS / 32];
+    /** Blocks currently being written back. */
+    uint32_t          au32Destage[VCI_SLOT_BLOCKS / 32];
+    /** Blocks written by the guest while being written back. */
+    uint32_t          au32Rewritten[VCI_SLOT_BLOCKS / 32];
+    /** Flag whether the slot is linked into the tree. */
+    bool              fMapped;
+    /** Flag whether the slot was accessed since the clock hand passed it. */
+    bool              fReferenced;
+    /** Flag whether the slot is on the dirty list. */
+    bool              fDirty;
+    /** Flag whether dirty data of the slot is being written back. */
+    bool              fDestaging;
+    /** Flag whether the slot is on the journal list. */
+    bool              fJournalPending;
+    /** Number of guest reads from the slot in flight. */
+    uint32_t          cReadsActive;
+    /** Number of guest writes to the slot in flight. */
+    uint32_t          cWritesActive;
+} VCISLOT;
+/** Pointer to the in memory state of a slot. */
+typedef VCISLOT *PVCISLOT;
 
 /**
- * Internal node.
+ * Transfer types.
  */
-typedef struct VCINODEINTERNAL
+typedef enum VCIXFERTYPE
 {
-    /** First block of cached data the internal node represents. */
-    uint64_t       u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t       u32Blocks;
-    /** Pointer to the child node. */
-    VCITREENODEPTR PtrChild;
-} VCINODEINTERNAL, *PVCINODEINTERNAL;
+    /** Invalid type. */
+    VCIXFERTYPE_INVALID = 0,
+    /** Guest data read from a slot. */
+    VCIXFERTYPE_READ,
+    /** Guest data written to a slot. */
+    VCIXFERTYPE_WRITE,
+    /** Journal commit or checkpoint. */
+    VCIXFERTYPE_COMMIT,
+    /** 32bit hack. */
+    VCIXFERTYPE_32BIT_HACK = 0x7fffffff
+} VCIXFERTYPE;
 
 /**
- * A in memory internal B+-tree node.
+ * Slot state recorded by a journal commit or checkpoint.
  */
-typedef struct VCITREENODEINT
+typedef struct VCICOMMITREC
 {
-    /** Node core. */
-    VCITREENODE     Core;
-    /** Number of used nodes. */
-    unsigned        cUsedNodes;
-    /** Array of internal nodes. */
-    VCINODEINTERNAL aIntNodes[VCI_TREE_INTERNAL_NODES_PER_NODE];
-} VCITREENODEINT, *PVCITREENODEINT;
+    /** Index of the slot. */
+    uint32_t          idxSlot;
+    /** Recorded disk block. */
+    uint64_t          u64BlockDisk;
+    /** Recorded dirty bitmap. */
+    uint32_t          au32Dirty[VCI_SLOT_BLOCKS / 32];
+} VCICOMMITREC;
+/** Pointer to a slot record. */
+typedef VCICOMMITREC *PVCICOMMITREC;
 
 /**
- * A in memory cache extent.
+ * Transfer of the cache in flight. The in memory state is only updated after
+ * all I/O of the transfer completed.
  */
-typedef struct VCICACHEEXTENT
+typedef struct VCIXFER
 {
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VCICACHEEXTENT, *PVCICACHEEXTENT;
-
-/**
- * A in memory leaf B+-tree node.
- */
-typedef struct VCITREENODELEAF
-{
-    /** Node core. */
-    VCITREENODE             Core;
-    /** Next leaf node in the list. */
-    struct VCITREENODELEAF *pNext;
-    /** Number of used nodes. */
-    unsigned                cUsedNodes;
-    /** The extents in the node. */
-    VCICACHEEXTENT          aExtents[VCI_TREE_EXTENTS_PER_NODE];
-} VCITREENODELEAF, *PVCITREENODELEAF;
+    /** Next completed transfer waiting to be processed. */
+    struct VCIXFER * volatile pNext;
+    /** Transfer type. */
+    VCIXFERTYPE       enmType;
+    /** Number of references, one for every I/O in flight and one for the
+     * initiator while the I/O is issued. */
+    volatile uint32_t cRefs;
+    /** Status code of the first failed I/O. */
+    volatile int32_t  rcReq;
+    /** Slot of a guest data transfer. */
+    PVCISLOT          pSlot;
+    /** First block of a guest data transfer in the slot. */
+    uint32_t          iBlock;
+    /** Number of blocks of a guest data transfer. */
+    uint32_t          cBlocks;
+    /** Commit number of a journal commit or checkpoint. */
+    uint64_t          u64Commit;
+    /** Flag whether the commit is a checkpoint. */
+    bool              fCheckpoint;
+    /** Number of slot records of a commit. */
+    uint32_t          cRecords;
+    /** Slot records of a commit - variable size. */
+    VCICOMMITREC      aRecords[1];
+} VCIXFER;
+/** Pointer to a transfer. */
+typedef VCIXFER *PVCIXFER;
 
 /**
  * VCI image data structure.
@@ -355,24 +366,73 @@ typedef struct VCICACHE
     /** Total size of the image. */
     uint64_t          cbSize;
 
-    /** Offset of the B+-Tree in the image in bytes. */
-    uint64_t          offTreeRoot;
-    /** Pointer to the root node of the B+-Tree. */
-    PVCITREENODE      pRoot;
-    /** Offset to the block allocation bitmap in bytes. */
-    uint64_t          offBlksBitmap;
-    /** Block map. */
-    PVCIBLKMAP        pBlkMap;
+    /** Critical section protecting the cache state. The destage thread of
+     * the VD layer accesses the cache concurrently to the I/O path. I/O
+     * completion callbacks never wait for it, see vciXferDone(). */
+    RTCRITSECT        CritSect;
+    /** Cache type from the header. */
+    uint32_t          u32CacheType;
+    /** Offset of the slot table in bytes. */
+    uint64_t          offSlotTable;
+    /** Offset of the journal in bytes. */
+    uint64_t          offJournal;
+    /** Size of the journal in blocks. */
+    uint32_t          cJournalBlocks;
+    /** Offset of the first data slot in bytes. */
+    uint64_t          offData;
+    /** Number of slots. */
+    uint32_t          cSlots;
+    /** Array of in memory slot states. */
+    PVCISLOT          paSlots;
+    /** Tree of mapped slots. */
+    AVLRU64TREE        TreeSlots;
+    /** Clock hand for slot replacement. */
+    uint32_t          idxClock;
+    /** Number of slots holding dirty data. */
+    uint32_t          cSlotsDirty;
+    /** List of dirty slots, oldest first. */
+    RTLISTANCHOR      ListDirty;
+    /** List of slots needing a journal record. */
+    RTLISTANCHOR      ListJournal;
+    /** Bitmap of slot table blocks to write during the next checkpoint. */
+    uint32_t         *pbmTableDirty;
+    /** Journal block where the replay starts. */
+    uint32_t          idxJournalHead;
+    /** Sequence number of the block at idxJournalHead. */
+    uint64_t          u64JournalSeqHead;
+    /** Sequence number of the next journal block to write. */
+    uint64_t          u64JournalSeqNext;
+    /** Buffer for one slot worth of data. */
+    uint8_t          *pbBuf;
+    /** Completed transfers waiting to be processed with the lock held. */
+    PVCIXFER volatile pXfersDone;
+    /** Number of the next journal commit or checkpoint. */
+    uint64_t          u64CommitNext;
+    /** Flag whether the journal must be reset with a checkpoint because a
+     * commit failed. */
+    bool              fCheckpointNeeded;
+
+    /** Flag whether guest writes are cached (write-back mode). */
+    bool              fWriteBack;
+    /** Percentage of dirty slots to start writing back data. */
+    uint32_t          uDirtyLowWater;
+    /** Percentage of dirty slots above which no new dirty slots are allocated. */
+    uint32_t          uDirtyHighWater;
+    /** Maximum age of dirty data in milliseconds. */
+    uint32_t          cMsDirtyMaxAge;
+
+    /** Number of reads satisfied from the cache. */
+    uint64_t          cHits;
+    /** Number of reads which missed. */
+    uint64_t          cMisses;
+    /** Number of guest writes cached. */
+    uint64_t          cWritesCached;
+    /** Number of guest writes passed to the image. */
+    uint64_t          cWritesPassed;
+    /** Number of ranges written back. */
+    uint64_t          cDestaged;
 } VCICACHE, *PVCICACHE;
 
-/** No block free in bitmap error code. */
-#define VERR_VCI_NO_BLOCKS_FREE (-65536)
-
-/** Flags for the block map allocator. */
-#define VCIBLKMAP_ALLOC_DATA 0
-#define VCIBLKMAP_ALLOC_META RT_BIT(0)
-#define VCIBLKMAP_ALLOC_MASK 0x1
-
 /*******************************************************************************
 *   Static Variables                                                           *
 *******************************************************************************/
@@ -384,813 +444,1119 @@ static const char *const s_apszVciFileExtensions[] =
     NULL
 };
 
+/** Configuration keys. */
+static const VDCONFIGINFO s_aVciConfigInfo[] =
+{
+    /* pszKey                   pszDefaultValue     enmValueType            uKeyFlags */
+    { VCI_CFG_WRITE_BACK,       "0",                VDCFGVALUETYPE_INTEGER, 0 },
+    { VCI_CFG_DIRTY_LOW_WATER,  "10",               VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { VCI_CFG_DIRTY_HIGH_WATER, "75",               VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { VCI_CFG_DIRTY_MAX_AGE,    "30000",            VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                     NULL,               VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
 
 /**
- * Internal. Flush image data to disk.
+ * Returns whether the given slot bitmap has no bit set.
  */
-static int vciFlushImage(PVCICACHE pCache)
+DECLINLINE(bool) vciBitmapIsEmpty(const uint32_t *pau32Bitmap)
 {
-    int rc = VINF_SUCCESS;
+    return ASMBitFirstSet(pau32Bitmap, VCI_SLOT_BLOCKS) == -1;
+}
 
-    if (   pCache->pStorage
-        && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+/**
+ * Returns whether any bit in the given range of a slot bitmap is set.
+ */
+DECLINLINE(bool) vciBitmapIsRangeSet(const uint32_t *pau32Bitmap, uint32_t iBlock, uint32_t cBlocks)
+{
+    if (ASMBitTest(pau32Bitmap, iBlock))
+        return true;
+    if (iBlock + 1 >= VCI_SLOT_BLOCKS)
+        return false;
+
+    int iBit = ASMBitNextSet(pau32Bitmap, VCI_SLOT_BLOCKS, iBlock);
+    return iBit != -1 && (uint32_t)iBit < iBlock + cBlocks;
+}
+
+/**
+ * Returns the number of consecutive blocks starting at iBlock which have the
+ * same state in the given bitmap, limited to cBlocksMax.
+ */
+static uint32_t vciBitmapRun(const uint32_t *pau32Bitmap, uint32_t iBlock, uint32_t cBlocksMax)
+{
+    int iEnd;
+
+    if (ASMBitTest(pau32Bitmap, iBlock))
+        iEnd = iBlock + 1 < VCI_SLOT_BLOCKS ? ASMBitNextClear(pau32Bitmap, VCI_SLOT_BLOCKS, iBlock) : -1;
+    else
+        iEnd = iBlock + 1 < VCI_SLOT_BLOCKS ? ASMBitNextSet(pau32Bitmap, VCI_SLOT_BLOCKS, iBlock) : -1;
+
+    if (iEnd == -1)
+        iEnd = VCI_SLOT_BLOCKS;
+
+    return RT_MIN((uint32_t)iEnd - iBlock, cBlocksMax);
+}
+
+/**
+ * Returns the byte offset of the given block of a slot in the image.
+ */
+DECLINLINE(uint64_t) vciSlotOffset(PVCICACHE pCache, PVCISLOT pSlot, uint32_t iBlock)
+{
+    return   pCache->offData
+           + (uint64_t)(pSlot - pCache->paSlots) * VCI_SLOT_SIZE
+           + VCI_BLOCK2BYTE(iBlock);
+}
+
+/**
+ * Queues a journal record for the given slot.
+ */
+static void vciSlotJournalQueue(PVCICACHE pCache, PVCISLOT pSlot)
+{
+    if (!pSlot->fJournalPending)
     {
-        rc = vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
+        RTListAppend(&pCache->ListJournal, &pSlot->NodeJournal);
+        pSlot->fJournalPending = true;
     }
-
-    return rc;
 }
 
 /**
- * Internal. Free all allocated space for representing an image except pCache,
- * and optionally delete the image from disk.
+ * Updates the dirty list membership of the slot after the dirty bitmap changed.
  */
-static int vciFreeImage(PVCICACHE pCache, bool fDelete)
+static void vciSlotDirtyUpdate(PVCICACHE pCache, PVCISLOT pSlot)
 {
-    int rc = VINF_SUCCESS;
+    bool fDirty = !vciBitmapIsEmpty(pSlot->au32Dirty);
 
-    /* Freeing a never allocated image (e.g. because the open failed) is
-     * not signalled as an error. After all nothing bad happens. */
-    if (pCache)
+    if (fDirty && !pSlot->fDirty)
     {
-        if (pCache->pStorage)
-        {
-            /* No point updating the file that is deleted anyway. */
-            if (!fDelete)
-                vciFlushImage(pCache);
+        RTListAppend(&pCache->ListDirty, &pSlot->NodeDirty);
+        pSlot->tsDirty = RTTimeMilliTS();
+        pSlot->fDirty = true;
+        pCache->cSlotsDirty++;
+    }
+    else if (!fDirty && pSlot->fDirty)
+    {
+        RTListNodeRemove(&pSlot->NodeDirty);
+        pSlot->fDirty = false;
+        pCache->cSlotsDirty--;
+    }
+}
 
-            vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
-            pCache->pStorage = NULL;
-        }
+/**
+ * Removes the slot from the tree, dropping all clean data.
+ */
+static void vciSlotUnmap(PVCICACHE pCache, PVCISLOT pSlot)
+{
+    Assert(!pSlot->fDirty && !pSlot->fDestaging);
 
-        if (fDelete && pCache->pszFilename)
-            vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
+    if (pSlot->fMapped)
+    {
+        PAVLRU64NODECORE pCore = RTAvlrU64Remove(&pCache->TreeSlots, pSlot->Core.Key);
+        Assert(pCore == &pSlot->Core); NOREF(pCore);
+        pSlot->fMapped = false;
     }
 
-    LogFlowFunc(("returns %Rrc\n", rc));
-    return rc;
+    RT_ZERO(pSlot->au32Valid);
+    pSlot->fReferenced = false;
 }
 
 /**
- * Creates a new block map which can manage the given number of blocks.
+ * Maps the slot to the given disk block.
+ */
+static void vciSlotMap(PVCICACHE pCache, PVCISLOT pSlot, uint64_t u64BlockDisk)
+{
+    Assert(!pSlot->fMapped);
+
+    pSlot->Core.Key     = u64BlockDisk;
+    pSlot->Core.KeyLast = u64BlockDisk;
+    bool fInserted = RTAvlrU64Insert(&pCache->TreeSlots, &pSlot->Core);
+    Assert(fInserted); NOREF(fInserted);
+    pSlot->fMapped = true;
+    pSlot->fReferenced = true;
+}
+
+/**
+ * Returns whether the slot may be reused for another disk block.
  *
- * The size of the bitmap is aligned to the VCI block size.
+ * A slot must not be reused before the journal says it holds no dirty data,
+ * otherwise a replay after a crash would write the new data to the old
+ * location. Guest transfers in flight pin the slot as well.
+ */
+DECLINLINE(bool) vciSlotIsReusable(PVCISLOT pSlot)
+{
+    return    !pSlot->fDirty
+           && !pSlot->fDestaging
+           && !pSlot->cReadsActive
+           && !pSlot->cWritesActive
+           && pSlot->u64BlockDurable == VCI_SLOT_ENTRY_FREE
+           && pSlot->u64BlockLogged == VCI_SLOT_ENTRY_FREE;
+}
+
+/**
+ * Allocates a slot for the given disk block, evicting clean data if required.
  *
- * @returns VBox status code.
- * @param   cBlocks      The number of blocks the bitmap can manage.
- * @param   ppBlkMap     Where to store the pointer to the block bitmap.
- * @param   pcbBlkMap    Where to store the size of the block bitmap in blocks
- *                       needed on the disk.
+ * @returns Pointer to the slot or NULL if every slot is in use.
+ * @param   pCache          The cache instance.
+ * @param   u64BlockDisk    The slot sized disk block to map.
  */
-static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcBlkMap)
+static PVCISLOT vciSlotAlloc(PVCICACHE pCache, uint64_t u64BlockDisk)
 {
-    int rc = VINF_SUCCESS;
-    uint32_t cbBlkMap = RT_ALIGN_Z(cBlocks / sizeof(VciBlkMapEnt) / 8, VCI_BLOCK_SIZE);
-    PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
-    PVCIBLKRANGEDESC pFree   = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+    for (uint32_t i = 0; i < 2 * pCache->cSlots; i++)
+    {
+        PVCISLOT pSlot = &pCache->paSlots[pCache->idxClock];
+
+        pCache->idxClock = (pCache->idxClock + 1) % pCache->cSlots;
+
+        if (!vciSlotIsReusable(pSlot))
+            continue;
+
+        if (pSlot->fMapped && pSlot->fReferenced)
+        {
+            pSlot->fReferenced = false;
+            continue;
+        }
 
-    LogFlowFunc(("cBlocks=%u ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
+        vciSlotUnmap(pCache, pSlot);
+        vciSlotMap(pCache, pSlot, u64BlockDisk);
+        return pSlot;
+    }
+
+    return NULL;
+}
+
+/**
+ * Converts the durable state of a slot to the on disk slot table entry.
+ */
+static void vciSlotEntryFromSlot(PVCISLOT pSlot, PVciSlotEntry pEntry, bool fClean)
+{
+    memset(pEntry, 0, sizeof(*pEntry));
 
-    if (pBlkMap && pFree)
+    if (fClean)
     {
-        pBlkMap->cBlocks          = cBlocks;
-        pBlkMap->cBlocksAllocMeta = 0;
-        pBlkMap->cBlocksAllocData = 0;
-        pBlkMap->cBlocksFree      = cBlocks;
-
-        pFree->pPrev = NULL;
-        pFree->pNext = NULL;
-        pFree->offAddrStart = 0;
-        pFree->cBlocks      = cBlocks;
-        pFree->fFree        = true;
-
-        pBlkMap->pRangesHead = pFree;
-        pBlkMap->pRangesTail = pFree;
-
-        Assert(!((cbBlkMap + sizeof(VciBlkMap)) % VCI_BLOCK_SIZE));
-        *ppBlkMap = pBlkMap;
-        *pcBlkMap = VCI_BYTE2BLOCK(cbBlkMap + sizeof(VciBlkMap));
+        /* Everything in memory is up to date after a clean shutdown. */
+        if (pSlot->fMapped && !vciBitmapIsEmpty(pSlot->au32Valid))
+        {
+            pEntry->u64BlockDisk = RT_H2LE_U64(pSlot->Core.Key);
+            memcpy(pEntry->abValid, pSlot->au32Valid, sizeof(pEntry->abValid));
+            memcpy(pEntry->abDirty, pSlot->au32Dirty, sizeof(pEntry->abDirty));
+        }
+        else
+            pEntry->u64BlockDisk = RT_H2LE_U64(VCI_SLOT_ENTRY_FREE);
     }
     else
     {
-        if (pBlkMap)
-            RTMemFree(pBlkMap);
-        if (pFree)
-            RTMemFree(pFree);
+        pEntry->u64BlockDisk = RT_H2LE_U64(pSlot->u64BlockLogged);
+        memcpy(pEntry->abValid, pSlot->au32DirtyLogged, sizeof(pEntry->abValid));
+        memcpy(pEntry->abDirty, pSlot->au32DirtyLogged, sizeof(pEntry->abDirty));
+    }
+}
 
-        rc = VERR_NO_MEMORY;
+/**
+ * Allocates a new transfer holding the reference of the initiator.
+ *
+ * @returns Pointer to the transfer or NULL if out of memory.
+ * @param   enmType         The transfer type.
+ * @param   cRecords        Number of slot records for a commit.
+ */
+static PVCIXFER vciXferAlloc(VCIXFERTYPE enmType, uint32_t cRecords)
+{
+    PVCIXFER pXfer = (PVCIXFER)RTMemAllocZ(RT_OFFSETOF(VCIXFER, aRecords[RT_MAX(cRecords, 1)]));
+    if (pXfer)
+    {
+        pXfer->enmType = enmType;
+        pXfer->cRefs   = 1;
+        pXfer->rcReq   = VINF_SUCCESS;
     }
 
-    LogFlowFunc(("returns rc=%Rrc cBlkMap=%u\n", rc, *pcBlkMap));
-    return rc;
+    return pXfer;
 }
 
 /**
- * Frees a block map.
- *
- * @returns nothing.
- * @param   pBlkMap         The block bitmap to destroy.
+ * Updates the slot after a guest write to the cache completed.
  */
-static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
+static void vciSlotWriteCompleted(PVCICACHE pCache, PVCIXFER pXfer)
 {
-    LogFlowFunc(("pBlkMap=%#p\n", pBlkMap));
+    PVCISLOT pSlot = pXfer->pSlot;
+    uint32_t iBlock = pXfer->iBlock;
+    uint32_t cBlocks = pXfer->cBlocks;
 
-    PVCIBLKRANGEDESC pRangeCur = pBlkMap->pRangesHead;
+    Assert(pSlot->cWritesActive);
+    pSlot->cWritesActive--;
 
-    while (pRangeCur)
+    if (RT_SUCCESS(pXfer->rcReq))
+    {
+        ASMBitSetRange(pSlot->au32Valid, iBlock, iBlock + cBlocks);
+        ASMBitSetRange(pSlot->au32Dirty, iBlock, iBlock + cBlocks);
+        if (pSlot->fDestaging)
+            ASMBitSetRange(pSlot->au32Rewritten, iBlock, iBlock + cBlocks);
+        pSlot->fReferenced = true;
+        vciSlotDirtyUpdate(pCache, pSlot);
+        vciSlotJournalQueue(pCache, pSlot);
+        pCache->cWritesCached++;
+    }
+    else
     {
-        PVCIBLKRANGEDESC pTmp = pRangeCur;
+        /* The content is undefined now, only dirty blocks are kept as they still go to the image. */
+        for (uint32_t i = iBlock; i < iBlock + cBlocks; i++)
+            if (!ASMBitTest(pSlot->au32Dirty, i))
+                ASMBitClear(pSlot->au32Valid, i);
+    }
+}
 
-        RTMemFree(pTmp);
+/**
+ * Updates the durable state of the slots after a journal commit or checkpoint
+ * completed.
+ */
+static void vciCommitCompleted(PVCICACHE pCache, PVCIXFER pXfer)
+{
+    for (uint32_t i = 0; i < pXfer->cRecords; i++)
+    {
+        PVCICOMMITREC pRec = &pXfer->aRecords[i];
+        PVCISLOT pSlot = &pCache->paSlots[pRec->idxSlot];
 
-        pRangeCur = pRangeCur->pNext;
+        if (RT_SUCCESS(pXfer->rcReq))
+        {
+            /* Commits can complete out of order. */
+            if (pXfer->u64Commit > pSlot->u64CommitDurable)
+            {
+                memcpy(pSlot->au32DirtyDurable, pRec->au32Dirty, sizeof(pSlot->au32DirtyDurable));
+                pSlot->u64BlockDurable  = pRec->u64BlockDisk;
+                pSlot->u64CommitDurable = pXfer->u64Commit;
+            }
+        }
+        else if (pSlot->u64CommitLogged == pXfer->u64Commit)
+        {
+            /* Record the slot again with the next commit. */
+            memcpy(pSlot->au32DirtyLogged, pSlot->au32DirtyDurable, sizeof(pSlot->au32DirtyLogged));
+            pSlot->u64BlockLogged  = pSlot->u64BlockDurable;
+            pSlot->u64CommitLogged = pSlot->u64CommitDurable;
+            vciSlotJournalQueue(pCache, pSlot);
+        }
     }
 
-    RTMemFree(pBlkMap);
+    if (RT_FAILURE(pXfer->rcReq))
+    {
+        /* The journal might have a hole now, start over with a checkpoint. */
+        LogRel(("VCI: Committing the state of '%s' failed with %Rrc\n",
+                pCache->pszFilename, pXfer->rcReq));
+        pCache->fCheckpointNeeded = true;
+        if (pXfer->fCheckpoint)
+        {
+            uint32_t cTableBlocks = RT_ALIGN_32(pCache->cSlots, VCI_SLOT_ENTRIES_PER_BLOCK) / VCI_SLOT_ENTRIES_PER_BLOCK;
+            ASMBitSetRange(pCache->pbmTableDirty, 0, cTableBlocks);
+        }
+    }
+}
 
-    LogFlowFunc(("returns\n"));
+/**
+ * Updates the in memory state after all I/O of a transfer completed and frees
+ * the transfer. Called with the lock held.
+ */
+static void vciXferProcess(PVCICACHE pCache, PVCIXFER pXfer)
+{
+    switch (pXfer->enmType)
+    {
+        case VCIXFERTYPE_READ:
+            Assert(pXfer->pSlot->cReadsActive);
+            pXfer->pSlot->cReadsActive--;
+            break;
+        case VCIXFERTYPE_WRITE:
+            vciSlotWriteCompleted(pCache, pXfer);
+            break;
+        case VCIXFERTYPE_COMMIT:
+            vciCommitCompleted(pCache, pXfer);
+            break;
+        default:
+            AssertMsgFailed(("Invalid transfer type %d\n", pXfer->enmType));
+    }
+
+    RTMemFree(pXfer);
 }
 
 /**
- * Loads the block map from the specified medium and creates all necessary
- * in memory structures to manage used and free blocks.
- *
- * @returns VBox status code.
- * @param   pStorage        Storage handle to read the block bitmap from.
- * @param   offBlkMap       Start of the block bitmap in blocks.
- * @param   cBlkMap         Size of the block bitmap on the disk in blocks.
- * @param   ppBlkMap        Where to store the block bitmap on success.
+ * Processes all transfers which completed while someone else held the lock.
  */
-static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMap, PVCIBLKMAP *ppBlkMap)
+static void vciXfersProcessDone(PVCICACHE pCache)
 {
-    int rc = VINF_SUCCESS;
-    VciBlkMap BlkMap;
+    PVCIXFER pXfer = ASMAtomicXchgPtrT(&pCache->pXfersDone, NULL, PVCIXFER);
 
-    LogFlowFunc(("pStorage=%#p offBlkMap=%llu cBlkMap=%u ppBlkMap=%#p\n",
-                 pStorage, offBlkMap, cBlkMap, ppBlkMap));
+    while (pXfer)
+    {
+        PVCIXFER pNext = pXfer->pNext;
+        vciXferProcess(pCache, pXfer);
+        pXfer = pNext;
+    }
+}
 
-    if (cBlkMap >= VCI_BYTE2BLOCK(sizeof(VciBlkMap)))
+/**
+ * Enters the lock protecting the cache state.
+ */
+static void vciLock(PVCICACHE pCache)
+{
+    RTCritSectEnter(&pCache->CritSect);
+    vciXfersProcessDone(pCache);
+}
+
+/**
+ * Leaves the lock protecting the cache state, processing transfers which
+ * completed in the meantime.
+ */
+static void vciUnlock(PVCICACHE pCache)
+{
+    do
     {
-        cBlkMap -= VCI_BYTE2BLOCK(sizeof(VciBlkMap));
+        vciXfersProcessDone(pCache);
+        RTCritSectLeave(&pCache->CritSect);
+    } while (   ASMAtomicReadPtrT(&pCache->pXfersDone, PVCIXFER)
+             && RT_SUCCESS(RTCritSectTryEnter(&pCache->CritSect)));
+}
 
-        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                   &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
-        if (RT_SUCCESS(rc))
-        {
-            offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-            BlkMap.u32Magic         = RT_LE2H_U32(BlkMap.u32Magic);
-            BlkMap.u32Version       = RT_LE2H_U32(BlkMap.u32Version);
-            BlkMap.cBlocks          = RT_LE2H_U32(BlkMap.cBlocks);
-            BlkMap.cBlocksFree      = RT_LE2H_U32(BlkMap.cBlocksFree);
-            BlkMap.cBlocksAllocMeta = RT_LE2H_U32(BlkMap.cBlocksAllocMeta);
-            BlkMap.cBlocksAllocData = RT_LE2H_U32(BlkMap.cBlocksAllocData);
-
-            if (   BlkMap.u32Magic == VCI_BLKMAP_MAGIC
-                && BlkMap.u32Version == VCI_BLKMAP_VERSION
-                && BlkMap.cBlocks == BlkMap.cBlocksFree + BlkMap.cBlocksAllocMeta + BlkMap.cBlocksAllocData
-                && VCI_BYTE2BLOCK(BlkMap.cBlocks / 8) == cBlkMap)
-            {
-                PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
-                if (pBlkMap)
-                {
-                    pBlkMap->cBlocks          = BlkMap.cBlocks;
-                    pBlkMap->cBlocksFree      = BlkMap.cBlocksFree;
-                    pBlkMap->cBlocksAllocMeta = BlkMap.cBlocksAllocMeta;
-                    pBlkMap->cBlocksAllocData = BlkMap.cBlocksAllocData;
-
-                    /* Load the bitmap and construct the range list. */
-                    uint32_t cBlocksFree = 0;
-                    uint32_t cBlocksAllocated = 0;
-                    PVCIBLKRANGEDESC pRangeCur = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-
-                    if (pRangeCur)
-                    {
-                        uint8_t abBitmapBuffer[16 * _1K];
-                        uint32_t cBlocksRead = 0;
-                        uint64_t cBlocksLeft = VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8);
-
-                        cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                   offBlkMap, abBitmapBuffer,
-                                                   cBlocksRead);
-
-                        if (RT_SUCCESS(rc))
-                        {
-                            pRangeCur->fFree        = !(abBitmapBuffer[0] & 0x01);
-                            pRangeCur->offAddrStart = 0;
-                            pRangeCur->cBlocks      = 0;
-                            pRangeCur->pNext        = NULL;
-                            pRangeCur->pPrev        = NULL;
-                            pBlkMap->pRangesHead = pRangeCur;
-                            pBlkMap->pRangesTail = pRangeCur;
-                        }
-
-                        while (   RT_SUCCESS(rc)
-                               && cBlocksLeft)
-                        {
-                            int iBit = 0;
-                            uint32_t cBits = VCI_BLOCK2BYTE(cBlocksRead) * 8;
-                            uint32_t iBitPrev = 0xffffffff;
-
-                            while (cBits)
-                            {
-                                if (pRangeCur->fFree)
-                                {
-                                    /* Check for the first set bit. */
-                                    iBit = ASMBitNextSet(abBitmapBuffer, cBits, iBitPrev);
-                                }
-                                else
-                                {
-                                    /* Check for the first free bit. */
-                                    iBit = ASMBitNextClear(abBitmapBuffer, cBits, iBitPrev);
-                                }
-
-                                if (iBit == -1)
-                                {
-                                    /* No change. */
-                                    pRangeCur->cBlocks += cBits;
-                                    cBits = 0;
-                                }
-                                else
-                                {
-                                    Assert((uint32_t)iBit < cBits);
-                                    pRangeCur->cBlocks += iBit;
-
-                                    /* Create a new range descriptor. */
-                                    PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-                                    if (!pRangeNew)
-                                    {
-                                        rc = VERR_NO_MEMORY;
-                                        break;
-                                    }
-
-                                    pRangeNew->fFree = !pRangeCur->fFree;
-                                    pRangeNew->offAddrStart = pRangeCur->offAddrStart + pRangeCur->cBlocks;
-                                    pRangeNew->cBlocks = 0;
-                                    pRangeNew->pPrev = pRangeCur;
-                                    pRangeCur->pNext = pRangeNew;
-                                    pBlkMap->pRangesTail = pRangeNew;
-                                    pRangeCur = pRangeNew;
-                                    cBits -= iBit;
-                                    iBitPrev = iBit;
-                                }
-                            }
-
-                            cBlocksLeft -= cBlocksRead;
-                            offBlkMap   += cBlocksRead;
-
-                            if (   RT_SUCCESS(rc)
-                                && cBlocksLeft)
-                            {
-                                /* Read next chunk. */
-                                cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                                rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                           offBlkMap, abBitmapBuffer, cBlocksRead);
-                            }
-                        }
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
-
-                    if (RT_SUCCESS(rc))
-                    {
-                        *ppBlkMap = pBlkMap;
-                        LogFlowFunc(("return success\n"));
-                        return VINF_SUCCESS;
-                    }
-                    else
-                        RTMemFree(pBlkMap);
-                }
-                else
-                    rc = VERR_NO_MEMORY;
-            }
-            else
-                rc = VERR_VD_GEN_INVALID_HEADER;
-        }
-        else if (RT_SUCCESS(rc))
-            rc = VERR_VD_GEN_INVALID_HEADER;
+/**
+ * Completion callback for the I/O of a transfer.
+ */
+static DECLCALLBACK(int) vciXferDone(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    PVCIXFER pXfer = (PVCIXFER)pvUser;
+
+    NOREF(pIoCtx);
+
+    if (RT_FAILURE(rcReq))
+        ASMAtomicCmpXchgS32(&pXfer->rcReq, rcReq, VINF_SUCCESS);
+
+    if (!ASMAtomicDecU32(&pXfer->cRefs))
+    {
+        /*
+         * Never wait for the lock here. The destage thread holds it while
+         * doing synchronous I/O which might have to be processed by the
+         * thread calling us. The next owner of the lock processes the transfer.
+         */
+        PVCIXFER pHead = ASMAtomicUoReadPtrT(&pCache->pXfersDone, PVCIXFER);
+        do
+            pXfer->pNext = pHead;
+        while (!ASMAtomicCmpXchgExPtr(&pCache->pXfersDone, pXfer, pHead, &pHead));
+
+        if (   !RTCritSectIsOwner(&pCache->CritSect)
+            && RT_SUCCESS(RTCritSectTryEnter(&pCache->CritSect)))
+            vciUnlock(pCache);
     }
-    else
-        rc = VERR_VD_GEN_INVALID_HEADER;
 
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
-    return rc;
+    return VINF_SUCCESS;
 }
 
 /**
- * Saves the block map in the cache image. All necessary on disk structures
- * are written.
+ * Drops the reference of the initiator after all I/O of the transfer was
+ * issued. Called with the lock held.
  *
  * @returns VBox status code.
- * @param   pBlkMap         The block bitmap to save.
- * @param   pStorage        Where the block bitmap should be written to.
- * @param   offBlkMap       Start of the block bitmap in blocks.
- * @param   cBlkMap         Size of the block bitmap on the disk in blocks.
+ * @retval  VINF_SUCCESS if all I/O completed and the state was updated.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if I/O is still in flight.
+ * @param   pCache          The cache instance.
+ * @param   pXfer           The transfer.
+ * @param   rc              Status code of issuing the I/O.
  */
-static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMap)
+static int vciXferRelease(PVCICACHE pCache, PVCIXFER pXfer, int rc)
 {
-    int rc = VINF_SUCCESS;
-    VciBlkMap BlkMap;
-
-    LogFlowFunc(("pBlkMap=%#p pStorage=%#p offBlkMap=%llu cBlkMap=%u\n",
-                 pBlkMap, pStorage, offBlkMap, cBlkMap));
+    if (RT_FAILURE(rc))
+        ASMAtomicCmpXchgS32(&pXfer->rcReq, rc, VINF_SUCCESS);
 
-    /* Make sure the number of blocks allocated for us match our expectations. */
-    if (VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8) + VCI_BYTE2BLOCK(sizeof(VciBlkMap)) == cBlkMap)
+    if (!ASMAtomicDecU32(&pXfer->cRefs))
     {
-        /* Setup the header */
-        memset(&BlkMap, 0, sizeof(VciBlkMap));
-
-        BlkMap.u32Magic         = RT_H2LE_U32(VCI_BLKMAP_MAGIC);
-        BlkMap.u32Version       = RT_H2LE_U32(VCI_BLKMAP_VERSION);
-        BlkMap.cBlocks          = RT_H2LE_U32(pBlkMap->cBlocks);
-        BlkMap.cBlocksFree      = RT_H2LE_U32(pBlkMap->cBlocksFree);
-        BlkMap.cBlocksAllocMeta = RT_H2LE_U32(pBlkMap->cBlocksAllocMeta);
-        BlkMap.cBlocksAllocData = RT_H2LE_U32(pBlkMap->cBlocksAllocData);
-
-        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                    &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
-        if (RT_SUCCESS(rc))
-        {
-            uint8_t abBitmapBuffer[16*_1K];
-            unsigned iBit = 0;
-            PVCIBLKRANGEDESC pCur = pBlkMap->pRangesHead;
+        rc = pXfer->rcReq;
+        vciXferProcess(pCache, pXfer);
+    }
+    else if (RT_SUCCESS(rc))
+        rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
 
-            offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
+    return rc;
+}
 
-            /* Write the descriptor ranges. */
-            while (pCur)
-            {
-                uint64_t cBlocks = pCur->cBlocks;
+/**
+ * Issues a guest data transfer between the I/O context and the given blocks
+ * of the slot.
+ *
+ * @returns VBox status code, VINF_SUCCESS if the I/O completed or is in flight.
+ */
+static int vciXferUser(PVCICACHE pCache, PVCIXFER pXfer, PVDIOCTX pIoCtx)
+{
+    uint64_t uOffset = vciSlotOffset(pCache, pXfer->pSlot, pXfer->iBlock);
+    size_t cbXfer = VCI_BLOCK2BYTE(pXfer->cBlocks);
+    int rc;
 
-                while (cBlocks)
-                {
-                    uint64_t cBlocksMax = RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
-
-                    if (pCur->fFree)
-                        ASMBitClearRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-                    else
-                        ASMBitSetRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-
-                    iBit    += cBlocksMax;
-                    cBlocks -= cBlocksMax;
-
-                    if (iBit == sizeof(abBitmapBuffer) * 8)
-                    {
-                        /* Buffer is full, write to file and reset. */
-                        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                                    offBlkMap, abBitmapBuffer,
-                                                    VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)));
-                        if (RT_FAILURE(rc))
-                            break;
-
-                        offBlkMap += VCI_BYTE2BLOCK(sizeof(abBitmapBuffer));
-                        iBit = 0;
-                    }
-                }
+    ASMAtomicIncU32(&pXfer->cRefs);
+    if (pXfer->enmType == VCIXFERTYPE_READ)
+        rc = vdIfIoIntFileReadUserEx(pCache->pIfIo, pCache->pStorage, uOffset,
+                                     pIoCtx, cbXfer, vciXferDone, pXfer);
+    else
+        rc = vdIfIoIntFileWriteUser(pCache->pIfIo, pCache->pStorage, uOffset,
+                                    pIoCtx, cbXfer, vciXferDone, pXfer);
+    if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        rc = VINF_SUCCESS;
+    else
+        ASMAtomicDecU32(&pXfer->cRefs);
 
-                pCur = pCur->pNext;
-            }
+    return rc;
+}
 
-            Assert(iBit % 8 == 0);
+/**
+ * Writes metadata as part of a commit. Without an I/O context the write is
+ * synchronous.
+ *
+ * @returns VBox status code, VINF_SUCCESS if the I/O completed or is in flight.
+ */
+static int vciXferMetaWrite(PVCICACHE pCache, PVCIXFER pXfer, PVDIOCTX pIoCtx,
+                            uint64_t uOffset, void *pvBuf, size_t cbBuf)
+{
+    if (!pIoCtx || !pXfer)
+        return vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, uOffset, pvBuf, cbBuf);
 
-            if (RT_SUCCESS(rc) && iBit)
-                rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                            offBlkMap, abBitmapBuffer, VCI_BYTE2BLOCK(iBit / 8));
-        }
-    }
+    ASMAtomicIncU32(&pXfer->cRefs);
+    int rc = vdIfIoIntFileWriteMeta(pCache->pIfIo, pCache->pStorage, uOffset, pvBuf, cbBuf,
+                                    pIoCtx, vciXferDone, pXfer);
+    if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        rc = VINF_SUCCESS;
     else
-        rc = VERR_INTERNAL_ERROR; /* @todo Better error code. */
+        ASMAtomicDecU32(&pXfer->cRefs);
 
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
 /**
- * Finds the range block describing the given block address.
+ * Flushes the image as part of a commit. Without an I/O context the flush is
+ * synchronous. A flush orders all writes issued before it against all
+ * writes issued after it.
  *
- * @returns Pointer to the block range descriptor or NULL if none could be found.
- * @param   pBlkMap         The block bitmap to search on.
- * @param   offBlockAddr    The block address to search for.
+ * @returns VBox status code, VINF_SUCCESS if the I/O completed or is in flight.
  */
-static PVCIBLKRANGEDESC vciBlkMapFindByBlock(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr)
+static int vciXferFlush(PVCICACHE pCache, PVCIXFER pXfer, PVDIOCTX pIoCtx)
 {
-    PVCIBLKRANGEDESC pBlk = pBlkMap->pRangesHead;
+    if (!pIoCtx || !pXfer)
+        return vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
 
-    while (   pBlk
-           && pBlk->offAddrStart < offBlockAddr)
-        pBlk = pBlk->pNext;
+    ASMAtomicIncU32(&pXfer->cRefs);
+    int rc = vdIfIoIntFileFlush(pCache->pIfIo, pCache->pStorage, pIoCtx, vciXferDone, pXfer);
+    if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        rc = VINF_SUCCESS;
+    else
+        ASMAtomicDecU32(&pXfer->cRefs);
 
-    return pBlk;
+    return rc;
 }
 
 /**
- * Allocates the given number of blocks in the bitmap and returns the start block address.
+ * Creates a commit recording the current dirty state of all slots on the
+ * journal list and empties the list.
  *
- * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocks          How many blocks to allocate.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * @returns Pointer to the commit transfer or NULL if out of memory.
+ * @param   pCache          The cache instance.
+ * @param   fCheckpoint     Flag whether the commit is a checkpoint.
  */
-static int vciBlkMapAllocate(PVCIBLKMAP pBlkMap, uint32_t cBlocks, uint32_t fFlags,
-                             uint64_t *poffBlockAddr)
+static PVCIXFER vciCommitAlloc(PVCICACHE pCache, bool fCheckpoint)
 {
-    PVCIBLKRANGEDESC pBestFit = NULL;
-    PVCIBLKRANGEDESC pCur = NULL;
-    int rc = VINF_SUCCESS;
+    PVCISLOT pSlot, pSlotNext;
+    uint32_t cRecords = 0;
+
+    RTListForEach(&pCache->ListJournal, pSlot, VCISLOT, NodeJournal)
+        cRecords++;
 
-    LogFlowFunc(("pBlkMap=%#p cBlocks=%u poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocks, poffBlockAddr));
+    PVCIXFER pXfer = vciXferAlloc(VCIXFERTYPE_COMMIT, cRecords);
+    if (!pXfer)
+        return NULL;
 
-    pCur = pBlkMap->pRangesHead;
+    pXfer->u64Commit   = pCache->u64CommitNext++;
+    pXfer->fCheckpoint = fCheckpoint;
 
-    while (pCur)
+    RTListForEachSafe(&pCache->ListJournal, pSlot, pSlotNext, VCISLOT, NodeJournal)
     {
-        if (   pCur->fFree
-            && pCur->cBlocks >= cBlocks)
-        {
-            if (   !pBestFit
-                || pCur->cBlocks < pBestFit->cBlocks)
-            {
-                pBestFit = pCur;
-                /* Stop searching if the size is matching exactly. */
-                if (pBestFit->cBlocks == cBlocks)
-                    break;
-            }
-        }
-        pCur = pCur->pNext;
+        PVCICOMMITREC pRec = &pXfer->aRecords[pXfer->cRecords++];
+        uint32_t idxSlot = (uint32_t)(pSlot - pCache->paSlots);
+
+        pRec->idxSlot      = idxSlot;
+        pRec->u64BlockDisk =   vciBitmapIsEmpty(pSlot->au32Dirty)
+                             ? VCI_SLOT_ENTRY_FREE
+                             : pSlot->Core.Key;
+        memcpy(pRec->au32Dirty, pSlot->au32Dirty, sizeof(pRec->au32Dirty));
+
+        memcpy(pSlot->au32DirtyLogged, pRec->au32Dirty, sizeof(pSlot->au32DirtyLogged));
+        pSlot->u64BlockLogged  = pRec->u64BlockDisk;
+        pSlot->u64CommitLogged = pXfer->u64Commit;
+        ASMBitSet(pCache->pbmTableDirty, idxSlot / VCI_SLOT_ENTRIES_PER_BLOCK);
+        RTListNodeRemove(&pSlot->NodeJournal);
+        pSlot->fJournalPending = false;
     }
 
-    Assert(!pBestFit || pBestFit->fFree);
+    return pXfer;
+}
 
-    if (pBestFit)
-    {
-        pBestFit->fFree = false;
+/**
+ * Writes the header.
+ *
+ * @returns VBox status code.
+ * @param   pCache          The cache instance.
+ * @param   fUnclean        Value of the unclean shutdown flag.
+ * @param   pXfer           The commit the write belongs to, optional.
+ * @param   pIoCtx          The I/O context for an asynchronous write, optional.
+ */
+static int vciHdrWrite(PVCICACHE pCache, bool fUnclean, PVCIXFER pXfer, PVDIOCTX pIoCtx)
+{
+    VciHdr Hdr;
 
-        if (pBestFit->cBlocks > cBlocks)
+    memset(&Hdr, 0, sizeof(Hdr));
+    Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
+    Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
+    Hdr.cBlocksCache     = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->cbSize));
+    Hdr.fUncleanShutdown = fUnclean ? VCI_HDR_UNCLEAN_SHUTDOWN : VCI_HDR_CLEAN_SHUTDOWN;
+    Hdr.u32CacheType     = RT_H2LE_U32(pCache->u32CacheType);
+    Hdr.offSlotTable     = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->offSlotTable));
+    Hdr.offJournal       = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->offJournal));
+    Hdr.cJournalBlocks   = RT_H2LE_U32(pCache->cJournalBlocks);
+    Hdr.offData          = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->offData));
+    Hdr.cSlots           = RT_H2LE_U32(pCache->cSlots);
+    Hdr.cSlotBlocks      = RT_H2LE_U32(VCI_SLOT_BLOCKS);
+    Hdr.idxJournalHead   = RT_H2LE_U32(pCache->idxJournalHead);
+    Hdr.u64JournalSeq    = RT_H2LE_U64(pCache->u64JournalSeqHead);
+
+    return vciXferMetaWrite(pCache, pXfer, pIoCtx, 0, &Hdr, sizeof(Hdr));
+}
+
+/**
+ * Writes the marked blocks of the slot table.
+ *
+ * @returns VBox status code.
+ * @param   pCache          The cache instance.
+ * @param   fClean          Flag whether the complete in memory state is written
+ *                          for a clean shutdown instead of the logged state.
+ * @param   pXfer           The commit the write belongs to, optional.
+ * @param   pIoCtx          The I/O context for asynchronous writes, optional.
+ */
+static int vciSlotTableWrite(PVCICACHE pCache, bool fClean, PVCIXFER pXfer, PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    uint32_t cTableBlocks = RT_ALIGN_32(pCache->cSlots, VCI_SLOT_ENTRIES_PER_BLOCK) / VCI_SLOT_ENTRIES_PER_BLOCK;
+    PVciSlotEntry paEntries = (PVciSlotEntry)pCache->pbBuf;
+    uint32_t cBlocksPerChunk = VCI_SLOT_SIZE / VCI_BLOCK_SIZE;
+
+    if (fClean)
+        ASMBitSetRange(pCache->pbmTableDirty, 0, cTableBlocks);
+
+    int idxBlock = ASMBitFirstSet(pCache->pbmTableDirty, RT_ALIGN_32(cTableBlocks, 32));
+    while (   idxBlock != -1
+           && RT_SUCCESS(rc))
+    {
+        /* Write a run of consecutive marked blocks in one go. */
+        uint32_t cBlocks = 0;
+        while (   (uint32_t)idxBlock + cBlocks < cTableBlocks
+               && cBlocks < cBlocksPerChunk
+               && ASMBitTest(pCache->pbmTableDirty, idxBlock + cBlocks))
         {
-            /* Create a new free block. */
-            PVCIBLKRANGEDESC pFree = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+            uint32_t idxSlotFirst = (idxBlock + cBlocks) * VCI_SLOT_ENTRIES_PER_BLOCK;
 
-            if (pFree)
-            {
-                pFree->fFree = true;
-                pFree->cBlocks = pBestFit->cBlocks - cBlocks;
-                pBestFit->cBlocks -= pFree->cBlocks;
-                pFree->offAddrStart = pBestFit->offAddrStart + cBlocks;
-
-                /* Link into the list. */
-                pFree->pNext = pBestFit->pNext;
-                pBestFit->pNext = pFree;
-                pFree->pPrev    = pBestFit;
-                if (!pFree->pNext)
-                    pBlkMap->pRangesTail = pFree;
-
-                *poffBlockAddr = pBestFit->offAddrStart;
-            }
-            else
+            for (uint32_t i = 0; i < VCI_SLOT_ENTRIES_PER_BLOCK; i++)
             {
-                rc = VERR_NO_MEMORY;
-                pBestFit->fFree = true;
+                PVciSlotEntry pEntry = &paEntries[cBlocks * VCI_SLOT_ENTRIES_PER_BLOCK + i];
+
+                if (idxSlotFirst + i < pCache->cSlots)
+                    vciSlotEntryFromSlot(&pCache->paSlots[idxSlotFirst + i], pEntry, fClean);
+                else
+                {
+                    memset(pEntry, 0, sizeof(*pEntry));
+                    pEntry->u64BlockDisk = RT_H2LE_U64(VCI_SLOT_ENTRY_FREE);
+                }
             }
+
+            cBlocks++;
         }
-    }
-    else
-        rc = VERR_VCI_NO_BLOCKS_FREE;
 
-    if (RT_SUCCESS(rc))
-    {
-        if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-            pBlkMap->cBlocksAllocMeta += cBlocks;
-        else
-            pBlkMap->cBlocksAllocData += cBlocks;
+        rc = vciXferMetaWrite(pCache, pXfer, pIoCtx,
+                              pCache->offSlotTable + VCI_BLOCK2BYTE(idxBlock),
+                              paEntries, VCI_BLOCK2BYTE(cBlocks));
+        if (RT_SUCCESS(rc))
+            ASMBitClearRange(pCache->pbmTableDirty, idxBlock, idxBlock + cBlocks);
 
-        pBlkMap->cBlocksFree -= cBlocks;
+        if ((uint32_t)idxBlock + cBlocks >= cTableBlocks)
+            break;
+        idxBlock = ASMBitNextSet(pCache->pbmTableDirty, RT_ALIGN_32(cTableBlocks, 32), idxBlock + cBlocks - 1);
     }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
     return rc;
 }
 
 /**
- * Try to extend the space of an already allocated block.
+ * Makes the queued dirty state of all slots durable by writing the slot table,
+ * resetting the journal.
  *
  * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocksNew       How many blocks the extended block should have.
- * @param   offBlockAddrOld  The start address of the block to reallocate.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if the I/O is still in flight.
+ * @param   pCache          The cache instance.
+ * @param   pIoCtx          The I/O context for asynchronous I/O, optional.
  */
-static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t offBlockAddrOld,
-                            uint64_t *poffBlockAddr)
+static int vciCheckpoint(PVCICACHE pCache, PVDIOCTX pIoCtx)
 {
-    int rc = VINF_SUCCESS;
+    PVCIXFER pXfer = vciCommitAlloc(pCache, true /* fCheckpoint */);
+    if (!pXfer)
+        return VERR_NO_MEMORY;
 
-    LogFlowFunc(("pBlkMap=%#p cBlocksNew=%u offBlockAddrOld=%llu poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr));
-
-    AssertMsgFailed(("Implement\n"));
+    /* The data the new state refers to must be on the disk first. */
+    int rc = vciXferFlush(pCache, pXfer, pIoCtx);
+    if (RT_SUCCESS(rc))
+        rc = vciSlotTableWrite(pCache, false /* fClean */, pXfer, pIoCtx);
+    if (RT_SUCCESS(rc))
+        rc = vciXferFlush(pCache, pXfer, pIoCtx);
+    if (RT_SUCCESS(rc))
+    {
+        /* Start the journal from scratch where we are now. */
+        pCache->idxJournalHead =   (pCache->idxJournalHead + (pCache->u64JournalSeqNext - pCache->u64JournalSeqHead))
+                                 % pCache->cJournalBlocks;
+        pCache->u64JournalSeqHead = pCache->u64JournalSeqNext;
+        pCache->fCheckpointNeeded = false;
+        rc = vciHdrWrite(pCache, true /* fUnclean */, pXfer, pIoCtx);
+        if (RT_SUCCESS(rc))
+            rc = vciXferFlush(pCache, pXfer, pIoCtx);
+    }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
-    return rc;
+    return vciXferRelease(pCache, pXfer, rc);
 }
 
 /**
- * Frees a range of blocks.
+ * Writes journal records for all slots whose dirty state changed since the
+ * last commit and flushes the image.
  *
- * @returns nothing.
- * @param   pBlkMap          The block bitmap.
- * @param   offBlockAddr     Address of the first block to free.
- * @param   cBlocks          How many blocks to free.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
+ * The durable state of the slots is only updated after all I/O completed, a
+ * slot can't be reused before. Without an I/O context everything is done
+ * synchronously.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if the I/O is still in flight.
+ * @param   pCache          The cache instance.
+ * @param   pIoCtx          The I/O context for asynchronous I/O, optional.
  */
-static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cBlocks,
-                          uint32_t fFlags)
+static int vciJournalCommit(PVCICACHE pCache, PVDIOCTX pIoCtx)
 {
-    PVCIBLKRANGEDESC pBlk;
+    PVCISLOT pSlot, pSlotNext;
+    uint32_t cRecords = 0;
 
-    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%u\n",
-                 pBlkMap, offBlockAddr, cBlocks));
+    if (pCache->fCheckpointNeeded)
+        return vciCheckpoint(pCache, pIoCtx);
 
-    while (cBlocks)
+    /* Drop slots whose state didn't change in the end. */
+    RTListForEachSafe(&pCache->ListJournal, pSlot, pSlotNext, VCISLOT, NodeJournal)
     {
-        pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
-        AssertPtr(pBlk);
+        uint64_t u64Block = vciBitmapIsEmpty(pSlot->au32Dirty) ? VCI_SLOT_ENTRY_FREE : pSlot->Core.Key;
 
-        /* Easy case, the whole block is freed. */
-        if (   pBlk->offAddrStart == offBlockAddr
-            && pBlk->cBlocks <= cBlocks)
+        if (   u64Block == pSlot->u64BlockLogged
+            && !memcmp(pSlot->au32Dirty, pSlot->au32DirtyLogged, sizeof(pSlot->au32Dirty)))
         {
-            pBlk->fFree = true;
-            cBlocks      -= pBlk->cBlocks;
-            offBlockAddr += pBlk->cBlocks;
+            RTListNodeRemove(&pSlot->NodeJournal);
+            pSlot->fJournalPending = false;
+        }
+        else
+            cRecords++;
+    }
 
-            /* Check if it is possible to merge free blocks. */
-            if (   pBlk->pPrev
-                && pBlk->pPrev->fFree)
-            {
-                PVCIBLKRANGEDESC pBlkPrev = pBlk->pPrev;
+    if (!cRecords)
+        return vdIfIoIntFileFlush(pCache->pIfIo, pCache->pStorage, pIoCtx, NULL, NULL);
 
-                Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pBlk->offAddrStart);
-                pBlkPrev->cBlocks += pBlk->cBlocks;
-                pBlkPrev->pNext = pBlk->pNext;
-                if (pBlk->pNext)
-                    pBlk->pNext->pPrev = pBlkPrev;
-                else
-                    pBlkMap->pRangesTail = pBlkPrev;
+    uint32_t cBlocksNeeded = (cRecords + VCI_JOURNAL_ENTRIES_PER_BLOCK - 1) / VCI_JOURNAL_ENTRIES_PER_BLOCK;
+    uint32_t cBlocksUsed = (uint32_t)(pCache->u64JournalSeqNext - pCache->u64JournalSeqHead);
 
-                RTMemFree(pBlk);
-                pBlk = pBlkPrev;
-            }
+    if (   cBlocksUsed + cBlocksNeeded > pCache->cJournalBlocks
+        || cBlocksNeeded > VCI_SLOT_SIZE / VCI_BLOCK_SIZE)
+        return vciCheckpoint(pCache, pIoCtx);
 
-            /* Now the one to the right. */
-            if (   pBlk->pNext
-                && pBlk->pNext->fFree)
-            {
-                PVCIBLKRANGEDESC pBlkNext = pBlk->pNext;
+    PVCIXFER pXfer = vciCommitAlloc(pCache, false /* fCheckpoint */);
+    if (!pXfer)
+        return VERR_NO_MEMORY;
+    Assert(pXfer->cRecords == cRecords);
 
-                Assert(pBlk->offAddrStart + pBlk->cBlocks == pBlkNext->offAddrStart);
-                pBlk->cBlocks += pBlkNext->cBlocks;
-                pBlk->pNext = pBlkNext->pNext;
-                if (pBlkNext->pNext)
-                    pBlkNext->pNext->pPrev = pBlk;
-                else
-                    pBlkMap->pRangesTail = pBlk;
+    /* The data must hit the disk before the records describing it. */
+    int rc = vciXferFlush(pCache, pXfer, pIoCtx);
+    if (RT_FAILURE(rc))
+        return vciXferRelease(pCache, pXfer, rc);
 
-                RTMemFree(pBlkNext);
-            }
+    PVciJournalBlock paBlocks = (PVciJournalBlock)pCache->pbBuf;
+    uint32_t idxBlock = 0;
+
+    memset(paBlocks, 0, VCI_BLOCK2BYTE(cBlocksNeeded));
+    for (uint32_t i = 0; i < pXfer->cRecords; i++)
+    {
+        PVCICOMMITREC pRec = &pXfer->aRecords[i];
+        PVciJournalBlock pBlock = &paBlocks[idxBlock];
+        PVciJournalEntry pEntry = &pBlock->aEntries[pBlock->cEntries++];
+
+        pEntry->idxSlot      = RT_H2LE_U32(pRec->idxSlot);
+        pEntry->u64BlockDisk = RT_H2LE_U64(pRec->u64BlockDisk);
+        memcpy(pEntry->abDirty, pRec->au32Dirty, sizeof(pEntry->abDirty));
+
+        if (pBlock->cEntries == VCI_JOURNAL_ENTRIES_PER_BLOCK)
+            idxBlock++;
+    }
+
+    for (uint32_t i = 0; i < cBlocksNeeded; i++)
+    {
+        PVciJournalBlock pBlock = &paBlocks[i];
+
+        pBlock->u32Magic = RT_H2LE_U32(VCI_JOURNAL_MAGIC);
+        pBlock->u64Seq   = RT_H2LE_U64(pCache->u64JournalSeqNext + i);
+        pBlock->cEntries = RT_H2LE_U32(pBlock->cEntries);
+        pBlock->u32Crc   = 0;
+        pBlock->u32Crc   = RT_H2LE_U32(RTCrc32(pBlock, sizeof(*pBlock)));
+    }
+
+    /*
+     * Write the blocks, wrapping around at the end of the journal. The space
+     * is claimed right away, later commits might be issued before this one
+     * completes.
+     */
+    uint32_t idxPos = (pCache->idxJournalHead + cBlocksUsed) % pCache->cJournalBlocks;
+    uint32_t cBlocksFirst = RT_MIN(cBlocksNeeded, pCache->cJournalBlocks - idxPos);
+
+    pCache->u64JournalSeqNext += cBlocksNeeded;
+    rc = vciXferMetaWrite(pCache, pXfer, pIoCtx,
+                          pCache->offJournal + VCI_BLOCK2BYTE(idxPos),
+                          paBlocks, VCI_BLOCK2BYTE(cBlocksFirst));
+    if (   RT_SUCCESS(rc)
+        && cBlocksFirst < cBlocksNeeded)
+        rc = vciXferMetaWrite(pCache, pXfer, pIoCtx, pCache->offJournal,
+                              &paBlocks[cBlocksFirst],
+                              VCI_BLOCK2BYTE(cBlocksNeeded - cBlocksFirst));
+    if (RT_SUCCESS(rc))
+        rc = vciXferFlush(pCache, pXfer, pIoCtx);
+
+    return vciXferRelease(pCache, pXfer, rc);
+}
+
+/**
+ * Applies a journal record during recovery.
+ */
+static int vciJournalReplayEntry(PVCICACHE pCache, PVciJournalEntry pEntry)
+{
+    uint32_t idxSlot = RT_LE2H_U32(pEntry->idxSlot);
+    uint64_t u64BlockDisk = RT_LE2H_U64(pEntry->u64BlockDisk);
+
+    if (idxSlot >= pCache->cSlots)
+        return VERR_VD_GEN_INVALID_HEADER;
+
+    PVCISLOT pSlot = &pCache->paSlots[idxSlot];
+
+    RT_ZERO(pSlot->au32Dirty);
+    vciSlotDirtyUpdate(pCache, pSlot);
+    vciSlotUnmap(pCache, pSlot);
+    RT_ZERO(pSlot->au32DirtyDurable);
+    RT_ZERO(pSlot->au32DirtyLogged);
+    pSlot->u64BlockDurable = VCI_SLOT_ENTRY_FREE;
+    pSlot->u64BlockLogged  = VCI_SLOT_ENTRY_FREE;
+
+    if (u64BlockDisk != VCI_SLOT_ENTRY_FREE)
+    {
+        /* A block can only live in one slot, drop any stale mapping. */
+        PVCISLOT pSlotOld = (PVCISLOT)RTAvlrU64Get(&pCache->TreeSlots, u64BlockDisk);
+        if (pSlotOld)
+        {
+            RT_ZERO(pSlotOld->au32Dirty);
+            RT_ZERO(pSlotOld->au32DirtyDurable);
+            RT_ZERO(pSlotOld->au32DirtyLogged);
+            pSlotOld->u64BlockDurable = VCI_SLOT_ENTRY_FREE;
+            pSlotOld->u64BlockLogged  = VCI_SLOT_ENTRY_FREE;
+            vciSlotDirtyUpdate(pCache, pSlotOld);
+            vciSlotUnmap(pCache, pSlotOld);
         }
-        else
+
+        memcpy(pSlot->au32Dirty, pEntry->abDirty, sizeof(pSlot->au32Dirty));
+        if (!vciBitmapIsEmpty(pSlot->au32Dirty))
         {
-            /* The block is intersecting. */
-            AssertMsgFailed(("TODO\n"));
+            memcpy(pSlot->au32Valid, pSlot->au32Dirty, sizeof(pSlot->au32Valid));
+            memcpy(pSlot->au32DirtyDurable, pSlot->au32Dirty, sizeof(pSlot->au32DirtyDurable));
+            memcpy(pSlot->au32DirtyLogged, pSlot->au32Dirty, sizeof(pSlot->au32DirtyLogged));
+            pSlot->u64BlockDurable = u64BlockDisk;
+            pSlot->u64BlockLogged  = u64BlockDisk;
+            vciSlotMap(pCache, pSlot, u64BlockDisk);
+            vciSlotDirtyUpdate(pCache, pSlot);
         }
     }
 
-    if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-        pBlkMap->cBlocksAllocMeta -= cBlocks;
-    else
-        pBlkMap->cBlocksAllocData -= cBlocks;
+    return VINF_SUCCESS;
+}
 
-    pBlkMap->cBlocksFree += cBlocks;
+/**
+ * Replays the journal after an unclean shutdown.
+ *
+ * @returns VBox status code.
+ * @param   pCache          The cache instance.
+ */
+static int vciJournalReplay(PVCICACHE pCache)
+{
+    int rc = VINF_SUCCESS;
+    uint32_t idxPos = pCache->idxJournalHead;
+    uint64_t u64Seq = pCache->u64JournalSeqHead;
+    VciJournalBlock Block;
 
-    LogFlowFunc(("returns\n"));
+    for (uint32_t i = 0; i < pCache->cJournalBlocks && RT_SUCCESS(rc); i++)
+    {
+        rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
+                                   pCache->offJournal + VCI_BLOCK2BYTE(idxPos),
+                                   &Block, sizeof(Block));
+        if (RT_FAILURE(rc))
+            break;
+
+        uint32_t u32Crc = RT_LE2H_U32(Block.u32Crc);
+        Block.u32Crc = 0;
+        if (   RT_LE2H_U32(Block.u32Magic) != VCI_JOURNAL_MAGIC
+            || RT_LE2H_U64(Block.u64Seq) != u64Seq
+            || RT_LE2H_U32(Block.cEntries) > VCI_JOURNAL_ENTRIES_PER_BLOCK
+            || RTCrc32(&Block, sizeof(Block)) != u32Crc)
+            break; /* End of the journal. */
+
+        for (uint32_t iEntry = 0; iEntry < RT_LE2H_U32(Block.cEntries) && RT_SUCCESS(rc); iEntry++)
+            rc = vciJournalReplayEntry(pCache, &Block.aEntries[iEntry]);
+
+        u64Seq++;
+        idxPos = (idxPos + 1) % pCache->cJournalBlocks;
+    }
+
+    LogRel(("VCI: Replayed %llu journal blocks of '%s', %u slots hold dirty data\n",
+            u64Seq - pCache->u64JournalSeqHead, pCache->pszFilename, pCache->cSlotsDirty));
+
+    pCache->u64JournalSeqNext = u64Seq;
+    return rc;
 }
 
 /**
- * Converts a tree node from the image to the in memory structure.
+ * Loads the slot table and rebuilds the in memory state.
  *
- * @returns Pointer to the in memory tree node.
- * @param   offBlockAddrNode    Block address of the node.
- * @param   pNodeImage          Pointer to the image representation of the node.
+ * @returns VBox status code.
+ * @param   pCache          The cache instance.
+ * @param   fClean          Flag whether the cache was closed cleanly.
  */
-static PVCITREENODE vciTreeNodeImage2Host(uint64_t offBlockAddrNode, PVciTreeNode pNodeImage)
+static int vciSlotTableLoad(PVCICACHE pCache, bool fClean)
 {
-    PVCITREENODE pNode = NULL;
+    int rc = VINF_SUCCESS;
+    uint32_t cTableBlocks = RT_ALIGN_32(pCache->cSlots, VCI_SLOT_ENTRIES_PER_BLOCK) / VCI_SLOT_ENTRIES_PER_BLOCK;
+    uint32_t cBlocksPerChunk = VCI_SLOT_SIZE / VCI_BLOCK_SIZE;
+    PVciSlotEntry paEntries = (PVciSlotEntry)pCache->pbBuf;
 
-    if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_LEAF)
+    for (uint32_t idxBlock = 0; idxBlock < cTableBlocks && RT_SUCCESS(rc); idxBlock += cBlocksPerChunk)
     {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)RTMemAllocZ(sizeof(VCITREENODELEAF));
+        uint32_t cBlocks = RT_MIN(cBlocksPerChunk, cTableBlocks - idxBlock);
 
-        if (pLeaf)
+        rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
+                                   pCache->offSlotTable + VCI_BLOCK2BYTE(idxBlock),
+                                   paEntries, VCI_BLOCK2BYTE(cBlocks));
+        if (RT_FAILURE(rc))
+            break;
+
+        for (uint32_t i = 0; i < cBlocks * VCI_SLOT_ENTRIES_PER_BLOCK; i++)
         {
-            PVciCacheExtent pExtent = (PVciCacheExtent)&pNodeImage->au8Data[0];
+            uint32_t idxSlot = idxBlock * VCI_SLOT_ENTRIES_PER_BLOCK + i;
+            PVciSlotEntry pEntry = &paEntries[i];
+            uint64_t u64BlockDisk = RT_LE2H_U64(pEntry->u64BlockDisk);
+
+            if (idxSlot >= pCache->cSlots)
+                break;
+            if (u64BlockDisk == VCI_SLOT_ENTRY_FREE)
+                continue;
+
+            PVCISLOT pSlot = &pCache->paSlots[idxSlot];
 
-            pLeaf->Core.u8Type = VCI_TREE_NODE_TYPE_LEAF;
+            /* Clean data is only trusted after a clean shutdown. */
+            memcpy(pSlot->au32Dirty, pEntry->abDirty, sizeof(pSlot->au32Dirty));
+            if (fClean)
+                memcpy(pSlot->au32Valid, pEntry->abValid, sizeof(pSlot->au32Valid));
+            else
+                memcpy(pSlot->au32Valid, pEntry->abDirty, sizeof(pSlot->au32Valid));
+
+            if (vciBitmapIsEmpty(pSlot->au32Valid))
+            {
+                RT_ZERO(pSlot->au32Dirty);
+                continue;
+            }
+
+            if (RTAvlrU64Get(&pCache->TreeSlots, u64BlockDisk))
+            {
+                rc = vdIfError(pCache->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                               N_("VCI: disk block %llu is cached twice in '%s'"),
+                               u64BlockDisk, pCache->pszFilename);
+                break;
+            }
 
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pLeaf->aExtents); idx++)
+            vciSlotMap(pCache, pSlot, u64BlockDisk);
+            pSlot->fReferenced = false;
+            if (!vciBitmapIsEmpty(pSlot->au32Dirty))
             {
-                pLeaf->aExtents[idx].u64BlockOffset = RT_LE2H_U64(pExtent->u64BlockOffset);
-                pLeaf->aExtents[idx].u32Blocks      = RT_LE2H_U32(pExtent->u32Blocks);
-                pLeaf->aExtents[idx].u64BlockAddr   = RT_LE2H_U64(pExtent->u64BlockAddr);
-                pExtent++;
-
-                if (   pLeaf->aExtents[idx].u32Blocks
-                    && pLeaf->aExtents[idx].u64BlockAddr)
-                    pLeaf->cUsedNodes++;
+                memcpy(pSlot->au32DirtyDurable, pSlot->au32Dirty, sizeof(pSlot->au32DirtyDurable));
+                memcpy(pSlot->au32DirtyLogged, pSlot->au32Dirty, sizeof(pSlot->au32DirtyLogged));
+                pSlot->u64BlockDurable = u64BlockDisk;
+                pSlot->u64BlockLogged  = u64BlockDisk;
+                vciSlotDirtyUpdate(pCache, pSlot);
             }
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Reads the configuration of the write-back mode.
+ */
+static void vciConfigLoad(PVCICACHE pCache)
+{
+    PVDINTERFACECONFIG pIfConfig = VDIfConfigGet(pCache->pVDIfsImage);
+    bool fWriteBack = false;
+    uint32_t uLowWater = 10;
+    uint32_t uHighWater = 75;
+    uint32_t cMsMaxAge = 30000;
 
-            pNode = &pLeaf->Core;
-        }
-    }
-    else if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
+    if (pIfConfig)
     {
-        PVCITREENODEINT pInt = (PVCITREENODEINT)RTMemAllocZ(sizeof(VCITREENODEINT));
-
-        if (pInt)
+        int rc = VDCFGQueryBoolDef(pIfConfig, VCI_CFG_WRITE_BACK, &fWriteBack, false);
+        if (RT_SUCCESS(rc))
+            rc = VDCFGQueryU32Def(pIfConfig, VCI_CFG_DIRTY_LOW_WATER, &uLowWater, 10);
+        if (RT_SUCCESS(rc))
+            rc = VDCFGQueryU32Def(pIfConfig, VCI_CFG_DIRTY_HIGH_WATER, &uHighWater, 75);
+        if (RT_SUCCESS(rc))
+            rc = VDCFGQueryU32Def(pIfConfig, VCI_CFG_DIRTY_MAX_AGE, &cMsMaxAge, 30000);
+        if (   RT_FAILURE(rc)
+            || uHighWater > 100
+            || uLowWater > uHighWater)
         {
-            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNodeImage->au8Data[0];
-
-            pInt->Core.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
-
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pInt->aIntNodes); idx++)
-            {
-                pInt->aIntNodes[idx].u64BlockOffset              = RT_LE2H_U64(pIntImage->u64BlockOffset);
-                pInt->aIntNodes[idx].u32Blocks                   = RT_LE2H_U32(pIntImage->u32Blocks);
-                pInt->aIntNodes[idx].PtrChild.fInMemory          = false;
-                pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode = RT_LE2H_U64(pIntImage->u64ChildAddr);
-                pIntImage++;
-
-                if (   pInt->aIntNodes[idx].u32Blocks
-                    && pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode)
-                    pInt->cUsedNodes++;
-            }
-
-            pNode = &pInt->Core;
+            LogRel(("VCI: Invalid write-back configuration for '%s' (%Rrc), using defaults\n",
+                    pCache->pszFilename, rc));
+            fWriteBack = false;
+            uLowWater  = 10;
+            uHighWater = 75;
+            cMsMaxAge  = 30000;
         }
     }
-    else
-        AssertMsgFailed(("Invalid node type %d\n", pNodeImage->u8Type));
 
-    if (pNode)
-        pNode->u64BlockAddr = offBlockAddrNode;
-
-    return pNode;
+    pCache->fWriteBack      = fWriteBack;
+    pCache->uDirtyLowWater  = uLowWater;
+    pCache->uDirtyHighWater = uHighWater;
+    pCache->cMsDirtyMaxAge  = cMsMaxAge;
 }
 
 /**
- * Looks up the cache extent for the given virtual block address.
- *
- * @returns Pointer to the cache extent or NULL if none could be found.
- * @param   pCache         The cache image instance.
- * @param   offBlockOffset The block offset to search for.
- * @param   ppNextBestFit  Where to store the pointer to the next best fit
- *                         cache extent above offBlockOffset if existing. - Optional
- *                         This is always filled if possible even if the function returns NULL.
+ * Internal. Flush image data to disk.
  */
-static PVCICACHEEXTENT vciCacheExtentLookup(PVCICACHE pCache, uint64_t offBlockOffset,
-                                            PVCICACHEEXTENT *ppNextBestFit)
+static int vciFlushImage(PVCICACHE pCache, PVDIOCTX pIoCtx)
 {
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent = NULL;
-    PVCITREENODE pNodeCur = pCache->pRoot;
 
-    while (   RT_SUCCESS(rc)
-           && pNodeCur
-           && pNodeCur->u8Type != VCI_TREE_NODE_TYPE_LEAF)
+    if (   pCache->pStorage
+        && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
     {
-        PVCITREENODEINT pNodeInt = (PVCITREENODEINT)pNodeCur;
+        vciLock(pCache);
+        rc = vciJournalCommit(pCache, pIoCtx);
+        vciUnlock(pCache);
+    }
 
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_INTERNAL);
+    return rc;
+}
 
-        /* Search for the correct internal node. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pNodeInt->cUsedNodes;
-        unsigned idxCur = pNodeInt->cUsedNodes / 2;
+/**
+ * Internal. Free all allocated space for representing an image except pCache,
+ * and optionally delete the image from disk.
+ */
+static int vciFreeImage(PVCICACHE pCache, bool fDelete)
+{
+    int rc = VINF_SUCCESS;
 
-        while (idxMin < idxMax)
+    /* Freeing a never allocated image (e.g. because the open failed) is
+     * not signalled as an error. After all nothing bad happens. */
+    if (pCache)
+    {
+        if (pCache->pStorage)
         {
-            PVCINODEINTERNAL pInt = &pNodeInt->aIntNodes[idxCur];
-
-            /* Determine the search direction. */
-            if (offBlockOffset < pInt->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pInt->u64BlockOffset + pInt->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
+            /* No point updating the file that is deleted anyway. */
+            if (   !fDelete
+                && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+                && pCache->paSlots)
             {
-                /* The block lies in the node, stop searching. */
-                if (pInt->PtrChild.fInMemory)
-                    pNodeCur = pInt->PtrChild.u.pNode;
-                else
+                /* Persist the complete state and mark the cache as cleanly closed. */
+                vciXfersProcessDone(pCache);
+                rc = vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
+                if (RT_SUCCESS(rc))
+                    rc = vciSlotTableWrite(pCache, true /* fClean */, NULL /* pXfer */, NULL /* pIoCtx */);
+                if (RT_SUCCESS(rc))
+                    rc = vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
+                if (RT_SUCCESS(rc))
                 {
-                    PVCITREENODE pNodeNew;
-                    VciTreeNode NodeTree;
-
-                    /* Read from disk and add to the tree. */
-                    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                               VCI_BLOCK2BYTE(pInt->PtrChild.u.offAddrBlockNode),
-                                               &NodeTree, sizeof(NodeTree));
-                    AssertRC(rc);
-
-                    pNodeNew = vciTreeNodeImage2Host(pInt->PtrChild.u.offAddrBlockNode, &NodeTree);
-                    if (pNodeNew)
-                    {
-                        /* Link to the parent. */
-                        pInt->PtrChild.fInMemory = true;
-                        pInt->PtrChild.u.pNode = pNodeNew;
-                        pNodeNew->pParent = pNodeCur;
-                        pNodeCur = pNodeNew;
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
+                    pCache->idxJournalHead = 0;
+                    pCache->u64JournalSeqHead = pCache->u64JournalSeqNext;
+                    rc = vciHdrWrite(pCache, false /* fUnclean */, NULL /* pXfer */, NULL /* pIoCtx */);
                 }
-                break;
+                if (RT_SUCCESS(rc))
+                    rc = vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
+
+                LogRel(("VCI: Statistics for '%s': %llu hits, %llu misses, %llu writes cached, %llu writes passed through, %llu ranges written back, %u slots dirty\n",
+                        pCache->pszFilename, pCache->cHits, pCache->cMisses, pCache->cWritesCached,
+                        pCache->cWritesPassed, pCache->cDestaged, pCache->cSlotsDirty));
             }
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
+            vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
+            pCache->pStorage = NULL;
         }
-    }
-
-    if (   RT_SUCCESS(rc)
-        && pNodeCur)
-    {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)pNodeCur;
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_LEAF);
 
-        /* Search the range. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pLeaf->cUsedNodes;
-        unsigned idxCur = pLeaf->cUsedNodes / 2;
+        if (fDelete && pCache->pszFilename)
+            vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
 
-        while (idxMin < idxMax)
+        if (pCache->paSlots)
+        {
+            RTMemFree(pCache->paSlots);
+            pCache->paSlots = NULL;
+        }
+        if (pCache->pbmTableDirty)
         {
-            PVCICACHEEXTENT pExtentCur = &pLeaf->aExtents[idxCur];
+            RTMemFree(pCache->pbmTableDirty);
+            pCache->pbmTableDirty = NULL;
+        }
+        if (pCache->pbBuf)
+        {
+            RTMemPageFree(pCache->pbBuf, VCI_SLOT_SIZE);
+            pCache->pbBuf = NULL;
+        }
+        if (RTCritSectIsInitialized(&pCache->CritSect))
+            RTCritSectDelete(&pCache->CritSect);
+    }
 
-            /* Determine the search direction. */
-            if (offBlockOffset < pExtentCur->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pExtentCur->u64BlockOffset + pExtentCur->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* We found the extent, stop searching. */
-                pExtent = pExtentCur;
-                break;
-            }
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
-        }
+/**
+ * Internal: Allocates the in memory state for the geometry in pCache.
+ */
+static int vciStateAlloc(PVCICACHE pCache)
+{
+    uint32_t cTableBlocks = RT_ALIGN_32(pCache->cSlots, VCI_SLOT_ENTRIES_PER_BLOCK) / VCI_SLOT_ENTRIES_PER_BLOCK;
 
-        /* Get the next best fit extent if it exists. */
-        if (ppNextBestFit)
-        {
-            if (idxCur < pLeaf->cUsedNodes - 1)
-                *ppNextBestFit = &pLeaf->aExtents[idxCur + 1];
-            else
-            {
-                /*
-                 * Go up the tree and find the best extent
-                 * in the leftmost tree of the child subtree to the right.
-                 */
-                PVCITREENODEINT pInt = (PVCITREENODEINT)pLeaf->Core.pParent;
+    int rc = RTCritSectInit(&pCache->CritSect);
+    if (RT_FAILURE(rc))
+        return rc;
 
-                while (pInt)
-                {
+    pCache->paSlots = (PVCISLOT)RTMemAllocZ(pCache->cSlots * sizeof(VCISLOT));
+    pCache->pbmTableDirty = (uint32_t *)RTMemAllocZ(RT_ALIGN_32(cTableBlocks, 32) / 8);
+    pCache->pbBuf = (uint8_t *)RTMemPageAlloc(VCI_SLOT_SIZE);
+    if (   !pCache->paSlots
+        || !pCache->pbmTableDirty
+        || !pCache->pbBuf)
+        return VERR_NO_MEMORY;
 
-                }
-            }
-        }
+    for (uint32_t i = 0; i < pCache->cSlots; i++)
+    {
+        pCache->paSlots[i].u64BlockDurable = VCI_SLOT_ENTRY_FREE;
+        pCache->paSlots[i].u64BlockLogged  = VCI_SLOT_ENTRY_FREE;
     }
 
-    return pExtent;
+    pCache->TreeSlots = NULL;
+    pCache->pXfersDone = NULL;
+    pCache->u64CommitNext = 1;
+    pCache->fCheckpointNeeded = false;
+    pCache->idxClock = 0;
+    pCache->cSlotsDirty = 0;
+    RTListInit(&pCache->ListDirty);
+    RTListInit(&pCache->ListJournal);
+    return VINF_SUCCESS;
 }
 
 /**
@@ -1230,47 +1596,95 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
     }
 
     rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr,
-                               VCI_BYTE2BLOCK(sizeof(Hdr)));
+                               sizeof(Hdr));
     if (RT_FAILURE(rc))
     {
         rc = VERR_VD_GEN_INVALID_HEADER;
         goto out;
     }
 
-    Hdr.u32Signature = RT_LE2H_U32(Hdr.u32Signature);
-    Hdr.u32Version   = RT_LE2H_U32(Hdr.u32Version);
-    Hdr.cBlocksCache = RT_LE2H_U64(Hdr.cBlocksCache);
-    Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
-    Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
-    Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
+    Hdr.u32Signature   = RT_LE2H_U32(Hdr.u32Signature);
+    Hdr.u32Version     = RT_LE2H_U32(Hdr.u32Version);
+    Hdr.cBlocksCache   = RT_LE2H_U64(Hdr.cBlocksCache);
+    Hdr.u32CacheType   = RT_LE2H_U32(Hdr.u32CacheType);
+    Hdr.offSlotTable   = RT_LE2H_U64(Hdr.offSlotTable);
+    Hdr.offJournal     = RT_LE2H_U64(Hdr.offJournal);
+    Hdr.cJournalBlocks = RT_LE2H_U32(Hdr.cJournalBlocks);
+    Hdr.offData        = RT_LE2H_U64(Hdr.offData);
+    Hdr.cSlots         = RT_LE2H_U32(Hdr.cSlots);
+    Hdr.cSlotBlocks    = RT_LE2H_U32(Hdr.cSlotBlocks);
+    Hdr.idxJournalHead = RT_LE2H_U32(Hdr.idxJournalHead);
+    Hdr.u64JournalSeq  = RT_LE2H_U64(Hdr.u64JournalSeq);
+
+    if (   Hdr.u32Signature != VCI_HDR_SIGNATURE
+        || Hdr.u32Version != VCI_HDR_VERSION)
+    {
+        rc = VERR_VD_GEN_INVALID_HEADER;
+        goto out;
+    }
 
-    if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
-        && Hdr.u32Version == VCI_HDR_VERSION)
+    if (   Hdr.cSlotBlocks != VCI_SLOT_BLOCKS
+        || !Hdr.cSlots
+        || !Hdr.cJournalBlocks
+        || Hdr.idxJournalHead >= Hdr.cJournalBlocks
+        || Hdr.offJournal < Hdr.offSlotTable + RT_ALIGN_32(Hdr.cSlots, VCI_SLOT_ENTRIES_PER_BLOCK) / VCI_SLOT_ENTRIES_PER_BLOCK
+        || Hdr.offData < Hdr.offJournal + Hdr.cJournalBlocks
+        || Hdr.offData + (uint64_t)Hdr.cSlots * VCI_SLOT_BLOCKS > Hdr.cBlocksCache)
     {
-        pCache->offTreeRoot   = Hdr.offTreeRoot;
-        pCache->offBlksBitmap = Hdr.offBlkMap;
+        rc = vdIfError(pCache->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       N_("VCI: inconsistent header in '%s'"), pCache->pszFilename);
+        goto out;
+    }
 
-        /* Load the block map. */
-        rc = vciBlkMapLoad(pCache, pCache->offBlksBitmap, Hdr.cBlkMap, &pCache->pBlkMap);
-        if (RT_SUCCESS(rc))
+    pCache->cbSize            = VCI_BLOCK2BYTE(Hdr.cBlocksCache);
+    pCache->u32CacheType      = Hdr.u32CacheType;
+    pCache->uImageFlags       =   Hdr.u32CacheType == VCI_HDR_CACHE_TYPE_FIXED
+                                ? VD_IMAGE_FLAGS_FIXED
+                                : VD_IMAGE_FLAGS_NONE;
+    pCache->offSlotTable      = VCI_BLOCK2BYTE(Hdr.offSlotTable);
+    pCache->offJournal        = VCI_BLOCK2BYTE(Hdr.offJournal);
+    pCache->cJournalBlocks    = Hdr.cJournalBlocks;
+    pCache->offData           = VCI_BLOCK2BYTE(Hdr.offData);
+    pCache->cSlots            = Hdr.cSlots;
+    pCache->idxJournalHead    = Hdr.idxJournalHead;
+    pCache->u64JournalSeqHead = Hdr.u64JournalSeq;
+    pCache->u64JournalSeqNext = Hdr.u64JournalSeq;
+
+    rc = vciStateAlloc(pCache);
+    if (RT_FAILURE(rc))
+        goto out;
+
+    vciConfigLoad(pCache);
+
+    rc = vciSlotTableLoad(pCache, Hdr.fUncleanShutdown == VCI_HDR_CLEAN_SHUTDOWN);
+    if (RT_FAILURE(rc))
+        goto out;
+
+    if (Hdr.fUncleanShutdown != VCI_HDR_CLEAN_SHUTDOWN)
+    {
+        rc = vciJournalReplay(pCache);
+        if (RT_FAILURE(rc))
         {
-            /* Load the first tree node. */
-            VciTreeNode RootNode;
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS,
+                           N_("VCI: cannot replay the journal of '%s'"), pCache->pszFilename);
+            goto out;
+        }
 
-            rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                       pCache->offTreeRoot, &RootNode,
-                                       VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
-            if (RT_SUCCESS(rc))
-            {
-                pCache->pRoot = vciTreeNodeImage2Host(pCache->offTreeRoot, &RootNode);
-                if (!pCache->pRoot)
-                    rc = VERR_NO_MEMORY;
-            }
+        if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        {
+            /* Rewrite the whole table, clean data was dropped. */
+            uint32_t cTableBlocks = RT_ALIGN_32(pCache->cSlots, VCI_SLOT_ENTRIES_PER_BLOCK) / VCI_SLOT_ENTRIES_PER_BLOCK;
+            ASMBitSetRange(pCache->pbmTableDirty, 0, cTableBlocks);
+            rc = vciCheckpoint(pCache, NULL /* pIoCtx */);
         }
     }
-    else
-        rc = VERR_VD_GEN_INVALID_HEADER;
+    else if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+    {
+        /* Anything from here on goes to the journal until the cache is closed. */
+        rc = vciHdrWrite(pCache, true /* fUnclean */, NULL /* pXfer */, NULL /* pIoCtx */);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
+    }
 
 out:
     if (RT_FAILURE(rc))
@@ -1287,8 +1701,6 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
                           void *pvUser, unsigned uPercentStart,
                           unsigned uPercentSpan)
 {
-    VciHdr Hdr;
-    VciTreeNode NodeRoot;
     int rc;
     uint64_t cBlocks = cbSize / VCI_BLOCK_SIZE; /* Size of the cache in blocks. */
 
@@ -1307,129 +1719,103 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
 
     do
     {
-        /* Create image file. */
-        rc = vdIfIoIntFileOpen(pCache->pIfIo, pCache->pszFilename,
-                               VDOpenFlagsToFileOpenFlags(uOpenFlags & ~VD_OPEN_FLAGS_READONLY,
-                                                          true /* fCreate */),
-                               &pCache->pStorage);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot create image '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        /* Allocate block bitmap. */
-        uint32_t cBlkMap = 0;
-        rc = vciBlkMapCreate(cBlocks, &pCache->pBlkMap, &cBlkMap);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot create block bitmap '%s'"), pCache->pszFilename);
-            break;
-        }
-
         /*
-         * Allocate space for the header in the block bitmap.
-         * Because the block map is empty the header has to start at block 0
+         * Layout: header, slot table, journal and the data slots aligned
+         * to the slot size. The journal gets 1/256th of the cache.
          */
-        uint64_t offHdr = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciHdr)), VCIBLKMAP_ALLOC_META, &offHdr);
-        if (RT_FAILURE(rc))
+        uint32_t cJournalBlocks = (uint32_t)RT_MIN(RT_MAX(cBlocks / 256, VCI_JOURNAL_BLOCKS_MIN),
+                                                   VCI_JOURNAL_BLOCKS_MAX);
+        uint64_t cBlocksMeta = VCI_BYTE2BLOCK(sizeof(VciHdr)) + cJournalBlocks + VCI_SLOT_BLOCKS;
+        uint64_t cSlots = cBlocks > cBlocksMeta
+                        ? (cBlocks - cBlocksMeta) * VCI_SLOT_ENTRIES_PER_BLOCK / (VCI_SLOT_BLOCKS * VCI_SLOT_ENTRIES_PER_BLOCK + 1)
+                        : 0;
+        uint64_t offSlotTable = VCI_BYTE2BLOCK(sizeof(VciHdr));
+        uint64_t offJournal, offData;
+
+        for (;;)
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for header in block bitmap '%s'"), pCache->pszFilename);
-            break;
-        }
+            uint64_t cTableBlocks = (cSlots + VCI_SLOT_ENTRIES_PER_BLOCK - 1) / VCI_SLOT_ENTRIES_PER_BLOCK;
 
-        Assert(offHdr == 0);
+            offJournal = offSlotTable + cTableBlocks;
+            offData    = RT_ALIGN_64(offJournal + cJournalBlocks, VCI_SLOT_BLOCKS);
+            if (   !cSlots
+                || offData + cSlots * VCI_SLOT_BLOCKS <= cBlocks)
+                break;
+            cSlots--;
+        }
 
-        /*
-         * Allocate space for the block map itself.
-         */
-        uint64_t offBlkMap = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, cBlkMap, VCIBLKMAP_ALLOC_META, &offBlkMap);
-        if (RT_FAILURE(rc))
+        if (   !cSlots
+            || cSlots > UINT32_MAX)
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, VERR_VD_INVALID_SIZE, RT_SRC_POS,
+                           N_("VCI: invalid cache size %llu for '%s'"), cbSize, pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate space for the tree root node.
-         */
-        uint64_t offTreeRoot = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META, &offTreeRoot);
+        /* Create image file. */
+        rc = vdIfIoIntFileOpen(pCache->pIfIo, pCache->pszFilename,
+                               VDOpenFlagsToFileOpenFlags(uOpenFlags & ~VD_OPEN_FLAGS_READONLY,
+                                                          true /* fCreate */),
+                               &pCache->pStorage);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot create image '%s'"), pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate the in memory root node.
-         */
-        pCache->pRoot = (PVCITREENODE)RTMemAllocZ(sizeof(VCITREENODELEAF));
-        if (!pCache->pRoot)
+        pCache->cbSize            = cbSize;
+        pCache->u32CacheType      =   uImageFlags & VD_IMAGE_FLAGS_FIXED
+                                    ? VCI_HDR_CACHE_TYPE_FIXED
+                                    : VCI_HDR_CACHE_TYPE_DYNAMIC;
+        pCache->offSlotTable      = VCI_BLOCK2BYTE(offSlotTable);
+        pCache->offJournal        = VCI_BLOCK2BYTE(offJournal);
+        pCache->cJournalBlocks    = cJournalBlocks;
+        pCache->offData           = VCI_BLOCK2BYTE(offData);
+        pCache->cSlots            = (uint32_t)cSlots;
+        pCache->idxJournalHead    = 0;
+        pCache->u64JournalSeqHead = 1;
+        pCache->u64JournalSeqNext = 1;
+
+        rc = vciStateAlloc(pCache);
+        if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate B+-Tree root pointer '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate memory for '%s'"), pCache->pszFilename);
             break;
         }
 
-        pCache->pRoot->u8Type = VCI_TREE_NODE_TYPE_LEAF;
-        /* Rest remains 0 as the tree is still empty. */
-
-        /*
-         * Now that we are here we have all the basic structures and know where to place them in the image.
-         * It's time to write it now.
-         */
+        vciConfigLoad(pCache);
 
-        /* Setup the header. */
-        memset(&Hdr, 0, sizeof(VciHdr));
-        Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
-        Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
-        Hdr.cBlocksCache     = RT_H2LE_U64(cBlocks);
-        Hdr.fUncleanShutdown = VCI_HDR_UNCLEAN_SHUTDOWN;
-        Hdr.u32CacheType     = uImageFlags & VD_IMAGE_FLAGS_FIXED
-                               ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
-                               : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
-        Hdr.offTreeRoot      = RT_H2LE_U64(offTreeRoot);
-        Hdr.offBlkMap        = RT_H2LE_U64(offBlkMap);
-        Hdr.cBlkMap          = RT_H2LE_U32(cBlkMap);
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offHdr, &Hdr,
-                                    VCI_BYTE2BLOCK(sizeof(VciHdr)));
+        rc = vdIfIoIntFileSetSize(pCache->pIfIo, pCache->pStorage,
+                                    uImageFlags & VD_IMAGE_FLAGS_FIXED
+                                  ? VCI_BLOCK2BYTE(cBlocks)
+                                  : pCache->offData);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot set the size of '%s'"), pCache->pszFilename);
             break;
         }
 
-        rc = vciBlkMapSave(pCache->pBlkMap, pCache, offBlkMap, cBlkMap);
+        /* Write an empty slot table, the journal is invalid as it is zeroed. */
+        rc = vciSlotTableWrite(pCache, true /* fClean */, NULL /* pXfer */, NULL /* pIoCtx */);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write block map '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write slot table '%s'"), pCache->pszFilename);
             break;
         }
 
-        /* Setup the root tree. */
-        memset(&NodeRoot, 0, sizeof(VciTreeNode));
-        NodeRoot.u8Type = RT_H2LE_U32(VCI_TREE_NODE_TYPE_LEAF);
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offTreeRoot,
-                                    &NodeRoot, VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
+        rc = vciHdrWrite(pCache, true /* fUnclean */, NULL /* pXfer */, NULL /* pIoCtx */);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write root node '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
             break;
         }
 
-        rc = vciFlushImage(pCache);
+        rc = vdIfIoIntFileFlushSync(pCache->pIfIo, pCache->pStorage);
         if (RT_FAILURE(rc))
         {
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot flush '%s'"), pCache->pszFilename);
             break;
         }
-
-        pCache->cbSize = cbSize;
-
     } while (0);
 
     if (RT_SUCCESS(rc) && pfnProgress)
@@ -1440,6 +1826,67 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
     return rc;
 }
 
+/**
+ * Internal: Stores guest data in the given slot, marking it dirty once the
+ * data reached the cache. A journal record must never describe data which
+ * didn't reach the cache.
+ */
+static int vciSlotWriteBack(PVCICACHE pCache, PVCISLOT pSlot, uint32_t iBlock,
+                            uint32_t cBlocks, PVDIOCTX pIoCtx)
+{
+    PVCIXFER pXfer = vciXferAlloc(VCIXFERTYPE_WRITE, 0);
+    if (!pXfer)
+        return VERR_NO_MEMORY;
+
+    pXfer->pSlot   = pSlot;
+    pXfer->iBlock  = iBlock;
+    pXfer->cBlocks = cBlocks;
+    pSlot->cWritesActive++;
+
+    /* A write back running concurrently might read the old data. */
+    if (pSlot->fDestaging)
+        ASMBitSetRange(pSlot->au32Rewritten, iBlock, iBlock + cBlocks);
+
+    int rc = vciXferUser(pCache, pXfer, pIoCtx);
+    return vciXferRelease(pCache, pXfer, rc);
+}
+
+/**
+ * Internal: Fills the invalid blocks of the given slot with data read from the image.
+ *
+ * The VD layer only updates the cache for synchronous requests, the data is
+ * written with the lock held so no guest write can interfere.
+ */
+static int vciSlotFill(PVCICACHE pCache, PVCISLOT pSlot, uint32_t iBlock,
+                       uint32_t cBlocks, PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+
+    /* Never overwrite valid data, it might be newer than the image. */
+    uint32_t i = 0;
+    while (   i < cBlocks
+           && RT_SUCCESS(rc))
+    {
+        uint32_t cRun = vciBitmapRun(pSlot->au32Valid, iBlock + i, cBlocks - i);
+
+        if (!ASMBitTest(pSlot->au32Valid, iBlock + i))
+        {
+            rc = vdIfIoIntFileWriteUser(pCache->pIfIo, pCache->pStorage,
+                                        vciSlotOffset(pCache, pSlot, iBlock + i),
+                                        pIoCtx, VCI_BLOCK2BYTE(cRun), NULL, NULL);
+            if (RT_SUCCESS(rc))
+                ASMBitSetRange(pSlot->au32Valid, iBlock + i, iBlock + i + cRun);
+        }
+        else /* Skip the data. */
+            vdIfIoIntIoCtxCopyFrom(pCache->pIfIo, pIoCtx, pCache->pbBuf, VCI_BLOCK2BYTE(cRun));
+
+        i += cRun;
+    }
+
+    pSlot->fReferenced = true;
+    return rc;
+}
+
 /** @copydoc VDCACHEBACKEND::pfnProbe */
 static int vciProbe(const char *pszFilename, PVDINTERFACE pVDIfsCache,
                     PVDINTERFACE pVDIfsImage)
@@ -1477,11 +1924,6 @@ static int vciProbe(const char *pszFilename, PVDINTERFACE pVDIfsCache,
 
     Hdr.u32Signature = RT_LE2H_U32(Hdr.u32Signature);
     Hdr.u32Version   = RT_LE2H_U32(Hdr.u32Version);
-    Hdr.cBlocksCache = RT_LE2H_U64(Hdr.cBlocksCache);
-    Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
-    Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
-    Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
 
     if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
         && Hdr.u32Version == VCI_HDR_VERSION)
@@ -1640,33 +2082,55 @@ static int vciRead(void *pBackendData, uint64_t uOffset, size_t cbToRead,
                  pBackendData, uOffset, cbToRead, pIoCtx, pcbActuallyRead));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent;
-    uint64_t cBlocksToRead = VCI_BYTE2BLOCK(cbToRead);
-    uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint64_t u64BlockDisk = uOffset / VCI_SLOT_SIZE;
+    uint32_t iBlock = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_SLOT_SIZE);
+    uint32_t cBlocks = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbToRead), VCI_SLOT_BLOCKS - iBlock);
 
     AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToRead % 512 == 0);
 
-    pExtent = vciCacheExtentLookup(pCache, offBlockAddr, NULL);
-    if (pExtent)
-    {
-        uint64_t offRead = offBlockAddr - pExtent->u64BlockOffset;
-        cBlocksToRead = RT_MIN(cBlocksToRead, pExtent->u32Blocks - offRead);
+    vciLock(pCache);
 
-        rc = vdIfIoIntFileReadUser(pCache->pIfIo, pCache->pStorage,
-                                   pExtent->u64BlockAddr + offRead,
-                                   pIoCtx, cBlocksToRead);
+    PVCISLOT pSlot = (PVCISLOT)RTAvlrU64Get(&pCache->TreeSlots, u64BlockDisk);
+    if (pSlot)
+    {
+        cBlocks = vciBitmapRun(pSlot->au32Valid, iBlock, cBlocks);
+        if (ASMBitTest(pSlot->au32Valid, iBlock))
+        {
+            /* Read straight into the I/O context, the slot is pinned until the read completed. */
+            PVCIXFER pXfer = vciXferAlloc(VCIXFERTYPE_READ, 0);
+            if (pXfer)
+            {
+                pXfer->pSlot   = pSlot;
+                pXfer->iBlock  = iBlock;
+                pXfer->cBlocks = cBlocks;
+                pSlot->cReadsActive++;
+                pSlot->fReferenced = true;
+                pCache->cHits++;
+
+                rc = vciXferUser(pCache, pXfer, pIoCtx);
+                rc = vciXferRelease(pCache, pXfer, rc);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+        else
+        {
+            pCache->cMisses++;
+            rc = VERR_VD_BLOCK_FREE;
+        }
     }
     else
     {
-        /** @todo Best fit to check whether we have cached data later and set
-         * pcbActuallyRead accordingly. */
+        pCache->cMisses++;
         rc = VERR_VD_BLOCK_FREE;
     }
 
+    vciUnlock(pCache);
+
     if (pcbActuallyRead)
-        *pcbActuallyRead = VCI_BLOCK2BYTE(cBlocksToRead);
+        *pcbActuallyRead = VCI_BLOCK2BYTE(cBlocks);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1674,25 +2138,78 @@ static int vciRead(void *pBackendData, uint64_t uOffset, size_t cbToRead,
 
 /** @copydoc VDCACHEBACKEND::pfnWrite */
 static int vciWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
-                    PVDIOCTX pIoCtx, size_t *pcbWriteProcess)
+                    PVDIOCTX pIoCtx, size_t *pcbWriteProcess, uint32_t fWrite)
 {
-    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbToWrite=%zu pIoCtx=%#p pcbWriteProcess=%#p\n",
-                 pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess));
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbToWrite=%zu pIoCtx=%#p pcbWriteProcess=%#p fWrite=%#x\n",
+                 pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess, fWrite));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
-    uint64_t cBlocksToWrite = VCI_BYTE2BLOCK(cbToWrite);
-    uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint64_t u64BlockDisk = uOffset / VCI_SLOT_SIZE;
+    uint32_t iBlock = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_SLOT_SIZE);
+    uint32_t cBlocks = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbToWrite), VCI_SLOT_BLOCKS - iBlock);
 
     AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToWrite % 512 == 0);
 
-    while (cBlocksToWrite)
-    {
+    vciLock(pCache);
 
+    PVCISLOT pSlot = (PVCISLOT)RTAvlrU64Get(&pCache->TreeSlots, u64BlockDisk);
+    if (!(fWrite & VD_CACHE_WRITE_GUEST))
+    {
+        /*
+         * Guest writes in flight might land after the fill and be marked
+         * valid before it, leave the slot alone then.
+         */
+        bool fFill =    !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+                     && vdIfIoIntIoCtxIsSynchronous(pCache->pIfIo, pIoCtx)
+                     && (!pSlot || !pSlot->cWritesActive);
+
+        if (   !pSlot
+            && fFill)
+            pSlot = vciSlotAlloc(pCache, u64BlockDisk);
+        if (   pSlot
+            && fFill)
+            rc = vciSlotFill(pCache, pSlot, iBlock, cBlocks, pIoCtx);
+        else /* No room, skip the data. */
+            vdIfIoIntIoCtxCopyFrom(pCache->pIfIo, pIoCtx, pCache->pbBuf, VCI_BLOCK2BYTE(cBlocks));
+    }
+    else if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        rc = VERR_VD_BLOCK_FREE; /* The image is read-only as well, let it fail there. */
+    else
+    {
+        /*
+         * Guest writes go to the cache in write-back mode as long as there is
+         * room below the high water mark. Dirty blocks from an earlier
+         * write-back session and slots being written back are always updated
+         * in place, writing to the image could get the update overwritten by
+         * the write back. The same goes for slots with guest writes still in
+         * flight, they would mark the range valid again afterwards.
+         */
+        if (   !pSlot
+            && pCache->fWriteBack
+            && (uint64_t)pCache->cSlotsDirty * 100 < (uint64_t)pCache->uDirtyHighWater * pCache->cSlots)
+            pSlot = vciSlotAlloc(pCache, u64BlockDisk);
+
+        if (   pSlot
+            && (   pCache->fWriteBack
+                || pSlot->fDestaging
+                || pSlot->cWritesActive
+                || vciBitmapIsRangeSet(pSlot->au32Dirty, iBlock, cBlocks)))
+            rc = vciSlotWriteBack(pCache, pSlot, iBlock, cBlocks, pIoCtx);
+        else
+        {
+            /* Drop the stale clean copy, the image gets the data. */
+            if (pSlot)
+                ASMBitClearRange(pSlot->au32Valid, iBlock, iBlock + cBlocks);
+            pCache->cWritesPassed++;
+            rc = VERR_VD_BLOCK_FREE;
+        }
     }
 
-    *pcbWriteProcess = cbToWrite; /** @todo: Implement. */
+    vciUnlock(pCache);
+
+    *pcbWriteProcess = VCI_BLOCK2BYTE(cBlocks);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1705,7 +2222,123 @@ static int vciFlush(void *pBackendData, PVDIOCTX pIoCtx)
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
 
-    rc = vciFlushImage(pCache);
+    rc = vciFlushImage(pCache, pIoCtx);
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnDestageGet */
+static int vciDestageGet(void *pBackendData, bool fAll, void *pvBuf, size_t cbBuf,
+                         uint64_t *puOffset, size_t *pcbDestage, uint64_t *puCookie)
+{
+    LogFlowFunc(("pBackendData=%#p fAll=%RTbool pvBuf=%#p cbBuf=%zu\n",
+                 pBackendData, fAll, pvBuf, cbBuf));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VERR_NOT_FOUND;
+    uint32_t cBlocksMax = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbBuf), VCI_SLOT_BLOCKS);
+
+    AssertPtr(pCache);
+    AssertReturn(cBlocksMax, VERR_INVALID_PARAMETER);
+
+    vciLock(pCache);
+
+    PVCISLOT pSlot = RTListGetFirst(&pCache->ListDirty, VCISLOT, NodeDirty);
+    if (   pSlot
+        && !fAll
+        && (uint64_t)pCache->cSlotsDirty * 100 <= (uint64_t)pCache->uDirtyLowWater * pCache->cSlots
+        && RTTimeMilliTS() - pSlot->tsDirty < pCache->cMsDirtyMaxAge)
+        pSlot = NULL; /* Not enough dirty data yet and nothing too old. */
+
+    while (   pSlot
+           && pSlot->fDestaging)
+        pSlot = RTListGetNext(&pCache->ListDirty, pSlot, VCISLOT, NodeDirty);
+
+    if (pSlot)
+    {
+        /*
+         * Write back from the first dirty block up to the last one, including
+         * clean blocks in between as long as they are valid.
+         */
+        uint32_t iBlockStart = (uint32_t)ASMBitFirstSet(pSlot->au32Dirty, VCI_SLOT_BLOCKS);
+        uint32_t iBlockEnd = iBlockStart + vciBitmapRun(pSlot->au32Dirty, iBlockStart, VCI_SLOT_BLOCKS);
+
+        while (iBlockEnd < VCI_SLOT_BLOCKS)
+        {
+            int iDirtyNext = ASMBitNextSet(pSlot->au32Dirty, VCI_SLOT_BLOCKS, iBlockEnd - 1);
+            if (   iDirtyNext == -1
+                || (uint32_t)iDirtyNext - iBlockStart > cBlocksMax
+                || vciBitmapRun(pSlot->au32Valid, iBlockEnd, iDirtyNext - iBlockEnd) != (uint32_t)iDirtyNext - iBlockEnd
+                || !ASMBitTest(pSlot->au32Valid, iBlockEnd))
+                break;
+            iBlockEnd = iDirtyNext + vciBitmapRun(pSlot->au32Dirty, iDirtyNext, VCI_SLOT_BLOCKS);
+        }
+        iBlockEnd = RT_MIN(iBlockEnd, iBlockStart + cBlocksMax);
+
+        rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
+                                   vciSlotOffset(pCache, pSlot, iBlockStart),
+                                   pvBuf, VCI_BLOCK2BYTE(iBlockEnd - iBlockStart));
+        if (RT_SUCCESS(rc))
+        {
+            RT_ZERO(pSlot->au32Destage);
+            RT_ZERO(pSlot->au32Rewritten);
+            ASMBitSetRange(pSlot->au32Destage, iBlockStart, iBlockEnd);
+            for (unsigned i = 0; i < RT_ELEMENTS(pSlot->au32Destage); i++)
+                pSlot->au32Destage[i] &= pSlot->au32Dirty[i];
+            pSlot->fDestaging = true;
+
+            *puOffset   = pSlot->Core.Key * VCI_SLOT_SIZE + VCI_BLOCK2BYTE(iBlockStart);
+            *pcbDestage = VCI_BLOCK2BYTE(iBlockEnd - iBlockStart);
+            *puCookie   = (uint64_t)(pSlot - pCache->paSlots);
+        }
+    }
+
+    vciUnlock(pCache);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnDestageComplete */
+static int vciDestageComplete(void *pBackendData, const uint64_t *pauCookies,
+                              unsigned cCookies, int rcDestage)
+{
+    LogFlowFunc(("pBackendData=%#p pauCookies=%#p cCookies=%u rcDestage=%Rrc\n",
+                 pBackendData, pauCookies, cCookies, rcDestage));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pCache);
+
+    vciLock(pCache);
+
+    for (unsigned i = 0; i < cCookies; i++)
+    {
+        AssertBreakStmt(pauCookies[i] < pCache->cSlots, rc = VERR_INVALID_PARAMETER);
+        PVCISLOT pSlot = &pCache->paSlots[pauCookies[i]];
+
+        Assert(pSlot->fDestaging);
+        if (RT_SUCCESS(rcDestage))
+        {
+            /* Blocks written again in the meantime stay dirty. */
+            for (unsigned j = 0; j < RT_ELEMENTS(pSlot->au32Dirty); j++)
+                pSlot->au32Dirty[j] &= ~(pSlot->au32Destage[j] & ~pSlot->au32Rewritten[j]);
+            vciSlotDirtyUpdate(pCache, pSlot);
+            vciSlotJournalQueue(pCache, pSlot);
+            pCache->cDestaged++;
+        }
+
+        RT_ZERO(pSlot->au32Destage);
+        RT_ZERO(pSlot->au32Rewritten);
+        pSlot->fDestaging = false;
+    }
+
+    /* The slots can't be reused before the journal says they are clean. */
+    if (   RT_SUCCESS(rc)
+        && RT_SUCCESS(rcDestage))
+        rc = vciJournalCommit(pCache, NULL /* pIoCtx */);
+
+    vciUnlock(pCache);
+
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
 }
@@ -1719,7 +2352,7 @@ static unsigned vciGetVersion(void *pBackendData)
     AssertPtr(pCache);
 
     if (pCache)
-        return 1;
+        return VCI_HDR_VERSION;
     else
         return 0;
 }
@@ -1965,11 +2598,11 @@ const VDCACHEBACKEND g_VciCacheBackend =
     /* cbSize */
     sizeof(VDCACHEBACKEND),
     /* uBackendCaps */
-    VD_CAP_CREATE_FIXED | VD_CAP_CREATE_DYNAMIC | VD_CAP_FILE | VD_CAP_VFS,
+    VD_CAP_CREATE_FIXED | VD_CAP_CREATE_DYNAMIC | VD_CAP_FILE | VD_CAP_VFS | VD_CAP_ASYNC,
     /* papszFileExtensions */
     s_apszVciFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aVciConfigInfo,
     /* pfnProbe */
     vciProbe,
     /* pfnOpen */
@@ -2015,6 +2648,10 @@ const VDCACHEBACKEND g_VciCacheBackend =
     /* pfnComposeLocation */
     NULL,
     /* pfnComposeName */
-    NULL
+    NULL,
+    /* pfnDestageGet */
+    vciDestageGet,
+    /* pfnDestageComplete */
+    vciDestageComplete
 };
 
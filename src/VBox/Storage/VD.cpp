@@ -38,7 +38,9 @@
 #include <iprt/sg.h>
 #include <iprt/list.h>
 #include <iprt/avl.h>
+#include <iprt/critsect.h>
 #include <iprt/semaphore.h>
+#include <iprt/thread.h>
 
 #include <VBox/vd-plugin.h>
 
@@ -56,6 +58,11 @@
 /** Buffer size used for merging images. */
 #define VD_MERGE_BUFFER_SIZE    (16 * _1M)
 
+/** Number of buffers in flight when copying images. */
+#define VD_COPY_BUFFERS         4
+/** Size of one buffer used for copying images. */
+#define VD_COPY_BUFFER_SIZE     (VD_MERGE_BUFFER_SIZE / VD_COPY_BUFFERS)
+
 /** Maximum number of segments in one I/O task. */
 #define VD_IO_TASK_SEGMENTS_MAX 64
 
@@ -158,8 +165,23 @@ typedef struct VDCACHE
     PVDINTERFACE        pVDIfsCache;
     /** I/O related things. */
     VDIO                VDIo;
+
+    /** Thread writing back dirty data, NIL_RTTHREAD if the cache doesn't
+     * support write-back caching. */
+    RTTHREAD            hThreadDestage;
+    /** Event semaphore to wake up the destage thread. */
+    RTSEMEVENT          hEvtDestage;
+    /** Flag whether the destage thread should terminate. */
+    volatile bool       fDestageShutdown;
+    /** Buffer for the data written back. */
+    void               *pvDestageBuf;
 } VDCACHE, *PVDCACHE;
 
+/** Size of the buffer used for writing back dirty data from the cache. */
+#define VD_CACHE_DESTAGE_BUF_SIZE      _1M
+/** Maximum number of ranges written back before the image is flushed. */
+#define VD_CACHE_DESTAGE_RANGES_MAX    64
+
 /**
  * A block waiting for a discard.
  */
@@ -192,6 +214,21 @@ typedef struct VDDISCARDSTATE
     RTLISTNODE          ListLru;
 } VDDISCARDSTATE, *PVDDISCARDSTATE;
 
+/**
+ * State of an online compaction step.
+ */
+typedef struct VDCOMPACTONLINE
+{
+    /** Buffer to read the image data into. */
+    void                  *pvBuf;
+    /** Size of the buffer in bytes. */
+    size_t                 cbBuf;
+    /** Number of bytes scanned so far. */
+    uint64_t               cbScanned;
+    /** Number of bytes the image file shrunk. */
+    uint64_t               cbReclaimed;
+} VDCOMPACTONLINE, *PVDCOMPACTONLINE;
+
 /**
  * VD filter instance.
  */
@@ -277,6 +314,16 @@ struct VBOXHDD
      * Other flush or growing write requests need to wait until
      * the current one completes. - NIL_VDIOCTX if unlocked. */
     volatile PVDIOCTX      pIoCtxLockOwner;
+    /** Number of threads currently submitting I/O requests without holding
+     * the disk lock. The lock can't be acquired while this is not 0. */
+    volatile uint32_t      cIoCtxParallel;
+    /** Number of data transfers issued without the disk lock which did not complete yet.
+     * The disk lock is not handed to a growing write, flush or discard request
+     * until this dropped to 0, see vdIoCtxLockDisk(). */
+    volatile uint32_t      cIoTasksParallelPending;
+    /** Number of user data transfers currently in flight on any image of the disk.
+     * Online compaction must not move blocks around while this is not 0. */
+    volatile uint32_t      cIoTasksUserPending;
     /** If the disk was locked by a growing write, flush or discard request this
      * contains the start offset to check for interfering I/O while it is in progress. */
     uint64_t               uOffsetStartLocked;
@@ -296,6 +343,9 @@ struct VBOXHDD
 
     /** Event semaphore for synchronous I/O. */
     RTSEMEVENT             hEventSemSyncIo;
+    /** Critical section serializing synchronous I/O, there is only one
+     * event semaphore and status code. */
+    RTCRITSECT             CritSectSyncIo;
     /** Status code of the last synchronous I/O request. */
     int                    rcSync;
 };
@@ -491,6 +541,10 @@ typedef struct VDIOCTX
  * multiple times.
  */
 #define VDIOCTX_FLAGS_WRITE_FILTER_APPLIED   RT_BIT_32(6)
+/** The I/O context is processed without the disk lock, see vdIoCtxProcessParallel(). */
+#define VDIOCTX_FLAGS_PARALLEL               RT_BIT_32(7)
+/** Bypass the cache, used when writing back dirty data from the cache. */
+#define VDIOCTX_FLAGS_NO_CACHE               RT_BIT_32(8)
 
 /** NIL I/O context pointer value. */
 #define NIL_VDIOCTX ((PVDIOCTX)0)
@@ -527,6 +581,9 @@ typedef struct VDIOTASK
     int                          rcReq;
     /** Flag whether this is a meta data transfer. */
     bool                         fMeta;
+    /** Flag whether the task was issued without the disk lock held
+     * and completes without it. */
+    bool                         fParallel;
     /** Type dependent data. */
     union
     {
@@ -547,6 +604,26 @@ typedef struct VDIOTASK
     } Type;
 } VDIOTASK;
 
+/**
+ * User data transfer which had to be split into several I/O tasks.
+ * The completion callback of the backend is invoked only once after the last
+ * task finished.
+ */
+typedef struct VDIOUSERXFER
+{
+    /** Number of references, one for every task in flight and one for the
+     * initiator while the tasks are spawned. */
+    volatile uint32_t            cRefs;
+    /** Status code of the first failed task. */
+    volatile int32_t             rcReq;
+    /** Completion callback of the backend, NULL if the initiator failed. */
+    PFNVDXFERCOMPLETED           pfnComplete;
+    /** Opaque user data for the completion callback. */
+    void                        *pvUser;
+} VDIOUSERXFER;
+/** Pointer to a split user data transfer. */
+typedef VDIOUSERXFER *PVDIOUSERXFER;
+
 /**
  * Storage handle.
  */
@@ -633,6 +710,7 @@ static PCVBOXHDDBACKEND aStaticBackends[] =
 {
     &g_VmdkBackend,
     &g_VDIBackend,
+    &g_DedupBackend,
     &g_VhdBackend,
     &g_ParallelsBackend,
     &g_DmgBackend,
@@ -667,6 +745,7 @@ static int vdDiscardHelperAsync(PVDIOCTX pIoCtx);
 static int vdWriteHelperAsync(PVDIOCTX pIoCtx);
 static void vdDiskProcessBlockedIoCtx(PVBOXHDD pDisk);
 static int vdDiskUnlock(PVBOXHDD pDisk, PVDIOCTX pIoCtxRc);
+static bool vdDiskTryLock(PVBOXHDD pDisk);
 static DECLCALLBACK(void) vdIoCtxSyncComplete(void *pvUser1, void *pvUser2, int rcReq);
 
 /**
@@ -1164,14 +1243,15 @@ static int vdCacheReadHelper(PVDCACHE pCache, uint64_t uOffset,
  * @param   cbWrite    How much to write.
  * @param   pIoCtx     The I/O context to ẃrite from.
  * @param   pcbWritten How much data could be written, optional.
+ * @param   fWrite     Write flags, VD_CACHE_WRITE_XXX.
  */
 static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
-                              PVDIOCTX pIoCtx, size_t *pcbWritten)
+                              PVDIOCTX pIoCtx, size_t *pcbWritten, uint32_t fWrite)
 {
     int rc = VINF_SUCCESS;
 
-    LogFlowFunc(("pCache=%#p uOffset=%llu pIoCtx=%p cbWrite=%zu pcbWritten=%#p\n",
-                 pCache, uOffset, pIoCtx, cbWrite, pcbWritten));
+    LogFlowFunc(("pCache=%#p uOffset=%llu pIoCtx=%p cbWrite=%zu pcbWritten=%#p fWrite=%#x\n",
+                 pCache, uOffset, pIoCtx, cbWrite, pcbWritten, fWrite));
 
     AssertPtr(pCache);
     AssertPtr(pIoCtx);
@@ -1179,7 +1259,7 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
 
     if (pcbWritten)
         rc = pCache->Backend->pfnWrite(pCache->pBackendData, uOffset, cbWrite,
-                                       pIoCtx, pcbWritten);
+                                       pIoCtx, pcbWritten, fWrite);
     else
     {
         size_t cbWritten = 0;
@@ -1187,7 +1267,7 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
         do
         {
             rc = pCache->Backend->pfnWrite(pCache->pBackendData, uOffset, cbWrite,
-                                           pIoCtx, &cbWritten);
+                                           pIoCtx, &cbWritten, fWrite);
             uOffset += cbWritten;
             cbWrite -= cbWritten;
         } while (   cbWrite
@@ -1506,8 +1586,12 @@ DECLINLINE(PVDIOTASK) vdIoTaskUserAlloc(PVDIOSTORAGE pIoStorage, PFNVDXFERCOMPLE
         pIoTask->pfnComplete          = pfnComplete;
         pIoTask->pvUser               = pvUser;
         pIoTask->fMeta                = false;
+        pIoTask->fParallel            = RT_BOOL(pIoCtx->fFlags & VDIOCTX_FLAGS_PARALLEL);
         pIoTask->Type.User.cbTransfer = cbTransfer;
         pIoTask->Type.User.pIoCtx     = pIoCtx;
+        ASMAtomicIncU32(&pIoStorage->pVDIo->pDisk->cIoTasksUserPending);
+        if (pIoTask->fParallel)
+            ASMAtomicIncU32(&pIoStorage->pVDIo->pDisk->cIoTasksParallelPending);
     }
 
     return pIoTask;
@@ -1524,6 +1608,7 @@ DECLINLINE(PVDIOTASK) vdIoTaskMetaAlloc(PVDIOSTORAGE pIoStorage, PFNVDXFERCOMPLE
         pIoTask->pfnComplete         = pfnComplete;
         pIoTask->pvUser              = pvUser;
         pIoTask->fMeta               = true;
+        pIoTask->fParallel           = false;
         pIoTask->Type.Meta.pMetaXfer = pMetaXfer;
     }
 
@@ -1547,6 +1632,16 @@ DECLINLINE(void) vdIoCtxFree(PVBOXHDD pDisk, PVDIOCTX pIoCtx)
 
 DECLINLINE(void) vdIoTaskFree(PVBOXHDD pDisk, PVDIOTASK pIoTask)
 {
+    if (!pIoTask->fMeta)
+    {
+        Assert(pDisk->cIoTasksUserPending > 0);
+        ASMAtomicDecU32(&pDisk->cIoTasksUserPending);
+        if (pIoTask->fParallel)
+        {
+            Assert(pDisk->cIoTasksParallelPending > 0);
+            ASMAtomicDecU32(&pDisk->cIoTasksParallelPending);
+        }
+    }
 #ifdef DEBUG
     memset(pIoTask, 0xff, sizeof(VDIOTASK));
 #endif
@@ -1822,6 +1917,20 @@ static int vdDiskProcessWaitingIoCtx(PVBOXHDD pDisk, PVDIOCTX pIoCtxRc)
     return rc;
 }
 
+/**
+ * Checks whether there are blocked I/O contexts which only waited for the
+ * transfers issued without the disk lock to drain (see vdIoCtxLockDisk()).
+ *
+ * @returns true if the blocked list should be processed, false otherwise.
+ * @param   pDisk    The disk structure.
+ */
+DECLINLINE(bool) vdDiskBlockedIoCtxDrained(PVBOXHDD pDisk)
+{
+    return    ASMAtomicReadPtrT(&pDisk->pIoCtxBlockedHead, PVDIOCTX) != NULL
+           && ASMAtomicReadPtrT(&pDisk->pIoCtxLockOwner, PVDIOCTX) == NIL_VDIOCTX
+           && !ASMAtomicReadU32(&pDisk->cIoTasksParallelPending);
+}
+
 /**
  * Processes the list of blocked I/O contexts.
  *
@@ -1893,7 +2002,7 @@ static int vdIoCtxProcessTryLockDefer(PVDIOCTX pIoCtx)
     /* Put it on the waiting list first. */
     vdIoCtxAddToWaitingList(&pDisk->pIoCtxHead, pIoCtx);
 
-    if (ASMAtomicCmpXchgBool(&pDisk->fLocked, true, false))
+    if (vdDiskTryLock(pDisk))
     {
         /* Leave it again, the context will be processed just before leaving the lock. */
         LogFlowFunc(("Successfully acquired the lock\n"));
@@ -1908,6 +2017,340 @@ static int vdIoCtxProcessTryLockDefer(PVDIOCTX pIoCtx)
     return rc;
 }
 
+/**
+ * Tries to acquire the disk lock.
+ *
+ * This fails if another thread holds the lock already or if there are
+ * threads submitting I/O without holding the lock (see vdIoCtxProcessParallel()).
+ *
+ * @returns true if the lock was acquired, false otherwise.
+ * @param   pDisk    The disk to lock.
+ */
+static bool vdDiskTryLock(PVBOXHDD pDisk)
+{
+    while (ASMAtomicCmpXchgBool(&pDisk->fLocked, true, false))
+    {
+        if (!ASMAtomicReadU32(&pDisk->cIoCtxParallel))
+            return true;
+
+        ASMAtomicXchgBool(&pDisk->fLocked, false);
+
+        /*
+         * The last thread leaving the parallel section might have failed to
+         * get the lock because we held it for a short moment. Try again
+         * if it is gone already, otherwise it will process the lists.
+         */
+        if (ASMAtomicReadU32(&pDisk->cIoCtxParallel))
+            break;
+    }
+
+    return false;
+}
+
+/**
+ * Leaves the parallel submission section processing anything which
+ * was queued for the disk lock in the meantime.
+ *
+ * @returns nothing.
+ * @param   pDisk    The disk.
+ */
+static void vdDiskParallelLeave(PVBOXHDD pDisk)
+{
+    if (   !ASMAtomicDecU32(&pDisk->cIoCtxParallel)
+        && (   ASMAtomicReadPtrT(&pDisk->pIoCtxHead, PVDIOCTX) != NULL
+            || ASMAtomicReadPtrT(&pDisk->pIoTasksPendingHead, PVDIOTASK) != NULL
+            || ASMAtomicReadPtrT(&pDisk->pIoCtxHaltedHead, PVDIOCTX) != NULL)
+        && vdDiskTryLock(pDisk))
+        vdDiskUnlock(pDisk, NULL);
+}
+
+/**
+ * Checks whether the given I/O context can be processed without
+ * the disk lock.
+ *
+ * @returns true if the parallel path can be used, false otherwise.
+ * @param   pDisk    The disk, the caller entered the parallel section already.
+ * @param   pIoCtx   The I/O context to check.
+ */
+static bool vdIoCtxParallelIsPossible(PVBOXHDD pDisk, PVDIOCTX pIoCtx)
+{
+    /*
+     * Nothing must be going on under the lock. Checking fLocked first is enough
+     * to make sure nobody can acquire it until we leave the parallel section again.
+     */
+    if (   ASMAtomicReadBool(&pDisk->fLocked)
+        || ASMAtomicReadPtrT(&pDisk->pIoCtxLockOwner, PVDIOCTX) != NIL_VDIOCTX
+        || ASMAtomicReadPtrT(&pDisk->pIoCtxHead, PVDIOCTX) != NULL
+        || ASMAtomicReadPtrT(&pDisk->pIoTasksPendingHead, PVDIOTASK) != NULL
+        || ASMAtomicReadPtrT(&pDisk->pIoCtxHaltedHead, PVDIOCTX) != NULL
+        || ASMAtomicReadPtrT(&pDisk->pIoCtxBlockedHead, PVDIOCTX) != NULL)
+        return false;
+
+    /* Everything which needs to update state besides the image data goes the locked way. */
+    if (   pDisk->pCache
+        || pDisk->pDiscard
+        || pDisk->pFilterHead
+        || pDisk->pImageRelay
+        || (pDisk->pLast->uOpenFlags & (VD_OPEN_FLAGS_DISCARD | VD_OPEN_FLAGS_INFORM_ABOUT_ZERO_BLOCKS)))
+        return false;
+
+    if (pIoCtx->enmTxDir == VDIOCTXTXDIR_READ)
+    {
+        if (   !(pIoCtx->fFlags & VDIOCTX_FLAGS_ZERO_FREE_BLOCKS)
+            || pIoCtx->Req.Io.cImagesRead
+            || pIoCtx->Req.Io.pImageParentOverride)
+            return false;
+    }
+    else
+    {
+        /* The first write after opening or flushing needs to update the modification UUID. */
+        Assert(pIoCtx->enmTxDir == VDIOCTXTXDIR_WRITE);
+        if (   (pDisk->uModified & (VD_IMAGE_MODIFIED_FLAG | VD_IMAGE_MODIFIED_FIRST)) != VD_IMAGE_MODIFIED_FLAG
+            || (pIoCtx->fFlags & VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG))
+            return false;
+    }
+
+    for (PVDIMAGE pImage = pDisk->pLast; pImage; pImage = pImage->pPrev)
+        if (!(pImage->Backend->uBackendCaps & VD_CAP_CONCURRENT_IO))
+            return false;
+
+    return true;
+}
+
+/**
+ * Read helper for I/O contexts processed without the disk lock.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_BLOCK_FREE if a backend needs to read metadata for a part of the request.
+ *          The I/O context is updated to describe the remaining part.
+ * @param   pIoCtx    The I/O context to process.
+ */
+static int vdReadHelperParallel(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    uint64_t uOffset = pIoCtx->Req.Io.uOffset;
+    size_t cbToRead  = pIoCtx->Req.Io.cbTransfer;
+
+    while (cbToRead)
+    {
+        PVDIMAGE pCurrImage = pIoCtx->Req.Io.pImageStart;
+        size_t cbThisRead   = cbToRead;
+
+        /* Search for the image with the allocated block. */
+        do
+        {
+            rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                              uOffset, cbThisRead, pIoCtx,
+                                              &cbThisRead);
+            pCurrImage = pCurrImage->pPrev;
+        } while (rc == VERR_VD_BLOCK_FREE && pCurrImage);
+
+        if (rc == VERR_VD_NOT_ENOUGH_METADATA)
+        {
+            /* A backend needs to read metadata first, leave the remaining part to vdReadHelperAsync(). */
+            pIoCtx->Req.Io.uOffset    = uOffset;
+            pIoCtx->Req.Io.cbTransfer = cbToRead;
+            rc = VERR_VD_BLOCK_FREE;
+            break;
+        }
+        else if (rc == VERR_VD_BLOCK_FREE)
+        {
+            /* No image in the chain contains the data for the block. */
+            vdIoCtxSet(pIoCtx, '\0', cbThisRead);
+            ASMAtomicSubU32(&pIoCtx->Req.Io.cbTransferLeft, (uint32_t)cbThisRead); Assert(cbThisRead == (uint32_t)cbThisRead);
+        }
+        else if (   RT_FAILURE(rc)
+                 && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            break;
+
+        rc = VINF_SUCCESS;
+        cbToRead -= cbThisRead;
+        uOffset  += cbThisRead;
+    }
+
+    return rc;
+}
+
+/**
+ * Write helper for I/O contexts processed without the disk lock.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_BLOCK_FREE if a part of the request hits an unallocated block
+ *          or the backend needs to read metadata first.
+ *          The I/O context is updated to describe the remaining part.
+ * @param   pIoCtx    The I/O context to process.
+ */
+static int vdWriteHelperParallel(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVDIMAGE pImage  = pIoCtx->Req.Io.pImageCur;
+    uint64_t uOffset = pIoCtx->Req.Io.uOffset;
+    size_t cbWrite   = pIoCtx->Req.Io.cbTransfer;
+
+    while (cbWrite)
+    {
+        size_t cbThisWrite = cbWrite;
+        size_t cbPreRead, cbPostRead;
+
+        rc = pImage->Backend->pfnWrite(pImage->pBackendData, uOffset, cbThisWrite,
+                                       pIoCtx, &cbThisWrite, &cbPreRead, &cbPostRead,
+                                       VD_WRITE_NO_ALLOC | VD_WRITE_CONCURRENT);
+        if (   rc == VERR_VD_BLOCK_FREE
+            || rc == VERR_VD_NOT_ENOUGH_METADATA)
+        {
+            /* Leave the remaining part to vdWriteHelperAsync(). */
+            pIoCtx->Req.Io.uOffset    = uOffset;
+            pIoCtx->Req.Io.cbTransfer = cbWrite;
+            rc = VERR_VD_BLOCK_FREE;
+            break;
+        }
+        else if (   RT_FAILURE(rc)
+                 && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            break;
+
+        rc = VINF_SUCCESS;
+        cbWrite -= cbThisWrite;
+        uOffset += cbThisWrite;
+    }
+
+    return rc;
+}
+
+/**
+ * Called when the last data transfer of an I/O context processed
+ * without the disk lock completed.
+ *
+ * @returns nothing.
+ * @param   pIoCtx    The I/O context.
+ */
+static void vdIoCtxParallelComplete(PVDIOCTX pIoCtx)
+{
+    PVBOXHDD pDisk = pIoCtx->pDisk;
+
+    if (ASMAtomicReadU32(&pIoCtx->fFlags) & VDIOCTX_FLAGS_PARALLEL)
+    {
+        if (ASMAtomicCmpXchgBool(&pIoCtx->fComplete, true, false))
+        {
+            LogFlowFunc(("I/O context completed pIoCtx=%#p rcReq=%Rrc\n", pIoCtx, pIoCtx->rcReq));
+            Assert(!pIoCtx->Req.Io.cbTransferLeft || RT_FAILURE(pIoCtx->rcReq));
+
+            if (pIoCtx->enmTxDir == VDIOCTXTXDIR_READ)
+                vdThreadFinishRead(pDisk);
+            else
+                vdThreadFinishWrite(pDisk);
+
+            vdIoCtxRootComplete(pDisk, pIoCtx);
+            vdIoCtxFree(pDisk, pIoCtx);
+        }
+    }
+    else
+    {
+        /* The context was handed over to the locked path, continue there. */
+        vdIoCtxAddToWaitingList(&pDisk->pIoCtxHaltedHead, pIoCtx);
+        if (vdDiskTryLock(pDisk))
+            vdDiskUnlock(pDisk, NULL);
+    }
+}
+
+/**
+ * Completes an I/O task which was issued without the disk lock.
+ *
+ * @returns nothing.
+ * @param   pIoTask   The completed I/O task.
+ */
+static void vdIoCtxParallelXferCompleted(PVDIOTASK pIoTask)
+{
+    PVDIOCTX pIoCtx = pIoTask->Type.User.pIoCtx;
+    PVBOXHDD pDisk  = pIoCtx->pDisk;
+
+    Assert(!pIoTask->fMeta && !pIoTask->pfnComplete);
+
+    if (RT_FAILURE(pIoTask->rcReq))
+        ASMAtomicCmpXchgS32(&pIoCtx->rcReq, pIoTask->rcReq, VINF_SUCCESS);
+
+    Assert(pIoCtx->Req.Io.cbTransferLeft >= pIoTask->Type.User.cbTransfer);
+    ASMAtomicSubU32(&pIoCtx->Req.Io.cbTransferLeft, pIoTask->Type.User.cbTransfer);
+    vdIoTaskFree(pDisk, pIoTask);
+
+    if (!ASMAtomicDecU32(&pIoCtx->cDataTransfersPending))
+        vdIoCtxParallelComplete(pIoCtx);
+
+    /*
+     * The last transfer without the lock completed, requests waiting for the
+     * disk lock to drain them can be processed now.
+     */
+    if (   vdDiskBlockedIoCtxDrained(pDisk)
+        && vdDiskTryLock(pDisk))
+        vdDiskUnlock(pDisk, NULL);
+}
+
+/**
+ * Processes a read or write I/O context without acquiring the disk lock
+ * if possible, falls back to vdIoCtxProcessTryLockDefer() otherwise.
+ *
+ * Reads and writes hitting only allocated blocks of backends supporting
+ * VD_CAP_CONCURRENT_IO are submitted directly from the calling thread and
+ * complete without the disk lock. Anything requiring metadata updates
+ * (block allocation, modified flag, cache, discard, ...) is handed over
+ * to the locked path.
+ *
+ * @returns VBox status code.
+ * @param   pIoCtx    The I/O context to process.
+ */
+static int vdIoCtxProcessParallel(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVBOXHDD pDisk = pIoCtx->pDisk;
+
+    ASMAtomicIncU32(&pDisk->cIoCtxParallel);
+    if (!vdIoCtxParallelIsPossible(pDisk, pIoCtx))
+    {
+        vdDiskParallelLeave(pDisk);
+        return vdIoCtxProcessTryLockDefer(pIoCtx);
+    }
+
+    LogFlowFunc(("Processing pIoCtx=%#p without the disk lock\n", pIoCtx));
+
+    /* Keep the context from completing while the transfers are submitted. */
+    ASMAtomicIncU32(&pIoCtx->cDataTransfersPending);
+    pIoCtx->fFlags |= VDIOCTX_FLAGS_PARALLEL;
+
+    if (pIoCtx->enmTxDir == VDIOCTXTXDIR_READ)
+        rc = vdReadHelperParallel(pIoCtx);
+    else
+        rc = vdWriteHelperParallel(pIoCtx);
+
+    if (rc == VERR_VD_BLOCK_FREE)
+    {
+        /*
+         * Hand the context over to the locked path. It is blocked until all
+         * transfers issued so far completed.
+         */
+        ASMAtomicOrU32(&pIoCtx->fFlags, VDIOCTX_FLAGS_BLOCKED);
+        ASMAtomicAndU32(&pIoCtx->fFlags, ~VDIOCTX_FLAGS_PARALLEL);
+    }
+    else if (RT_FAILURE(rc))
+        ASMAtomicCmpXchgS32(&pIoCtx->rcReq, rc, VINF_SUCCESS);
+
+    vdDiskParallelLeave(pDisk);
+
+    /* The last completing transfer takes care of the context if something is still pending. */
+    if (ASMAtomicDecU32(&pIoCtx->cDataTransfersPending))
+        return VERR_VD_ASYNC_IO_IN_PROGRESS;
+
+    if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_PARALLEL))
+    {
+        pIoCtx->fFlags &= ~VDIOCTX_FLAGS_BLOCKED;
+        return vdIoCtxProcessTryLockDefer(pIoCtx);
+    }
+
+    /* Everything completed synchronously. */
+    if (RT_FAILURE(pIoCtx->rcReq))
+        return pIoCtx->rcReq;
+
+    return VINF_VD_ASYNC_IO_FINISHED;
+}
+
 /**
  * Process the I/O context in a synchronous manner, waiting
  * for it to complete.
@@ -1925,6 +2368,9 @@ static int vdIoCtxProcessSync(PVDIOCTX pIoCtx)
     AssertMsg(pIoCtx->fFlags & VDIOCTX_FLAGS_SYNC,
               ("I/O context is not marked as synchronous\n"));
 
+    /* The cache destage thread might issue synchronous I/O concurrently. */
+    RTCritSectEnter(&pDisk->CritSectSyncIo);
+
     rc = vdIoCtxProcessTryLockDefer(pIoCtx);
     if (rc == VINF_VD_ASYNC_IO_FINISHED)
         rc = VINF_SUCCESS;
@@ -1942,6 +2388,7 @@ static int vdIoCtxProcessSync(PVDIOCTX pIoCtx)
         vdIoCtxFree(pDisk, pIoCtx);
     }
 
+    RTCritSectLeave(&pDisk->CritSectSyncIo);
     return rc;
 }
 
@@ -1964,6 +2411,19 @@ static int vdIoCtxLockDisk(PVBOXHDD pDisk, PVDIOCTX pIoCtx)
         vdIoCtxDefer(pDisk, pIoCtx);
         rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
     }
+    else if (ASMAtomicReadU32(&pDisk->cIoTasksParallelPending))
+    {
+        /*
+         * Transfers issued without the disk lock are still in flight. Wait for
+         * them to complete before changing metadata or flushing, the last one
+         * gets the blocked requests going again (see vdDiskUnlock()).
+         * No new ones can be issued as long as we hold the disk lock.
+         */
+        LogFlowFunc(("Transfers without the disk lock in flight, deferring\n"));
+        ASMAtomicXchgPtrT(&pDisk->pIoCtxLockOwner, NIL_VDIOCTX, PVDIOCTX);
+        vdIoCtxDefer(pDisk, pIoCtx);
+        rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
+    }
 
     LogFlowFunc(("returns -> %Rrc\n", rc));
     return rc;
@@ -2074,15 +2534,34 @@ static int vdReadHelperAsync(PVDIOCTX pIoCtx)
                                    pIoCtx, &cbThisRead);
             if (rc == VERR_VD_BLOCK_FREE)
             {
+                RTSGBUF SgBufSaved;
+                uint32_t cbTransferLeftSaved = pIoCtx->Req.Io.cbTransferLeft;
+
+                RTSgBufClone(&SgBufSaved, &pIoCtx->Req.Io.SgBuf);
                 rc = vdDiskReadHelper(pDisk, pCurrImage, NULL, uOffset, cbThisRead,
                                       pIoCtx, &cbThisRead);
 
-                /* If the read was successful, write the data back into the cache. */
+                /*
+                 * If the read was successful, write the data back into the cache.
+                 * The data was copied into the I/O context already, rewind it
+                 * to the start of the read and restore the state afterwards.
+                 * This is only possible for synchronous requests as the data
+                 * isn't there yet otherwise.
+                 */
                 if (   RT_SUCCESS(rc)
-                    && pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
+                    && (pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
+                    && (pIoCtx->fFlags & VDIOCTX_FLAGS_SYNC))
                 {
+                    RTSGBUF SgBufCur;
+                    uint32_t cbTransferLeftCur = pIoCtx->Req.Io.cbTransferLeft;
+
+                    RTSgBufClone(&SgBufCur, &pIoCtx->Req.Io.SgBuf);
+                    RTSgBufClone(&pIoCtx->Req.Io.SgBuf, &SgBufSaved);
+                    pIoCtx->Req.Io.cbTransferLeft = cbTransferLeftSaved;
                     rc = vdCacheWriteHelper(pDisk->pCache, uOffset, cbThisRead,
-                                            pIoCtx, NULL);
+                                            pIoCtx, NULL, 0 /* fWrite */);
+                    RTSgBufClone(&pIoCtx->Req.Io.SgBuf, &SgBufCur);
+                    pIoCtx->Req.Io.cbTransferLeft = cbTransferLeftCur;
                 }
             }
         }
@@ -2368,152 +2847,342 @@ static int vdWriteHelper(PVBOXHDD pDisk, PVDIMAGE pImage, uint64_t uOffset,
                            fFlags, 0);
 }
 
+/**
+ * Buffer of the image copy pipeline.
+ */
+typedef struct VDCOPYBUF
+{
+    /** The buffer. */
+    void               *pvBuf;
+    /** Start offset of the data in the buffer. */
+    uint64_t            uOffset;
+    /** Amount of data in the buffer. */
+    size_t              cbData;
+    /** Flag whether there is nothing to write for this range because it is
+     * unallocated in the source or all zeros and the destination is new. */
+    bool                fSkip;
+} VDCOPYBUF;
+/** Pointer to a copy pipeline buffer. */
+typedef VDCOPYBUF *PVDCOPYBUF;
+
+/**
+ * Image copy state shared between the reader thread and the writer.
+ */
+typedef struct VDCOPYSTATE
+{
+    /** Source disk. */
+    PVBOXHDD            pDiskFrom;
+    /** Source image. */
+    PVDIMAGE            pImageFrom;
+    /** Number of bytes to copy. */
+    uint64_t            cbSize;
+    /** Number of images to read from the source chain in blockwise mode. */
+    unsigned            cImagesFromRead;
+    /** Flag whether to copy blockwise, skipping unallocated blocks. */
+    bool                fBlockwiseCopy;
+    /** Flag whether ranges containing only zeros don't need to be written
+     * because the destination is a new base image. */
+    bool                fSkipZeroes;
+    /** Flag whether the writer wants the reader to stop. */
+    volatile bool       fCancel;
+    /** Flag whether the reader is done, either because everything was read
+     * or an error occurred. */
+    volatile bool       fReadDone;
+    /** Status code of the reader. */
+    int                 rcRead;
+    /** Number of filled buffers not yet processed by the writer. */
+    volatile uint32_t   cBufsFilled;
+    /** Event signalled by the reader when a buffer was filled. */
+    RTSEMEVENT          hEvtFilled;
+    /** Event signalled by the writer when a buffer was drained. */
+    RTSEMEVENT          hEvtDrained;
+    /** The buffers, used as a ring. */
+    VDCOPYBUF           aBufs[VD_COPY_BUFFERS];
+} VDCOPYSTATE;
+/** Pointer to the image copy state. */
+typedef VDCOPYSTATE *PVDCOPYSTATE;
+
+/**
+ * Internal: Reads the next chunk of data to copy from the source.
+ *
+ * @returns VBox status code, VERR_VD_BLOCK_FREE if the range is unallocated.
+ * @param   pState          The copy state.
+ * @param   pBuf            The buffer to read into, uOffset is set.
+ *                          cbData is updated with the amount of data read.
+ */
+static int vdCopyHelperRead(PVDCOPYSTATE pState, PVDCOPYBUF pBuf)
+{
+    int rc;
+    PVBOXHDD pDiskFrom = pState->pDiskFrom;
+    PVDIMAGE pImageFrom = pState->pImageFrom;
+    size_t cbThisRead = pBuf->cbData;
+
+    if (pState->fBlockwiseCopy)
+    {
+        RTSGSEG SegmentBuf;
+        RTSGBUF SgBuf;
+        VDIOCTX IoCtx;
+
+        SegmentBuf.pvSeg = pBuf->pvBuf;
+        SegmentBuf.cbSeg = VD_COPY_BUFFER_SIZE;
+        RTSgBufInit(&SgBuf, &SegmentBuf, 1);
+        vdIoCtxInit(&IoCtx, pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
+                    &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+
+        /* Read the source data. */
+        rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
+                                          pBuf->uOffset, cbThisRead, &IoCtx,
+                                          &cbThisRead);
+
+        if (   rc == VERR_VD_BLOCK_FREE
+            && pState->cImagesFromRead != 1)
+        {
+            unsigned cImagesToProcess = pState->cImagesFromRead;
+
+            for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
+                 pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
+                 pCurrImage = pCurrImage->pPrev)
+            {
+                rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                                  pBuf->uOffset, cbThisRead,
+                                                  &IoCtx, &cbThisRead);
+                if (cImagesToProcess == 1)
+                    break;
+                else if (cImagesToProcess > 0)
+                    cImagesToProcess--;
+            }
+        }
+    }
+    else
+        rc = vdReadHelper(pDiskFrom, pImageFrom, pBuf->uOffset, pBuf->pvBuf, cbThisRead,
+                          false /* fUpdateCache */);
+
+    pBuf->cbData = cbThisRead;
+    return rc;
+}
+
+/**
+ * Reader thread of the image copy pipeline.
+ *
+ * Reads the source image into the ring of buffers ahead of the writer so
+ * reading the source and writing the destination overlap.
+ *
+ * @returns VBox status code.
+ * @param   hThreadSelf     Thread handle.
+ * @param   pvUser          Pointer to the copy state.
+ */
+static DECLCALLBACK(int) vdCopyHelperReadThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVDCOPYSTATE pState = (PVDCOPYSTATE)pvUser;
+    uint64_t uOffset = 0;
+    unsigned idxBuf = 0;
+    int rc = VINF_SUCCESS;
+    int rc2;
+    NOREF(hThreadSelf);
+
+    while (   uOffset < pState->cbSize
+           && !ASMAtomicReadBool(&pState->fCancel))
+    {
+        /* Wait for a free buffer. */
+        if (ASMAtomicReadU32(&pState->cBufsFilled) == VD_COPY_BUFFERS)
+        {
+            RTSemEventWait(pState->hEvtDrained, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        PVDCOPYBUF pBuf = &pState->aBufs[idxBuf];
+        pBuf->uOffset = uOffset;
+        pBuf->cbData  = (size_t)RT_MIN(VD_COPY_BUFFER_SIZE, pState->cbSize - uOffset);
+        pBuf->fSkip   = false;
+
+        /* Note that we don't attempt to synchronize cross-disk accesses.
+         * It wouldn't be very difficult to do, just the lock order would
+         * need to be defined somehow to prevent deadlocks. Postpone such
+         * magic as there is no use case for this. */
+        rc2 = vdThreadStartRead(pState->pDiskFrom);
+        AssertRC(rc2);
+        rc = vdCopyHelperRead(pState, pBuf);
+        rc2 = vdThreadFinishRead(pState->pDiskFrom);
+        AssertRC(rc2);
+
+        if (rc == VERR_VD_BLOCK_FREE)
+        {
+            /* Don't propagate the error to the outside */
+            pBuf->fSkip = true;
+            rc = VINF_SUCCESS;
+        }
+        else if (RT_FAILURE(rc))
+            break;
+        else if (   pState->fSkipZeroes
+                 && ASMBitFirstSet((volatile void *)pBuf->pvBuf, (uint32_t)pBuf->cbData * 8) == -1)
+            pBuf->fSkip = true;
+
+        uOffset += pBuf->cbData;
+        idxBuf = (idxBuf + 1) % VD_COPY_BUFFERS;
+
+        ASMAtomicIncU32(&pState->cBufsFilled);
+        RTSemEventSignal(pState->hEvtFilled);
+    }
+
+    pState->rcRead = rc;
+    ASMAtomicWriteBool(&pState->fReadDone, true);
+    RTSemEventSignal(pState->hEvtFilled);
+    return rc;
+}
+
 /**
  * Internal: Copies the content of one disk to another one applying optimizations
  * to speed up the copy process if possible.
+ *
+ * The source is read by a separate thread into a ring of buffers while the
+ * calling thread writes the buffers to the destination.
  */
 static int vdCopyHelper(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskTo,
                         uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
-                        bool fSuppressRedundantIo, PVDINTERFACEPROGRESS pIfProgress,
+                        bool fSuppressRedundantIo, bool fSkipZeroes,
+                        PVDINTERFACEPROGRESS pIfProgress,
                         PVDINTERFACEPROGRESS pDstIfProgress)
 {
     int rc = VINF_SUCCESS;
     int rc2;
     uint64_t uOffset = 0;
-    uint64_t cbRemaining = cbSize;
-    void *pvBuf = NULL;
-    bool fLockReadFrom = false;
-    bool fLockWriteTo = false;
+    unsigned idxBuf = 0;
     bool fBlockwiseCopy = fSuppressRedundantIo || (cImagesFromRead > 0);
     unsigned uProgressOld = 0;
+    PVDCOPYSTATE pState = NULL;
+    RTTHREAD hThreadRead = NIL_RTTHREAD;
 
-    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool pIfProgress=%#p pDstIfProgress=%#p\n",
-                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, pDstIfProgress, pDstIfProgress));
+    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool fSkipZeroes=%RTbool pIfProgress=%#p pDstIfProgress=%#p\n",
+                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, fSkipZeroes, pDstIfProgress, pDstIfProgress));
 
-    /* Allocate tmp buffer. */
-    pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
-    if (!pvBuf)
-        return rc;
+    pState = (PVDCOPYSTATE)RTMemAllocZ(sizeof(VDCOPYSTATE));
+    if (!pState)
+        return VERR_NO_MEMORY;
+
+    pState->pDiskFrom       = pDiskFrom;
+    pState->pImageFrom      = pImageFrom;
+    pState->cbSize          = cbSize;
+    pState->cImagesFromRead = cImagesFromRead;
+    pState->fBlockwiseCopy  = fBlockwiseCopy;
+    pState->fSkipZeroes     = fSkipZeroes;
+    pState->hEvtFilled      = NIL_RTSEMEVENT;
+    pState->hEvtDrained     = NIL_RTSEMEVENT;
 
     do
     {
-        size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
-
-        /* Note that we don't attempt to synchronize cross-disk accesses.
-         * It wouldn't be very difficult to do, just the lock order would
-         * need to be defined somehow to prevent deadlocks. Postpone such
-         * magic as there is no use case for this. */
-
-        rc2 = vdThreadStartRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = true;
-
-        if (fBlockwiseCopy)
+        /* Allocate tmp buffers. */
+        for (unsigned i = 0; i < VD_COPY_BUFFERS; i++)
         {
-            RTSGSEG SegmentBuf;
-            RTSGBUF SgBuf;
-            VDIOCTX IoCtx;
-
-            SegmentBuf.pvSeg = pvBuf;
-            SegmentBuf.cbSeg = VD_MERGE_BUFFER_SIZE;
-            RTSgBufInit(&SgBuf, &SegmentBuf, 1);
-            vdIoCtxInit(&IoCtx, pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
-                        &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
-
-            /* Read the source data. */
-            rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
-                                              uOffset, cbThisRead, &IoCtx,
-                                              &cbThisRead);
-
-            if (   rc == VERR_VD_BLOCK_FREE
-                && cImagesFromRead != 1)
+            pState->aBufs[i].pvBuf = RTMemTmpAlloc(VD_COPY_BUFFER_SIZE);
+            if (!pState->aBufs[i].pvBuf)
             {
-                unsigned cImagesToProcess = cImagesFromRead;
-
-                for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
-                     pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
-                     pCurrImage = pCurrImage->pPrev)
-                {
-                    rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                           uOffset, cbThisRead,
-                                                           &IoCtx, &cbThisRead);
-                    if (cImagesToProcess == 1)
-                        break;
-                    else if (cImagesToProcess > 0)
-                        cImagesToProcess--;
-                }
+                rc = VERR_NO_MEMORY;
+                break;
             }
         }
-        else
-            rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
-                              false /* fUpdateCache */);
+        if (RT_FAILURE(rc))
+            break;
 
-        if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
+        rc = RTSemEventCreate(&pState->hEvtFilled);
+        if (RT_FAILURE(rc))
+            break;
+        rc = RTSemEventCreate(&pState->hEvtDrained);
+        if (RT_FAILURE(rc))
             break;
 
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = false;
+        rc = RTThreadCreate(&hThreadRead, vdCopyHelperReadThread, pState, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "VDCopy");
+        if (RT_FAILURE(rc))
+            break;
 
-        if (rc != VERR_VD_BLOCK_FREE)
+        while (uOffset < cbSize)
         {
-            rc2 = vdThreadStartWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = true;
-
-            /* Only do collapsed I/O if we are copying the data blockwise. */
-            rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
-                                 cbThisRead, VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG /* fFlags */,
-                                 fBlockwiseCopy ? cImagesToRead : 0);
-            if (RT_FAILURE(rc))
-                break;
+            /* Wait for the reader to fill the next buffer. */
+            if (!ASMAtomicReadU32(&pState->cBufsFilled))
+            {
+                if (ASMAtomicReadBool(&pState->fReadDone))
+                {
+                    /* Check again, the reader might have filled a buffer before finishing. */
+                    if (!ASMAtomicReadU32(&pState->cBufsFilled))
+                    {
+                        rc = RT_FAILURE(pState->rcRead) ? pState->rcRead : VERR_INTERNAL_ERROR;
+                        break;
+                    }
+                }
+                else
+                {
+                    RTSemEventWait(pState->hEvtFilled, RT_INDEFINITE_WAIT);
+                    continue;
+                }
+            }
 
-            rc2 = vdThreadFinishWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = false;
-        }
-        else /* Don't propagate the error to the outside */
-            rc = VINF_SUCCESS;
+            PVDCOPYBUF pBuf = &pState->aBufs[idxBuf];
+            Assert(pBuf->uOffset == uOffset);
 
-        uOffset += cbThisRead;
-        cbRemaining -= cbThisRead;
+            if (!pBuf->fSkip)
+            {
+                rc2 = vdThreadStartWrite(pDiskTo);
+                AssertRC(rc2);
 
-        unsigned uProgressNew = uOffset * 99 / cbSize;
-        if (uProgressNew != uProgressOld)
-        {
-            uProgressOld = uProgressNew;
+                /* Only do collapsed I/O if we are copying the data blockwise. */
+                rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, pBuf->uOffset, pBuf->pvBuf,
+                                     pBuf->cbData, VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG /* fFlags */,
+                                     fBlockwiseCopy ? cImagesToRead : 0);
 
-            if (pIfProgress && pIfProgress->pfnProgress)
-            {
-                rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
-                                              uProgressOld);
+                rc2 = vdThreadFinishWrite(pDiskTo);
+                AssertRC(rc2);
                 if (RT_FAILURE(rc))
                     break;
             }
-            if (pDstIfProgress && pDstIfProgress->pfnProgress)
+
+            uOffset += pBuf->cbData;
+            idxBuf = (idxBuf + 1) % VD_COPY_BUFFERS;
+
+            ASMAtomicDecU32(&pState->cBufsFilled);
+            RTSemEventSignal(pState->hEvtDrained);
+
+            unsigned uProgressNew = uOffset * 99 / cbSize;
+            if (uProgressNew != uProgressOld)
             {
-                rc = pDstIfProgress->pfnProgress(pDstIfProgress->Core.pvUser,
-                                                 uProgressOld);
-                if (RT_FAILURE(rc))
-                    break;
+                uProgressOld = uProgressNew;
+
+                if (pIfProgress && pIfProgress->pfnProgress)
+                {
+                    rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
+                                                  uProgressOld);
+                    if (RT_FAILURE(rc))
+                        break;
+                }
+                if (pDstIfProgress && pDstIfProgress->pfnProgress)
+                {
+                    rc = pDstIfProgress->pfnProgress(pDstIfProgress->Core.pvUser,
+                                                     uProgressOld);
+                    if (RT_FAILURE(rc))
+                        break;
+                }
             }
         }
-    } while (uOffset < cbSize);
-
-    RTMemFree(pvBuf);
+    } while (0);
 
-    if (fLockReadFrom)
+    if (hThreadRead != NIL_RTTHREAD)
     {
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
-    }
+        /* Stop the reader if we bailed out early. */
+        ASMAtomicWriteBool(&pState->fCancel, true);
+        RTSemEventSignal(pState->hEvtDrained);
 
-    if (fLockWriteTo)
-    {
-        rc2 = vdThreadFinishWrite(pDiskTo);
+        rc2 = RTThreadWait(hThreadRead, RT_INDEFINITE_WAIT, NULL);
         AssertRC(rc2);
     }
 
+    if (pState->hEvtDrained != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pState->hEvtDrained);
+    if (pState->hEvtFilled != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pState->hEvtFilled);
+    for (unsigned i = 0; i < VD_COPY_BUFFERS; i++)
+        if (pState->aBufs[i].pvBuf)
+            RTMemTmpFree(pState->aBufs[i].pvBuf);
+    RTMemFree(pState);
+
     LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
@@ -2966,6 +3635,29 @@ static int vdWriteHelperAsync(PVDIOCTX pIoCtx)
             break;
         }
 
+        /*
+         * Give the cache the chance to take the data first. The image is only
+         * written if the cache doesn't want it (write-through) and the cache
+         * drops any stale copy of the range in that case.
+         */
+        if (   pDisk->pCache
+            && pImage == pDisk->pLast
+            && !(pIoCtx->fFlags & VDIOCTX_FLAGS_NO_CACHE))
+        {
+            rc = vdCacheWriteHelper(pDisk->pCache, uOffset, cbThisWrite, pIoCtx,
+                                    &cbThisWrite, VD_CACHE_WRITE_GUEST);
+            if (rc != VERR_VD_BLOCK_FREE)
+            {
+                if (   RT_FAILURE(rc)
+                    && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                    break;
+
+                cbWrite -= cbThisWrite;
+                uOffset += cbThisWrite;
+                continue;
+            }
+        }
+
         fWrite =   (pImage->uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME)
                  ? 0 : VD_WRITE_NO_ALLOC;
         rc = pImage->Backend->pfnWrite(pImage->pBackendData, uOffset, cbThisWrite,
@@ -3089,42 +3781,287 @@ static int vdWriteHelperAsync(PVDIOCTX pIoCtx)
 }
 
 /**
- * Flush helper async version.
+ * Flush helper async version.
+ */
+static int vdFlushHelperAsync(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVBOXHDD pDisk = pIoCtx->pDisk;
+    PVDIMAGE pImage = pIoCtx->Req.Io.pImageCur;
+
+    rc = vdIoCtxLockDisk(pDisk, pIoCtx);
+    if (RT_SUCCESS(rc))
+    {
+        /* Mark the whole disk as locked. */
+        pDisk->uOffsetStartLocked = 0;
+        pDisk->uOffsetEndLocked = UINT64_C(0xffffffffffffffff);
+
+        vdResetModifiedFlag(pDisk);
+        rc = pImage->Backend->pfnFlush(pImage->pBackendData, pIoCtx);
+        if (   (   RT_SUCCESS(rc)
+                || rc == VERR_VD_ASYNC_IO_IN_PROGRESS
+                || rc == VERR_VD_IOCTX_HALT)
+            && pDisk->pCache
+            && !(pIoCtx->fFlags & VDIOCTX_FLAGS_NO_CACHE))
+        {
+            rc = pDisk->pCache->Backend->pfnFlush(pDisk->pCache->pBackendData, pIoCtx);
+            if (   RT_SUCCESS(rc)
+                || (   rc != VERR_VD_ASYNC_IO_IN_PROGRESS
+                    && rc != VERR_VD_IOCTX_HALT))
+                vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+            else if (rc != VERR_VD_IOCTX_HALT)
+                rc = VINF_SUCCESS;
+        }
+        else if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            rc = VINF_SUCCESS;
+        else if (rc != VERR_VD_IOCTX_HALT)/* Some other error. */
+            vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+    }
+
+    return rc;
+}
+
+/**
+ * Writes back a batch of dirty data from the cache to the last image.
+ *
+ * The write lock is taken for every range written back and for the final
+ * flush separately, so other users of the disk don't have to wait for the
+ * whole batch. Guest writes to a range being written back are handled by
+ * the cache, the range stays dirty then.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND if there was nothing to write back.
+ * @param   pDisk     The disk.
+ * @param   pCache    The cache to write back.
+ * @param   fAll      Flag whether to write back regardless of the thresholds
+ *                    of the cache.
+ * @param   fLock     Flag whether to take the write lock, false if the caller
+ *                    holds it already.
+ */
+static int vdCacheDestage(PVBOXHDD pDisk, PVDCACHE pCache, bool fAll, bool fLock)
+{
+    uint64_t auCookies[VD_CACHE_DESTAGE_RANGES_MAX];
+    unsigned cCookies = 0;
+    size_t cbDestaged = 0;
+    int rc = VINF_SUCCESS;
+    int rc2;
+
+    while (   cCookies < RT_ELEMENTS(auCookies)
+           && cbDestaged < VD_CACHE_DESTAGE_BUF_SIZE)
+    {
+        uint64_t uOffset = 0;
+        size_t cbDestage = 0;
+
+        if (fLock)
+        {
+            rc2 = vdThreadStartWrite(pDisk);
+            AssertRC(rc2);
+        }
+
+        if (pDisk->pLast)
+        {
+            rc = pCache->Backend->pfnDestageGet(pCache->pBackendData, fAll, pCache->pvDestageBuf,
+                                                VD_CACHE_DESTAGE_BUF_SIZE, &uOffset, &cbDestage,
+                                                &auCookies[cCookies]);
+            if (RT_SUCCESS(rc))
+            {
+                cCookies++;
+                cbDestaged += cbDestage;
+
+                /* The write filters were applied before the data went into the cache. */
+                rc = vdWriteHelper(pDisk, pDisk->pLast, uOffset, pCache->pvDestageBuf, cbDestage,
+                                     VDIOCTX_FLAGS_NO_CACHE
+                                   | VDIOCTX_FLAGS_WRITE_FILTER_APPLIED
+                                   | VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG);
+            }
+        }
+        else
+            rc = VERR_NOT_FOUND;
+
+        if (fLock)
+        {
+            rc2 = vdThreadFinishWrite(pDisk);
+            AssertRC(rc2);
+        }
+
+        if (RT_FAILURE(rc))
+            break;
+    }
+
+    if (!cCookies)
+        return rc;
+
+    if (fLock)
+    {
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    if (   (RT_SUCCESS(rc) || rc == VERR_NOT_FOUND)
+        && !pDisk->pLast)
+        rc = VERR_VD_NOT_OPENED;
+
+    if (RT_SUCCESS(rc) || rc == VERR_NOT_FOUND)
+    {
+        /* The data must be on the image before the cache forgets about it. */
+        PVDIOCTX pIoCtx = vdIoCtxRootAlloc(pDisk, VDIOCTXTXDIR_FLUSH, 0,
+                                           0, pDisk->pLast, NULL,
+                                           vdIoCtxSyncComplete, pDisk, NULL,
+                                           NULL, vdFlushHelperAsync,
+                                           VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_NO_CACHE);
+        if (pIoCtx)
+            rc = vdIoCtxProcessSync(pIoCtx);
+        else
+            rc = VERR_NO_MEMORY;
+    }
+
+    rc2 = pCache->Backend->pfnDestageComplete(pCache->pBackendData, auCookies, cCookies, rc);
+    if (RT_SUCCESS(rc))
+        rc = rc2;
+
+    if (fLock)
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    return rc;
+}
+
+/**
+ * The cache destage thread, writes back dirty data in the background.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hThread   The thread handle.
+ * @param   pvUser    The cache.
+ */
+static DECLCALLBACK(int) vdCacheDestageThread(RTTHREAD hThread, void *pvUser)
+{
+    PVDCACHE pCache = (PVDCACHE)pvUser;
+    PVBOXHDD pDisk = pCache->VDIo.pDisk;
+    bool fErrorLogged = false;
+
+    NOREF(hThread);
+
+    while (!ASMAtomicReadBool(&pCache->fDestageShutdown))
+    {
+        int rc = vdCacheDestage(pDisk, pCache, false /* fAll */, true /* fLock */);
+
+        if (RT_SUCCESS(rc))
+            continue; /* More to do. */
+
+        if (   rc != VERR_NOT_FOUND
+            && !fErrorLogged)
+        {
+            LogRel(("VD: Writing back data from cache '%s' failed with %Rrc\n",
+                    pCache->pszFilename, rc));
+            fErrorLogged = true;
+        }
+
+        RTSemEventWait(pCache->hEvtDestage, 1000);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Starts the destage thread if the cache supports write-back caching.
+ *
+ * @returns VBox status code.
+ * @param   pCache    The cache.
+ */
+static int vdCacheDestageStart(PVDCACHE pCache)
+{
+    if (   !pCache->Backend->pfnDestageGet
+        || !pCache->Backend->pfnDestageComplete
+        || (pCache->Backend->pfnGetOpenFlags(pCache->pBackendData) & VD_OPEN_FLAGS_READONLY))
+        return VINF_SUCCESS;
+
+    pCache->pvDestageBuf = RTMemPageAlloc(VD_CACHE_DESTAGE_BUF_SIZE);
+    if (!pCache->pvDestageBuf)
+        return VERR_NO_MEMORY;
+
+    int rc = RTSemEventCreate(&pCache->hEvtDestage);
+    if (RT_SUCCESS(rc))
+    {
+        pCache->fDestageShutdown = false;
+        rc = RTThreadCreate(&pCache->hThreadDestage, vdCacheDestageThread, pCache, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "VDCacheWB");
+        if (RT_FAILURE(rc))
+        {
+            RTSemEventDestroy(pCache->hEvtDestage);
+            pCache->hEvtDestage = NIL_RTSEMEVENT;
+            pCache->hThreadDestage = NIL_RTTHREAD;
+        }
+    }
+
+    if (RT_FAILURE(rc))
+    {
+        RTMemPageFree(pCache->pvDestageBuf, VD_CACHE_DESTAGE_BUF_SIZE);
+        pCache->pvDestageBuf = NULL;
+    }
+
+    return rc;
+}
+
+/**
+ * Stops the destage thread, must be called without holding the disk lock.
+ *
+ * @param   pCache    The cache.
  */
-static int vdFlushHelperAsync(PVDIOCTX pIoCtx)
+static void vdCacheDestageStop(PVDCACHE pCache)
+{
+    if (pCache->hThreadDestage != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&pCache->fDestageShutdown, true);
+        RTSemEventSignal(pCache->hEvtDestage);
+        int rc = RTThreadWait(pCache->hThreadDestage, RT_INDEFINITE_WAIT, NULL);
+        AssertRC(rc);
+        pCache->hThreadDestage = NIL_RTTHREAD;
+        RTSemEventDestroy(pCache->hEvtDestage);
+        pCache->hEvtDestage = NIL_RTSEMEVENT;
+    }
+}
+
+/**
+ * Writes back all dirty data of the cache and closes it.
+ *
+ * @returns VBox status code.
+ * @param   pDisk     The disk, the caller holds the write lock.
+ * @param   pCache    The cache to close, the destage thread must be stopped.
+ * @param   fDelete   Flag whether to delete the cache image.
+ */
+static int vdCacheCloseInternal(PVBOXHDD pDisk, PVDCACHE pCache, bool fDelete)
 {
     int rc = VINF_SUCCESS;
-    PVBOXHDD pDisk = pIoCtx->pDisk;
-    PVDIMAGE pImage = pIoCtx->Req.Io.pImageCur;
 
-    rc = vdIoCtxLockDisk(pDisk, pIoCtx);
-    if (RT_SUCCESS(rc))
+    if (pCache->pvDestageBuf)
     {
-        /* Mark the whole disk as locked. */
-        pDisk->uOffsetStartLocked = 0;
-        pDisk->uOffsetEndLocked = UINT64_C(0xffffffffffffffff);
+        do
+            rc = vdCacheDestage(pDisk, pCache, true /* fAll */, false /* fLock */);
+        while (RT_SUCCESS(rc));
 
-        vdResetModifiedFlag(pDisk);
-        rc = pImage->Backend->pfnFlush(pImage->pBackendData, pIoCtx);
-        if (   (   RT_SUCCESS(rc)
-                || rc == VERR_VD_ASYNC_IO_IN_PROGRESS
-                || rc == VERR_VD_IOCTX_HALT)
-            && pDisk->pCache)
+        if (rc == VERR_NOT_FOUND)
+            rc = VINF_SUCCESS;
+        else
         {
-            rc = pDisk->pCache->Backend->pfnFlush(pDisk->pCache->pBackendData, pIoCtx);
-            if (   RT_SUCCESS(rc)
-                || (   rc != VERR_VD_ASYNC_IO_IN_PROGRESS
-                    && rc != VERR_VD_IOCTX_HALT))
-                vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
-            else if (rc != VERR_VD_IOCTX_HALT)
-                rc = VINF_SUCCESS;
+            /* Keep the cache image, it holds the only copy of the data. */
+            LogRel(("VD: Writing back data from cache '%s' failed with %Rrc, keeping it\n",
+                    pCache->pszFilename, rc));
+            fDelete = false;
         }
-        else if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
-            rc = VINF_SUCCESS;
-        else if (rc != VERR_VD_IOCTX_HALT)/* Some other error. */
-            vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+
+        RTMemPageFree(pCache->pvDestageBuf, VD_CACHE_DESTAGE_BUF_SIZE);
+        pCache->pvDestageBuf = NULL;
     }
 
+    int rc2 = pCache->Backend->pfnClose(pCache->pBackendData, fDelete);
+    if (RT_SUCCESS(rc))
+        rc = rc2;
+
+    if (pCache->pszFilename)
+        RTStrFree(pCache->pszFilename);
+    RTMemFree(pCache);
     return rc;
 }
 
@@ -3459,6 +4396,111 @@ static int vdDiscardHelperAsync(PVDIOCTX pIoCtx)
     return rc;
 }
 
+/**
+ * Online compaction helper - frees all blocks of the last image in the given
+ * range which contain only zeros.
+ *
+ * The whole disk is locked while the range is processed because the backend
+ * relocates blocks in the image file to fill the holes. If there are user data
+ * transfers in flight the step is aborted to not delay guest I/O, the caller
+ * has to retry later.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_TRY_AGAIN if there is I/O in flight.
+ * @param   pIoCtx    The I/O context to operate on.
+ */
+static int vdCompactOnlineHelper(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVBOXHDD pDisk = pIoCtx->pDisk;
+    PVDIMAGE pImage = pDisk->pLast;
+    PVDCOMPACTONLINE pCompact = (PVDCOMPACTONLINE)pIoCtx->Type.Root.pvUser2;
+    uint64_t offCur = pIoCtx->Req.Discard.paRanges[0].offStart;
+    size_t   cbLeft = pIoCtx->Req.Discard.paRanges[0].cbRange;
+
+    LogFlowFunc(("pIoCtx=%#p\n", pIoCtx));
+
+    if (pDisk->pIoCtxLockOwner != pIoCtx)
+    {
+        rc = vdIoCtxLockDisk(pDisk, pIoCtx);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    if (ASMAtomicReadU32(&pDisk->cIoTasksUserPending))
+    {
+        LogFlowFunc(("User I/O in flight, retry later\n"));
+        vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+        return VERR_TRY_AGAIN;
+    }
+
+    /* Block moves may affect every part of the disk. */
+    pDisk->uOffsetStartLocked = 0;
+    pDisk->uOffsetEndLocked   = UINT64_MAX;
+
+    uint64_t cbFileStart = pImage->Backend->pfnGetFileSize(pImage->pBackendData);
+
+    while (cbLeft)
+    {
+        size_t cbThisRead = 0;
+        RTSGSEG Seg;
+        RTSGBUF SgBuf;
+        VDIOCTX IoCtx;
+
+        Seg.pvSeg = pCompact->pvBuf;
+        Seg.cbSeg = RT_MIN(cbLeft, pCompact->cbBuf);
+        RTSgBufInit(&SgBuf, &Seg, 1);
+
+        vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_READ, offCur, Seg.cbSeg, pImage,
+                    &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+        rc = pImage->Backend->pfnRead(pImage->pBackendData, offCur, Seg.cbSeg,
+                                      &IoCtx, &cbThisRead);
+        if (rc == VERR_VD_BLOCK_FREE)
+            rc = VINF_SUCCESS; /* Nothing to reclaim here. */
+        else if (   RT_SUCCESS(rc)
+                 && ASMBitFirstSet(pCompact->pvBuf, (uint32_t)cbThisRead * 8) == -1)
+        {
+            /*
+             * The range contains only zeros. The backend checks the rest of the block
+             * if the range doesn't cover it completely and frees it only if it is unused.
+             */
+            size_t cbPreAllocated = 0;
+            size_t cbPostAllocated = 0;
+            size_t cbActuallyDiscarded = 0;
+            void *pbmAllocationBitmap = NULL;
+
+            vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_DISCARD, 0, 0, NULL,
+                        NULL, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+            rc = pImage->Backend->pfnDiscard(pImage->pBackendData, &IoCtx, offCur, cbThisRead,
+                                             &cbPreAllocated, &cbPostAllocated,
+                                             &cbActuallyDiscarded, &pbmAllocationBitmap, 0);
+            if (rc == VERR_VD_DISCARD_ALIGNMENT_NOT_MET)
+            {
+                /* Other parts of the block still contain data. */
+                RTMemFree(pbmAllocationBitmap);
+                rc = VINF_SUCCESS;
+            }
+        }
+
+        if (RT_FAILURE(rc))
+            break;
+
+        Assert(cbThisRead && cbThisRead <= cbLeft);
+        offCur += cbThisRead;
+        cbLeft -= cbThisRead;
+        pCompact->cbScanned += cbThisRead;
+    }
+
+    uint64_t cbFileEnd = pImage->Backend->pfnGetFileSize(pImage->pBackendData);
+    if (cbFileEnd < cbFileStart)
+        pCompact->cbReclaimed += cbFileStart - cbFileEnd;
+
+    vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
 #ifndef VBOX_HDD_NO_DYNAMIC_BACKENDS
 /**
  * @copydoc VDPLUGIN::pfnRegisterImage
@@ -4406,6 +5448,8 @@ static int vdDiskUnlock(PVBOXHDD pDisk, PVDIOCTX pIoCtxRc)
     vdIoTaskProcessWaitingList(pDisk);
     vdIoCtxProcessHaltedList(pDisk);
     rc = vdDiskProcessWaitingIoCtx(pDisk, pIoCtxRc);
+    if (vdDiskBlockedIoCtxDrained(pDisk))
+        vdDiskProcessBlockedIoCtx(pDisk);
     ASMAtomicXchgBool(&pDisk->fLocked, false);
 
     /*
@@ -4415,14 +5459,17 @@ static int vdDiskUnlock(PVBOXHDD pDisk, PVDIOCTX pIoCtxRc)
      */
     while (   ASMAtomicUoReadPtrT(&pDisk->pIoCtxHead, PVDIOCTX) != NULL
            || ASMAtomicUoReadPtrT(&pDisk->pIoTasksPendingHead, PVDIOTASK) != NULL
-           || ASMAtomicUoReadPtrT(&pDisk->pIoCtxHaltedHead, PVDIOCTX) != NULL)
+           || ASMAtomicUoReadPtrT(&pDisk->pIoCtxHaltedHead, PVDIOCTX) != NULL
+           || vdDiskBlockedIoCtxDrained(pDisk))
     {
         /* Try lock disk again. */
-        if (ASMAtomicCmpXchgBool(&pDisk->fLocked, true, false))
+        if (vdDiskTryLock(pDisk))
         {
             vdIoTaskProcessWaitingList(pDisk);
             vdIoCtxProcessHaltedList(pDisk);
             vdDiskProcessWaitingIoCtx(pDisk, NULL);
+            if (vdDiskBlockedIoCtxDrained(pDisk))
+                vdDiskProcessBlockedIoCtx(pDisk);
             ASMAtomicXchgBool(&pDisk->fLocked, false);
         }
         else /* Let the other thread everything when he unlocks the disk. */
@@ -4458,7 +5505,7 @@ static void vdXferTryLockDiskDeferIoTask(PVDIOTASK pIoTask)
         ASMNopPause();
     }
 
-    if (ASMAtomicCmpXchgBool(&pDisk->fLocked, true, false))
+    if (vdDiskTryLock(pDisk))
     {
         /* Release disk lock, it will take care of processing all lists. */
         vdDiskUnlock(pDisk, NULL);
@@ -4472,7 +5519,10 @@ static int vdIOIntReqCompleted(void *pvUser, int rcReq)
     LogFlowFunc(("Task completed pIoTask=%#p\n", pIoTask));
 
     pIoTask->rcReq = rcReq;
-    vdXferTryLockDiskDeferIoTask(pIoTask);
+    if (pIoTask->fParallel)
+        vdIoCtxParallelXferCompleted(pIoTask);
+    else
+        vdXferTryLockDiskDeferIoTask(pIoTask);
     return VINF_SUCCESS;
 }
 
@@ -4579,8 +5629,54 @@ static int vdIOIntSetSize(void *pvUser, PVDIOSTORAGE pIoStorage,
                                            pIoStorage->pStorage, cbSize);
 }
 
+/**
+ * Completion callback for one task of a split user data transfer.
+ */
+static int vdIOIntUserXferSplitCompleted(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVDIOUSERXFER pXfer = (PVDIOUSERXFER)pvUser;
+    int rc = VINF_SUCCESS;
+
+    if (RT_FAILURE(rcReq))
+        ASMAtomicCmpXchgS32(&pXfer->rcReq, rcReq, VINF_SUCCESS);
+
+    if (!ASMAtomicDecU32(&pXfer->cRefs))
+    {
+        if (pXfer->pfnComplete)
+            rc = pXfer->pfnComplete(pBackendData, pIoCtx, pXfer->pvUser, pXfer->rcReq);
+        RTMemFree(pXfer);
+    }
+
+    return rc;
+}
+
+/**
+ * Drops the reference of the initiator to a split user data transfer after
+ * all tasks were spawned.
+ *
+ * @returns Status code to return to the backend.
+ * @param   pXfer    The split transfer.
+ * @param   rc       Status code of the last spawned task.
+ */
+static int vdIOIntUserXferSplitRelease(PVDIOUSERXFER pXfer, int rc)
+{
+    /*
+     * The tasks can't complete while the disk is locked, so the last reference
+     * is only ours if every task completed already.
+     */
+    if (!ASMAtomicDecU32(&pXfer->cRefs))
+        RTMemFree(pXfer);
+    else if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
+    else
+        pXfer->pfnComplete = NULL; /* The backend cleans up after the failure itself. */
+
+    return rc;
+}
+
 static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffset,
-                           PVDIOCTX pIoCtx, size_t cbRead)
+                           PVDIOCTX pIoCtx, size_t cbRead, PFNVDXFERCOMPLETED pfnComplete,
+                           void *pvCompleteUser)
 {
     int rc = VINF_SUCCESS;
     PVDIO    pVDIo = (PVDIO)pvUser;
@@ -4590,8 +5686,10 @@ static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
                  pvUser, pIoStorage, uOffset, pIoCtx, cbRead));
 
     /** @todo: Enable check for sync I/O later. */
-    if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_SYNC))
+    if (!(pIoCtx->fFlags & (VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_PARALLEL)))
         VD_IS_LOCKED(pDisk);
+    Assert(   !(pIoCtx->fFlags & VDIOCTX_FLAGS_PARALLEL)
+           || !pfnComplete);
 
     Assert(cbRead > 0);
 
@@ -4620,6 +5718,8 @@ static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
     }
     else
     {
+        PVDIOUSERXFER pXfer = NULL;
+
         /* Build the S/G array and spawn a new I/O task */
         while (cbRead)
         {
@@ -4627,6 +5727,18 @@ static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
             unsigned cSegments  = VD_IO_TASK_SEGMENTS_MAX;
             size_t   cbTaskRead = RTSgBufSegArrayCreate(&pIoCtx->Req.Io.SgBuf, aSeg, &cSegments, cbRead);
 
+            if (   pfnComplete
+                && !pXfer
+                && cbTaskRead < cbRead)
+            {
+                pXfer = (PVDIOUSERXFER)RTMemAllocZ(sizeof(VDIOUSERXFER));
+                if (!pXfer)
+                    return VERR_NO_MEMORY;
+                pXfer->cRefs       = 1;
+                pXfer->pfnComplete = pfnComplete;
+                pXfer->pvUser      = pvCompleteUser;
+            }
+
             Assert(cSegments > 0);
             Assert(cbTaskRead > 0);
             AssertMsg(cbTaskRead <= cbRead, ("Invalid number of bytes to read\n"));
@@ -4640,12 +5752,19 @@ static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
 #endif
 
             Assert(cbTaskRead == (uint32_t)cbTaskRead);
-            PVDIOTASK pIoTask = vdIoTaskUserAlloc(pIoStorage, NULL, NULL, pIoCtx, (uint32_t)cbTaskRead);
+            PVDIOTASK pIoTask = pXfer
+                              ? vdIoTaskUserAlloc(pIoStorage, vdIOIntUserXferSplitCompleted, pXfer, pIoCtx, (uint32_t)cbTaskRead)
+                              : vdIoTaskUserAlloc(pIoStorage, pfnComplete, pvCompleteUser, pIoCtx, (uint32_t)cbTaskRead);
 
             if (!pIoTask)
-                return VERR_NO_MEMORY;
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
 
             ASMAtomicIncU32(&pIoCtx->cDataTransfersPending);
+            if (pXfer)
+                ASMAtomicIncU32(&pXfer->cRefs);
 
             void *pvTask;
             Log(("Spawning pIoTask=%p pIoCtx=%p\n", pIoTask, pIoCtx));
@@ -4658,11 +5777,15 @@ static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
                 AssertMsg(cbTaskRead <= pIoCtx->Req.Io.cbTransferLeft, ("Impossible!\n"));
                 ASMAtomicSubU32(&pIoCtx->Req.Io.cbTransferLeft, (uint32_t)cbTaskRead);
                 ASMAtomicDecU32(&pIoCtx->cDataTransfersPending);
+                if (pXfer)
+                    ASMAtomicDecU32(&pXfer->cRefs);
                 vdIoTaskFree(pDisk, pIoTask);
             }
             else if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
             {
                 ASMAtomicDecU32(&pIoCtx->cDataTransfersPending);
+                if (pXfer)
+                    ASMAtomicDecU32(&pXfer->cRefs);
                 vdIoTaskFree(pDisk, pIoTask);
                 break;
             }
@@ -4670,6 +5793,9 @@ static int vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
             uOffset += cbTaskRead;
             cbRead  -= cbTaskRead;
         }
+
+        if (pXfer)
+            rc = vdIOIntUserXferSplitRelease(pXfer, rc);
     }
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
@@ -4688,8 +5814,10 @@ static int vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOff
                  pvUser, pIoStorage, uOffset, pIoCtx, cbWrite));
 
     /** @todo: Enable check for sync I/O later. */
-    if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_SYNC))
+    if (!(pIoCtx->fFlags & (VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_PARALLEL)))
         VD_IS_LOCKED(pDisk);
+    Assert(   !(pIoCtx->fFlags & VDIOCTX_FLAGS_PARALLEL)
+           || !pfnComplete);
 
     Assert(cbWrite > 0);
 
@@ -4718,6 +5846,8 @@ static int vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOff
     }
     else
     {
+        PVDIOUSERXFER pXfer = NULL;
+
         /* Build the S/G array and spawn a new I/O task */
         while (cbWrite)
         {
@@ -4727,6 +5857,18 @@ static int vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOff
 
             cbTaskWrite = RTSgBufSegArrayCreate(&pIoCtx->Req.Io.SgBuf, aSeg, &cSegments, cbWrite);
 
+            if (   pfnComplete
+                && !pXfer
+                && cbTaskWrite < cbWrite)
+            {
+                pXfer = (PVDIOUSERXFER)RTMemAllocZ(sizeof(VDIOUSERXFER));
+                if (!pXfer)
+                    return VERR_NO_MEMORY;
+                pXfer->cRefs       = 1;
+                pXfer->pfnComplete = pfnComplete;
+                pXfer->pvUser      = pvCompleteUser;
+            }
+
             Assert(cSegments > 0);
             Assert(cbTaskWrite > 0);
             AssertMsg(cbTaskWrite <= cbWrite, ("Invalid number of bytes to write\n"));
@@ -4740,12 +5882,19 @@ static int vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOff
 #endif
 
             Assert(cbTaskWrite == (uint32_t)cbTaskWrite);
-            PVDIOTASK pIoTask = vdIoTaskUserAlloc(pIoStorage, pfnComplete, pvCompleteUser, pIoCtx, (uint32_t)cbTaskWrite);
+            PVDIOTASK pIoTask = pXfer
+                              ? vdIoTaskUserAlloc(pIoStorage, vdIOIntUserXferSplitCompleted, pXfer, pIoCtx, (uint32_t)cbTaskWrite)
+                              : vdIoTaskUserAlloc(pIoStorage, pfnComplete, pvCompleteUser, pIoCtx, (uint32_t)cbTaskWrite);
 
             if (!pIoTask)
-                return VERR_NO_MEMORY;
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
 
             ASMAtomicIncU32(&pIoCtx->cDataTransfersPending);
+            if (pXfer)
+                ASMAtomicIncU32(&pXfer->cRefs);
 
             void *pvTask;
             Log(("Spawning pIoTask=%p pIoCtx=%p\n", pIoTask, pIoCtx));
@@ -4758,11 +5907,15 @@ static int vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOff
                 AssertMsg(cbTaskWrite <= pIoCtx->Req.Io.cbTransferLeft, ("Impossible!\n"));
                 ASMAtomicSubU32(&pIoCtx->Req.Io.cbTransferLeft, (uint32_t)cbTaskWrite);
                 ASMAtomicDecU32(&pIoCtx->cDataTransfersPending);
+                if (pXfer)
+                    ASMAtomicDecU32(&pXfer->cRefs);
                 vdIoTaskFree(pDisk, pIoTask);
             }
             else if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
             {
                 ASMAtomicDecU32(&pIoCtx->cDataTransfersPending);
+                if (pXfer)
+                    ASMAtomicDecU32(&pXfer->cRefs);
                 vdIoTaskFree(pDisk, pIoTask);
                 break;
             }
@@ -4770,6 +5923,9 @@ static int vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOff
             uOffset += cbTaskWrite;
             cbWrite -= cbTaskWrite;
         }
+
+        if (pXfer)
+            rc = vdIOIntUserXferSplitRelease(pXfer, rc);
     }
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
@@ -4797,6 +5953,11 @@ static int vdIOIntReadMeta(void *pvUser, PVDIOSTORAGE pIoStorage, uint64_t uOffs
                     ("A synchronous metadata read is requested but the parameters are wrong\n"),
                     VERR_INVALID_POINTER);
 
+    /* Metadata transfers need the disk lock, the request is handed over to the locked path. */
+    if (   pIoCtx
+        && (pIoCtx->fFlags & VDIOCTX_FLAGS_PARALLEL))
+        return VERR_VD_NOT_ENOUGH_METADATA;
+
     /** @todo: Enable check for sync I/O later. */
     if (   pIoCtx
         && !(pIoCtx->fFlags & VDIOCTX_FLAGS_SYNC))
@@ -5132,7 +6293,7 @@ static int vdIOIntFlush(void *pvUser, PVDIOSTORAGE pIoStorage, PVDIOCTX pIoCtx,
         if (!pMetaXfer)
             return VERR_NO_MEMORY;
 
-        pIoTask = vdIoTaskMetaAlloc(pIoStorage, pfnComplete, pvUser, pMetaXfer);
+        pIoTask = vdIoTaskMetaAlloc(pIoStorage, pfnComplete, pvCompleteUser, pMetaXfer);
         if (!pIoTask)
         {
             RTMemFree(pMetaXfer);
@@ -5215,7 +6376,7 @@ static size_t vdIOIntIoCtxSet(void *pvUser, PVDIOCTX pIoCtx, int ch, size_t cb)
     size_t cbSet = 0;
 
     /** @todo: Enable check for sync I/O later. */
-    if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_SYNC))
+    if (!(pIoCtx->fFlags & (VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_PARALLEL)))
         VD_IS_LOCKED(pDisk);
 
     cbSet = vdIoCtxSet(pIoCtx, ch, cb);
@@ -5280,7 +6441,7 @@ static void vdIOIntIoCtxCompleted(void *pvUser, PVDIOCTX pIoCtx, int rcReq,
     }
 
     vdIoCtxAddToWaitingList(&pDisk->pIoCtxHaltedHead, pIoCtx);
-    if (ASMAtomicCmpXchgBool(&pDisk->fLocked, true, false))
+    if (vdDiskTryLock(pDisk))
     {
         /* Immediately drop the lock again, it will take care of processing the list. */
         vdDiskUnlock(pDisk, NULL);
@@ -5406,13 +6567,16 @@ static int vdIOIntWriteUserLimited(void *pvUser, PVDIOSTORAGE pStorage,
 
 static int vdIOIntReadUserLimited(void *pvUser, PVDIOSTORAGE pStorage,
                                   uint64_t uOffset, PVDIOCTX pIoCtx,
-                                  size_t cbRead)
+                                  size_t cbRead, PFNVDXFERCOMPLETED pfnComplete,
+                                  void *pvCompleteUser)
 {
     NOREF(pvUser);
     NOREF(pStorage);
     NOREF(uOffset);
     NOREF(pIoCtx);
     NOREF(cbRead);
+    NOREF(pfnComplete);
+    NOREF(pvCompleteUser);
     AssertMsgFailedReturn(("This needs to be implemented when called\n"), VERR_NOT_IMPLEMENTED);
 }
 
@@ -5953,6 +7117,9 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVBOXHDD *pp
             pDisk->pInterfaceError         = NULL;
             pDisk->pInterfaceThreadSync    = NULL;
             pDisk->pIoCtxLockOwner         = NULL;
+            pDisk->cIoCtxParallel          = 0;
+            pDisk->cIoTasksParallelPending = 0;
+            pDisk->cIoTasksUserPending     = 0;
             pDisk->pIoCtxHead              = NULL;
             pDisk->fLocked                 = false;
             pDisk->hEventSemSyncIo         = NIL_RTSEMEVENT;
@@ -5965,6 +7132,10 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVBOXHDD *pp
             if (RT_FAILURE(rc))
                 break;
 
+            rc = RTCritSectInit(&pDisk->CritSectSyncIo);
+            if (RT_FAILURE(rc))
+                break;
+
             /* Create the I/O ctx cache */
             rc = RTMemCacheCreate(&pDisk->hMemCacheIoCtx, sizeof(VDIOCTX), 0, UINT32_MAX,
                                   NULL, NULL, NULL, 0);
@@ -5994,6 +7165,8 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVBOXHDD *pp
     {
         if (pDisk->hEventSemSyncIo != NIL_RTSEMEVENT)
             RTSemEventDestroy(pDisk->hEventSemSyncIo);
+        if (RTCritSectIsInitialized(&pDisk->CritSectSyncIo))
+            RTCritSectDelete(&pDisk->CritSectSyncIo);
         if (pDisk->hMemCacheIoCtx != NIL_RTMEMCACHE)
             RTMemCacheDestroy(pDisk->hMemCacheIoCtx);
         if (pDisk->hMemCacheIoTask != NIL_RTMEMCACHE)
@@ -6030,6 +7203,7 @@ VBOXDDU_DECL(int) VDDestroy(PVBOXHDD pDisk)
         RTMemCacheDestroy(pDisk->hMemCacheIoCtx);
         RTMemCacheDestroy(pDisk->hMemCacheIoTask);
         RTSemEventDestroy(pDisk->hEventSemSyncIo);
+        RTCritSectDelete(&pDisk->CritSectSyncIo);
         RTMemFree(pDisk);
     } while (0);
     LogFlowFunc(("returns %Rrc\n", rc));
@@ -6121,7 +7295,8 @@ VBOXDDU_DECL(int) VDGetFormat(PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
                      && rc != VERR_VD_VHD_INVALID_HEADER
                      && rc != VERR_VD_RAW_INVALID_HEADER
                      && rc != VERR_VD_PARALLELS_INVALID_HEADER
-                     && rc != VERR_VD_DMG_INVALID_HEADER))
+                     && rc != VERR_VD_DMG_INVALID_HEADER
+                     && rc != VERR_VD_DEDUP_INVALID_HEADER))
             {
                 /* Copy the name into the new string. */
                 char *pszFormat = RTStrDup(g_apBackends[i]->pszBackendName);
@@ -6595,6 +7770,16 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
                             &pCache->VDIo, sizeof(VDINTERFACEIOINT), &pCache->pVDIfsCache);
         AssertRC(rc);
 
+        /* Cache images without async I/O support can't be used with async I/O. */
+        if (   (uOpenFlags & VD_OPEN_FLAGS_ASYNC_IO)
+            && !(pCache->Backend->uBackendCaps & VD_CAP_ASYNC))
+        {
+            rc = VERR_NOT_SUPPORTED;
+            break;
+        }
+
+        pCache->hThreadDestage = NIL_RTTHREAD;
+        pCache->hEvtDestage    = NIL_RTSEMEVENT;
         pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
         rc = pCache->Backend->pfnOpen(pCache->pszFilename,
                                       uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
@@ -6656,13 +7841,18 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
         if (rc == VERR_NOT_SUPPORTED)
             rc = VINF_SUCCESS;
 
+        if (   RT_SUCCESS(rc)
+            && pDisk->pCache)
+            rc = VERR_VD_CACHE_ALREADY_EXISTS;
+
+        /* Write back dirty data left in the cache and from now on. */
+        if (RT_SUCCESS(rc))
+            rc = vdCacheDestageStart(pCache);
+
         if (RT_SUCCESS(rc))
         {
             /* Cache successfully opened, make it the current one. */
-            if (!pDisk->pCache)
-                pDisk->pCache = pCache;
-            else
-                rc = VERR_VD_CACHE_ALREADY_EXISTS;
+            pDisk->pCache = pCache;
         }
 
         if (RT_FAILURE(rc))
@@ -7474,6 +8664,8 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
             pUuid = &uuid;
         }
 
+        pCache->hThreadDestage = NIL_RTTHREAD;
+        pCache->hEvtDestage    = NIL_RTSEMEVENT;
         pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
         pCache->VDIo.fIgnoreFlush = (uOpenFlags & VD_OPEN_FLAGS_IGNORE_FLUSH) != 0;
         rc = pCache->Backend->pfnCreate(pCache->pszFilename, cbSize,
@@ -7520,6 +8712,9 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
                 rc = VINF_SUCCESS;
         }
 
+        if (RT_SUCCESS(rc))
+            rc = vdCacheDestageStart(pCache);
+
         if (RT_SUCCESS(rc))
         {
             /* Cache successfully created. */
@@ -8247,10 +9442,15 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
         else
             cImagesToReadBack = pDiskTo->cImages - nImageToSame - 1;
 
+        /* Ranges containing only zeros don't need to be written to a new base
+         * image as unallocated blocks read as zero there. */
+        bool fSkipZeroes = pszFilename != NULL && cImagesTo == 0;
+
         /* Copy the data. */
         rc = vdCopyHelper(pDiskFrom, pImageFrom, pDiskTo, cbSize,
                           cImagesFromReadBack, cImagesToReadBack,
-                          fSuppressRedundantIo, pIfProgress, pDstIfProgress);
+                          fSuppressRedundantIo, fSkipZeroes,
+                          pIfProgress, pDstIfProgress);
 
         if (RT_SUCCESS(rc))
         {
@@ -8749,6 +9949,10 @@ VBOXDDU_DECL(int) VDCacheClose(PVBOXHDD pDisk, bool fDelete)
         AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
         AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
 
+        /* The destage thread takes the lock, stop it before. */
+        if (pDisk->pCache)
+            vdCacheDestageStop(pDisk->pCache);
+
         rc2 = vdThreadStartWrite(pDisk);
         AssertRC(rc2);
         fLockWrite = true;
@@ -8756,12 +9960,10 @@ VBOXDDU_DECL(int) VDCacheClose(PVBOXHDD pDisk, bool fDelete)
         AssertPtrBreakStmt(pDisk->pCache, rc = VERR_VD_CACHE_NOT_FOUND);
 
         pCache = pDisk->pCache;
-        pDisk->pCache = NULL;
 
-        pCache->Backend->pfnClose(pCache->pBackendData, fDelete);
-        if (pCache->pszFilename)
-            RTStrFree(pCache->pszFilename);
-        RTMemFree(pCache);
+        /* Dirty data is written back through the disk, keep the cache attached until then. */
+        rc = vdCacheCloseInternal(pDisk, pCache, fDelete);
+        pDisk->pCache = NULL;
     } while (0);
 
     if (RT_LIKELY(fLockWrite))
@@ -8838,6 +10040,10 @@ VBOXDDU_DECL(int) VDCloseAll(PVBOXHDD pDisk)
         AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
         AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
 
+        /* The destage thread takes the lock, stop it before. */
+        if (pDisk->pCache)
+            vdCacheDestageStop(pDisk->pCache);
+
         /* Lock the entire operation. */
         rc2 = vdThreadStartWrite(pDisk);
         AssertRC(rc2);
@@ -8846,13 +10052,10 @@ VBOXDDU_DECL(int) VDCloseAll(PVBOXHDD pDisk)
         PVDCACHE pCache = pDisk->pCache;
         if (pCache)
         {
-            rc2 = pCache->Backend->pfnClose(pCache->pBackendData, false);
+            rc2 = vdCacheCloseInternal(pDisk, pCache, false /* fDelete */);
             if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
                 rc = rc2;
-
-            if (pCache->pszFilename)
-                RTStrFree(pCache->pszFilename);
-            RTMemFree(pCache);
+            pDisk->pCache = NULL;
         }
 
         PVDIMAGE pImage = pDisk->pLast;
@@ -10493,6 +11696,103 @@ VBOXDDU_DECL(int) VDDiscardRanges(PVBOXHDD pDisk, PCRTRANGE paRanges, unsigned c
 }
 
 
+VBOXDDU_DECL(int) VDCompactOnline(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRange,
+                                  uint64_t *pcbReclaimed)
+{
+    int rc;
+    int rc2;
+    bool fLockWrite = false;
+    VDCOMPACTONLINE Compact;
+    RTRANGE Range;
+
+    LogFlowFunc(("pDisk=%#p uOffset=%llu cbRange=%zu pcbReclaimed=%#p\n",
+                 pDisk, uOffset, cbRange, pcbReclaimed));
+
+    RT_ZERO(Compact);
+
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VBOXHDDDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        /* Check arguments. */
+        AssertMsgBreakStmt(   cbRange
+                           && cbRange <= VD_COMPACT_ONLINE_RANGE_MAX
+                           && !(uOffset % 512)
+                           && !(cbRange % 512),
+                           ("uOffset=%llu cbRange=%zu\n", uOffset, cbRange),
+                           rc = VERR_INVALID_PARAMETER);
+        AssertMsgBreakStmt(!pcbReclaimed || VALID_PTR(pcbReclaimed),
+                           ("pcbReclaimed=%#p\n", pcbReclaimed),
+                           rc = VERR_INVALID_PARAMETER);
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        PVDIMAGE pImage = pDisk->pLast;
+        AssertPtrBreakStmt(pImage, rc = VERR_VD_NOT_OPENED);
+
+        AssertMsgBreakStmt(uOffset + cbRange <= pDisk->cbSize,
+                           ("uOffset=%llu cbRange=%zu\n", uOffset, cbRange),
+                           rc = VERR_INVALID_PARAMETER);
+
+        if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        {
+            rc = VERR_VD_IMAGE_READ_ONLY;
+            break;
+        }
+
+        /* The backends only keep the state for freeing blocks if the image was opened for discarding. */
+        if (   !pImage->Backend->pfnDiscard
+            || (pImage->Backend->uBackendCaps & VD_CAP_FILE) == 0
+            || !(pImage->uOpenFlags & VD_OPEN_FLAGS_DISCARD))
+        {
+            rc = VERR_NOT_SUPPORTED;
+            break;
+        }
+
+        Compact.cbBuf = cbRange;
+        Compact.pvBuf = RTMemTmpAlloc(cbRange);
+        if (!Compact.pvBuf)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+
+        Range.offStart = uOffset;
+        Range.cbRange  = cbRange;
+
+        PVDIOCTX pIoCtx = vdIoCtxDiscardAlloc(pDisk, &Range, 1,
+                                              vdIoCtxSyncComplete, pDisk, &Compact, NULL,
+                                              vdCompactOnlineHelper,
+                                              VDIOCTX_FLAGS_SYNC);
+        if (!pIoCtx)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+
+        rc = vdIoCtxProcessSync(pIoCtx);
+        if (pcbReclaimed)
+            *pcbReclaimed = Compact.cbReclaimed;
+    } while (0);
+
+    if (RT_UNLIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    if (Compact.pvBuf)
+        RTMemTmpFree(Compact.pvBuf);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+
 VBOXDDU_DECL(int) VDAsyncRead(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRead,
                               PCRTSGBUF pcSgBuf,
                               PFNVDASYNCTRANSFERCOMPLETE pfnComplete,
@@ -10541,7 +11841,7 @@ VBOXDDU_DECL(int) VDAsyncRead(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRead,
             break;
         }
 
-        rc = vdIoCtxProcessTryLockDefer(pIoCtx);
+        rc = vdIoCtxProcessParallel(pIoCtx);
         if (rc == VINF_VD_ASYNC_IO_FINISHED)
         {
             if (ASMAtomicCmpXchgBool(&pIoCtx->fComplete, true, false))
@@ -10575,6 +11875,8 @@ VBOXDDU_DECL(int) VDAsyncWrite(PVBOXHDD pDisk, uint64_t uOffset, size_t cbWrite,
     int rc2;
     bool fLockWrite = false;
     PVDIOCTX pIoCtx = NULL;
+    void *pvAllocation = NULL;
+    RTSGBUF SgBufShadow;
 
     LogFlowFunc(("pDisk=%#p uOffset=%llu cSgBuf=%#p cbWrite=%zu pvUser1=%#p pvUser2=%#p\n",
                  pDisk, uOffset, pcSgBuf, cbWrite, pvUser1, pvUser2));
@@ -10602,18 +11904,43 @@ VBOXDDU_DECL(int) VDAsyncWrite(PVBOXHDD pDisk, uint64_t uOffset, size_t cbWrite,
                            rc = VERR_INVALID_PARAMETER);
         AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
 
+        /*
+         * Filters transform the data in place. The buffer of the caller might
+         * be guest memory mapped directly by a device, so work on a copy.
+         */
+        if (pDisk->pFilterHead)
+        {
+            pvAllocation = RTMemAlloc(RT_ALIGN_Z(sizeof(RTSGSEG), 64) + cbWrite);
+            if (!pvAllocation)
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
+
+            PRTSGSEG pSeg = (PRTSGSEG)pvAllocation;
+            RTSGBUF SgBufSrc;
+
+            pSeg->pvSeg = (uint8_t *)pvAllocation + RT_ALIGN_Z(sizeof(RTSGSEG), 64);
+            pSeg->cbSeg = cbWrite;
+            RTSgBufClone(&SgBufSrc, pcSgBuf);
+            RTSgBufCopyToBuf(&SgBufSrc, pSeg->pvSeg, cbWrite);
+            RTSgBufInit(&SgBufShadow, pSeg, 1);
+            pcSgBuf = &SgBufShadow;
+        }
+
         pIoCtx = vdIoCtxRootAlloc(pDisk, VDIOCTXTXDIR_WRITE, uOffset,
                                   cbWrite, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
-                                  NULL, vdWriteHelperAsync,
+                                  pvAllocation, vdWriteHelperAsync,
                                   VDIOCTX_FLAGS_DEFAULT);
         if (!pIoCtx)
         {
+            RTMemFree(pvAllocation);
             rc = VERR_NO_MEMORY;
             break;
         }
 
-        rc = vdIoCtxProcessTryLockDefer(pIoCtx);
+        rc = vdIoCtxProcessParallel(pIoCtx);
         if (rc == VINF_VD_ASYNC_IO_FINISHED)
         {
             if (ASMAtomicCmpXchgBool(&pIoCtx->fComplete, true, false))
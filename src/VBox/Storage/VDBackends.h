@@ -28,6 +28,7 @@ RT_C_DECLS_BEGIN
 extern const VBOXHDDBACKEND g_RawBackend;
 extern const VBOXHDDBACKEND g_VmdkBackend;
 extern const VBOXHDDBACKEND g_VDIBackend;
+extern const VBOXHDDBACKEND g_DedupBackend;
 extern const VBOXHDDBACKEND g_VhdBackend;
 extern const VBOXHDDBACKEND g_ParallelsBackend;
 extern const VBOXHDDBACKEND g_DmgBackend;
@@ -29,11 +29,22 @@
 #include <iprt/uuid.h>
 #include <iprt/string.h>
 #include <iprt/asm.h>
+#include <iprt/param.h>
 
 #include "VDBackends.h"
 
 #define VDI_IMAGE_DEFAULT_BLOCK_SIZE _1M
 
+/** Size of a block array page, the unit the block array is read in on demand. */
+#define VDI_BLOCKMAP_PAGE_SIZE      _4K
+/** Number of block pointers in a block array page. */
+#define VDI_BLOCKMAP_PAGE_ENTRIES   (VDI_BLOCKMAP_PAGE_SIZE / sizeof(VDIIMAGEBLOCKPOINTER))
+/** Name of the configuration key for the block array size in bytes starting
+ * from which the block array is read on demand instead of on open (0 disables). */
+#define VDI_CFG_BLOCKMAP_LAZY       "BlockMapLazyThreshold"
+/** Default block array size for reading it on demand (a 256GB image with 1MB blocks). */
+#define VDI_BLOCKMAP_LAZY_DEFAULT   _1M
+
 /** Macros for endianess conversion. */
 #define SET_ENDIAN_U32(conv, u32) (conv == VDIECONV_H2F ? RT_H2LE_U32(u32) : RT_LE2H_U32(u32))
 #define SET_ENDIAN_U64(conv, u64) (conv == VDIECONV_H2F ? RT_H2LE_U64(u64) : RT_LE2H_U64(u64))
@@ -49,6 +60,12 @@ static const VDFILEEXTENSION s_aVdiFileExtensions[] =
     {NULL, VDTYPE_INVALID}
 };
 
+static const VDCONFIGINFO s_aVdiConfigInfo[] =
+{
+    { VDI_CFG_BLOCKMAP_LAZY,    "1048576",    VDCFGVALUETYPE_INTEGER,    VD_CFGKEY_EXPERT },
+    { NULL,                     NULL,         VDCFGVALUETYPE_INTEGER,    0 }
+};
+
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
@@ -193,6 +210,171 @@ static void vdiConvBlocksEndianess(VDIECONV enmConv, PVDIIMAGEBLOCKPOINTER paBlo
         paBlocks[i] = SET_ENDIAN_U32(enmConv, paBlocks[i]);
 }
 
+/**
+ * Internal: Returns the number of block array pages of the image.
+ */
+DECLINLINE(unsigned) vdiBlockMapPages(PVDIIMAGEDESC pImage)
+{
+    return (getImageBlocks(&pImage->Header) + VDI_BLOCKMAP_PAGE_ENTRIES - 1) / VDI_BLOCKMAP_PAGE_ENTRIES;
+}
+
+/**
+ * Internal: Sets up the block array to be read on demand.
+ *
+ * Only address space is reserved for the block array, the pages are read
+ * when they are accessed the first time. Parts of the block array which are
+ * never used don't cost any memory and opening huge images doesn't need to
+ * read and convert the complete block array.
+ *
+ * @returns VBox status code.
+ * @param   pImage    VDI image instance data.
+ */
+static int vdiBlockMapInitLazy(PVDIIMAGEDESC pImage)
+{
+    size_t cbBitmap = RT_ALIGN_Z(vdiBlockMapPages(pImage), 32) / 8;
+
+    pImage->cbBlockMap = getImageBlocks(&pImage->Header) * sizeof(VDIIMAGEBLOCKPOINTER);
+    pImage->paBlocks = (PVDIIMAGEBLOCKPOINTER)RTMemPageAlloc(pImage->cbBlockMap);
+    pImage->pbmBlockMapLoaded = RTMemAllocZ(cbBitmap);
+    if (   !pImage->paBlocks
+        || !pImage->pbmBlockMapLoaded)
+        return VERR_NO_MEMORY;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Frees the block array.
+ */
+static void vdiBlockMapFree(PVDIIMAGEDESC pImage)
+{
+    if (pImage->paBlocks)
+    {
+        if (pImage->pbmBlockMapLoaded)
+            RTMemPageFree(pImage->paBlocks, pImage->cbBlockMap);
+        else
+            RTMemFree(pImage->paBlocks);
+        pImage->paBlocks = NULL;
+    }
+
+    if (pImage->pbmBlockMapLoaded)
+    {
+        RTMemFree(pImage->pbmBlockMapLoaded);
+        pImage->pbmBlockMapLoaded = NULL;
+    }
+}
+
+/**
+ * Internal: Reads a page of the block array from the image.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_NOT_ENOUGH_METADATA if the read is still in progress,
+ *          the I/O context is continued when it completed.
+ * @param   pImage    VDI image instance data.
+ * @param   idxPage   The page to read.
+ * @param   pIoCtx    I/O context associated with the request, NULL for
+ *                    synchronous operation.
+ */
+static int vdiBlockMapPageLoad(PVDIIMAGEDESC pImage, unsigned idxPage, PVDIOCTX pIoCtx)
+{
+    unsigned uBlockFirst = idxPage * VDI_BLOCKMAP_PAGE_ENTRIES;
+    unsigned cEntries = RT_MIN(getImageBlocks(&pImage->Header) - uBlockFirst, VDI_BLOCKMAP_PAGE_ENTRIES);
+    uint64_t u64Offset = pImage->offStartBlocks + (uint64_t)uBlockFirst * sizeof(VDIIMAGEBLOCKPOINTER);
+    int rc;
+
+    if (pIoCtx)
+    {
+        PVDMETAXFER pMetaXfer;
+        rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage, u64Offset,
+                                   &pImage->paBlocks[uBlockFirst], cEntries * sizeof(VDIIMAGEBLOCKPOINTER),
+                                   pIoCtx, &pMetaXfer, NULL, NULL);
+        if (RT_SUCCESS(rc) && pMetaXfer)
+            vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+    }
+    else
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, u64Offset,
+                                   &pImage->paBlocks[uBlockFirst], cEntries * sizeof(VDIIMAGEBLOCKPOINTER));
+    if (RT_SUCCESS(rc))
+    {
+        vdiConvBlocksEndianess(VDIECONV_F2H, &pImage->paBlocks[uBlockFirst], cEntries);
+        ASMBitSet(pImage->pbmBlockMapLoaded, idxPage);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Makes sure the block pointer for the given block is present
+ * in paBlocks.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_NOT_ENOUGH_METADATA if the block array page is still being read.
+ * @param   pImage    VDI image instance data.
+ * @param   uBlock    The block which is about to be accessed.
+ * @param   pIoCtx    I/O context associated with the request, NULL for
+ *                    synchronous operation.
+ */
+DECLINLINE(int) vdiBlockMapEnsure(PVDIIMAGEDESC pImage, unsigned uBlock, PVDIOCTX pIoCtx)
+{
+    if (RT_LIKELY(   !pImage->pbmBlockMapLoaded
+                  || ASMBitTest(pImage->pbmBlockMapLoaded, uBlock / VDI_BLOCKMAP_PAGE_ENTRIES)))
+        return VINF_SUCCESS;
+
+    return vdiBlockMapPageLoad(pImage, uBlock / VDI_BLOCKMAP_PAGE_ENTRIES, pIoCtx);
+}
+
+/**
+ * Internal: Reads the remaining parts of a block array loaded on demand and
+ * switches to a completely loaded one, for operations working on the whole
+ * block array.
+ *
+ * @returns VBox status code.
+ * @param   pImage    VDI image instance data.
+ */
+static int vdiBlockMapLoadAll(PVDIIMAGEDESC pImage)
+{
+    if (!pImage->pbmBlockMapLoaded)
+        return VINF_SUCCESS;
+
+    int rc = VINF_SUCCESS;
+    unsigned cPages = vdiBlockMapPages(pImage);
+    for (unsigned idxPage = 0; idxPage < cPages && RT_SUCCESS(rc); idxPage++)
+        if (!ASMBitTest(pImage->pbmBlockMapLoaded, idxPage))
+            rc = vdiBlockMapPageLoad(pImage, idxPage, NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /* Other operations expect a block array allocated from the heap. */
+    PVDIIMAGEBLOCKPOINTER paBlocks = (PVDIIMAGEBLOCKPOINTER)RTMemAlloc(pImage->cbBlockMap);
+    if (!paBlocks)
+        return VERR_NO_MEMORY;
+
+    memcpy(paBlocks, pImage->paBlocks, pImage->cbBlockMap);
+    vdiBlockMapFree(pImage);
+    pImage->paBlocks = paBlocks;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Returns whether the block array of the image should be read on demand.
+ */
+static bool vdiBlockMapIsLazy(PVDIIMAGEDESC pImage)
+{
+    uint64_t cbThreshold = VDI_BLOCKMAP_LAZY_DEFAULT;
+    PVDINTERFACECONFIG pIfConfig = VDIfConfigGet(pImage->pVDIfsImage);
+
+    if (pIfConfig)
+    {
+        int rc = VDCFGQueryU64Def(pIfConfig, VDI_CFG_BLOCKMAP_LAZY, &cbThreshold,
+                                  VDI_BLOCKMAP_LAZY_DEFAULT);
+        if (RT_FAILURE(rc))
+            cbThreshold = VDI_BLOCKMAP_LAZY_DEFAULT;
+    }
+
+    return    cbThreshold
+           && getImageBlocks(&pImage->Header) * (uint64_t)sizeof(VDIIMAGEBLOCKPOINTER) >= cbThreshold;
+}
+
 /**
  * Internal: Flush the image file to disk.
  */
@@ -230,11 +412,7 @@ static int vdiFreeImage(PVDIIMAGEDESC pImage, bool fDelete)
             pImage->pStorage = NULL;
         }
 
-        if (pImage->paBlocks)
-        {
-            RTMemFree(pImage->paBlocks);
-            pImage->paBlocks = NULL;
-        }
+        vdiBlockMapFree(pImage);
 
         if (pImage->paBlocksRev)
         {
@@ -865,6 +1043,17 @@ static int vdiOpenImage(PVDIIMAGEDESC pImage, unsigned uOpenFlags)
     /* Setup image parameters by header. */
     vdiSetupImageDesc(pImage);
 
+    /*
+     * Read big block arrays on demand unless discarding is enabled which
+     * needs the complete one for creating the back resolving table.
+     */
+    if (   !(uOpenFlags & VD_OPEN_FLAGS_DISCARD)
+        && vdiBlockMapIsLazy(pImage))
+    {
+        rc = vdiBlockMapInitLazy(pImage);
+        goto out;
+    }
+
     /* Allocate memory for blocks array. */
     pImage->paBlocks = (PVDIIMAGEBLOCKPOINTER)RTMemAlloc(sizeof(VDIIMAGEBLOCKPOINTER) * getImageBlocks(&pImage->Header));
     if (!pImage->paBlocks)
@@ -1581,6 +1770,10 @@ static int vdiRead(void *pBackendData, uint64_t uOffset, size_t cbToRead,
     cbToRead = RT_MIN(cbToRead, getImageBlockSize(&pImage->Header) - offRead);
     Assert(!(cbToRead % 512));
 
+    rc = vdiBlockMapEnsure(pImage, uBlock, pIoCtx);
+    if (RT_FAILURE(rc))
+        goto out;
+
     if (pImage->paBlocks[uBlock] == VDI_IMAGE_BLOCK_FREE)
         rc = VERR_VD_BLOCK_FREE;
     else if (pImage->paBlocks[uBlock] == VDI_IMAGE_BLOCK_ZERO)
@@ -1659,8 +1852,22 @@ static int vdiWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
 
     do
     {
+        rc = vdiBlockMapEnsure(pImage, uBlock, pIoCtx);
+        if (RT_FAILURE(rc))
+            break;
+
         if (!IS_VDI_IMAGE_BLOCK_ALLOCATED(pImage->paBlocks[uBlock]))
         {
+            /* Concurrent writes must leave the block map alone, let the
+             * generic code handle the block with the disk lock held. */
+            if (fWrite & VD_WRITE_CONCURRENT)
+            {
+                *pcbPreRead = 0;
+                *pcbPostRead = 0;
+                rc = VERR_VD_BLOCK_FREE;
+                break;
+            }
+
             /* Block is either free or zero. */
             if (   !(pImage->uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
                 && (   pImage->paBlocks[uBlock] == VDI_IMAGE_BLOCK_ZERO
@@ -2365,6 +2572,13 @@ static void vdiDump(void *pBackendData)
                      pImage->uShiftOffset2Index,
                      pImage->offStartBlockData);
 
+    int rc = vdiBlockMapLoadAll(pImage);
+    if (RT_FAILURE(rc))
+    {
+        vdIfErrorMessage(pImage->pIfError, "!! WARNING: Reading the block table failed with %Rrc !!\n", rc);
+        return;
+    }
+
     unsigned uBlock, cBlocksNotFree, cBadBlocks, cBlocks = getImageBlocks(&pImage->Header);
     for (uBlock=0, cBlocksNotFree=0, cBadBlocks=0; uBlock<cBlocks; uBlock++)
     {
@@ -2418,6 +2632,10 @@ static int vdiCompact(void *pBackendData, unsigned uPercentStart,
         AssertBreakStmt(!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY),
                         rc = VERR_VD_IMAGE_READ_ONLY);
 
+        rc = vdiBlockMapLoadAll(pImage);
+        if (RT_FAILURE(rc))
+            break;
+
         unsigned cBlocks;
         unsigned cBlocksToMove = 0;
         size_t cbBlock;
@@ -2661,6 +2879,10 @@ static int vdiResize(void *pBackendData, uint64_t cbSize,
         || pImage->uImageFlags & VD_IMAGE_FLAGS_FIXED)
         rc = VERR_NOT_SUPPORTED;
     else if (cbSize > getImageDiskSize(&pImage->Header))
+        rc = vdiBlockMapLoadAll(pImage);
+
+    if (   RT_SUCCESS(rc)
+        && cbSize > getImageDiskSize(&pImage->Header))
     {
         unsigned cBlocksAllocated = getImageBlocksAllocated(&pImage->Header); /** < Blocks currently allocated, doesn't change during resize */
         uint32_t cBlocksNew = cbSize / getImageBlockSize(&pImage->Header);    /** < New number of blocks in the image after the resize */
@@ -2892,6 +3114,10 @@ static DECLCALLBACK(int) vdiDiscard(void *pBackendData, PVDIOCTX pIoCtx,
         if (pcbPostAllocated)
             *pcbPostAllocated = 0;
 
+        rc = vdiBlockMapEnsure(pImage, uBlock, pIoCtx);
+        if (RT_FAILURE(rc))
+            break;
+
         if (IS_VDI_IMAGE_BLOCK_ALLOCATED(pImage->paBlocks[uBlock]))
         {
             uint8_t *pbBlockData;
@@ -3203,11 +3429,12 @@ const VBOXHDDBACKEND g_VDIBackend =
     sizeof(VBOXHDDBACKEND),
     /* uBackendCaps */
       VD_CAP_UUID | VD_CAP_CREATE_FIXED | VD_CAP_CREATE_DYNAMIC
-    | VD_CAP_DIFF | VD_CAP_FILE | VD_CAP_ASYNC | VD_CAP_VFS | VD_CAP_DISCARD,
+    | VD_CAP_DIFF | VD_CAP_FILE | VD_CAP_ASYNC | VD_CAP_VFS | VD_CAP_DISCARD
+    | VD_CAP_CONCURRENT_IO,
     /* paFileExtensions */
     s_aVdiFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aVdiConfigInfo,
     /* pfnCheckIfValid */
     vdiCheckIfValid,
     /* pfnOpen */
@@ -527,6 +527,11 @@ typedef struct VDIIMAGEDESC
     PVDIIMAGEBLOCKPOINTER   paBlocks;
     /** Pointer to the block array for back resolving (used if discarding is enabled). */
     unsigned               *paBlocksRev;
+    /** Bitmap of block array pages read from the image so far. NULL if the
+     * whole block array was read on open, see vdiBlockMapEnsure(). */
+    void                   *pbmBlockMapLoaded;
+    /** Size of the page allocation backing paBlocks if it is loaded on demand. */
+    size_t                  cbBlockMap;
     /** fFlags copy from image header, for speed optimization. */
     unsigned                uImageFlags;
     /** Start offset of block array in image file, here for speed optimization. */
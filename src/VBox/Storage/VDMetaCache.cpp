@@ -0,0 +1,412 @@
+/* $Id: VDMetaCache.cpp $ */
+/** @file
+ * VD - Metadata table cache shared by the image backends.
+ */
+
+/*
+ * Copyright (C) 2014 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_vd_metacache   VD Metadata Table Cache
+ *
+ * Sparse image formats translate guest offsets through a second level of
+ * tables (L2 tables for QCOW and QED, grain tables for VMDK). This module
+ * implements a cache for these tables which can be used by all backends.
+ *
+ * Tables are looked up through an AVL tree keyed by a backend specific
+ * identifier (usually the offset of the table in the image). The amount of
+ * memory used is bounded by a per image budget which can be configured with
+ * the "MetaCacheSize" key. When the budget is exhausted entries are evicted
+ * using the CLOCK algorithm, which approximates LRU without having to touch
+ * a list on every hit. Entries still referenced by the backend are never
+ * evicted.
+ *
+ * Backends may read tables ahead of time. Prefetched entries are only
+ * allocated while there is room left in the budget and start without the
+ * reference bit set, so they are the first to go if they are not used.
+ */
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_VD
+#include <VBox/log.h>
+#include <VBox/err.h>
+#include <iprt/assert.h>
+#include <iprt/mem.h>
+
+#include "VDMetaCache.h"
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+
+/**
+ * Metadata cache instance data.
+ */
+typedef struct VDMETACACHE
+{
+    /** Size of one cached table in bytes. */
+    size_t              cbEntry;
+    /** Maximum amount of memory the cache is allowed to use. */
+    size_t              cbMax;
+    /** Memory occupied by the cache entries. */
+    size_t              cbUsed;
+    /** Number of allocated entries. */
+    uint32_t            cEntries;
+    /** AVL tree of the cached entries for searching. */
+    AVLRU64TREE         TreeEntries;
+    /** Clock list of the cached entries. */
+    RTLISTANCHOR        ListClock;
+    /** The clock hand, next entry to consider for eviction. NULL if the
+     * hand points to the start of the list. */
+    PVDMETACACHEENTRY   pHand;
+    /** Statistics. */
+    VDMETACACHESTATS    Stats;
+} VDMETACACHE;
+
+
+/**
+ * Advances the clock hand to the next entry in the list.
+ *
+ * @returns The entry the hand pointed to before.
+ * @param   pCache    The cache instance.
+ */
+static PVDMETACACHEENTRY vdMetaCacheHandAdvance(PVDMETACACHE pCache)
+{
+    PVDMETACACHEENTRY pEntry = pCache->pHand;
+
+    if (!pEntry)
+        pEntry = RTListGetFirst(&pCache->ListClock, VDMETACACHEENTRY, NodeClock);
+
+    if (pEntry)
+        pCache->pHand = RTListGetNext(&pCache->ListClock, pEntry, VDMETACACHEENTRY, NodeClock);
+
+    return pEntry;
+}
+
+/**
+ * Unlinks the given entry from the cache.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The entry to unlink.
+ */
+static void vdMetaCacheEntryUnlink(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry)
+{
+    Assert(pEntry->fCached);
+
+    if (pCache->pHand == pEntry)
+        vdMetaCacheHandAdvance(pCache);
+
+    PAVLRU64NODECORE pCore = RTAvlrU64Remove(&pCache->TreeEntries, pEntry->Core.Key);
+    Assert(pCore == &pEntry->Core); NOREF(pCore);
+    RTListNodeRemove(&pEntry->NodeClock);
+    pEntry->fCached = false;
+}
+
+/**
+ * Creates a new metadata cache.
+ *
+ * @returns VBox status code.
+ * @param   ppCache   Where to store the cache handle on success.
+ * @param   cbEntry   Size of one table in bytes.
+ * @param   cbMax     Maximum amount of memory the cache is allowed to use.
+ *                    At least one entry is always allowed.
+ */
+DECLHIDDEN(int) vdMetaCacheCreate(PVDMETACACHE *ppCache, size_t cbEntry, size_t cbMax)
+{
+    AssertPtrReturn(ppCache, VERR_INVALID_POINTER);
+    AssertReturn(cbEntry > 0, VERR_INVALID_PARAMETER);
+
+    PVDMETACACHE pCache = (PVDMETACACHE)RTMemAllocZ(sizeof(VDMETACACHE));
+    if (!pCache)
+        return VERR_NO_MEMORY;
+
+    pCache->cbEntry     = cbEntry;
+    pCache->cbMax       = RT_MAX(cbMax, cbEntry);
+    pCache->cbUsed      = 0;
+    pCache->cEntries    = 0;
+    pCache->TreeEntries = NULL;
+    pCache->pHand       = NULL;
+    RTListInit(&pCache->ListClock);
+
+    *ppCache = pCache;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Destroys a metadata cache freeing all entries.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance, NULL is ignored.
+ */
+DECLHIDDEN(void) vdMetaCacheDestroy(PVDMETACACHE pCache)
+{
+    PVDMETACACHEENTRY pEntry = NULL;
+    PVDMETACACHEENTRY pNext  = NULL;
+
+    if (!pCache)
+        return;
+
+    RTListForEachSafe(&pCache->ListClock, pEntry, pNext, VDMETACACHEENTRY, NodeClock)
+    {
+        Assert(!pEntry->cRefs);
+
+        vdMetaCacheEntryUnlink(pCache, pEntry);
+        RTMemPageFree(pEntry->pvData, pCache->cbEntry);
+        RTMemFree(pEntry);
+    }
+
+    RTMemFree(pCache);
+}
+
+/**
+ * Queries the configured cache size for an image.
+ *
+ * @returns Cache size in bytes.
+ * @param   pVDIfsImage    The per image interface list.
+ * @param   cbDefault      The default size if nothing is configured.
+ */
+DECLHIDDEN(size_t) vdMetaCacheQuerySize(PVDINTERFACE pVDIfsImage, size_t cbDefault)
+{
+    PVDINTERFACECONFIG pIfConfig = VDIfConfigGet(pVDIfsImage);
+
+    if (pIfConfig)
+    {
+        uint64_t cbCache = 0;
+        int rc = VDCFGQueryU64Def(pIfConfig, VD_METACACHE_CFG_SIZE, &cbCache, cbDefault);
+        if (RT_SUCCESS(rc))
+        {
+            if (   cbCache != cbDefault
+                && (   cbCache < VD_METACACHE_SIZE_MIN
+                    || cbCache > VD_METACACHE_SIZE_MAX))
+            {
+                LogRel(("VD: Configured metadata cache size %llu is out of range, using %zu\n",
+                        cbCache, cbDefault));
+                cbCache = cbDefault;
+            }
+
+            return (size_t)cbCache;
+        }
+    }
+
+    return cbDefault;
+}
+
+/**
+ * Returns the entry matching the given key with a reference retained
+ * or NULL if the table is not cached.
+ *
+ * @returns Pointer to the cache entry or NULL.
+ * @param   pCache    The cache instance.
+ * @param   uKey      The key of the table to search for.
+ */
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheRetain(PVDMETACACHE pCache, uint64_t uKey)
+{
+    PVDMETACACHEENTRY pEntry = (PVDMETACACHEENTRY)RTAvlrU64Get(&pCache->TreeEntries, uKey);
+
+    if (pEntry)
+    {
+        pEntry->fReferenced = true;
+        pEntry->cRefs++;
+        pCache->Stats.cHits++;
+    }
+    else
+        pCache->Stats.cMisses++;
+
+    return pEntry;
+}
+
+/**
+ * Returns whether the table with the given key is in the cache
+ * without updating any state or statistics.
+ *
+ * @returns true if the table is cached, false otherwise.
+ * @param   pCache    The cache instance.
+ * @param   uKey      The key of the table to search for.
+ */
+DECLHIDDEN(bool) vdMetaCacheIsCached(PVDMETACACHE pCache, uint64_t uKey)
+{
+    return RTAvlrU64Get(&pCache->TreeEntries, uKey) != NULL;
+}
+
+/**
+ * Allocates a new entry evicting old entries if required.
+ *
+ * @returns Pointer to the new entry with one reference retained or NULL if
+ *          there is no memory or all entries are in use.
+ * @param   pCache    The cache instance.
+ * @param   fPrefetch Flag whether the entry is used to read a table ahead of time.
+ *                    No entries are evicted for prefetches.
+ */
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheEntryAlloc(PVDMETACACHE pCache, bool fPrefetch)
+{
+    PVDMETACACHEENTRY pEntry = NULL;
+
+    if (pCache->cbUsed + pCache->cbEntry <= pCache->cbMax)
+    {
+        /* Add a new entry. */
+        pEntry = (PVDMETACACHEENTRY)RTMemAllocZ(sizeof(VDMETACACHEENTRY));
+        if (pEntry)
+        {
+            pEntry->pvData = RTMemPageAllocZ(pCache->cbEntry);
+            if (RT_UNLIKELY(!pEntry->pvData))
+            {
+                RTMemFree(pEntry);
+                pEntry = NULL;
+            }
+            else
+            {
+                pEntry->cRefs    = 1;
+                pCache->cbUsed  += pCache->cbEntry;
+                pCache->cEntries++;
+            }
+        }
+    }
+    else if (!fPrefetch)
+    {
+        /*
+         * Run the clock, clearing the reference bit of every entry we pass
+         * until one without it is found. Two rounds are enough to find a
+         * victim if there is any entry not in use.
+         */
+        for (uint32_t i = 0; i < 2 * pCache->cEntries; i++)
+        {
+            PVDMETACACHEENTRY pCur = vdMetaCacheHandAdvance(pCache);
+            if (!pCur)
+                break;
+
+            if (pCur->cRefs)
+                continue;
+
+            if (pCur->fReferenced)
+                pCur->fReferenced = false;
+            else
+            {
+                pEntry = pCur;
+                break;
+            }
+        }
+
+        if (pEntry)
+        {
+            vdMetaCacheEntryUnlink(pCache, pEntry);
+            pEntry->Core.Key     = 0;
+            pEntry->Core.KeyLast = 0;
+            pEntry->cRefs        = 1;
+            pCache->Stats.cEvictions++;
+        }
+    }
+
+    if (pEntry)
+    {
+        /* Prefetched entries are not referenced until they are actually used. */
+        pEntry->fReferenced = !fPrefetch;
+        if (fPrefetch)
+            pCache->Stats.cPrefetches++;
+    }
+
+    return pEntry;
+}
+
+/**
+ * Releases a reference to a cache entry.
+ *
+ * @returns nothing.
+ * @param   pEntry    The cache entry.
+ */
+DECLHIDDEN(void) vdMetaCacheEntryRelease(PVDMETACACHEENTRY pEntry)
+{
+    Assert(pEntry->cRefs > 0);
+    pEntry->cRefs--;
+}
+
+/**
+ * Frees a cache entry which is not in use anymore.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The cache entry to free.
+ */
+DECLHIDDEN(void) vdMetaCacheEntryFree(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry)
+{
+    Assert(!pEntry->cRefs);
+
+    if (pEntry->fCached)
+        vdMetaCacheEntryUnlink(pCache, pEntry);
+
+    RTMemPageFree(pEntry->pvData, pCache->cbEntry);
+    RTMemFree(pEntry);
+
+    pCache->cbUsed -= pCache->cbEntry;
+    pCache->cEntries--;
+}
+
+/**
+ * Inserts an entry into the cache.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The cache entry to insert.
+ * @param   uKey      The key of the table.
+ */
+DECLHIDDEN(void) vdMetaCacheEntryInsert(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry, uint64_t uKey)
+{
+    Assert(!pEntry->fCached);
+
+    pEntry->Core.Key     = uKey;
+    pEntry->Core.KeyLast = uKey;
+    pEntry->fCached      = true;
+
+    bool fInserted = RTAvlrU64Insert(&pCache->TreeEntries, &pEntry->Core);
+    Assert(fInserted); NOREF(fInserted);
+
+    /* Insert just behind the hand so it takes a full round until the entry is considered. */
+    if (pCache->pHand)
+        RTListNodeInsertBefore(&pCache->pHand->NodeClock, &pEntry->NodeClock);
+    else
+        RTListAppend(&pCache->ListClock, &pEntry->NodeClock);
+}
+
+/**
+ * Queries the cache statistics.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pStats    Where to store the statistics.
+ */
+DECLHIDDEN(void) vdMetaCacheQueryStats(PVDMETACACHE pCache, PVDMETACACHESTATS pStats)
+{
+    *pStats        = pCache->Stats;
+    pStats->cbUsed = pCache->cbUsed;
+    pStats->cbMax  = pCache->cbMax;
+}
+
+/**
+ * Writes the cache statistics to the release log.
+ *
+ * @returns nothing.
+ * @param   pCache      The cache instance, NULL is ignored.
+ * @param   pszBackend  The backend name for the log statement.
+ * @param   pszFilename The image filename for the log statement.
+ */
+DECLHIDDEN(void) vdMetaCacheLogStats(PVDMETACACHE pCache, const char *pszBackend, const char *pszFilename)
+{
+    if (   !pCache
+        || !(pCache->Stats.cHits + pCache->Stats.cMisses))
+        return;
+
+    LogRel(("%s: Metadata cache statistics for '%s': %llu hits, %llu misses, %llu evictions, %llu prefetches, %zu of %zu bytes used\n",
+            pszBackend, pszFilename, pCache->Stats.cHits, pCache->Stats.cMisses,
+            pCache->Stats.cEvictions, pCache->Stats.cPrefetches,
+            pCache->cbUsed, pCache->cbMax));
+}
@@ -0,0 +1,105 @@
+/* $Id: VDMetaCache.h $ */
+/** @file
+ * VD - Metadata table cache shared by the image backends.
+ */
+
+/*
+ * Copyright (C) 2014 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___VDMetaCache_h
+#define ___VDMetaCache_h
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vd-plugin.h>
+#include <iprt/avl.h>
+#include <iprt/list.h>
+
+RT_C_DECLS_BEGIN
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+
+/** Name of the configuration key for the cache size in bytes. */
+#define VD_METACACHE_CFG_SIZE       "MetaCacheSize"
+/** Smallest accepted cache size. */
+#define VD_METACACHE_SIZE_MIN       (256*_1K)
+/** Biggest accepted cache size. */
+#define VD_METACACHE_SIZE_MAX       (2*_1G64)
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+
+/**
+ * Metadata cache entry.
+ */
+typedef struct VDMETACACHEENTRY
+{
+    /** AVL tree node, the key is the backend specific table identifier,
+     * usually the offset of the table in the image. */
+    AVLRU64NODECORE     Core;
+    /** List node for the clock list. */
+    RTLISTNODE          NodeClock;
+    /** Reference counter. */
+    uint32_t            cRefs;
+    /** Flag whether the entry was accessed since the clock hand passed it the last time. */
+    bool                fReferenced;
+    /** Flag whether the entry is linked into the cache. */
+    bool                fCached;
+    /** Pointer to the cached table. */
+    void               *pvData;
+} VDMETACACHEENTRY;
+/** Pointer to a metadata cache entry. */
+typedef VDMETACACHEENTRY *PVDMETACACHEENTRY;
+
+/**
+ * Metadata cache statistics.
+ */
+typedef struct VDMETACACHESTATS
+{
+    /** Number of lookups satisfied from the cache. */
+    uint64_t            cHits;
+    /** Number of lookups which missed. */
+    uint64_t            cMisses;
+    /** Number of entries evicted to make room for new ones. */
+    uint64_t            cEvictions;
+    /** Number of tables read ahead of time. */
+    uint64_t            cPrefetches;
+    /** Amount of memory currently used for cached tables. */
+    size_t              cbUsed;
+    /** Maximum amount of memory the cache is allowed to use. */
+    size_t              cbMax;
+} VDMETACACHESTATS;
+/** Pointer to metadata cache statistics. */
+typedef VDMETACACHESTATS *PVDMETACACHESTATS;
+
+/** Metadata cache handle. */
+typedef struct VDMETACACHE *PVDMETACACHE;
+
+DECLHIDDEN(int)               vdMetaCacheCreate(PVDMETACACHE *ppCache, size_t cbEntry, size_t cbMax);
+DECLHIDDEN(void)              vdMetaCacheDestroy(PVDMETACACHE pCache);
+DECLHIDDEN(size_t)            vdMetaCacheQuerySize(PVDINTERFACE pVDIfsImage, size_t cbDefault);
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheRetain(PVDMETACACHE pCache, uint64_t uKey);
+DECLHIDDEN(bool)              vdMetaCacheIsCached(PVDMETACACHE pCache, uint64_t uKey);
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheEntryAlloc(PVDMETACACHE pCache, bool fPrefetch);
+DECLHIDDEN(void)              vdMetaCacheEntryRelease(PVDMETACACHEENTRY pEntry);
+DECLHIDDEN(void)              vdMetaCacheEntryFree(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry);
+DECLHIDDEN(void)              vdMetaCacheEntryInsert(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry, uint64_t uKey);
+DECLHIDDEN(void)              vdMetaCacheQueryStats(PVDMETACACHE pCache, PVDMETACACHESTATS pStats);
+DECLHIDDEN(void)              vdMetaCacheLogStats(PVDMETACACHE pCache, const char *pszBackend, const char *pszFilename);
+
+RT_C_DECLS_END
+
+#endif
@@ -33,6 +33,7 @@
 #include <iprt/asm.h>
 
 #include "VDBackends.h"
+#include "VDMetaCache.h"
 
 /*******************************************************************************
 *   Constants And Macros, Structures and Typedefs                              *
@@ -330,7 +331,8 @@ typedef struct VMDKEXTENT
 } VMDKEXTENT, *PVMDKEXTENT;
 
 /**
- * Grain table cache size. Allocated per image.
+ * Size of the grain table buffer for writing streamOptimized images in
+ * grain table blocks. Allocated per image.
  */
 #define VMDK_GT_CACHE_SIZE 256
 
@@ -341,6 +343,16 @@ typedef struct VMDKEXTENT
  */
 #define VMDK_GT_CACHELINE_SIZE 128
 
+/**
+ * Default amount of memory the grain table cache is allowed to use.
+ */
+#define VMDK_GT_CACHE_MEMORY_MAX (1*_1M)
+
+/**
+ * Computes the grain table cache key from the extent number and the
+ * grain table block number.
+ */
+#define VMDK_GT_CACHE_KEY(a_uExtent, a_uGTBlock) RT_MAKE_U64((uint32_t)(a_uGTBlock), (a_uExtent))
 
 /**
  * Maximum number of lines in a descriptor file. Not worth the effort of
@@ -377,31 +389,12 @@ typedef struct VMDKDESCRIPTOR
 
 /**
  * Cache entry for translating extent/sector to a sector number in that
- * extent.
- */
-typedef struct VMDKGTCACHEENTRY
-{
-    /** Extent number for which this entry is valid. */
-    uint32_t    uExtent;
-    /** GT data block number. */
-    uint64_t    uGTBlock;
-    /** Data part of the cache entry. */
-    uint32_t    aGTData[VMDK_GT_CACHELINE_SIZE];
-} VMDKGTCACHEENTRY, *PVMDKGTCACHEENTRY;
-
-/**
- * Cache data structure for blocks of grain table entries. For now this is a
- * fixed size direct mapping cache, but this should be adapted to the size of
- * the sparse image and maybe converted to a set-associative cache. The
- * implementation below implements a write-through cache with write allocate.
+ * extent. The cached data is a grain table block of VMDK_GT_CACHELINE_SIZE
+ * entries in host endianess.
  */
-typedef struct VMDKGTCACHE
-{
-    /** Cache entries. */
-    VMDKGTCACHEENTRY    aGTCache[VMDK_GT_CACHE_SIZE];
-    /** Number of cache entries (currently unused). */
-    unsigned            cEntries;
-} VMDKGTCACHE, *PVMDKGTCACHE;
+typedef VDMETACACHEENTRY VMDKGTCACHEENTRY, *PVMDKGTCACHEENTRY;
+/** Accessor for the grain table data in a cache entry. */
+#define VMDK_GT_CACHE_ENTRY_DATA(a_pGTCacheEntry) ((uint32_t *)(a_pGTCacheEntry)->pvData)
 
 /**
  * Complete VMDK image data structure. Mainly a collection of extents and a few
@@ -463,7 +456,9 @@ typedef struct VMDKIMAGE
     RTUUID          ParentModificationUuid;
 
     /** Pointer to grain table cache, if this image contains sparse extents. */
-    PVMDKGTCACHE    pGTCache;
+    PVDMETACACHE    pGTCache;
+    /** Grain table buffer for writing streamOptimized images, NULL otherwise. */
+    uint32_t        *paStreamGT;
     /** Pointer to the descriptor (NULL if no separate descriptor file). */
     char            *pDescData;
     /** Allocation size of the descriptor file. */
@@ -520,6 +515,12 @@ static const VDFILEEXTENSION s_aVmdkFileExtensions[] =
     {NULL, VDTYPE_INVALID}
 };
 
+static const VDCONFIGINFO s_aVmdkConfigInfo[] =
+{
+    { VD_METACACHE_CFG_SIZE,    "1048576",    VDCFGVALUETYPE_INTEGER,    VD_CFGKEY_EXPERT },
+    { NULL,                     NULL,         VDCFGVALUETYPE_INTEGER,    0 }
+};
+
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
@@ -2921,15 +2922,19 @@ static int vmdkAllocateGrainTableCache(PVMDKIMAGE pImage)
            )
         {
             /* Allocate grain table cache. */
-            pImage->pGTCache = (PVMDKGTCACHE)RTMemAllocZ(sizeof(VMDKGTCACHE));
-            if (!pImage->pGTCache)
-                return VERR_NO_MEMORY;
-            for (unsigned j = 0; j < VMDK_GT_CACHE_SIZE; j++)
+            size_t cbCache = vdMetaCacheQuerySize(pImage->pVDIfsImage, VMDK_GT_CACHE_MEMORY_MAX);
+            int rc = vdMetaCacheCreate(&pImage->pGTCache, VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t),
+                                       cbCache);
+            if (RT_FAILURE(rc))
+                return rc;
+
+            /* streamOptimized images are written one complete grain table at a time. */
+            if (pImage->uImageFlags & VD_VMDK_IMAGE_FLAGS_STREAM_OPTIMIZED)
             {
-                PVMDKGTCACHEENTRY pGCE = &pImage->pGTCache->aGTCache[j];
-                pGCE->uExtent = UINT32_MAX;
+                pImage->paStreamGT = (uint32_t *)RTMemAllocZ(VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t));
+                if (!pImage->paStreamGT)
+                    return VERR_NO_MEMORY;
             }
-            pImage->pGTCache->cEntries = VMDK_GT_CACHE_SIZE;
             break;
         }
     }
@@ -4129,9 +4134,7 @@ static int vmdkSetImageComment(PVMDKIMAGE pImage, const char *pszComment)
 static void vmdkStreamClearGT(PVMDKIMAGE pImage, PVMDKEXTENT pExtent)
 {
     uint32_t cCacheLines = RT_ALIGN(pExtent->cGTEntries, VMDK_GT_CACHELINE_SIZE) / VMDK_GT_CACHELINE_SIZE;
-    for (uint32_t i = 0; i < cCacheLines; i++)
-        memset(&pImage->pGTCache->aGTCache[i].aGTData[0], '\0',
-               VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t));
+    memset(pImage->paStreamGT, '\0', cCacheLines * VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t));
 }
 
 /**
@@ -4152,7 +4155,7 @@ static int vmdkStreamFlushGT(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     {
         /* Convert the grain table to little endian in place, as it will not
          * be used at all after this function has been called. */
-        uint32_t *pGTTmp = &pImage->pGTCache->aGTCache[i].aGTData[0];
+        uint32_t *pGTTmp = &pImage->paStreamGT[i * VMDK_GT_CACHELINE_SIZE];
         for (uint32_t j = 0; j < VMDK_GT_CACHELINE_SIZE; j++, pGTTmp++)
             if (*pGTTmp)
             {
@@ -4191,12 +4194,12 @@ static int vmdkStreamFlushGT(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     {
         /* Convert the grain table to little endian in place, as it will not
          * be used at all after this function has been called. */
-        uint32_t *pGTTmp = &pImage->pGTCache->aGTCache[i].aGTData[0];
+        uint32_t *pGTTmp = &pImage->paStreamGT[i * VMDK_GT_CACHELINE_SIZE];
         for (uint32_t j = 0; j < VMDK_GT_CACHELINE_SIZE; j++, pGTTmp++)
             *pGTTmp = RT_H2LE_U32(*pGTTmp);
 
         rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage, uFileOffset,
-                                    &pImage->pGTCache->aGTCache[i].aGTData[0],
+                                    &pImage->paStreamGT[i * VMDK_GT_CACHELINE_SIZE],
                                     VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t));
         uFileOffset += VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t);
         if (RT_FAILURE(rc))
@@ -4352,9 +4355,15 @@ static int vmdkFreeImage(PVMDKIMAGE pImage, bool fDelete)
 
         if (pImage->pGTCache)
         {
-            RTMemFree(pImage->pGTCache);
+            vdMetaCacheLogStats(pImage->pGTCache, "VMDK", pImage->pszFilename);
+            vdMetaCacheDestroy(pImage->pGTCache);
             pImage->pGTCache = NULL;
         }
+        if (pImage->paStreamGT)
+        {
+            RTMemFree(pImage->paStreamGT);
+            pImage->paStreamGT = NULL;
+        }
         if (pImage->pDescData)
         {
             RTMemFree(pImage->pDescData);
@@ -4483,14 +4492,47 @@ static int vmdkFindExtent(PVMDKIMAGE pImage, uint64_t offSector,
 }
 
 /**
- * Internal. Hash function for placing the grain table hash entries.
+ * Internal. Fetches a grain table block, trying the grain table cache first
+ * and reading it from the image after a cache miss. On success the returned
+ * entry has a reference retained which must be released by the caller.
  */
-static uint32_t vmdkGTCacheHash(PVMDKGTCACHE pCache, uint64_t uSector,
-                                unsigned uExtent)
+static int vmdkGTCacheFetch(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOCTX pIoCtx,
+                            uint64_t uGTSector, uint64_t uGTBlock,
+                            PFNVDXFERCOMPLETED pfnComplete, void *pvUser,
+                            PVMDKGTCACHEENTRY *ppGTCacheEntry)
 {
-    /** @todo this hash function is quite simple, maybe use a better one which
-     * scrambles the bits better. */
-    return (uSector + uExtent) % pCache->cEntries;
+    uint64_t uKey = VMDK_GT_CACHE_KEY(pExtent->uExtent, uGTBlock);
+    PVMDKGTCACHEENTRY pGTCacheEntry = vdMetaCacheRetain(pImage->pGTCache, uKey);
+
+    if (!pGTCacheEntry)
+    {
+        /* Cache miss, fetch data from disk. */
+        PVDMETAXFER pMetaXfer = NULL;
+        pGTCacheEntry = vdMetaCacheEntryAlloc(pImage->pGTCache, false /* fPrefetch */);
+        if (!pGTCacheEntry)
+            return VERR_NO_MEMORY;
+
+        uint32_t *paGTData = VMDK_GT_CACHE_ENTRY_DATA(pGTCacheEntry);
+        int rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pExtent->pFile->pStorage,
+                                       VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t),
+                                       paGTData, VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t), pIoCtx,
+                                       &pMetaXfer, pfnComplete, pvUser);
+        if (RT_FAILURE(rc))
+        {
+            /* The entry is not usable until the read completed, the caller retries. */
+            vdMetaCacheEntryRelease(pGTCacheEntry);
+            vdMetaCacheEntryFree(pImage->pGTCache, pGTCacheEntry);
+            return rc;
+        }
+        /* We can release the metadata transfer immediately. */
+        vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+        for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
+            paGTData[i] = RT_LE2H_U32(paGTData[i]);
+        vdMetaCacheEntryInsert(pImage->pGTCache, pGTCacheEntry, uKey);
+    }
+
+    *ppGTCacheEntry = pGTCacheEntry;
+    return VINF_SUCCESS;
 }
 
 /**
@@ -4501,11 +4543,9 @@ static int vmdkGetSector(PVMDKIMAGE pImage, PVDIOCTX pIoCtx,
                          PVMDKEXTENT pExtent, uint64_t uSector,
                          uint64_t *puExtentSector)
 {
-    PVMDKGTCACHE pCache = pImage->pGTCache;
     uint64_t uGDIndex, uGTSector, uGTBlock;
-    uint32_t uGTHash, uGTBlockIndex;
+    uint32_t uGTBlockIndex;
     PVMDKGTCACHEENTRY pGTCacheEntry;
-    uint32_t aGTDataTmp[VMDK_GT_CACHELINE_SIZE];
     int rc;
 
     /* For newly created and readonly/sequentially opened streamOptimized
@@ -4533,27 +4573,13 @@ static int vmdkGetSector(PVMDKIMAGE pImage, PVDIOCTX pIoCtx,
     }
 
     uGTBlock = uSector / (pExtent->cSectorsPerGrain * VMDK_GT_CACHELINE_SIZE);
-    uGTHash = vmdkGTCacheHash(pCache, uGTBlock, pExtent->uExtent);
-    pGTCacheEntry = &pCache->aGTCache[uGTHash];
-    if (    pGTCacheEntry->uExtent != pExtent->uExtent
-        ||  pGTCacheEntry->uGTBlock != uGTBlock)
-    {
-        /* Cache miss, fetch data from disk. */
-        PVDMETAXFER pMetaXfer;
-        rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pExtent->pFile->pStorage,
-                                   VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * sizeof(aGTDataTmp),
-                                   aGTDataTmp, sizeof(aGTDataTmp), pIoCtx, &pMetaXfer, NULL, NULL);
-        if (RT_FAILURE(rc))
-            return rc;
-        /* We can release the metadata transfer immediately. */
-        vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
-        pGTCacheEntry->uExtent = pExtent->uExtent;
-        pGTCacheEntry->uGTBlock = uGTBlock;
-        for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
-            pGTCacheEntry->aGTData[i] = RT_LE2H_U32(aGTDataTmp[i]);
-    }
+    rc = vmdkGTCacheFetch(pImage, pExtent, pIoCtx, uGTSector, uGTBlock,
+                          NULL, NULL, &pGTCacheEntry);
+    if (RT_FAILURE(rc))
+        return rc;
     uGTBlockIndex = (uSector / pExtent->cSectorsPerGrain) % VMDK_GT_CACHELINE_SIZE;
-    uint32_t uGrainSector = pGTCacheEntry->aGTData[uGTBlockIndex];
+    uint32_t uGrainSector = VMDK_GT_CACHE_ENTRY_DATA(pGTCacheEntry)[uGTBlockIndex];
+    vdMetaCacheEntryRelease(pGTCacheEntry);
     if (uGrainSector)
         *puExtentSector = uGrainSector + uSector % pExtent->cSectorsPerGrain;
     else
@@ -4631,13 +4657,13 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     /* Paranoia check: extent type, grain table buffer presence and
      * grain table buffer space. Also grain table entry must be clear. */
     if (   pExtent->enmType != VMDKETYPE_HOSTED_SPARSE
-        || !pImage->pGTCache
+        || !pImage->paStreamGT
         || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE
-        || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
+        || pImage->paStreamGT[uCacheLine * VMDK_GT_CACHELINE_SIZE + uCacheEntry])
         return VERR_INTERNAL_ERROR;
 
     /* Update grain table entry. */
-    pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
+    pImage->paStreamGT[uCacheLine * VMDK_GT_CACHELINE_SIZE + uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
 
     if (cbWrite != VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain))
     {
@@ -4679,15 +4705,14 @@ static int vmdkAllocGrainGTUpdate(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOC
                                   PVMDKGRAINALLOCASYNC pGrainAlloc)
 {
     int rc = VINF_SUCCESS;
-    PVMDKGTCACHE pCache = pImage->pGTCache;
     uint32_t aGTDataTmp[VMDK_GT_CACHELINE_SIZE];
-    uint32_t uGTHash, uGTBlockIndex;
+    uint32_t uGTBlockIndex;
     uint64_t uGTSector, uRGTSector, uGTBlock;
     uint64_t uSector = pGrainAlloc->uSector;
     PVMDKGTCACHEENTRY pGTCacheEntry;
 
-    LogFlowFunc(("pImage=%#p pExtent=%#p pCache=%#p pIoCtx=%#p pGrainAlloc=%#p\n",
-                 pImage, pExtent, pCache, pIoCtx, pGrainAlloc));
+    LogFlowFunc(("pImage=%#p pExtent=%#p pIoCtx=%#p pGrainAlloc=%#p\n",
+                 pImage, pExtent, pIoCtx, pGrainAlloc));
 
     uGTSector = pGrainAlloc->uGTSector;
     uRGTSector = pGrainAlloc->uRGTSector;
@@ -4695,45 +4720,29 @@ static int vmdkAllocGrainGTUpdate(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOC
 
     /* Update the grain table (and the cache). */
     uGTBlock = uSector / (pExtent->cSectorsPerGrain * VMDK_GT_CACHELINE_SIZE);
-    uGTHash = vmdkGTCacheHash(pCache, uGTBlock, pExtent->uExtent);
-    pGTCacheEntry = &pCache->aGTCache[uGTHash];
-    if (    pGTCacheEntry->uExtent != pExtent->uExtent
-        ||  pGTCacheEntry->uGTBlock != uGTBlock)
-    {
-        /* Cache miss, fetch data from disk. */
-        LogFlow(("Cache miss, fetch data from disk\n"));
-        PVDMETAXFER pMetaXfer = NULL;
-        rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pExtent->pFile->pStorage,
-                                   VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * sizeof(aGTDataTmp),
-                                   aGTDataTmp, sizeof(aGTDataTmp), pIoCtx,
-                                   &pMetaXfer, vmdkAllocGrainComplete, pGrainAlloc);
-        if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
-        {
-            pGrainAlloc->cIoXfersPending++;
-            pGrainAlloc->fGTUpdateNeeded = true;
-            /* Leave early, we will be called  again after the read completed. */
-            LogFlowFunc(("Metadata read in progress, leaving\n"));
-            return rc;
-        }
-        else if (RT_FAILURE(rc))
-            return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot read allocated grain table entry in '%s'"), pExtent->pszFullname);
-        vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
-        pGTCacheEntry->uExtent = pExtent->uExtent;
-        pGTCacheEntry->uGTBlock = uGTBlock;
-        for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
-            pGTCacheEntry->aGTData[i] = RT_LE2H_U32(aGTDataTmp[i]);
-    }
-    else
+    rc = vmdkGTCacheFetch(pImage, pExtent, pIoCtx, uGTSector, uGTBlock,
+                          vmdkAllocGrainComplete, pGrainAlloc, &pGTCacheEntry);
+    if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
     {
-        /* Cache hit. Convert grain table block back to disk format, otherwise
-         * the code below will write garbage for all but the updated entry. */
-        for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
-            aGTDataTmp[i] = RT_H2LE_U32(pGTCacheEntry->aGTData[i]);
+        pGrainAlloc->cIoXfersPending++;
+        pGrainAlloc->fGTUpdateNeeded = true;
+        /* Leave early, we will be called  again after the read completed. */
+        LogFlowFunc(("Metadata read in progress, leaving\n"));
+        return rc;
     }
+    else if (RT_FAILURE(rc))
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot read allocated grain table entry in '%s'"), pExtent->pszFullname);
+
+    /* Convert grain table block back to disk format, otherwise the code
+     * below will write garbage for all but the updated entry. */
+    uint32_t *paGTData = VMDK_GT_CACHE_ENTRY_DATA(pGTCacheEntry);
+    for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
+        aGTDataTmp[i] = RT_H2LE_U32(paGTData[i]);
     pGrainAlloc->fGTUpdateNeeded = false;
     uGTBlockIndex = (uSector / pExtent->cSectorsPerGrain) % VMDK_GT_CACHELINE_SIZE;
     aGTDataTmp[uGTBlockIndex] = RT_H2LE_U32(VMDK_BYTE2SECTOR(pGrainAlloc->uGrainOffset));
-    pGTCacheEntry->aGTData[uGTBlockIndex] = VMDK_BYTE2SECTOR(pGrainAlloc->uGrainOffset);
+    paGTData[uGTBlockIndex] = VMDK_BYTE2SECTOR(pGrainAlloc->uGrainOffset);
+    vdMetaCacheEntryRelease(pGTCacheEntry);
     /* Update grain table on disk. */
     rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pExtent->pFile->pStorage,
                                 VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * sizeof(aGTDataTmp),
@@ -4801,14 +4810,13 @@ static int vmdkAllocGrainComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvU
 static int vmdkAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOCTX pIoCtx,
                           uint64_t uSector, uint64_t cbWrite)
 {
-    PVMDKGTCACHE pCache = pImage->pGTCache;
     uint64_t uGDIndex, uGTSector, uRGTSector;
     uint64_t uFileOffset;
     PVMDKGRAINALLOCASYNC pGrainAlloc = NULL;
     int rc;
 
-    LogFlowFunc(("pCache=%#p pExtent=%#p pIoCtx=%#p uSector=%llu cbWrite=%llu\n",
-                 pCache, pExtent, pIoCtx, uSector, cbWrite));
+    LogFlowFunc(("pGTCache=%#p pExtent=%#p pIoCtx=%#p uSector=%llu cbWrite=%llu\n",
+                 pImage->pGTCache, pExtent, pIoCtx, uSector, cbWrite));
 
     pGrainAlloc = (PVMDKGRAINALLOCASYNC)RTMemAllocZ(sizeof(VMDKGRAINALLOCASYNC));
     if (!pGrainAlloc)
@@ -5230,6 +5238,7 @@ static int vmdkCheckIfValid(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
     pImage->pExtents = NULL;
     pImage->pFiles = NULL;
     pImage->pGTCache = NULL;
+    pImage->paStreamGT = NULL;
     pImage->pDescData = NULL;
     pImage->pVDIfsDisk = pVDIfsDisk;
     pImage->pVDIfsImage = pVDIfsImage;
@@ -5283,6 +5292,7 @@ static int vmdkOpen(const char *pszFilename, unsigned uOpenFlags,
     pImage->pExtents = NULL;
     pImage->pFiles = NULL;
     pImage->pGTCache = NULL;
+    pImage->paStreamGT = NULL;
     pImage->pDescData = NULL;
     pImage->pVDIfsDisk = pVDIfsDisk;
     pImage->pVDIfsImage = pVDIfsImage;
@@ -5370,6 +5380,7 @@ static int vmdkCreate(const char *pszFilename, uint64_t cbSize,
     pImage->pExtents = NULL;
     pImage->pFiles = NULL;
     pImage->pGTCache = NULL;
+    pImage->paStreamGT = NULL;
     pImage->pDescData = NULL;
     pImage->pVDIfsDisk = pVDIfsDisk;
     pImage->pVDIfsImage = pVDIfsImage;
@@ -6564,7 +6575,7 @@ const VBOXHDDBACKEND g_VmdkBackend =
     /* paFileExtensions */
     s_aVmdkFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aVmdkConfigInfo,
     /* pfnCheckIfValid */
     vmdkCheckIfValid,
     /* pfnOpen */
@@ -22,11 +22,14 @@
 #include <VBox/err.h>
 #include <VBox/log.h>
 #include <iprt/asm-amd64-x86.h>
+#include <iprt/asm.h>
 #include <iprt/dir.h>
 #include <iprt/string.h>
 #include <iprt/stream.h>
 #include <iprt/file.h>
+#include <iprt/fs.h>
 #include <iprt/mem.h>
+#include <iprt/path.h>
 #include <iprt/initterm.h>
 #include <iprt/rand.h>
 #include "stdio.h"
@@ -35,6 +38,9 @@
 #define VHD_TEST
 #define VDI_TEST
 #define VMDK_TEST
+#define DEDUP_TEST
+#define QCOW_TEST
+#define QED_TEST
 
 /*******************************************************************************
 *   Global Variables                                                           *
@@ -697,6 +703,882 @@ static int tstVDCreateWriteOpenRead(const char *pszBackend,
     return 0;
 }
 
+static int tstVDCrashConsistency(const char *pszBackend,
+                                 const char *pszFilename,
+                                 const char *pszCopyFilename,
+                                 bool fDiscard,
+                                 uint32_t u32Seed)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    PVBOXHDD pVDCopy = NULL;
+    VDGEOMETRY PCHS = { 0, 0, 0 };
+    VDGEOMETRY LCHS = { 0, 0, 0 };
+    /* Big enough for VDI to read the block array on demand. */
+    uint64_t u64DiskSize = _1T / 4;
+    uint32_t u32SectorSize = 512;
+    unsigned uOpenFlags = fDiscard ? VD_OPEN_FLAGS_DISCARD : VD_OPEN_FLAGS_NORMAL;
+    PVDINTERFACE     pVDIfs = NULL;
+    VDINTERFACEERROR VDIfError;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            if (pvBuf) \
+                RTMemFree(pvBuf); \
+            if (pVDCopy) \
+                VDDestroy(pVDCopy); \
+            VDDestroy(pVD); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+
+    RTFileDelete(pszFilename);
+    RTFileDelete(pszCopyFilename);
+
+    rc = VDCreateBase(pVD, pszBackend, pszFilename, u64DiskSize,
+                      VD_IMAGE_FLAGS_NONE, "Test image",
+                      &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      NULL, NULL);
+    CHECK("VDCreateBase()");
+    VDCloseAll(pVD);
+
+    rc = VDOpen(pVD, pszBackend, pszFilename, uOpenFlags, NULL);
+    CHECK("VDOpen()");
+
+    int nSegments = 50;
+    /* Allocate one extra element for a sentinel. */
+    PSEGMENT paSegments  = (PSEGMENT)RTMemAllocZ(sizeof(struct Segment) * (nSegments + 1));
+
+    if (fDiscard)
+    {
+        /*
+         * Fill whole blocks and discard every other one, this moves the blocks
+         * at the end of the image into the freed ones. The discarded blocks
+         * have to read back as zeros.
+         */
+        RTRANGE aRanges[8];
+        for (int i = 0; i < nSegments; i++)
+        {
+            paSegments[i].u64Offset = (uint64_t)i * 7 * _1M;
+            paSegments[i].u32Length = _1M;
+            paSegments[i].u8Value   = (uint8_t)(i + 1);
+        }
+        writeSegmentsToDisk(pVD, pvBuf, paSegments);
+
+        for (unsigned i = 0; i < RT_ELEMENTS(aRanges); i++)
+        {
+            PSEGMENT pSegment = &paSegments[i * 2];
+            aRanges[i].offStart = pSegment->u64Offset;
+            aRanges[i].cbRange  = pSegment->u32Length;
+            pSegment->u8Value   = 0;
+        }
+        rc = VDDiscardRanges(pVD, &aRanges[0], RT_ELEMENTS(aRanges));
+        CHECK("VDDiscardRanges()");
+    }
+    else
+    {
+        RNDCTX ctx;
+        initializeRandomGenerator(&ctx, u32Seed);
+        generateRandomSegments(&ctx, paSegments, nSegments, _1M, u64DiskSize, u32SectorSize, 0u, 127u);
+        writeSegmentsToDisk(pVD, pvBuf, paSegments);
+    }
+
+    /*
+     * Take a copy of the image without flushing or closing it, which is
+     * what is left on the disk after a host crash.
+     */
+    rc = RTFileCopy(pszFilename, pszCopyFilename);
+    CHECK("RTFileCopy()");
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVDCopy);
+    CHECK("VDCreate()");
+    rc = VDOpen(pVDCopy, pszBackend, pszCopyFilename, VD_OPEN_FLAGS_READONLY, NULL);
+    CHECK("VDOpen()");
+    rc = readAndCompareSegments(pVDCopy, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    RTMemFree(paSegments);
+
+    VDDestroy(pVDCopy);
+    VDDestroy(pVD);
+    RTFileDelete(pszCopyFilename);
+    if (pvBuf)
+        RTMemFree(pvBuf);
+#undef CHECK
+    return 0;
+}
+
+static int tstVDDedupWriteOpenRead(const char *pszFilename,
+                                   const char *pszFilename2)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    PVBOXHDD pVD2 = NULL;
+    VDGEOMETRY PCHS = { 0, 0, 0 };
+    VDGEOMETRY LCHS = { 0, 0, 0 };
+    uint64_t u64DiskSize = 100 * _1M;
+    PVDINTERFACE     pVDIfs = NULL;
+    VDINTERFACEERROR VDIfError;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            if (pvBuf) \
+                RTMemFree(pvBuf); \
+            if (pVD2) \
+                VDDestroy(pVD2); \
+            VDDestroy(pVD); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD2);
+    CHECK("VDCreate()");
+
+    /* Both images use the default store next to them. */
+    rc = VDCreateBase(pVD, "Dedup", pszFilename, u64DiskSize,
+                      VD_IMAGE_FLAGS_NONE, "Test image",
+                      &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      NULL, NULL);
+    CHECK("VDCreateBase()");
+    rc = VDCreateBase(pVD2, "Dedup", pszFilename2, u64DiskSize,
+                      VD_IMAGE_FLAGS_NONE, "Test image",
+                      &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      NULL, NULL);
+    CHECK("VDCreateBase()");
+
+    /*
+     * The same two patterns repeated all over the disk, zeros in between and
+     * a few writes not covering a whole block which have to be merged with
+     * the old content of the block. Everything is written to both images.
+     */
+    int nSegments = 40;
+    /* Room for splitting segments below and one extra element for a sentinel. */
+    PSEGMENT paSegments  = (PSEGMENT)RTMemAllocZ(sizeof(struct Segment) * (nSegments * 2 + 1));
+    for (int i = 0; i < nSegments; i++)
+    {
+        paSegments[i].u64Offset = (uint64_t)i * 2 * _1M;
+        paSegments[i].u32Length = _256K;
+        paSegments[i].u8Value   = (i % 3) == 2 ? 0 : (uint8_t)(0x11 << (i % 3));
+    }
+    writeSegmentsToDisk(pVD, pvBuf, paSegments);
+    writeSegmentsToDisk(pVD2, pvBuf, paSegments);
+
+    /* Overwrite the second sector of every fifth segment. */
+    struct Segment aPartial[3];
+    RT_ZERO(aPartial);
+    for (int i = 0; i < nSegments; i += 5)
+    {
+        aPartial[0].u64Offset = paSegments[i].u64Offset;
+        aPartial[0].u32Length = 512;
+        aPartial[0].u8Value   = paSegments[i].u8Value;
+        aPartial[1].u64Offset = paSegments[i].u64Offset + 512;
+        aPartial[1].u32Length = 512;
+        aPartial[1].u8Value   = 0x55;
+        writeSegmentsToDisk(pVD, pvBuf, &aPartial[1]);
+
+        /* Split the segment to keep the expected content in order. */
+        memmove(&paSegments[i + 2], &paSegments[i], (nSegments - i + 1) * sizeof(struct Segment));
+        paSegments[i] = aPartial[0];
+        paSegments[i + 1] = aPartial[1];
+        paSegments[i + 2].u64Offset += 1024;
+        paSegments[i + 2].u32Length -= 1024;
+        nSegments += 2;
+        i += 2;
+    }
+
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    VDCloseAll(pVD);
+    VDCloseAll(pVD2);
+
+    rc = VDOpen(pVD, "Dedup", pszFilename, VD_OPEN_FLAGS_NORMAL, NULL);
+    CHECK("VDOpen()");
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    /* Deleting the second image must not affect the blocks shared with the first one. */
+    rc = VDOpen(pVD2, "Dedup", pszFilename2, VD_OPEN_FLAGS_NORMAL, NULL);
+    CHECK("VDOpen()");
+    rc = VDClose(pVD2, true /* fDelete */);
+    CHECK("VDClose()");
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    RTMemFree(paSegments);
+
+    VDDestroy(pVD2);
+    VDDestroy(pVD);
+    if (pvBuf)
+        RTMemFree(pvBuf);
+#undef CHECK
+    return 0;
+}
+
+/** Configuration of the cache for tstVDCacheWriteBack(), keeps all data dirty. */
+static const char * const g_apszCacheCfg[][2] =
+{
+    { "WriteBack",      "1" },
+    { "DirtyLowWater",  "100" },
+    { "DirtyHighWater", "100" },
+    { "DirtyMaxAge",    "3600000" },
+    { NULL,             NULL }
+};
+
+/** Configuration for tstVDMetaCacheEviction(), the smallest possible metadata cache. */
+static const char * const g_apszMetaCacheCfg[][2] =
+{
+    { "MetaCacheSize",  "262144" },
+    { NULL,             NULL }
+};
+
+static DECLCALLBACK(bool) tstVDCfgAreKeysValid(void *pvUser, const char *pszzValid)
+{
+    return true;
+}
+
+static DECLCALLBACK(int) tstVDCfgQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
+{
+    const char * const (*papszCfg)[2] = (const char * const (*)[2])pvUser;
+
+    for (unsigned i = 0; papszCfg[i][0]; i++)
+        if (!strcmp(pszName, papszCfg[i][0]))
+        {
+            *pcbValue = strlen(papszCfg[i][1]) + 1;
+            return VINF_SUCCESS;
+        }
+
+    return VERR_CFGM_VALUE_NOT_FOUND;
+}
+
+static DECLCALLBACK(int) tstVDCfgQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    const char * const (*papszCfg)[2] = (const char * const (*)[2])pvUser;
+
+    for (unsigned i = 0; papszCfg[i][0]; i++)
+        if (!strcmp(pszName, papszCfg[i][0]))
+            return RTStrCopy(pszValue, cchValue, papszCfg[i][1]);
+
+    return VERR_CFGM_VALUE_NOT_FOUND;
+}
+
+static int tstVDCacheWriteBack(const char *pszFilename, const char *pszCacheFilename,
+                               const char *pszCopyFilename, const char *pszCacheCopyFilename,
+                               uint32_t u32Seed)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    PVBOXHDD pVDCopy = NULL;
+    VDGEOMETRY PCHS = { 0, 0, 0 };
+    VDGEOMETRY LCHS = { 0, 0, 0 };
+    uint64_t u64DiskSize = 200 * _1M;
+    uint32_t u32SectorSize = 512;
+    PVDINTERFACE      pVDIfs = NULL;
+    PVDINTERFACE      pVDIfsCache = NULL;
+    VDINTERFACEERROR  VDIfError;
+    VDINTERFACECONFIG VDIfConfig;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            if (pvBuf) \
+                RTMemFree(pvBuf); \
+            if (pVDCopy) \
+                VDDestroy(pVDCopy); \
+            VDDestroy(pVD); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    /* Create the config interface enabling write-back mode for the cache. */
+    VDIfConfig.pfnAreKeysValid = tstVDCfgAreKeysValid;
+    VDIfConfig.pfnQuerySize    = tstVDCfgQuerySize;
+    VDIfConfig.pfnQuery        = tstVDCfgQuery;
+    VDIfConfig.pfnQueryBytes   = NULL;
+
+    rc = VDInterfaceAdd(&VDIfConfig.Core, "tstVD_Config", VDINTERFACETYPE_CONFIG,
+                        (void *)g_apszCacheCfg, sizeof(VDINTERFACECONFIG), &pVDIfsCache);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVDCopy);
+    CHECK("VDCreate()");
+
+    RTFileDelete(pszFilename);
+    RTFileDelete(pszCacheFilename);
+    RTFileDelete(pszCopyFilename);
+    RTFileDelete(pszCacheCopyFilename);
+
+    rc = VDCreateBase(pVD, "VDI", pszFilename, u64DiskSize,
+                      VD_IMAGE_FLAGS_NONE, "Test image",
+                      &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      NULL, NULL);
+    CHECK("VDCreateBase()");
+    rc = VDCreateCache(pVD, "VCI", pszCacheFilename, 64 * _1M,
+                       VD_IMAGE_FLAGS_NONE, "Test cache", NULL,
+                       VD_OPEN_FLAGS_NORMAL, pVDIfsCache, NULL);
+    CHECK("VDCreateCache()");
+
+    int nSegments = 50;
+    /* Allocate one extra element for a sentinel. */
+    PSEGMENT paSegments  = (PSEGMENT)RTMemAllocZ(sizeof(struct Segment) * (nSegments + 1));
+
+    RNDCTX ctx;
+    initializeRandomGenerator(&ctx, u32Seed);
+    generateRandomSegments(&ctx, paSegments, nSegments, _256K, u64DiskSize, u32SectorSize, 1u, 255u);
+
+    /* The writes stay in the cache as dirty data. */
+    writeSegmentsToDisk(pVD, pvBuf, paSegments);
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+    rc = VDFlush(pVD);
+    CHECK("VDFlush()");
+
+    /*
+     * Take a copy of the image and the cache without closing them, which is
+     * what is left on the disk after a host crash. The dirty data has to be
+     * recovered from the journal of the cache when it is opened again.
+     */
+    rc = RTFileCopy(pszFilename, pszCopyFilename);
+    CHECK("RTFileCopy()");
+    rc = RTFileCopy(pszCacheFilename, pszCacheCopyFilename);
+    CHECK("RTFileCopy()");
+
+    /* The data was not written back yet, the image alone must not have it. */
+    rc = VDOpen(pVDCopy, "VDI", pszCopyFilename, VD_OPEN_FLAGS_READONLY, NULL);
+    CHECK("VDOpen()");
+    rc = VDRead(pVDCopy, paSegments[0].u64Offset, pvBuf, paSegments[0].u32Length);
+    CHECK("VDRead()");
+    if (ASMMemIsAll8(pvBuf, paSegments[0].u32Length, 0) != NULL)
+    {
+        rc = VERR_INTERNAL_ERROR;
+        CHECK("Data written back too early");
+    }
+    VDCloseAll(pVDCopy);
+
+    rc = VDOpen(pVDCopy, "VDI", pszCopyFilename, VD_OPEN_FLAGS_NORMAL, NULL);
+    CHECK("VDOpen()");
+    rc = VDCacheOpen(pVDCopy, "VCI", pszCacheCopyFilename, VD_OPEN_FLAGS_NORMAL, pVDIfsCache);
+    CHECK("VDCacheOpen()");
+    rc = readAndCompareSegments(pVDCopy, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    /* Closing writes back all dirty data to the image. */
+    VDCloseAll(pVDCopy);
+    rc = VDOpen(pVDCopy, "VDI", pszCopyFilename, VD_OPEN_FLAGS_READONLY, NULL);
+    CHECK("VDOpen()");
+    rc = readAndCompareSegments(pVDCopy, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+    VDCloseAll(pVDCopy);
+
+    /* Same for the original after a clean close. */
+    VDCloseAll(pVD);
+    rc = VDOpen(pVD, "VDI", pszFilename, VD_OPEN_FLAGS_READONLY, NULL);
+    CHECK("VDOpen()");
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    RTMemFree(paSegments);
+
+    VDDestroy(pVDCopy);
+    VDDestroy(pVD);
+    RTFileDelete(pszCacheFilename);
+    RTFileDelete(pszCopyFilename);
+    RTFileDelete(pszCacheCopyFilename);
+    if (pvBuf)
+        RTMemFree(pvBuf);
+#undef CHECK
+    return 0;
+}
+
+/**
+ * Writes to a big sparse image with the smallest metadata cache possible so
+ * the backend has to evict and reload its tables all the time, and checks
+ * that nothing gets lost before and after reopening the image.
+ */
+static int tstVDMetaCacheEviction(const char *pszBackend, const char *pszFilename,
+                                  uint32_t u32Seed)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    VDGEOMETRY PCHS = { 0, 0, 0 };
+    VDGEOMETRY LCHS = { 0, 0, 0 };
+    uint64_t u64DiskSize = 20 * _1G64;
+    uint32_t u32SectorSize = 512;
+    PVDINTERFACE      pVDIfs = NULL;
+    PVDINTERFACE      pVDIfsImage = NULL;
+    VDINTERFACEERROR  VDIfError;
+    VDINTERFACECONFIG VDIfConfig;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            if (pvBuf) \
+                RTMemFree(pvBuf); \
+            VDDestroy(pVD); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    /* Create the config interface limiting the metadata cache. */
+    VDIfConfig.pfnAreKeysValid = tstVDCfgAreKeysValid;
+    VDIfConfig.pfnQuerySize    = tstVDCfgQuerySize;
+    VDIfConfig.pfnQuery        = tstVDCfgQuery;
+    VDIfConfig.pfnQueryBytes   = NULL;
+
+    rc = VDInterfaceAdd(&VDIfConfig.Core, "tstVD_Config", VDINTERFACETYPE_CONFIG,
+                        (void *)g_apszMetaCacheCfg, sizeof(VDINTERFACECONFIG), &pVDIfsImage);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+
+    RTFileDelete(pszFilename);
+
+    rc = VDCreateBase(pVD, pszBackend, pszFilename, u64DiskSize,
+                      VD_IMAGE_FLAGS_NONE, "Test image",
+                      &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      pVDIfsImage, NULL);
+    CHECK("VDCreateBase()");
+
+    /* Spread the writes over far more tables than fit into the cache. */
+    int nSegments = 400;
+    /* Allocate one extra element for a sentinel. */
+    PSEGMENT paSegments  = (PSEGMENT)RTMemAllocZ(sizeof(struct Segment) * (nSegments + 1));
+
+    RNDCTX ctx;
+    initializeRandomGenerator(&ctx, u32Seed);
+    generateRandomSegments(&ctx, paSegments, nSegments, _64K, u64DiskSize, u32SectorSize, 1u, 255u);
+
+    writeSegmentsToDisk(pVD, pvBuf, paSegments);
+    rc = VDFlush(pVD);
+    CHECK("VDFlush()");
+
+    /* Reading everything back evicts the tables updated last. */
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    VDCloseAll(pVD);
+
+    rc = VDOpen(pVD, pszBackend, pszFilename, VD_OPEN_FLAGS_NORMAL, pVDIfsImage);
+    CHECK("VDOpen()");
+    rc = readAndCompareSegments(pVD, pvBuf, paSegments);
+    CHECK("readAndCompareSegments()");
+
+    RTMemFree(paSegments);
+
+    VDDestroy(pVD);
+    RTFileDelete(pszFilename);
+    if (pvBuf)
+        RTMemFree(pvBuf);
+#undef CHECK
+    return 0;
+}
+
+/**
+ * Per image state of the I/O interface used by tstVDCopyPipeline() which
+ * can be told to fail reads.
+ */
+typedef struct TSTVDIOFAIL
+{
+    /** Flag whether reads touching anything at or beyond offFail fail. */
+    volatile bool     fFailReads;
+    /** Offset from which on reads fail. */
+    uint64_t          offFail;
+    /** Number of reads which were failed. */
+    volatile uint32_t cReadsFailed;
+} TSTVDIOFAIL;
+/** Pointer to the failing I/O interface state. */
+typedef TSTVDIOFAIL *PTSTVDIOFAIL;
+
+static DECLCALLBACK(int) tstVDIoFailOpen(void *pvUser, const char *pszLocation, uint32_t fOpen,
+                                         PFNVDCOMPLETED pfnCompleted, void **ppStorage)
+{
+    PRTFILE phFile = (PRTFILE)RTMemAllocZ(sizeof(RTFILE));
+    if (!phFile)
+        return VERR_NO_MEMORY;
+
+    int rc = RTFileOpen(phFile, pszLocation, fOpen);
+    if (RT_SUCCESS(rc))
+        *ppStorage = phFile;
+    else
+        RTMemFree(phFile);
+    return rc;
+}
+
+static DECLCALLBACK(int) tstVDIoFailClose(void *pvUser, void *pStorage)
+{
+    PRTFILE phFile = (PRTFILE)pStorage;
+    int rc = RTFileClose(*phFile);
+    RTMemFree(phFile);
+    return rc;
+}
+
+static DECLCALLBACK(int) tstVDIoFailDelete(void *pvUser, const char *pcszFilename)
+{
+    return RTFileDelete(pcszFilename);
+}
+
+static DECLCALLBACK(int) tstVDIoFailMove(void *pvUser, const char *pcszSrc, const char *pcszDst, unsigned fMove)
+{
+    return RTFileMove(pcszSrc, pcszDst, fMove);
+}
+
+static DECLCALLBACK(int) tstVDIoFailGetFreeSpace(void *pvUser, const char *pcszFilename, int64_t *pcbFreeSpace)
+{
+    RTFOFF cbFree = 0;
+    int rc = RTFsQuerySizes(pcszFilename, NULL, &cbFree, NULL, NULL);
+    if (RT_SUCCESS(rc))
+        *pcbFreeSpace = cbFree;
+    return rc;
+}
+
+static DECLCALLBACK(int) tstVDIoFailGetModificationTime(void *pvUser, const char *pcszFilename,
+                                                        PRTTIMESPEC pModificationTime)
+{
+    RTFSOBJINFO Info;
+    int rc = RTPathQueryInfo(pcszFilename, &Info, RTFSOBJATTRADD_NOTHING);
+    if (RT_SUCCESS(rc))
+        *pModificationTime = Info.ModificationTime;
+    return rc;
+}
+
+static DECLCALLBACK(int) tstVDIoFailGetSize(void *pvUser, void *pStorage, uint64_t *pcbSize)
+{
+    return RTFileGetSize(*(PRTFILE)pStorage, pcbSize);
+}
+
+static DECLCALLBACK(int) tstVDIoFailSetSize(void *pvUser, void *pStorage, uint64_t cbSize)
+{
+    return RTFileSetSize(*(PRTFILE)pStorage, cbSize);
+}
+
+static DECLCALLBACK(int) tstVDIoFailWriteSync(void *pvUser, void *pStorage, uint64_t uOffset,
+                                              const void *pvBuffer, size_t cbBuffer, size_t *pcbWritten)
+{
+    return RTFileWriteAt(*(PRTFILE)pStorage, uOffset, pvBuffer, cbBuffer, pcbWritten);
+}
+
+static DECLCALLBACK(int) tstVDIoFailReadSync(void *pvUser, void *pStorage, uint64_t uOffset,
+                                             void *pvBuffer, size_t cbBuffer, size_t *pcbRead)
+{
+    PTSTVDIOFAIL pIoFail = (PTSTVDIOFAIL)pvUser;
+
+    if (   ASMAtomicReadBool(&pIoFail->fFailReads)
+        && uOffset + cbBuffer > pIoFail->offFail)
+    {
+        ASMAtomicIncU32(&pIoFail->cReadsFailed);
+        return VERR_DEV_IO_ERROR;
+    }
+
+    return RTFileReadAt(*(PRTFILE)pStorage, uOffset, pvBuffer, cbBuffer, pcbRead);
+}
+
+static DECLCALLBACK(int) tstVDIoFailFlushSync(void *pvUser, void *pStorage)
+{
+    return RTFileFlush(*(PRTFILE)pStorage);
+}
+
+static DECLCALLBACK(int) tstVDIoFailReadAsync(void *pvUser, void *pStorage, uint64_t uOffset,
+                                              PCRTSGSEG paSegments, size_t cSegments,
+                                              size_t cbRead, void *pvCompletion, void **ppTask)
+{
+    return VERR_NOT_SUPPORTED;
+}
+
+static DECLCALLBACK(int) tstVDIoFailWriteAsync(void *pvUser, void *pStorage, uint64_t uOffset,
+                                               PCRTSGSEG paSegments, size_t cSegments,
+                                               size_t cbWrite, void *pvCompletion, void **ppTask)
+{
+    return VERR_NOT_SUPPORTED;
+}
+
+static DECLCALLBACK(int) tstVDIoFailFlushAsync(void *pvUser, void *pStorage,
+                                               void *pvCompletion, void **ppTask)
+{
+    return VERR_NOT_SUPPORTED;
+}
+
+/** Percentage at which tstVDCopyCancelProgress() cancels the copy. */
+#define TSTVD_COPY_CANCEL_PERCENT   25
+
+static DECLCALLBACK(int) tstVDCopyCancelProgress(void *pvUser, unsigned uPercentage)
+{
+    return uPercentage >= TSTVD_COPY_CANCEL_PERCENT ? VERR_CANCELLED : VINF_SUCCESS;
+}
+
+static int tstVDCompareDisks(PVBOXHDD pVD1, PVBOXHDD pVD2, uint64_t cbDisk,
+                             void *pvBuf1, void *pvBuf2)
+{
+    for (uint64_t uOffset = 0; uOffset < cbDisk; uOffset += _1M)
+    {
+        size_t cbRead = (size_t)RT_MIN(cbDisk - uOffset, _1M);
+
+        int rc = VDRead(pVD1, uOffset, pvBuf1, cbRead);
+        if (RT_SUCCESS(rc))
+            rc = VDRead(pVD2, uOffset, pvBuf2, cbRead);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("ERROR: Failed to read from virtual disk\n");
+            return rc;
+        }
+
+        if (memcmp(pvBuf1, pvBuf2, cbRead))
+        {
+            RTPrintf("ERROR: Disks differ in the 1MB chunk at %Lx\n", uOffset);
+            RTLogPrintf("ERROR: Disks differ in the 1MB chunk at %Lx\n", uOffset);
+            return VERR_INTERNAL_ERROR;
+        }
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Copies a raw image into a new one with VDCopy() which reads and writes
+ * through a ring of buffers on two threads. Checks that the data arrives
+ * intact, that the all zero half of the source is not written to the new
+ * image, and that read errors and cancelling the copy halfway through stop
+ * both threads and leave no destination image behind.
+ */
+static int tstVDCopyPipeline(const char *pszBackend, const char *pszFilename,
+                             const char *pszCopyFilename, uint32_t u32Seed)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    PVBOXHDD pVDCopy = NULL;
+    VDGEOMETRY PCHS = { 0, 0, 0 };
+    VDGEOMETRY LCHS = { 0, 0, 0 };
+    /* Many times the amount of data in flight in the copy pipeline. */
+    uint64_t u64DiskSize = 64 * _1M;
+    uint32_t u32SectorSize = 512;
+    uint64_t cbFile = 0;
+    PVDINTERFACE        pVDIfs = NULL;
+    PVDINTERFACE        pVDIfsImage = NULL;
+    PVDINTERFACE        pVDIfsOperation = NULL;
+    VDINTERFACEERROR    VDIfError;
+    VDINTERFACEIO       VDIfIo;
+    VDINTERFACEPROGRESS VDIfProgress;
+    TSTVDIOFAIL         IoFail;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            if (pvBuf) \
+                RTMemFree(pvBuf); \
+            if (pvBuf2) \
+                RTMemFree(pvBuf2); \
+            if (pVDCopy) \
+                VDDestroy(pVDCopy); \
+            VDDestroy(pVD); \
+            RTFileDelete(pszCopyFilename); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+    void *pvBuf2 = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    /* Create the I/O interface of the source which can fail reads. */
+    IoFail.fFailReads   = false;
+    IoFail.offFail      = u64DiskSize / 2 + u64DiskSize / 8;
+    IoFail.cReadsFailed = 0;
+
+    VDIfIo.pfnOpen                = tstVDIoFailOpen;
+    VDIfIo.pfnClose               = tstVDIoFailClose;
+    VDIfIo.pfnDelete              = tstVDIoFailDelete;
+    VDIfIo.pfnMove                = tstVDIoFailMove;
+    VDIfIo.pfnGetFreeSpace        = tstVDIoFailGetFreeSpace;
+    VDIfIo.pfnGetModificationTime = tstVDIoFailGetModificationTime;
+    VDIfIo.pfnGetSize             = tstVDIoFailGetSize;
+    VDIfIo.pfnSetSize             = tstVDIoFailSetSize;
+    VDIfIo.pfnReadSync            = tstVDIoFailReadSync;
+    VDIfIo.pfnWriteSync           = tstVDIoFailWriteSync;
+    VDIfIo.pfnFlushSync           = tstVDIoFailFlushSync;
+    VDIfIo.pfnReadAsync           = tstVDIoFailReadAsync;
+    VDIfIo.pfnWriteAsync          = tstVDIoFailWriteAsync;
+    VDIfIo.pfnFlushAsync          = tstVDIoFailFlushAsync;
+
+    rc = VDInterfaceAdd(&VDIfIo.Core, "tstVD_IoFail", VDINTERFACETYPE_IO,
+                        &IoFail, sizeof(VDINTERFACEIO), &pVDIfsImage);
+    AssertRC(rc);
+
+    /* Create the progress interface cancelling the copy. */
+    VDIfProgress.pfnProgress = tstVDCopyCancelProgress;
+
+    rc = VDInterfaceAdd(&VDIfProgress.Core, "tstVD_Progress", VDINTERFACETYPE_PROGRESS,
+                        NULL, sizeof(VDINTERFACEPROGRESS), &pVDIfsOperation);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVDCopy);
+    CHECK("VDCreate()");
+
+    RTFileDelete(pszFilename);
+    RTFileDelete(pszCopyFilename);
+
+    rc = VDCreateBase(pVD, "RAW", pszFilename, u64DiskSize,
+                      VD_IMAGE_FLAGS_FIXED, "Test image",
+                      &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      pVDIfsImage, NULL);
+    CHECK("VDCreateBase()");
+
+    /*
+     * Only write to the first half, including some segments of zeros. The
+     * second half stays all zero and must not end up in the copy.
+     */
+    int nSegments = 40;
+    /* Allocate one extra element for a sentinel. */
+    PSEGMENT paSegments  = (PSEGMENT)RTMemAllocZ(sizeof(struct Segment) * (nSegments + 1));
+
+    RNDCTX ctx;
+    initializeRandomGenerator(&ctx, u32Seed);
+    generateRandomSegments(&ctx, paSegments, nSegments, _1M, u64DiskSize / 2, u32SectorSize, 0u, 127u);
+    writeSegmentsToDisk(pVD, pvBuf, paSegments);
+    RTMemFree(paSegments);
+
+    rc = VDCopy(pVD, VD_LAST_IMAGE, pVDCopy, pszBackend, pszCopyFilename, false /* fMoveByRename */,
+                0 /* cbSize */, VD_IMAGE_FLAGS_NONE, NULL /* pDstUuid */, VD_OPEN_FLAGS_NORMAL,
+                NULL, NULL, NULL);
+    CHECK("VDCopy()");
+    rc = tstVDCompareDisks(pVD, pVDCopy, u64DiskSize, pvBuf, pvBuf2);
+    CHECK("tstVDCompareDisks()");
+
+    cbFile = VDGetFileSize(pVDCopy, VD_LAST_IMAGE);
+    RTPrintf("Copy file size %llu of %llu bytes\n", cbFile, u64DiskSize);
+    if (!cbFile || cbFile > u64DiskSize / 2 + _1M)
+    {
+        RTPrintf("ERROR: The zero half of the disk was written to the copy\n");
+        rc = VERR_INTERNAL_ERROR;
+    }
+    CHECK("Zero ranges skipped");
+
+    rc = VDCloseAll(pVDCopy);
+    CHECK("VDCloseAll()");
+    RTFileDelete(pszCopyFilename);
+
+    /* A read error while the copy is in progress must end it. */
+    ASMAtomicWriteBool(&IoFail.fFailReads, true);
+    rc = VDCopy(pVD, VD_LAST_IMAGE, pVDCopy, pszBackend, pszCopyFilename, false /* fMoveByRename */,
+                0 /* cbSize */, VD_IMAGE_FLAGS_NONE, NULL /* pDstUuid */, VD_OPEN_FLAGS_NORMAL,
+                NULL, NULL, NULL);
+    ASMAtomicWriteBool(&IoFail.fFailReads, false);
+    RTPrintf("VDCopy() with read errors rc=%Rrc\n", rc);
+    if (rc != VERR_DEV_IO_ERROR || !IoFail.cReadsFailed)
+    {
+        RTPrintf("ERROR: The read error was not returned (%u failed reads)\n", IoFail.cReadsFailed);
+        rc = VERR_INTERNAL_ERROR;
+    }
+    else if (VDGetCount(pVDCopy) || RTFileExists(pszCopyFilename))
+    {
+        RTPrintf("ERROR: The failed copy left the destination image behind\n");
+        rc = VERR_INTERNAL_ERROR;
+    }
+    else
+        rc = VINF_SUCCESS;
+    CHECK("Read error");
+
+    /* Cancelling stops the reader while it waits for the writer. */
+    rc = VDCopy(pVD, VD_LAST_IMAGE, pVDCopy, pszBackend, pszCopyFilename, false /* fMoveByRename */,
+                0 /* cbSize */, VD_IMAGE_FLAGS_NONE, NULL /* pDstUuid */, VD_OPEN_FLAGS_NORMAL,
+                pVDIfsOperation, NULL, NULL);
+    RTPrintf("VDCopy() cancelled rc=%Rrc\n", rc);
+    if (rc != VERR_CANCELLED)
+    {
+        RTPrintf("ERROR: Cancelling the copy was not returned\n");
+        rc = VERR_INTERNAL_ERROR;
+    }
+    else if (VDGetCount(pVDCopy) || RTFileExists(pszCopyFilename))
+    {
+        RTPrintf("ERROR: The cancelled copy left the destination image behind\n");
+        rc = VERR_INTERNAL_ERROR;
+    }
+    else
+        rc = VINF_SUCCESS;
+    CHECK("Cancel");
+
+    VDDestroy(pVDCopy);
+    VDDestroy(pVD);
+    RTFileDelete(pszFilename);
+    RTFileDelete(pszCopyFilename);
+    RTMemFree(pvBuf);
+    RTMemFree(pvBuf2);
+#undef CHECK
+    return 0;
+}
+
 static int tstVmdkRename(const char *src, const char *dst)
 {
     int rc;
@@ -865,6 +1747,20 @@ int main(int argc, char *argv[])
     RTFileDelete("tmpVDCreate.vhd");
     RTFileDelete("tmpVDBase.vdi");
     RTFileDelete("tmpVDDiff.vdi");
+    RTFileDelete("tmpVDCrash.vdi");
+    RTFileDelete("tmpVDCrashCopy.vdi");
+    RTFileDelete("tmpVDCopy.img");
+    RTFileDelete("tmpVDCopy.vdi");
+    RTFileDelete("tmpVDDedup.vdd");
+    RTFileDelete("tmpVDDedup2.vdd");
+    RTFileDelete("Dedup.vddstore");
+    RTFileDelete("tmpVDCache.vdi");
+    RTFileDelete("tmpVDCache.vci");
+    RTFileDelete("tmpVDCacheCopy.vdi");
+    RTFileDelete("tmpVDCacheCopy.vci");
+    RTFileDelete("tmpVDMetaCache.vmdk");
+    RTFileDelete("tmpVDMetaCache.qcow");
+    RTFileDelete("tmpVDMetaCache.qed");
     RTFileDelete("tmpVDBase.vmdk");
     RTFileDelete("tmpVDDiff.vmdk");
     RTFileDelete("tmpVDBase.vhd");
@@ -991,6 +1887,30 @@ int main(int argc, char *argv[])
         RTPrintf("tstVD: VDI test failed (existing image)! rc=%Rrc\n", rc);
         g_cErrors++;
     }
+    rc = tstVDCrashConsistency("VDI", "tmpVDCrash.vdi", "tmpVDCrashCopy.vdi", false, u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: VDI crash consistency test failed (allocating writes)! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+    rc = tstVDCrashConsistency("VDI", "tmpVDCrash.vdi", "tmpVDCrashCopy.vdi", true, u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: VDI crash consistency test failed (discard)! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+    rc = tstVDCopyPipeline("VDI", "tmpVDCopy.img", "tmpVDCopy.vdi", u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: VDI copy test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+    rc = tstVDCacheWriteBack("tmpVDCache.vdi", "tmpVDCache.vci", "tmpVDCacheCopy.vdi", "tmpVDCacheCopy.vci", u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: VCI write-back cache test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
 #endif /* VDI_TEST */
 #ifdef VMDK_TEST
     rc = tstVDOpenCreateWriteMerge("VMDK", "tmpVDBase.vmdk", "tmpVDDiff.vmdk", u32Seed);
@@ -1005,7 +1925,29 @@ int main(int argc, char *argv[])
         RTPrintf("tstVD: VMDK test failed (existing image)! rc=%Rrc\n", rc);
         g_cErrors++;
     }
+    rc = tstVDMetaCacheEviction("VMDK", "tmpVDMetaCache.vmdk", u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: VMDK metadata cache eviction test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
 #endif /* VMDK_TEST */
+#ifdef QCOW_TEST
+    rc = tstVDMetaCacheEviction("QCOW", "tmpVDMetaCache.qcow", u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: QCOW metadata cache eviction test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+#endif /* QCOW_TEST */
+#ifdef QED_TEST
+    rc = tstVDMetaCacheEviction("QED", "tmpVDMetaCache.qed", u32Seed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: QED metadata cache eviction test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+#endif /* QED_TEST */
 #ifdef VHD_TEST
     rc = tstVDCreateWriteOpenRead("VHD", "tmpVDCreate.vhd", u32Seed);
     if (RT_FAILURE(rc))
@@ -1021,6 +1963,14 @@ int main(int argc, char *argv[])
         g_cErrors++;
     }
 #endif /* VHD_TEST */
+#ifdef DEDUP_TEST
+    rc = tstVDDedupWriteOpenRead("tmpVDDedup.vdd", "tmpVDDedup2.vdd");
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: Dedup test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+#endif /* DEDUP_TEST */
 
     /*
      * Clean up any leftovers.
@@ -1030,6 +1980,20 @@ int main(int argc, char *argv[])
     RTFileDelete("tmpVDCreate.vhd");
     RTFileDelete("tmpVDBase.vdi");
     RTFileDelete("tmpVDDiff.vdi");
+    RTFileDelete("tmpVDCrash.vdi");
+    RTFileDelete("tmpVDCrashCopy.vdi");
+    RTFileDelete("tmpVDCopy.img");
+    RTFileDelete("tmpVDCopy.vdi");
+    RTFileDelete("tmpVDDedup.vdd");
+    RTFileDelete("tmpVDDedup2.vdd");
+    RTFileDelete("Dedup.vddstore");
+    RTFileDelete("tmpVDCache.vdi");
+    RTFileDelete("tmpVDCache.vci");
+    RTFileDelete("tmpVDCacheCopy.vdi");
+    RTFileDelete("tmpVDCacheCopy.vci");
+    RTFileDelete("tmpVDMetaCache.vmdk");
+    RTFileDelete("tmpVDMetaCache.qcow");
+    RTFileDelete("tmpVDMetaCache.qed");
     RTFileDelete("tmpVDBase.vmdk");
     RTFileDelete("tmpVDDiff.vmdk");
     RTFileDelete("tmpVDBase.vhd");
@@ -109,6 +109,16 @@ typedef struct VDDISK
     VDGEOMETRY     LogicalGeom;
     /** Global test data. */
     PVDTESTGLOB    pTestGlob;
+    /** Online compaction thread, NIL_RTTHREAD if not running. */
+    RTTHREAD       hThreadCompact;
+    /** Flag whether the online compaction thread should stop. */
+    volatile bool  fCompactStop;
+    /** Status code of the online compaction thread. */
+    int            rcCompact;
+    /** Number of bytes the online compaction reclaimed. */
+    uint64_t       cbCompactReclaimed;
+    /** Number of online compaction steps deferred because of I/O in flight. */
+    uint64_t       cCompactDeferred;
 } VDDISK, *PVDDISK;
 
 /**
@@ -166,6 +176,9 @@ typedef enum VDIOREQTXDIR
     VDIOREQTXDIR_DISCARD
 } VDIOREQTXDIR;
 
+/** Maximum number of segments an async request is split into. */
+#define VDIOREQ_SEGS_SCATTERED_MAX 16
+
 /**
  * I/O request.
  */
@@ -183,6 +196,8 @@ typedef struct VDIOREQ
     RTSGBUF       SgBuf;
     /** Data segment */
     RTSGSEG       DataSeg;
+    /** The data segment split into pieces in reverse order, for async requests. */
+    RTSGSEG       aSegsScattered[VDIOREQ_SEGS_SCATTERED_MAX];
     /** Flag whether the request is outstanding or not. */
     volatile bool fOutstanding;
     /** Buffer to use for reads. */
@@ -208,10 +223,15 @@ typedef struct VDIOTEST
     uint64_t    cbIo;
     /** Chance in percent to get a write. */
     unsigned    uWriteChance;
+    /** Chance in percent to get a flush between the reads and writes. */
+    unsigned    uFlushChance;
     /** Pointer to the I/O data generator. */
     PVDIORND    pIoRnd;
     /** Pointer to the data pattern to use. */
     PVDPATTERN  pPattern;
+    /** Flag whether to describe the request buffers by several segments which are
+     * not contiguous in memory, like guest pages mapped by a device. */
+    bool        fScatter;
     /** Data dependent on the I/O mode (sequential or random). */
     union
     {
@@ -233,6 +253,7 @@ typedef struct VDIOTEST
 static DECLCALLBACK(int) vdScriptHandlerCreate(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerOpen(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerIoFlush(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerFlush(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerMerge(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCompact(PVDSCRIPTARG paScriptArgs, void *pvUser);
@@ -256,6 +277,8 @@ static DECLCALLBACK(int) vdScriptHandlerShowStatistics(PVDSCRIPTARG paScriptArgs
 static DECLCALLBACK(int) vdScriptHandlerResetStatistics(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerResize(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerSetFileBackend(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCompactOnlineStart(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCompactOnlineStop(PVDSCRIPTARG paScriptArgs, void *pvUser);
 
 #ifdef VBOX_TSTVDIO_WITH_LOG_REPLAY
 static DECLCALLBACK(int) vdScriptHandlerIoLogReplay(PVDSCRIPTARG paScriptArgs, void *pvUser);
@@ -303,6 +326,22 @@ const VDSCRIPTTYPE g_aArgIo[] =
     VDSCRIPTTYPE_STRING  /* pattern */
 };
 
+/* I/O action with flushes mixed in */
+const VDSCRIPTTYPE g_aArgIoFlush[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_BOOL,   /* async */
+    VDSCRIPTTYPE_UINT32, /* max-reqs */
+    VDSCRIPTTYPE_STRING, /* mode */
+    VDSCRIPTTYPE_UINT64, /* size */
+    VDSCRIPTTYPE_UINT64, /* blocksize */
+    VDSCRIPTTYPE_UINT64, /* offStart */
+    VDSCRIPTTYPE_UINT64, /* offEnd */
+    VDSCRIPTTYPE_UINT32, /* writes */
+    VDSCRIPTTYPE_STRING, /* pattern */
+    VDSCRIPTTYPE_UINT32  /* flushes */
+};
+
 /* flush action */
 const VDSCRIPTTYPE g_aArgFlush[] =
 {
@@ -470,12 +509,27 @@ const VDSCRIPTTYPE g_aArgSetFileBackend[] =
     VDSCRIPTTYPE_STRING /* new file backend */
 };
 
+/* Start online compaction. */
+const VDSCRIPTTYPE g_aArgCompactOnlineStart[] =
+{
+    VDSCRIPTTYPE_STRING  /* disk */
+};
+
+/* Stop online compaction. */
+const VDSCRIPTTYPE g_aArgCompactOnlineStop[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_BOOL,   /* reclaimed */
+    VDSCRIPTTYPE_BOOL    /* supported */
+};
+
 const VDSCRIPTCALLBACK g_aScriptActions[] =
 {
     /* pcszFnName                  enmTypeReturn      paArgDesc                          cArgDescs                                      pfnHandler */
     {"create",                     VDSCRIPTTYPE_VOID, g_aArgCreate,                      RT_ELEMENTS(g_aArgCreate),                     vdScriptHandlerCreate},
     {"open",                       VDSCRIPTTYPE_VOID, g_aArgOpen,                        RT_ELEMENTS(g_aArgOpen),                       vdScriptHandlerOpen},
     {"io",                         VDSCRIPTTYPE_VOID, g_aArgIo,                          RT_ELEMENTS(g_aArgIo),                         vdScriptHandlerIo},
+    {"ioflush",                    VDSCRIPTTYPE_VOID, g_aArgIoFlush,                     RT_ELEMENTS(g_aArgIoFlush),                    vdScriptHandlerIoFlush},
     {"flush",                      VDSCRIPTTYPE_VOID, g_aArgFlush,                       RT_ELEMENTS(g_aArgFlush),                      vdScriptHandlerFlush},
     {"close",                      VDSCRIPTTYPE_VOID, g_aArgClose,                       RT_ELEMENTS(g_aArgClose),                      vdScriptHandlerClose},
     {"printfilesize",              VDSCRIPTTYPE_VOID, g_aArgPrintFileSize,               RT_ELEMENTS(g_aArgPrintFileSize),              vdScriptHandlerPrintFileSize},
@@ -502,6 +556,8 @@ const VDSCRIPTCALLBACK g_aScriptActions[] =
     {"resetstatistics",            VDSCRIPTTYPE_VOID, g_aArgResetStatistics,             RT_ELEMENTS(g_aArgResetStatistics),            vdScriptHandlerResetStatistics},
     {"resize",                     VDSCRIPTTYPE_VOID, g_aArgResize,                      RT_ELEMENTS(g_aArgResize),                     vdScriptHandlerResize},
     {"setfilebackend",             VDSCRIPTTYPE_VOID, g_aArgSetFileBackend,              RT_ELEMENTS(g_aArgSetFileBackend),             vdScriptHandlerSetFileBackend},
+    {"compactonlinestart",         VDSCRIPTTYPE_VOID, g_aArgCompactOnlineStart,          RT_ELEMENTS(g_aArgCompactOnlineStart),         vdScriptHandlerCompactOnlineStart},
+    {"compactonlinestop",          VDSCRIPTTYPE_VOID, g_aArgCompactOnlineStop,           RT_ELEMENTS(g_aArgCompactOnlineStop),          vdScriptHandlerCompactOnlineStop},
 };
 
 const unsigned g_cScriptActions = RT_ELEMENTS(g_aScriptActions);
@@ -529,7 +585,7 @@ static int tstVDMessage(void *pvUser, const char *pszFormat, va_list va)
 
 static int tstVDIoTestInit(PVDIOTEST pIoTest, PVDTESTGLOB pGlob, bool fRandomAcc, uint64_t cbIo,
                            size_t cbBlkSize, uint64_t offStart, uint64_t offEnd,
-                           unsigned uWriteChance, PVDPATTERN pPattern);
+                           unsigned uWriteChance, unsigned uFlushChance, PVDPATTERN pPattern);
 static bool tstVDIoTestRunning(PVDIOTEST pIoTest);
 static void tstVDIoTestDestroy(PVDIOTEST pIoTest);
 static bool tstVDIoTestReqOutstanding(PVDIOREQ pIoReq);
@@ -667,7 +723,15 @@ static DECLCALLBACK(int) vdScriptHandlerOpen(PVDSCRIPTARG paScriptArgs, void *pv
     return rc;
 }
 
-static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUser)
+/**
+ * Runs an I/O test described by the script arguments of the io and ioflush actions.
+ *
+ * @returns VBox status code.
+ * @param   paScriptArgs    The script arguments, the first ten are the same for both actions.
+ * @param   pvUser          The global test state.
+ * @param   uFlushChance    Chance in percent to issue a flush instead of a read or write.
+ */
+static int tstVDIoRun(PVDSCRIPTARG paScriptArgs, void *pvUser, unsigned uFlushChance)
 {
     int rc = VINF_SUCCESS;
     PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
@@ -744,7 +808,9 @@ static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUs
         VDIOTEST IoTest;
 
         RTTestSub(pGlob->hTest, "Basic I/O");
-        rc = tstVDIoTestInit(&IoTest, pGlob, fRandomAcc, cbIo, cbBlkSize, offStart, offEnd, uWriteChance, pPattern);
+        rc = tstVDIoTestInit(&IoTest, pGlob, fRandomAcc, cbIo, cbBlkSize, offStart, offEnd, uWriteChance,
+                             uFlushChance, pPattern);
+        IoTest.fScatter = fAsync;
         if (RT_SUCCESS(rc))
         {
             PVDIOREQ paIoReq = NULL;
@@ -976,6 +1042,16 @@ static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUs
     return rc;
 }
 
+static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    return tstVDIoRun(paScriptArgs, pvUser, 0 /* uFlushChance */);
+}
+
+static DECLCALLBACK(int) vdScriptHandlerIoFlush(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    return tstVDIoRun(paScriptArgs, pvUser, (unsigned)paScriptArgs[10].u64);
+}
+
 static DECLCALLBACK(int) vdScriptHandlerFlush(PVDSCRIPTARG paScriptArgs, void *pvUser)
 {
     int rc = VINF_SUCCESS;
@@ -1786,6 +1862,7 @@ static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDSCRIPTARG paScriptArgs, vo
         if (pDisk)
         {
             pDisk->pTestGlob = pGlob;
+            pDisk->hThreadCompact = NIL_RTTHREAD;
             pDisk->pszName = RTStrDup(pcszDisk);
             if (pDisk->pszName)
             {
@@ -1843,6 +1920,12 @@ static DECLCALLBACK(int) vdScriptHandlerDestroyDisk(PVDSCRIPTARG paScriptArgs, v
     pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
     if (pDisk)
     {
+        if (pDisk->hThreadCompact != NIL_RTTHREAD)
+        {
+            ASMAtomicWriteBool(&pDisk->fCompactStop, true);
+            RTThreadWait(pDisk->hThreadCompact, RT_INDEFINITE_WAIT, NULL);
+        }
+
         RTListNodeRemove(&pDisk->ListNode);
         VDDestroy(pDisk->pVD);
         if (pDisk->pMemDiskVerify)
@@ -2061,6 +2144,120 @@ static DECLCALLBACK(int) vdScriptHandlerSetFileBackend(PVDSCRIPTARG paScriptArgs
     return rc;
 }
 
+/**
+ * Online compaction thread, walks over the disk in steps like DrvVD does
+ * until it is told to stop.
+ */
+static DECLCALLBACK(int) tstVDIoCompactOnlineThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVDDISK pDisk = (PVDDISK)pvUser;
+    uint64_t cbDisk = VDGetSize(pDisk->pVD, VD_LAST_IMAGE);
+    uint64_t offCur = 0;
+    int rc = VINF_SUCCESS;
+
+    while (!ASMAtomicReadBool(&pDisk->fCompactStop))
+    {
+        size_t cbThis = (size_t)RT_MIN(cbDisk - offCur, VD_COMPACT_ONLINE_RANGE_MAX);
+        uint64_t cbReclaimed = 0;
+
+        rc = VDCompactOnline(pDisk->pVD, offCur, cbThis, &cbReclaimed);
+        if (rc == VERR_TRY_AGAIN)
+        {
+            /* Guest I/O in flight, back off. */
+            pDisk->cCompactDeferred++;
+            RTThreadYield();
+            continue;
+        }
+        if (RT_FAILURE(rc))
+            break;
+
+        pDisk->cbCompactReclaimed += cbReclaimed;
+        offCur += cbThis;
+        if (offCur == cbDisk)
+            offCur = 0;
+    }
+
+    if (RT_SUCCESS(rc) || rc == VERR_TRY_AGAIN)
+        rc = VINF_SUCCESS;
+    pDisk->rcCompact = rc;
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerCompactOnlineStart(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = paScriptArgs[0].psz;
+    PVDDISK pDisk = NULL;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (!pDisk)
+        rc = VERR_NOT_FOUND;
+    else if (pDisk->hThreadCompact != NIL_RTTHREAD)
+        rc = VERR_INVALID_STATE;
+    else
+    {
+        pDisk->fCompactStop       = false;
+        pDisk->rcCompact          = VINF_SUCCESS;
+        pDisk->cbCompactReclaimed = 0;
+        pDisk->cCompactDeferred   = 0;
+        rc = RTThreadCreate(&pDisk->hThreadCompact, tstVDIoCompactOnlineThread, pDisk, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "Compact");
+        if (RT_FAILURE(rc))
+            pDisk->hThreadCompact = NIL_RTTHREAD;
+    }
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerCompactOnlineStop(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = paScriptArgs[0].psz;
+    bool fReclaimed = paScriptArgs[1].f;
+    bool fSupported = paScriptArgs[2].f;
+    PVDDISK pDisk = NULL;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (!pDisk)
+        rc = VERR_NOT_FOUND;
+    else if (pDisk->hThreadCompact == NIL_RTTHREAD)
+        rc = VERR_INVALID_STATE;
+    else
+    {
+        ASMAtomicWriteBool(&pDisk->fCompactStop, true);
+        rc = RTThreadWait(pDisk->hThreadCompact, RT_INDEFINITE_WAIT, NULL);
+        AssertRC(rc);
+        pDisk->hThreadCompact = NIL_RTTHREAD;
+
+        RTPrintf("Online compaction %s: reclaimed=%llu deferred=%llu rc=%Rrc\n",
+                 pcszDisk, pDisk->cbCompactReclaimed, pDisk->cCompactDeferred, pDisk->rcCompact);
+
+        rc = pDisk->rcCompact;
+        if (!fSupported)
+        {
+            if (rc == VERR_NOT_SUPPORTED)
+                rc = VINF_SUCCESS;
+            else
+            {
+                RTTestFailed(pGlob->hTest, "Online compaction of %s should not be supported but returned %Rrc\n",
+                             pcszDisk, rc);
+                rc = VERR_INVALID_STATE;
+            }
+        }
+        else if (   RT_SUCCESS(rc)
+                 && fReclaimed
+                 && !pDisk->cbCompactReclaimed)
+        {
+            RTTestFailed(pGlob->hTest, "Online compaction of %s didn't reclaim any space\n", pcszDisk);
+            rc = VERR_INVALID_STATE;
+        }
+    }
+
+    return rc;
+}
+
 static DECLCALLBACK(int) tstVDIoFileOpen(void *pvUser, const char *pszLocation,
                                          uint32_t fOpen,
                                          PFNVDCOMPLETED pfnCompleted,
@@ -2381,7 +2578,7 @@ static DECLCALLBACK(int) tstVDIoFileFlushAsync(void *pvUser, void *pStorage, voi
 
 static int tstVDIoTestInit(PVDIOTEST pIoTest, PVDTESTGLOB pGlob, bool fRandomAcc, uint64_t cbIo,
                            size_t cbBlkSize, uint64_t offStart, uint64_t offEnd,
-                           unsigned uWriteChance, PVDPATTERN pPattern)
+                           unsigned uWriteChance, unsigned uFlushChance, PVDPATTERN pPattern)
 {
     int rc = VINF_SUCCESS;
 
@@ -2392,6 +2589,7 @@ static int tstVDIoTestInit(PVDIOTEST pIoTest, PVDTESTGLOB pGlob, bool fRandomAcc
     pIoTest->offStart      = offStart;
     pIoTest->offEnd        = offEnd;
     pIoTest->uWriteChance  = uWriteChance;
+    pIoTest->uFlushChance  = uFlushChance;
     pIoTest->pIoRnd        = pGlob->pIoRnd;
     pIoTest->pPattern      = pPattern;
 
@@ -2445,11 +2643,53 @@ static bool tstVDIoTestIsTrue(PVDIOTEST pIoTest, int iPercentage)
     return (uRnd < iPercentage); /* This should be enough for our purpose */
 }
 
+/**
+ * Describes the data buffer of the request by several segments in reverse
+ * order, so no segment follows its predecessor in memory.
+ *
+ * @returns nothing.
+ * @param   pIoReq        The request with the data segment set up.
+ */
+static void tstVDIoTestReqScatter(PVDIOREQ pIoReq)
+{
+    size_t cSegs = RT_MIN(VDIOREQ_SEGS_SCATTERED_MAX, pIoReq->cbReq / 512);
+    size_t cbSeg = RT_ALIGN_Z((pIoReq->cbReq + cSegs - 1) / cSegs, 512);
+    uint8_t *pbBuf = (uint8_t *)pIoReq->DataSeg.pvSeg;
+    size_t offBuf = pIoReq->cbReq;
+    size_t i = 0;
+
+    while (offBuf)
+    {
+        size_t cbThisSeg = offBuf % cbSeg ? offBuf % cbSeg : cbSeg;
+
+        offBuf -= cbThisSeg;
+        pIoReq->aSegsScattered[i].pvSeg = pbBuf + offBuf;
+        pIoReq->aSegsScattered[i].cbSeg = cbThisSeg;
+        i++;
+    }
+
+    RTSgBufInit(&pIoReq->SgBuf, &pIoReq->aSegsScattered[0], i);
+}
+
 static int tstVDIoTestReqInit(PVDIOTEST pIoTest, PVDIOREQ pIoReq, void *pvUser)
 {
     int rc = VINF_SUCCESS;
 
-    if (pIoTest->cbIo)
+    if (   pIoTest->cbIo
+        && pIoTest->uFlushChance
+        && tstVDIoTestIsTrue(pIoTest, pIoTest->uFlushChance))
+    {
+        /* Flushes don't transfer data and don't count against the I/O size. */
+        pIoReq->enmTxDir      = VDIOREQTXDIR_FLUSH;
+        pIoReq->off           = 0;
+        pIoReq->cbReq         = 0;
+        pIoReq->DataSeg.pvSeg = NULL;
+        pIoReq->DataSeg.cbSeg = 0;
+        RTSgBufInit(&pIoReq->SgBuf, &pIoReq->DataSeg, 1);
+        pIoReq->pvUser        = pvUser;
+        pIoReq->fOutstanding  = true;
+    }
+    else if (pIoTest->cbIo)
     {
         /* Read or Write? */
         pIoReq->enmTxDir = tstVDIoTestIsTrue(pIoTest, pIoTest->uWriteChance) ? VDIOREQTXDIR_WRITE : VDIOREQTXDIR_READ;
@@ -2473,7 +2713,11 @@ static int tstVDIoTestReqInit(PVDIOTEST pIoTest, PVDIOREQ pIoReq, void *pvUser)
 
         if (RT_SUCCESS(rc))
         {
-            RTSgBufInit(&pIoReq->SgBuf, &pIoReq->DataSeg, 1);
+            if (   pIoTest->fScatter
+                && pIoReq->cbReq >= 2 * 512)
+                tstVDIoTestReqScatter(pIoReq);
+            else
+                RTSgBufInit(&pIoReq->SgBuf, &pIoReq->DataSeg, 1);
 
             if (pIoTest->fRandomAccess)
             {
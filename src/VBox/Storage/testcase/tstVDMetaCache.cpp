@@ -0,0 +1,279 @@
+/* $Id: tstVDMetaCache.cpp $ */
+/** @file
+ * VD testcase - Metadata table cache.
+ */
+
+/*
+ * Copyright (C) 2014 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/err.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+#include "../VDMetaCache.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** Size of one table used for the tests. */
+#define TST_CB_ENTRY    _4K
+/** Number of entries fitting into the cache. */
+#define TST_C_ENTRIES   4
+
+
+/**
+ * Allocates an entry, inserts it under the given key and drops the reference
+ * like a backend does after it is done with the table.
+ *
+ * @returns The entry or NULL if the allocation failed.
+ * @param   pCache    The cache instance.
+ * @param   uKey      The key to insert the entry with.
+ * @param   fPrefetch Flag whether to allocate the entry for a prefetch.
+ */
+static PVDMETACACHEENTRY tstVDMetaCacheAdd(PVDMETACACHE pCache, uint64_t uKey, bool fPrefetch)
+{
+    PVDMETACACHEENTRY pEntry = vdMetaCacheEntryAlloc(pCache, fPrefetch);
+    if (pEntry)
+    {
+        *(uint64_t *)pEntry->pvData = uKey;
+        vdMetaCacheEntryInsert(pCache, pEntry, uKey);
+        vdMetaCacheEntryRelease(pEntry);
+    }
+
+    return pEntry;
+}
+
+/**
+ * Checks that exactly the given keys are in the cache.
+ *
+ * @returns nothing.
+ * @param   hTest     The test handle.
+ * @param   pCache    The cache instance.
+ * @param   fBitmap   Bitmap of the keys 0..63 which must be cached.
+ */
+static void tstVDMetaCacheCheckKeys(RTTEST hTest, PVDMETACACHE pCache, uint64_t fBitmap)
+{
+    for (uint64_t uKey = 0; uKey < 64; uKey++)
+    {
+        bool fCached = vdMetaCacheIsCached(pCache, uKey);
+        if (fCached != !!(fBitmap & RT_BIT_64(uKey)))
+            RTTestFailed(hTest, "Key %llu is %s but should%s be", uKey,
+                         fCached ? "cached" : "not cached", fCached ? " not" : "");
+    }
+}
+
+static void tstVDMetaCacheEviction(RTTEST hTest)
+{
+    RTTestSub(hTest, "Eviction");
+
+    PVDMETACACHE pCache = NULL;
+    RTTESTI_CHECK_RC_RETV(vdMetaCacheCreate(&pCache, TST_CB_ENTRY, TST_C_ENTRIES * TST_CB_ENTRY), VINF_SUCCESS);
+
+    for (uint64_t uKey = 0; uKey < TST_C_ENTRIES; uKey++)
+        RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, uKey, false) != NULL);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(0) | RT_BIT_64(1) | RT_BIT_64(2) | RT_BIT_64(3));
+
+    /* The cache is full, the oldest entry must go. */
+    RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, 4, false) != NULL);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(1) | RT_BIT_64(2) | RT_BIT_64(3) | RT_BIT_64(4));
+
+    /* Touch 1 and 2, 3 is the least recently used one now. */
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pCache, 1);
+    RTTESTI_CHECK_RETV(pEntry != NULL);
+    RTTESTI_CHECK(*(uint64_t *)pEntry->pvData == 1);
+    vdMetaCacheEntryRelease(pEntry);
+    pEntry = vdMetaCacheRetain(pCache, 2);
+    RTTESTI_CHECK_RETV(pEntry != NULL);
+    vdMetaCacheEntryRelease(pEntry);
+
+    RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, 5, false) != NULL);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(1) | RT_BIT_64(2) | RT_BIT_64(4) | RT_BIT_64(5));
+
+    /* The memory budget must not be exceeded. */
+    VDMETACACHESTATS Stats;
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK(Stats.cEvictions == 2);
+    RTTESTI_CHECK(Stats.cbUsed == TST_C_ENTRIES * TST_CB_ENTRY);
+    RTTESTI_CHECK(Stats.cbMax == TST_C_ENTRIES * TST_CB_ENTRY);
+
+    vdMetaCacheDestroy(pCache);
+}
+
+static void tstVDMetaCacheInUse(RTTEST hTest)
+{
+    RTTestSub(hTest, "Entries in use");
+
+    PVDMETACACHE pCache = NULL;
+    RTTESTI_CHECK_RC_RETV(vdMetaCacheCreate(&pCache, TST_CB_ENTRY, TST_C_ENTRIES * TST_CB_ENTRY), VINF_SUCCESS);
+
+    PVDMETACACHEENTRY apEntries[TST_C_ENTRIES];
+    for (unsigned i = 0; i < TST_C_ENTRIES; i++)
+    {
+        apEntries[i] = vdMetaCacheEntryAlloc(pCache, false /* fPrefetch */);
+        RTTESTI_CHECK_RETV(apEntries[i] != NULL);
+        vdMetaCacheEntryInsert(pCache, apEntries[i], i);
+    }
+
+    /* Everything is referenced, the allocation must fail instead of evicting a table in use. */
+    RTTESTI_CHECK(vdMetaCacheEntryAlloc(pCache, false /* fPrefetch */) == NULL);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(0) | RT_BIT_64(1) | RT_BIT_64(2) | RT_BIT_64(3));
+
+    /* Dropping a single reference makes exactly this entry the victim. */
+    vdMetaCacheEntryRelease(apEntries[2]);
+    PVDMETACACHEENTRY pEntry = vdMetaCacheEntryAlloc(pCache, false /* fPrefetch */);
+    RTTESTI_CHECK_RETV(pEntry == apEntries[2]);
+    RTTESTI_CHECK(!pEntry->fCached);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(0) | RT_BIT_64(1) | RT_BIT_64(3));
+
+    /* A failed table read frees the entry which must return the memory to the budget. */
+    vdMetaCacheEntryRelease(pEntry);
+    vdMetaCacheEntryFree(pCache, pEntry);
+
+    VDMETACACHESTATS Stats;
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK(Stats.cEvictions == 1);
+    RTTESTI_CHECK(Stats.cbUsed == (TST_C_ENTRIES - 1) * TST_CB_ENTRY);
+
+    for (unsigned i = 0; i < TST_C_ENTRIES; i++)
+        if (i != 2)
+            vdMetaCacheEntryRelease(apEntries[i]);
+
+    vdMetaCacheDestroy(pCache);
+}
+
+static void tstVDMetaCachePrefetch(RTTEST hTest)
+{
+    RTTestSub(hTest, "Prefetch");
+
+    PVDMETACACHE pCache = NULL;
+    RTTESTI_CHECK_RC_RETV(vdMetaCacheCreate(&pCache, TST_CB_ENTRY, TST_C_ENTRIES * TST_CB_ENTRY), VINF_SUCCESS);
+
+    for (uint64_t uKey = 0; uKey < TST_C_ENTRIES - 1; uKey++)
+        RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, uKey, false) != NULL);
+
+    /* There is room left for a prefetch. */
+    RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, 10, true) != NULL);
+
+    /* The cache is full now, prefetches must not evict anything. */
+    RTTESTI_CHECK(vdMetaCacheEntryAlloc(pCache, true /* fPrefetch */) == NULL);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(0) | RT_BIT_64(1) | RT_BIT_64(2) | RT_BIT_64(10));
+
+    /* The unused prefetched table is evicted before the tables which were used. */
+    RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, 4, false) != NULL);
+    tstVDMetaCacheCheckKeys(hTest, pCache, RT_BIT_64(0) | RT_BIT_64(1) | RT_BIT_64(2) | RT_BIT_64(4));
+
+    VDMETACACHESTATS Stats;
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK(Stats.cPrefetches == 1);
+    RTTESTI_CHECK(Stats.cEvictions == 1);
+
+    vdMetaCacheDestroy(pCache);
+}
+
+static void tstVDMetaCacheStats(RTTEST hTest)
+{
+    RTTestSub(hTest, "Statistics");
+
+    PVDMETACACHE pCache = NULL;
+    RTTESTI_CHECK_RC_RETV(vdMetaCacheCreate(&pCache, TST_CB_ENTRY, 0), VINF_SUCCESS);
+
+    /* A single entry is always allowed. */
+    RTTESTI_CHECK(tstVDMetaCacheAdd(pCache, 1, false) != NULL);
+
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pCache, 1);
+    RTTESTI_CHECK(pEntry != NULL);
+    if (pEntry)
+        vdMetaCacheEntryRelease(pEntry);
+    RTTESTI_CHECK(vdMetaCacheRetain(pCache, 2) == NULL);
+
+    /* Checking for a table doesn't count as a lookup. */
+    RTTESTI_CHECK(vdMetaCacheIsCached(pCache, 1));
+    RTTESTI_CHECK(!vdMetaCacheIsCached(pCache, 2));
+
+    VDMETACACHESTATS Stats;
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK(Stats.cHits == 1);
+    RTTESTI_CHECK(Stats.cMisses == 1);
+    RTTESTI_CHECK(Stats.cbUsed == TST_CB_ENTRY);
+    RTTESTI_CHECK(Stats.cbMax == TST_CB_ENTRY);
+
+    vdMetaCacheDestroy(pCache);
+}
+
+static DECLCALLBACK(int) tstVDMetaCacheCfgQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    if (   pvUser
+        && !strcmp(pszName, VD_METACACHE_CFG_SIZE))
+        return RTStrCopy(pszValue, cchValue, (const char *)pvUser);
+
+    return VERR_CFGM_VALUE_NOT_FOUND;
+}
+
+/**
+ * Queries the cache size with the given configuration value.
+ *
+ * @returns The cache size.
+ * @param   pszValue  The configured value, NULL if nothing is configured.
+ */
+static size_t tstVDMetaCacheQuerySizeWith(const char *pszValue)
+{
+    VDINTERFACECONFIG VDIfConfig;
+    PVDINTERFACE      pVDIfs = NULL;
+
+    VDIfConfig.pfnAreKeysValid = NULL;
+    VDIfConfig.pfnQuerySize    = NULL;
+    VDIfConfig.pfnQuery        = tstVDMetaCacheCfgQuery;
+    VDIfConfig.pfnQueryBytes   = NULL;
+
+    int rc = VDInterfaceAdd(&VDIfConfig.Core, "tstVDMetaCache_Config", VDINTERFACETYPE_CONFIG,
+                            (void *)pszValue, sizeof(VDINTERFACECONFIG), &pVDIfs);
+    RTTESTI_CHECK_RC_OK(rc);
+
+    return vdMetaCacheQuerySize(pVDIfs, _1M);
+}
+
+static void tstVDMetaCacheQuerySize(RTTEST hTest)
+{
+    RTTestSub(hTest, "Configuration");
+
+    RTTESTI_CHECK(vdMetaCacheQuerySize(NULL, _1M) == _1M);
+    RTTESTI_CHECK(tstVDMetaCacheQuerySizeWith(NULL) == _1M);
+    RTTESTI_CHECK(tstVDMetaCacheQuerySizeWith("262144") == VD_METACACHE_SIZE_MIN);
+    RTTESTI_CHECK(tstVDMetaCacheQuerySizeWith("8388608") == 8 * _1M);
+    RTTESTI_CHECK(tstVDMetaCacheQuerySizeWith("4096") == _1M);
+    RTTESTI_CHECK(tstVDMetaCacheQuerySizeWith("0x100000000") == _1M);
+    RTTESTI_CHECK(tstVDMetaCacheQuerySizeWith("garbage") == _1M);
+}
+
+int main()
+{
+    RTTEST hTest;
+    int rc = RTTestInitAndCreate("tstVDMetaCache", &hTest);
+    if (rc)
+        return rc;
+    RTTestBanner(hTest);
+
+    tstVDMetaCacheEviction(hTest);
+    tstVDMetaCacheInUse(hTest);
+    tstVDMetaCachePrefetch(hTest);
+    tstVDMetaCacheStats(hTest);
+    tstVDMetaCacheQuerySize(hTest);
+
+    /*
+     * Summary.
+     */
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -669,6 +669,7 @@ int pgmPhysAllocPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
     PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ALLOCATED);
     PGM_PAGE_SET_PDE_TYPE(pVM, pPage, PGM_PAGE_PDE_TYPE_PT);
     pgmPhysInvalidatePageMapTLBEntry(pVM, GCPhys);
+    pgmPhysDirtyLogMark(pVM, GCPhys, 1);
 
     /* Copy the shared page contents to the replacement page. */
     if (pvSharedPage)
@@ -770,6 +771,7 @@ int pgmPhysAllocLargePage(PVM pVM, RTGCPHYS GCPhys)
             {
                 Assert(PGM_PAGE_GET_STATE(pFirstPage) == PGM_PAGE_STATE_ALLOCATED);
                 pVM->pgm.s.cLargePages++;
+                pgmPhysDirtyLogMark(pVM, GCPhysBase, _2M / PAGE_SIZE);
                 return VINF_SUCCESS;
             }
 
@@ -854,10 +856,11 @@ int pgmPhysRecheckLargePage(PVM pVM, RTGCPHYS GCPhys, PPGMPAGE pLargePage)
  *
  * @param   pVM         Pointer to the VM.
  * @param   pPage       The physical page tracking structure.
+ * @param   GCPhys      The address of the page.
  *
  * @remarks Called from within the PGM critical section.
  */
-void pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage)
+void pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
 {
     Assert(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_WRITE_MONITORED);
     PGM_PAGE_SET_WRITTEN_TO(pVM, pPage);
@@ -865,6 +868,7 @@ void pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage)
     Assert(pVM->pgm.s.cMonitoredPages > 0);
     pVM->pgm.s.cMonitoredPages--;
     pVM->pgm.s.cWrittenToPages++;
+    pgmPhysDirtyLogMark(pVM, GCPhys, 1);
 }
 
 
@@ -888,7 +892,7 @@ int pgmPhysPageMakeWritable(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
     switch (PGM_PAGE_GET_STATE(pPage))
     {
         case PGM_PAGE_STATE_WRITE_MONITORED:
-            pgmPhysPageMakeWriteMonitoredWritable(pVM, pPage);
+            pgmPhysPageMakeWriteMonitoredWritable(pVM, pPage, GCPhys);
             /* fall thru */
         default: /* to shut up GCC */
         case PGM_PAGE_STATE_ALLOCATED:
@@ -440,6 +440,9 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
             pAioMgrNew->enmMgrType = pEpClass->enmMgrTypeOverride;
 
         pAioMgrNew->msBwLimitExpired = RT_INDEFINITE_WAIT;
+        /* Cleared by pdmacFileAioMgrNormalInit() if the context can't provide it. */
+        pAioMgrNew->fBufferedAsync   =    pEpClass->fBufferedAsync
+                                       && pAioMgrNew->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE;
 
         rc = RTSemEventCreate(&pAioMgrNew->EventSem);
         if (RT_SUCCESS(rc))
@@ -826,6 +829,7 @@ static int pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGlobals, PCFGMNO
     {
         pEpClassFile->uBitmaskAlignment   = AioLimits.cbBufferAlignment ? ~((RTR3UINTPTR)AioLimits.cbBufferAlignment - 1) : RTR3UINTPTR_MAX;
         pEpClassFile->cReqsOutstandingMax = AioLimits.cReqsOutstandingMax;
+        pEpClassFile->fBufferedAsync      = RT_BOOL(AioLimits.fFlags & RTFILEAIOLIMITS_F_BUFFERED_ASYNC);
 
         if (pCfgNode)
         {
@@ -853,8 +857,10 @@ static int pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGlobals, PCFGMNO
             LogRel(("AIOMgr: Default file backend is \"%s\"\n", pdmacFileBackendTypeToName(pEpClassFile->enmEpBackendDefault)));
 
 #ifdef RT_OS_LINUX
+            /* Only io_uring handles buffered I/O asynchronously, the io_* interface blocks. */
             if (   pEpClassFile->enmMgrTypeOverride == PDMACEPFILEMGRTYPE_ASYNC
-                && pEpClassFile->enmEpBackendDefault == PDMACFILEEPBACKEND_BUFFERED)
+                && pEpClassFile->enmEpBackendDefault == PDMACFILEEPBACKEND_BUFFERED
+                && !pEpClassFile->fBufferedAsync)
             {
                 LogRel(("AIOMgr: Linux does not support buffered async I/O, changing to non buffered\n"));
                 pEpClassFile->enmEpBackendDefault = PDMACFILEEPBACKEND_NON_BUFFERED;
@@ -923,7 +929,9 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
      */
     if (fFlags & PDMACEP_FILE_FLAGS_HOST_CACHE_ENABLED)
     {
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        /* Keep the async manager if the host doesn't block on buffered I/O. */
+        if (!pEpClassFile->fBufferedAsync)
+            enmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
         enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
     }
 
@@ -944,7 +952,12 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
             fFileFlags |= RTFILE_O_DENY_WRITE;
     }
 
-    if (enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
+    if (   enmMgrType == PDMACEPFILEMGRTYPE_ASYNC
+#ifdef RT_OS_LINUX
+        /* RTFILE_O_ASYNC_IO implies O_DIRECT on Linux which would bypass the host cache. */
+        && enmEpBackend != PDMACFILEEPBACKEND_BUFFERED
+#endif
+       )
         fFileFlags |= RTFILE_O_ASYNC_IO;
 
     int rc;
@@ -975,7 +988,8 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
 
 #ifdef RT_OS_LINUX
                 fFileFlags &= ~RTFILE_O_ASYNC_IO;
-                enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                if (!pEpClassFile->fBufferedAsync)
+                    enmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
 #endif
             }
             RTFileClose(hFile);
@@ -1005,7 +1019,8 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
 
 #ifdef RT_OS_LINUX
         fFileFlags &= ~RTFILE_O_ASYNC_IO;
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        if (!pEpClassFile->fBufferedAsync)
+            enmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
 #endif
 
         /* Open again. */
@@ -1054,12 +1069,15 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
                 }
                 else
                 {
+                    bool fNeedBufferedAsync = enmEpBackend == PDMACFILEEPBACKEND_BUFFERED;
+
                     pAioMgr = pEpClassFile->pAioMgrHead;
 
                     /* Check for an idling manager of the same type */
                     while (pAioMgr)
                     {
-                        if (pAioMgr->enmMgrType == enmMgrType)
+                        if (   pAioMgr->enmMgrType == enmMgrType
+                            && (pAioMgr->fBufferedAsync || !fNeedBufferedAsync))
                             break;
                         pAioMgr = pAioMgr->pNext;
                     }
@@ -1068,6 +1086,25 @@ static int pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndpoint,
                     {
                         rc = pdmacFileAioMgrCreate(pEpClassFile, &pAioMgr, enmMgrType);
                         AssertRC(rc);
+
+                        /*
+                         * The context of the new manager might not handle buffered I/O
+                         * asynchronously after all (see pdmacFileAioMgrNormalInit()).
+                         * The endpoint would block the manager, use the failsafe one.
+                         * Remember the outcome so later endpoints with buffered I/O
+                         * go straight to the failsafe manager.
+                         */
+                        if (   RT_SUCCESS(rc)
+                            && fNeedBufferedAsync
+                            && !pAioMgr->fBufferedAsync)
+                        {
+                            LogRel(("AIOMgr: Endpoint for file '%s' (flags %08x) uses the failsafe manager, buffered async I/O is not available\n",
+                                    pszUri, fFileFlags));
+                            pdmacFileAioMgrDestroy(pEpClassFile, pAioMgr);
+                            pEpClassFile->fBufferedAsync = false;
+                            rc = pdmacFileAioMgrCreate(pEpClassFile, &pAioMgr, PDMACEPFILEMGRTYPE_SIMPLE);
+                            AssertRC(rc);
+                        }
                     }
                 }
 
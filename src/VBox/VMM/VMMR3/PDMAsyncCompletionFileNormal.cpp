@@ -50,13 +50,36 @@ static void pdmacFileAioMgrNormalReqCompleteRc(PPDMACEPFILEMGR pAioMgr, RTFILEAI
                                                int rc, size_t cbTransfered);
 
 
+/**
+ * Creates the async I/O context for the given I/O manager.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr    The I/O manager.
+ * @param   phAioCtx   Where to store the handle of the context on success.
+ */
+static int pdmacFileAioMgrNormalCtxCreate(PPDMACEPFILEMGR pAioMgr, PRTFILEAIOCTX phAioCtx)
+{
+    uint32_t fFlags = pAioMgr->fBufferedAsync ? RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC : 0;
+
+    int rc = RTFileAioCtxCreate(phAioCtx, RTFILEAIO_UNLIMITED_REQS, fFlags);
+    if (rc == VERR_OUT_OF_RANGE)
+        rc = RTFileAioCtxCreate(phAioCtx, pAioMgr->cRequestsActiveMax, fFlags);
+
+    return rc;
+}
+
 int pdmacFileAioMgrNormalInit(PPDMACEPFILEMGR pAioMgr)
 {
     pAioMgr->cRequestsActiveMax = PDMACEPFILEMGR_REQS_STEP;
 
-    int rc = RTFileAioCtxCreate(&pAioMgr->hAioCtx, RTFILEAIO_UNLIMITED_REQS, 0 /* fFlags */);
-    if (rc == VERR_OUT_OF_RANGE)
-        rc = RTFileAioCtxCreate(&pAioMgr->hAioCtx, pAioMgr->cRequestsActiveMax, 0 /* fFlags */);
+    int rc = pdmacFileAioMgrNormalCtxCreate(pAioMgr, &pAioMgr->hAioCtx);
+    if (rc == VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED)
+    {
+        /* Endpoints with buffered I/O are assigned to the failsafe manager then. */
+        LogRel(("AIOMgr: Buffered async I/O is not available for the new I/O manager\n"));
+        pAioMgr->fBufferedAsync = false;
+        rc = pdmacFileAioMgrNormalCtxCreate(pAioMgr, &pAioMgr->hAioCtx);
+    }
 
     if (RT_SUCCESS(rc))
     {
@@ -354,9 +377,7 @@ static int pdmacFileAioMgrNormalGrow(PPDMACEPFILEMGR pAioMgr)
     pAioMgr->cRequestsActiveMax += PDMACEPFILEMGR_REQS_STEP;
 
     RTFILEAIOCTX hAioCtxNew = NIL_RTFILEAIOCTX;
-    int rc = RTFileAioCtxCreate(&hAioCtxNew, RTFILEAIO_UNLIMITED_REQS, 0 /* fFlags */);
-    if (rc == VERR_OUT_OF_RANGE)
-        rc = RTFileAioCtxCreate(&hAioCtxNew, pAioMgr->cRequestsActiveMax, 0 /* fFlags */);
+    int rc = pdmacFileAioMgrNormalCtxCreate(pAioMgr, &hAioCtxNew);
 
     if (RT_SUCCESS(rc))
     {
@@ -402,6 +423,18 @@ static int pdmacFileAioMgrNormalGrow(PPDMACEPFILEMGR pAioMgr)
     {
         LogFlow(("Increasing size of the I/O manager failed with rc=%Rrc\n", rc));
         pAioMgr->cRequestsActiveMax -= PDMACEPFILEMGR_REQS_STEP;
+
+        /*
+         * The context can't grow any further without losing buffered async I/O,
+         * keep the current one and let the requests wait for free slots.
+         */
+        if (rc == VERR_FILE_AIO_BUFFERED_NOT_SUPPORTED)
+        {
+            LogRel(("AIOMgr: I/O manager is limited to %u requests to keep buffered async I/O\n",
+                    pAioMgr->cRequestsActiveMax));
+            pAioMgr->fGrowLimitReached = true;
+            rc = VINF_SUCCESS;
+        }
     }
 
     pAioMgr->enmState = PDMACEPFILEMGRSTATE_RUNNING;
@@ -1101,7 +1134,8 @@ static int pdmacFileAioMgrNormalProcessTaskList(PPDMACTASKFILE pTaskHead,
         pdmacFileAioMgrEpAddTaskList(pEndpoint, pTaskHead);
 
         if (RT_UNLIKELY(   pAioMgr->cRequestsActiveMax == pAioMgr->cRequestsActive
-                        && !pEndpoint->pFlushReq))
+                        && !pEndpoint->pFlushReq
+                        && !pAioMgr->fGrowLimitReached))
         {
 #if 0
             /*
@@ -17,6 +17,13 @@
 
 /** @page pg_pdm_block_cache     PDM Block Cache - The I/O cache
  * This component implements an I/O cache based on the 2Q cache algorithm.
+ * The adaptive replacement cache (ARC) algorithm can be selected as an
+ * alternative replacement policy.
+ *
+ * The cache memory is split into shards which have their own lists and
+ * lock, each user of the cache is assigned to one shard.  New entries created
+ * while a user accesses the medium sequentially (a scan) are put at the tail
+ * of the recently used list so a scan can't flush the working set.
  */
 
 /*******************************************************************************
@@ -97,47 +104,74 @@ DECLINLINE(void) pdmBlkCacheEntryRef(PPDMBLKCACHEENTRY pEntry)
 }
 
 #ifdef VBOX_STRICT
-static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
+static void pdmBlkCacheValidate(PPDMBLKCACHESHARD pShard)
 {
     /* Amount of cached data should never exceed the maximum amount. */
-    AssertMsg(pCache->cbCached <= pCache->cbMax,
+    AssertMsg(pShard->cbCached <= pShard->cbMax,
               ("Current amount of cached data exceeds maximum\n"));
 
     /* The amount of cached data in the LRU and FRU list should match cbCached */
-    AssertMsg(pCache->LruRecentlyUsedIn.cbCached + pCache->LruFrequentlyUsed.cbCached == pCache->cbCached,
+    AssertMsg(pShard->LruRecentlyUsedIn.cbCached + pShard->LruFrequentlyUsed.cbCached == pShard->cbCached,
               ("Amount of cached data doesn't match\n"));
 
-    AssertMsg(pCache->LruRecentlyUsedOut.cbCached <= pCache->cbRecentlyUsedOutMax,
+    AssertMsg(pShard->LruRecentlyUsedOut.cbCached <= pShard->cbRecentlyUsedOutMax,
               ("Paged out list exceeds maximum\n"));
+    AssertMsg(pShard->LruFrequentlyUsedOut.cbCached <= pShard->cbFrequentlyUsedOutMax,
+              ("Frequently used paged out list exceeds maximum\n"));
 }
 #endif
 
 DECLINLINE(void) pdmBlkCacheLockEnter(PPDMBLKCACHEGLOBAL pCache)
 {
     RTCritSectEnter(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+{
+    RTCritSectLeave(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheShardLockEnter(PPDMBLKCACHESHARD pShard)
+{
+    RTCritSectEnter(&pShard->CritSect);
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheValidate(pShard);
 #endif
 }
 
-DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+DECLINLINE(void) pdmBlkCacheShardLockLeave(PPDMBLKCACHESHARD pShard)
 {
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheValidate(pShard);
 #endif
-    RTCritSectLeave(&pCache->CritSect);
+    RTCritSectLeave(&pShard->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
+{
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached -= cbAmount;
 }
 
-DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached -= cbAmount;
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached += cbAmount;
 }
 
-DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+/**
+ * Returns whether the given entry contains data, i.e. is not on one of the
+ * ghost lists.
+ *
+ * @returns true if the entry is on the recently or frequently used list.
+ * @param   pShard    The shard the entry belongs to.
+ * @param   pEntry    The entry to check.
+ */
+DECLINLINE(bool) pdmBlkCacheEntryHasData(PPDMBLKCACHESHARD pShard, PPDMBLKCACHEENTRY pEntry)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached += cbAmount;
+    PPDMBLKLRULIST pList = pEntry->pList;
+    return    pList == &pShard->LruRecentlyUsedIn
+           || pList == &pShard->LruFrequentlyUsed;
 }
 
 DECLINLINE(void) pdmBlkCacheListAdd(PPDMBLKLRULIST pList, uint32_t cbAmount)
@@ -276,6 +310,67 @@ static void pdmBlkCacheEntryAddToList(PPDMBLKLRULIST pList, PPDMBLKCACHEENTRY pE
 #endif
 }
 
+/**
+ * Adds a cache entry to the tail of the given LRU list so it is the first
+ * candidate for eviction.
+ *
+ * @returns nothing.
+ * @param    pList    List to the add entry to.
+ * @param    pEntry   Entry to add, must not be on any list.
+ */
+static void pdmBlkCacheEntryAppendToList(PPDMBLKLRULIST pList, PPDMBLKCACHEENTRY pEntry)
+{
+    LogFlowFunc((": Appending entry %#p to list %#p\n", pEntry, pList));
+#ifdef PDMACFILECACHE_WITH_LRULIST_CHECKS
+    pdmBlkCacheCheckList(pList, NULL);
+#endif
+
+    Assert(!pEntry->pList);
+
+    pEntry->pPrev = pList->pTail;
+    if (pList->pTail)
+        pList->pTail->pNext = pEntry;
+    else
+    {
+        Assert(!pList->pHead);
+        pList->pHead = pEntry;
+    }
+
+    pEntry->pNext    = NULL;
+    pList->pTail     = pEntry;
+    pdmBlkCacheListAdd(pList, pEntry->cbData);
+    pEntry->pList    = pList;
+#ifdef PDMACFILECACHE_WITH_LRULIST_CHECKS
+    pdmBlkCacheCheckList(pList, NULL);
+#endif
+}
+
+/**
+ * Allocates the data buffer of a cache entry.
+ *
+ * The pages are touched by the calling thread, which is the EMT issuing
+ * the request in most cases.  The first touch policy of the host places them
+ * on the NUMA node of that thread instead of the node of the I/O thread which
+ * would otherwise write to the buffer first.
+ *
+ * @returns Pointer to the buffer or NULL if out of memory.
+ * @param   pCache    The global cache data.
+ * @param   cbData    Size of the buffer.
+ */
+static uint8_t *pdmBlkCacheEntryBufAlloc(PPDMBLKCACHEGLOBAL pCache, size_t cbData)
+{
+    uint8_t *pbData = (uint8_t *)RTMemPageAlloc(cbData);
+
+    if (   pbData
+        && pCache->fBufPrefault)
+    {
+        for (size_t off = 0; off < cbData; off += PAGE_SIZE)
+            ASMAtomicWriteU8(&pbData[off], 0);
+    }
+
+    return pbData;
+}
+
 /**
  * Destroys a LRU list freeing all entries.
  *
@@ -300,12 +395,28 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
     }
 }
 
+/**
+ * Returns the maximum number of bytes the given ghost list may track.
+ *
+ * @returns Maximum size of the ghost list.
+ * @param   pShard        The shard owning the list.
+ * @param   pGhostList    The ghost list.
+ */
+DECLINLINE(uint32_t) pdmBlkCacheGhostListMax(PPDMBLKCACHESHARD pShard, PPDMBLKLRULIST pGhostList)
+{
+    if (pGhostList == &pShard->LruRecentlyUsedOut)
+        return pShard->cbRecentlyUsedOutMax;
+
+    Assert(pGhostList == &pShard->LruFrequentlyUsedOut);
+    return pShard->cbFrequentlyUsedOutMax;
+}
+
 /**
  * Tries to remove the given amount of bytes from a given list in the cache
  * moving the entries to one of the given ghosts lists
  *
  * @returns Amount of data which could be freed.
- * @param    pCache           Pointer to the global cache data.
+ * @param    pShard           Pointer to the cache shard.
  * @param    cbData           The amount of the data to free.
  * @param    pListSrc         The source list to evict data from.
  * @param    pGhostListSrc    The ghost list removed entries should be moved to
@@ -318,18 +429,20 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  *          may be marked as non evictable if they are used for I/O at the
  *          moment.
  */
-static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData,
+static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHESHARD pShard, size_t cbData,
                                         PPDMBLKLRULIST pListSrc, PPDMBLKLRULIST pGhostListDst,
                                         bool fReuseBuffer, uint8_t **ppbBuffer)
 {
+    PPDMBLKCACHEGLOBAL pCache = pShard->pCache;
     size_t cbEvicted = 0;
 
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
 
     AssertMsg(cbData > 0, ("Evicting 0 bytes not possible\n"));
     AssertMsg(   !pGhostListDst
-              || (pGhostListDst == &pCache->LruRecentlyUsedOut),
-              ("Destination list must be NULL or the recently used but paged out list\n"));
+              || (pGhostListDst == &pShard->LruRecentlyUsedOut)
+              || (pGhostListDst == &pShard->LruFrequentlyUsedOut),
+              ("Destination list must be NULL or one of the paged out lists\n"));
 
     if (fReuseBuffer)
     {
@@ -372,16 +485,18 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                 cbEvicted += pCurr->cbData;
 
                 pdmBlkCacheEntryRemoveFromList(pCurr);
-                pdmBlkCacheSub(pCache, pCurr->cbData);
+                pdmBlkCacheSub(pShard, pCurr->cbData);
 
                 if (pGhostListDst)
                 {
+                    uint32_t cbGhostMax = pdmBlkCacheGhostListMax(pShard, pGhostListDst);
+
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
                     PPDMBLKCACHEENTRY pGhostEntFree = pGhostListDst->pTail;
 
                     /* We have to remove the last entries from the paged out list. */
-                    while (   pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax
+                    while (   pGhostListDst->cbCached + pCurr->cbData > cbGhostMax
                            && pGhostEntFree)
                     {
                         PPDMBLKCACHEENTRY pFree = pGhostEntFree;
@@ -405,7 +520,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                         RTSemRWReleaseWrite(pBlkCacheFree->SemRWEntries);
                     }
 
-                    if (pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax)
+                    if (pGhostListDst->cbCached + pCurr->cbData > cbGhostMax)
                     {
                         /* Couldn't remove enough entries. Delete */
                         STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
@@ -437,17 +552,44 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
     return cbEvicted;
 }
 
-static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
+/**
+ * @interface_method_impl{PDMBLKCACHEPOLICYOPS,pfnHit,2Q}
+ */
+static DECLCALLBACK(void) pdmBlkCache2QHit(PPDMBLKCACHESHARD pShard, PPDMBLKCACHEENTRY pEntry)
+{
+    /* Only entries in Am are moved, A1in is a FIFO. */
+    if (pEntry->pList == &pShard->LruFrequentlyUsed)
+    {
+        pdmBlkCacheShardLockEnter(pShard);
+        pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+        pdmBlkCacheShardLockLeave(pShard);
+    }
+}
+
+/**
+ * @interface_method_impl{PDMBLKCACHEPOLICYOPS,pfnGhostHit,2Q}
+ */
+static DECLCALLBACK(void) pdmBlkCache2QGhostHit(PPDMBLKCACHESHARD pShard, PPDMBLKLRULIST pListGhost, uint32_t cbData)
+{
+    NOREF(pShard); NOREF(pListGhost); NOREF(cbData);
+}
+
+/**
+ * @interface_method_impl{PDMBLKCACHEPOLICYOPS,pfnReclaim,2Q}
+ */
+static DECLCALLBACK(bool) pdmBlkCache2QReclaim(PPDMBLKCACHESHARD pShard, size_t cbData, PPDMBLKLRULIST pListGhostHit,
+                                               bool fReuseBuffer, uint8_t **ppbBuffer)
 {
     size_t cbRemoved = 0;
+    NOREF(pListGhostHit);
 
-    if ((pCache->cbCached + cbData) < pCache->cbMax)
+    if ((pShard->cbCached + cbData) < pShard->cbMax)
         return true;
-    else if ((pCache->LruRecentlyUsedIn.cbCached + cbData) > pCache->cbRecentlyUsedInMax)
+    else if ((pShard->LruRecentlyUsedIn.cbCached + cbData) > pShard->cbRecentlyUsedInMax)
     {
         /* Try to evict as many bytes as possible from A1in */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruRecentlyUsedIn,
-                                                 &pCache->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
+        cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruRecentlyUsedIn,
+                                                 &pShard->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
 
         /*
          * If it was not possible to remove enough entries
@@ -462,17 +604,17 @@ static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fR
              * we don't need to evict that much data
              */
             if (!cbRemoved)
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruFrequentlyUsed,
                                                           NULL, fReuseBuffer, ppbBuffer);
             else
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData - cbRemoved, &pCache->LruFrequentlyUsed,
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData - cbRemoved, &pShard->LruFrequentlyUsed,
                                                           NULL, false, NULL);
         }
     }
     else
     {
         /* We have to remove entries from frequently access list. */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
+        cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruFrequentlyUsed,
                                                  NULL, fReuseBuffer, ppbBuffer);
     }
 
@@ -480,6 +622,156 @@ static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fR
     return (cbRemoved >= cbData);
 }
 
+/**
+ * 2Q replacement policy.
+ */
+static const PDMBLKCACHEPOLICYOPS g_BlkCachePolicy2Q =
+{
+    /* pszName */
+    "2Q",
+    /* pfnHit */
+    pdmBlkCache2QHit,
+    /* pfnGhostHit */
+    pdmBlkCache2QGhostHit,
+    /* pfnReclaim */
+    pdmBlkCache2QReclaim
+};
+
+/**
+ * @interface_method_impl{PDMBLKCACHEPOLICYOPS,pfnHit,ARC}
+ */
+static DECLCALLBACK(void) pdmBlkCacheArcHit(PPDMBLKCACHESHARD pShard, PPDMBLKCACHEENTRY pEntry)
+{
+    /* A hit in T1 or T2 moves the entry to the head of T2. */
+    pdmBlkCacheShardLockEnter(pShard);
+    if (pdmBlkCacheEntryHasData(pShard, pEntry))
+        pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+    pdmBlkCacheShardLockLeave(pShard);
+}
+
+/**
+ * @interface_method_impl{PDMBLKCACHEPOLICYOPS,pfnGhostHit,ARC}
+ */
+static DECLCALLBACK(void) pdmBlkCacheArcGhostHit(PPDMBLKCACHESHARD pShard, PPDMBLKLRULIST pListGhost, uint32_t cbData)
+{
+    uint64_t cbB1 = pShard->LruRecentlyUsedOut.cbCached;
+    uint64_t cbB2 = pShard->LruFrequentlyUsedOut.cbCached;
+    uint64_t cbDelta;
+
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+
+    /*
+     * A hit in B1 means T1 was too small, grow the target for T1.
+     * A hit in B2 means T2 was too small, shrink the target for T1.
+     */
+    if (pListGhost == &pShard->LruRecentlyUsedOut)
+    {
+        cbDelta = cbB1 >= cbB2 ? cbData : cbData * cbB2 / cbB1;
+        pShard->cbRecentlyUsedTarget = (uint32_t)RT_MIN(pShard->cbRecentlyUsedTarget + cbDelta, pShard->cbMax);
+    }
+    else
+    {
+        Assert(pListGhost == &pShard->LruFrequentlyUsedOut);
+        cbDelta = cbB2 >= cbB1 ? cbData : cbData * cbB1 / cbB2;
+        pShard->cbRecentlyUsedTarget = pShard->cbRecentlyUsedTarget > cbDelta
+                                     ? pShard->cbRecentlyUsedTarget - (uint32_t)cbDelta
+                                     : 0;
+    }
+
+    LogFlowFunc((": cbRecentlyUsedTarget=%u\n", pShard->cbRecentlyUsedTarget));
+}
+
+/**
+ * @interface_method_impl{PDMBLKCACHEPOLICYOPS,pfnReclaim,ARC}
+ */
+static DECLCALLBACK(bool) pdmBlkCacheArcReclaim(PPDMBLKCACHESHARD pShard, size_t cbData, PPDMBLKLRULIST pListGhostHit,
+                                                bool fReuseBuffer, uint8_t **ppbBuffer)
+{
+    PPDMBLKLRULIST pListFirst,  pGhostFirst;
+    PPDMBLKLRULIST pListSecond, pGhostSecond;
+    size_t cbRemoved = 0;
+    uint32_t cbT1 = pShard->LruRecentlyUsedIn.cbCached;
+
+    if ((pShard->cbCached + cbData) < pShard->cbMax)
+        return true;
+
+    /* Evict from T1 if it exceeds its target size, from T2 otherwise. */
+    if (   cbT1
+        && (   cbT1 > pShard->cbRecentlyUsedTarget
+            || (   pListGhostHit == &pShard->LruFrequentlyUsedOut
+                && cbT1 == pShard->cbRecentlyUsedTarget)))
+    {
+        pListFirst   = &pShard->LruRecentlyUsedIn;
+        pGhostFirst  = &pShard->LruRecentlyUsedOut;
+        pListSecond  = &pShard->LruFrequentlyUsed;
+        pGhostSecond = &pShard->LruFrequentlyUsedOut;
+    }
+    else
+    {
+        pListFirst   = &pShard->LruFrequentlyUsed;
+        pGhostFirst  = &pShard->LruFrequentlyUsedOut;
+        pListSecond  = &pShard->LruRecentlyUsedIn;
+        pGhostSecond = &pShard->LruRecentlyUsedOut;
+    }
+
+    cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, pListFirst, pGhostFirst, fReuseBuffer, ppbBuffer);
+    if (cbRemoved < cbData)
+    {
+        Assert(!fReuseBuffer || !*ppbBuffer);
+
+        /* Entries may be in progress, try the other list. */
+        if (!cbRemoved)
+            cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData, pListSecond, pGhostSecond,
+                                                   fReuseBuffer, ppbBuffer);
+        else
+            cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData - cbRemoved, pListSecond, pGhostSecond,
+                                                   false, NULL);
+    }
+
+    LogFlowFunc((": removed %u bytes, requested %u\n", cbRemoved, cbData));
+    return (cbRemoved >= cbData);
+}
+
+/**
+ * Adaptive replacement cache policy.
+ */
+static const PDMBLKCACHEPOLICYOPS g_BlkCachePolicyArc =
+{
+    /* pszName */
+    "ARC",
+    /* pfnHit */
+    pdmBlkCacheArcHit,
+    /* pfnGhostHit */
+    pdmBlkCacheArcGhostHit,
+    /* pfnReclaim */
+    pdmBlkCacheArcReclaim
+};
+
+/** Array of all replacement policies. */
+static PCPDMBLKCACHEPOLICYOPS const g_apBlkCachePolicies[] =
+{
+    &g_BlkCachePolicy2Q,
+    &g_BlkCachePolicyArc
+};
+
+/**
+ * Reclaims the given amount of data from the shard using the configured
+ * replacement policy.
+ *
+ * @returns Flag whether enough data could be evicted.
+ * @param   pShard          The shard.
+ * @param   cbData          Number of bytes required.
+ * @param   pListGhostHit   The ghost list the entry to fetch was hit in, NULL for new entries.
+ * @param   fReuseBuffer    Flag whether a buffer of the same size should be returned.
+ * @param   ppbBuffer       Where to store the buffer to reuse.
+ */
+DECLINLINE(bool) pdmBlkCacheReclaim(PPDMBLKCACHESHARD pShard, size_t cbData, PPDMBLKLRULIST pListGhostHit,
+                                    bool fReuseBuffer, uint8_t **ppbBuffer)
+{
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    return pShard->pCache->pPolicy->pfnReclaim(pShard, cbData, pListGhostHit, fReuseBuffer, ppbBuffer);
+}
+
 DECLINLINE(int) pdmBlkCacheEnqueue(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbXfer, PPDMBLKCACHEIOXFER pIoXfer)
 {
     int rc = VINF_SUCCESS;
@@ -843,9 +1135,7 @@ static DECLCALLBACK(int) pdmR3BlkCacheSaveExec(PVM pVM, PSSMHANDLE pSSM)
             AssertMsg(pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY, ("Entry is not dirty\n"));
             AssertMsg(!(pEntry->fFlags & ~PDMBLKCACHE_ENTRY_IS_DIRTY), ("Invalid flags set\n"));
             AssertMsg(!pEntry->pWaitingHead && !pEntry->pWaitingTail, ("There are waiting requests\n"));
-            AssertMsg(   pEntry->pList == &pBlkCacheGlobal->LruRecentlyUsedIn
-                      || pEntry->pList == &pBlkCacheGlobal->LruFrequentlyUsed,
-                      ("Invalid list\n"));
+            AssertMsg(pdmBlkCacheEntryHasData(pBlkCache->pShard, pEntry), ("Invalid list\n"));
             AssertMsg(pEntry->cbData == pEntry->Core.KeyLast - pEntry->Core.Key + 1,
                       ("Size and range do not match\n"));
 
@@ -956,8 +1246,10 @@ static DECLCALLBACK(int) pdmR3BlkCacheLoadExec(PVM pVM, PSSMHANDLE pSSM, uint32_
 
             /* Add to the dirty list. */
             pdmBlkCacheAddDirtyEntry(pBlkCache, pEntry);
-            pdmBlkCacheEntryAddToList(&pBlkCacheGlobal->LruRecentlyUsedIn, pEntry);
-            pdmBlkCacheAdd(pBlkCacheGlobal, cbEntry);
+            pdmBlkCacheShardLockEnter(pBlkCache->pShard);
+            pdmBlkCacheEntryAddToList(&pBlkCache->pShard->LruRecentlyUsedIn, pEntry);
+            pdmBlkCacheAdd(pBlkCache->pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pBlkCache->pShard);
             pdmBlkCacheEntryRelease(pEntry);
             cEntries--;
         }
@@ -985,11 +1277,96 @@ static DECLCALLBACK(int) pdmR3BlkCacheLoadExec(PVM pVM, PSSMHANDLE pSSM, uint32_
     return rc;
 }
 
+/**
+ * Initializes a cache shard.
+ *
+ * @returns VBox status code.
+ * @param   pBlkCacheGlobal    The global cache data.
+ * @param   pShard             The shard to initialize.
+ * @param   idShard            Index of the shard.
+ */
+static int pdmR3BlkCacheShardInit(PPDMBLKCACHEGLOBAL pBlkCacheGlobal, PPDMBLKCACHESHARD pShard, uint32_t idShard)
+{
+    PVM pVM = pBlkCacheGlobal->pVM;
+
+    pShard->pCache   = pBlkCacheGlobal;
+    pShard->idShard  = idShard;
+    pShard->cUsers   = 0;
+    pShard->cbMax    = pBlkCacheGlobal->cbMax / pBlkCacheGlobal->cShards;
+    pShard->cbCached = 0;
+
+    if (pBlkCacheGlobal->pPolicy == &g_BlkCachePolicyArc)
+    {
+        /* Each ghost list can track at most half the size of the cache. */
+        pShard->cbRecentlyUsedInMax    = pShard->cbMax;
+        pShard->cbRecentlyUsedOutMax   = pShard->cbMax / 2;
+        pShard->cbFrequentlyUsedOutMax = pShard->cbMax / 2;
+    }
+    else
+    {
+        pShard->cbRecentlyUsedInMax    = (pShard->cbMax / 100) * 25; /* 25% of the buffer size */
+        pShard->cbRecentlyUsedOutMax   = (pShard->cbMax / 100) * 50; /* 50% of the buffer size */
+        pShard->cbFrequentlyUsedOutMax = 0;
+    }
+    pShard->cbRecentlyUsedTarget = 0;
+    LogFlowFunc(("idShard=%u cbMax=%u cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
+                 idShard, pShard->cbMax, pShard->cbRecentlyUsedInMax, pShard->cbRecentlyUsedOutMax));
+
+    /* Initialize members */
+    pShard->LruRecentlyUsedIn.pHead    = NULL;
+    pShard->LruRecentlyUsedIn.pTail    = NULL;
+    pShard->LruRecentlyUsedIn.cbCached = 0;
+
+    pShard->LruRecentlyUsedOut.pHead    = NULL;
+    pShard->LruRecentlyUsedOut.pTail    = NULL;
+    pShard->LruRecentlyUsedOut.cbCached = 0;
+
+    pShard->LruFrequentlyUsed.pHead    = NULL;
+    pShard->LruFrequentlyUsed.pTail    = NULL;
+    pShard->LruFrequentlyUsed.cbCached = 0;
+
+    pShard->LruFrequentlyUsedOut.pHead    = NULL;
+    pShard->LruFrequentlyUsedOut.pTail    = NULL;
+    pShard->LruFrequentlyUsedOut.cbCached = 0;
+
+    STAMR3RegisterF(pVM, &pShard->cbMax,
+                    STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                    STAMUNIT_BYTES, "Maximum shard size",
+                    "/PDM/BlkCache/Shard%u/cbMax", idShard);
+    STAMR3RegisterF(pVM, &pShard->cbCached,
+                    STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                    STAMUNIT_BYTES, "Currently used cache",
+                    "/PDM/BlkCache/Shard%u/cbCached", idShard);
+    STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedIn.cbCached,
+                    STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                    STAMUNIT_BYTES, "Number of bytes cached in MRU list",
+                    "/PDM/BlkCache/Shard%u/cbCachedMruIn", idShard);
+    STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedOut.cbCached,
+                    STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                    STAMUNIT_BYTES, "Number of bytes cached in MRU ghost list",
+                    "/PDM/BlkCache/Shard%u/cbCachedMruOut", idShard);
+    STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsed.cbCached,
+                    STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                    STAMUNIT_BYTES, "Number of bytes cached in FRU list",
+                    "/PDM/BlkCache/Shard%u/cbCachedFru", idShard);
+    STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsedOut.cbCached,
+                    STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                    STAMUNIT_BYTES, "Number of bytes cached in FRU ghost list",
+                    "/PDM/BlkCache/Shard%u/cbCachedFruOut", idShard);
+    STAMR3RegisterF(pVM, &pShard->cbRecentlyUsedTarget,
+                    STAMTYPE_U32, STAMVISIBILITY_USED,
+                    STAMUNIT_BYTES, "Adaptive target size of the MRU list",
+                    "/PDM/BlkCache/Shard%u/cbMruTarget", idShard);
+
+    return RTCritSectInit(&pShard->CritSect);
+}
+
 int pdmR3BlkCacheInit(PVM pVM)
 {
     int  rc   = VINF_SUCCESS;
     PUVM pUVM = pVM->pUVM;
     PPDMBLKCACHEGLOBAL pBlkCacheGlobal;
+    uint32_t cShardsInit = 0;
 
     LogFlowFunc((": pVM=%p\n", pVM));
 
@@ -1005,21 +1382,8 @@ int pdmR3BlkCacheInit(PVM pVM)
     RTListInit(&pBlkCacheGlobal->ListUsers);
     pBlkCacheGlobal->pVM = pVM;
     pBlkCacheGlobal->cRefs = 0;
-    pBlkCacheGlobal->cbCached  = 0;
     pBlkCacheGlobal->fCommitInProgress = false;
-
-    /* Initialize members */
-    pBlkCacheGlobal->LruRecentlyUsedIn.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.cbCached = 0;
-
-    pBlkCacheGlobal->LruRecentlyUsedOut.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.cbCached = 0;
-
-    pBlkCacheGlobal->LruFrequentlyUsed.pHead    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.pTail    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.cbCached = 0;
+    pBlkCacheGlobal->pPolicy = &g_BlkCachePolicy2Q;
 
     do
     {
@@ -1027,16 +1391,60 @@ int pdmR3BlkCacheInit(PVM pVM)
         AssertLogRelRCBreak(rc);
         LogFlowFunc(("Maximum number of bytes cached %u\n", pBlkCacheGlobal->cbMax));
 
-        pBlkCacheGlobal->cbRecentlyUsedInMax  = (pBlkCacheGlobal->cbMax / 100) * 25; /* 25% of the buffer size */
-        pBlkCacheGlobal->cbRecentlyUsedOutMax = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
-        LogFlowFunc(("cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
-                     pBlkCacheGlobal->cbRecentlyUsedInMax, pBlkCacheGlobal->cbRecentlyUsedOutMax));
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheShards", &pBlkCacheGlobal->cShards, 1);
+        AssertLogRelRCBreak(rc);
+        if (   !pBlkCacheGlobal->cShards
+            || pBlkCacheGlobal->cShards > 64)
+        {
+            rc = VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                            N_("Configuration error: PDM/BlkCache/CacheShards must be between 1 and 64"));
+            break;
+        }
+
+        char *pszPolicy = NULL;
+        rc = CFGMR3QueryStringAllocDef(pCfgBlkCache, "CachePolicy", &pszPolicy, "2Q");
+        AssertLogRelRCBreak(rc);
+
+        pBlkCacheGlobal->pPolicy = NULL;
+        for (unsigned i = 0; i < RT_ELEMENTS(g_apBlkCachePolicies); i++)
+            if (!RTStrICmp(pszPolicy, g_apBlkCachePolicies[i]->pszName))
+            {
+                pBlkCacheGlobal->pPolicy = g_apBlkCachePolicies[i];
+                break;
+            }
+
+        if (!pBlkCacheGlobal->pPolicy)
+            rc = VMSetError(pVM, VERR_NOT_FOUND, RT_SRC_POS,
+                            N_("Configuration error: Unknown block cache policy '%s'"), pszPolicy);
+        MMR3HeapFree(pszPolicy);
+        if (RT_FAILURE(rc))
+            break;
+
+        rc = CFGMR3QueryU64Def(pCfgBlkCache, "CacheScanThreshold", &pBlkCacheGlobal->cbScanThreshold,
+                               pBlkCacheGlobal->cbMax / 2);
+        AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryBoolDef(pCfgBlkCache, "CacheBufPrefault", &pBlkCacheGlobal->fBufPrefault, true);
+        AssertLogRelRCBreak(rc);
 
         /** @todo r=aeichner: Experiment to find optimal default values */
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitIntervalMs", &pBlkCacheGlobal->u32CommitTimeoutMs, 10000 /* 10sec */);
         AssertLogRelRCBreak(rc);
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitThreshold", &pBlkCacheGlobal->cbCommitDirtyThreshold, pBlkCacheGlobal->cbMax / 2);
         AssertLogRelRCBreak(rc);
+
+        pBlkCacheGlobal->paShards = (PPDMBLKCACHESHARD)RTMemAllocZ(pBlkCacheGlobal->cShards * sizeof(PDMBLKCACHESHARD));
+        if (!pBlkCacheGlobal->paShards)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+
+        for (cShardsInit = 0; cShardsInit < pBlkCacheGlobal->cShards; cShardsInit++)
+        {
+            rc = pdmR3BlkCacheShardInit(pBlkCacheGlobal, &pBlkCacheGlobal->paShards[cShardsInit], cShardsInit);
+            if (RT_FAILURE(rc))
+                break;
+        }
     } while (0);
 
     if (RT_SUCCESS(rc))
@@ -1046,27 +1454,6 @@ int pdmR3BlkCacheInit(PVM pVM)
                        "/PDM/BlkCache/cbMax",
                        STAMUNIT_BYTES,
                        "Maximum cache size");
-        STAMR3Register(pVM, &pBlkCacheGlobal->cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCached",
-                       STAMUNIT_BYTES,
-                       "Currently used cache");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedIn.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruIn",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in MRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedOut.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruOut",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruFrequentlyUsed.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedFru",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU ghost list");
-
 #ifdef VBOX_WITH_STATISTICS
         STAMR3Register(pVM, &pBlkCacheGlobal->cHits,
                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
@@ -1104,6 +1491,10 @@ int pdmR3BlkCacheInit(PVM pVM)
                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
                        "/PDM/BlkCache/CacheBuffersReused",
                        STAMUNIT_COUNT, "Number of times a buffer could be reused");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatScanEntries,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/CacheScanEntries",
+                       STAMUNIT_COUNT, "Number of entries created during a sequential scan");
 #endif
 
         /* Initialize the critical section */
@@ -1130,6 +1521,9 @@ int pdmR3BlkCacheInit(PVM pVM)
             if (RT_SUCCESS(rc))
             {
                 LogRel(("BlkCache: Cache successfully initialised. Cache size is %u bytes\n", pBlkCacheGlobal->cbMax));
+                LogRel(("BlkCache: Using the %s replacement policy with %u shard(s)\n",
+                        pBlkCacheGlobal->pPolicy->pszName, pBlkCacheGlobal->cShards));
+                LogRel(("BlkCache: Cache scan threshold is %llu bytes\n", pBlkCacheGlobal->cbScanThreshold));
                 LogRel(("BlkCache: Cache commit interval is %u ms\n", pBlkCacheGlobal->u32CommitTimeoutMs));
                 LogRel(("BlkCache: Cache commit threshold is %u bytes\n", pBlkCacheGlobal->cbCommitDirtyThreshold));
                 pUVM->pdm.s.pBlkCacheGlobal = pBlkCacheGlobal;
@@ -1140,6 +1534,13 @@ int pdmR3BlkCacheInit(PVM pVM)
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
     }
 
+    if (pBlkCacheGlobal->paShards)
+    {
+        for (uint32_t i = 0; i < cShardsInit; i++)
+            RTCritSectDelete(&pBlkCacheGlobal->paShards[i].CritSect);
+        RTMemFree(pBlkCacheGlobal->paShards);
+    }
+
     if (pBlkCacheGlobal)
         RTMemFree(pBlkCacheGlobal);
 
@@ -1156,14 +1557,25 @@ void pdmR3BlkCacheTerm(PVM pVM)
         /* Make sure no one else uses the cache now */
         pdmBlkCacheLockEnter(pBlkCacheGlobal);
 
-        /* Cleanup deleting all cache entries waiting for in progress entries to finish. */
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedIn);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedOut);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruFrequentlyUsed);
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->paShards[i];
+
+            /* Cleanup deleting all cache entries waiting for in progress entries to finish. */
+            pdmBlkCacheShardLockEnter(pShard);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedIn);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedOut);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsed);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsedOut);
+            pdmBlkCacheShardLockLeave(pShard);
+
+            RTCritSectDelete(&pShard->CritSect);
+        }
 
         pdmBlkCacheLockLeave(pBlkCacheGlobal);
 
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
+        RTMemFree(pBlkCacheGlobal->paShards);
         RTMemFree(pBlkCacheGlobal);
         pVM->pUVM->pdm.s.pBlkCacheGlobal = NULL;
     }
@@ -1225,6 +1637,15 @@ static int pdmR3BlkCacheRetain(PVM pVM, PPPDMBLKCACHE ppBlkCache, const char *pc
                     pBlkCache->pTree  = (PAVLRU64TREE)RTMemAllocZ(sizeof(AVLRFOFFTREE));
                     if (pBlkCache->pTree)
                     {
+                        /* Assign the user to the shard with the fewest users. */
+                        PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->paShards[0];
+                        for (uint32_t i = 1; i < pBlkCacheGlobal->cShards; i++)
+                            if (pBlkCacheGlobal->paShards[i].cUsers < pShard->cUsers)
+                                pShard = &pBlkCacheGlobal->paShards[i];
+
+                        pShard->cUsers++;
+                        pBlkCache->pShard = pShard;
+
 #ifdef VBOX_WITH_STATISTICS
                         STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatWriteDeferred,
                                         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
@@ -1375,7 +1796,8 @@ VMMR3DECL(int) PDMR3BlkCacheRetainInt(PVM pVM, void *pvUser, PPPDMBLKCACHE ppBlk
 static int pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *pvUser)
 {
     PPDMBLKCACHEENTRY  pEntry = (PPDMBLKCACHEENTRY)pNode;
-    PPDMBLKCACHEGLOBAL pCache = (PPDMBLKCACHEGLOBAL)pvUser;
+    PPDMBLKCACHESHARD  pShard = (PPDMBLKCACHESHARD)pvUser;
+    PPDMBLKCACHEGLOBAL pCache = pShard->pCache;
     PPDMBLKCACHE pBlkCache = pEntry->pBlkCache;
 
     while (ASMAtomicReadU32(&pEntry->fFlags) & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS)
@@ -1383,12 +1805,14 @@ static int pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *pvUser)
         /* Leave the locks to let the I/O thread make progress but reference the entry to prevent eviction. */
         pdmBlkCacheEntryRef(pEntry);
         RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+        pdmBlkCacheShardLockLeave(pShard);
         pdmBlkCacheLockLeave(pCache);
 
         RTThreadSleep(250);
 
         /* Re-enter all locks */
         pdmBlkCacheLockEnter(pCache);
+        pdmBlkCacheShardLockEnter(pShard);
         RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
         pdmBlkCacheEntryRelease(pEntry);
     }
@@ -1396,13 +1820,12 @@ static int pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *pvUser)
     AssertMsg(!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS),
                 ("Entry is dirty and/or still in progress fFlags=%#x\n", pEntry->fFlags));
 
-    bool fUpdateCache =    pEntry->pList == &pCache->LruFrequentlyUsed
-                        || pEntry->pList == &pCache->LruRecentlyUsedIn;
+    bool fUpdateCache = pdmBlkCacheEntryHasData(pShard, pEntry);
 
     pdmBlkCacheEntryRemoveFromList(pEntry);
 
     if (fUpdateCache)
-        pdmBlkCacheSub(pCache, pEntry->cbData);
+        pdmBlkCacheSub(pShard, pEntry->cbData);
 
     RTMemPageFree(pEntry->pbData, pEntry->cbData);
     RTMemFree(pEntry);
@@ -1430,13 +1853,16 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
     pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheShardLockEnter(pBlkCache->pShard);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
-    RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
+    RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pBlkCache->pShard);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheShardLockLeave(pBlkCache->pShard);
 
     RTSpinlockDestroy(pBlkCache->LockList);
 
     pCache->cRefs--;
+    pBlkCache->pShard->cUsers--;
     RTListNodeRemove(&pBlkCache->NodeCacheUser);
 
     pdmBlkCacheLockLeave(pCache);
@@ -1626,7 +2052,7 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryAlloc(PPDMBLKCACHE pBlkCache,
     if (pbBuffer)
         pEntryNew->pbData    = pbBuffer;
     else
-        pEntryNew->pbData    = (uint8_t *)RTMemPageAlloc(cbData);
+        pEntryNew->pbData    = pdmBlkCacheEntryBufAlloc(pBlkCache->pCache, cbData);
 
     if (RT_UNLIKELY(!pEntryNew->pbData))
     {
@@ -1809,22 +2235,25 @@ static uint32_t pdmBlkCacheEntryBoundariesCalc(PPDMBLKCACHE pBlkCache,
  * @param   pcbData           Where to store the number of bytes the new
  *                            entry can hold. May be lower than actually requested
  *                            due to another entry intersecting the access range.
+ * @param   fScan             Flag whether the access is part of a sequential scan.
+ *                            The entry is put at the tail of the recently used
+ *                            list in that case.
  */
 static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
                                                 uint64_t off, size_t cb,
-                                                size_t *pcbData)
+                                                size_t *pcbData, bool fScan)
 {
     uint32_t cbEntry  = 0;
 
     *pcbData = pdmBlkCacheEntryBoundariesCalc(pBlkCache, off, (uint32_t)cb, &cbEntry);
     AssertReturn(cb <= UINT32_MAX, NULL);
 
-    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
-    pdmBlkCacheLockEnter(pCache);
+    PPDMBLKCACHESHARD pShard = pBlkCache->pShard;
+    pdmBlkCacheShardLockEnter(pShard);
 
     PPDMBLKCACHEENTRY pEntryNew = NULL;
     uint8_t          *pbBuffer  = NULL;
-    bool fEnough = pdmBlkCacheReclaim(pCache, cbEntry, true, &pbBuffer);
+    bool fEnough = pdmBlkCacheReclaim(pShard, cbEntry, NULL, true, &pbBuffer);
     if (fEnough)
     {
         LogFlow(("Evicted enough bytes (%u requested). Creating new cache entry\n", cbEntry));
@@ -1832,9 +2261,15 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
         pEntryNew = pdmBlkCacheEntryAlloc(pBlkCache, off, cbEntry, pbBuffer);
         if (RT_LIKELY(pEntryNew))
         {
-            pdmBlkCacheEntryAddToList(&pCache->LruRecentlyUsedIn, pEntryNew);
-            pdmBlkCacheAdd(pCache, cbEntry);
-            pdmBlkCacheLockLeave(pCache);
+            if (fScan)
+            {
+                STAM_COUNTER_INC(&pBlkCache->pCache->StatScanEntries);
+                pdmBlkCacheEntryAppendToList(&pShard->LruRecentlyUsedIn, pEntryNew);
+            }
+            else
+                pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntryNew);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
 
             pdmBlkCacheInsertEntry(pBlkCache, pEntryNew);
 
@@ -1843,14 +2278,38 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
                       ("Overflow in calculation off=%llu\n", off));
         }
         else
-            pdmBlkCacheLockLeave(pCache);
+            pdmBlkCacheShardLockLeave(pShard);
     }
     else
-        pdmBlkCacheLockLeave(pCache);
+        pdmBlkCacheShardLockLeave(pShard);
 
     return pEntryNew;
 }
 
+/**
+ * Updates the sequential access detection of the given user.
+ *
+ * @returns Flag whether the access is part of a scan.
+ * @param   pBlkCache    The block cache user.
+ * @param   off          Start offset of the access.
+ * @param   cb           Size of the access.
+ */
+static bool pdmBlkCacheScanDetect(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cb)
+{
+    uint64_t cbScanThreshold = pBlkCache->pCache->cbScanThreshold;
+
+    if (!cbScanThreshold)
+        return false;
+
+    if (off == pBlkCache->offSeqNext)
+        pBlkCache->cbSeq += cb;
+    else
+        pBlkCache->cbSeq = cb;
+    pBlkCache->offSeqNext = off + cb;
+
+    return pBlkCache->cbSeq >= cbScanThreshold;
+}
+
 static PPDMBLKCACHEREQ pdmBlkCacheReqAlloc(void *pvUser)
 {
     PPDMBLKCACHEREQ pReq = (PPDMBLKCACHEREQ)RTMemAlloc(sizeof(PDMBLKCACHEREQ));
@@ -1927,6 +2386,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 {
     int rc = VINF_SUCCESS;
     PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    PPDMBLKCACHESHARD  pShard = pBlkCache->pShard;
     PPDMBLKCACHEENTRY  pEntry;
     PPDMBLKCACHEREQ    pReq;
 
@@ -1936,6 +2396,11 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
     AssertPtrReturn(pBlkCache, VERR_INVALID_POINTER);
     AssertReturn(!pBlkCache->fSuspended, VERR_INVALID_STATE);
 
+#ifdef VBOX_WITH_IO_READ_CACHE
+    /* Reads only create entries with the read cache, don't disturb the write scan detection otherwise. */
+    bool fScan = pdmBlkCacheScanDetect(pBlkCache, off, cbRead);
+#endif
+
     RTSGBUF SgBuf;
     RTSgBufClone(&SgBuf, pcSgBuf);
 
@@ -1990,8 +2455,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
             STAM_COUNTER_ADD(&pCache->StatRead, cbToRead);
 
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (pdmBlkCacheEntryHasData(pShard, pEntry))
             {
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
                                                               PDMBLKCACHE_ENTRY_IO_IN_PROGRESS,
@@ -2009,13 +2473,8 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     RTSgBufCopyFromBuf(&SgBuf, pEntry->pbData + offDiff, cbToRead);
                 }
 
-                /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                /* Let the replacement policy move the entry. */
+                pCache->pPolicy->pfnHit(pShard, pEntry);
                 /* Release the entry */
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2025,21 +2484,23 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 
                 LogFlow(("Fetching data for ghost entry %#p from file\n", pEntry));
 
-                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheShardLockEnter(pShard);
+                PPDMBLKLRULIST pListGhost = pEntry->pList;
+                pCache->pPolicy->pfnGhostHit(pShard, pListGhost, pEntry->cbData);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pShard, pEntry->cbData, pListGhost, true, &pbBuffer);
 
                 /* Move the entry to Am and fetch it to the cache. */
                 if (fEnough)
                 {
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
                     else
-                        pEntry->pbData = (uint8_t *)RTMemPageAlloc(pEntry->cbData);
+                        pEntry->pbData = pdmBlkCacheEntryBufAlloc(pCache, pEntry->cbData);
                     AssertPtr(pEntry->pbData);
 
                     pdmBlkCacheEntryWaitersAdd(pEntry, pReq,
@@ -2057,7 +2518,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
 
@@ -2073,7 +2534,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
             /* No entry found for this offset. Create a new entry and fetch the data to the cache. */
             PPDMBLKCACHEENTRY pEntryNew = pdmBlkCacheEntryCreate(pBlkCache,
                                                                  off, cbRead,
-                                                                 &cbToRead);
+                                                                 &cbToRead, fScan);
 
             cbRead -= cbToRead;
 
@@ -2143,6 +2604,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
 {
     int rc = VINF_SUCCESS;
     PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    PPDMBLKCACHESHARD pShard = pBlkCache->pShard;
     PPDMBLKCACHEENTRY pEntry;
     PPDMBLKCACHEREQ pReq;
 
@@ -2152,6 +2614,8 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
     AssertPtrReturn(pBlkCache, VERR_INVALID_POINTER);
     AssertReturn(!pBlkCache->fSuspended, VERR_INVALID_STATE);
 
+    bool fScan = pdmBlkCacheScanDetect(pBlkCache, off, cbWrite);
+
     RTSGBUF SgBuf;
     RTSgBufClone(&SgBuf, pcSgBuf);
 
@@ -2190,8 +2654,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
             STAM_COUNTER_ADD(&pCache->StatWritten, cbToWrite);
 
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (pdmBlkCacheEntryHasData(pShard, pEntry))
             {
                 /* Check if the entry is dirty. */
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
@@ -2239,13 +2702,8 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                     }
                 } /* Dirty bit not set */
 
-                /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                /* Let the replacement policy move the entry. */
+                pCache->pPolicy->pfnHit(pShard, pEntry);
 
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2253,21 +2711,23 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
             {
                 uint8_t *pbBuffer = NULL;
 
-                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheShardLockEnter(pShard);
+                PPDMBLKLRULIST pListGhost = pEntry->pList;
+                pCache->pPolicy->pfnGhostHit(pShard, pListGhost, pEntry->cbData);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pShard, pEntry->cbData, pListGhost, true, &pbBuffer);
 
                 if (fEnough)
                 {
                     /* Move the entry to Am and fetch it to the cache. */
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
                     else
-                        pEntry->pbData = (uint8_t *)RTMemPageAlloc(pEntry->cbData);
+                        pEntry->pbData = pdmBlkCacheEntryBufAlloc(pCache, pEntry->cbData);
                     AssertPtr(pEntry->pbData);
 
                     pdmBlkCacheEntryWaitersAdd(pEntry, pReq,
@@ -2287,7 +2747,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
                     pdmBlkCacheRequestPassthrough(pBlkCache, pReq,
@@ -2304,7 +2764,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
              */
             PPDMBLKCACHEENTRY pEntryNew = pdmBlkCacheEntryCreate(pBlkCache,
                                                                  off, cbWrite,
-                                                                 &cbToWrite);
+                                                                 &cbToWrite, fScan);
 
             cbWrite -= cbToWrite;
 
@@ -2397,6 +2857,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
 {
     int rc = VINF_SUCCESS;
     PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    PPDMBLKCACHESHARD pShard = pBlkCache->pShard;
     PPDMBLKCACHEENTRY pEntry;
     PPDMBLKCACHEREQ pReq;
 
@@ -2439,8 +2900,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                 cbThisDiscard = RT_MIN(pEntry->cbData - offDiff, cbLeft);
 
                 /* Ghost lists contain no data. */
-                if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                    || (pEntry->pList == &pCache->LruFrequentlyUsed))
+                if (pdmBlkCacheEntryHasData(pShard, pEntry))
                 {
                     /* Check if the entry is dirty. */
                     if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
@@ -2450,14 +2910,14 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         /* If it is dirty but not yet in progress remove it. */
                         if (!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS))
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
 
                             STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
                             RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2496,7 +2956,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         }
                         else /* I/O in progress flag not set */
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
 
                             RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2505,7 +2965,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                             RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2513,7 +2973,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                 }
                 else /* Entry is on the ghost list just remove cache entry. */
                 {
-                    pdmBlkCacheLockEnter(pCache);
+                    pdmBlkCacheShardLockEnter(pShard);
                     pdmBlkCacheEntryRemoveFromList(pEntry);
 
                     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2522,7 +2982,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
                 }
@@ -2750,9 +3210,11 @@ VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache)
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
     pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheShardLockEnter(pBlkCache->pShard);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
-    RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
+    RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pBlkCache->pShard);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheShardLockLeave(pBlkCache->pShard);
 
     pdmBlkCacheLockLeave(pCache);
     return rc;
@@ -36,6 +36,7 @@
 #include <VBox/vmm/vmm.h>
 
 #include <VBox/version.h>
+#include <VBox/msi.h>
 #include <VBox/log.h>
 #include <VBox/err.h>
 #include <iprt/asm.h>
@@ -1433,7 +1434,8 @@ static DECLCALLBACK(void) pdmR3DevHlp_PCISetIrq(PPDMDEVINS pDevIns, int iIrq, in
     /*
      * Validate input.
      */
-    Assert(iIrq == 0);
+    /* MSI-X capable devices pass the vector number. */
+    Assert(iIrq == 0 || (uint32_t)iIrq < VBOX_MSIX_MAX_ENTRIES);
     Assert((uint32_t)iLevel <= PDM_IRQ_LEVEL_FLIP_FLOP);
 
     /*
@@ -287,7 +287,7 @@ VMMDECL(int) PGMR3PhysWriteExternal(PVM pVM, RTGCPHYS GCPhys, const void *pvBuf,
                 {
                     if (    PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_WRITE_MONITORED
                         && !PGM_PAGE_HAS_ACTIVE_HANDLERS(pPage))
-                        pgmPhysPageMakeWriteMonitoredWritable(pVM, pPage);
+                        pgmPhysPageMakeWriteMonitoredWritable(pVM, pPage, pRam->GCPhys + off);
                     else
                     {
                         pgmUnlock(pVM);
@@ -439,7 +439,18 @@ VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrExternal(PVM pVM, RTGCPHYS GCPhys, void **pp
 
     Assert(VM_IS_EMT(pVM) || !PGMIsLockOwner(pVM));
 
-    int rc = pgmLock(pVM);
+    /*
+     * Pull the page first if it's still missing after a post-copy teleportation.
+     */
+    int rc;
+    if (RT_UNLIKELY(pVM->pgm.s.pPostCopyR3))
+    {
+        rc = pgmR3PhysPostCopyEnsurePage(pVM, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    rc = pgmLock(pVM);
     AssertRCReturn(rc, rc);
 
     /*
@@ -473,7 +484,7 @@ VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrExternal(PVM pVM, RTGCPHYS GCPhys, void **pp
                     &&  !pgmPoolIsDirtyPage(pVM, GCPhys)
 #endif
                    )
-                    pgmPhysPageMakeWriteMonitoredWritable(pVM, pPage);
+                    pgmPhysPageMakeWriteMonitoredWritable(pVM, pPage, GCPhys);
                 else
                 {
                     pgmUnlock(pVM);
@@ -540,7 +551,15 @@ VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrExternal(PVM pVM, RTGCPHYS GCPhys, void **pp
  */
 VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrReadOnlyExternal(PVM pVM, RTGCPHYS GCPhys, void const **ppv, PPGMPAGEMAPLOCK pLock)
 {
-    int rc = pgmLock(pVM);
+    int rc;
+    if (RT_UNLIKELY(pVM->pgm.s.pPostCopyR3))
+    {
+        rc = pgmR3PhysPostCopyEnsurePage(pVM, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    rc = pgmLock(pVM);
     AssertRCReturn(rc, rc);
 
     /*
@@ -4599,6 +4618,7 @@ int pgmPhysFreePage(PVM pVM, PGMMFREEPAGESREQ pReq, uint32_t *pcPendingPages, PP
         PGM_PAGE_SET_WRITTEN_TO(pVM, pPage);
         pVM->pgm.s.cWrittenToPages++;
     }
+    pgmPhysDirtyLogMark(pVM, GCPhys, 1);
 
     /*
      * pPage = ZERO page.
@@ -0,0 +1,969 @@
+/* $Id: PGMPostCopy.cpp $ */
+/** @file
+ * PGM - Page Manager and Monitor, Post-copy teleportation.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_pgm_post_copy  PGM - Post-copy Teleportation
+ *
+ * A regular (pre-copy) teleportation keeps copying dirty RAM until the
+ * remainder can be sent within the max downtime, which never happens for
+ * guests dirtying memory faster than the link can carry it.  In post-copy
+ * mode the source arms PGM with PGMR3PhysPostCopyArm before starting the live
+ * save.  The live save then votes for the final pass after the first full
+ * pass, and the final pass writes PGM_STATE_REC_RAM_REMOTE records instead of
+ * the content of the pages dirtied since.  The source remembers these pages
+ * in a bitmap and hands them out through PGMR3PhysPostCopyReadPage while it
+ * is suspended.
+ *
+ * The target marks the remote pages in the same kind of bitmap while loading
+ * and leaves them zero.  Before resuming, PGMR3PhysPostCopyStart covers them
+ * with ALL access handlers (merging nearby pages into the same range and
+ * turning the handler off for the pages in between), so the first guest or
+ * device access to a missing page ends up in pgmR3PhysPostCopyHandler on an
+ * EMT.  The handler asks the transport to request the page from the source
+ * and waits for it.  Meanwhile the source pushes all the other pages, which
+ * the transport passes to PGMR3PhysPostCopyPutPage.  Pushed pages are staged
+ * and installed by an EMT, since that is where page allocation has to happen.
+ * When the EMTs fall behind, PGMR3PhysPostCopyPutPage makes the transport wait
+ * once PGM_POST_COPY_MAX_STAGED pages are staged, unless a page request is in
+ * progress and the transport has to keep going to deliver the page.  Once the
+ * last page has been installed, the access handlers are deregistered.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_PGM_PHYS
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/uvm.h>
+#include <VBox/vmm/vmapi.h>
+#include "PGMInternal.h"
+#include <VBox/vmm/vm.h>
+#include <VBox/param.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/avl.h>
+#include <iprt/mem.h>
+#include <iprt/semaphore.h>
+#include <iprt/string.h>
+
+#include "PGMInline.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The initial number of pages that may separate two missing pages covered
+ * by the same access handler. */
+#define PGM_POST_COPY_MIN_GAP           16
+/** The max number of staged pages an EMT installs per request. */
+#define PGM_POST_COPY_INSTALL_BATCH     64
+
+
+/*******************************************************************************
+*   Internal Functions                                                         *
+*******************************************************************************/
+static DECLCALLBACK(int) pgmR3PhysPostCopyHandler(PVM pVM, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                                                  PGMACCESSTYPE enmAccessType, void *pvUser);
+
+
+/**
+ * Allocates or resets the post-copy page bitmap.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ */
+int pgmR3PhysPostCopyInitBitmap(PVM pVM)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+    {
+        pPostCopy = (PPGMPOSTCOPY)MMR3HeapAllocZ(pVM, MM_TAG_PGM_PHYS, sizeof(*pPostCopy));
+        if (!pPostCopy)
+            return VERR_NO_MEMORY;
+        int rc = RTSemEventMultiCreate(&pPostCopy->hEvtRequestsIdle);
+        if (RT_SUCCESS(rc))
+        {
+            rc = RTSemEventCreate(&pPostCopy->hEvtStagedRoom);
+            if (RT_FAILURE(rc))
+                RTSemEventMultiDestroy(pPostCopy->hEvtRequestsIdle);
+        }
+        if (RT_FAILURE(rc))
+        {
+            MMR3HeapFree(pPostCopy);
+            return rc;
+        }
+        pVM->pgm.s.pPostCopyR3 = pPostCopy;
+    }
+    AssertReturn(!pPostCopy->fHooked, VERR_WRONG_ORDER);
+
+    if (pPostCopy->pbmPages)
+        ASMMemZero32((void *)pPostCopy->pbmPages, pPostCopy->cBits / 8);
+    else
+    {
+        RTGCPHYS GCPhysLast = 0;
+        for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+            if (   !PGM_RAM_RANGE_IS_AD_HOC(pCur)
+                && pCur->GCPhysLast > GCPhysLast)
+                GCPhysLast = pCur->GCPhysLast;
+        uint64_t const cBits = RT_ALIGN_64((GCPhysLast >> PAGE_SHIFT) + 1, 32);
+        AssertLogRelMsgReturn(cBits < _2G, ("GCPhysLast=%RGp\n", GCPhysLast), VERR_OUT_OF_RANGE);
+
+        pPostCopy->pbmPages = (uint32_t volatile *)MMR3HeapAllocZ(pVM, MM_TAG_PGM_PHYS, cBits / 8);
+        if (!pPostCopy->pbmPages)
+            return VERR_NO_MEMORY;
+        pPostCopy->cBits = (uint32_t)cBits;
+    }
+
+    pPostCopy->cPending         = 0;
+    pPostCopy->iNext            = 0;
+    pPostCopy->fAborted         = false;
+    RTSemEventMultiReset(pPostCopy->hEvtRequestsIdle);
+    pPostCopy->cDemanded        = 0;
+    pPostCopy->cPushed          = 0;
+    pPostCopy->cFetchedUnhooked = 0;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Records that the content of a RAM page will arrive after the VM has been
+ * resumed (target, state loading).
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ * @param   GCPhys      The guest physical address of the page.
+ */
+int pgmR3PhysPostCopyMarkRemote(PVM pVM, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy || !pPostCopy->pbmPages)
+    {
+        int rc = pgmR3PhysPostCopyInitBitmap(pVM);
+        if (RT_FAILURE(rc))
+            return rc;
+        pPostCopy = pVM->pgm.s.pPostCopyR3;
+    }
+    AssertReturn(!pPostCopy->fHooked, VERR_WRONG_ORDER);
+
+    uint64_t const iBit = GCPhys >> PAGE_SHIFT;
+    AssertLogRelMsgReturn(iBit < pPostCopy->cBits, ("GCPhys=%RGp cBits=%#x\n", GCPhys, pPostCopy->cBits),
+                          VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    if (!ASMAtomicBitTestAndSet(pPostCopy->pbmPages, (int32_t)iBit))
+        pPostCopy->cPending++;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * AVL destroy callback freeing a staged page.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   pNode       The staged page.
+ * @param   pvUser      Ignored.
+ */
+static DECLCALLBACK(int) pgmR3PhysPostCopyFreeStagedOne(PAVLGCPHYSNODECORE pNode, void *pvUser)
+{
+    NOREF(pvUser);
+    RTMemFree(pNode);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Deregisters the access handlers after the last missing page has been
+ * installed (target).
+ *
+ * @param   pVM         Pointer to the VM.
+ * @thread  EMT.
+ */
+static DECLCALLBACK(void) pgmR3PhysPostCopyCleanup(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    RTGCPHYS     aGCPhysHandlers[PGM_POST_COPY_MAX_HANDLERS];
+    uint32_t     cHandlers = 0;
+
+    pgmLock(pVM);
+    pPostCopy->fCleanupQueued = false;
+    if (   pPostCopy->fHooked
+        && !pPostCopy->cPending)
+    {
+        cHandlers = pPostCopy->cHandlers;
+        memcpy(aGCPhysHandlers, pPostCopy->aGCPhysHandlers, cHandlers * sizeof(aGCPhysHandlers[0]));
+        pPostCopy->cHandlers = 0;
+        ASMAtomicWriteBool(&pPostCopy->fHooked, false);
+        RTAvlGCPhysDestroy(&pPostCopy->StagedTree, pgmR3PhysPostCopyFreeStagedOne, NULL);
+        ASMAtomicWriteU32(&pPostCopy->cStaged, 0);
+        RTSemEventSignal(pPostCopy->hEvtStagedRoom);
+
+        LogRel(("PGM: Post-copy complete: %u pages demanded, %u pushed, %u fetched up front\n",
+                pPostCopy->cDemanded, pPostCopy->cPushed, pPostCopy->cFetchedUnhooked));
+    }
+    pgmUnlock(pVM);
+
+    for (uint32_t i = 0; i < cHandlers; i++)
+    {
+        int rc = PGMHandlerPhysicalDeregister(pVM, aGCPhysHandlers[i]);
+        AssertLogRelMsgRC(rc, ("GCPhys=%RGp rc=%Rrc\n", aGCPhysHandlers[i], rc));
+    }
+}
+
+
+/**
+ * Frees the post-copy resources when the VM is destroyed.
+ *
+ * @param   pVM         Pointer to the VM.
+ */
+void pgmR3PhysPostCopyTerm(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+        return;
+
+    RTAvlGCPhysDestroy(&pPostCopy->StagedTree, pgmR3PhysPostCopyFreeStagedOne, NULL);
+    pPostCopy->cStaged = 0;
+    RTSemEventMultiDestroy(pPostCopy->hEvtRequestsIdle);
+    pPostCopy->hEvtRequestsIdle = NIL_RTSEMEVENTMULTI;
+    RTSemEventDestroy(pPostCopy->hEvtStagedRoom);
+    pPostCopy->hEvtStagedRoom = NIL_RTSEMEVENT;
+}
+
+
+/**
+ * Copies a received page into guest memory and lets the guest access it
+ * directly from now on (target).
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ * @param   pPostCopy   The post-copy state.
+ * @param   GCPhys      The guest physical address of the page.
+ * @param   pvPage      The page content.
+ */
+static int pgmR3PhysPostCopyInstall(PVM pVM, PPGMPOSTCOPY pPostCopy, RTGCPHYS GCPhys, void const *pvPage)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    VM_ASSERT_EMT(pVM);
+
+    int32_t const iBit = (int32_t)(GCPhys >> PAGE_SHIFT);
+    if (!ASMBitTest(pPostCopy->pbmPages, iBit))
+        return VINF_SUCCESS; /* duplicate */
+
+    PPGMPAGE pPage;
+    int rc = pgmPhysGetPageEx(pVM, GCPhys, &pPage);
+    AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp rc=%Rrc\n", GCPhys, rc), rc);
+
+    /* The guest may have ballooned the page or the range may have been
+       remapped by now, in which case the content no longer matters. */
+    if (   PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM
+        && !PGM_PAGE_IS_BALLOONED(pPage)
+        && (   !PGM_PAGE_IS_ZERO(pPage)
+            || !ASMMemIsZeroPage(pvPage)))
+    {
+        PGMPAGEMAPLOCK  PgMpLck;
+        void           *pvDstPage;
+        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+        memcpy(pvDstPage, pvPage, PAGE_SIZE);
+        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+    }
+
+    ASMAtomicBitClear(pPostCopy->pbmPages, iBit);
+    uint32_t const cPending = ASMAtomicDecU32(&pPostCopy->cPending);
+
+    PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, GCPhys);
+    if (pCur && pCur->pfnHandlerR3 == pgmR3PhysPostCopyHandler)
+        PGMHandlerPhysicalPageTempOff(pVM, pCur->Core.Key, GCPhys);
+
+    /*
+     * Deregister the handlers once everything is in place.  We may be
+     * called from one of them, so leave that to a request.
+     */
+    if (   !cPending
+        && pPostCopy->fHooked
+        && !pPostCopy->fCleanupQueued)
+    {
+        pPostCopy->fCleanupQueued = true;
+        rc = VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3PhysPostCopyCleanup, 1, pVM);
+        AssertLogRelRC(rc);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Installs a batch of staged pages (target).
+ *
+ * Queued by PGMR3PhysPostCopyPutPage, one request per page, so there is
+ * always a request around for each staged page even if a batch stops short.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @thread  EMT.
+ */
+static DECLCALLBACK(void) pgmR3PhysPostCopyInstallStaged(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    unsigned     i;
+
+    pgmLock(pVM);
+    for (i = 0; i < PGM_POST_COPY_INSTALL_BATCH; i++)
+    {
+        PPGMPOSTCOPYSTAGEDPAGE pStaged = (PPGMPOSTCOPYSTAGEDPAGE)RTAvlGCPhysRemoveBestFit(&pPostCopy->StagedTree, 0,
+                                                                                          true /*fAbove*/);
+        if (!pStaged)
+            break;
+        ASMAtomicDecU32(&pPostCopy->cStaged);
+        bool const fPending = ASMBitTest(pPostCopy->pbmPages, (int32_t)(pStaged->Core.Key >> PAGE_SHIFT));
+        int rc = pgmR3PhysPostCopyInstall(pVM, pPostCopy, pStaged->Core.Key, pStaged->abPage);
+        if (RT_SUCCESS(rc) && fPending)
+            pPostCopy->cPushed++;
+        RTMemFree(pStaged);
+    }
+    pgmUnlock(pVM);
+
+    if (i > 0)
+        RTSemEventSignal(pPostCopy->hEvtStagedRoom);
+}
+
+
+/**
+ * Makes sure a missing page is present, requesting it from the source if it
+ * hasn't arrived yet (target).
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ * @param   pGCPhys     The guest physical address of the page.  (Passed by
+ *                      reference for the benefit of VMR3ReqCall.)
+ * @thread  EMT, not owning the PGM lock if it can be helped.
+ */
+static DECLCALLBACK(int) pgmR3PhysPostCopyDemand(PVM pVM, PRTGCPHYS pGCPhys)
+{
+    PPGMPOSTCOPY   pPostCopy = pVM->pgm.s.pPostCopyR3;
+    RTGCPHYS const GCPhys    = *pGCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    uint64_t const iBit      = GCPhys >> PAGE_SHIFT;
+    int            rc        = VINF_SUCCESS;
+
+    for (unsigned cRequests = 0; ; cRequests++)
+    {
+        pgmLock(pVM);
+        if (   iBit >= pPostCopy->cBits
+            || !ASMBitTest(pPostCopy->pbmPages, (int32_t)iBit))
+        {
+            pgmUnlock(pVM);
+            return VINF_SUCCESS;
+        }
+
+        PPGMPOSTCOPYSTAGEDPAGE pStaged = (PPGMPOSTCOPYSTAGEDPAGE)RTAvlGCPhysRemove(&pPostCopy->StagedTree, GCPhys);
+        if (pStaged)
+        {
+            ASMAtomicDecU32(&pPostCopy->cStaged);
+            rc = pgmR3PhysPostCopyInstall(pVM, pPostCopy, GCPhys, pStaged->abPage);
+            if (RT_SUCCESS(rc))
+                pPostCopy->cDemanded++;
+            pgmUnlock(pVM);
+            RTMemFree(pStaged);
+            RTSemEventSignal(pPostCopy->hEvtStagedRoom);
+            return rc;
+        }
+
+        /* The request doesn't return before the page has been staged, so
+           once is enough. */
+        if (   cRequests > 0
+            || pPostCopy->fAborted)
+        {
+            pgmUnlock(pVM);
+            rc = VERR_PGM_POST_COPY_PAGE_NOT_RECEIVED;
+            break;
+        }
+        ASMAtomicIncU32(&pPostCopy->cRequestsActive);
+        pgmUnlock(pVM);
+
+        /* The transport may be waiting for room in the staging tree, but it
+           has to go on receiving to deliver our page. */
+        RTSemEventSignal(pPostCopy->hEvtStagedRoom);
+
+        rc = pPostCopy->pfnRequest(pVM->pUVM, GCPhys, pPostCopy->pvUser);
+        if (   ASMAtomicDecU32(&pPostCopy->cRequestsActive) == 0
+            && ASMAtomicReadBool(&pPostCopy->fAborted))
+            RTSemEventMultiSignal(pPostCopy->hEvtRequestsIdle);
+        if (RT_FAILURE(rc))
+            break;
+    }
+
+    LogRel(("PGM: Failed to get post-copy page %RGp: %Rrc\n", GCPhys, rc));
+    return rc;
+}
+
+
+/**
+ * Stops the VM after failing to obtain a missing page (target).
+ *
+ * There is no way to continue without the page content and the source has
+ * most likely gone away.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   GCPhys      The guest physical address of the page.
+ * @param   rc          The failure status.
+ */
+static void pgmR3PhysPostCopyFatal(PVM pVM, RTGCPHYS GCPhys, int rc)
+{
+    VMSetRuntimeError(pVM, VMSETRTERR_FLAGS_FATAL, "PostCopyPageMissing",
+                      N_("Guest memory at %RGp could not be obtained from the teleportation source (%Rrc)"),
+                      GCPhys, rc);
+}
+
+
+/**
+ * Access handler for the missing pages (target).
+ *
+ * @returns VINF_SUCCESS or VINF_PGM_HANDLER_DO_DEFAULT.
+ * @param   pVM             Pointer to the VM.
+ * @param   GCPhys          The physical address the guest is accessing.
+ * @param   pvPhys          The HC mapping of that address.  Stale for
+ *                          reads if the page was missing.
+ * @param   pvBuf           What the guest is reading/writing.
+ * @param   cbBuf           How much it's reading/writing.
+ * @param   enmAccessType   The access type.
+ * @param   pvUser          Unused.
+ */
+static DECLCALLBACK(int) pgmR3PhysPostCopyHandler(PVM pVM, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                                                  PGMACCESSTYPE enmAccessType, void *pvUser)
+{
+    NOREF(pvPhys); NOREF(pvUser);
+
+    RTGCPHYS GCPhysPage = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    int rc = pgmR3PhysPostCopyDemand(pVM, &GCPhysPage);
+    if (RT_FAILURE(rc))
+    {
+        pgmR3PhysPostCopyFatal(pVM, GCPhysPage, rc);
+        if (enmAccessType == PGMACCESSTYPE_READ)
+            memset(pvBuf, 0xff, cbBuf);
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * Writes go to the mapping the caller made writable before calling us,
+     * which is the page we've just filled.  For reads the caller may have
+     * mapped the zero page, so we do those ourselves.
+     */
+    if (enmAccessType == PGMACCESSTYPE_WRITE)
+        return VINF_PGM_HANDLER_DO_DEFAULT;
+    rc = PGMPhysSimpleReadGCPhys(pVM, pvBuf, GCPhys, cbBuf);
+    AssertLogRelMsgRC(rc, ("GCPhys=%RGp cbBuf=%#zx rc=%Rrc\n", GCPhys, cbBuf, rc));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Makes sure a page is present before handing out a direct mapping of it
+ * (target).
+ *
+ * Mappings ignore ALL access handlers on RAM pages, so the external mapping
+ * APIs have to call this first.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ * @param   GCPhys      The guest physical address.
+ * @thread  Any.  Non-EMT callers must not own the PGM lock.
+ */
+int pgmR3PhysPostCopyEnsurePage(PVM pVM, RTGCPHYS GCPhys)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (   !pPostCopy
+        || !pPostCopy->fHooked)
+        return VINF_SUCCESS;
+    uint64_t const iBit = GCPhys >> PAGE_SHIFT;
+    if (   iBit >= pPostCopy->cBits
+        || !ASMBitTest(pPostCopy->pbmPages, (int32_t)iBit))
+        return VINF_SUCCESS;
+
+    GCPhys &= ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    int rc;
+    if (VM_IS_EMT(pVM))
+        rc = pgmR3PhysPostCopyDemand(pVM, &GCPhys);
+    else
+        rc = VMR3ReqPriorityCallWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3PhysPostCopyDemand, 2, pVM, &GCPhys);
+    if (RT_FAILURE(rc))
+        pgmR3PhysPostCopyFatal(pVM, GCPhys, rc);
+    return rc;
+}
+
+
+/**
+ * Checks whether a page can be covered by a post-copy access handler.
+ *
+ * @returns true if it can, false if not.
+ * @param   pPage       The page.
+ */
+DECLINLINE(bool) pgmR3PhysPostCopyIsHookable(PPGMPAGE pPage)
+{
+    return PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM
+        && !PGM_PAGE_HAS_ANY_HANDLERS(pPage);
+}
+
+
+/**
+ * Finds the ranges of missing pages that can share an access handler
+ * (target).
+ *
+ * A range starts and ends with a missing page and consists of plain RAM pages
+ * without other access handlers, with at most @a cMaxGap present pages in a
+ * row.
+ *
+ * @returns The number of ranges found.
+ * @param   pVM         Pointer to the VM.
+ * @param   pPostCopy   The post-copy state.
+ * @param   cMaxGap     The max number of present pages in a row.
+ * @param   paFirst     Where to return the first addresses of the ranges.
+ *                      Optional, PGM_POST_COPY_MAX_HANDLERS entries.
+ * @param   paLast      Where to return the last addresses of the ranges.
+ *                      Optional, PGM_POST_COPY_MAX_HANDLERS entries.
+ */
+static uint32_t pgmR3PhysPostCopyFindRanges(PVM pVM, PPGMPOSTCOPY pPostCopy, uint32_t cMaxGap,
+                                            PRTGCPHYS paFirst, PRTGCPHYS paLast)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    uint32_t const          cBits  = pPostCopy->cBits;
+    uint32_t volatile const *pbm   = pPostCopy->pbmPages;
+    uint32_t                cRanges = 0;
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3)
+    {
+        uint32_t const iBitBase = (uint32_t)(pRam->GCPhys >> PAGE_SHIFT);
+        if (   PGM_RAM_RANGE_IS_AD_HOC(pRam)
+            || iBitBase >= cBits)
+            continue;
+        uint32_t const cPages = (uint32_t)RT_MIN(pRam->cb >> PAGE_SHIFT, cBits - iBitBase);
+
+        uint32_t iPage = 0;
+        for (;;)
+        {
+            int iBit = iBitBase + iPage == 0
+                     ? ASMBitFirstSet(pbm, cBits)
+                     : ASMBitNextSet(pbm, cBits, iBitBase + iPage - 1);
+            if (iBit < 0 || (uint32_t)iBit - iBitBase >= cPages)
+                break;
+            iPage = (uint32_t)iBit - iBitBase;
+            if (!pgmR3PhysPostCopyIsHookable(&pRam->aPages[iPage]))
+            {
+                iPage++;
+                continue;
+            }
+
+            uint32_t const iFirst = iPage;
+            uint32_t       iLast  = iPage;
+            for (iPage++; iPage < cPages && iPage - iLast <= cMaxGap; iPage++)
+            {
+                if (!pgmR3PhysPostCopyIsHookable(&pRam->aPages[iPage]))
+                    break;
+                if (ASMBitTest(pbm, (int32_t)(iBitBase + iPage)))
+                    iLast = iPage;
+            }
+            iPage = iLast + 1;
+
+            if (paFirst && cRanges < PGM_POST_COPY_MAX_HANDLERS)
+            {
+                paFirst[cRanges] = pRam->GCPhys + ((RTGCPHYS)iFirst << PAGE_SHIFT);
+                paLast[cRanges]  = pRam->GCPhys + ((RTGCPHYS)iLast  << PAGE_SHIFT) + PAGE_OFFSET_MASK;
+            }
+            cRanges++;
+        }
+    }
+    return cRanges;
+}
+
+
+/**
+ * EMT worker for PGMR3PhysPostCopyStart.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ * @param   pfnRequest  The page request callback.
+ * @param   pvUser      User argument for the callback.
+ */
+static DECLCALLBACK(int) pgmR3PhysPostCopyStartEMT(PVM pVM, PFNPGMPHYSPOSTCOPYREQUEST pfnRequest, void *pvUser)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    RTGCPHYS     aGCPhysFirst[PGM_POST_COPY_MAX_HANDLERS];
+    RTGCPHYS     aGCPhysLast[PGM_POST_COPY_MAX_HANDLERS];
+
+    pgmLock(pVM);
+    if (   !pPostCopy
+        || !pPostCopy->cPending)
+    {
+        pgmUnlock(pVM);
+        return VINF_SUCCESS;
+    }
+    AssertReturnStmt(!pPostCopy->fHooked, pgmUnlock(pVM), VERR_WRONG_ORDER);
+    pPostCopy->fAborted   = false;
+    RTSemEventMultiReset(pPostCopy->hEvtRequestsIdle);
+    pPostCopy->pfnRequest = pfnRequest;
+    pPostCopy->pvUser     = pvUser;
+    pPostCopy->cHandlers  = 0;
+    ASMAtomicWriteBool(&pPostCopy->fHooked, true);
+    uint32_t const cPendingAtStart = pPostCopy->cPending;
+
+    /*
+     * Find ranges to cover, widening the allowed gaps between missing pages
+     * until they fit the handler budget.
+     */
+    uint32_t cMaxGap = PGM_POST_COPY_MIN_GAP;
+    while (   pgmR3PhysPostCopyFindRanges(pVM, pPostCopy, cMaxGap, NULL, NULL) > PGM_POST_COPY_MAX_HANDLERS
+           && cMaxGap <= pPostCopy->cBits / 4)
+        cMaxGap *= 4;
+    uint32_t cRanges = pgmR3PhysPostCopyFindRanges(pVM, pPostCopy, cMaxGap, aGCPhysFirst, aGCPhysLast);
+    cRanges = RT_MIN(cRanges, PGM_POST_COPY_MAX_HANDLERS);
+    pgmUnlock(pVM);
+
+    /*
+     * Register the handlers and turn them off again for the pages we've got.
+     */
+    for (uint32_t i = 0; i < cRanges; i++)
+    {
+        int rc = PGMR3HandlerPhysicalRegister(pVM, PGMPHYSHANDLERTYPE_PHYSICAL_ALL, aGCPhysFirst[i], aGCPhysLast[i],
+                                              pgmR3PhysPostCopyHandler, NULL,
+                                              NULL /*pszModR0*/, NULL /*pszHandlerR0*/, NIL_RTR0PTR,
+                                              NULL /*pszModRC*/, NULL /*pszHandlerRC*/, NIL_RTRCPTR, "Post-copy teleportation");
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("PGM: Failed to register post-copy handler for %RGp-%RGp: %Rrc\n", aGCPhysFirst[i], aGCPhysLast[i], rc));
+            continue;
+        }
+
+        pgmLock(pVM);
+        pPostCopy->aGCPhysHandlers[pPostCopy->cHandlers++] = aGCPhysFirst[i];
+        for (RTGCPHYS GCPhys = aGCPhysFirst[i]; GCPhys < aGCPhysLast[i]; GCPhys += PAGE_SIZE)
+            if (!ASMBitTest(pPostCopy->pbmPages, (int32_t)(GCPhys >> PAGE_SHIFT)))
+                PGMHandlerPhysicalPageTempOff(pVM, aGCPhysFirst[i], GCPhys);
+        pgmUnlock(pVM);
+    }
+
+    /*
+     * Pull the missing pages we couldn't cover right away.
+     */
+    int rc = VINF_SUCCESS;
+    pgmLock(pVM);
+    uint32_t const cDemandedBefore = pPostCopy->cDemanded;
+    int iBit = ASMBitFirstSet(pPostCopy->pbmPages, pPostCopy->cBits);
+    while (iBit >= 0)
+    {
+        RTGCPHYS        GCPhys = (RTGCPHYS)iBit << PAGE_SHIFT;
+        PPGMPHYSHANDLER pCur   = pgmHandlerPhysicalLookup(pVM, GCPhys);
+        if (   !pCur
+            || pCur->pfnHandlerR3 != pgmR3PhysPostCopyHandler)
+        {
+            pgmUnlock(pVM);
+            rc = pgmR3PhysPostCopyDemand(pVM, &GCPhys);
+            pgmLock(pVM);
+            if (RT_FAILURE(rc))
+                break;
+        }
+        iBit = ASMBitNextSet(pPostCopy->pbmPages, pPostCopy->cBits, iBit);
+    }
+    pPostCopy->cFetchedUnhooked = pPostCopy->cDemanded - cDemandedBefore;
+    pPostCopy->cDemanded        = cDemandedBefore;
+    pgmUnlock(pVM);
+
+    LogRel(("PGM: Post-copy started: %u pages missing, %u access handlers (max gap %u pages), %u pages fetched up front\n",
+            cPendingAtStart, pPostCopy->cHandlers, cMaxGap, pPostCopy->cFetchedUnhooked));
+    return rc;
+}
+
+
+/**
+ * Arms the next live save for a post-copy teleportation (source).
+ *
+ * The live save will vote for the final pass after the first full pass over
+ * the memory.  The final pass skips the content of the RAM pages dirtied
+ * since, which must then be served from PGMR3PhysPostCopyReadPage after the
+ * save has completed.  The arming is undone when the save completes.
+ *
+ * @returns VBox status code.
+ * @param   pUVM        The user mode VM handle.
+ * @thread  Any.
+ */
+VMMR3DECL(int) PGMR3PhysPostCopyArm(PUVM pUVM)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+
+    pgmLock(pVM);
+    int rc = VINF_SUCCESS;
+    if (pVM->pgm.s.LiveSave.fActive)
+        rc = VERR_INVALID_STATE;
+    else
+        rc = pgmR3PhysPostCopyInitBitmap(pVM);
+    if (RT_SUCCESS(rc))
+        pVM->pgm.s.pPostCopyR3->fSourceArmed = true;
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
+/**
+ * Reads a page deferred by a post-copy teleportation (source).
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND if all deferred pages have been read.
+ *
+ * @param   pUVM        The user mode VM handle.
+ * @param   pGCPhys     On input the guest physical address of the page the
+ *                      target is asking for, or NIL_RTGCPHYS for the next
+ *                      deferred page.  On output the address of the page
+ *                      returned.
+ * @param   pvPage      Where to return the page content (PAGE_SIZE).
+ * @thread  Any.  The VM must be suspended.
+ */
+VMMR3DECL(int) PGMR3PhysPostCopyReadPage(PUVM pUVM, PRTGCPHYS pGCPhys, void *pvPage)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pGCPhys, VERR_INVALID_POINTER);
+    AssertPtrReturn(pvPage, VERR_INVALID_POINTER);
+
+    pgmLock(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (   !pPostCopy
+        || !pPostCopy->pbmPages
+        || pPostCopy->fHooked)
+    {
+        pgmUnlock(pVM);
+        return VERR_INVALID_STATE;
+    }
+
+    /*
+     * Pick the page.
+     */
+    RTGCPHYS GCPhys = *pGCPhys;
+    if (GCPhys == NIL_RTGCPHYS)
+    {
+        if (!pPostCopy->cPending)
+        {
+            pgmUnlock(pVM);
+            return VERR_NOT_FOUND;
+        }
+        int iBit = pPostCopy->iNext > 0 && pPostCopy->iNext < pPostCopy->cBits
+                 ? ASMBitNextSet(pPostCopy->pbmPages, pPostCopy->cBits, pPostCopy->iNext - 1)
+                 : -1;
+        if (iBit < 0)
+            iBit = ASMBitFirstSet(pPostCopy->pbmPages, pPostCopy->cBits);
+        AssertLogRelMsgReturnStmt(iBit >= 0, ("cPending=%u\n", pPostCopy->cPending),
+                                  pPostCopy->cPending = 0; pgmUnlock(pVM), VERR_NOT_FOUND);
+        pPostCopy->iNext = (uint32_t)iBit + 1;
+        GCPhys = (RTGCPHYS)iBit << PAGE_SHIFT;
+    }
+    else
+        AssertMsgReturnStmt(!(GCPhys & PAGE_OFFSET_MASK), ("%RGp\n", GCPhys), pgmUnlock(pVM), VERR_INVALID_PARAMETER);
+
+    /*
+     * Copy it.  Explicit requests are served even if the page has been pushed
+     * already, the target will just drop the duplicate.
+     */
+    PPGMPAGE pPage;
+    int rc = pgmPhysGetPageEx(pVM, GCPhys, &pPage);
+    if (RT_SUCCESS(rc))
+    {
+        if (PGM_PAGE_IS_MMIO_OR_SPECIAL_ALIAS(pPage))
+            rc = VERR_PGM_PHYS_PAGE_RESERVED;
+        else
+        {
+            PGMPAGEMAPLOCK  PgMpLck;
+            void const     *pvSrcPage;
+            rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pPage, GCPhys, &pvSrcPage, &PgMpLck);
+            if (RT_SUCCESS(rc))
+            {
+                memcpy(pvPage, pvSrcPage, PAGE_SIZE);
+                pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+            }
+        }
+    }
+    uint64_t const iBit = GCPhys >> PAGE_SHIFT;
+    if (   iBit < pPostCopy->cBits
+        && ASMBitTestAndClear(pPostCopy->pbmPages, (int32_t)iBit))
+        pPostCopy->cPending--;
+    pgmUnlock(pVM);
+
+    *pGCPhys = GCPhys;
+    return rc;
+}
+
+
+/**
+ * Gets the number of pages the post-copy phase still has to transfer.
+ *
+ * On the source this is the number of deferred pages not yet read, on the
+ * target the number of pages still missing plus the number of page requests
+ * in progress.  Once it drops to zero on the target, the request callback
+ * will not be called again.
+ *
+ * @returns Number of pages, 0 if no post-copy teleportation is in progress or
+ *          the handle is invalid.
+ * @param   pUVM        The user mode VM handle.
+ */
+VMMR3DECL(uint32_t) PGMR3PhysPostCopyGetPending(PUVM pUVM)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, 0);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, 0);
+
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+        return 0;
+    return ASMAtomicReadU32(&pPostCopy->cPending) + ASMAtomicReadU32(&pPostCopy->cRequestsActive);
+}
+
+
+/**
+ * Starts the post-copy phase on the target after the state has been loaded.
+ *
+ * Must be called before the VM is resumed.  Covers the pages still missing
+ * with access handlers which request them via @a pfnRequest on first access.
+ * The transport passes all pages it receives to PGMR3PhysPostCopyPutPage.
+ * Does nothing if no pages are missing.
+ *
+ * @returns VBox status code.
+ * @param   pUVM        The user mode VM handle.
+ * @param   pfnRequest  Callback requesting a page from the source.  Will be
+ *                      called on EMTs until the last page has arrived, and
+ *                      already by this function for missing pages that
+ *                      can't be covered.
+ * @param   pvUser      User argument for the callback.
+ * @thread  Any.
+ */
+VMMR3DECL(int) PGMR3PhysPostCopyStart(PUVM pUVM, PFNPGMPHYSPOSTCOPYREQUEST pfnRequest, void *pvUser)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pfnRequest, VERR_INVALID_POINTER);
+
+    return VMR3ReqCallWaitU(pUVM, VMCPUID_ANY, (PFNRT)pgmR3PhysPostCopyStartEMT, 3, pUVM->pVM, pfnRequest, pvUser);
+}
+
+
+/**
+ * Stops calling the page request callback (target).
+ *
+ * For use when the link to the source has failed.  Accesses to pages still
+ * missing are fatal from now on.  Returns once no request callback is in
+ * progress any more, so the transport can be torn down afterwards.
+ *
+ * @returns VBox status code.
+ * @param   pUVM        The user mode VM handle.
+ * @thread  Any but EMT.
+ */
+VMMR3DECL(int) PGMR3PhysPostCopyAbort(PUVM pUVM)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    VM_ASSERT_OTHER_THREAD(pVM);
+
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+        return VINF_SUCCESS;
+
+    pgmLock(pVM);
+    ASMAtomicWriteBool(&pPostCopy->fAborted, true);
+    pgmUnlock(pVM);
+
+    /* Release a transport thread waiting for room in the staging tree. */
+    RTSemEventSignal(pPostCopy->hEvtStagedRoom);
+
+    /*
+     * No new requests can start now that fAborted is set, and the one
+     * dropping cRequestsActive to zero signals the event.  The event stays
+     * signalled until the next post-copy phase starts.
+     */
+    while (ASMAtomicReadU32(&pPostCopy->cRequestsActive) > 0)
+    {
+        int rc = RTSemEventMultiWait(pPostCopy->hEvtRequestsIdle, RT_INDEFINITE_WAIT);
+        AssertLogRelRCReturn(rc, rc);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Hands a page received from the post-copy source to PGM (target).
+ *
+ * The page is staged and installed by an EMT.  Pages that aren't missing
+ * (duplicates) are ignored.  When called on a non-EMT thread, this waits
+ * while PGM_POST_COPY_MAX_STAGED pages are waiting for the EMTs already,
+ * except while a page request is in progress or after
+ * PGMR3PhysPostCopyAbort.
+ *
+ * @returns VBox status code.
+ * @param   pUVM        The user mode VM handle.
+ * @param   GCPhys      The guest physical address of the page.
+ * @param   pvPage      The page content (PAGE_SIZE).
+ * @thread  Any.
+ */
+VMMR3DECL(int) PGMR3PhysPostCopyPutPage(PUVM pUVM, RTGCPHYS GCPhys, void const *pvPage)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pvPage, VERR_INVALID_POINTER);
+    AssertMsgReturn(!(GCPhys & PAGE_OFFSET_MASK), ("%RGp\n", GCPhys), VERR_INVALID_PARAMETER);
+
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy && pPostCopy->pbmPages, VERR_INVALID_STATE);
+    uint64_t const iBit = GCPhys >> PAGE_SHIFT;
+    if (   iBit >= pPostCopy->cBits
+        || !ASMBitTest(pPostCopy->pbmPages, (int32_t)iBit))
+        return VINF_SUCCESS;
+
+    /*
+     * Apply backpressure if the EMTs are falling behind.  An EMT waiting for
+     * a page request can't install anything, so don't wait while one is in
+     * progress as the request could never complete otherwise.
+     */
+    if (!VM_IS_EMT(pVM))
+        while (   ASMAtomicReadU32(&pPostCopy->cStaged) >= PGM_POST_COPY_MAX_STAGED
+               && !ASMAtomicReadU32(&pPostCopy->cRequestsActive)
+               && !ASMAtomicReadBool(&pPostCopy->fAborted))
+        {
+            int rc = RTSemEventWait(pPostCopy->hEvtStagedRoom, RT_INDEFINITE_WAIT);
+            AssertLogRelRCReturn(rc, rc);
+        }
+
+    PPGMPOSTCOPYSTAGEDPAGE pStaged = (PPGMPOSTCOPYSTAGEDPAGE)RTMemAlloc(sizeof(*pStaged));
+    if (!pStaged)
+        return VERR_NO_MEMORY;
+    pStaged->Core.Key = GCPhys;
+    memcpy(pStaged->abPage, pvPage, PAGE_SIZE);
+
+    pgmLock(pVM);
+    bool const fStaged = ASMBitTest(pPostCopy->pbmPages, (int32_t)iBit)
+                      && RTAvlGCPhysInsert(&pPostCopy->StagedTree, &pStaged->Core);
+    if (fStaged)
+        ASMAtomicIncU32(&pPostCopy->cStaged);
+    pgmUnlock(pVM);
+    if (!fStaged)
+    {
+        RTMemFree(pStaged);
+        return VINF_SUCCESS;
+    }
+
+    return VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3PhysPostCopyInstallStaged, 1, pVM);
+}
+
@@ -25,8 +25,10 @@
 #include <VBox/vmm/ssm.h>
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmdev.h>
+#include <VBox/sup.h>
 #include "PGMInternal.h"
 #include <VBox/vmm/vm.h>
+#include <VBox/vmm/uvm.h>
 #include "PGMInline.h"
 
 #include <VBox/param.h>
@@ -46,7 +48,10 @@
 *   Defined Constants And Macros                                               *
 *******************************************************************************/
 /** Saved state data unit version.  */
-#define PGM_SAVED_STATE_VERSION                 14
+#define PGM_SAVED_STATE_VERSION                 15
+/** Saved state data unit version before duplicate RAM pages were saved as
+ *  references (PGM_STATE_REC_RAM_DUP). */
+#define PGM_SAVED_STATE_VERSION_PRE_DUP_PAGES   14
 /** Saved state data unit version before the PAE PDPE registers. */
 #define PGM_SAVED_STATE_VERSION_PRE_PAE         13
 /** Saved state data unit version after this includes ballooned page flags in
@@ -87,8 +92,14 @@
 #define PGM_STATE_REC_ROM_PROT          UINT8_C(0x07)
 /** Ballooned page. No data. */
 #define PGM_STATE_REC_RAM_BALLOONED     UINT8_C(0x08)
+/** RAM page which content is transferred after the target has resumed
+ *  (post-copy teleportation, see PGMPostCopy.cpp).  No data. */
+#define PGM_STATE_REC_RAM_REMOTE        UINT8_C(0x09)
+/** RAM page with the same content as a page saved earlier in the same pass.
+ *  Followed by the RTGCPHYS of that page. */
+#define PGM_STATE_REC_RAM_DUP           UINT8_C(0x0a)
 /** The last record type. */
-#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BALLOONED
+#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_DUP
 /** End marker. */
 #define PGM_STATE_REC_END               UINT8_C(0xff)
 /** Flag indicating that the data is preceded by the page address.
@@ -1058,6 +1069,45 @@ static void pgmR3DoneMmio2Pages(PVM pVM)
 }
 
 
+/**
+ * Gets the bitmap of pages pending saving that trails the live save tracking
+ * array of a RAM range.
+ *
+ * @returns Pointer to the bitmap.
+ * @param   pCur                The RAM range. paLSPages must be valid.
+ */
+DECLINLINE(uint32_t *) pgmR3LiveRamPendingBitmap(PPGMRAMRANGE pCur)
+{
+    return (uint32_t *)&pCur->paLSPages[pCur->cb >> PAGE_SHIFT];
+}
+
+
+/**
+ * Gets the next RAM page to visit according to a bitmap.
+ *
+ * @returns Index of the next page at or after @a iPage, @a cPages if none.
+ * @param   pbm                 The bitmap.  NULL means every page.
+ * @param   cBits               The size of the bitmap (multiple of 32).
+ * @param   iBitBase            The bit corresponding to the first page.
+ * @param   iPage               The page to start at.
+ * @param   cPages              The number of pages in the range.
+ */
+DECLINLINE(uint32_t) pgmR3LiveRamNextPage(uint32_t const volatile *pbm, uint32_t cBits, uint32_t iBitBase,
+                                          uint32_t iPage, uint32_t cPages)
+{
+    if (!pbm)
+        return iPage;
+    if (iPage >= cPages)
+        return cPages;
+    if (ASMBitTest(pbm, iBitBase + iPage))
+        return iPage;
+    int iBit = ASMBitNextSet(pbm, cBits, iBitBase + iPage);
+    if (iBit < 0 || (uint32_t)iBit - iBitBase >= cPages)
+        return cPages;
+    return (uint32_t)iBit - iBitBase;
+}
+
+
 /**
  * Prepares the RAM pages for a live save.
  *
@@ -1089,7 +1139,9 @@ static int pgmR3PrepRamPages(PVM pVM)
                 uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
                 uint32_t const  cPages = pCur->cb >> PAGE_SHIFT;
                 pgmUnlock(pVM);
-                PPGMLIVESAVERAMPAGE paLSPages = (PPGMLIVESAVERAMPAGE)MMR3HeapAllocZ(pVM, MM_TAG_PGM, cPages * sizeof(PGMLIVESAVERAMPAGE));
+                PPGMLIVESAVERAMPAGE paLSPages = (PPGMLIVESAVERAMPAGE)MMR3HeapAllocZ(pVM, MM_TAG_PGM,
+                                                                                     cPages * sizeof(PGMLIVESAVERAMPAGE)
+                                                                                   + RT_ALIGN_32(cPages, 32) / 8);
                 if (!paLSPages)
                     return VERR_NO_MEMORY;
                 pgmLock(pVM);
@@ -1103,8 +1155,9 @@ static int pgmR3PrepRamPages(PVM pVM)
                 pCur->paLSPages = paLSPages;
 
                 /*
-                 * Initialize the array.
+                 * Initialize the array and the pending save bitmap trailing it.
                  */
+                uint32_t *pbmPending = pgmR3LiveRamPendingBitmap(pCur);
                 uint32_t iPage = cPages;
                 while (iPage-- > 0)
                 {
@@ -1144,6 +1197,7 @@ static int pgmR3PrepRamPages(PVM pVM)
 #endif
                             }
                             paLSPages[iPage].fIgnore     = 0;
+                            ASMBitSet(pbmPending, iPage);
                             pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
                             break;
 
@@ -1191,8 +1245,51 @@ static int pgmR3PrepRamPages(PVM pVM)
             }
         }
     } while (pCur);
+
+    /*
+     * Allocate the dirty log covering all guest physical pages up to the end
+     * of the last RAM range.  This is optional, without it (or when the fault
+     * paths couldn't record a change in it) we simply scan all the pages.
+     */
+    uint64_t cLogPages = 0;
+    for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        if (!PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            cLogPages = RT_MAX(cLogPages, (pCur->GCPhysLast >> PAGE_SHIFT) + 1);
+    pVM->pgm.s.LiveSave.fDirtyLogIncomplete = true; /* the first scan visits everything. */
     pgmUnlock(pVM);
 
+    size_t const cLogChunkPages = RT_ALIGN_Z(cLogPages, PAGE_SIZE * 8) / (PAGE_SIZE * 8);
+    if (cLogPages > 0 && cLogPages < _1G)
+    {
+        void   *pvLog  = NULL;
+        RTR0PTR R0PtrLog = NIL_RTR0PTR;
+        int rc = SUPR3PageAllocEx(cLogChunkPages, 0 /*fFlags*/, &pvLog,
+#ifdef VBOX_WITH_2X_4GB_ADDR_SPACE
+                                  HMIsEnabled(pVM) ? &R0PtrLog : NULL,
+#else
+                                  NULL,
+#endif
+                                  NULL /*paPages*/);
+        if (RT_SUCCESS(rc))
+        {
+#ifdef VBOX_WITH_2X_4GB_ADDR_SPACE
+            if (!HMIsEnabled(pVM))
+                R0PtrLog = NIL_RTR0PTR;
+#else
+            R0PtrLog = (uintptr_t)pvLog;
+#endif
+            memset(pvLog, 0, cLogChunkPages << PAGE_SHIFT);
+
+            pgmLock(pVM);
+            pVM->pgm.s.LiveSave.pbmDirtyLogR3   = (uint32_t volatile *)pvLog;
+            pVM->pgm.s.LiveSave.pbmDirtyLogR0   = (R0PTRTYPE(uint32_t volatile *))R0PtrLog;
+            pVM->pgm.s.LiveSave.cDirtyLogPages  = (uint32_t)(cLogChunkPages * PAGE_SIZE * 8);
+            pgmUnlock(pVM);
+        }
+        else
+            LogRel(("PGM: Failed to allocate %zu pages for the live save dirty log: %Rrc\n", cLogChunkPages, rc));
+    }
+
     return VINF_SUCCESS;
 }
 
@@ -1332,17 +1429,37 @@ static void pgmR3StateVerifyCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVE
 /**
  * Scan for RAM page modifications and reprotect them.
  *
+ * The first and the final scan visit all the pages, the ones in-between only
+ * visits the pages flagged in the dirty log (if it's complete).
+ *
  * @param   pVM                 Pointer to the VM.
  * @param   fFinalPass          Whether this is the final pass or not.
  */
 static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
 {
+    /*
+     * Decide whether we can get away with only visiting the pages in the
+     * dirty log.  When doing a full scan, we start a fresh log.
+     */
+    pgmLock(pVM);
+    uint32_t volatile * const pbmDirtyLog    = pVM->pgm.s.LiveSave.pbmDirtyLogR3;
+    uint32_t const            cDirtyLogPages = pVM->pgm.s.LiveSave.cDirtyLogPages;
+    bool const                fFullScan      = fFinalPass
+                                            || !pbmDirtyLog
+                                            || pVM->pgm.s.LiveSave.fDirtyLogIncomplete;
+    if (fFullScan && pbmDirtyLog)
+    {
+        ASMMemZero32((void *)pbmDirtyLog, cDirtyLogPages / 8);
+        pVM->pgm.s.LiveSave.fDirtyLogIncomplete = false;
+    }
+    uint32_t cDirtied = 0;
+    uint32_t cVisited = 0;
+
     /*
      * The RAM.
      */
     RTGCPHYS GCPhysCur = 0;
     PPGMRAMRANGE pCur;
-    pgmLock(pVM);
     do
     {
         uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
@@ -1353,14 +1470,21 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
             {
                 PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
                 uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
+                uint32_t * const pbmPending = pgmR3LiveRamPendingBitmap(pCur);
+                uint32_t const   iLogBase  = (uint32_t)(pCur->GCPhys >> PAGE_SHIFT);
+                uint32_t volatile *pbmLog  = pbmDirtyLog && (pCur->GCPhysLast >> PAGE_SHIFT) < cDirtyLogPages
+                                           ? pbmDirtyLog : NULL;
+                uint32_t volatile *pbmVisit = fFullScan ? NULL : pbmLog;
                 uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
                 GCPhysCur = 0;
-                for (; iPage < cPages; iPage++)
+                for (iPage = pgmR3LiveRamNextPage(pbmVisit, cDirtyLogPages, iLogBase, iPage, cPages);
+                     iPage < cPages;
+                     iPage = pgmR3LiveRamNextPage(pbmVisit, cDirtyLogPages, iLogBase, iPage + 1, cPages))
                 {
                     /* Do yield first. */
                     if (   !fFinalPass
 #ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
-                        && (iPage & 0x7ff) == 0x100
+                        && (cVisited & 0x7ff) == 0x100
 #endif
                         && PDMR3CritSectYield(&pVM->pgm.s.CritSectX)
                         && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
@@ -1368,6 +1492,9 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                         GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
                         break; /* restart */
                     }
+                    cVisited++;
+                    if (pbmVisit)
+                        ASMBitClear(pbmVisit, iLogBase + iPage);
 
                     /* Skip already ignored pages. */
                     if (paLSPages[iPage].fIgnore)
@@ -1406,6 +1533,7 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                                     pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
                                     if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
                                         paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                                    cDirtied++;
                                 }
 
                                 pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
@@ -1444,6 +1572,7 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                                         pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
                                         if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
                                             paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                                        cDirtied++;
                                     }
                                 }
                                 break;
@@ -1457,6 +1586,7 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                                         paLSPages[iPage].fDirty = 1;
                                         pVM->pgm.s.LiveSave.Ram.cReadyPages--;
                                         pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                                        cDirtied++;
                                     }
                                     paLSPages[iPage].fZero = 1;
                                     paLSPages[iPage].fShared = 0;
@@ -1476,6 +1606,7 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                                         if (paLSPages[iPage].fZero)
                                             pVM->pgm.s.LiveSave.Ram.cZeroPages--;
                                         pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                                        cDirtied++;
                                     }
                                     paLSPages[iPage].fZero = 0;
                                     paLSPages[iPage].fShared = 1;
@@ -1485,6 +1616,14 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                                 }
                                 break;
                         }
+
+                        /* Pages that was (re)monitored or is write locked must
+                           be revisited by the next scan, and dirty ones are
+                           pending saving. */
+                        if (pbmLog && paLSPages[iPage].fWriteMonitoredJustNow)
+                            ASMBitSet(pbmLog, iLogBase + iPage);
+                        if (paLSPages[iPage].fDirty)
+                            ASMBitSet(pbmPending, iPage);
                     }
                     else
                     {
@@ -1532,7 +1671,107 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
             }
         } /* for each range */
     } while (pCur);
+
+    /*
+     * Update the dirty rate estimate.  Only pages going from ready to dirty
+     * count, so the first scan (where everything is dirty) yields zero.
+     */
+    uint64_t const uNowNS = RTTimeNanoTS();
+    if (!fFinalPass)
+    {
+        uint64_t const cNsElapsed = uNowNS - pVM->pgm.s.LiveSave.uLastScanNS;
+        if (cNsElapsed > 0)
+            pVM->pgm.s.LiveSave.cDirtiedPagesPerSecond = (uint32_t)RT_MIN(cDirtied * UINT64_C(1000000000) / cNsElapsed,
+                                                                          UINT32_MAX);
+    }
+    pVM->pgm.s.LiveSave.uLastScanNS = uNowNS;
     pgmUnlock(pVM);
+    Log(("pgmR3ScanRamPages: %s scan visited %u pages, %u newly dirtied\n", fFullScan ? "full" : "logged", cVisited, cDirtied));
+}
+
+
+/**
+ * Scans a RAM page for the saved page cache.
+ *
+ * Checks for zeros and calculates the content hash in a single pass.  The
+ * hash only picks the candidate in the cache, matches are always confirmed
+ * by comparing the content.
+ *
+ * @returns The content hash, 0 if the page is all zeros.
+ * @param   pbPage              The page content.
+ */
+static uint64_t pgmR3StateHashPage(uint8_t const *pbPage)
+{
+    uint64_t const *pu64  = (uint64_t const *)pbPage;
+    uint64_t        uOr   = 0;
+    uint64_t        uHash0 = UINT64_C(0xcbf29ce484222325);
+    uint64_t        uHash1 = UINT64_C(0x84222325cbf29ce4);
+    uint64_t        uHash2 = UINT64_C(0x9e3779b97f4a7c15);
+    uint64_t        uHash3 = UINT64_C(0x7f4a7c159e3779b9);
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 4)
+    {
+        uOr   |= pu64[i] | pu64[i + 1] | pu64[i + 2] | pu64[i + 3];
+        uHash0 = (uHash0 ^ pu64[i    ]) * UINT64_C(0x100000001b3);
+        uHash1 = (uHash1 ^ pu64[i + 1]) * UINT64_C(0x100000001b3);
+        uHash2 = (uHash2 ^ pu64[i + 2]) * UINT64_C(0x100000001b3);
+        uHash3 = (uHash3 ^ pu64[i + 3]) * UINT64_C(0x100000001b3);
+    }
+    if (!uOr)
+        return 0;
+
+    uint64_t uHash = uHash0 ^ ASMRotateLeftU64(uHash1, 16) ^ ASMRotateLeftU64(uHash2, 32) ^ ASMRotateLeftU64(uHash3, 48);
+    uHash ^= uHash >> 29;
+    uHash *= UINT64_C(0xbf58476d1ce4e5b9);
+    uHash ^= uHash >> 32;
+    return uHash | 1;
+}
+
+
+/**
+ * Looks up a RAM page about to be saved in the saved page cache.
+ *
+ * If no page saved earlier in this pass had the same content, this page
+ * replaces the cache entry.
+ *
+ * @returns The address of the page to save a reference to, NIL_RTGCPHYS if
+ *          the page must be saved raw.
+ * @param   pVM                 Pointer to the VM.
+ * @param   pbPage              The page content.
+ * @param   uHash               The content hash (pgmR3StateHashPage).
+ * @param   GCPhys              The address of the page.
+ */
+static RTGCPHYS pgmR3StateLookupDupPage(PVM pVM, uint8_t const *pbPage, uint64_t uHash, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMSAVEDUPPAGE pEntry = &pVM->pgm.s.paSaveDupPagesR3[uHash >> (64 - PGM_SAVE_DUP_PAGES_SHIFT)];
+    if (   pEntry->uHash == uHash
+        && pEntry->GCPhys != NIL_RTGCPHYS)
+    {
+        /* The page may have changed since it was saved, in which case it
+           won't match any longer. */
+        PPGMPAGE pPage;
+        int rc = pgmPhysGetPageEx(pVM, pEntry->GCPhys, &pPage);
+        if (   RT_SUCCESS(rc)
+            && PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM
+            && !PGM_PAGE_IS_ZERO(pPage)
+            && !PGM_PAGE_IS_BALLOONED(pPage))
+        {
+            PGMPAGEMAPLOCK  PgMpLck;
+            void const     *pvPage;
+            rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pPage, pEntry->GCPhys, &pvPage, &PgMpLck);
+            if (RT_SUCCESS(rc))
+            {
+                bool const fSame = !memcmp(pvPage, pbPage, PAGE_SIZE);
+                pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                if (fSame)
+                    return pEntry->GCPhys;
+            }
+        }
+    }
+
+    pEntry->uHash  = uHash;
+    pEntry->GCPhys = GCPhys;
+    return NIL_RTGCPHYS;
 }
 
 
@@ -1547,8 +1786,6 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
  */
 static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t uPass)
 {
-    NOREF(fLiveSave);
-
     /*
      * The RAM.
      */
@@ -1556,11 +1793,33 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
     RTGCPHYS GCPhysCur = 0;
     PPGMRAMRANGE pCur;
     bool fFTMDeltaSaveActive = FTMIsDeltaLoadSaveActive(pVM);
+    uint32_t cVisited = 0;
+    PPGMPOSTCOPY pPostCopy = fLiveSave && uPass == SSM_PASS_FINAL
+                          && pVM->pgm.s.pPostCopyR3 && pVM->pgm.s.pPostCopyR3->fSourceArmed
+                           ? pVM->pgm.s.pPostCopyR3 : NULL;
+
+    /*
+     * Duplicate pages are saved as references to the first page of the pass
+     * with the same content.  The target has to see the referenced page in
+     * the state we saved it, so the cache must only contain pages saved in
+     * this pass.  FT delta saves keep things as they are.
+     */
+    PPGMSAVEDUPPAGE paDupPages = pVM->pgm.s.paSaveDupPagesR3;
+    if (!paDupPages && !fFTMDeltaSaveActive)
+    {
+        paDupPages = (PPGMSAVEDUPPAGE)MMR3HeapAlloc(pVM, MM_TAG_PGM, sizeof(PGMSAVEDUPPAGE) << PGM_SAVE_DUP_PAGES_SHIFT);
+        pVM->pgm.s.paSaveDupPagesR3 = paDupPages;
+    }
+    if (fFTMDeltaSaveActive)
+        paDupPages = NULL;
 
     pgmLock(pVM);
     do
     {
         uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+        /* Restarts may revisit pages, so forget what we've saved so far. */
+        if (paDupPages)
+            memset(paDupPages, 0xff, sizeof(PGMSAVEDUPPAGE) << PGM_SAVE_DUP_PAGES_SHIFT);
         for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
         {
             if (   pCur->GCPhysLast > GCPhysCur
@@ -1568,13 +1827,17 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
             {
                 PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
                 uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
+                uint32_t        *pbmPending = paLSPages && uPass != SSM_PASS_FINAL
+                                            ? pgmR3LiveRamPendingBitmap(pCur) : NULL;
                 uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
                 GCPhysCur = 0;
-                for (; iPage < cPages; iPage++)
+                for (iPage = pgmR3LiveRamNextPage(pbmPending, RT_ALIGN_32(cPages, 32), 0, iPage, cPages);
+                     iPage < cPages;
+                     iPage = pgmR3LiveRamNextPage(pbmPending, RT_ALIGN_32(cPages, 32), 0, iPage + 1, cPages))
                 {
                     /* Do yield first. */
                     if (   uPass != SSM_PASS_FINAL
-                        && (iPage & 0x7ff) == 0x100
+                        && (cVisited++ & 0x7ff) == 0x100
                         && PDMR3CritSectYield(&pVM->pgm.s.CritSectX)
                         && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
                     {
@@ -1590,12 +1853,14 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                     if (    uPass != SSM_PASS_FINAL
                         &&  paLSPages)
                     {
-                        if (!paLSPages[iPage].fDirty)
+                        if (   !paLSPages[iPage].fDirty
+                            || paLSPages[iPage].fIgnore)
+                        {
+                            ASMBitClear(pbmPending, iPage);
                             continue;
+                        }
                         if (paLSPages[iPage].fWriteMonitoredJustNow)
                             continue;
-                        if (paLSPages[iPage].fIgnore)
-                            continue;
                         if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM) /* in case of recent remappings */
                             continue;
                         if (    PGM_PAGE_GET_STATE(pCurPage)
@@ -1633,7 +1898,27 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                     bool        fBallooned = PGM_PAGE_IS_BALLOONED(pCurPage);
                     bool        fSkipped = false;
 
-                    if (!fZero && !fBallooned)
+                    if (   pPostCopy
+                        && !fZero
+                        && !fBallooned
+                        && (GCPhys >> PAGE_SHIFT) < pPostCopy->cBits)
+                    {
+                        /*
+                         * Leave the page to the post-copy phase of the teleportation.
+                         */
+                        if (!ASMAtomicBitTestAndSet(pPostCopy->pbmPages, (int32_t)(GCPhys >> PAGE_SHIFT)))
+                            pPostCopy->cPending++;
+                        pgmUnlock(pVM);
+
+                        if (GCPhys == GCPhysLast + PAGE_SIZE)
+                            rc = SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_REMOTE);
+                        else
+                        {
+                            SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_REMOTE | PGM_STATE_REC_FLAG_ADDR);
+                            rc = SSMR3PutGCPhys(pSSM, GCPhys);
+                        }
+                    }
+                    else if (!fZero && !fBallooned)
                     {
                         /*
                          * Copy the page and then save it outside the lock (since any
@@ -1642,6 +1927,8 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         uint8_t         abPage[PAGE_SIZE];
                         PGMPAGEMAPLOCK  PgMpLck;
                         void const     *pvPage;
+                        uint64_t        uHash     = 0;
+                        RTGCPHYS        GCPhysDup = NIL_RTGCPHYS;
                         rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pCurPage, GCPhys, &pvPage, &PgMpLck);
                         if (RT_SUCCESS(rc))
                         {
@@ -1651,12 +1938,16 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 pgmR3StateVerifyCrc32ForPage(abPage, pCur, paLSPages, iPage, "save#3");
 #endif
                             pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+
+                            uHash = pgmR3StateHashPage(abPage);
+                            if (uHash && paDupPages)
+                                GCPhysDup = pgmR3StateLookupDupPage(pVM, abPage, uHash, GCPhys);
                         }
                         pgmUnlock(pVM);
                         AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys), rc);
 
                         /* Try save some memory when restoring. */
-                        if (!ASMMemIsZeroPage(pvPage))
+                        if (uHash)
                         {
                             if (fFTMDeltaSaveActive)
                             {
@@ -1678,6 +1969,18 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 else
                                     fSkipped = true;
                             }
+                            else if (GCPhysDup != NIL_RTGCPHYS)
+                            {
+                                if (GCPhys == GCPhysLast + PAGE_SIZE)
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP);
+                                else
+                                {
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP | PGM_STATE_REC_FLAG_ADDR);
+                                    SSMR3PutGCPhys(pSSM, GCPhys);
+                                }
+                                rc = SSMR3PutGCPhys(pSSM, GCPhysDup);
+                                ASMAtomicIncU32(&pVM->pgm.s.cSaveDupPages);
+                            }
                             else
                             {
                                 if (GCPhys == GCPhysLast + PAGE_SIZE)
@@ -1730,6 +2033,8 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                     if (paLSPages)
                     {
                         paLSPages[iPage].fDirty = 0;
+                        if (pbmPending)
+                            ASMBitClear(pbmPending, iPage);
                         pVM->pgm.s.LiveSave.Ram.cReadyPages++;
                         if (fZero)
                             pVM->pgm.s.LiveSave.Ram.cZeroPages++;
@@ -1817,10 +2122,19 @@ static void pgmR3DoneRamPages(PVM pVM)
     else
         pVM->pgm.s.cMonitoredPages -= cMonitoredPages;
 
+    /* Detach the dirty log. */
+    void *pvLog = (void *)pVM->pgm.s.LiveSave.pbmDirtyLogR3;
+    size_t const cLogChunkPages = pVM->pgm.s.LiveSave.cDirtyLogPages / (PAGE_SIZE * 8);
+    pVM->pgm.s.LiveSave.pbmDirtyLogR3  = NULL;
+    pVM->pgm.s.LiveSave.pbmDirtyLogR0  = NIL_RTR0PTR;
+    pVM->pgm.s.LiveSave.cDirtyLogPages = 0;
+
     pgmUnlock(pVM);
 
     MMR3HeapFree(pvToFree);
     pvToFree = NULL;
+    if (pvLog)
+        SUPR3PageFreeEx(pvLog, cLogChunkPages);
 }
 
 
@@ -1942,6 +2256,19 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
                                           / ((long double)cNsElapsed / 1000000000.0) );
     pVM->pgm.s.LiveSave.cPagesPerSecond = cPagesPerSecond;
 
+    /*
+     * A post-copy teleportation is done after one full pass, the target
+     * pulls whatever has been dirtied since once it is running.
+     */
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (   pPostCopy
+        && pPostCopy->fSourceArmed
+        && uPass >= 1)
+    {
+        Log(("pgmR3LiveVote: VINF_SUCCESS - pass=%d post-copy cDirtyNow=%u\n", uPass, cDirtyNow));
+        return VINF_SUCCESS;
+    }
+
     /*
      * Try make a decision.
      */
@@ -2041,6 +2368,8 @@ static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
     pVM->pgm.s.LiveSave.cSavedPages       = 0;
     pVM->pgm.s.LiveSave.uSaveStartNS      = RTTimeNanoTS();
     pVM->pgm.s.LiveSave.cPagesPerSecond   = 8192;
+    pVM->pgm.s.LiveSave.uLastScanNS       = RTTimeNanoTS();
+    pVM->pgm.s.LiveSave.cDirtiedPagesPerSecond = 0;
 
     /*
      * Per page type.
@@ -2150,11 +2479,25 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
      */
     pgmLock(pVM);
     pVM->pgm.s.LiveSave.fActive = false;
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (pPostCopy && pPostCopy->fSourceArmed)
+    {
+        pPostCopy->fSourceArmed = false;
+        LogRel(("PGM: Deferred %u RAM pages to the post-copy phase\n", pPostCopy->cPending));
+    }
+    if (pVM->pgm.s.cSaveDupPages)
+    {
+        LogRel(("PGM: Saved %u RAM pages as references to duplicates\n", pVM->pgm.s.cSaveDupPages));
+        pVM->pgm.s.cSaveDupPages = 0;
+    }
+    PPGMSAVEDUPPAGE paDupPages = pVM->pgm.s.paSaveDupPagesR3;
+    pVM->pgm.s.paSaveDupPagesR3 = NULL;
     /** @todo this is blindly assuming that we're the only user of write
      *        monitoring. Fix this when more users are added. */
     pVM->pgm.s.fPhysWriteMonitoringEngaged = false;
     pgmUnlock(pVM);
 
+    MMR3HeapFree(paDupPages);
     NOREF(pSSM);
     return VINF_SUCCESS;
 }
@@ -2174,8 +2517,19 @@ static DECLCALLBACK(int) pgmR3LoadPrep(PVM pVM, PSSMHANDLE pSSM)
      */
     PGMR3Reset(pVM);
     pVM->pgm.s.LiveSave.fActive = false;
+
+    /*
+     * Forget pages left missing by an earlier post-copy teleportation load.
+     */
+    int rc = VINF_SUCCESS;
+    if (pVM->pgm.s.pPostCopyR3)
+    {
+        pgmLock(pVM);
+        rc = pgmR3PhysPostCopyInitBitmap(pVM);
+        pgmUnlock(pVM);
+    }
     NOREF(pSSM);
-    return VINF_SUCCESS;
+    return rc;
 }
 
 
@@ -2689,6 +3043,8 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             case PGM_STATE_REC_RAM_ZERO:
             case PGM_STATE_REC_RAM_RAW:
             case PGM_STATE_REC_RAM_BALLOONED:
+            case PGM_STATE_REC_RAM_REMOTE:
+            case PGM_STATE_REC_RAM_DUP:
             {
                 /*
                  * Get the address and resolve it into a page descriptor.
@@ -2712,6 +3068,16 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                  */
                 switch (u8 & ~PGM_STATE_REC_FLAG_ADDR)
                 {
+                    case PGM_STATE_REC_RAM_REMOTE:
+                    {
+                        /* The content arrives after the VM has been resumed,
+                           until then it's a zero page. */
+                        AssertLogRelMsgReturn(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM, ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage),
+                                              VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+                        rc = pgmR3PhysPostCopyMarkRemote(pVM, GCPhys);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp rc=%Rrc\n", GCPhys, rc), rc);
+                    }
+                    /* fall thru */
                     case PGM_STATE_REC_RAM_ZERO:
                     {
                         if (PGM_PAGE_IS_ZERO(pPage))
@@ -2794,6 +3160,38 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                         break;
                     }
 
+                    case PGM_STATE_REC_RAM_DUP:
+                    {
+                        RTGCPHYS GCPhysSrc;
+                        rc = SSMR3GetGCPhys(pSSM, &GCPhysSrc);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        AssertLogRelMsgReturn(!(GCPhysSrc & PAGE_OFFSET_MASK) && GCPhysSrc != GCPhys,
+                                              ("GCPhys=%RGp GCPhysSrc=%RGp\n", GCPhys, GCPhysSrc), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+
+                        PPGMPAGE pSrcPage;
+                        rc = pgmPhysGetPageEx(pVM, GCPhysSrc, &pSrcPage);
+                        AssertLogRelMsgRCReturn(rc, ("rc=%Rrc %RGp\n", rc, GCPhysSrc), rc);
+                        AssertLogRelMsgReturn(PGM_PAGE_GET_TYPE(pSrcPage) == PGMPAGETYPE_RAM, ("GCPhysSrc=%RGp %R[pgmpage]\n", GCPhysSrc, pSrcPage),
+                                              VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+
+                        PGMPAGEMAPLOCK PgMpLck;
+                        void          *pvDstPage;
+                        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+                        PGMPAGEMAPLOCK PgMpLckSrc;
+                        void const    *pvSrcPage;
+                        rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pSrcPage, GCPhysSrc, &pvSrcPage, &PgMpLckSrc);
+                        if (RT_SUCCESS(rc))
+                        {
+                            memcpy(pvDstPage, pvSrcPage, PAGE_SIZE);
+                            pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLckSrc);
+                        }
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhysSrc=%RGp %R[pgmpage] rc=%Rrc\n", GCPhysSrc, pSrcPage, rc), rc);
+                        break;
+                    }
+
                     default:
                         AssertMsgFailedReturn(("%#x\n", u8), VERR_PGM_SAVED_REC_TYPE);
                 }
@@ -3161,11 +3559,13 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
      */
     if (   (   uPass != SSM_PASS_FINAL
             && uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_DUP_PAGES
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
             && uVersion != PGM_SAVED_STATE_VERSION_NO_RAM_CFG)
         || (   uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_DUP_PAGES
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
@@ -3329,6 +3729,38 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
 }
 
 
+/**
+ * Queries the live save progress of the guest RAM.
+ *
+ * This is intended for throttling the guest when it dirties memory faster
+ * than the pre-copy passes can get it across.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_INVALID_STATE if no live save is in progress.
+ * @param   pUVM                The user mode VM handle.
+ * @param   pcbDirtyMem         Where to return the amount of RAM currently
+ *                              dirty and waiting to be saved.  Optional.
+ * @param   pcbDirtiedPerSec    Where to return the rate (bytes per second) at
+ *                              which saved RAM was dirtied again between the
+ *                              last two scans.  Optional.
+ */
+VMMR3DECL(int) PGMR3QueryLiveSaveStats(PUVM pUVM, uint64_t *pcbDirtyMem, uint64_t *pcbDirtiedPerSec)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+
+    if (!pVM->pgm.s.LiveSave.fActive)
+        return VERR_INVALID_STATE;
+
+    if (pcbDirtyMem)
+        *pcbDirtyMem      = (uint64_t)pVM->pgm.s.LiveSave.Ram.cDirtyPages * PAGE_SIZE;
+    if (pcbDirtiedPerSec)
+        *pcbDirtiedPerSec = (uint64_t)pVM->pgm.s.LiveSave.cDirtiedPagesPerSecond * PAGE_SIZE;
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Registers the saved state callbacks with SSM.
  *
@@ -112,7 +112,9 @@
  *       - type 5: Named data - length prefixed name followed by the data. This
  *                 type is not implemented yet as we're missing the API part, so
  *                 the type assignment is tentative.
- *       - types 6 thru 15 are current undefined.
+ *       - type 6: Raw data compressed by LZ4, otherwise like type 3.  Only
+ *                 written when SSM/ZipType is "lz4".
+ *       - types 7 thru 15 are current undefined.
  *   - bit 4: Important (set), can be skipped (clear).
  *   - bit 5: Undefined flag, must be zero.
  *   - bit 6: Undefined flag, must be zero.
@@ -127,6 +129,12 @@
  * based. The unit header contained the compressed size of the data, i.e. it
  * needed updating after the data was written.)
  *
+ * Since every block is compressed independently, the compression is done on
+ * a pool of worker threads when saving (see SSMZIPPOOL and the SSM/ZipThreads
+ * configuration value).  The records are put into the stream in the order
+ * the data was passed to SSM, so the output is the same as when compressing
+ * on the EMT.
+ *
  *
  * @section sec_ssm_future          Future Changes
  *
@@ -145,6 +153,7 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_SSM
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/pdmcritsect.h>
@@ -161,6 +170,7 @@
 #include <iprt/crc.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/param.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
@@ -227,10 +237,13 @@
 /** Named data items.
  * A length prefix zero terminated string (i.e. max 255) followed by the data.  */
 #define SSM_REC_TYPE_NAMED                      5
+/** Raw data compressed by LZ4.
+ * The layout is the same as for SSM_REC_TYPE_RAW_LZF. */
+#define SSM_REC_TYPE_RAW_LZ4                    6
 /** Macro for validating the record type.
  * This can be used with the flags+type byte, no need to mask out the type first. */
 #define SSM_REC_TYPE_IS_VALID(u8Type)           (   ((u8Type) & SSM_REC_TYPE_MASK) >  SSM_REC_TYPE_INVALID \
-                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_NAMED )
+                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_RAW_LZ4 )
 /** @} */
 
 /** The flag mask. */
@@ -284,6 +297,25 @@
  * Must be a multiple of 1KB.  */
 #define SSM_ZIP_BLOCK_SIZE                      _4K
 AssertCompile(SSM_ZIP_BLOCK_SIZE / _1K * _1K == SSM_ZIP_BLOCK_SIZE);
+/** The max size of the record ssmR3DataZipBlock makes out of one block. */
+#define SSM_ZIP_MAX_REC_SIZE                    (1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE)
+
+/** The max number of compression worker threads. */
+#define SSM_ZIP_MAX_THREADS                     16
+/** The default max number of compression worker threads. */
+#define SSM_ZIP_DEF_MAX_THREADS                 4
+/** The number of compression jobs in flight per worker thread. */
+#define SSM_ZIP_JOBS_PER_THREAD                 32
+
+/** @name SSMZIPJOB::u32State values.
+ * @{ */
+/** The block awaits compression. */
+#define SSMZIPJOB_STATE_PENDING                 UINT32_C(1)
+/** A thread is compressing the block. */
+#define SSMZIPJOB_STATE_BUSY                    UINT32_C(2)
+/** The record is ready to be written to the stream. */
+#define SSMZIPJOB_STATE_DONE                    UINT32_C(3)
+/** @} */
 
 
 /**
@@ -447,6 +479,75 @@ typedef struct SSMSTRM
 typedef SSMSTRM *PSSMSTRM;
 
 
+/**
+ * A job in the compression pipeline.
+ *
+ * Either a block that is compressed by a worker thread, or data written while
+ * compression jobs were pending which must go to the stream after them.
+ */
+typedef struct SSMZIPJOB
+{
+    /** The job state, SSMZIPJOB_STATE_XXX. */
+    uint32_t volatile       u32State;
+    /** The size of the record(s) in abRec. */
+    uint32_t                cbRec;
+    /** Set if abRec holds raw data queued by the EMT rather than a compressed
+     * block.  More raw data may be appended while it's the last job. */
+    bool                    fRaw;
+    /** Explicit alignment padding. */
+    uint8_t                 abPadding[7];
+    /** The block to compress. */
+    uint8_t                 abBlock[SSM_ZIP_BLOCK_SIZE];
+    /** The record(s) ready to be written to the stream. */
+    uint8_t                 abRec[RT_ALIGN_32(SSM_ZIP_MAX_REC_SIZE, 16)];
+} SSMZIPJOB;
+AssertCompileMemberAlignment(SSMZIPJOB, abBlock, 16);
+AssertCompileSizeAlignment(SSMZIPJOB, 16);
+/** Pointer to a compression job. */
+typedef SSMZIPJOB *PSSMZIPJOB;
+
+
+/**
+ * Pool of threads compressing data unit blocks while saving.
+ *
+ * The EMT queues jobs at iTail, the workers (and the EMT while it would
+ * otherwise wait) compress them in any order, and the EMT writes the records
+ * to the stream in queue order from iHead.  The result is byte for byte the
+ * same as when compressing on the EMT.
+ */
+typedef struct SSMZIPPOOL
+{
+    /** The jobs, cJobs entries. */
+    PSSMZIPJOB              paJobs;
+    /** The number of jobs, a power of two. */
+    uint32_t                cJobs;
+    /** The oldest job not yet written to the stream (EMT only). */
+    uint32_t                iHead;
+    /** The next job to queue, everything before it is visible to the workers. */
+    uint32_t volatile       iTail;
+    /** The next job for the workers to look at. */
+    uint32_t volatile       iNextWork;
+    /** The number of workers waiting for jobs. */
+    uint32_t volatile       cIdleWorkers;
+    /** Set when the EMT is waiting for a job to complete. */
+    bool volatile           fEmtWaiting;
+    /** Tells the workers to terminate. */
+    bool volatile           fTerminate;
+    /** The workers wait on this for jobs. */
+    RTSEMEVENT              hEvtWork;
+    /** The EMT waits on this for a job to complete. */
+    RTSEMEVENT              hEvtDone;
+    /** The number of worker threads. */
+    uint32_t                cThreads;
+    /** The block compressor, see SSMHANDLE::u.Write.enmZipType. */
+    RTZIPTYPE               enmZipType;
+    /** The worker threads. */
+    RTTHREAD                ahThreads[SSM_ZIP_MAX_THREADS];
+} SSMZIPPOOL;
+/** Pointer to a compression thread pool. */
+typedef SSMZIPPOOL *PSSMZIPPOOL;
+
+
 /**
  * Handle structure.
  */
@@ -514,6 +615,10 @@ typedef struct SSMHANDLE
             uint8_t         abDataBuffer[4096];
             /** The maximum downtime given as milliseconds. */
             uint32_t        cMsMaxDowntime;
+            /** The compression thread pool, NULL if compressing on the EMT. */
+            PSSMZIPPOOL     pZipPool;
+            /** The block compressor, RTZIPTYPE_LZF or RTZIPTYPE_LZ4. */
+            RTZIPTYPE       enmZipType;
         } Write;
 
         /** Read data. */
@@ -891,6 +996,8 @@ static int                  ssmR3StrmReadMore(PSSMSTRM pStrm);
 
 #ifndef SSM_STANDALONE
 static int                  ssmR3DataFlushBuffer(PSSMHANDLE pSSM);
+static int                  ssmR3DataZipQueueRaw(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf);
+static int                  ssmR3DataZipDrain(PSSMHANDLE pSSM);
 #endif
 static int                  ssmR3DataReadRecHdrV2(PSSMHANDLE pSSM);
 
@@ -3160,6 +3267,19 @@ static int ssmR3DataWriteRaw(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
     if (RT_FAILURE(pSSM->rc))
         return pSSM->rc;
 
+    /*
+     * Queue it behind pending compression jobs.
+     */
+    PSSMZIPPOOL pZipPool = pSSM->u.Write.pZipPool;
+    if (pZipPool && pZipPool->iHead != pZipPool->iTail)
+    {
+        if (cbBuf <= SSM_ZIP_MAX_REC_SIZE)
+            return ssmR3DataZipQueueRaw(pSSM, pvBuf, cbBuf);
+        int rc = ssmR3DataZipDrain(pSSM);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     /*
      * Write the data item in 1MB chunks for progress indicator reasons.
      */
@@ -3247,12 +3367,13 @@ static int ssmR3DataWriteRecHdr(PSSMHANDLE pSSM, size_t cb, uint8_t u8TypeAndFla
 
 
 /**
- * Worker that flushes the buffered data.
+ * Worker that writes the buffered data as a record, queuing it behind any
+ * pending compression jobs.
  *
  * @returns VBox status code. Will set pSSM->rc on error.
  * @param   pSSM            The saved state handle.
  */
-static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
+static int ssmR3DataWriteBuffer(PSSMHANDLE pSSM)
 {
     /*
      * Check how much there current is in the buffer.
@@ -3275,6 +3396,411 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Worker that flushes the buffered data and waits for all pending compression
+ * jobs to be written to the stream.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
+{
+    int rc = ssmR3DataWriteBuffer(pSSM);
+    if (RT_SUCCESS(rc) && pSSM->u.Write.pZipPool)
+        rc = ssmR3DataZipDrain(pSSM);
+    return rc;
+}
+
+
+/**
+ * Compresses one block into a data record.
+ *
+ * Zero blocks are stored as RAW_ZERO records, blocks which don't compress as
+ * RAW records.
+ *
+ * @returns The size of the record.
+ * @param   enmZipType      The compressor, RTZIPTYPE_LZF or RTZIPTYPE_LZ4.
+ * @param   pvBlock         The block, SSM_ZIP_BLOCK_SIZE bytes.
+ * @param   pbRec           Where to format the record, SSM_ZIP_MAX_REC_SIZE
+ *                          bytes.
+ * @thread  Any.
+ */
+static size_t ssmR3DataZipBlock(RTZIPTYPE enmZipType, const void *pvBlock, uint8_t *pbRec)
+{
+    AssertCompile(SSM_ZIP_BLOCK_SIZE == PAGE_SIZE);
+    if (   !((uintptr_t)pvBlock & 0xf)
+        && ASMMemIsZeroPage(pvBlock))
+    {
+        pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZERO;
+        pbRec[1] = 1;
+        pbRec[2] = SSM_ZIP_BLOCK_SIZE / _1K;
+        return 3;
+    }
+
+    AssertCompile(SSM_ZIP_MAX_REC_SIZE < 0x00010000);
+    size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
+    int rc = RTZipBlockCompress(enmZipType, RTZIPLEVEL_FAST, 0 /*fFlags*/,
+                                pvBlock, SSM_ZIP_BLOCK_SIZE,
+                                pbRec + 1 + 3 + 1, cbRec, &cbRec);
+    if (RT_SUCCESS(rc))
+    {
+        pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT
+                 | (enmZipType == RTZIPTYPE_LZ4 ? SSM_REC_TYPE_RAW_LZ4 : SSM_REC_TYPE_RAW_LZF);
+        pbRec[4] = SSM_ZIP_BLOCK_SIZE / _1K;
+        cbRec += 1;
+    }
+    else
+    {
+        pbRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
+        memcpy(&pbRec[4], pvBlock, SSM_ZIP_BLOCK_SIZE);
+        cbRec = SSM_ZIP_BLOCK_SIZE;
+    }
+    pbRec[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
+    pbRec[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
+    pbRec[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
+    return cbRec + 1 + 3;
+}
+
+
+/**
+ * Picks up a pending job and compresses it.
+ *
+ * @returns true if it did a job (or lost the race for one), false if there
+ *          are no jobs left to pick up.
+ * @param   pPool           The compression thread pool.
+ * @thread  Worker threads, EMT while waiting.
+ */
+static bool ssmR3DataZipDoOneJob(PSSMZIPPOOL pPool)
+{
+    uint32_t iJob = ASMAtomicReadU32(&pPool->iNextWork);
+    if (iJob == ASMAtomicReadU32(&pPool->iTail))
+        return false;
+    if (ASMAtomicCmpXchgU32(&pPool->iNextWork, iJob + 1, iJob))
+    {
+        /* The claim on the index may be stale when the slot was recycled, so
+           the state change decides who gets to do the job. */
+        PSSMZIPJOB pJob = &pPool->paJobs[iJob & (pPool->cJobs - 1)];
+        if (ASMAtomicCmpXchgU32(&pJob->u32State, SSMZIPJOB_STATE_BUSY, SSMZIPJOB_STATE_PENDING))
+        {
+            pJob->cbRec = (uint32_t)ssmR3DataZipBlock(pPool->enmZipType, pJob->abBlock, pJob->abRec);
+            ASMAtomicWriteU32(&pJob->u32State, SSMZIPJOB_STATE_DONE);
+            if (ASMAtomicReadBool(&pPool->fEmtWaiting))
+                RTSemEventSignal(pPool->hEvtDone);
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Compression worker thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hSelf           The thread handle.
+ * @param   pvPool          The compression thread pool.
+ */
+static DECLCALLBACK(int) ssmR3DataZipThread(RTTHREAD hSelf, void *pvPool)
+{
+    PSSMZIPPOOL pPool = (PSSMZIPPOOL)pvPool;
+    NOREF(hSelf);
+
+    while (!ASMAtomicReadBool(&pPool->fTerminate))
+    {
+        if (ssmR3DataZipDoOneJob(pPool))
+            continue;
+
+        /* Announce that we're idle and recheck so we don't miss a job queued
+           before the EMT saw us. */
+        ASMAtomicIncU32(&pPool->cIdleWorkers);
+        if (   ASMAtomicReadU32(&pPool->iNextWork) == ASMAtomicReadU32(&pPool->iTail)
+            && !ASMAtomicReadBool(&pPool->fTerminate))
+            RTSemEventWait(pPool->hEvtWork, RT_INDEFINITE_WAIT);
+        ASMAtomicDecU32(&pPool->cIdleWorkers);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Writes the completed jobs at the head of the queue to the stream.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   fWaitHead       Whether to wait for the head job to complete if it
+ *                          hasn't already.
+ */
+static int ssmR3DataZipCommit(PSSMHANDLE pSSM, bool fWaitHead)
+{
+    PSSMZIPPOOL pPool = pSSM->u.Write.pZipPool;
+    while (pPool->iHead != pPool->iTail)
+    {
+        PSSMZIPJOB pJob = &pPool->paJobs[pPool->iHead & (pPool->cJobs - 1)];
+        while (ASMAtomicReadU32(&pJob->u32State) != SSMZIPJOB_STATE_DONE)
+        {
+            if (!fWaitHead)
+                return pSSM->rc;
+
+            /* Lend a hand rather than just waiting. */
+            if (ssmR3DataZipDoOneJob(pPool))
+                continue;
+            ASMAtomicWriteBool(&pPool->fEmtWaiting, true);
+            if (ASMAtomicReadU32(&pJob->u32State) != SSMZIPJOB_STATE_DONE)
+                RTSemEventWait(pPool->hEvtDone, RT_INDEFINITE_WAIT);
+            ASMAtomicWriteBool(&pPool->fEmtWaiting, false);
+        }
+        fWaitHead = false;
+
+        if (RT_SUCCESS(pSSM->rc))
+        {
+            Log3(("ssmR3DataZipCommit: %08llx|%08llx: job %#x type=%02x cbRec=%#x\n",
+                  ssmR3StrmTell(&pSSM->Strm), pSSM->offUnit, pPool->iHead, pJob->abRec[0], pJob->cbRec));
+            int rc = ssmR3StrmWrite(&pSSM->Strm, pJob->abRec, pJob->cbRec);
+            if (RT_SUCCESS(rc))
+                pSSM->offUnit += pJob->cbRec;
+            else
+                pSSM->rc = rc;
+        }
+        pPool->iHead++;
+    }
+    return pSSM->rc;
+}
+
+
+/**
+ * Gets a free job at the tail of the queue, writing completed jobs to the
+ * stream to make room when necessary.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   ppJob           Where to return the job.
+ */
+static int ssmR3DataZipAllocJob(PSSMHANDLE pSSM, PSSMZIPJOB *ppJob)
+{
+    PSSMZIPPOOL pPool = pSSM->u.Write.pZipPool;
+    int rc = ssmR3DataZipCommit(pSSM, false /*fWaitHead*/);
+    if (RT_SUCCESS(rc) && pPool->iTail - pPool->iHead >= pPool->cJobs)
+        rc = ssmR3DataZipCommit(pSSM, true /*fWaitHead*/);
+    *ppJob = &pPool->paJobs[pPool->iTail & (pPool->cJobs - 1)];
+    return rc;
+}
+
+
+/**
+ * Makes the job at the tail of the queue visible to the workers.
+ *
+ * @param   pPool           The compression thread pool.
+ * @param   fWakeUp         Whether to wake up an idle worker.
+ */
+DECLINLINE(void) ssmR3DataZipPublishJob(PSSMZIPPOOL pPool, bool fWakeUp)
+{
+    ASMAtomicWriteU32(&pPool->iTail, pPool->iTail + 1);
+    if (fWakeUp && ASMAtomicReadU32(&pPool->cIdleWorkers))
+        RTSemEventSignal(pPool->hEvtWork);
+}
+
+
+/**
+ * Queues a block for compression by the thread pool.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pvBlock         The block, SSM_ZIP_BLOCK_SIZE bytes.  Copied.
+ */
+static int ssmR3DataZipQueueBlock(PSSMHANDLE pSSM, const void *pvBlock)
+{
+    PSSMZIPJOB pJob;
+    int rc = ssmR3DataZipAllocJob(pSSM, &pJob);
+    if (RT_SUCCESS(rc))
+    {
+        memcpy(pJob->abBlock, pvBlock, SSM_ZIP_BLOCK_SIZE);
+        pJob->fRaw = false;
+        ASMAtomicWriteU32(&pJob->u32State, SSMZIPJOB_STATE_PENDING);
+        ssmR3DataZipPublishJob(pSSM->u.Write.pZipPool, true /*fWakeUp*/);
+    }
+    return rc;
+}
+
+
+/**
+ * Queues raw data behind the pending compression jobs.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pvBuf           The bits to write.
+ * @param   cbBuf           The number of bytes to write, at most
+ *                          SSM_ZIP_MAX_REC_SIZE.
+ */
+static int ssmR3DataZipQueueRaw(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
+{
+    Assert(cbBuf <= SSM_ZIP_MAX_REC_SIZE);
+    PSSMZIPPOOL pPool = pSSM->u.Write.pZipPool;
+
+    /* Append to the last queued job if it's raw data and there is room. */
+    if (pPool->iTail != pPool->iHead)
+    {
+        PSSMZIPJOB pJob = &pPool->paJobs[(pPool->iTail - 1) & (pPool->cJobs - 1)];
+        if (   pJob->fRaw
+            && pJob->cbRec + cbBuf <= sizeof(pJob->abRec))
+        {
+            memcpy(&pJob->abRec[pJob->cbRec], pvBuf, cbBuf);
+            pJob->cbRec += (uint32_t)cbBuf;
+            return VINF_SUCCESS;
+        }
+    }
+
+    PSSMZIPJOB pJob;
+    int rc = ssmR3DataZipAllocJob(pSSM, &pJob);
+    if (RT_SUCCESS(rc))
+    {
+        memcpy(pJob->abRec, pvBuf, cbBuf);
+        pJob->cbRec = (uint32_t)cbBuf;
+        pJob->fRaw  = true;
+        ASMAtomicWriteU32(&pJob->u32State, SSMZIPJOB_STATE_DONE);
+        ssmR3DataZipPublishJob(pPool, false /*fWakeUp*/);
+    }
+    return rc;
+}
+
+
+/**
+ * Waits for all pending compression jobs and writes them to the stream.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataZipDrain(PSSMHANDLE pSSM)
+{
+    PSSMZIPPOOL pPool = pSSM->u.Write.pZipPool;
+    while (pPool->iHead != pPool->iTail)
+        ssmR3DataZipCommit(pSSM, true /*fWaitHead*/);
+    return pSSM->rc;
+}
+
+
+/**
+ * Destroys the compression thread pool of a saved state handle, if any.
+ *
+ * Pending jobs are discarded.
+ *
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3DataZipDestroy(PSSMHANDLE pSSM)
+{
+    PSSMZIPPOOL pPool = pSSM->u.Write.pZipPool;
+    if (!pPool)
+        return;
+    pSSM->u.Write.pZipPool = NULL;
+
+    ASMAtomicWriteBool(&pPool->fTerminate, true);
+    for (uint32_t i = 0; i < pPool->cThreads; i++)
+    {
+        RTSemEventSignal(pPool->hEvtWork);
+        while (RTThreadWait(pPool->ahThreads[i], 100 /*ms*/, NULL) == VERR_TIMEOUT)
+            RTSemEventSignal(pPool->hEvtWork);
+    }
+
+    RTSemEventDestroy(pPool->hEvtWork);
+    RTSemEventDestroy(pPool->hEvtDone);
+    RTMemPageFree(pPool->paJobs, pPool->cJobs * sizeof(SSMZIPJOB));
+    RTMemFree(pPool);
+}
+
+
+/**
+ * Picks the block compressor for a saved state handle from the SSM/ZipType
+ * CFGM value, "lzf" (default) or "lz4".
+ *
+ * LZ4 is faster at the expense of a slightly worse ratio, which pays off when
+ * the stream is fast (teleportation over a fast link, SSD).  Saved states
+ * using it cannot be loaded by older versions.
+ *
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3DataZipQueryType(PSSMHANDLE pSSM)
+{
+    pSSM->u.Write.enmZipType = RTZIPTYPE_LZF;
+
+    char szType[16];
+    int rc = CFGMR3QueryStringDef(CFGMR3GetChild(CFGMR3GetRoot(pSSM->pVM), "SSM"), "ZipType", szType, sizeof(szType), "lzf");
+    AssertLogRelRCReturnVoid(rc);
+    if (!RTStrICmp(szType, "lz4"))
+    {
+        pSSM->u.Write.enmZipType = RTZIPTYPE_LZ4;
+        LogRel(("SSM: Using LZ4 compression\n"));
+    }
+    else if (RTStrICmp(szType, "lzf"))
+        LogRel(("SSM: Unknown SSM/ZipType value '%s', using LZF\n", szType));
+}
+
+
+/**
+ * Creates the thread pool for compressing the data blocks of a saved state
+ * handle, unless there's only one CPU or it's been disabled.
+ *
+ * The number of worker threads is taken from the SSM/ZipThreads CFGM value
+ * and defaults to one less than the number of online CPUs, but no more than
+ * SSM_ZIP_DEF_MAX_THREADS.  Zero disables the pool.  The pool is an
+ * optimization only, so failures are not fatal.
+ *
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3DataZipCreate(PSSMHANDLE pSSM)
+{
+    uint32_t cCpus = RTMpGetOnlineCount();
+    uint32_t cThreads;
+    int rc = CFGMR3QueryU32Def(CFGMR3GetChild(CFGMR3GetRoot(pSSM->pVM), "SSM"), "ZipThreads", &cThreads,
+                               RT_MIN(cCpus > 1 ? cCpus - 1 : 0, SSM_ZIP_DEF_MAX_THREADS));
+    AssertLogRelRCReturnVoid(rc);
+    cThreads = RT_MIN(cThreads, SSM_ZIP_MAX_THREADS);
+    if (!cThreads)
+        return;
+
+    PSSMZIPPOOL pPool = (PSSMZIPPOOL)RTMemAllocZ(sizeof(*pPool));
+    if (!pPool)
+        return;
+    pPool->cJobs    = cThreads * SSM_ZIP_JOBS_PER_THREAD;
+    AssertCompile(!(SSM_ZIP_JOBS_PER_THREAD & (SSM_ZIP_JOBS_PER_THREAD - 1)));
+    while (pPool->cJobs & (pPool->cJobs - 1))
+        pPool->cJobs &= pPool->cJobs - 1;   /* round down to a power of two */
+    pPool->hEvtWork = NIL_RTSEMEVENT;
+    pPool->hEvtDone = NIL_RTSEMEVENT;
+    pPool->enmZipType = pSSM->u.Write.enmZipType;
+    pPool->paJobs   = (PSSMZIPJOB)RTMemPageAllocZ(pPool->cJobs * sizeof(SSMZIPJOB));
+    if (pPool->paJobs)
+        rc = RTSemEventCreate(&pPool->hEvtWork);
+    else
+        rc = VERR_NO_MEMORY;
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPool->hEvtDone);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Failed to create the compression thread pool: %Rrc\n", rc));
+        RTSemEventDestroy(pPool->hEvtWork);
+        if (pPool->paJobs)
+            RTMemPageFree(pPool->paJobs, pPool->cJobs * sizeof(SSMZIPJOB));
+        RTMemFree(pPool);
+        return;
+    }
+
+    pSSM->u.Write.pZipPool = pPool;
+    for (uint32_t i = 0; i < cThreads; i++)
+    {
+        rc = RTThreadCreateF(&pPool->ahThreads[i], ssmR3DataZipThread, pPool, 0, RTTHREADTYPE_DEFAULT,
+                             RTTHREADFLAGS_WAITABLE, "SSM-Zip%u", i);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("SSM: Failed to create compression thread #%u: %Rrc\n", i, rc));
+            break;
+        }
+        pPool->cThreads++;
+    }
+    if (!pPool->cThreads)
+        ssmR3DataZipDestroy(pSSM);
+    else
+        LogRel(("SSM: Compressing on %u worker threads\n", pPool->cThreads));
+}
+
+
 /**
  * ssmR3DataWrite worker that writes big stuff.
  *
@@ -3285,7 +3811,7 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
  */
 static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
 {
-    int rc = ssmR3DataFlushBuffer(pSSM);
+    int rc = ssmR3DataWriteBuffer(pSSM);
     if (RT_SUCCESS(rc))
     {
         pSSM->offUnitUser += cbBuf;
@@ -3295,45 +3821,26 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
          */
         for (;;)
         {
-            AssertCompile(SSM_ZIP_BLOCK_SIZE == PAGE_SIZE);
-            if (    cbBuf >= SSM_ZIP_BLOCK_SIZE
-                && (    ((uintptr_t)pvBuf & 0xf)
-                    ||  !ASMMemIsZeroPage(pvBuf))
-               )
+            if (cbBuf >= SSM_ZIP_BLOCK_SIZE)
             {
                 /*
-                 * Compress it.
+                 * Compress it, on the thread pool if we've got one.
                  */
-                AssertCompile(1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE < 0x00010000);
-                uint8_t *pb;
-                rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, 1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE, &pb);
-                if (RT_FAILURE(rc))
-                    break;
-                size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
-                rc = RTZipBlockCompress(RTZIPTYPE_LZF, RTZIPLEVEL_FAST, 0 /*fFlags*/,
-                                        pvBuf, SSM_ZIP_BLOCK_SIZE,
-                                        pb + 1 + 3 + 1, cbRec, &cbRec);
-                if (RT_SUCCESS(rc))
-                {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF;
-                    pb[4] = SSM_ZIP_BLOCK_SIZE / _1K;
-                    cbRec += 1;
-                }
+                if (pSSM->u.Write.pZipPool)
+                    rc = ssmR3DataZipQueueBlock(pSSM, pvBuf);
                 else
                 {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
-                    memcpy(&pb[4], pvBuf, SSM_ZIP_BLOCK_SIZE);
-                    cbRec = SSM_ZIP_BLOCK_SIZE;
+                    uint8_t *pb;
+                    rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, SSM_ZIP_MAX_REC_SIZE, &pb);
+                    if (RT_FAILURE(rc))
+                        break;
+                    size_t cbRec = ssmR3DataZipBlock(pSSM->u.Write.enmZipType, pvBuf, pb);
+                    rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
+                    if (RT_SUCCESS(rc))
+                        pSSM->offUnit += cbRec;
                 }
-                pb[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
-                pb[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
-                pb[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
-                cbRec += 1 + 3;
-                rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
                 if (RT_FAILURE(rc))
                     break;
-
-                pSSM->offUnit += cbRec;
                 ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
 
                 /* advance */
@@ -3342,27 +3849,6 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
                 cbBuf -= SSM_ZIP_BLOCK_SIZE;
                 pvBuf = (uint8_t const*)pvBuf + SSM_ZIP_BLOCK_SIZE;
             }
-            else if (cbBuf >= SSM_ZIP_BLOCK_SIZE)
-            {
-                /*
-                 * Zero block.
-                 */
-                uint8_t abRec[3];
-                abRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZERO;
-                abRec[1] = 1;
-                abRec[2] = SSM_ZIP_BLOCK_SIZE / _1K;
-                Log3(("ssmR3DataWriteBig: %08llx|%08llx/%08x: ZERO\n", ssmR3StrmTell(&pSSM->Strm) + 2, pSSM->offUnit + 2, 1));
-                rc = ssmR3DataWriteRaw(pSSM, &abRec[0], sizeof(abRec));
-                if (RT_FAILURE(rc))
-                    break;
-
-                /* advance */
-                ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
-                if (cbBuf == SSM_ZIP_BLOCK_SIZE)
-                    return VINF_SUCCESS;
-                cbBuf -= SSM_ZIP_BLOCK_SIZE;
-                pvBuf = (uint8_t const*)pvBuf + SSM_ZIP_BLOCK_SIZE;
-            }
             else
             {
                 /*
@@ -3393,7 +3879,7 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
  */
 static int ssmR3DataWriteFlushAndBuffer(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
 {
-    int rc = ssmR3DataFlushBuffer(pSSM);
+    int rc = ssmR3DataWriteBuffer(pSSM);
     if (RT_SUCCESS(rc))
     {
         memcpy(&pSSM->u.Write.abDataBuffer[0], pvBuf, cbBuf);
@@ -4410,6 +4896,7 @@ static int ssmR3SaveDoClose(PVM pVM, PSSMHANDLE pSSM)
      * Make it non-cancellable, close the stream and delete the file on failure.
      */
     ssmR3SetCancellable(pVM, pSSM, false);
+    ssmR3DataZipDestroy(pSSM);
     int rc = ssmR3StrmClose(&pSSM->Strm, pSSM->rc == VERR_SSM_CANCELLED);
     if (RT_SUCCESS(rc))
         rc = pSSM->rc;
@@ -5016,6 +5503,8 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
         RTMemFree(pSSM);
         return rc;
     }
+    ssmR3DataZipQueryType(pSSM);
+    ssmR3DataZipCreate(pSSM);
 
     *ppSSM = pSSM;
     return VINF_SUCCESS;
@@ -5827,7 +6316,7 @@ DECLINLINE(int) ssmR3DataReadV2Raw(PSSMHANDLE pSSM, void *pvBuf, size_t cbToRead
 
 
 /**
- * Reads and checks the LZF "header".
+ * Reads and checks the LZF or LZ4 "header".
  *
  * @returns VBox status code. Sets pSSM->rc on error.
  * @param   pSSM            The saved state handle..
@@ -5859,8 +6348,8 @@ DECLINLINE(int) ssmR3DataReadV2RawLzfHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr)
 
 
 /**
- * Reads an LZF block from the stream and decompresses into the specified
- * buffer.
+ * Reads an LZF or LZ4 block from the stream and decompresses into the
+ * specified buffer.
  *
  * @returns VBox status code. Sets pSSM->rc on error.
  * @param   SSM             The saved state handle.
@@ -5894,7 +6383,9 @@ static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
      * Decompress it.
      */
     size_t cbDstActual;
-    rc = RTZipBlockDecompress(RTZIPTYPE_LZF, 0 /*fFlags*/,
+    RTZIPTYPE const enmZipType = (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_LZ4
+                               ? RTZIPTYPE_LZ4 : RTZIPTYPE_LZF;
+    rc = RTZipBlockDecompress(enmZipType, 0 /*fFlags*/,
                               pb, cbCompr, NULL /*pcbSrcActual*/,
                               pvDst, cbDecompr, &cbDstActual);
     if (RT_SUCCESS(rc))
@@ -6167,6 +6658,7 @@ static int ssmR3DataReadUnbufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
             }
 
             case SSM_REC_TYPE_RAW_LZF:
+            case SSM_REC_TYPE_RAW_LZ4:
             {
                 int rc = ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead);
                 if (RT_FAILURE(rc))
@@ -6290,6 +6782,7 @@ static int ssmR3DataReadBufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
             }
 
             case SSM_REC_TYPE_RAW_LZF:
+            case SSM_REC_TYPE_RAW_LZ4:
             {
                 int rc = ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead);
                 if (RT_FAILURE(rc))
@@ -165,6 +165,11 @@ typedef struct PDMACEPFILEMGR
     unsigned                               cRequestsActive;
     /** Number of maximum requests active. */
     uint32_t                               cRequestsActiveMax;
+    /** Flag whether the async I/O context processes requests on buffered files
+     * asynchronously (created with RTFILEAIOCTX_FLAGS_BUFFERED_ASYNC). */
+    bool                                   fBufferedAsync;
+    /** Flag whether the async I/O context can't grow any further. */
+    bool                                   fGrowLimitReached;
     /** Pointer to an array of free async I/O request handles. */
     RTFILEAIOREQ                          *pahReqsFree;
     /** Index of the next free entry in the cache. */
@@ -269,6 +274,9 @@ typedef struct PDMASYNCCOMPLETIONEPCLASSFILE
     uint32_t                            cReqsOutstandingMax;
     /** Bitmask for checking the alignment of a buffer. */
     RTR3UINTPTR                         uBitmaskAlignment;
+    /** Flag whether the host processes buffered I/O asynchronously
+     * (RTFILEAIOLIMITS_F_BUFFERED_ASYNC). */
+    bool                                fBufferedAsync;
     /** Flag whether the out of resources warning was printed already. */
     bool                                fOutOfResourcesWarningPrinted;
 #ifdef PDM_ASYNC_COMPLETION_FILE_WITH_DELAY
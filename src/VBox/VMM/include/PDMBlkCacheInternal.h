@@ -41,6 +41,8 @@ RT_C_DECLS_BEGIN
 typedef struct PDMBLKLRULIST *PPDMBLKLRULIST;
 /** Pointer to the global cache structure. */
 typedef struct PDMBLKCACHEGLOBAL *PPDMBLKCACHEGLOBAL;
+/** Pointer to a cache shard. */
+typedef struct PDMBLKCACHESHARD *PPDMBLKCACHESHARD;
 /** Pointer to a cache entry waiter structure. */
 typedef struct PDMBLKCACHEWAITER *PPDMBLKCACHEWAITER;
 
@@ -97,28 +99,115 @@ typedef struct PDMBLKLRULIST
 } PDMBLKLRULIST;
 
 /**
- * Global cache data.
+ * Replacement policy operations.
+ *
+ * All callbacks except pfnHit are called with the shard lock held.
  */
-typedef struct PDMBLKCACHEGLOBAL
+typedef struct PDMBLKCACHEPOLICYOPS
 {
-    /** Pointer to the owning VM instance. */
-    PVM                 pVM;
-    /** Maximum size of the cache in bytes. */
+    /** Name of the policy as used in the configuration. */
+    const char                   *pszName;
+
+    /**
+     * Updates the position of an entry containing data after it was accessed.
+     *
+     * @returns nothing.
+     * @param   pShard          The shard the entry belongs to.
+     * @param   pEntry          The referenced entry which was accessed.
+     *
+     * @note The shard lock is not held when this is called, the policy has to
+     *       acquire it if the entry needs to be moved.
+     */
+    DECLR3CALLBACKMEMBER(void, pfnHit, (PPDMBLKCACHESHARD pShard, PPDMBLKCACHEENTRY pEntry));
+
+    /**
+     * Adapts the policy after an access hit an entry in one of the ghost lists.
+     *
+     * @returns nothing.
+     * @param   pShard          The shard the entry belongs to.
+     * @param   pListGhost      The ghost list the entry is in.
+     * @param   cbData          Size of the entry.
+     */
+    DECLR3CALLBACKMEMBER(void, pfnGhostHit, (PPDMBLKCACHESHARD pShard, PPDMBLKLRULIST pListGhost, uint32_t cbData));
+
+    /**
+     * Makes room for the given amount of data evicting entries if required.
+     *
+     * @returns Flag whether enough data could be evicted.
+     * @param   pShard          The shard to reclaim data from.
+     * @param   cbData          Number of bytes required.
+     * @param   pListGhostHit   The ghost list the entry to fetch was hit in,
+     *                          NULL if a new entry is created.
+     * @param   fReuseBuffer    Flag whether a buffer of the same size should be returned.
+     * @param   ppbBuffer       Where to store the buffer to reuse if one was found.
+     */
+    DECLR3CALLBACKMEMBER(bool, pfnReclaim, (PPDMBLKCACHESHARD pShard, size_t cbData, PPDMBLKLRULIST pListGhostHit,
+                                            bool fReuseBuffer, uint8_t **ppbBuffer));
+} PDMBLKCACHEPOLICYOPS;
+/** Pointer to const replacement policy operations. */
+typedef const PDMBLKCACHEPOLICYOPS *PCPDMBLKCACHEPOLICYOPS;
+
+/**
+ * Cache shard.
+ *
+ * The cache is split into shards each owning a part of the cache memory and
+ * its own LRU lists and lock. Every user is assigned to one shard so users
+ * in different shards don't contend for the same lock.
+ */
+typedef struct PDMBLKCACHESHARD
+{
+    /** Pointer to the global cache data. */
+    PPDMBLKCACHEGLOBAL  pCache;
+    /** Index of the shard. */
+    uint32_t            idShard;
+    /** Number of users assigned to this shard, protected by the global lock. */
+    uint32_t            cUsers;
+    /** Critical section protecting the lists of the shard. */
+    RTCRITSECT          CritSect;
+    /** Maximum size of the shard in bytes. */
     uint32_t            cbMax;
-    /** Current size of the cache in bytes. */
+    /** Current size of the shard in bytes. */
     uint32_t            cbCached;
-    /** Critical section protecting the cache. */
-    RTCRITSECT          CritSect;
-    /** Maximum number of bytes cached. */
+    /** Maximum number of bytes cached (2Q only). */
     uint32_t            cbRecentlyUsedInMax;
-    /** Maximum number of bytes in the paged out list .*/
+    /** Maximum number of bytes in the recently used paged out list .*/
     uint32_t            cbRecentlyUsedOutMax;
-    /** Recently used cache entries list */
+    /** Maximum number of bytes in the frequently used paged out list (ARC only). */
+    uint32_t            cbFrequentlyUsedOutMax;
+    /** Adaptive target size of the recently used list (ARC only). */
+    uint32_t            cbRecentlyUsedTarget;
+    /** Recently used cache entries list (A1in/T1) */
     PDMBLKLRULIST       LruRecentlyUsedIn;
-    /** Scorecard cache entry list. */
+    /** Scorecard cache entry list (A1out/B1). */
     PDMBLKLRULIST       LruRecentlyUsedOut;
-    /** List of frequently used cache entries */
+    /** List of frequently used cache entries (Am/T2) */
     PDMBLKLRULIST       LruFrequentlyUsed;
+    /** Frequently used but paged out entries (B2, ARC only). */
+    PDMBLKLRULIST       LruFrequentlyUsedOut;
+} PDMBLKCACHESHARD;
+
+/**
+ * Global cache data.
+ */
+typedef struct PDMBLKCACHEGLOBAL
+{
+    /** Pointer to the owning VM instance. */
+    PVM                 pVM;
+    /** Maximum size of the cache in bytes. */
+    uint32_t            cbMax;
+    /** Number of shards. */
+    uint32_t            cShards;
+    /** Critical section protecting the list of users. */
+    RTCRITSECT          CritSect;
+    /** Pointer to the array of shards. */
+    PPDMBLKCACHESHARD   paShards;
+    /** The replacement policy. */
+    PCPDMBLKCACHEPOLICYOPS pPolicy;
+    /** Number of bytes accessed sequentially after which new entries are
+     * treated as part of a scan, 0 if scan detection is disabled. */
+    uint64_t            cbScanThreshold;
+    /** Flag whether new buffers are faulted in by the allocating thread. */
+    bool                fBufPrefault;
     /** Commit timeout in milli seconds */
     uint32_t            u32CommitTimeoutMs;
     /** Number of dirty bytes needed to start a commit of the data to the disk. */
@@ -154,6 +243,8 @@ typedef struct PDMBLKCACHEGLOBAL
     STAMPROFILEADV      StatTreeRemove;
     /** Number of times a buffer could be reused. */
     STAMCOUNTER         StatBuffersReused;
+    /** Number of entries created while a sequential scan was detected. */
+    STAMCOUNTER         StatScanEntries;
 #endif
 } PDMBLKCACHEGLOBAL;
 #ifdef VBOX_WITH_STATISTICS
@@ -188,6 +279,12 @@ typedef struct PDMBLKCACHE
     RTSEMRW                       SemRWEntries;
     /** Pointer to the gobal cache data */
     PPDMBLKCACHEGLOBAL            pCache;
+    /** The shard the entries of this user are kept in. */
+    PPDMBLKCACHESHARD             pShard;
+    /** Offset where the next access continues the current sequential run. */
+    uint64_t                      offSeqNext;
+    /** Number of bytes accessed sequentially so far. */
+    uint64_t                      cbSeq;
     /** Lock protecting the dirty entries list. */
     RTSPINLOCK                    LockList;
     /** List of dirty but not committed entries for this endpoint. */
@@ -214,6 +214,43 @@ DECLINLINE(int) pgmRamGCPhys2HCPhys(PVM pVM, RTGCPHYS GCPhys, PRTHCPHYS pHCPhys)
     return VINF_SUCCESS;
 }
 
+
+/**
+ * Records a RAM page state change in the live save dirty log.
+ *
+ * The raw-mode context has no mapping of the log, so changes made there (and
+ * any that falls outside it) flags the log as incomplete, which makes the
+ * next scan fall back on walking all the pages.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   GCPhys      The address of the first page.
+ * @param   cPages      The number of pages.
+ *
+ * @remarks Called from within the PGM critical section.
+ */
+DECLINLINE(void) pgmPhysDirtyLogMark(PVM pVM, RTGCPHYS GCPhys, uint32_t cPages)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    if (!pVM->pgm.s.LiveSave.fActive)
+        return;
+#if defined(IN_RING3)
+    uint32_t volatile *pbmDirtyLog = pVM->pgm.s.LiveSave.pbmDirtyLogR3;
+#elif defined(IN_RING0)
+    uint32_t volatile *pbmDirtyLog = pVM->pgm.s.LiveSave.pbmDirtyLogR0;
+#else
+    uint32_t volatile *pbmDirtyLog = NULL;
+#endif
+    RTGCPHYS const iPage = GCPhys >> PAGE_SHIFT;
+    if (   pbmDirtyLog
+        && iPage + cPages <= pVM->pgm.s.LiveSave.cDirtyLogPages)
+    {
+        while (cPages-- > 0)
+            ASMBitSet(pbmDirtyLog, (int32_t)(iPage + cPages));
+    }
+    else
+        pVM->pgm.s.LiveSave.fDirtyLogIncomplete = true;
+}
+
 #if defined(VBOX_WITH_2X_4GB_ADDR_SPACE_IN_R0) || defined(IN_RC)
 
 /**
@@ -1365,6 +1365,107 @@ typedef PGMLIVESAVERAMPAGE *PPGMLIVESAVERAMPAGE;
 #define PGMLIVSAVEPAGE_MAX_DIRTIED 0x00fffff0
 
 
+/**
+ * A page received by a post-copy target that is waiting for an EMT to
+ * install it.
+ */
+typedef struct PGMPOSTCOPYSTAGEDPAGE
+{
+    /** The AVL node core, keyed by the guest physical page address. */
+    AVLGCPHYSNODECORE                   Core;
+    /** The page content. */
+    uint8_t                             abPage[PAGE_SIZE];
+} PGMPOSTCOPYSTAGEDPAGE;
+/** Pointer to a staged post-copy page. */
+typedef PGMPOSTCOPYSTAGEDPAGE *PPGMPOSTCOPYSTAGEDPAGE;
+
+/** The max number of access handler ranges a post-copy target registers. */
+#define PGM_POST_COPY_MAX_HANDLERS      256
+/** The max number of received pages a post-copy target keeps staged before
+ * making the transport wait for the EMTs to catch up (16MB). */
+#define PGM_POST_COPY_MAX_STAGED        4096
+
+/**
+ * Post-copy teleportation state (ring-3 only).
+ *
+ * On the source this tracks the RAM pages which the final live save pass
+ * deferred instead of saving, on the target the pages which are still
+ * missing.  The bitmap has one bit per guest physical page and is protected by
+ * the PGM lock, though unlocked tests of a bit are fine since bits are only
+ * cleared once set.
+ */
+typedef struct PGMPOSTCOPY
+{
+    /** Source: defer the pages dirtied in the final pass of the next live save
+     * (one-shot). */
+    bool                                fSourceArmed;
+    /** Target: set while the access handlers are registered. */
+    bool volatile                       fHooked;
+    /** Target: set when the handler cleanup has been queued. */
+    bool                                fCleanupQueued;
+    /** Target: set when the transport has gone away, pfnRequest is off limits. */
+    bool volatile                       fAborted;
+    /** The number of guest physical pages covered by pbmPages. */
+    uint32_t                            cBits;
+    /** The number of bits set in pbmPages. */
+    uint32_t volatile                   cPending;
+    /** Source: where to continue looking for the next deferred page. */
+    uint32_t                            iNext;
+    /** Target: the number of pfnRequest calls in progress. */
+    uint32_t volatile                   cRequestsActive;
+    /** Target: the number of pages in StagedTree. */
+    uint32_t volatile                   cStaged;
+    /** The page bitmap. */
+    uint32_t volatile                  *pbmPages;
+    /** Target: callback requesting a page from the source. */
+    PFNPGMPHYSPOSTCOPYREQUEST           pfnRequest;
+    /** Target: user argument for pfnRequest. */
+    void                               *pvUser;
+    /** Target: received pages not yet installed (PGMPOSTCOPYSTAGEDPAGE). */
+    AVLGCPHYSTREE                       StagedTree;
+    /** Target: signalled once fAborted is set and the last pfnRequest call
+     * has returned. */
+    RTSEMEVENTMULTI                     hEvtRequestsIdle;
+    /** Target: signalled when staged pages have been installed, for
+     * PGMR3PhysPostCopyPutPage waiting for room in StagedTree. */
+    RTSEMEVENT                          hEvtStagedRoom;
+    /** Target: the number of access handler ranges in aGCPhysHandlers. */
+    uint32_t                            cHandlers;
+    /** Target: the number of pages demanded by the guest or devices. */
+    uint32_t                            cDemanded;
+    /** Target: the number of pages installed from the background push. */
+    uint32_t                            cPushed;
+    /** Target: the number of pages fetched without a handler. */
+    uint32_t                            cFetchedUnhooked;
+    /** Target: the start addresses of the registered access handlers. */
+    RTGCPHYS                            aGCPhysHandlers[PGM_POST_COPY_MAX_HANDLERS];
+} PGMPOSTCOPY;
+/** Pointer to the post-copy teleportation state. */
+typedef PGMPOSTCOPY *PPGMPOSTCOPY;
+
+
+/** The log2 of the number of entries in the saved page cache
+ * (PGM::paSaveDupPagesR3). */
+#define PGM_SAVE_DUP_PAGES_SHIFT        14
+
+/**
+ * Saved page cache entry.
+ *
+ * The cache is direct mapped by content hash and remembers which page of the
+ * current save pass had that content, so pages with the same content can be
+ * saved as references to it.
+ */
+typedef struct PGMSAVEDUPPAGE
+{
+    /** The content hash. */
+    uint64_t                            uHash;
+    /** The page that was saved with this content, NIL_RTGCPHYS if unused. */
+    RTGCPHYS                            GCPhys;
+} PGMSAVEDUPPAGE;
+/** Pointer to a saved page cache entry. */
+typedef PGMSAVEDUPPAGE *PPGMSAVEDUPPAGE;
+
+
 /**
  * RAM range for GC Phys to HC Phys conversion.
  *
@@ -3408,8 +3509,11 @@ typedef struct PGM
         uint32_t                    cIgnoredPages;
         /** Indicates that a live save operation is active.  */
         bool                        fActive;
+        /** Set when a RAM page state change could not be recorded in the dirty
+         * log, forcing the next scan to walk all the pages. */
+        bool volatile               fDirtyLogIncomplete;
         /** Padding. */
-        bool                        afReserved[2];
+        bool                        afReserved[1];
         /** The next history index. */
         uint8_t                     iDirtyPagesHistory;
         /** History of the total amount of dirty pages. */
@@ -3427,9 +3531,32 @@ typedef struct PGM
         uint64_t                    uSaveStartNS;
         /** Pages per second (for statistics). */
         uint32_t                    cPagesPerSecond;
+        /** The number of guest physical pages covered by the dirty log. */
+        uint32_t                    cDirtyLogPages;
+        /** The dirty log - R0 pointer.
+         * This is a bitmap with one bit per guest physical page which is set
+         * when a RAM page changes state after the scanner has seen it (written
+         * to after being write monitored, allocated, freed), so the scans
+         * between the first and the final pass only have to visit those.  */
+        R0PTRTYPE(uint32_t volatile *) pbmDirtyLogR0;
+        /** The dirty log - R3 pointer. */
+        R3PTRTYPE(uint32_t volatile *) pbmDirtyLogR3;
+        /** The nanosecond timestamp of the previous RAM scan. */
+        uint64_t                    uLastScanNS;
+        /** Pages dirtied per second between the last two RAM scans. */
+        uint32_t                    cDirtiedPagesPerSecond;
         uint32_t                    cAlignment;
     } LiveSave;
 
+    /** Post-copy teleportation state, NULL until first used (ring-3 only). */
+    R3PTRTYPE(PPGMPOSTCOPY)         pPostCopyR3;
+    /** The RAM pages saved so far in the current pass, for sending duplicates
+     * as references (ring-3 only).  NULL until first used. */
+    R3PTRTYPE(PPGMSAVEDUPPAGE)      paSaveDupPagesR3;
+    /** The number of RAM pages saved as references to duplicates. */
+    uint32_t                        cSaveDupPages;
+    uint32_t                        u32SaveDupAlignment;
+
     /** @name   Error injection.
      * @{ */
     /** Inject handy page allocation errors pretending we're completely out of
@@ -4026,13 +4153,17 @@ void            pgmHandlerVirtualDumpPhysPages(PVM pVM);
 #endif
 DECLCALLBACK(void) pgmR3InfoHandlers(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
 int             pgmR3InitSavedState(PVM pVM, uint64_t cbRam);
+int             pgmR3PhysPostCopyInitBitmap(PVM pVM);
+void            pgmR3PhysPostCopyTerm(PVM pVM);
+int             pgmR3PhysPostCopyMarkRemote(PVM pVM, RTGCPHYS GCPhys);
+int             pgmR3PhysPostCopyEnsurePage(PVM pVM, RTGCPHYS GCPhys);
 
 int             pgmPhysAllocPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysAllocLargePage(PVM pVM, RTGCPHYS GCPhys);
 int             pgmPhysRecheckLargePage(PVM pVM, RTGCPHYS GCPhys, PPGMPAGE pLargePage);
 int             pgmPhysPageLoadIntoTlb(PVM pVM, RTGCPHYS GCPhys);
 int             pgmPhysPageLoadIntoTlbWithPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
-void            pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage);
+void            pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysPageMakeWritable(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysPageMakeWritableAndMap(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, void **ppv);
 int             pgmPhysPageMap(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, void **ppv);
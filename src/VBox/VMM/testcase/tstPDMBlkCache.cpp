@@ -0,0 +1,468 @@
+/* $Id: tstPDMBlkCache.cpp $ */
+/** @file
+ * PDM Block Cache Testcase - Replacement with sequential scans.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/pdmblkcache.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/sg.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+#define TESTCASE    "tstPDMBlkCache"
+/** The size of the cache. */
+#define TST_CACHE_SIZE          _1M
+/** The sequential run after which accesses count as a scan. */
+#define TST_SCAN_THRESHOLD      _128K
+/** The size of each transfer (and thus of each cache entry). */
+#define TST_XFER_SIZE           _16K
+/** The number of entries in the hot set. */
+#define TST_HOT_ENTRIES         16
+/** The distance between the hot entries, so they don't look sequential. */
+#define TST_HOT_STRIDE          _64K
+/** Where the sequential scan starts. */
+#define TST_SCAN_OFFSET         (8 * _1M)
+/** The size of the sequential scan, well above the cache size. */
+#define TST_SCAN_SIZE           _4M
+/** Where the reads interleaved with the scan go, never cached. */
+#define TST_READ_OFFSET         (16 * _1M)
+/** The size of the medium. */
+#define TST_MEDIUM_SIZE         (TST_READ_OFFSET + TST_XFER_SIZE)
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A transfer the cache handed to the medium.
+ */
+typedef struct TSTXFER
+{
+    /** The next transfer in the queue. */
+    struct TSTXFER     *pNext;
+    /** The transfer direction. */
+    PDMBLKCACHEXFERDIR  enmXferDir;
+    /** The medium offset. */
+    uint64_t            off;
+    /** The number of bytes to transfer. */
+    size_t              cbXfer;
+    /** The S/G buffer of the cache. */
+    PCRTSGBUF           pcSgBuf;
+    /** The cache's handle for the transfer. */
+    PPDMBLKCACHEIOXFER  hIoXfer;
+} TSTXFER;
+/** Pointer to a transfer. */
+typedef TSTXFER *PTSTXFER;
+
+/**
+ * A request to the cache.
+ */
+typedef struct TSTREQ
+{
+    /** Set when the request completed. */
+    bool                fDone;
+    /** The status of the request. */
+    int                 rc;
+} TSTREQ;
+/** Pointer to a request. */
+typedef TSTREQ *PTSTREQ;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** the error count. */
+static int          g_cErrors = 0;
+/** The scan threshold for the VM being created. */
+static uint64_t     g_cbScanThreshold = TST_SCAN_THRESHOLD;
+/** The medium content. */
+static uint8_t     *g_pbMedium = NULL;
+/** The block cache user. */
+static PPDMBLKCACHE g_pBlkCache = NULL;
+/** The queue of transfers to the medium. */
+static PTSTXFER     g_pXferHead = NULL;
+/** The tail of the queue of transfers to the medium. */
+static PTSTXFER     g_pXferTail = NULL;
+/** The number of reads the cache did from the medium. */
+static uint32_t     g_cMediumReads = 0;
+
+
+/**
+ * Fills a buffer with the pattern for the given offset and tag.
+ *
+ * @param   pb          The buffer.
+ * @param   off         The medium offset.
+ * @param   cb          The buffer size.
+ * @param   uTag        Distinguishes the different writes to the same offset.
+ */
+static void tstPDMBlkCacheFill(uint8_t *pb, uint64_t off, size_t cb, uint32_t uTag)
+{
+    uint32_t *pu32 = (uint32_t *)pb;
+    for (size_t i = 0; i < cb / sizeof(uint32_t); i++)
+        pu32[i] = (uint32_t)(off + i * sizeof(uint32_t)) ^ uTag;
+}
+
+
+/**
+ * @copydoc FNPDMBLKCACHEXFERCOMPLETEINT
+ */
+static DECLCALLBACK(void) tstPDMBlkCacheXferComplete(void *pvUserInt, void *pvUser, int rc)
+{
+    PTSTREQ pReq = (PTSTREQ)pvUser;
+    NOREF(pvUserInt);
+    pReq->rc    = rc;
+    pReq->fDone = true;
+}
+
+
+/**
+ * @copydoc FNPDMBLKCACHEXFERENQUEUEINT
+ *
+ * The transfers are queued and carried out by tstPDMBlkCacheProcessXfers, as
+ * the cache may hold locks while enqueuing.
+ */
+static DECLCALLBACK(int) tstPDMBlkCacheXferEnqueue(void *pvUser, PDMBLKCACHEXFERDIR enmXferDir,
+                                                   uint64_t off, size_t cbXfer,
+                                                   PCRTSGBUF pcSgBuf, PPDMBLKCACHEIOXFER hIoXfer)
+{
+    NOREF(pvUser);
+    AssertReturn(   enmXferDir == PDMBLKCACHEXFERDIR_READ
+                 || enmXferDir == PDMBLKCACHEXFERDIR_WRITE, VERR_NOT_SUPPORTED);
+    AssertReturn(off + cbXfer <= TST_MEDIUM_SIZE, VERR_OUT_OF_RANGE);
+
+    PTSTXFER pXfer = (PTSTXFER)RTMemAllocZ(sizeof(TSTXFER));
+    if (!pXfer)
+        return VERR_NO_MEMORY;
+    pXfer->enmXferDir = enmXferDir;
+    pXfer->off        = off;
+    pXfer->cbXfer     = cbXfer;
+    pXfer->pcSgBuf    = pcSgBuf;
+    pXfer->hIoXfer    = hIoXfer;
+    if (g_pXferTail)
+        g_pXferTail->pNext = pXfer;
+    else
+        g_pXferHead = pXfer;
+    g_pXferTail = pXfer;
+
+    if (enmXferDir == PDMBLKCACHEXFERDIR_READ)
+        g_cMediumReads++;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @copydoc FNPDMBLKCACHEXFERENQUEUEDISCARDINT
+ */
+static DECLCALLBACK(int) tstPDMBlkCacheXferEnqueueDiscard(void *pvUser, PCRTRANGE paRanges, unsigned cRanges,
+                                                          PPDMBLKCACHEIOXFER hIoXfer)
+{
+    NOREF(pvUser); NOREF(paRanges); NOREF(cRanges); NOREF(hIoXfer);
+    return VERR_NOT_SUPPORTED;
+}
+
+
+/**
+ * Carries out the queued transfers, including those queued while doing so.
+ */
+static void tstPDMBlkCacheProcessXfers(void)
+{
+    while (g_pXferHead)
+    {
+        PTSTXFER pXfer = g_pXferHead;
+        g_pXferHead = pXfer->pNext;
+        if (!g_pXferHead)
+            g_pXferTail = NULL;
+
+        RTSGBUF SgBuf;
+        RTSgBufClone(&SgBuf, pXfer->pcSgBuf);
+        if (pXfer->enmXferDir == PDMBLKCACHEXFERDIR_READ)
+            RTSgBufCopyFromBuf(&SgBuf, &g_pbMedium[pXfer->off], pXfer->cbXfer);
+        else
+            RTSgBufCopyToBuf(&SgBuf, &g_pbMedium[pXfer->off], pXfer->cbXfer);
+        PDMR3BlkCacheIoXferComplete(g_pBlkCache, pXfer->hIoXfer, VINF_SUCCESS);
+        RTMemFree(pXfer);
+    }
+}
+
+
+/**
+ * Reads from or writes to the cache and waits for the request to complete.
+ *
+ * @returns VBox status code of the request.
+ * @param   fWrite      Whether to write.
+ * @param   off         The medium offset.
+ * @param   pb          The buffer.
+ * @param   cb          The number of bytes to transfer.
+ */
+static int tstPDMBlkCacheIo(bool fWrite, uint64_t off, uint8_t *pb, size_t cb)
+{
+    TSTREQ  Req = { false, VINF_SUCCESS };
+    RTSGSEG Seg = { pb, cb };
+    RTSGBUF SgBuf;
+    RTSgBufInit(&SgBuf, &Seg, 1);
+
+    int rc = fWrite
+           ? PDMR3BlkCacheWrite(g_pBlkCache, off, &SgBuf, cb, &Req)
+           : PDMR3BlkCacheRead(g_pBlkCache, off, &SgBuf, cb, &Req);
+    tstPDMBlkCacheProcessXfers();
+    if (rc == VINF_AIO_TASK_PENDING)
+    {
+        if (!Req.fDone)
+        {
+            RTPrintf(TESTCASE ": %s at %#llx did not complete\n", fWrite ? "Write" : "Read", off);
+            return VERR_INTERNAL_ERROR;
+        }
+        rc = Req.rc;
+    }
+    if (RT_FAILURE(rc))
+        RTPrintf(TESTCASE ": %s at %#llx -> %Rrc\n", fWrite ? "Write" : "Read", off, rc);
+    return rc;
+}
+
+
+/**
+ * Writes a hot set, scans the medium sequentially and checks whether the hot
+ * set survived, EMT.
+ *
+ * The cache commits every write right away (CacheCommitIntervalMs is 0), so
+ * all entries are clean and may be evicted once the transfers are done.  A
+ * read interleaved with each scan write must neither be cached nor disturb
+ * the scan detection, as the read cache is disabled.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ * @param   fScanDetection  Whether scan detection is enabled for this VM.
+ */
+static DECLCALLBACK(int) tstPDMBlkCacheScan(PVM pVM, bool fScanDetection)
+{
+    static uint8_t s_abBuf[TST_XFER_SIZE];
+    static uint8_t s_abExpected[TST_XFER_SIZE];
+
+    int rc = PDMR3BlkCacheRetainInt(pVM, NULL, &g_pBlkCache, tstPDMBlkCacheXferComplete,
+                                    tstPDMBlkCacheXferEnqueue, tstPDMBlkCacheXferEnqueueDiscard, TESTCASE);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": PDMR3BlkCacheRetainInt -> %Rrc\n", rc);
+        return rc;
+    }
+
+    /*
+     * The hot set.
+     */
+    for (unsigned i = 0; i < TST_HOT_ENTRIES && RT_SUCCESS(rc); i++)
+    {
+        uint64_t off = (uint64_t)i * TST_HOT_STRIDE;
+        tstPDMBlkCacheFill(s_abBuf, off, sizeof(s_abBuf), 1);
+        rc = tstPDMBlkCacheIo(true /*fWrite*/, off, s_abBuf, sizeof(s_abBuf));
+    }
+
+    /*
+     * The scan, reading the same uncached block in between.  Each of these
+     * reads has to go to the medium.
+     */
+    uint32_t const cScanWrites = TST_SCAN_SIZE / TST_XFER_SIZE;
+    g_cMediumReads = 0;
+    for (uint32_t i = 0; i < cScanWrites && RT_SUCCESS(rc); i++)
+    {
+        uint64_t off = TST_SCAN_OFFSET + (uint64_t)i * TST_XFER_SIZE;
+        tstPDMBlkCacheFill(s_abBuf, off, sizeof(s_abBuf), 2);
+        rc = tstPDMBlkCacheIo(true /*fWrite*/, off, s_abBuf, sizeof(s_abBuf));
+        if (RT_SUCCESS(rc))
+            rc = tstPDMBlkCacheIo(false /*fWrite*/, TST_READ_OFFSET, s_abBuf, sizeof(s_abBuf));
+    }
+    if (RT_SUCCESS(rc) && g_cMediumReads != cScanWrites)
+    {
+        RTPrintf(TESTCASE ": %u reads from the medium during the scan, expected %u - reads got cached?\n",
+                 g_cMediumReads, cScanWrites);
+        g_cErrors++;
+    }
+
+    /*
+     * Read the hot set back, which must come from the cache with scan
+     * detection enabled and not without.
+     */
+    g_cMediumReads = 0;
+    for (unsigned i = 0; i < TST_HOT_ENTRIES && RT_SUCCESS(rc); i++)
+    {
+        uint64_t off = (uint64_t)i * TST_HOT_STRIDE;
+        rc = tstPDMBlkCacheIo(false /*fWrite*/, off, s_abBuf, sizeof(s_abBuf));
+        tstPDMBlkCacheFill(s_abExpected, off, sizeof(s_abExpected), 1);
+        if (RT_SUCCESS(rc) && memcmp(s_abBuf, s_abExpected, sizeof(s_abBuf)))
+        {
+            RTPrintf(TESTCASE ": Hot block at %#llx has wrong content\n", off);
+            g_cErrors++;
+        }
+    }
+    if (RT_SUCCESS(rc))
+    {
+        RTPrintf(TESTCASE ": Scan detection %s: %u of %u hot blocks read from the medium\n",
+                 fScanDetection ? "enabled" : "disabled", g_cMediumReads, TST_HOT_ENTRIES);
+        if (fScanDetection && g_cMediumReads)
+        {
+            RTPrintf(TESTCASE ": The scan evicted the hot set\n");
+            g_cErrors++;
+        }
+        else if (!fScanDetection && !g_cMediumReads)
+        {
+            RTPrintf(TESTCASE ": The hot set survived without scan detection, the test proves nothing\n");
+            g_cErrors++;
+        }
+    }
+
+    /* All the writes must have made it to the medium. */
+    for (uint32_t i = 0; i < cScanWrites && RT_SUCCESS(rc); i++)
+    {
+        uint64_t off = TST_SCAN_OFFSET + (uint64_t)i * TST_XFER_SIZE;
+        tstPDMBlkCacheFill(s_abExpected, off, sizeof(s_abExpected), 2);
+        if (memcmp(&g_pbMedium[off], s_abExpected, sizeof(s_abExpected)))
+        {
+            RTPrintf(TESTCASE ": Scan block at %#llx was not written to the medium\n", off);
+            g_cErrors++;
+            break;
+        }
+    }
+
+    tstPDMBlkCacheProcessXfers();
+    PDMR3BlkCacheRelease(g_pBlkCache);
+    g_pBlkCache = NULL;
+    return rc;
+}
+
+
+static DECLCALLBACK(int)
+tstPDMBlkCacheConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    NOREF(pUVM); NOREF(pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        rc = CFGMR3InsertInteger(pRoot, "HMEnabled", false);
+
+        PCFGMNODE pPdm = CFGMR3GetChild(pRoot, "PDM");
+        if (RT_SUCCESS(rc) && !pPdm)
+            rc = CFGMR3InsertNode(pRoot, "PDM", &pPdm);
+        PCFGMNODE pBlkCache = NULL;
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertNode(pPdm, "BlkCache", &pBlkCache);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pBlkCache, "CacheSize", TST_CACHE_SIZE);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertString(pBlkCache, "CachePolicy", "2Q");
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pBlkCache, "CacheScanThreshold", g_cbScanThreshold);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pBlkCache, "CacheCommitIntervalMs", 0);
+        if (RT_FAILURE(rc))
+            RTPrintf(TESTCASE ": failed to configure the VM, rc=%Rrc\n", rc);
+    }
+    return rc;
+}
+
+
+/**
+ * Creates a VM with or without scan detection and runs the scan test.
+ *
+ * @param   fScanDetection  Whether to enable scan detection.
+ */
+static void tstPDMBlkCacheRun(bool fScanDetection)
+{
+    RTPrintf(TESTCASE ": Scanning with scan detection %s...\n", fScanDetection ? "enabled" : "disabled");
+    g_cbScanThreshold = fScanDetection ? TST_SCAN_THRESHOLD : 0;
+    memset(g_pbMedium, 0, TST_MEDIUM_SIZE);
+
+    PVM  pVM;
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstPDMBlkCacheConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstPDMBlkCacheScan, 2, pVM, fScanDetection);
+        if (RT_FAILURE(rc))
+            g_cErrors++;
+
+        rc = VMR3Destroy(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to destroy vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        VMR3ReleaseUVM(pUVM);
+    }
+    else
+    {
+        RTPrintf(TESTCASE ": fatal error: failed to create vm! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+}
+
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    RTPrintf(TESTCASE ": TESTING...\n");
+    RTStrmFlush(g_pStdOut);
+
+    g_pbMedium = (uint8_t *)RTMemAllocZ(TST_MEDIUM_SIZE);
+    if (!g_pbMedium)
+    {
+        RTPrintf(TESTCASE ": fatal error: out of memory\n");
+        return 1;
+    }
+
+    tstPDMBlkCacheRun(true /*fScanDetection*/);
+    tstPDMBlkCacheRun(false /*fScanDetection*/);
+
+    RTMemFree(g_pbMedium);
+
+    /*
+     * Summary and return.
+     */
+    if (!g_cErrors)
+        RTPrintf(TESTCASE ": SUCCESS\n");
+    else
+        RTPrintf(TESTCASE ": FAILURE - %d errors\n", g_cErrors);
+
+    return !!g_cErrors;
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
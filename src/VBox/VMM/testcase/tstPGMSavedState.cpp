@@ -0,0 +1,564 @@
+/* $Id: tstPGMSavedState.cpp $ */
+/** @file
+ * PGM Testcase - Saved state round trips of guest RAM.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include "internal/pgm.h" /* PGMR3ResetNoMorePhysWritesFlag */
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/param.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/file.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+#define TESTCASE    "tstPGMSavedState"
+/** The guest physical address of the first test page. */
+#define TST_GCPHYS_FIRST    _1M
+/** The number of test pages (16MB). */
+#define TST_PAGES           4096
+/** The number of template pages the duplicate pages are copies of. */
+#define TST_TEMPLATES       8
+/** The number of pages dirtied after the last live pass. */
+#define TST_LATE_WRITES     64
+/** The saved state file. */
+#define TST_STATE_FILE      "tstPGMSavedState.sav"
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** the error count. */
+static int g_cErrors = 0;
+/** The expected content of the test pages. */
+static uint8_t *g_pabExpected = NULL;
+/** The template pages. */
+static uint8_t g_aabTemplates[TST_TEMPLATES][PAGE_SIZE];
+/** Tells the writer thread to stop. */
+static bool volatile g_fWriterStop = false;
+/** The number of times the writer thread got the live save statistics. */
+static uint32_t volatile g_cLiveStats = 0;
+/** The highest dirty rate reported by PGMR3QueryLiveSaveStats. */
+static uint64_t volatile g_cbMaxDirtiedPerSec = 0;
+
+
+/**
+ * Makes up new content for a test page, recording it as expected.
+ *
+ * Every fourth page is zero, every fourth is unique and the rest are copies of
+ * the template pages so the saved state gets duplicate page references.
+ *
+ * @returns Pointer to the new page content.
+ * @param   iPage       The test page index.
+ * @param   fInitial    Whether this is the initial content or a later write,
+ *                      the latter never produces zero pages.
+ */
+static uint8_t *tstPGMSavedStateMakePage(uint32_t iPage, bool fInitial)
+{
+    uint8_t *pbPage = &g_pabExpected[(size_t)iPage * PAGE_SIZE];
+    switch (fInitial ? iPage % 4 : RTRandU32Ex(1, 3))
+    {
+        case 0:
+            memset(pbPage, 0, PAGE_SIZE);
+            break;
+        case 1:
+            RTRandBytes(pbPage, PAGE_SIZE);
+            break;
+        default:
+            memcpy(pbPage, g_aabTemplates[RTRandU32Ex(0, TST_TEMPLATES - 1)], PAGE_SIZE);
+            break;
+    }
+    return pbPage;
+}
+
+
+/**
+ * Writes new content to a test page from a non-EMT thread.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   iPage       The test page index.
+ */
+static void tstPGMSavedStateWritePage(PVM pVM, uint32_t iPage)
+{
+    uint8_t *pbPage = tstPGMSavedStateMakePage(iPage, false /*fInitial*/);
+    int rc = PGMR3PhysWriteExternal(pVM, TST_GCPHYS_FIRST + (RTGCPHYS)iPage * PAGE_SIZE, pbPage, PAGE_SIZE, TESTCASE);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": PGMR3PhysWriteExternal(,%#x,) -> %Rrc\n", iPage, rc);
+        g_cErrors++;
+    }
+}
+
+
+/**
+ * Fills the test pages with their initial content, EMT.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ */
+static DECLCALLBACK(int) tstPGMSavedStateInitPages(PVM pVM)
+{
+    for (uint32_t iPage = 0; iPage < TST_PAGES; iPage++)
+    {
+        uint8_t *pbPage = tstPGMSavedStateMakePage(iPage, true /*fInitial*/);
+        int rc = PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_FIRST + (RTGCPHYS)iPage * PAGE_SIZE, pbPage, PAGE_SIZE);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Overwrites the test pages so a load that skips any of them is noticed, EMT.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ */
+static DECLCALLBACK(int) tstPGMSavedStateScribble(PVM pVM)
+{
+    uint8_t abPage[PAGE_SIZE];
+    memset(abPage, 0xcc, sizeof(abPage));
+    for (uint32_t iPage = 0; iPage < TST_PAGES; iPage++)
+    {
+        int rc = PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_FIRST + (RTGCPHYS)iPage * PAGE_SIZE, abPage, PAGE_SIZE);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks that the test pages have the expected content.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   pszWhat     What is being tested.
+ */
+static void tstPGMSavedStateCompare(PVM pVM, const char *pszWhat)
+{
+    uint32_t cBad = 0;
+    uint8_t  abPage[PAGE_SIZE];
+    for (uint32_t iPage = 0; iPage < TST_PAGES; iPage++)
+    {
+        int rc = PGMR3PhysReadExternal(pVM, TST_GCPHYS_FIRST + (RTGCPHYS)iPage * PAGE_SIZE, abPage, PAGE_SIZE);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": %s: PGMR3PhysReadExternal(,%#x,) -> %Rrc\n", pszWhat, iPage, rc);
+            g_cErrors++;
+            return;
+        }
+        if (memcmp(abPage, &g_pabExpected[(size_t)iPage * PAGE_SIZE], PAGE_SIZE))
+        {
+            if (cBad++ < 8)
+                RTPrintf(TESTCASE ": %s: page %#x does not match\n", pszWhat, iPage);
+        }
+    }
+    if (cBad)
+    {
+        RTPrintf(TESTCASE ": %s: %u of %u pages do not match\n", pszWhat, cBad, TST_PAGES);
+        g_cErrors++;
+    }
+}
+
+
+/**
+ * Scribbles over the test pages, loads the saved state and checks the pages.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pVM         Pointer to the VM.
+ * @param   pszWhat     What is being tested.
+ */
+static void tstPGMSavedStateLoadAndCompare(PUVM pUVM, PVM pVM, const char *pszWhat)
+{
+    int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstPGMSavedStateScribble, 1, pVM);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": %s: scribbling failed, rc=%Rrc\n", pszWhat, rc);
+        g_cErrors++;
+        return;
+    }
+
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)SSMR3Load, 7,
+                          pVM, TST_STATE_FILE, NULL, NULL, SSMAFTER_RESUME, NULL, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": %s: SSMR3Load -> %Rrc\n", pszWhat, rc);
+        g_cErrors++;
+        return;
+    }
+
+    tstPGMSavedStateCompare(pVM, pszWhat);
+}
+
+
+/**
+ * Saves the state the ordinary way and loads it again.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pVM         Pointer to the VM.
+ */
+static void tstPGMSavedStateNormal(PUVM pUVM, PVM pVM)
+{
+    RTPrintf(TESTCASE ": Saving and loading...\n");
+    int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)SSMR3Save, 7,
+                              pVM, TST_STATE_FILE, NULL, NULL, SSMAFTER_CONTINUE, NULL, NULL);
+    PGMR3ResetNoMorePhysWritesFlag(pVM);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": SSMR3Save -> %Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    tstPGMSavedStateLoadAndCompare(pUVM, pVM, "normal");
+}
+
+
+/**
+ * Thread dirtying test pages while the live passes are running.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hThreadSelf The thread handle.
+ * @param   pvUser      Pointer to the VM.
+ */
+static DECLCALLBACK(int) tstPGMSavedStateWriter(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVM pVM = (PVM)pvUser;
+    NOREF(hThreadSelf);
+
+    /* Keep the rate moderate so the live passes get a chance to converge.
+       Check out the dirty rate the teleporter would throttle the guest by
+       while at it. */
+    for (uint32_t i = 0; i < TST_PAGES * 4 && !ASMAtomicReadBool(&g_fWriterStop); i++)
+    {
+        tstPGMSavedStateWritePage(pVM, RTRandU32Ex(0, TST_PAGES - 1));
+        if (!(i % 16))
+        {
+            uint64_t cbDirtiedPerSec;
+            int rc = PGMR3QueryLiveSaveStats(pVM->pUVM, NULL, &cbDirtiedPerSec);
+            if (RT_SUCCESS(rc))
+            {
+                ASMAtomicIncU32(&g_cLiveStats);
+                if (cbDirtiedPerSec > ASMAtomicReadU64(&g_cbMaxDirtiedPerSec))
+                    ASMAtomicWriteU64(&g_cbMaxDirtiedPerSec, cbDirtiedPerSec);
+            }
+            RTThreadSleep(1);
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Saves the state live while the test pages are being modified and loads it
+ * again.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pVM         Pointer to the VM.
+ */
+static void tstPGMSavedStateLive(PUVM pUVM, PVM pVM)
+{
+    RTPrintf(TESTCASE ": Live saving and loading...\n");
+    int rc = PGMR3QueryLiveSaveStats(pUVM, NULL, NULL);
+    if (rc != VERR_INVALID_STATE)
+    {
+        RTPrintf(TESTCASE ": PGMR3QueryLiveSaveStats -> %Rrc before the live save, expected VERR_INVALID_STATE\n", rc);
+        g_cErrors++;
+    }
+
+    PSSMHANDLE pSSM = NULL;
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)SSMR3LiveSave, 9,
+                              pVM, 250 /*cMsMaxDowntime*/, TST_STATE_FILE, NULL, NULL, SSMAFTER_CONTINUE,
+                              NULL, NULL, &pSSM);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": SSMR3LiveSave -> %Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    /*
+     * Do the live passes with the writer thread dirtying pages underneath them.
+     */
+    ASMAtomicWriteBool(&g_fWriterStop, false);
+    ASMAtomicWriteU32(&g_cLiveStats, 0);
+    ASMAtomicWriteU64(&g_cbMaxDirtiedPerSec, 0);
+    RTTHREAD hThread;
+    rc = RTThreadCreate(&hThread, tstPGMSavedStateWriter, pVM, 0, RTTHREADTYPE_DEFAULT, RTTHREADFLAGS_WAITABLE, "Writer");
+    if (RT_SUCCESS(rc))
+    {
+        rc = SSMR3LiveDoStep1(pSSM);
+        if (RT_FAILURE(rc))
+            RTPrintf(TESTCASE ": SSMR3LiveDoStep1 -> %Rrc\n", rc);
+        ASMAtomicWriteBool(&g_fWriterStop, true);
+        RTThreadWait(hThread, RT_INDEFINITE_WAIT, NULL);
+
+        /* The scans between the passes must have noticed the writer. */
+        if (!g_cLiveStats || !g_cbMaxDirtiedPerSec)
+        {
+            RTPrintf(TESTCASE ": No dirty rate reported during the live passes (%u queries)\n", g_cLiveStats);
+            g_cErrors++;
+        }
+        else
+            RTPrintf(TESTCASE ": Highest dirty rate reported: %llu bytes/s\n", g_cbMaxDirtiedPerSec);
+    }
+    else
+        RTPrintf(TESTCASE ": RTThreadCreate -> %Rrc\n", rc);
+
+    /*
+     * Dirty a few pages after the last live pass; only the dirty log knows
+     * about these, so the final pass must pick them up.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        for (uint32_t i = 0; i < TST_LATE_WRITES; i++)
+            tstPGMSavedStateWritePage(pVM, RTRandU32Ex(0, TST_PAGES - 1));
+
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)SSMR3LiveDoStep2, 1, pSSM);
+        if (RT_FAILURE(rc))
+            RTPrintf(TESTCASE ": SSMR3LiveDoStep2 -> %Rrc\n", rc);
+    }
+
+    int rc2 = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)SSMR3LiveDone, 1, pSSM);
+    if (RT_FAILURE(rc2))
+        RTPrintf(TESTCASE ": SSMR3LiveDone -> %Rrc\n", rc2);
+    PGMR3ResetNoMorePhysWritesFlag(pVM);
+    int rc3 = PGMR3QueryLiveSaveStats(pUVM, NULL, NULL);
+    if (rc3 != VERR_INVALID_STATE)
+    {
+        RTPrintf(TESTCASE ": PGMR3QueryLiveSaveStats -> %Rrc after the live save, expected VERR_INVALID_STATE\n", rc3);
+        g_cErrors++;
+    }
+    if (RT_SUCCESS(rc))
+        rc = rc2;
+    if (RT_FAILURE(rc))
+    {
+        g_cErrors++;
+        return;
+    }
+
+    tstPGMSavedStateLoadAndCompare(pUVM, pVM, "live");
+}
+
+
+/**
+ * Fills the test pages with exact and near copies of the templates, EMT.
+ *
+ * Even pages are exact copies, odd pages differ from their template in a
+ * single byte and every eighth page is zero.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ */
+static DECLCALLBACK(int) tstPGMSavedStateInitDupPages(PVM pVM)
+{
+    for (uint32_t iPage = 0; iPage < TST_PAGES; iPage++)
+    {
+        uint8_t *pbPage = &g_pabExpected[(size_t)iPage * PAGE_SIZE];
+        if (!(iPage % 8))
+            memset(pbPage, 0, PAGE_SIZE);
+        else
+        {
+            memcpy(pbPage, g_aabTemplates[(iPage / 2) % TST_TEMPLATES], PAGE_SIZE);
+            if (iPage & 1)
+                pbPage[(iPage * 7) % PAGE_SIZE] ^= (uint8_t)(iPage | 1);
+        }
+        int rc = PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_FIRST + (RTGCPHYS)iPage * PAGE_SIZE, pbPage, PAGE_SIZE);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks that duplicate pages are saved as references and zero pages as
+ * markers, while pages differing in a single byte are saved in full.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pVM         Pointer to the VM.
+ */
+static void tstPGMSavedStateDuplicates(PUVM pUVM, PVM pVM)
+{
+    RTPrintf(TESTCASE ": Saving and loading duplicate pages...\n");
+    int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstPGMSavedStateInitDupPages, 1, pVM);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": failed to initialize the duplicate pages, rc=%Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)SSMR3Save, 7,
+                          pVM, TST_STATE_FILE, NULL, NULL, SSMAFTER_CONTINUE, NULL, NULL);
+    PGMR3ResetNoMorePhysWritesFlag(pVM);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": SSMR3Save -> %Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    /*
+     * The templates are random and thus incompressible.  Only the near copies
+     * and the first copy of each template should take a full page, if any of
+     * the exact copies or zero pages did the state exceeds the limit.  The
+     * rest of the VM (zero RAM, VRAM and the ROMs) fits well inside 2MB.
+     */
+    uint64_t cbFile = 0;
+    rc = RTFileQuerySize(TST_STATE_FILE, &cbFile);
+    uint64_t const cbMax = (uint64_t)(TST_PAGES / 2 + TST_TEMPLATES) * PAGE_SIZE + _2M;
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": RTFileQuerySize -> %Rrc\n", rc);
+        g_cErrors++;
+    }
+    else if (cbFile > cbMax)
+    {
+        RTPrintf(TESTCASE ": The saved state is %llu bytes, expected at most %llu - duplicate pages not detected?\n",
+                 cbFile, cbMax);
+        g_cErrors++;
+    }
+
+    /* A near copy saved as a reference would show up as a mismatch here. */
+    tstPGMSavedStateLoadAndCompare(pUVM, pVM, "duplicates");
+}
+
+
+static DECLCALLBACK(int)
+tstPGMSavedStateConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    NOREF(pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        /* Disable HM, otherwise it will fail on machines without unrestricted guest execution
+         * because the allocation of HM_VTX_TOTAL_DEVHEAP_MEM will fail -- no VMMDev */
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        rc = CFGMR3InsertInteger(pRoot, "HMEnabled", false);
+        if (RT_FAILURE(rc))
+            RTPrintf("CFGMR3InsertInteger(pRoot,\"HMEnabled\",) -> %Rrc\n", rc);
+    }
+    return rc;
+}
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    RTPrintf(TESTCASE ": TESTING...\n");
+    RTStrmFlush(g_pStdOut);
+
+    g_pabExpected = (uint8_t *)RTMemAlloc(TST_PAGES * PAGE_SIZE);
+    if (!g_pabExpected)
+    {
+        RTPrintf(TESTCASE ": fatal error: out of memory\n");
+        return 1;
+    }
+    for (unsigned i = 0; i < TST_TEMPLATES; i++)
+        RTRandBytes(g_aabTemplates[i], PAGE_SIZE);
+
+    /*
+     * Create empty VM.
+     */
+    PVM  pVM;
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstPGMSavedStateConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        /*
+         * Do testing.
+         */
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstPGMSavedStateInitPages, 1, pVM);
+        if (RT_SUCCESS(rc))
+        {
+            tstPGMSavedStateNormal(pUVM, pVM);
+            tstPGMSavedStateLive(pUVM, pVM);
+            tstPGMSavedStateDuplicates(pUVM, pVM);
+        }
+        else
+        {
+            RTPrintf(TESTCASE ": failed to initialize the test pages, rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        RTFileDelete(TST_STATE_FILE);
+
+        /*
+         * Cleanup.
+         */
+        rc = VMR3PowerOff(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to power off vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        rc = VMR3Destroy(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to destroy vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        VMR3ReleaseUVM(pUVM);
+    }
+    else
+    {
+        RTPrintf(TESTCASE ": fatal error: failed to create vm! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+    RTMemFree(g_pabExpected);
+
+    /*
+     * Summary and return.
+     */
+    if (!g_cErrors)
+        RTPrintf(TESTCASE ": SUCCESS\n");
+    else
+        RTPrintf(TESTCASE ": FAILURE - %d errors\n", g_cErrors);
+
+    return !!g_cErrors;
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
+
@@ -21,6 +21,7 @@
 *******************************************************************************/
 #include <VBox/vmm/ssm.h>
 #include "VMInternal.h" /* createFakeVM */
+#include "CFGMInternal.h" /* tstSSMSaveZipThreads */
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
 #include <VBox/vmm/mm.h>
@@ -683,6 +684,151 @@ static int createFakeVM(PVM *ppVM)
 }
 
 
+/**
+ * Saves the state with the given number of compression threads.
+ *
+ * @returns 0 on success, 1 on failure.
+ * @param   pVM             The cross context VM handle.
+ * @param   pszFilename     The file to save to.
+ * @param   cZipThreads     Number of compression threads, 0 for compressing
+ *                          everything on the calling thread.
+ */
+static int tstSSMSaveZipThreads(PVM pVM, const char *pszFilename, uint32_t cZipThreads)
+{
+    PCFGMNODE pNode = CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM");
+    CFGMR3RemoveValue(pNode, "ZipThreads");
+    int rc = CFGMR3InsertInteger(pNode, "ZipThreads", cZipThreads);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("CFGMR3InsertInteger(ZipThreads) -> %Rrc\n", rc);
+        return 1;
+    }
+
+    uint64_t u64Start = RTTimeNanoTS();
+    rc = SSMR3Save(pVM, pszFilename, NULL, NULL, SSMAFTER_DESTROY, NULL, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Save (%u compression threads) -> %Rrc\n", cZipThreads, rc);
+        return 1;
+    }
+    uint64_t u64Elapsed = RTTimeNanoTS() - u64Start;
+    RTPrintf("tstSSM: Saved with %u compression threads in %'RI64 ns\n", cZipThreads, u64Elapsed);
+    return 0;
+}
+
+
+/**
+ * Checks that the compression thread pool produces exactly the same stream
+ * as compressing on the calling thread and that it loads back.
+ *
+ * @returns 0 on success, 1 on failure.
+ * @param   pVM             The cross context VM handle.
+ */
+static int tstSSMZipPool(PVM pVM)
+{
+    const char *pszFilenameSerial = "SSMTestSave#2";
+    const char *pszFilenamePool   = "SSMTestSave#3";
+
+    /* The fake VM has no configuration tree, give it one. */
+    PCFGMNODE pRoot = CFGMR3CreateTree(pVM->pUVM);
+    if (!pRoot)
+    {
+        RTPrintf("CFGMR3CreateTree -> NULL\n");
+        return 1;
+    }
+    pVM->cfgm.s.pRoot = pRoot;
+    int rc = CFGMR3InsertNode(pRoot, "SSM", NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("CFGMR3InsertNode(SSM) -> %Rrc\n", rc);
+        return 1;
+    }
+
+    if (   tstSSMSaveZipThreads(pVM, pszFilenameSerial, 0)
+        || tstSSMSaveZipThreads(pVM, pszFilenamePool, 4))
+        return 1;
+
+    /*
+     * Compare the two files.
+     */
+    RTFILE hFileSerial;
+    rc = RTFileOpen(&hFileSerial, pszFilenameSerial, RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("RTFileOpen(%s) -> %Rrc\n", pszFilenameSerial, rc);
+        return 1;
+    }
+    RTFILE hFilePool;
+    rc = RTFileOpen(&hFilePool, pszFilenamePool, RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("RTFileOpen(%s) -> %Rrc\n", pszFilenamePool, rc);
+        RTFileClose(hFileSerial);
+        return 1;
+    }
+
+    uint64_t cbSerial = 0;
+    uint64_t cbPool = 0;
+    RTFileGetSize(hFileSerial, &cbSerial);
+    RTFileGetSize(hFilePool, &cbPool);
+    if (cbSerial != cbPool)
+    {
+        RTPrintf("tstSSM: Size mismatch, serial %'RU64 bytes, pool %'RU64 bytes\n", cbSerial, cbPool);
+        rc = VERR_INTERNAL_ERROR;
+    }
+
+    uint8_t *pbSerial = (uint8_t *)RTMemAlloc(_1M);
+    uint8_t *pbPool   = (uint8_t *)RTMemAlloc(_1M);
+    if (!pbSerial || !pbPool)
+        rc = VERR_NO_MEMORY;
+    for (uint64_t off = 0; off < cbSerial && RT_SUCCESS(rc); off += _1M)
+    {
+        size_t cbThis = (size_t)RT_MIN(cbSerial - off, _1M);
+        rc = RTFileRead(hFileSerial, pbSerial, cbThis, NULL);
+        if (RT_SUCCESS(rc))
+            rc = RTFileRead(hFilePool, pbPool, cbThis, NULL);
+        if (RT_SUCCESS(rc) && memcmp(pbSerial, pbPool, cbThis))
+        {
+            RTPrintf("tstSSM: Content mismatch in the %'RU64 bytes at offset %'RU64\n", (uint64_t)cbThis, off);
+            rc = VERR_INTERNAL_ERROR;
+        }
+    }
+    RTMemFree(pbSerial);
+    RTMemFree(pbPool);
+    RTFileClose(hFileSerial);
+    RTFileClose(hFilePool);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstSSM: Comparing the serial and pool output failed: %Rrc\n", rc);
+        return 1;
+    }
+    RTPrintf("tstSSM: Serial and pool output are identical (%'RU64 bytes)\n", cbSerial);
+
+    /*
+     * Load the pool output back.
+     */
+    rc = SSMR3Load(pVM, pszFilenamePool, NULL /*pStreamOps*/, NULL /*pStreamOpsUser*/,
+                   SSMAFTER_RESUME, NULL /*pfnProgress*/, NULL /*pvProgressUser*/);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Load (pool) -> %Rrc\n", rc);
+        return 1;
+    }
+    rc = SSMR3ValidateFile(pszFilenamePool, true /* fChecksumIt */);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3ValidateFile (pool) -> %Rrc\n", rc);
+        return 1;
+    }
+
+    RTFileDelete(pszFilenameSerial);
+    RTFileDelete(pszFilenamePool);
+    pVM->cfgm.s.pRoot = NULL;
+    CFGMR3DestroyTree(pRoot);
+    return 0;
+}
+
+
 /**
  *  Entry point.
  */
@@ -915,6 +1061,12 @@ extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
     /* delete */
     RTFileDelete(pszFilename);
 
+    /*
+     * Compression thread pool.
+     */
+    if (tstSSMZipPool(pVM))
+        return 1;
+
     RTPrintf("tstSSM: SUCCESS\n");
     return 0;
 }